@@ -49,6 +49,16 @@ fn main() {
         println!("cargo:rustc-link-lib=opendht-c");
     }
 
+    // Same for zstd
+    if opendht.contains("#define HAVE_ZSTD 1") {
+        println!("cargo:rustc-link-lib=zstd");
+    }
+
+    // And liburing, for the C SIP listener's io_uring backend
+    if opendht.contains("#define HAVE_LIBURING 1") {
+        println!("cargo:rustc-link-lib=uring");
+    }
+
     // The bindgen::Builder is the main entry point
     // to bindgen, and lets you build up options for
     // the resulting bindings.
@@ -60,7 +70,9 @@ fn main() {
         .clang_arg("-I/opt/homebrew/include")
         // Pick the functions we want to generate bindings for
         // conf.h
-        .allowlist_function("sentrypeer_config_new|sentrypeer_config_destroy")
+        .allowlist_function(
+            "sentrypeer_config_new|sentrypeer_config_destroy|sentrypeer_config_add_import_json_file",
+        )
         // sip_message_event.h
         .allowlist_function("sip_message_event_new|sip_message_event_destroy")
         // sip_daemon.h
@@ -79,6 +91,9 @@ fn main() {
         )
         // json_logger.h
         .allowlist_function("free_oauth2_access_token")
+        // metrics.h
+        .allowlist_function("metrics_add|metrics_start|metrics_observe|metrics_observe_ns")
+        .allowlist_item("METRICS_.*")
         // Set whether string constants should be generated as &CStr instead of &[u8].
         .generate_cstr(true)
         // Tell cargo to invalidate the built crate whenever any of the
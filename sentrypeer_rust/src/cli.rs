@@ -16,7 +16,10 @@ use std::ffi::{CStr, CString, c_char};
 use std::path::PathBuf;
 
 // Our C FFI functions
-use crate::{PACKAGE_NAME, PACKAGE_VERSION, sentrypeer_config, util_duplicate_string};
+use crate::{
+    PACKAGE_NAME, PACKAGE_VERSION, sentrypeer_config, sentrypeer_config_add_import_json_file,
+    util_duplicate_string,
+};
 
 pub fn cstr_to_string(cstr: &CStr) -> String {
     cstr.to_string_lossy().into_owned()
@@ -109,6 +112,22 @@ struct Args {
     /// Enable debug mode or use SENTRYPEER_DEBUG env
     #[arg(short)]
     debug: bool,
+
+    /// Log the SIP requests in a pcap or pcapng file, then exit
+    #[arg(long = "ingest-pcap", value_name = "PCAP_FILE")]
+    ingest_pcap: Option<PathBuf>,
+
+    /// Import a JSON log into the database, then exit. Repeat to import several
+    #[arg(long = "import-json", value_name = "JSON_LOG_FILE")]
+    import_json: Vec<PathBuf>,
+
+    /// Export the database to Parquet files by day in a directory, then exit. SENTRYPEER_PARQUET_ARCHIVE_DIR env does this hourly instead
+    #[arg(long = "export-parquet", value_name = "EXPORT_DIR")]
+    export_parquet: Option<PathBuf>,
+
+    /// Switch the database to incremental auto_vacuum and WAL with a full VACUUM, then exit. Stop SentryPeer first
+    #[arg(long = "vacuum")]
+    vacuum: bool,
 }
 
 /// # Safety
@@ -265,6 +284,32 @@ unsafe fn parse_args(
                 CString::new(config_file.to_str().ok_or("config_file is invalid.")?)?;
             (*sentrypeer_c_config).config_file = util_duplicate_string(config_file_c_str.as_ptr());
         }
+
+        if args.ingest_pcap.is_some() {
+            let ingest_pcap = args.ingest_pcap.ok_or("ingest_pcap is required.")?;
+            let ingest_pcap_c_str =
+                CString::new(ingest_pcap.to_str().ok_or("ingest_pcap is invalid.")?)?;
+            (*sentrypeer_c_config).ingest_pcap_file =
+                util_duplicate_string(ingest_pcap_c_str.as_ptr());
+        }
+
+        for import_json in args.import_json {
+            let import_json_c_str =
+                CString::new(import_json.to_str().ok_or("import_json is invalid.")?)?;
+            sentrypeer_config_add_import_json_file(sentrypeer_c_config, import_json_c_str.as_ptr());
+        }
+
+        if args.export_parquet.is_some() {
+            let export_parquet = args.export_parquet.ok_or("export_parquet is required.")?;
+            let export_parquet_c_str =
+                CString::new(export_parquet.to_str().ok_or("export_parquet is invalid.")?)?;
+            (*sentrypeer_c_config).export_parquet_dir =
+                util_duplicate_string(export_parquet_c_str.as_ptr());
+        }
+
+        if args.vacuum {
+            (*sentrypeer_c_config).vacuum_mode = true;
+        }
     }
 
     Ok(())
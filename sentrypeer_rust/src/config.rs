@@ -36,15 +36,26 @@ impl Default for Config {
             cert: "cert.pem".into(),
             key: "key.pem".into(),
             tls_listen_address: "0.0.0.0:5061".into(),
+            tls_session_cache_size: TLS_SESSION_CACHE_SIZE,
+            tls_ktls: false,
         }
     }
 }
 
+/// Sessions kept for stateful TLS resumption, on top of stateless tickets
+pub const TLS_SESSION_CACHE_SIZE: usize = 4096;
+
+// Anything missing from the config file is taken from `Default`
 #[derive(Debug, Serialize, Deserialize)]
+#[serde(default)]
 pub struct Config {
     pub cert: PathBuf,
     pub key: PathBuf,
     pub tls_listen_address: String,
+    /// 0 turns the server side session cache off, leaving just tickets
+    pub tls_session_cache_size: usize,
+    /// Hand TLS connections to the kernel (kTLS) once the handshake is done
+    pub tls_ktls: bool,
 }
 
 pub(crate) fn config_from_env(config: Config) -> Result<Config, Box<dyn std::error::Error>> {
@@ -68,10 +79,24 @@ pub(crate) fn config_from_env(config: Config) -> Result<Config, Box<dyn std::err
         .map_err(|e| io::Error::new(io::ErrorKind::InvalidData, e.to_string()))
         .or_else(|_| Ok::<String, io::Error>(config.tls_listen_address.clone()))?;
 
+    let tls_session_cache_size = match std::env::var("SENTRYPEER_TLS_SESSION_CACHE_SIZE") {
+        Ok(size) => size.parse::<usize>().map_err(|e| {
+            io::Error::new(
+                io::ErrorKind::InvalidInput,
+                format!("SENTRYPEER_TLS_SESSION_CACHE_SIZE must be a number: {e}"),
+            )
+        })?,
+        Err(_) => config.tls_session_cache_size,
+    };
+    // Like our other flags, set to anything to enable
+    let tls_ktls = std::env::var("SENTRYPEER_TLS_KTLS").is_ok() || config.tls_ktls;
+
     let config = Config {
         cert: PathBuf::from(cert),
         key: PathBuf::from(key),
         tls_listen_address,
+        tls_session_cache_size,
+        tls_ktls,
     };
 
     Ok(config)
@@ -99,6 +124,7 @@ pub(crate) fn config_from_cli(
         cert,
         key,
         tls_listen_address: tls_listen_address.to_string(),
+        ..config
     };
 
     Ok(config)
@@ -220,11 +246,30 @@ mod tests {
             cert: PathBuf::from("cert.pem"),
             key: PathBuf::from("key.pem"),
             tls_listen_address: "0.0.0.0:5061".into(),
+            ..Default::default()
         };
         config = config_from_env(config).unwrap();
         assert_eq!(config.cert, PathBuf::from("cert.pem"));
         assert_eq!(config.key, PathBuf::from("key.pem"));
         assert_eq!(config.tls_listen_address, "0.0.0.0:5061");
+        assert_eq!(config.tls_session_cache_size, TLS_SESSION_CACHE_SIZE);
+        assert!(!config.tls_ktls);
+
+        unsafe {
+            std::env::set_var("SENTRYPEER_TLS_SESSION_CACHE_SIZE", "0");
+            std::env::set_var("SENTRYPEER_TLS_KTLS", "1");
+        }
+        config = config_from_env(config).unwrap();
+        assert_eq!(config.tls_session_cache_size, 0);
+        assert!(config.tls_ktls);
+
+        unsafe { std::env::set_var("SENTRYPEER_TLS_SESSION_CACHE_SIZE", "lots") };
+        assert!(config_from_env(config).is_err());
+
+        unsafe {
+            std::env::remove_var("SENTRYPEER_TLS_SESSION_CACHE_SIZE");
+            std::env::remove_var("SENTRYPEER_TLS_KTLS");
+        }
     }
 
     #[test]
@@ -241,6 +286,7 @@ mod tests {
             cert: "cert.pem".into(),
             key: "key.pem".into(),
             tls_listen_address: "0.0.0.0:5061".into(),
+            ..Default::default()
         };
         confy::store("sentrypeer", None, cfg).unwrap();
     }
@@ -252,6 +298,8 @@ mod tests {
         assert_eq!(cfg.cert, PathBuf::from("cert.pem"));
         assert_eq!(cfg.key, PathBuf::from("key.pem"));
         assert_eq!(cfg.tls_listen_address, "0.0.0.0:5061");
+        assert_eq!(cfg.tls_session_cache_size, TLS_SESSION_CACHE_SIZE);
+        assert!(!cfg.tls_ktls);
     }
 
     #[test]
@@ -264,6 +312,8 @@ mod tests {
         assert_eq!(cfg.cert, PathBuf::from("cert.pem"));
         assert_eq!(cfg.key, PathBuf::from("key.pem"));
         assert_eq!(cfg.tls_listen_address, "0.0.0.0:5061");
+        // Not in the file
+        assert_eq!(cfg.tls_session_cache_size, TLS_SESSION_CACHE_SIZE);
     }
 
     #[test]
@@ -288,6 +338,7 @@ mod tests {
             cert: "cert2.pem".into(),
             key: "key2.pem".into(),
             tls_listen_address: "0.0.0.0:5062".into(),
+            ..Default::default()
         };
         confy::store("sentrypeer", None, cfg).unwrap();
 
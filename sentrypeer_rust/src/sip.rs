@@ -27,7 +27,7 @@ use tokio_rustls::{TlsAcceptor, rustls};
 
 use crate::config::{SentryPeerConfig, create_certs, load_all_configs, load_certs, load_key};
 use crate::tcp::handle_tcp_connection;
-use crate::tls::handle_tls_connection;
+use crate::tls::{handle_tls_connection, server_config};
 use crate::udp::handle_udp_connection;
 
 // Our C FFI functions
@@ -212,11 +212,10 @@ pub(crate) extern "C" fn run_sip_server(sentrypeer_c_config: *mut sentrypeer_con
             rustls::crypto::aws_lc_rs::default_provider()
                 .install_default()
                 .expect("Can't set crypto provider to aws_lc_rs");
-            let server_config = rustls::ServerConfig::builder()
-                .with_no_client_auth()
-                .with_single_cert(certs, key)
+            let server_config = server_config(&config, certs, key)
                 .map_err(|err| io::Error::new(io::ErrorKind::InvalidInput, err))
                 .unwrap();
+            let ktls = config.tls_ktls;
             let tls_acceptor = TlsAcceptor::from(Arc::new(server_config));
 
             let tls_listener = TcpListener::bind(addr)
@@ -243,6 +242,7 @@ pub(crate) extern "C" fn run_sip_server(sentrypeer_c_config: *mut sentrypeer_con
                             sentrypeer_config,
                             peer_addr,
                             addr,
+                            ktls,
                         )
                         .await
                         {
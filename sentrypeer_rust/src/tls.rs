@@ -10,12 +10,52 @@
                               __/ |
                              |___/
 */
-use crate::config::SentryPeerConfig;
+use crate::config::{Config, SentryPeerConfig};
 use crate::sip::{gen_sip_reply, log_sip_packet};
+use crate::{
+    METRICS_TLS_HANDSHAKE_CPU_SECONDS, METRICS_TLS_HANDSHAKE_FAILURES,
+    METRICS_TLS_HANDSHAKE_SECONDS, METRICS_TLS_HANDSHAKES, METRICS_TLS_KTLS_OFFLOADS,
+    METRICS_TLS_RESUMED_HANDSHAKES, metrics_add, metrics_observe, metrics_observe_ns,
+    metrics_start,
+};
+use pki_types::{CertificateDer, PrivateKeyDer};
+use std::future::Future;
 use std::net::SocketAddr;
+use std::pin::Pin;
+use std::sync::Arc;
+use std::task::{Context, Poll};
 use tokio::io::{AsyncReadExt, split};
 use tokio::net::TcpStream;
 use tokio_rustls::TlsAcceptor;
+use tokio_rustls::rustls;
+use tokio_rustls::rustls::server::{NoServerSessionStorage, ServerSessionMemoryCache};
+use tokio_rustls::server::TlsStream;
+
+/// Our rustls `ServerConfig`, tuned for lots of short lived connections from the same scanners.
+///
+/// Resumption skips the certificate and key exchange, which is most of the cost of a handshake.
+/// Stateless tickets cover TLS 1.2 and 1.3 clients that support them, with keys that rotate
+/// every 6 hours and tickets good for 12. Anything else can resume from a bounded server side
+/// cache, where new sessions push the oldest out.
+pub fn server_config(
+    config: &Config,
+    certs: Vec<CertificateDer<'static>>,
+    key: PrivateKeyDer<'static>,
+) -> Result<rustls::ServerConfig, rustls::Error> {
+    let mut server_config = rustls::ServerConfig::builder()
+        .with_no_client_auth()
+        .with_single_cert(certs, key)?;
+
+    server_config.ticketer = rustls::crypto::aws_lc_rs::Ticketer::new()?;
+    server_config.session_storage = if config.tls_session_cache_size > 0 {
+        ServerSessionMemoryCache::new(config.tls_session_cache_size)
+    } else {
+        Arc::new(NoServerSessionStorage {})
+    };
+    server_config.enable_secret_extraction = config.tls_ktls;
+
+    Ok(server_config)
+}
 
 pub async fn handle_tls_connection(
     stream: TcpStream,
@@ -23,9 +63,31 @@ pub async fn handle_tls_connection(
     sentrypeer_config: SentryPeerConfig,
     peer_addr: SocketAddr,
     addr: SocketAddr,
+    ktls: bool,
 ) -> Result<(), Box<dyn std::error::Error>> {
     let mut buf = [0; 1024];
-    let tls_stream = acceptor.accept(stream).await?;
+    let metrics = (unsafe { *sentrypeer_config.p }).metrics;
+
+    let started = unsafe { metrics_start(metrics) };
+    let (tls_stream, cpu_ns) = CpuTimed::new(acceptor.accept(stream)).await;
+    let tls_stream = match tls_stream {
+        Ok(tls_stream) => tls_stream,
+        Err(err) => {
+            unsafe { metrics_add(metrics, METRICS_TLS_HANDSHAKE_FAILURES as i32, 1) };
+            return Err(err.into());
+        }
+    };
+    let handshakes =
+        if tls_stream.get_ref().1.handshake_kind() == Some(rustls::HandshakeKind::Resumed) {
+            METRICS_TLS_RESUMED_HANDSHAKES
+        } else {
+            METRICS_TLS_HANDSHAKES
+        };
+    unsafe {
+        metrics_observe(metrics, METRICS_TLS_HANDSHAKE_SECONDS as i32, started);
+        metrics_observe_ns(metrics, METRICS_TLS_HANDSHAKE_CPU_SECONDS as i32, cpu_ns);
+        metrics_add(metrics, handshakes as i32, 1);
+    }
 
     let (mut reader, writer) = split(tls_stream);
     let bytes_read = reader.read(&mut buf).await?;
@@ -53,8 +115,297 @@ pub async fn handle_tls_connection(
     }
 
     if sip_responsive_mode {
-        gen_sip_reply(writer).await;
+        if !ktls {
+            gen_sip_reply(writer).await;
+            return Ok(());
+        }
+
+        match into_ktls(reader.unsplit(writer))? {
+            Offloaded::Kernel(stream) => {
+                unsafe { metrics_add(metrics, METRICS_TLS_KTLS_OFFLOADS as i32, 1) };
+                gen_sip_reply(split(stream).1).await;
+            }
+            Offloaded::Rustls(tls_stream) => {
+                gen_sip_reply(split(tls_stream).1).await;
+            }
+        }
+    }
+
+    Ok(())
+}
+
+/// Adds up the CPU time of whichever thread polls the future, while it's being polled. For a
+/// handshake that's the cost of the crypto, without waiting on the network.
+struct CpuTimed<F> {
+    inner: F,
+    cpu_ns: u64,
+}
+
+impl<F> CpuTimed<F> {
+    fn new(inner: F) -> Self {
+        CpuTimed { inner, cpu_ns: 0 }
+    }
+}
+
+impl<F: Future + Unpin> Future for CpuTimed<F> {
+    type Output = (F::Output, u64);
+
+    fn poll(mut self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Self::Output> {
+        let started = thread_cpu_ns();
+        let poll = Pin::new(&mut self.inner).poll(cx);
+        self.cpu_ns += thread_cpu_ns().saturating_sub(started);
+
+        poll.map(|output| (output, self.cpu_ns))
+    }
+}
+
+fn thread_cpu_ns() -> u64 {
+    let mut now = libc::timespec {
+        tv_sec: 0,
+        tv_nsec: 0,
+    };
+    unsafe { libc::clock_gettime(libc::CLOCK_THREAD_CPUTIME_ID, &mut now) };
+
+    now.tv_sec as u64 * 1_000_000_000 + now.tv_nsec as u64
+}
+
+/// Where the rest of a TLS connection goes
+enum Offloaded {
+    /// The kernel encrypts what's written to the socket
+    Kernel(TcpStream),
+    /// kTLS isn't available for this connection, so carry on as we were
+    Rustls(TlsStream<TcpStream>),
+}
+
+/// Hand sending on a TLS connection to the kernel. We only ever read one request, with rustls,
+/// so it's only the sending side that's set up; anything the client sends after that is never
+/// read. Falls back to rustls if the kernel, cipher suite or connection state won't allow it,
+/// which is all checked before rustls gives up the connection's secrets. There's no going back
+/// after that, so anything that fails then is an error and the connection is dropped.
+#[cfg(target_os = "linux")]
+fn into_ktls(tls_stream: TlsStream<TcpStream>) -> std::io::Result<Offloaded> {
+    use std::os::fd::AsRawFd;
+    use tokio_rustls::rustls::{ConnectionTrafficSecrets, ProtocolVersion};
+
+    let (stream, connection) = tls_stream.get_ref();
+    let version = match connection.protocol_version() {
+        Some(ProtocolVersion::TLSv1_2) => libc::TLS_1_2_VERSION,
+        Some(ProtocolVersion::TLSv1_3) => libc::TLS_1_3_VERSION,
+        _ => return Ok(Offloaded::Rustls(tls_stream)),
+    };
+    let Some(cipher_type) = connection
+        .negotiated_cipher_suite()
+        .and_then(|suite| ktls_cipher_type(suite.suite()))
+    else {
+        return Ok(Offloaded::Rustls(tls_stream));
+    };
+    // Tickets, or anything else rustls still has to send, would be lost
+    if connection.wants_write() {
+        return Ok(Offloaded::Rustls(tls_stream));
+    }
+    // Fails if the tls kernel module isn't there. Until TLS_TX is set the socket still sends
+    // as plain TCP, so rustls can carry on.
+    let fd = stream.as_raw_fd();
+    if setsockopt(fd, libc::SOL_TCP, libc::TCP_ULP, b"tls").is_err() {
+        return Ok(Offloaded::Rustls(tls_stream));
+    }
+
+    let (stream, connection) = tls_stream.into_inner();
+    let (seq, secrets) = connection
+        .dangerous_extract_secrets()
+        .map_err(|err| ktls_error(&err))?
+        .tx;
+    let rec_seq = seq.to_be_bytes();
+
+    // The kernel wants rustls' 12 byte IV split into a salt and the rest
+    let info = match secrets {
+        ConnectionTrafficSecrets::Aes128Gcm { key, iv } => {
+            let mut info: libc::tls12_crypto_info_aes_gcm_128 = unsafe { std::mem::zeroed() };
+            info.info.version = version;
+            info.info.cipher_type = cipher_type;
+            info.key.copy_from_slice(key.as_ref());
+            info.salt.copy_from_slice(&iv.as_ref()[..4]);
+            info.iv.copy_from_slice(&iv.as_ref()[4..]);
+            info.rec_seq = rec_seq;
+            as_bytes(&info).to_vec()
+        }
+        ConnectionTrafficSecrets::Aes256Gcm { key, iv } => {
+            let mut info: libc::tls12_crypto_info_aes_gcm_256 = unsafe { std::mem::zeroed() };
+            info.info.version = version;
+            info.info.cipher_type = cipher_type;
+            info.key.copy_from_slice(key.as_ref());
+            info.salt.copy_from_slice(&iv.as_ref()[..4]);
+            info.iv.copy_from_slice(&iv.as_ref()[4..]);
+            info.rec_seq = rec_seq;
+            as_bytes(&info).to_vec()
+        }
+        ConnectionTrafficSecrets::Chacha20Poly1305 { key, iv } => {
+            let mut info: libc::tls12_crypto_info_chacha20_poly1305 = unsafe { std::mem::zeroed() };
+            info.info.version = version;
+            info.info.cipher_type = cipher_type;
+            info.key.copy_from_slice(key.as_ref());
+            info.iv.copy_from_slice(iv.as_ref());
+            info.rec_seq = rec_seq;
+            as_bytes(&info).to_vec()
+        }
+        // Not one of the suites ktls_cipher_type() allowed
+        _ => return Err(ktls_error(&"secrets for an unexpected cipher suite")),
+    };
+    setsockopt(fd, libc::SOL_TLS, libc::TLS_TX, &info).map_err(|err| ktls_error(&err))?;
+
+    Ok(Offloaded::Kernel(stream))
+}
+
+/// The kernel's name for a cipher suite it can encrypt with
+#[cfg(target_os = "linux")]
+fn ktls_cipher_type(suite: rustls::CipherSuite) -> Option<u16> {
+    use tokio_rustls::rustls::CipherSuite;
+
+    match suite {
+        CipherSuite::TLS13_AES_128_GCM_SHA256
+        | CipherSuite::TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256
+        | CipherSuite::TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256 => Some(libc::TLS_CIPHER_AES_GCM_128),
+        CipherSuite::TLS13_AES_256_GCM_SHA384
+        | CipherSuite::TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384
+        | CipherSuite::TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384 => Some(libc::TLS_CIPHER_AES_GCM_256),
+        CipherSuite::TLS13_CHACHA20_POLY1305_SHA256
+        | CipherSuite::TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256
+        | CipherSuite::TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256 => {
+            Some(libc::TLS_CIPHER_CHACHA20_POLY1305)
+        }
+        _ => None,
+    }
+}
+
+/// rustls no longer has the connection, so it can't be handed back
+#[cfg(target_os = "linux")]
+fn ktls_error(err: &dyn std::fmt::Display) -> std::io::Error {
+    std::io::Error::other(format!(
+        "kTLS: {err}, after rustls gave up the connection, so dropping it"
+    ))
+}
+
+#[cfg(not(target_os = "linux"))]
+fn into_ktls(tls_stream: TlsStream<TcpStream>) -> std::io::Result<Offloaded> {
+    Ok(Offloaded::Rustls(tls_stream))
+}
+
+#[cfg(target_os = "linux")]
+fn as_bytes<T>(value: &T) -> &[u8] {
+    unsafe { std::slice::from_raw_parts(value as *const T as *const u8, size_of::<T>()) }
+}
+
+#[cfg(target_os = "linux")]
+fn setsockopt(
+    fd: std::os::fd::RawFd,
+    level: libc::c_int,
+    name: libc::c_int,
+    value: &[u8],
+) -> std::io::Result<()> {
+    let ret = unsafe {
+        libc::setsockopt(
+            fd,
+            level,
+            name,
+            value.as_ptr() as *const libc::c_void,
+            value.len() as libc::socklen_t,
+        )
+    };
+    if ret != 0 {
+        return Err(std::io::Error::last_os_error());
     }
 
     Ok(())
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use tokio::io::AsyncWriteExt;
+
+    #[test]
+    fn test_server_config() {
+        rustls::crypto::aws_lc_rs::default_provider()
+            .install_default()
+            .ok();
+        let rcgen::CertifiedKey { cert, signing_key } =
+            rcgen::generate_simple_self_signed(vec!["localhost".to_string()]).unwrap();
+        let certs = vec![cert.der().clone()];
+        let key = PrivateKeyDer::try_from(signing_key.serialize_der()).unwrap();
+
+        let config = Config {
+            tls_session_cache_size: 16,
+            tls_ktls: true,
+            ..Default::default()
+        };
+        let server_config = server_config(&config, certs, key).unwrap();
+        assert!(server_config.ticketer.enabled());
+        assert!(server_config.session_storage.can_cache());
+        assert!(server_config.enable_secret_extraction);
+    }
+
+    #[tokio::test]
+    async fn test_resumed_handshake() {
+        rustls::crypto::aws_lc_rs::default_provider()
+            .install_default()
+            .ok();
+        let rcgen::CertifiedKey { cert, signing_key } =
+            rcgen::generate_simple_self_signed(vec!["localhost".to_string()]).unwrap();
+        let mut roots = rustls::RootCertStore::empty();
+        roots.add(cert.der().clone()).unwrap();
+        let connector = tokio_rustls::TlsConnector::from(Arc::new(
+            rustls::ClientConfig::builder()
+                .with_root_certificates(roots)
+                .with_no_client_auth(),
+        ));
+
+        let config = Config {
+            tls_session_cache_size: 16,
+            ..Default::default()
+        };
+        let key = PrivateKeyDer::try_from(signing_key.serialize_der()).unwrap();
+        let acceptor = TlsAcceptor::from(Arc::new(
+            server_config(&config, vec![cert.der().clone()], key).unwrap(),
+        ));
+        let listener = tokio::net::TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let addr = listener.local_addr().unwrap();
+
+        // The same client twice, so the second time it has a session to resume
+        let mut handshake_kinds = Vec::new();
+        for _ in 0..2 {
+            let connector = connector.clone();
+            let client = tokio::spawn(async move {
+                let stream = TcpStream::connect(addr).await.unwrap();
+                let server_name = pki_types::ServerName::try_from("localhost").unwrap();
+                let mut tls_stream = connector.connect(server_name, stream).await.unwrap();
+                // Reading to the end picks up the session tickets
+                let mut buf = Vec::new();
+                tls_stream.read_to_end(&mut buf).await.unwrap();
+            });
+
+            let (stream, _) = listener.accept().await.unwrap();
+            let mut tls_stream = acceptor.accept(stream).await.unwrap();
+            handshake_kinds.push(tls_stream.get_ref().1.handshake_kind());
+            tls_stream.shutdown().await.unwrap();
+            client.await.unwrap();
+        }
+        assert_eq!(
+            handshake_kinds,
+            [
+                Some(rustls::HandshakeKind::Full),
+                Some(rustls::HandshakeKind::Resumed)
+            ]
+        );
+    }
+
+    #[tokio::test]
+    async fn test_cpu_timed() {
+        let (output, cpu_ns) = CpuTimed::new(Box::pin(async {
+            // Something to time
+            (0..100_000u64).fold(0u64, |sum, i| sum.wrapping_add(i * i))
+        }))
+        .await;
+        assert_eq!(output, 333328333350000);
+        assert!(cpu_ns > 0);
+    }
+}
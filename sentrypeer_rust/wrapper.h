@@ -19,3 +19,4 @@
 #include "../src/bad_actor.h"
 #include "../src/http_daemon.h"
 #include "../src/json_logger.h"
+#include "../src/metrics.h"
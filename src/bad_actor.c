@@ -22,6 +22,13 @@
 #include <syslog.h>
 
 #include "database.h"
+#include "ip_prefix_tree.h"
+#include "ip_address_log.h"
+#include "heavy_hitters.h"
+#include "event_series.h"
+#include "geoip.h"
+#include "event_stream.h"
+#include "metrics.h"
 #include "json_logger.h"
 #include "utils.h"
 
@@ -73,7 +80,7 @@ bad_actor *bad_actor_new(char *sip_message, char *source_ip,
 	assert(uuid_string);
 
 	self->event_timestamp = event_timestamp(time_str);
-	self->event_uuid = util_uuid_generate_string(uuid_string);
+	self->event_uuid = util_uuid7_generate_string(uuid_string);
 	self->sip_message = sip_message;
 	self->source_ip = source_ip;
 	self->destination_ip = destination_ip;
@@ -85,11 +92,61 @@ bad_actor *bad_actor_new(char *sip_message, char *source_ip,
 	self->created_by_node_id = util_duplicate_string(created_by_node_id);
 	self->seen_last = 0;
 	self->seen_count = 0;
+	self->arena = 0;
 
 	return self;
 }
 
-int bad_actor_log(sentrypeer_config *config, const bad_actor *bad_actor_event)
+void bad_actor_index(sentrypeer_config const *config,
+		     const bad_actor *bad_actor_event)
+{
+	// Only built in API mode
+	time_t now = time(NULL);
+	if (config->ip_prefix_tree != 0) {
+		ip_prefix_tree_insert(config->ip_prefix_tree,
+				      bad_actor_event->source_ip, now, 1);
+	}
+	if (config->ip_address_log != 0) {
+		ip_address_log_add(config->ip_address_log,
+				   bad_actor_event->source_ip, now);
+	}
+	if (config->user_agents != 0) {
+		heavy_hitters_add(config->user_agents,
+				  bad_actor_event->user_agent, now, now, 1);
+	}
+	if (config->sip_methods != 0) {
+		heavy_hitters_add(config->sip_methods, bad_actor_event->method,
+				  now, now, 1);
+	}
+	if (config->event_series != 0) {
+		// Clamped the same as the partition it went in
+		event_series_add(config->event_series,
+				 util_event_time(bad_actor_event->event_timestamp,
+						 now),
+				 bad_actor_event->method,
+				 bad_actor_event->transport_type,
+				 bad_actor_event->collected_method, 1);
+	}
+	// A cache hit, db_insert_bad_actor() has already looked it up
+	geoip_result location;
+	if (config->geoip != 0 && config->countries != 0 &&
+	    geoip_lookup(config->geoip, bad_actor_event->source_ip,
+			 &location) == EXIT_SUCCESS &&
+	    location.country_code[0] != '\0') {
+		heavy_hitters_add(config->countries, location.country_code,
+				  now, now, 1);
+		if (config->cities != 0 && location.city[0] != '\0') {
+			char city_key[HEAVY_HITTERS_MAX_KEY_LEN];
+			snprintf(city_key, sizeof(city_key), "%s/%s",
+				 location.country_code, location.city);
+			heavy_hitters_add(config->cities, city_key, now, now,
+					  1);
+		}
+	}
+}
+
+int bad_actor_log(sentrypeer_config *config, const bad_actor *bad_actor_event,
+		  json_buffer *json)
 {
 	if (config->syslog_mode) {
 		syslog(LOG_NOTICE, "Source IP: %s, Method: %s, Agent: %s\n",
@@ -97,52 +154,94 @@ int bad_actor_log(sentrypeer_config *config, const bad_actor *bad_actor_event)
 		       bad_actor_event->user_agent);
 	}
 
+	// Only counted in API mode, config->metrics is NULL otherwise
+	uint64_t started = metrics_start(config->metrics);
+	// Without new_mode, the Rust build doesn't write or POST anything here
+	bool json_logged = false;
 #if HAVE_RUST != 0
 	if (config->new_mode == true) {
 		if (config->json_log_mode &&
 		    (json_log_bad_actor_rs(config, bad_actor_event) !=
 		     EXIT_SUCCESS)) {
+			metrics_add(config->metrics, METRICS_JSON_LOG_FAILURES,
+				    1);
 			fprintf(stderr, "Saving bad_actor json to %s failed.\n",
 				config->json_log_file);
 			return EXIT_FAILURE;
 		}
+		json_logged = config->json_log_mode;
 	}
 #else
 	if (config->json_log_mode &&
-	    (json_log_bad_actor(config, bad_actor_event) != EXIT_SUCCESS)) {
+	    (bad_actor_json_once(config, bad_actor_event, json) == NULL ||
+	     json_log_bad_actor_json(config, json->data) != EXIT_SUCCESS)) {
+		metrics_add(config->metrics, METRICS_JSON_LOG_FAILURES, 1);
 		fprintf(stderr, "Saving bad_actor json to %s failed.\n",
 			config->json_log_file);
 		return EXIT_FAILURE;
 	}
+	json_logged = config->json_log_mode;
 #endif
+	if (json_logged) {
+		metrics_observe(config->metrics, METRICS_JSON_LOG_SECONDS,
+				started);
+		metrics_add(config->metrics, METRICS_JSON_LOGS, 1);
+	}
 
+	started = metrics_start(config->metrics);
 	if (db_insert_bad_actor(bad_actor_event, config) != EXIT_SUCCESS) {
+		metrics_add(config->metrics, METRICS_DB_INSERT_FAILURES, 1);
 		fprintf(stderr, "Saving bad actor to db failed\n");
 		return EXIT_FAILURE;
 	}
+	metrics_observe(config->metrics, METRICS_DB_INSERT_SECONDS, started);
+	metrics_add(config->metrics, METRICS_DB_INSERTS, 1);
+
+	bad_actor_index(config, bad_actor_event);
+	if (config->event_stream != 0 &&
+	    event_stream_has_subscribers(config->event_stream)) {
+		const char *event_json =
+			bad_actor_json_once(config, bad_actor_event, json);
+		if (event_json != 0) {
+			event_stream_publish(config->event_stream, event_json);
+		}
+	}
 
+	started = metrics_start(config->metrics);
+	bool webhook_posted = false;
 #if HAVE_RUST != 0
 	if (config->new_mode == true) {
 		if (config->webhook_mode &&
 		    (json_http_post_bad_actor_rs(config, bad_actor_event) !=
 		     EXIT_SUCCESS)) {
+			metrics_add(config->metrics, METRICS_WEBHOOK_FAILURES,
+				    1);
 			fprintf(stderr,
 				"POSTing bad_actor json to URL '%s' failed.\n",
 				config->webhook_url);
 			// Just log failing WebHook POSTs
 			return EXIT_SUCCESS;
 		}
+		webhook_posted = config->webhook_mode;
 	}
 #else
 	if (config->webhook_mode &&
-	    (json_http_post_bad_actor(config, bad_actor_event) !=
-	     EXIT_SUCCESS)) {
+	    (bad_actor_json_once(config, bad_actor_event, json) == NULL ||
+	     json_http_post_bad_actor_json(config, json->data) !=
+		     EXIT_SUCCESS)) {
+		metrics_add(config->metrics, METRICS_WEBHOOK_FAILURES, 1);
 		fprintf(stderr, "POSTing bad_actor json to URL '%s' failed.\n",
 			config->webhook_url);
 		// Just log failing WebHook POSTs
 		return EXIT_SUCCESS;
 	}
+	webhook_posted = config->webhook_mode;
 #endif
+	if (webhook_posted) {
+		metrics_observe(config->metrics, METRICS_WEBHOOK_SECONDS,
+				started);
+		metrics_add(config->metrics, METRICS_WEBHOOK_POSTS, 1);
+	}
 
 	return EXIT_SUCCESS;
 }
@@ -154,6 +253,13 @@ void bad_actor_destroy(bad_actor **self_ptr)
 	if (*self_ptr) {
 		bad_actor *self = *self_ptr;
 
+		if (self->arena != 0) {
+			free(self->arena);
+			free(self);
+			*self_ptr = 0;
+			return;
+		}
+
 		// Modern C by Manning, Takeaway 6.19
 		// "6.19 Initialization or assignment with 0 makes a pointer null."
 		if (self->event_timestamp != 0) {
@@ -229,8 +335,12 @@ void bad_actor_destroy(bad_actor **self_ptr)
 
 void bad_actors_destroy(bad_actor **bad_actors, const int64_t *row_count)
 {
-	assert(bad_actors);
-	if (*bad_actors) {
+	// Nothing was selected, or there were no rows to select
+	if (bad_actors == 0) {
+		return;
+	}
+	// An empty array has no first element to look at
+	if (*row_count > 0 && *bad_actors) {
 		int64_t row_num = 0;
 		while (row_num < *row_count) {
 			bad_actor_destroy(&bad_actors[row_num]);
@@ -41,6 +41,9 @@ struct bad_actor {
 	char *user_agent;
 	char *seen_last;
 	char *seen_count;
+	// Set when every string above points into this one allocation, see
+	// bad_actor_json_read()
+	char *arena;
 };
 
 //  Constructor
@@ -49,8 +52,30 @@ bad_actor *bad_actor_new(char *sip_message, char *source_ip,
 			 char *method, char *transport_type, char *user_agent,
 			 char *collected_method, char *created_by_node_id);
 
-// Log our bad actor to various places
-int bad_actor_log(sentrypeer_config *config, const bad_actor *bad_actor_event);
+// Defined in json_logger.h
+typedef struct json_buffer json_buffer;
+
+/**
+ * Log our bad actor to various places, one after another. Only used when
+ * there's no config->sinks to hand it to, see sinks.h.
+ *
+ * @param config The config.
+ * @param bad_actor_event The bad actor.
+ * @param json An empty json_buffer. Whichever sinks need json share what's
+ *             written here, so pass it on to any that come afterwards.
+ */
+int bad_actor_log(sentrypeer_config *config, const bad_actor *bad_actor_event,
+		  json_buffer *json);
+
+/**
+ * Count our bad actor in the in-memory indexes that the API serves from.
+ * Only built in API mode, so this does nothing otherwise.
+ *
+ * @param config The config.
+ * @param bad_actor_event The bad actor, already saved to the db.
+ */
+void bad_actor_index(sentrypeer_config const *config,
+		     const bad_actor *bad_actor_event);
 
 //  Destructors
 void bad_actor_destroy(bad_actor **self_ptr);
@@ -21,7 +21,21 @@
 #include "conf.h"
 #include "utils.h"
 #include "database.h"
+#include "db_partition.h"
+#include "db_maintenance.h"
+#include "db_export.h"
+#include "ip_prefix_tree.h"
+#include "ip_address_log.h"
+#include "geoip.h"
+#include "heavy_hitters.h"
+#include "event_series.h"
+#include "event_stream.h"
+#include "metrics.h"
+#include "sinks.h"
+#include "shm_ring_writer.h"
 #include "json_logger.h"
+#include "sip_daemon.h"
+#include "tcp_conn_table.h"
 
 #if HAVE_OPENDHT_C != 0
 #include <opendht/opendht_c.h>
@@ -34,6 +48,12 @@
 #include "sentrypeer_rust.h"
 #endif // HAVE_RUST
 
+// Options with no short version, past any option character
+#define CLI_INGEST_PCAP 256
+#define CLI_IMPORT_JSON 257
+#define CLI_EXPORT_PARQUET 258
+#define CLI_VACUUM 259
+
 //  Constructor
 sentrypeer_config *sentrypeer_config_new(void)
 {
@@ -62,13 +82,48 @@ sentrypeer_config *sentrypeer_config_new(void)
 	self->oauth2_client_secret = 0;
 	self->oauth2_access_token = 0;
 	
-	self->sip_daemon_thread = 0;
+	self->sip_workers = SIP_DAEMON_WORKERS;
+	self->sip_steering = SIP_STEERING_SOURCE;
+	self->sip_backend = SIP_BACKEND_AUTO;
+	self->tcp_max_connections = TCP_CONN_MAX_CONNECTIONS;
+	self->tcp_max_connections_per_ip = TCP_CONN_MAX_PER_IP;
+	self->tcp_idle_timeout = TCP_CONN_IDLE_TIMEOUT;
+	self->tcp_max_lifetime = TCP_CONN_MAX_LIFETIME;
+	self->sip_daemon_workers = 0;
 	self->sip_channel = 0;
+	self->ip_prefix_tree = 0;
+	self->ip_address_log = 0;
+	self->user_agents = 0;
+	self->sip_methods = 0;
+	self->countries = 0;
+	self->cities = 0;
+	self->event_series = 0;
+	self->geoip_db_file = 0;
+	self->geoip_asn_db_file = 0;
+	self->geoip = 0;
+	self->event_stream = 0;
+	self->metrics = 0;
+	self->sinks = 0;
+	self->shm_ring_name = 0;
+	self->shm_ring = 0;
+	self->ingest_pcap_file = 0;
+	self->import_json_files = 0;
+	self->import_json_file_count = 0;
+	self->export_parquet_dir = 0;
+	self->vacuum_mode = false;
 
 	self->db_file = calloc(SENTRYPEER_PATH_MAX + 1, sizeof(char));
 	assert(self->db_file);
 	util_copy_string(self->db_file, DEFAULT_DB_FILE_NAME,
 			 SENTRYPEER_PATH_MAX);
+	self->db_partition = DB_PARTITION_NONE;
+	self->db_retention_days = 0; // Keep forever
+	self->db_retention_max_bytes = 0; // No limit
+	self->db_maintenance_interval = DB_MAINTENANCE_INTERVAL;
+	self->db_maintenance_thread = 0;
+	self->parquet_archive_dir = 0;
+	self->parquet_archive_interval = DB_EXPORT_INTERVAL;
+	self->parquet_archive_thread = 0;
 
 	self->json_log_file = calloc(SENTRYPEER_PATH_MAX + 1, sizeof(char));
 	assert(self->json_log_file);
@@ -120,6 +175,32 @@ void sentrypeer_config_destroy(sentrypeer_config **self_ptr)
 	if (*self_ptr) {
 		sentrypeer_config *self = *self_ptr;
 
+		// First, its threads still use everything below
+		sinks_destroy(&self->sinks);
+		shm_ring_writer_destroy(&self->shm_ring);
+		if (self->shm_ring_name != 0) {
+			free(self->shm_ring_name);
+			self->shm_ring_name = 0;
+		}
+		if (self->ingest_pcap_file != 0) {
+			free(self->ingest_pcap_file);
+			self->ingest_pcap_file = 0;
+		}
+		for (size_t i = 0; i < self->import_json_file_count; i++) {
+			free(self->import_json_files[i]);
+		}
+		free(self->import_json_files);
+		self->import_json_files = 0;
+		self->import_json_file_count = 0;
+		if (self->export_parquet_dir != 0) {
+			free(self->export_parquet_dir);
+			self->export_parquet_dir = 0;
+		}
+		if (self->parquet_archive_dir != 0) {
+			free(self->parquet_archive_dir);
+			self->parquet_archive_dir = 0;
+		}
+
 		// Modern C by Manning, Takeaway 6.19
 		// "6.19 Initialization or assignment with 0 makes a pointer null."
 		if (self->node_id != 0) {
@@ -169,6 +250,27 @@ void sentrypeer_config_destroy(sentrypeer_config **self_ptr)
 			self->json_log_file = 0;
 		}
 
+		ip_prefix_tree_destroy(&self->ip_prefix_tree);
+		ip_address_log_destroy(&self->ip_address_log);
+		heavy_hitters_destroy(&self->user_agents);
+		heavy_hitters_destroy(&self->sip_methods);
+		heavy_hitters_destroy(&self->countries);
+		heavy_hitters_destroy(&self->cities);
+		event_series_destroy(&self->event_series);
+		geoip_destroy(&self->geoip);
+		event_stream_destroy(&self->event_stream);
+		metrics_destroy(&self->metrics);
+
+		if (self->geoip_db_file != 0) {
+			free(self->geoip_db_file);
+			self->geoip_db_file = 0;
+		}
+
+		if (self->geoip_asn_db_file != 0) {
+			free(self->geoip_asn_db_file);
+			self->geoip_asn_db_file = 0;
+		}
+
 #if HAVE_RUST != 0
 		if (self->tls_cert_file != 0) {
 			free(self->tls_cert_file);
@@ -196,10 +298,24 @@ void sentrypeer_config_destroy(sentrypeer_config **self_ptr)
 	}
 }
 
+void sentrypeer_config_add_import_json_file(sentrypeer_config *self,
+					    const char *file_name)
+{
+	assert(self);
+	assert(file_name);
+
+	self->import_json_files =
+		realloc(self->import_json_files,
+			(self->import_json_file_count + 1) * sizeof(char *));
+	assert(self->import_json_files);
+	self->import_json_files[self->import_json_file_count++] =
+		util_duplicate_string(file_name);
+}
+
 void print_usage(void)
 {
 	fprintf(stderr,
-		"Usage: %s [-h] [-V] [-w https://api.example.com/events] [-j] [-p] [-b bootstrap.example.com] [-i OAuth_2_Client_ID] [-c OAuth_2_Client_Secret] [-f fullpath for sentrypeer.db] [-l fullpath for sentrypeer_json.log] [-r] [-R] [-a] [-s] [-v] [-d]\n",
+		"Usage: %s [-h] [-V] [-w https://api.example.com/events] [-j] [-p] [-b bootstrap.example.com] [-i OAuth_2_Client_ID] [-c OAuth_2_Client_Secret] [-f fullpath for sentrypeer.db] [-l fullpath for sentrypeer_json.log] [-r] [-R] [-a] [-s] [-v] [-d] [--ingest-pcap capture.pcap] [--import-json sentrypeer_json.log]... [--export-parquet dir] [--vacuum]\n",
 		PACKAGE_NAME);
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Options:\n");
@@ -233,6 +349,14 @@ void print_usage(void)
 		"  -v,      Enable verbose logging or use SENTRYPEER_VERBOSE env\n");
 	fprintf(stderr,
 		"  -d,      Enable debug mode or use SENTRYPEER_DEBUG env\n");
+	fprintf(stderr,
+		"  --ingest-pcap, Log the SIP requests in a pcap or pcapng file, then exit\n");
+	fprintf(stderr,
+		"  --import-json, Import a JSON log into the database, then exit. Repeat to import several\n");
+	fprintf(stderr,
+		"  --export-parquet, Export the database to Parquet files by day in a directory, then exit. SENTRYPEER_PARQUET_ARCHIVE_DIR env does this hourly instead\n");
+	fprintf(stderr,
+		"  --vacuum, Switch the database to incremental auto_vacuum and WAL with a full VACUUM, then exit. Stop SentryPeer first\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr,
 		"Report bugs to https://github.com/SentryPeer/SentryPeer/issues\n");
@@ -248,15 +372,24 @@ void print_version(void)
 int process_cli(sentrypeer_config *config, int argc, char **argv)
 {
 	// Check env vars first
-	process_env_vars(config);
+	if (process_env_vars(config) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
 
 #if HAVE_RUST != 0
 	process_cli_rs(config, argc, argv);
 #else
 	int cli_option;
-
-	while ((cli_option = getopt(argc, argv, "hVvf:l:b:c:i:w:jpdrRas")) !=
-	       -1) {
+	static const struct option long_options[] = {
+		{ "ingest-pcap", required_argument, 0, CLI_INGEST_PCAP },
+		{ "import-json", required_argument, 0, CLI_IMPORT_JSON },
+		{ "export-parquet", required_argument, 0, CLI_EXPORT_PARQUET },
+		{ "vacuum", no_argument, 0, CLI_VACUUM },
+		{ 0, 0, 0, 0 }
+	};
+
+	while ((cli_option = getopt_long(argc, argv, "hVvf:l:b:c:i:w:jpdrRas",
+					 long_options, 0)) != -1) {
 		switch (cli_option) {
 		case 'h':
 			print_usage();
@@ -330,6 +463,20 @@ int process_cli(sentrypeer_config *config, int argc, char **argv)
 			util_copy_string(config->webhook_url, optarg,
 					 DNS_MAX_LENGTH);
 			break;
+		case CLI_INGEST_PCAP:
+			free(config->ingest_pcap_file);
+			config->ingest_pcap_file = util_duplicate_string(optarg);
+			break;
+		case CLI_IMPORT_JSON:
+			sentrypeer_config_add_import_json_file(config, optarg);
+			break;
+		case CLI_EXPORT_PARQUET:
+			free(config->export_parquet_dir);
+			config->export_parquet_dir = util_duplicate_string(optarg);
+			break;
+		case CLI_VACUUM:
+			config->vacuum_mode = true;
+			break;
 		default:
 			print_usage();
 			return EXIT_FAILURE;
@@ -350,6 +497,112 @@ int process_env_vars(sentrypeer_config *config)
 		util_copy_string(config->db_file, getenv("SENTRYPEER_DB_FILE"),
 				 SENTRYPEER_PATH_MAX);
 	}
+	if (getenv("SENTRYPEER_DB_PARTITION")) {
+		int db_partition =
+			db_partition_from_string(getenv("SENTRYPEER_DB_PARTITION"));
+		if (db_partition < 0) {
+			fprintf(stderr,
+				"SENTRYPEER_DB_PARTITION must be one of none, day or week\n");
+			return EXIT_FAILURE;
+		}
+		config->db_partition = db_partition;
+	}
+	if (getenv("SENTRYPEER_DB_RETENTION_DAYS")) {
+		config->db_retention_days =
+			atoi(getenv("SENTRYPEER_DB_RETENTION_DAYS"));
+	}
+	if (getenv("SENTRYPEER_DB_RETENTION_MAX_MB")) {
+		config->db_retention_max_bytes =
+			strtoll(getenv("SENTRYPEER_DB_RETENTION_MAX_MB"), NULL,
+				10) *
+			1024 * 1024;
+	}
+	if (getenv("SENTRYPEER_DB_MAINTENANCE_INTERVAL")) {
+		config->db_maintenance_interval =
+			atoi(getenv("SENTRYPEER_DB_MAINTENANCE_INTERVAL"));
+	}
+	if (getenv("SENTRYPEER_PARQUET_ARCHIVE_DIR")) {
+		free(config->parquet_archive_dir);
+		config->parquet_archive_dir = util_duplicate_string(
+			getenv("SENTRYPEER_PARQUET_ARCHIVE_DIR"));
+	}
+	if (getenv("SENTRYPEER_PARQUET_ARCHIVE_INTERVAL")) {
+		config->parquet_archive_interval =
+			atoi(getenv("SENTRYPEER_PARQUET_ARCHIVE_INTERVAL"));
+	}
+	if (getenv("SENTRYPEER_GEOIP_DB")) {
+		free(config->geoip_db_file);
+		config->geoip_db_file =
+			util_duplicate_string(getenv("SENTRYPEER_GEOIP_DB"));
+	}
+	if (getenv("SENTRYPEER_GEOIP_ASN_DB")) {
+		free(config->geoip_asn_db_file);
+		config->geoip_asn_db_file =
+			util_duplicate_string(getenv("SENTRYPEER_GEOIP_ASN_DB"));
+	}
+	if (getenv("SENTRYPEER_SHM_RING")) {
+		free(config->shm_ring_name);
+		config->shm_ring_name =
+			util_duplicate_string(getenv("SENTRYPEER_SHM_RING"));
+	}
+	if (getenv("SENTRYPEER_SIP_WORKERS")) {
+		config->sip_workers = atoi(getenv("SENTRYPEER_SIP_WORKERS"));
+		if (config->sip_workers < 1 ||
+		    config->sip_workers > SIP_DAEMON_WORKERS_MAX) {
+			fprintf(stderr,
+				"SENTRYPEER_SIP_WORKERS must be between 1 and %d\n",
+				SIP_DAEMON_WORKERS_MAX);
+			return EXIT_FAILURE;
+		}
+	}
+	if (getenv("SENTRYPEER_SIP_STEERING")) {
+		int sip_steering =
+			sip_steering_from_string(getenv("SENTRYPEER_SIP_STEERING"));
+		if (sip_steering < 0) {
+			fprintf(stderr,
+				"SENTRYPEER_SIP_STEERING must be one of source or kernel\n");
+			return EXIT_FAILURE;
+		}
+		config->sip_steering = sip_steering;
+	}
+	if (getenv("SENTRYPEER_SIP_BACKEND")) {
+		int sip_backend =
+			sip_backend_from_string(getenv("SENTRYPEER_SIP_BACKEND"));
+		if (sip_backend < 0) {
+			fprintf(stderr,
+				"SENTRYPEER_SIP_BACKEND must be one of auto, io_uring or select\n");
+			return EXIT_FAILURE;
+		}
+		config->sip_backend = sip_backend;
+	}
+	if (getenv("SENTRYPEER_TCP_MAX_CONNECTIONS")) {
+		config->tcp_max_connections = atoi(getenv("SENTRYPEER_TCP_MAX_CONNECTIONS"));
+		if (config->tcp_max_connections < 1) {
+			fprintf(stderr, "SENTRYPEER_TCP_MAX_CONNECTIONS must be 1 or more\n");
+			return EXIT_FAILURE;
+		}
+	}
+	if (getenv("SENTRYPEER_TCP_MAX_CONNECTIONS_PER_IP")) {
+		config->tcp_max_connections_per_ip = atoi(getenv("SENTRYPEER_TCP_MAX_CONNECTIONS_PER_IP"));
+		if (config->tcp_max_connections_per_ip < 1) {
+			fprintf(stderr, "SENTRYPEER_TCP_MAX_CONNECTIONS_PER_IP must be 1 or more\n");
+			return EXIT_FAILURE;
+		}
+	}
+	if (getenv("SENTRYPEER_TCP_IDLE_TIMEOUT")) {
+		config->tcp_idle_timeout = atoi(getenv("SENTRYPEER_TCP_IDLE_TIMEOUT"));
+		if (config->tcp_idle_timeout < 1) {
+			fprintf(stderr, "SENTRYPEER_TCP_IDLE_TIMEOUT must be 1 or more\n");
+			return EXIT_FAILURE;
+		}
+	}
+	if (getenv("SENTRYPEER_TCP_MAX_LIFETIME")) {
+		config->tcp_max_lifetime = atoi(getenv("SENTRYPEER_TCP_MAX_LIFETIME"));
+		if (config->tcp_max_lifetime < 1) {
+			fprintf(stderr, "SENTRYPEER_TCP_MAX_LIFETIME must be 1 or more\n");
+			return EXIT_FAILURE;
+		}
+	}
 	if (getenv("SENTRYPEER_JSON_LOG_FILE")) {
 		util_copy_string(config->json_log_file,
 				 getenv("SENTRYPEER_JSON_LOG_FILE"),
@@ -16,6 +16,7 @@
 
 #include <getopt.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <pthread.h>
 
 #include "../config.h"
@@ -35,6 +36,18 @@
 #define SENTRYPEER_OAUTH2_CLIENT_SECRET "YOUR_CLIENT_SECRET"
 #define DHT_BAD_ACTORS_KEY "bad_actors"
 
+// See ip_prefix_tree.h, ip_address_log.h, heavy_hitters.h, event_series.h,
+// geoip.h, event_stream.h, metrics.h, sinks.h and shm_ring_writer.h
+struct ip_prefix_tree;
+struct ip_address_log;
+struct heavy_hitters;
+struct event_series;
+struct geoip;
+struct event_stream;
+struct metrics;
+struct sinks;
+struct shm_ring_writer;
+
 typedef struct sentrypeer_config sentrypeer_config;
 struct sentrypeer_config {
 	bool api_mode;
@@ -55,12 +68,47 @@ struct sentrypeer_config {
 	char *oauth2_client_secret;
 	char *oauth2_access_token;
 	char *db_file;
+	int db_partition;
+	int db_retention_days;
+	int64_t db_retention_max_bytes;
+	int db_maintenance_interval;
+	pthread_t db_maintenance_thread;
+	char *parquet_archive_dir;
+	int parquet_archive_interval;
+	pthread_t parquet_archive_thread;
 	char *json_log_file;
 	char *node_id;
 	char *p2p_bootstrap_node;
-	pthread_t sip_daemon_thread;
+	int sip_workers;
+	int sip_steering;
+	int sip_backend;
+	int tcp_max_connections;
+	int tcp_max_connections_per_ip;
+	int tcp_idle_timeout;
+	int tcp_max_lifetime;
+	struct sip_daemon_worker *sip_daemon_workers;
 	void *sip_channel;
 	struct MHD_Daemon *http_daemon;
+	struct ip_prefix_tree *ip_prefix_tree;
+	struct ip_address_log *ip_address_log;
+	struct heavy_hitters *user_agents;
+	struct heavy_hitters *sip_methods;
+	struct heavy_hitters *countries;
+	struct heavy_hitters *cities;
+	struct event_series *event_series;
+	char *geoip_db_file;
+	char *geoip_asn_db_file;
+	struct geoip *geoip;
+	struct event_stream *event_stream;
+	struct metrics *metrics;
+	struct sinks *sinks;
+	char *shm_ring_name;
+	struct shm_ring_writer *shm_ring;
+	char *ingest_pcap_file;
+	char **import_json_files;
+	size_t import_json_file_count;
+	char *export_parquet_dir;
+	bool vacuum_mode;
 
 #if HAVE_OPENDHT_C != 0
 	dht_runner *dht_node;
@@ -82,6 +130,10 @@ sentrypeer_config *sentrypeer_config_new(void);
 //  Destructor
 void sentrypeer_config_destroy(sentrypeer_config **self_ptr);
 
+// Another NDJSON file for --import-json, copied
+void sentrypeer_config_add_import_json_file(sentrypeer_config *self,
+					    const char *file_name);
+
 int process_cli(sentrypeer_config *config, int argc, char **argv);
 
 int process_env_vars(sentrypeer_config *config);
@@ -15,13 +15,21 @@
 #include <stdio.h>
 
 #include "database.h"
+#include "sip_message_store.h"
+#include "db_partition.h"
+#include "db_maintenance.h"
+#include "geoip.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
 #include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
 
 const char schema_check[] = "PRAGMA user_version;";
+const char db_is_new_sql[] = "SELECT 1 FROM sqlite_master LIMIT 1;";
 const char create_table_sql[] =
 	"CREATE TABLE IF NOT EXISTS honey "
 	"("
@@ -52,66 +60,205 @@ const char insert_bad_actor[] =
 	"INSERT INTO honey (event_timestamp,"
 	"   event_uuid, collected_method, source_ip,"
 	"   called_number, transport_type, method,"
-	"   user_agent, sip_message, created_by_node_id) "
-	"VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
-
-int db_insert_bad_actor(bad_actor const *bad_actor_event,
-			sentrypeer_config const *config)
+	"   user_agent, sip_message_id, created_by_node_id,"
+	"   country_code, city, asn, as_org) "
+	"VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+
+// honey.sip_message is only set on rows from before schema version 1
+const char add_sip_message_id_column[] =
+	"ALTER TABLE honey ADD COLUMN sip_message_id INTEGER REFERENCES sip_messages (sip_message_id);";
+
+// GeoIP enrichment, NULL when there's no database or no match
+const char *const add_geoip_columns[] = {
+	"ALTER TABLE honey ADD COLUMN country_code TEXT;",
+	"ALTER TABLE honey ADD COLUMN city TEXT;",
+	"ALTER TABLE honey ADD COLUMN asn INTEGER;",
+	"ALTER TABLE honey ADD COLUMN as_org TEXT;",
+	0,
+};
+
+// Bulk loads build the honey indexes once at the end, from a sort, instead
+// of a b-tree insert per row, and keep more of the database in memory
+const char *const bulk_load_settings[] = {
+	"DROP INDEX IF EXISTS source_ip_index;",
+	"DROP INDEX IF EXISTS called_number_index;",
+	"DROP INDEX IF EXISTS event_uuid_index;",
+	"PRAGMA cache_size = -65536;",
+	0,
+};
+
+// Bump DB_SCHEMA_VERSION and add a step here when the schema changes
+static int db_migrate_schema(sqlite3 *db, sentrypeer_config const *config)
 {
-	sqlite3 *db;
-	sqlite3_stmt *insert_bad_actor_stmt = 0;
+	sqlite3_stmt *schema_check_stmt = 0;
+	if (sqlite3_prepare_v2(db, schema_check, -1, &schema_check_stmt,
+			       NULL) != SQLITE_OK ||
+	    sqlite3_step(schema_check_stmt) != SQLITE_ROW) {
+		fprintf(stderr, "Failed to check schema\n");
+		sqlite3_finalize(schema_check_stmt);
+		return EXIT_FAILURE;
+	}
+	int32_t user_version = sqlite3_column_int(schema_check_stmt, 0);
+	sqlite3_finalize(schema_check_stmt);
 
-	assert(config->db_file);
+	if (user_version >= DB_SCHEMA_VERSION) {
+		return EXIT_SUCCESS;
+	}
 
 	if (config->debug_mode || config->verbose_mode) {
-		fprintf(stderr, "SentryPeer db file location is: %s\n",
-			config->db_file);
+		fprintf(stderr, "Migrating db schema from version %d to %d\n",
+			user_version, DB_SCHEMA_VERSION);
 	}
 
-	if (sqlite3_open(config->db_file, &db) != SQLITE_OK) {
-		fprintf(stderr, "Failed to open database\n");
-		sqlite3_close(db);
+	if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) !=
+	    SQLITE_OK) {
+		fprintf(stderr, "Failed to begin schema migration: %s\n",
+			sqlite3_errmsg(db));
 		return EXIT_FAILURE;
 	}
 
-	// TODO: Check if schema is needs to be updated
-	if (sqlite3_exec(db, schema_check, NULL, NULL, NULL) != SQLITE_OK) {
-		fprintf(stderr, "Failed to check schema\n");
-		sqlite3_close(db);
+	// Version 1: raw SIP messages moved to the sip_messages table
+	if (user_version < 1) {
+		if (sip_message_store_create_schema(db) != EXIT_SUCCESS ||
+		    sqlite3_exec(db, add_sip_message_id_column, NULL, NULL,
+				 NULL) != SQLITE_OK) {
+			fprintf(stderr, "Failed to migrate schema: %s\n",
+				sqlite3_errmsg(db));
+			sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Version 2: country, city and ASN of source_ip
+	if (user_version < 2) {
+		for (const char *const *sql = add_geoip_columns; *sql != 0;
+		     sql++) {
+			if (sqlite3_exec(db, *sql, NULL, NULL, NULL) !=
+			    SQLITE_OK) {
+				fprintf(stderr, "Failed to migrate schema: %s\n",
+					sqlite3_errmsg(db));
+				sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	char set_user_version[32];
+	snprintf(set_user_version, sizeof(set_user_version),
+		 "PRAGMA user_version = %d;", DB_SCHEMA_VERSION);
+	if (sqlite3_exec(db, set_user_version, NULL, NULL, NULL) != SQLITE_OK ||
+	    sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to set schema version: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
 		return EXIT_FAILURE;
 	}
 
+	return EXIT_SUCCESS;
+}
+
+// Nothing has been created in it yet
+static bool db_is_new(sqlite3 *db)
+{
+	sqlite3_stmt *master_stmt = 0;
+	bool is_new = sqlite3_prepare_v2(db, db_is_new_sql, -1, &master_stmt,
+					 NULL) == SQLITE_OK &&
+		      sqlite3_step(master_stmt) == SQLITE_DONE;
+	sqlite3_finalize(master_stmt);
+
+	return is_new;
+}
+
+static int db_create_schema(sqlite3 *db, sentrypeer_config const *config)
+{
+	// Both are kept in the file, and auto_vacuum can only be set before
+	// the first table, so only for a new one. Older ones get switched
+	// over with --vacuum.
+	if (db_is_new(db)) {
+		if (sqlite3_exec(db, DB_SET_AUTO_VACUUM, NULL, NULL, NULL) !=
+		    SQLITE_OK) {
+			fprintf(stderr, "Failed to set auto_vacuum\n");
+			return EXIT_FAILURE;
+		}
+
+		// So the API can read while we log and db_maintenance
+		// checkpoints
+		if (sqlite3_exec(db, DB_SET_JOURNAL_MODE, NULL, NULL, NULL) !=
+		    SQLITE_OK) {
+			fprintf(stderr, "Failed to set journal_mode\n");
+			return EXIT_FAILURE;
+		}
+	}
+
 	if (sqlite3_exec(db, create_table_sql, NULL, NULL, NULL) != SQLITE_OK) {
 		fprintf(stderr, "Failed to create table\n");
-		sqlite3_close(db);
 		return EXIT_FAILURE;
 	}
 
 	if (sqlite3_exec(db, create_source_ip_index, NULL, NULL, NULL) !=
 	    SQLITE_OK) {
 		fprintf(stderr, "Failed to create source_ip_index\n");
-		sqlite3_close(db);
 		return EXIT_FAILURE;
 	}
 
 	if (sqlite3_exec(db, create_called_number_index, NULL, NULL, NULL) !=
 	    SQLITE_OK) {
 		fprintf(stderr, "Failed to create called_number_index\n");
-		sqlite3_close(db);
 		return EXIT_FAILURE;
 	}
 
 	if (sqlite3_exec(db, create_event_uuid_index, NULL, NULL, NULL) !=
 	    SQLITE_OK) {
 		fprintf(stderr, "Failed to create event_uuid_index\n");
-		sqlite3_close(db);
 		return EXIT_FAILURE;
 	}
 
-	if (sqlite3_prepare_v2(db, insert_bad_actor, -1, &insert_bad_actor_stmt,
-			       NULL) != SQLITE_OK) {
-		fprintf(stderr, "Failed to prepare statement\n");
-		sqlite3_close(db);
+	return db_migrate_schema(db, config);
+}
+
+// Binds country_code, city, asn and as_org from index onwards
+static int db_bind_geoip(sqlite3_stmt *stmt, int index, bool located,
+			 const geoip_result *location)
+{
+	int rc = located && location->country_code[0] != '\0' ?
+			 sqlite3_bind_text(stmt, index, location->country_code,
+					   -1, SQLITE_TRANSIENT) :
+			 sqlite3_bind_null(stmt, index);
+	if (rc == SQLITE_OK) {
+		rc = located && location->city[0] != '\0' ?
+			     sqlite3_bind_text(stmt, index + 1, location->city,
+					       -1, SQLITE_TRANSIENT) :
+			     sqlite3_bind_null(stmt, index + 1);
+	}
+	if (rc == SQLITE_OK) {
+		rc = located && location->asn != 0 ?
+			     sqlite3_bind_int64(stmt, index + 2, location->asn) :
+			     sqlite3_bind_null(stmt, index + 2);
+	}
+	if (rc == SQLITE_OK) {
+		rc = located && location->as_org[0] != '\0' ?
+			     sqlite3_bind_text(stmt, index + 3, location->as_org,
+					       -1, SQLITE_TRANSIENT) :
+			     sqlite3_bind_null(stmt, index + 3);
+	}
+
+	return rc == SQLITE_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// One honey row, and its body, inside the caller's transaction. Leaves
+// insert_bad_actor_stmt reset for the next one.
+static int db_insert_bad_actor_row(sqlite3 *db,
+				   sqlite3_stmt *insert_bad_actor_stmt,
+				   bad_actor const *bad_actor_event,
+				   sentrypeer_config const *config)
+{
+	sqlite3_reset(insert_bad_actor_stmt);
+	sqlite3_clear_bindings(insert_bad_actor_stmt);
+
+	sqlite3_int64 sip_message_id = 0;
+	if (bad_actor_event->sip_message != 0 &&
+	    sip_message_store_put(db, bad_actor_event->sip_message,
+				  &sip_message_id, config) != EXIT_SUCCESS) {
 		return EXIT_FAILURE;
 	}
 
@@ -119,7 +266,6 @@ int db_insert_bad_actor(bad_actor const *bad_actor_event,
 			      bad_actor_event->event_timestamp, -1,
 			      SQLITE_STATIC) != SQLITE_OK) {
 		fprintf(stderr, "Failed to bind event_timestamp\n");
-		sqlite3_close(db);
 		return EXIT_FAILURE;
 	}
 
@@ -127,7 +273,6 @@ int db_insert_bad_actor(bad_actor const *bad_actor_event,
 			      bad_actor_event->event_uuid, -1,
 			      SQLITE_STATIC) != SQLITE_OK) {
 		fprintf(stderr, "Failed to bind event_uuid\n");
-		sqlite3_close(db);
 		return EXIT_FAILURE;
 	}
 
@@ -135,7 +280,6 @@ int db_insert_bad_actor(bad_actor const *bad_actor_event,
 			      bad_actor_event->collected_method, -1,
 			      SQLITE_STATIC) != SQLITE_OK) {
 		fprintf(stderr, "Failed to bind collected_method\n");
-		sqlite3_close(db);
 		return EXIT_FAILURE;
 	}
 
@@ -143,7 +287,6 @@ int db_insert_bad_actor(bad_actor const *bad_actor_event,
 			      bad_actor_event->source_ip, -1,
 			      SQLITE_STATIC) != SQLITE_OK) {
 		fprintf(stderr, "Failed to bind source_ip\n");
-		sqlite3_close(db);
 		return EXIT_FAILURE;
 	}
 
@@ -151,7 +294,6 @@ int db_insert_bad_actor(bad_actor const *bad_actor_event,
 			      bad_actor_event->called_number, -1,
 			      SQLITE_STATIC) != SQLITE_OK) {
 		fprintf(stderr, "Failed to bind called_number\n");
-		sqlite3_close(db);
 		return EXIT_FAILURE;
 	}
 
@@ -159,14 +301,12 @@ int db_insert_bad_actor(bad_actor const *bad_actor_event,
 			      bad_actor_event->transport_type, -1,
 			      SQLITE_STATIC) != SQLITE_OK) {
 		fprintf(stderr, "Failed to bind transport_type\n");
-		sqlite3_close(db);
 		return EXIT_FAILURE;
 	}
 
 	if (sqlite3_bind_text(insert_bad_actor_stmt, 7, bad_actor_event->method,
 			      -1, SQLITE_STATIC) != SQLITE_OK) {
 		fprintf(stderr, "Failed to bind method\n");
-		sqlite3_close(db);
 		return EXIT_FAILURE;
 	}
 
@@ -174,15 +314,16 @@ int db_insert_bad_actor(bad_actor const *bad_actor_event,
 			      bad_actor_event->user_agent, -1,
 			      SQLITE_STATIC) != SQLITE_OK) {
 		fprintf(stderr, "Failed to bind user_agent\n");
-		sqlite3_close(db);
 		return EXIT_FAILURE;
 	}
 
-	if (sqlite3_bind_text(insert_bad_actor_stmt, 9,
-			      bad_actor_event->sip_message, -1,
-			      SQLITE_STATIC) != SQLITE_OK) {
-		fprintf(stderr, "Failed to bind sip_message\n");
-		sqlite3_close(db);
+	int bind_sip_message_id =
+		sip_message_id == 0 ?
+			sqlite3_bind_null(insert_bad_actor_stmt, 9) :
+			sqlite3_bind_int64(insert_bad_actor_stmt, 9,
+					   sip_message_id);
+	if (bind_sip_message_id != SQLITE_OK) {
+		fprintf(stderr, "Failed to bind sip_message_id\n");
 		return EXIT_FAILURE;
 	}
 
@@ -190,21 +331,102 @@ int db_insert_bad_actor(bad_actor const *bad_actor_event,
 			      bad_actor_event->created_by_node_id, -1,
 			      SQLITE_STATIC) != SQLITE_OK) {
 		fprintf(stderr, "Failed to bind created_by_node_id\n");
-		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	// Cached, so repeat scanners cost a hash lookup
+	geoip_result location;
+	bool located = config->geoip != 0 &&
+		       geoip_lookup(config->geoip, bad_actor_event->source_ip,
+				    &location) == EXIT_SUCCESS;
+	if (db_bind_geoip(insert_bad_actor_stmt, 11, located, &location) !=
+	    EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to bind geoip columns\n");
 		return EXIT_FAILURE;
 	}
 
 	if (sqlite3_step(insert_bad_actor_stmt) != SQLITE_DONE) {
 		fprintf(stderr, "Error inserting bad actor: %s\n",
 			sqlite3_errmsg(db));
-		sqlite3_finalize(insert_bad_actor_stmt);
-		sqlite3_close(db);
 		return EXIT_FAILURE;
 	}
 
+	return EXIT_SUCCESS;
+}
+
+// Every row in one transaction, or none of them
+static int db_insert_bad_actors_in(sqlite3 *db,
+				   bad_actor const *const *bad_actor_events,
+				   size_t count, sentrypeer_config const *config)
+{
+	sqlite3_stmt *insert_bad_actor_stmt = 0;
+
+	// Each body and the honey row it belongs to go in together, and a
+	// batch of them share the one commit
+	if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) !=
+	    SQLITE_OK) {
+		fprintf(stderr, "Failed to begin transaction: %s\n",
+			sqlite3_errmsg(db));
+		return EXIT_FAILURE;
+	}
+
+	if (sqlite3_prepare_v2(db, insert_bad_actor, -1, &insert_bad_actor_stmt,
+			       NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare statement\n");
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (db_insert_bad_actor_row(db, insert_bad_actor_stmt,
+					    bad_actor_events[i],
+					    config) != EXIT_SUCCESS) {
+			sqlite3_finalize(insert_bad_actor_stmt);
+			sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+			return EXIT_FAILURE;
+		}
+	}
+
 	if (sqlite3_finalize(insert_bad_actor_stmt) != SQLITE_OK) {
 		fprintf(stderr, "Error finalizing statement: %s\n",
 			sqlite3_errmsg(db));
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+		return EXIT_FAILURE;
+	}
+
+	if (sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to commit bad actor: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+		return EXIT_FAILURE;
+	}
+	db_maintenance_note_write();
+
+	return EXIT_SUCCESS;
+}
+
+static int db_insert_bad_actors_into(const char *db_file,
+				     bad_actor const *const *bad_actor_events,
+				     size_t count,
+				     sentrypeer_config const *config)
+{
+	sqlite3 *db;
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "SentryPeer db file location is: %s\n",
+			db_file);
+	}
+
+	if (sqlite3_open(db_file, &db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to open database\n");
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+	sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+
+	if (db_create_schema(db, config) != EXIT_SUCCESS ||
+	    db_insert_bad_actors_in(db, bad_actor_events, count, config) !=
+		    EXIT_SUCCESS) {
 		sqlite3_close(db);
 		return EXIT_FAILURE;
 	}
@@ -217,8 +439,151 @@ int db_insert_bad_actor(bad_actor const *bad_actor_event,
 	return EXIT_SUCCESS;
 }
 
-bool db_bad_actor_exists(const char *bad_actor_event_uuid,
-			 sentrypeer_config const *config)
+// The partition for when the event happened, so a batch that straddles
+// midnight or was held up in a sink's queue still lands in the right one.
+// Only when that's close to now though, as a peer or the DHT could make a
+// stray partition years out that retention and cursors would trip over.
+static int db_insert_partition_path(bad_actor const *bad_actor_event,
+				    char *path, size_t path_len,
+				    sentrypeer_config const *config)
+{
+	return db_partition_path(
+		config,
+		util_event_time(bad_actor_event->event_timestamp, time(NULL)),
+		path, path_len);
+}
+
+int db_insert_bad_actors(bad_actor const *const *bad_actor_events,
+			 size_t count, sentrypeer_config const *config)
+{
+	assert(config->db_file);
+	assert(bad_actor_events);
+	if (count == 0) {
+		return EXIT_SUCCESS;
+	}
+
+	if (config->db_partition == DB_PARTITION_NONE) {
+		return db_insert_bad_actors_into(config->db_file,
+						 bad_actor_events, count,
+						 config);
+	}
+
+	// Runs of events for the same partition go in together
+	char partition_file[SENTRYPEER_PATH_MAX + 1];
+	char next_partition_file[SENTRYPEER_PATH_MAX + 1];
+	bool new_partition = false;
+	size_t start = 0;
+	while (start < count) {
+		if (db_insert_partition_path(bad_actor_events[start],
+					     partition_file,
+					     sizeof(partition_file),
+					     config) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+		size_t end = start + 1;
+		while (end < count &&
+		       db_insert_partition_path(bad_actor_events[end],
+						next_partition_file,
+						sizeof(next_partition_file),
+						config) == EXIT_SUCCESS &&
+		       strcmp(partition_file, next_partition_file) == 0) {
+			end++;
+		}
+
+		if (access(partition_file, F_OK) != 0) {
+			new_partition = true;
+		}
+		if (db_insert_bad_actors_into(partition_file,
+					      bad_actor_events + start,
+					      end - start,
+					      config) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+		start = end;
+	}
+
+	// A new day/week, so see if anything is due to go
+	if (new_partition) {
+		db_partition_retention(config);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+sqlite3 *db_bulk_open(const char *db_file, sentrypeer_config const *config)
+{
+	sqlite3 *db;
+
+	assert(db_file);
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Bulk loading into %s\n", db_file);
+	}
+
+	if (sqlite3_open(db_file, &db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to open database\n");
+		sqlite3_close(db);
+		return 0;
+	}
+	sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+
+	if (db_create_schema(db, config) != EXIT_SUCCESS) {
+		sqlite3_close(db);
+		return 0;
+	}
+
+	for (const char *const *sql = bulk_load_settings; *sql != 0; sql++) {
+		if (sqlite3_exec(db, *sql, NULL, NULL, NULL) != SQLITE_OK) {
+			fprintf(stderr, "Failed to set up bulk load: %s\n",
+				sqlite3_errmsg(db));
+			sqlite3_close(db);
+			return 0;
+		}
+	}
+
+	return db;
+}
+
+int db_bulk_insert(sqlite3 *db, bad_actor const *const *bad_actor_events,
+		   size_t count, sentrypeer_config const *config)
+{
+	assert(db);
+	assert(bad_actor_events);
+	if (count == 0) {
+		return EXIT_SUCCESS;
+	}
+
+	return db_insert_bad_actors_in(db, bad_actor_events, count, config);
+}
+
+int db_bulk_close(sqlite3 **db_ptr, sentrypeer_config const *config)
+{
+	assert(db_ptr);
+	if (*db_ptr == 0) {
+		return EXIT_SUCCESS;
+	}
+	sqlite3 *db = *db_ptr;
+	*db_ptr = 0;
+
+	// Puts back the indexes db_bulk_open() dropped, each built in one go
+	int status = db_create_schema(db, config);
+
+	if (sqlite3_close(db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to close database\n");
+		return EXIT_FAILURE;
+	}
+
+	return status;
+}
+
+int db_insert_bad_actor(bad_actor const *bad_actor_event,
+			sentrypeer_config const *config)
+{
+	return db_insert_bad_actors(&bad_actor_event, 1, config);
+}
+
+static bool db_bad_actor_exists_in(const char *db_file,
+				   const char *bad_actor_event_uuid,
+				   sentrypeer_config const *config)
 {
 	if (bad_actor_event_uuid == NULL) {
 		if (config->debug_mode || config->verbose_mode) {
@@ -229,9 +594,9 @@ bool db_bad_actor_exists(const char *bad_actor_event_uuid,
 
 	if (is_valid_uuid(bad_actor_event_uuid)) {
 		sqlite3 *db;
-		assert(config->db_file);
+		assert(db_file);
 
-		if (sqlite3_open(config->db_file, &db) != SQLITE_OK) {
+		if (sqlite3_open(db_file, &db) != SQLITE_OK) {
 			fprintf(stderr, "Failed to open database: %s\n",
 				sqlite3_errmsg(db));
 			sqlite3_close(db);
@@ -304,14 +669,15 @@ bool db_bad_actor_exists(const char *bad_actor_event_uuid,
 	}
 }
 
-int db_select_bad_actor_by_ip(const char *bad_actor_ip_address,
-			      bad_actor **bad_actor_to_find,
-			      sentrypeer_config const *config)
+static int db_select_bad_actor_by_ip_in(const char *db_file,
+					const char *bad_actor_ip_address,
+					bad_actor **bad_actor_to_find,
+					sentrypeer_config const *config)
 {
 	sqlite3 *db;
-	assert(config->db_file);
+	assert(db_file);
 
-	if (sqlite3_open(config->db_file, &db) != SQLITE_OK) {
+	if (sqlite3_open(db_file, &db) != SQLITE_OK) {
 		fprintf(stderr, "Failed to open database: %s\n",
 			sqlite3_errmsg(db));
 		sqlite3_close(db);
@@ -377,22 +743,16 @@ int db_select_bad_actor_by_ip(const char *bad_actor_ip_address,
 	return EXIT_SUCCESS;
 }
 
-int db_select_bad_actors(bad_actor ***bad_actors, int64_t *row_count,
-			 sentrypeer_config const *config)
+// Read the source_ip, seen_last and seen_total rows of select_bad_actors,
+// then close db
+static int select_bad_actor_rows(sqlite3 *db, const char *row_count_sql,
+				 const char *select_bad_actors,
+				 bad_actor ***bad_actors, int64_t *row_count,
+				 sentrypeer_config const *config)
 {
-	sqlite3 *db;
-	assert(config->db_file);
-
-	if (sqlite3_open(config->db_file, &db) != SQLITE_OK) {
-		fprintf(stderr, "Failed to open database: %s\n",
-			sqlite3_errmsg(db));
-		sqlite3_close(db);
-		return EXIT_FAILURE;
-	}
-
 	sqlite3_stmt *get_row_count_stmt = 0;
-	if (sqlite3_prepare_v2(db, GET_ROWS_DISTINCT_SOURCE_IP_COUNT, -1,
-			       &get_row_count_stmt, NULL) != SQLITE_OK) {
+	if (sqlite3_prepare_v2(db, row_count_sql, -1, &get_row_count_stmt,
+			       NULL) != SQLITE_OK) {
 		fprintf(stderr, "Failed to prepare statement: %s\n",
 			sqlite3_errmsg(db));
 		sqlite3_close(db);
@@ -421,9 +781,17 @@ int db_select_bad_actors(bad_actor ***bad_actors, int64_t *row_count,
 		return EXIT_FAILURE;
 	}
 
+	// Nothing new since a cursor, so no array, as calloc(0) can be NULL
+	if (*row_count == 0) {
+		*bad_actors = 0;
+		if (sqlite3_close(db) != SQLITE_OK) {
+			fprintf(stderr, "Failed to close database\n");
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
 	sqlite3_stmt *select_bad_actors_stmt = 0;
-	char select_bad_actors[] =
-		GET_ROWS_DISTINCT_SOURCE_IP_WITH_COUNT_AND_DATE;
 	if (sqlite3_prepare_v2(db, select_bad_actors, -1,
 			       &select_bad_actors_stmt, NULL) != SQLITE_OK) {
 		fprintf(stderr, "Failed to prepare statement: %s\n",
@@ -495,8 +863,8 @@ int db_select_bad_actors(bad_actor ***bad_actors, int64_t *row_count,
 	return EXIT_SUCCESS;
 }
 
-int db_select_called_numbers(bad_actor ***phone_numbers, int64_t *row_count,
-			     sentrypeer_config const *config)
+int db_select_bad_actors(bad_actor ***bad_actors, int64_t *row_count,
+			 sentrypeer_config const *config)
 {
 	sqlite3 *db;
 	assert(config->db_file);
@@ -508,40 +876,303 @@ int db_select_called_numbers(bad_actor ***phone_numbers, int64_t *row_count,
 		return EXIT_FAILURE;
 	}
 
-	sqlite3_stmt *get_row_count_stmt = 0;
-	if (sqlite3_prepare_v2(db, GET_ROWS_DISTINCT_PHONE_NUMBER_COUNT, -1,
-			       &get_row_count_stmt, NULL) != SQLITE_OK) {
-		fprintf(stderr, "Failed to prepare statement: %s\n",
-			sqlite3_errmsg(db));
-		sqlite3_close(db);
+	const char *row_count_sql = GET_ROWS_DISTINCT_SOURCE_IP_COUNT;
+	const char *select_bad_actors =
+		GET_ROWS_DISTINCT_SOURCE_IP_WITH_COUNT_AND_DATE;
+	if (config->db_partition != DB_PARTITION_NONE) {
+		if (sqlite3_exec(db, CREATE_SOURCE_IP_ROLLUP, NULL, NULL,
+				 NULL) != SQLITE_OK ||
+		    db_partition_fan_out(db, ROLLUP_SOURCE_IP_FROM, config) !=
+			    EXIT_SUCCESS) {
+			fprintf(stderr, "Failed to roll up partitions: %s\n",
+				sqlite3_errmsg(db));
+			sqlite3_close(db);
+			return EXIT_FAILURE;
+		}
+		row_count_sql = GET_SOURCE_IP_ROLLUP_COUNT;
+		select_bad_actors = GET_SOURCE_IP_ROLLUP_WITH_COUNT_AND_DATE;
+	}
+
+	return select_bad_actor_rows(db, row_count_sql, select_bad_actors,
+				     bad_actors, row_count, config);
+}
+
+// The honey_id of the last row read from partition, 0 if there's no
+// cursor for it
+static int64_t partition_honey_id(int64_t const *cursors, size_t cursor_count,
+				  int64_t partition)
+{
+	for (size_t i = 0; i < cursor_count; i++) {
+		if (DB_CURSOR_PARTITION(cursors[i]) == partition) {
+			return DB_CURSOR_HONEY_ID(cursors[i]);
+		}
+	}
+
+	return 0;
+}
+
+// Roll up the rows in schema after after_honey_id, setting newest_honey_id
+// to its newest row
+static int rollup_since_in(sqlite3 *db, const char *schema,
+			   int64_t after_honey_id, int64_t *newest_honey_id)
+{
+	// Before the roll up, so a row added in between is sent again next
+	// time rather than never
+	sqlite3_stmt *stmt = 0;
+	if (db_partition_prepare(db, GET_MAX_HONEY_ID, schema, &stmt) !=
+	    EXIT_SUCCESS) {
 		return EXIT_FAILURE;
 	}
-	if (sqlite3_step(get_row_count_stmt) != SQLITE_ROW) {
+	if (sqlite3_step(stmt) != SQLITE_ROW) {
 		fprintf(stderr, "Error stepping statement: %s\n",
 			sqlite3_errmsg(db));
-		sqlite3_close(db);
+		sqlite3_finalize(stmt);
 		return EXIT_FAILURE;
 	}
+	*newest_honey_id = sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
 
-	*row_count = sqlite3_column_int64(get_row_count_stmt, 0);
-	assert(row_count);
-	if (config->debug_mode || config->verbose_mode) {
-		fprintf(stderr,
-			"Distinct called_number row count in honey table is: %" PRId64
-			"\n",
-			*row_count);
+	if (db_partition_prepare(db, ROLLUP_SOURCE_IP_SINCE, schema, &stmt) !=
+	    EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+	if (sqlite3_bind_int64(stmt, 1, after_honey_id) != SQLITE_OK ||
+	    sqlite3_step(stmt) != SQLITE_DONE) {
+		fprintf(stderr, "Failed to roll up %s since cursor: %s\n",
+			schema, sqlite3_errmsg(db));
+		sqlite3_finalize(stmt);
+		return EXIT_FAILURE;
 	}
+	sqlite3_finalize(stmt);
 
-	if (sqlite3_finalize(get_row_count_stmt) != SQLITE_OK) {
-		fprintf(stderr, "Error finalizing statement: %s\n",
-			sqlite3_errmsg(db));
-		sqlite3_close(db);
+	return EXIT_SUCCESS;
+}
+
+// Every partition is read on from its own cursor. A partition with nothing
+// new costs one seek on the honey_id primary key.
+static int rollup_since(sqlite3 *db, int64_t const *cursors,
+			size_t cursor_count, int64_t **next_cursors,
+			size_t *next_cursor_count,
+			sentrypeer_config const *config)
+{
+	char **files = 0;
+	size_t count = 0;
+	if (db_partition_files(config, &files, &count) != EXIT_SUCCESS) {
 		return EXIT_FAILURE;
 	}
 
-	sqlite3_stmt *select_phone_numbers_stmt = 0;
-	char select_called_numbers[] =
+	*next_cursors = calloc(count + 1, sizeof(int64_t));
+	assert(*next_cursors);
+	*next_cursor_count = 0;
+
+	int status = EXIT_SUCCESS;
+	for (size_t i = 0; i < count && status == EXIT_SUCCESS; i++) {
+		int64_t partition = db_partition_number(config, files[i]);
+		int64_t after_honey_id =
+			partition_honey_id(cursors, cursor_count, partition);
+		int64_t newest_honey_id = 0;
+
+		if (partition == 0) {
+			bool main_has_honey = false;
+			status = db_partition_main_has_honey(db,
+							     &main_has_honey);
+			if (status == EXIT_SUCCESS && main_has_honey) {
+				status = rollup_since_in(db, "main",
+							 after_honey_id,
+							 &newest_honey_id);
+			}
+		} else if (db_partition_attach(db, files[i]) != EXIT_SUCCESS) {
+			status = EXIT_FAILURE;
+		} else {
+			status = rollup_since_in(db, DB_PARTITION_SCHEMA,
+						 after_honey_id,
+						 &newest_honey_id);
+			if (db_partition_detach(db, files[i]) != EXIT_SUCCESS) {
+				status = EXIT_FAILURE;
+			}
+		}
+
+		if (status == EXIT_SUCCESS && newest_honey_id > 0) {
+			(*next_cursors)[(*next_cursor_count)++] =
+				DB_CURSOR(partition, newest_honey_id);
+		}
+	}
+	db_partition_files_destroy(&files, count);
+
+	if (status != EXIT_SUCCESS) {
+		free(*next_cursors);
+		*next_cursors = 0;
+		*next_cursor_count = 0;
+	}
+
+	return status;
+}
+
+int db_parse_cursors(const char *text, int64_t **cursors,
+		     size_t *cursor_count)
+{
+	assert(text);
+
+	// One more than the commas
+	size_t count = 1;
+	for (const char *c = text; *c != '\0'; c++) {
+		count += *c == ',';
+	}
+	*cursors = calloc(count, sizeof(int64_t));
+	assert(*cursors);
+	*cursor_count = 0;
+
+	const char *next = text;
+	while (*cursor_count < count) {
+		char *end = 0;
+		errno = 0;
+		long long parsed = strtoll(next, &end, 10);
+		if (errno != 0 || end == next || parsed < 0 ||
+		    (*end != ',' && *end != '\0') ||
+		    (*end == '\0') != (*cursor_count + 1 == count)) {
+			free(*cursors);
+			*cursors = 0;
+			*cursor_count = 0;
+			return EXIT_FAILURE;
+		}
+		(*cursors)[(*cursor_count)++] = parsed;
+		next = end + 1;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+char *db_format_cursors(int64_t const *cursors, size_t cursor_count)
+{
+	// 19 digits and a comma each
+	size_t text_len = cursor_count * 20 + 2;
+	char *text = calloc(text_len, sizeof(char));
+	assert(text);
+
+	if (cursor_count == 0) {
+		text[0] = '0';
+		return text;
+	}
+
+	size_t used = 0;
+	for (size_t i = 0; i < cursor_count; i++) {
+		int written = snprintf(text + used, text_len - used,
+				       "%s%" PRId64, i > 0 ? "," : "",
+				       cursors[i]);
+		assert(written >= 0 && (size_t)written < text_len - used);
+		used += (size_t)written;
+	}
+
+	return text;
+}
+
+int db_select_bad_actors_since(int64_t const *cursors, size_t cursor_count,
+			       bad_actor ***bad_actors, int64_t *row_count,
+			       int64_t **next_cursors,
+			       size_t *next_cursor_count,
+			       sentrypeer_config const *config)
+{
+	sqlite3 *db;
+	assert(config->db_file);
+
+	if (sqlite3_open(config->db_file, &db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to open database: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	if (sqlite3_exec(db, CREATE_SOURCE_IP_ROLLUP, NULL, NULL, NULL) !=
+		    SQLITE_OK ||
+	    rollup_since(db, cursors, cursor_count, next_cursors,
+			 next_cursor_count, config) != EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to roll up changes since cursors\n");
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr,
+			"Rolled up changes since %zu cursors, %zu next time\n",
+			cursor_count, *next_cursor_count);
+	}
+
+	int status = select_bad_actor_rows(
+		db, GET_SOURCE_IP_ROLLUP_COUNT,
+		GET_SOURCE_IP_ROLLUP_WITH_COUNT_AND_DATE, bad_actors, row_count,
+		config);
+	if (status != EXIT_SUCCESS) {
+		free(*next_cursors);
+		*next_cursors = 0;
+		*next_cursor_count = 0;
+	}
+
+	return status;
+}
+
+int db_select_called_numbers(bad_actor ***phone_numbers, int64_t *row_count,
+			     sentrypeer_config const *config)
+{
+	sqlite3 *db;
+	assert(config->db_file);
+
+	if (sqlite3_open(config->db_file, &db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to open database: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	const char *row_count_sql = GET_ROWS_DISTINCT_PHONE_NUMBER_COUNT;
+	const char *select_called_numbers =
 		GET_ROWS_DISTINCT_PHONE_NUMBER_WITH_COUNT_AND_DATE;
+	if (config->db_partition != DB_PARTITION_NONE) {
+		if (sqlite3_exec(db, CREATE_PHONE_NUMBER_ROLLUP, NULL, NULL,
+				 NULL) != SQLITE_OK ||
+		    db_partition_fan_out(db, ROLLUP_PHONE_NUMBER_FROM, config) !=
+			    EXIT_SUCCESS) {
+			fprintf(stderr, "Failed to roll up partitions: %s\n",
+				sqlite3_errmsg(db));
+			sqlite3_close(db);
+			return EXIT_FAILURE;
+		}
+		row_count_sql = GET_PHONE_NUMBER_ROLLUP_COUNT;
+		select_called_numbers =
+			GET_PHONE_NUMBER_ROLLUP_WITH_COUNT_AND_DATE;
+	}
+
+	sqlite3_stmt *get_row_count_stmt = 0;
+	if (sqlite3_prepare_v2(db, row_count_sql, -1, &get_row_count_stmt,
+			       NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare statement: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+	if (sqlite3_step(get_row_count_stmt) != SQLITE_ROW) {
+		fprintf(stderr, "Error stepping statement: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	*row_count = sqlite3_column_int64(get_row_count_stmt, 0);
+	assert(row_count);
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr,
+			"Distinct called_number row count in honey table is: %" PRId64
+			"\n",
+			*row_count);
+	}
+
+	if (sqlite3_finalize(get_row_count_stmt) != SQLITE_OK) {
+		fprintf(stderr, "Error finalizing statement: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	sqlite3_stmt *select_phone_numbers_stmt = 0;
 	if (sqlite3_prepare_v2(db, select_called_numbers, -1,
 			       &select_phone_numbers_stmt, NULL) != SQLITE_OK) {
 		fprintf(stderr, "Failed to prepare statement: %s\n",
@@ -616,14 +1247,15 @@ int db_select_called_numbers(bad_actor ***phone_numbers, int64_t *row_count,
 	return EXIT_SUCCESS;
 }
 
-int db_select_phone_number(const char *phone_number,
-			   bad_actor **phone_number_to_find,
-			   sentrypeer_config const *config)
+static int db_select_phone_number_in(const char *db_file,
+				     const char *phone_number,
+				     bad_actor **phone_number_to_find,
+				     sentrypeer_config const *config)
 {
 	sqlite3 *db;
-	assert(config->db_file);
+	assert(db_file);
 
-	if (sqlite3_open(config->db_file, &db) != SQLITE_OK) {
+	if (sqlite3_open(db_file, &db) != SQLITE_OK) {
 		fprintf(stderr, "Failed to open database: %s\n",
 			sqlite3_errmsg(db));
 		sqlite3_close(db);
@@ -688,3 +1320,994 @@ int db_select_phone_number(const char *phone_number,
 	*phone_number_to_find = phone_number_found;
 	return EXIT_SUCCESS;
 }
+
+// Columns may be NULL, e.g. no User-Agent header
+static char *db_column_string(sqlite3_stmt *stmt, int column)
+{
+	const unsigned char *value = sqlite3_column_text(stmt, column);
+	if (value == 0) {
+		return 0;
+	}
+
+	return util_duplicate_string((const char *)value);
+}
+
+static int
+db_select_bad_actor_by_event_uuid_in(const char *db_file,
+				     const char *event_uuid,
+				     bad_actor **bad_actor_to_find,
+				     sentrypeer_config const *config)
+{
+	sqlite3 *db;
+	assert(db_file);
+
+	if (sqlite3_open(db_file, &db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to open database: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+	sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+
+	// Older databases need the sip_message_id column before we can read
+	if (db_create_schema(db, config) != EXIT_SUCCESS) {
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	sqlite3_stmt *find_bad_actor_stmt = 0;
+	if (sqlite3_prepare_v2(db, GET_BAD_ACTOR_BY_EVENT_UUID, -1,
+			       &find_bad_actor_stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare statement: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	if (sqlite3_bind_text(find_bad_actor_stmt, 1, event_uuid, -1,
+			      SQLITE_STATIC) != SQLITE_OK) {
+		fprintf(stderr, "Failed to bind event_uuid: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_finalize(find_bad_actor_stmt);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	if (sqlite3_step(find_bad_actor_stmt) != SQLITE_ROW) {
+		sqlite3_finalize(find_bad_actor_stmt);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	// Rows from before schema version 1 still have the message inline
+	char *sip_message = db_column_string(find_bad_actor_stmt, 8);
+	if (sip_message == 0 &&
+	    sqlite3_column_type(find_bad_actor_stmt, 9) != SQLITE_NULL) {
+		sip_message = sip_message_store_get(
+			db, sqlite3_column_int64(find_bad_actor_stmt, 9));
+	}
+
+	bad_actor *bad_actor_found = bad_actor_new(
+		sip_message, db_column_string(find_bad_actor_stmt, 3), 0,
+		db_column_string(find_bad_actor_stmt, 4),
+		db_column_string(find_bad_actor_stmt, 6),
+		db_column_string(find_bad_actor_stmt, 5),
+		db_column_string(find_bad_actor_stmt, 7),
+		db_column_string(find_bad_actor_stmt, 2),
+		config->node_id);
+	assert(bad_actor_found);
+
+	// Keep the original event's identity, not the one bad_actor_new() made
+	free(bad_actor_found->event_timestamp);
+	bad_actor_found->event_timestamp =
+		db_column_string(find_bad_actor_stmt, 0);
+	free(bad_actor_found->event_uuid);
+	bad_actor_found->event_uuid = db_column_string(find_bad_actor_stmt, 1);
+	free(bad_actor_found->created_by_node_id);
+	bad_actor_found->created_by_node_id =
+		db_column_string(find_bad_actor_stmt, 10);
+
+	if (sqlite3_finalize(find_bad_actor_stmt) != SQLITE_OK) {
+		fprintf(stderr, "Error finalizing statement: %s\n",
+			sqlite3_errmsg(db));
+		bad_actor_destroy(&bad_actor_found);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	if (sqlite3_close(db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to close database\n");
+		bad_actor_destroy(&bad_actor_found);
+		return EXIT_FAILURE;
+	}
+
+	*bad_actor_to_find = bad_actor_found;
+	return EXIT_SUCCESS;
+}
+
+// Whether the honey table has column, which is false without a honey table
+static int db_honey_has_column(sqlite3 *db, const char *column,
+			       bool *has_column)
+{
+	sqlite3_stmt *column_exists_stmt = 0;
+	if (sqlite3_prepare_v2(db, HONEY_COLUMN_EXISTS, -1, &column_exists_stmt,
+			       NULL) != SQLITE_OK ||
+	    sqlite3_bind_text(column_exists_stmt, 1, column, -1,
+			      SQLITE_STATIC) != SQLITE_OK ||
+	    sqlite3_step(column_exists_stmt) != SQLITE_ROW) {
+		fprintf(stderr, "Failed to check for honey column %s: %s\n",
+			column, sqlite3_errmsg(db));
+		sqlite3_finalize(column_exists_stmt);
+		return EXIT_FAILURE;
+	}
+	*has_column = sqlite3_column_int(column_exists_stmt, 0);
+	sqlite3_finalize(column_exists_stmt);
+
+	return EXIT_SUCCESS;
+}
+
+// Add the totals for column in one file to counters
+static int db_load_heavy_hitters_in(const char *db_file, const char *column,
+				    heavy_hitters *counters)
+{
+	sqlite3 *db;
+	sqlite3_stmt *column_totals_stmt = 0;
+
+	if (sqlite3_open_v2(db_file, &db, SQLITE_OPEN_READONLY, NULL) !=
+	    SQLITE_OK) {
+		// Nothing logged yet
+		sqlite3_close(db);
+		return EXIT_SUCCESS;
+	}
+
+	// Read only, so a partition nobody has written to since an upgrade
+	// hasn't been migrated and has nothing to count
+	bool has_column = false;
+	if (db_honey_has_column(db, column, &has_column) != EXIT_SUCCESS) {
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+	if (!has_column) {
+		sqlite3_close(db);
+		return EXIT_SUCCESS;
+	}
+
+	char column_totals[256];
+	int written = snprintf(column_totals, sizeof(column_totals),
+			       GET_COLUMN_TOTALS, column, column, column);
+	if (written < 0 || (size_t)written >= sizeof(column_totals)) {
+		fprintf(stderr, "Column totals query is too long for: %s\n",
+			column);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+	if (sqlite3_prepare_v2(db, column_totals, -1, &column_totals_stmt,
+			       NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare statement: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	while (sqlite3_step(column_totals_stmt) == SQLITE_ROW) {
+		heavy_hitters_add(
+			counters,
+			(const char *)sqlite3_column_text(column_totals_stmt, 0),
+			util_parse_event_timestamp((const char *)sqlite3_column_text(
+				column_totals_stmt, 2)),
+			util_parse_event_timestamp((const char *)sqlite3_column_text(
+				column_totals_stmt, 3)),
+			(uint64_t)sqlite3_column_int64(column_totals_stmt, 1));
+	}
+
+	if (sqlite3_finalize(column_totals_stmt) != SQLITE_OK) {
+		fprintf(stderr, "Error finalizing statement: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	if (sqlite3_close(db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to close database\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Point lookups check each partition in turn, newest first
+bool db_bad_actor_exists(const char *bad_actor_event_uuid,
+			 sentrypeer_config const *config)
+{
+	char **db_files = 0;
+	size_t db_file_count = 0;
+	if (db_partition_files(config, &db_files, &db_file_count) !=
+	    EXIT_SUCCESS) {
+		return false;
+	}
+
+	bool found = false;
+	for (size_t i = 0; i < db_file_count && !found; i++) {
+		found = db_bad_actor_exists_in(db_files[i],
+					       bad_actor_event_uuid, config);
+	}
+	db_partition_files_destroy(&db_files, db_file_count);
+
+	return found;
+}
+
+static int db_each_event_uuid_in(const char *db_file, db_event_uuid_fn fn,
+				 void *arg)
+{
+	sqlite3 *db;
+	sqlite3_stmt *event_uuids_stmt = 0;
+
+	if (sqlite3_open_v2(db_file, &db, SQLITE_OPEN_READONLY, NULL) !=
+	    SQLITE_OK) {
+		// Nothing logged yet
+		sqlite3_close(db);
+		return EXIT_SUCCESS;
+	}
+
+	// config->db_file never has one if partitioning was on from the start
+	bool has_honey = false;
+	if (db_partition_main_has_honey(db, &has_honey) != EXIT_SUCCESS ||
+	    !has_honey) {
+		sqlite3_close(db);
+		return EXIT_SUCCESS;
+	}
+
+	if (sqlite3_prepare_v2(db, GET_EVENT_UUIDS, -1, &event_uuids_stmt,
+			       NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare statement: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	while (sqlite3_step(event_uuids_stmt) == SQLITE_ROW) {
+		fn(arg, (const char *)sqlite3_column_text(event_uuids_stmt, 0));
+	}
+
+	if (sqlite3_finalize(event_uuids_stmt) != SQLITE_OK) {
+		fprintf(stderr, "Error finalizing statement: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	if (sqlite3_close(db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to close database\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int db_each_event_uuid(db_event_uuid_fn fn, void *arg,
+		       sentrypeer_config const *config)
+{
+	char **db_files = 0;
+	size_t db_file_count = 0;
+	if (db_partition_files(config, &db_files, &db_file_count) !=
+	    EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	int status = EXIT_SUCCESS;
+	for (size_t i = 0; i < db_file_count && status == EXIT_SUCCESS; i++) {
+		status = db_each_event_uuid_in(db_files[i], fn, arg);
+	}
+	db_partition_files_destroy(&db_files, db_file_count);
+
+	return status;
+}
+
+static const char *db_column_text(sqlite3_stmt *stmt, int column)
+{
+	return (const char *)sqlite3_column_text(stmt, column);
+}
+
+static int db_each_honey_row_in(const char *db_file, int64_t partition,
+				int64_t cursor, db_honey_row_fn fn, void *arg,
+				sentrypeer_config const *config)
+{
+	sqlite3 *db;
+	sqlite3_stmt *honey_rows_stmt = 0;
+
+	if (sqlite3_open_v2(db_file, &db, SQLITE_OPEN_READWRITE, NULL) !=
+	    SQLITE_OK) {
+		// Nothing logged yet
+		sqlite3_close(db);
+		return EXIT_SUCCESS;
+	}
+	sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+
+	// Older databases need the newer columns before we can read, but
+	// config->db_file has no honey table at all if partitioning was on
+	// from the start
+	bool has_honey = false;
+	if (db_partition_main_has_honey(db, &has_honey) != EXIT_SUCCESS ||
+	    !has_honey) {
+		sqlite3_close(db);
+		return EXIT_SUCCESS;
+	}
+	if (db_create_schema(db, config) != EXIT_SUCCESS) {
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	if (sqlite3_prepare_v2(db, GET_HONEY_ROWS_SINCE, -1, &honey_rows_stmt,
+			       NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare statement: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	// Everything in a partition newer than the cursor's
+	int64_t after_honey_id = DB_CURSOR_PARTITION(cursor) == partition ?
+					 DB_CURSOR_HONEY_ID(cursor) :
+					 0;
+	sqlite3_bind_int64(honey_rows_stmt, 1, after_honey_id);
+
+	// Scanners send the same message over and over, so only decode a
+	// stored body when it changes
+	sqlite3_int64 sip_message_id = 0;
+	char *sip_message = 0;
+
+	int status = EXIT_SUCCESS;
+	int rc = SQLITE_DONE;
+	while (status == EXIT_SUCCESS &&
+	       (rc = sqlite3_step(honey_rows_stmt)) == SQLITE_ROW) {
+		db_honey_row row = {
+			.cursor = DB_CURSOR(
+				partition,
+				sqlite3_column_int64(honey_rows_stmt, 0)),
+			.event_timestamp = db_column_text(honey_rows_stmt, 1),
+			.event_uuid = db_column_text(honey_rows_stmt, 2),
+			.collected_method = db_column_text(honey_rows_stmt, 3),
+			.source_ip = db_column_text(honey_rows_stmt, 4),
+			.called_number = db_column_text(honey_rows_stmt, 5),
+			.transport_type = db_column_text(honey_rows_stmt, 6),
+			.method = db_column_text(honey_rows_stmt, 7),
+			.user_agent = db_column_text(honey_rows_stmt, 8),
+			.sip_message = db_column_text(honey_rows_stmt, 9),
+			.created_by_node_id =
+				db_column_text(honey_rows_stmt, 11),
+			.country_code = db_column_text(honey_rows_stmt, 12),
+			.city = db_column_text(honey_rows_stmt, 13),
+			.has_asn = sqlite3_column_type(honey_rows_stmt, 14) !=
+				   SQLITE_NULL,
+			.asn = sqlite3_column_int64(honey_rows_stmt, 14),
+			.as_org = db_column_text(honey_rows_stmt, 15),
+		};
+
+		// Rows from before schema version 1 still have the message
+		// inline
+		if (row.sip_message == 0 &&
+		    sqlite3_column_type(honey_rows_stmt, 10) != SQLITE_NULL) {
+			sqlite3_int64 row_sip_message_id =
+				sqlite3_column_int64(honey_rows_stmt, 10);
+			if (sip_message == 0 ||
+			    row_sip_message_id != sip_message_id) {
+				free(sip_message);
+				sip_message = sip_message_store_get(
+					db, row_sip_message_id);
+				sip_message_id = row_sip_message_id;
+			}
+			row.sip_message = sip_message;
+		}
+
+		status = fn(arg, &row);
+	}
+	free(sip_message);
+
+	if (status == EXIT_SUCCESS && rc != SQLITE_DONE) {
+		fprintf(stderr, "Error stepping statement: %s\n",
+			sqlite3_errmsg(db));
+		status = EXIT_FAILURE;
+	}
+
+	if (sqlite3_finalize(honey_rows_stmt) != SQLITE_OK &&
+	    status == EXIT_SUCCESS) {
+		fprintf(stderr, "Error finalizing statement: %s\n",
+			sqlite3_errmsg(db));
+		status = EXIT_FAILURE;
+	}
+
+	if (sqlite3_close(db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to close database\n");
+		return EXIT_FAILURE;
+	}
+
+	return status;
+}
+
+int db_each_honey_row_since(int64_t cursor, db_honey_row_fn fn, void *arg,
+			    sentrypeer_config const *config)
+{
+	char **db_files = 0;
+	size_t db_file_count = 0;
+	if (db_partition_files(config, &db_files, &db_file_count) !=
+	    EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	// Oldest first, config->db_file is last and partition 0
+	int status = EXIT_SUCCESS;
+	for (size_t i = db_file_count; i > 0 && status == EXIT_SUCCESS; i--) {
+		int64_t partition = db_partition_number(config, db_files[i - 1]);
+		if (partition < DB_CURSOR_PARTITION(cursor)) {
+			continue;
+		}
+		status = db_each_honey_row_in(db_files[i - 1], partition,
+					      cursor, fn, arg, config);
+	}
+	db_partition_files_destroy(&db_files, db_file_count);
+
+	return status;
+}
+
+int db_each_honey_row_since_each(int64_t const *cursors, size_t cursor_count,
+				 db_honey_row_fn fn, void *arg,
+				 sentrypeer_config const *config)
+{
+	char **db_files = 0;
+	size_t db_file_count = 0;
+	if (db_partition_files(config, &db_files, &db_file_count) !=
+	    EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	// Oldest first, config->db_file is last and partition 0
+	int status = EXIT_SUCCESS;
+	for (size_t i = db_file_count; i > 0 && status == EXIT_SUCCESS; i--) {
+		int64_t partition = db_partition_number(config, db_files[i - 1]);
+		int64_t cursor = DB_CURSOR(
+			partition,
+			partition_honey_id(cursors, cursor_count, partition));
+		status = db_each_honey_row_in(db_files[i - 1], partition,
+					      cursor, fn, arg, config);
+	}
+	db_partition_files_destroy(&db_files, db_file_count);
+
+	return status;
+}
+
+static int db_newest_honey_id_in(const char *db_file, int64_t *honey_id)
+{
+	sqlite3 *db;
+
+	*honey_id = 0;
+	if (sqlite3_open_v2(db_file, &db, SQLITE_OPEN_READONLY, NULL) !=
+	    SQLITE_OK) {
+		// Nothing logged yet
+		sqlite3_close(db);
+		return EXIT_SUCCESS;
+	}
+	sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+
+	bool has_honey = false;
+	sqlite3_stmt *stmt = 0;
+	int status = db_partition_main_has_honey(db, &has_honey);
+	if (status == EXIT_SUCCESS && has_honey) {
+		status = db_partition_prepare(db, GET_MAX_HONEY_ID, "main",
+					      &stmt);
+	}
+	if (stmt != 0) {
+		if (sqlite3_step(stmt) == SQLITE_ROW) {
+			*honey_id = sqlite3_column_int64(stmt, 0);
+		} else {
+			fprintf(stderr, "Error stepping statement: %s\n",
+				sqlite3_errmsg(db));
+			status = EXIT_FAILURE;
+		}
+		sqlite3_finalize(stmt);
+	}
+
+	if (sqlite3_close(db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to close database\n");
+		return EXIT_FAILURE;
+	}
+
+	return status;
+}
+
+int db_select_partition_cursors(int64_t **cursors, size_t *cursor_count,
+				sentrypeer_config const *config)
+{
+	char **db_files = 0;
+	size_t db_file_count = 0;
+	if (db_partition_files(config, &db_files, &db_file_count) !=
+	    EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	*cursors = calloc(db_file_count + 1, sizeof(int64_t));
+	assert(*cursors);
+	*cursor_count = 0;
+
+	int status = EXIT_SUCCESS;
+	for (size_t i = 0; i < db_file_count && status == EXIT_SUCCESS; i++) {
+		int64_t honey_id = 0;
+		status = db_newest_honey_id_in(db_files[i], &honey_id);
+		if (status == EXIT_SUCCESS && honey_id > 0) {
+			(*cursors)[(*cursor_count)++] = DB_CURSOR(
+				db_partition_number(config, db_files[i]),
+				honey_id);
+		}
+	}
+	db_partition_files_destroy(&db_files, db_file_count);
+
+	return status;
+}
+
+int db_select_bad_actor_by_ip(const char *bad_actor_ip_address,
+			      bad_actor **bad_actor_to_find,
+			      sentrypeer_config const *config)
+{
+	char **db_files = 0;
+	size_t db_file_count = 0;
+	if (db_partition_files(config, &db_files, &db_file_count) !=
+	    EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	int status = EXIT_FAILURE;
+	for (size_t i = 0; i < db_file_count && status != EXIT_SUCCESS; i++) {
+		status = db_select_bad_actor_by_ip_in(db_files[i],
+						      bad_actor_ip_address,
+						      bad_actor_to_find, config);
+	}
+	db_partition_files_destroy(&db_files, db_file_count);
+
+	return status;
+}
+
+int db_select_phone_number(const char *phone_number,
+			   bad_actor **phone_number_to_find,
+			   sentrypeer_config const *config)
+{
+	char **db_files = 0;
+	size_t db_file_count = 0;
+	if (db_partition_files(config, &db_files, &db_file_count) !=
+	    EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	int status = EXIT_FAILURE;
+	for (size_t i = 0; i < db_file_count && status != EXIT_SUCCESS; i++) {
+		status = db_select_phone_number_in(db_files[i], phone_number,
+						   phone_number_to_find,
+						   config);
+	}
+	db_partition_files_destroy(&db_files, db_file_count);
+
+	return status;
+}
+
+int db_select_bad_actor_by_event_uuid(const char *event_uuid,
+				      bad_actor **bad_actor_to_find,
+				      sentrypeer_config const *config)
+{
+	char **db_files = 0;
+	size_t db_file_count = 0;
+	if (db_partition_files(config, &db_files, &db_file_count) !=
+	    EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	int status = EXIT_FAILURE;
+	for (size_t i = 0; i < db_file_count && status != EXIT_SUCCESS; i++) {
+		status = db_select_bad_actor_by_event_uuid_in(
+			db_files[i], event_uuid, bad_actor_to_find, config);
+	}
+	db_partition_files_destroy(&db_files, db_file_count);
+
+	return status;
+}
+
+int db_load_heavy_hitters(const char *column, heavy_hitters *counters,
+			  sentrypeer_config const *config)
+{
+	char **db_files = 0;
+	size_t db_file_count = 0;
+	if (db_partition_files(config, &db_files, &db_file_count) !=
+	    EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	int status = EXIT_SUCCESS;
+	for (size_t i = 0; i < db_file_count && status == EXIT_SUCCESS; i++) {
+		status = db_load_heavy_hitters_in(db_files[i], column,
+						  counters);
+	}
+	db_partition_files_destroy(&db_files, db_file_count);
+
+	return status;
+}
+
+static int db_load_ip_address_log_in(const char *db_file, ip_address_log *log)
+{
+	sqlite3 *db;
+	sqlite3_stmt *seen_first_stmt = 0;
+
+	if (sqlite3_open_v2(db_file, &db, SQLITE_OPEN_READONLY, NULL) !=
+	    SQLITE_OK) {
+		// Nothing logged yet
+		sqlite3_close(db);
+		return EXIT_SUCCESS;
+	}
+
+	if (sqlite3_prepare_v2(db, GET_IP_ADDRESSES_SEEN_FIRST, -1,
+			       &seen_first_stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare statement: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	while (sqlite3_step(seen_first_stmt) == SQLITE_ROW) {
+		ip_address_log_add(
+			log, (const char *)sqlite3_column_text(seen_first_stmt, 0),
+			util_parse_event_timestamp((const char *)sqlite3_column_text(
+				seen_first_stmt, 1)));
+	}
+
+	if (sqlite3_finalize(seen_first_stmt) != SQLITE_OK) {
+		fprintf(stderr, "Error finalizing statement: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	if (sqlite3_close(db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to close database\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int db_load_ip_address_log(ip_address_log *log,
+			   sentrypeer_config const *config)
+{
+	char **db_files = 0;
+	size_t db_file_count = 0;
+	if (db_partition_files(config, &db_files, &db_file_count) !=
+	    EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	// Partitions come newest first, an address seen in more than one
+	// keeps its earliest seen_first and the sort puts it in its place
+	int status = EXIT_SUCCESS;
+	for (size_t i = 0; i < db_file_count && status == EXIT_SUCCESS; i++) {
+		status = db_load_ip_address_log_in(db_files[i], log);
+	}
+	db_partition_files_destroy(&db_files, db_file_count);
+	ip_address_log_sort(log);
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Loaded %zu IP addresses into log\n",
+			ip_address_log_size(log));
+	}
+
+	return status;
+}
+
+// config->db_file, with the event_series table in it
+static sqlite3 *db_event_series_open(sentrypeer_config const *config)
+{
+	sqlite3 *db;
+
+	if (sqlite3_open(config->db_file, &db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to open database\n");
+		sqlite3_close(db);
+		return 0;
+	}
+	sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+
+	if (sqlite3_exec(db, DB_SET_JOURNAL_MODE, NULL, NULL, NULL) !=
+		    SQLITE_OK ||
+	    sqlite3_exec(db, CREATE_EVENT_SERIES_TABLE, NULL, NULL, NULL) !=
+		    SQLITE_OK) {
+		fprintf(stderr, "Failed to create event_series table: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return 0;
+	}
+
+	return db;
+}
+
+// Minute buckets older than EVENT_SERIES_MINUTES minutes ago, and hour
+// buckets older than EVENT_SERIES_HOURS hours ago, have been reused
+static int db_event_series_bind_window(sqlite3_stmt *stmt, time_t now)
+{
+	if (sqlite3_bind_int(stmt, 1, EVENT_SERIES_MINUTE) != SQLITE_OK ||
+	    sqlite3_bind_int64(stmt, 2,
+			       now - (int64_t)EVENT_SERIES_MINUTES *
+					     EVENT_SERIES_MINUTE) != SQLITE_OK ||
+	    sqlite3_bind_int(stmt, 3, EVENT_SERIES_HOUR) != SQLITE_OK ||
+	    sqlite3_bind_int64(stmt, 4,
+			       now - (int64_t)EVENT_SERIES_HOURS *
+					     EVENT_SERIES_HOUR) != SQLITE_OK) {
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int db_load_event_series_saved(sqlite3 *db, event_series *series)
+{
+	sqlite3_stmt *event_series_stmt = 0;
+
+	if (sqlite3_prepare_v2(db, GET_EVENT_SERIES, -1, &event_series_stmt,
+			       NULL) != SQLITE_OK ||
+	    db_event_series_bind_window(event_series_stmt, time(NULL)) !=
+		    EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to prepare statement: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_finalize(event_series_stmt);
+		return EXIT_FAILURE;
+	}
+
+	while (sqlite3_step(event_series_stmt) == SQLITE_ROW) {
+		event_series_set(
+			series, sqlite3_column_int(event_series_stmt, 0),
+			(time_t)sqlite3_column_int64(event_series_stmt, 1),
+			(const char *)sqlite3_column_text(event_series_stmt, 2),
+			(const char *)sqlite3_column_text(event_series_stmt, 3),
+			(const char *)sqlite3_column_text(event_series_stmt, 4),
+			(uint64_t)sqlite3_column_int64(event_series_stmt, 5));
+	}
+
+	if (sqlite3_finalize(event_series_stmt) != SQLITE_OK) {
+		fprintf(stderr, "Error finalizing statement: %s\n",
+			sqlite3_errmsg(db));
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int db_forget_event_series_since(sqlite3 *db, time_t since)
+{
+	sqlite3_stmt *delete_stmt = 0;
+
+	if (sqlite3_prepare_v2(db, DELETE_EVENT_SERIES_SINCE, -1, &delete_stmt,
+			       NULL) != SQLITE_OK ||
+	    sqlite3_bind_int64(delete_stmt, 1, since) != SQLITE_OK ||
+	    sqlite3_step(delete_stmt) != SQLITE_DONE) {
+		fprintf(stderr, "Failed to delete event_series: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_finalize(delete_stmt);
+		return EXIT_FAILURE;
+	}
+
+	return sqlite3_finalize(delete_stmt) == SQLITE_OK ? EXIT_SUCCESS :
+							     EXIT_FAILURE;
+}
+
+static int db_count_event_series_in(const char *db_file, const char *since,
+				    event_series *series)
+{
+	sqlite3 *db;
+	sqlite3_stmt *since_stmt = 0;
+
+	if (sqlite3_open_v2(db_file, &db, SQLITE_OPEN_READONLY, NULL) !=
+	    SQLITE_OK) {
+		// Nothing logged yet
+		sqlite3_close(db);
+		return EXIT_SUCCESS;
+	}
+
+	if (sqlite3_prepare_v2(db, GET_EVENT_SERIES_SINCE, -1, &since_stmt,
+			       NULL) != SQLITE_OK) {
+		// config->db_file has no honey table with partitioning on
+		// from the start
+		int status = strstr(sqlite3_errmsg(db), "no such table") != 0 ?
+				     EXIT_SUCCESS :
+				     EXIT_FAILURE;
+		if (status != EXIT_SUCCESS) {
+			fprintf(stderr, "Failed to prepare statement: %s\n",
+				sqlite3_errmsg(db));
+		}
+		sqlite3_close(db);
+		return status;
+	}
+
+	if (sqlite3_bind_text(since_stmt, 1, since, -1, SQLITE_STATIC) !=
+	    SQLITE_OK) {
+		fprintf(stderr, "Failed to bind since: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_finalize(since_stmt);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	while (sqlite3_step(since_stmt) == SQLITE_ROW) {
+		char minute[TIMESTAMP_LEN];
+		snprintf(minute, sizeof(minute), "%s:00",
+			 (const char *)sqlite3_column_text(since_stmt, 0));
+		event_series_add(
+			series, util_parse_event_timestamp(minute),
+			(const char *)sqlite3_column_text(since_stmt, 1),
+			(const char *)sqlite3_column_text(since_stmt, 2),
+			(const char *)sqlite3_column_text(since_stmt, 3),
+			(uint64_t)sqlite3_column_int64(since_stmt, 4));
+	}
+
+	if (sqlite3_finalize(since_stmt) != SQLITE_OK) {
+		fprintf(stderr, "Error finalizing statement: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	if (sqlite3_close(db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to close database\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int db_load_event_series(event_series *series,
+			 sentrypeer_config const *config)
+{
+	sqlite3 *db = db_event_series_open(config);
+	if (db == 0 || db_load_event_series_saved(db, series) != EXIT_SUCCESS) {
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	// Count the newest saved hour again, as we may have stopped part way
+	// through it, or as far back as the hours go the first time round
+	time_t since = event_series_newest(series, EVENT_SERIES_HOUR);
+	if (since == 0) {
+		since = time(NULL) -
+			(time_t)(EVENT_SERIES_HOURS - 1) * EVENT_SERIES_HOUR;
+		since -= since % EVENT_SERIES_HOUR;
+	}
+
+	if (db_forget_event_series_since(db, since) != EXIT_SUCCESS) {
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+	if (sqlite3_close(db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to close database\n");
+		return EXIT_FAILURE;
+	}
+	event_series_clear_since(series, since);
+
+	char since_timestamp[TIMESTAMP_LEN];
+	util_format_seen_time(since, since_timestamp, sizeof(since_timestamp));
+	// Partitions are newest first, and once one starts on or before
+	// since_day the rest are older than since
+	char since_day[DB_PARTITION_DATE_LEN + 1];
+	struct tm since_tm;
+	localtime_r(&since, &since_tm);
+	strftime(since_day, sizeof(since_day), "%Y%m%d", &since_tm);
+	int64_t since_partition = strtoll(since_day, NULL, 10);
+
+	char **db_files = 0;
+	size_t db_file_count = 0;
+	if (db_partition_files(config, &db_files, &db_file_count) !=
+	    EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	int status = EXIT_SUCCESS;
+	for (size_t i = 0; i < db_file_count && status == EXIT_SUCCESS; i++) {
+		status = db_count_event_series_in(db_files[i], since_timestamp,
+						  series);
+		int64_t partition = db_partition_number(config, db_files[i]);
+		if (partition != 0 && partition <= since_partition) {
+			break;
+		}
+	}
+	db_partition_files_destroy(&db_files, db_file_count);
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Counted events since %s into event series\n",
+			since_timestamp);
+	}
+
+	return status;
+}
+
+static int db_save_event_series_counts(const event_series_count *counts,
+				       size_t count,
+				       sentrypeer_config const *config)
+{
+	sqlite3_stmt *set_count_stmt = 0;
+	sqlite3_stmt *delete_stmt = 0;
+
+	sqlite3 *db = db_event_series_open(config);
+	if (db == 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) !=
+		    SQLITE_OK ||
+	    sqlite3_prepare_v2(db, SET_EVENT_SERIES_COUNT, -1, &set_count_stmt,
+			       NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(db, DELETE_EVENT_SERIES_BEFORE, -1,
+			       &delete_stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare statement: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_finalize(set_count_stmt);
+		sqlite3_finalize(delete_stmt);
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	int rc = SQLITE_DONE;
+	for (size_t i = 0; i < count && rc == SQLITE_DONE; i++) {
+		sqlite3_bind_int(set_count_stmt, 1, counts[i].resolution);
+		sqlite3_bind_int64(set_count_stmt, 2, counts[i].bucket);
+		sqlite3_bind_text(set_count_stmt, 3, counts[i].key->method, -1,
+				  SQLITE_STATIC);
+		sqlite3_bind_text(set_count_stmt, 4,
+				  counts[i].key->transport_type, -1,
+				  SQLITE_STATIC);
+		sqlite3_bind_text(set_count_stmt, 5,
+				  counts[i].key->collected_method, -1,
+				  SQLITE_STATIC);
+		sqlite3_bind_int64(set_count_stmt, 6,
+				   (sqlite3_int64)counts[i].count);
+		rc = sqlite3_step(set_count_stmt);
+		sqlite3_reset(set_count_stmt);
+	}
+
+	if (rc == SQLITE_DONE &&
+	    db_event_series_bind_window(delete_stmt, time(NULL)) ==
+		    EXIT_SUCCESS) {
+		rc = sqlite3_step(delete_stmt);
+	}
+
+	sqlite3_finalize(set_count_stmt);
+	sqlite3_finalize(delete_stmt);
+
+	if (rc != SQLITE_DONE ||
+	    sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to save event series: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	if (sqlite3_close(db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to close database\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int db_save_event_series(event_series *series,
+			 sentrypeer_config const *config)
+{
+	event_series_count *counts = 0;
+	size_t count = 0;
+	event_series_take_dirty(series, &counts, &count);
+	if (count == 0) {
+		free(counts);
+		return EXIT_SUCCESS;
+	}
+
+	int status = db_save_event_series_counts(counts, count, config);
+	if (status != EXIT_SUCCESS) {
+		event_series_mark_dirty(series, counts, count);
+	} else if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Saved %zu event series counts\n", count);
+	}
+	free(counts);
+
+	return status;
+}
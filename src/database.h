@@ -18,11 +18,45 @@
 
 #include "bad_actor.h"
 #include "conf.h"
+#include "event_series.h"
+#include "heavy_hitters.h"
+#include "ip_address_log.h"
 
 #define DEFAULT_DB_FILE_NAME "sentrypeer.db"
+// PRAGMA user_version. 1: raw SIP messages stored once in sip_messages,
+// 2: country_code, city, asn and as_org from GeoIP
+#define DB_SCHEMA_VERSION 2
+// Writers wait this long for db_maintenance to finish a step
+#define DB_BUSY_TIMEOUT_MS 5000
+// PRAGMA auto_vacuum value, so db_maintenance can give pages back a few at
+// a time instead of a full VACUUM
+#define DB_AUTO_VACUUM_INCREMENTAL 2
+#define DB_SET_AUTO_VACUUM "PRAGMA auto_vacuum = INCREMENTAL;"
+#define DB_SET_JOURNAL_MODE "PRAGMA journal_mode = WAL;"
+#define DB_HAS_STATS                                                           \
+	"SELECT EXISTS(SELECT 1 FROM sqlite_master WHERE name = 'sqlite_stat1');"
 
 int db_insert_bad_actor(bad_actor const *bad_actor_event,
 			sentrypeer_config const *config);
+// All or none of them, in one transaction
+int db_insert_bad_actors(bad_actor const *const *bad_actor_events,
+			 size_t count, sentrypeer_config const *config);
+
+/**
+ * Open a database file to load a lot of bad actors into, e.g. for
+ * --import-json. The honey indexes are dropped until db_bulk_close(), so
+ * nothing else should be using the file meanwhile.
+ *
+ * @param db_file config->db_file or one of its partitions.
+ * @param config Our config.
+ * @return The handle, or NULL on failure.
+ */
+sqlite3 *db_bulk_open(const char *db_file, sentrypeer_config const *config);
+// All or none of them, in one transaction, as with db_insert_bad_actors()
+int db_bulk_insert(sqlite3 *db, bad_actor const *const *bad_actor_events,
+		   size_t count, sentrypeer_config const *config);
+// Build the indexes again and close. NULL is fine.
+int db_bulk_close(sqlite3 **db_ptr, sentrypeer_config const *config);
 
 #define GET_BAD_ACTOR_BY_IP                                                    \
 	"SELECT DISTINCT(source_ip) FROM honey WHERE source_ip = ?;"
@@ -30,18 +64,165 @@ int db_select_bad_actor_by_ip(const char *bad_actor_ip_address,
 			      bad_actor **bad_actor,
 			      sentrypeer_config const *config);
 
+// sip_message is only set on rows from before DB_SCHEMA_VERSION 1,
+// newer rows reference sip_messages via sip_message_id
+#define GET_BAD_ACTOR_BY_EVENT_UUID                                            \
+	"SELECT event_timestamp, event_uuid, collected_method, source_ip, called_number, transport_type, method, user_agent, sip_message, sip_message_id, created_by_node_id FROM honey WHERE event_uuid = ? LIMIT 1;"
+int db_select_bad_actor_by_event_uuid(const char *event_uuid,
+				      bad_actor **bad_actor,
+				      sentrypeer_config const *config);
+
 #define BAD_ACTOR_EXISTS                                                       \
 	"SELECT EXISTS(SELECT 1 FROM honey WHERE event_uuid = ?);"
 bool db_bad_actor_exists(const char *bad_actor_event_uuid,
 			 sentrypeer_config const *config);
 
+#define GET_EVENT_UUIDS                                                        \
+	"SELECT event_uuid FROM honey WHERE event_uuid IS NOT NULL;"
+typedef void (*db_event_uuid_fn)(void *arg, const char *event_uuid);
+// Call fn with every event_uuid, across all partitions
+int db_each_event_uuid(db_event_uuid_fn fn, void *arg,
+		       sentrypeer_config const *config);
+
+#define GET_HONEY_ROWS_SINCE                                                   \
+	"SELECT honey_id, event_timestamp, event_uuid, collected_method, source_ip, called_number, transport_type, method, user_agent, sip_message, sip_message_id, created_by_node_id, country_code, city, asn, as_org FROM honey WHERE honey_id > ? ORDER BY honey_id;"
+// A honey row, only valid during the db_honey_row_fn call. Strings are
+// NULL when the column is.
+typedef struct db_honey_row db_honey_row;
+struct db_honey_row {
+	int64_t cursor;
+	const char *event_timestamp;
+	const char *event_uuid;
+	const char *collected_method;
+	const char *source_ip;
+	const char *called_number;
+	const char *transport_type;
+	const char *method;
+	const char *user_agent;
+	const char *sip_message;
+	const char *created_by_node_id;
+	const char *country_code;
+	const char *city;
+	bool has_asn;
+	int64_t asn;
+	const char *as_org;
+};
+// Return EXIT_FAILURE to stop
+typedef int (*db_honey_row_fn)(void *arg, db_honey_row const *row);
+/**
+ * Call fn with every honey row after cursor, oldest first and across all
+ * partitions, one row at a time so any amount can be exported.
+ *
+ * @param cursor From an earlier row's cursor, 0 for everything.
+ * @param fn Called with each row.
+ * @param arg Passed to fn.
+ * @param config Our config.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the rows couldn't be read or fn
+ *         stopped us.
+ */
+int db_each_honey_row_since(int64_t cursor, db_honey_row_fn fn, void *arg,
+			    sentrypeer_config const *config);
+/**
+ * Like db_each_honey_row_since(), but with a cursor for each partition
+ * instead of one for them all. Rows written to an older partition after
+ * it was last read, e.g. by db_import, sort below newer partitions'
+ * cursors and are only found this way.
+ *
+ * @param cursors The cursor of the last row read from each partition.
+ *        Partitions without one are read from the start.
+ * @param cursor_count How many.
+ * @param fn Called with each row.
+ * @param arg Passed to fn.
+ * @param config Our config.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the rows couldn't be read or fn
+ *         stopped us.
+ */
+int db_each_honey_row_since_each(int64_t const *cursors, size_t cursor_count,
+				 db_honey_row_fn fn, void *arg,
+				 sentrypeer_config const *config);
+/**
+ * The cursor of the newest row in each partition that has any, newest
+ * partition first, e.g. for db_select_bad_actors_since().
+ *
+ * @param cursors Set to an array to free().
+ * @param cursor_count Set to how many.
+ * @param config Our config.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int db_select_partition_cursors(int64_t **cursors, size_t *cursor_count,
+				sentrypeer_config const *config);
+
 #define GET_ROWS_DISTINCT_SOURCE_IP_COUNT                                      \
 	"SELECT COUNT(DISTINCT source_ip) from honey;"
 #define GET_ROWS_DISTINCT_SOURCE_IP_WITH_COUNT_AND_DATE                        \
 	"SELECT source_ip, max(event_timestamp) as seen_last, count(source_ip) as seen_total FROM honey GROUP BY source_ip order by event_timestamp DESC;"
+// With partitioning on, each partition is rolled up into a TEMP table
+// and the totals come from that
+#define CREATE_SOURCE_IP_ROLLUP                                                \
+	"CREATE TEMP TABLE source_ip_rollup (source_ip TEXT, seen_last TEXT, seen_total INTEGER);"
+#define ROLLUP_SOURCE_IP_FROM                                                  \
+	"INSERT INTO temp.source_ip_rollup SELECT source_ip, max(event_timestamp), count(source_ip) FROM %s.honey GROUP BY source_ip;"
+#define GET_SOURCE_IP_ROLLUP_COUNT                                             \
+	"SELECT COUNT(DISTINCT source_ip) from temp.source_ip_rollup;"
+#define GET_SOURCE_IP_ROLLUP_WITH_COUNT_AND_DATE                               \
+	"SELECT source_ip, max(seen_last) as seen_last, sum(seen_total) as seen_total FROM temp.source_ip_rollup GROUP BY source_ip order by seen_last DESC;"
 int db_select_bad_actors(bad_actor ***bad_actors, int64_t *row_count,
 			 sentrypeer_config const *config);
 
+// A change cursor is a partition's number (see db_partition_number()) in
+// the top bits and a honey_id in the rest. honey_id only goes up within a
+// partition, but rows can still land in an older partition after a newer
+// one has some, e.g. a batch that straddles midnight or db_import, so
+// changes are followed with a cursor for each partition.
+#define DB_CURSOR_HONEY_ID_BITS 36
+#define DB_CURSOR(partition, honey_id)                                         \
+	(((int64_t)(partition) << DB_CURSOR_HONEY_ID_BITS) | (int64_t)(honey_id))
+#define DB_CURSOR_PARTITION(cursor) ((cursor) >> DB_CURSOR_HONEY_ID_BITS)
+#define DB_CURSOR_HONEY_ID(cursor)                                             \
+	((cursor) & ((INT64_C(1) << DB_CURSOR_HONEY_ID_BITS) - 1))
+#define GET_MAX_HONEY_ID "SELECT max(honey_id) FROM %s.honey;"
+// A range scan on the honey_id primary key
+#define ROLLUP_SOURCE_IP_SINCE                                                 \
+	"INSERT INTO temp.source_ip_rollup SELECT source_ip, max(event_timestamp), count(source_ip) FROM %s.honey WHERE honey_id > ? GROUP BY source_ip;"
+/**
+ * Parse cursors written by db_format_cursors(), e.g. "0" or
+ * "1392326623818153985,1392326554598608897".
+ *
+ * @param text The cursors.
+ * @param cursors Set to an array to free().
+ * @param cursor_count Set to how many.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if one isn't a cursor.
+ */
+int db_parse_cursors(const char *text, int64_t **cursors,
+		     size_t *cursor_count);
+/**
+ * @param cursors The cursors, e.g. from db_select_partition_cursors().
+ * @param cursor_count How many.
+ * @return The cursors separated by commas, or "0" if there are none. Free
+ *         with free().
+ */
+char *db_format_cursors(int64_t const *cursors, size_t cursor_count);
+/**
+ * Only the source IPs seen again or for the first time after cursors, with
+ * seen_count being how many more times.
+ *
+ * @param cursors From db_select_partition_cursors() or an earlier
+ *        next_cursors. Partitions without one are read from the start.
+ * @param cursor_count How many, 0 for everything.
+ * @param bad_actors Set to the source IPs, as with db_select_bad_actors().
+ * @param row_count Set to the number in bad_actors.
+ * @param next_cursors Set to the cursors to ask for next time, an array to
+ *        free().
+ * @param next_cursor_count Set to how many.
+ * @param config Our config.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int db_select_bad_actors_since(int64_t const *cursors, size_t cursor_count,
+			       bad_actor ***bad_actors, int64_t *row_count,
+			       int64_t **next_cursors,
+			       size_t *next_cursor_count,
+			       sentrypeer_config const *config);
+
 #define GET_PHONE_NUMBER                                                       \
 	"SELECT DISTINCT(called_number) FROM honey WHERE called_number = ?;"
 int db_select_phone_number(const char *phone_number,
@@ -53,7 +234,83 @@ int db_select_phone_number(const char *phone_number,
 // https://stackoverflow.com/a/32528946/1072411
 #define GET_ROWS_DISTINCT_PHONE_NUMBER_WITH_COUNT_AND_DATE                     \
 	"SELECT called_number, max(event_timestamp) as seen_last, count(called_number) as seen_total FROM honey WHERE called_number LIKE '+%' OR printf('%d', called_number) = called_number GROUP BY called_number order by event_timestamp DESC;"
+#define CREATE_PHONE_NUMBER_ROLLUP                                             \
+	"CREATE TEMP TABLE phone_number_rollup (called_number TEXT, seen_last TEXT, seen_total INTEGER);"
+#define ROLLUP_PHONE_NUMBER_FROM                                               \
+	"INSERT INTO temp.phone_number_rollup SELECT called_number, max(event_timestamp), count(called_number) FROM %s.honey WHERE called_number LIKE '+%%' OR printf('%%d', called_number) = called_number GROUP BY called_number;"
+#define GET_PHONE_NUMBER_ROLLUP_COUNT                                          \
+	"SELECT COUNT(DISTINCT called_number) from temp.phone_number_rollup;"
+#define GET_PHONE_NUMBER_ROLLUP_WITH_COUNT_AND_DATE                            \
+	"SELECT called_number, max(seen_last) as seen_last, sum(seen_total) as seen_total FROM temp.phone_number_rollup GROUP BY called_number order by seen_last DESC;"
 int db_select_called_numbers(bad_actor ***phone_numbers, int64_t *row_count,
 			     sentrypeer_config const *config);
 
+// Cities are counted as "GB/London" so they can be listed per country
+#define HEAVY_HITTERS_CITY_KEY "country_code || '/' || city"
+// column is one of ours, e.g. "user_agent" or HEAVY_HITTERS_CITY_KEY, never
+// user input
+#define GET_COLUMN_TOTALS                                                      \
+	"SELECT %s, count(*), min(event_timestamp), max(event_timestamp) FROM honey WHERE %s IS NOT NULL GROUP BY %s;"
+#define HONEY_COLUMN_EXISTS                                                    \
+	"SELECT EXISTS(SELECT 1 FROM pragma_table_info('honey') WHERE name = ?);"
+/**
+ * Count every value of a honey column, across all partitions, into a set
+ * of heavy hitters.
+ *
+ * @param column The honey column, e.g. "user_agent" or "method".
+ * @param counters Where to count them.
+ * @param config Our config.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int db_load_heavy_hitters(const char *column, heavy_hitters *counters,
+			  sentrypeer_config const *config);
+
+#define GET_IP_ADDRESSES_SEEN_FIRST                                            \
+	"SELECT source_ip, min(event_timestamp) FROM honey WHERE source_ip IS NOT NULL GROUP BY source_ip;"
+/**
+ * Add every source IP, across all partitions, to the log in the order they
+ * were first seen.
+ *
+ * @param log Where to add them.
+ * @param config Our config.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int db_load_ip_address_log(ip_address_log *log,
+			   sentrypeer_config const *config);
+
+// Saved event_series buckets, in config->db_file whether or not it's
+// partitioned. Buckets that have fallen off the end of their ring are
+// deleted when saving.
+#define CREATE_EVENT_SERIES_TABLE                                              \
+	"CREATE TABLE IF NOT EXISTS event_series (resolution INTEGER NOT NULL, bucket INTEGER NOT NULL, method TEXT NOT NULL, transport_type TEXT NOT NULL, collected_method TEXT NOT NULL, count INTEGER NOT NULL, PRIMARY KEY (resolution, bucket, method, transport_type, collected_method)) WITHOUT ROWID;"
+#define GET_EVENT_SERIES                                                       \
+	"SELECT resolution, bucket, method, transport_type, collected_method, count FROM event_series WHERE (resolution = ? AND bucket > ?) OR (resolution = ? AND bucket > ?);"
+#define SET_EVENT_SERIES_COUNT                                                 \
+	"INSERT OR REPLACE INTO event_series (resolution, bucket, method, transport_type, collected_method, count) VALUES (?, ?, ?, ?, ?, ?);"
+#define DELETE_EVENT_SERIES_BEFORE                                             \
+	"DELETE FROM event_series WHERE (resolution = ? AND bucket <= ?) OR (resolution = ? AND bucket <= ?);"
+#define DELETE_EVENT_SERIES_SINCE "DELETE FROM event_series WHERE bucket >= ?;"
+// event_timestamp to the minute, e.g. "2026-10-19 14:05"
+#define GET_EVENT_SERIES_SINCE                                                 \
+	"SELECT substr(event_timestamp, 1, 16), method, transport_type, collected_method, count(*) FROM honey WHERE event_timestamp >= ? GROUP BY 1, 2, 3, 4;"
+/**
+ * Load the saved buckets, then count the honey rows from the newest saved
+ * hour on into the series, as we may have stopped before saving them.
+ *
+ * @param series Where to load them.
+ * @param config Our config.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int db_load_event_series(event_series *series,
+			 sentrypeer_config const *config);
+/**
+ * Save the buckets counted into since the last save, in one transaction.
+ * They're kept to try again next time if that fails.
+ *
+ * @param series The series.
+ * @param config Our config.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int db_save_event_series(event_series *series,
+			 sentrypeer_config const *config);
 #endif //SENTRYPEER_DATABASE_H
@@ -0,0 +1,585 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "db_export.h"
+#include "database.h"
+#include "parquet_writer.h"
+
+enum export_column {
+	COLUMN_EVENT_TIMESTAMP,
+	COLUMN_EVENT_UUID,
+	COLUMN_COLLECTED_METHOD,
+	COLUMN_SOURCE_IP,
+	COLUMN_CALLED_NUMBER,
+	COLUMN_TRANSPORT_TYPE,
+	COLUMN_METHOD,
+	COLUMN_USER_AGENT,
+	COLUMN_SIP_MESSAGE,
+	COLUMN_CREATED_BY_NODE_ID,
+	COLUMN_COUNTRY_CODE,
+	COLUMN_CITY,
+	COLUMN_ASN,
+	COLUMN_AS_ORG,
+	COLUMN_COUNT,
+};
+
+// Timestamps and uuids are all different, so aren't worth a dictionary.
+// Writers fall back to PLAIN for any others that turn out not to repeat.
+static const parquet_column export_columns[COLUMN_COUNT] = {
+	[COLUMN_EVENT_TIMESTAMP] = { "event_timestamp", PARQUET_TYPE_BYTE_ARRAY,
+				     false },
+	[COLUMN_EVENT_UUID] = { "event_uuid", PARQUET_TYPE_BYTE_ARRAY, false },
+	[COLUMN_COLLECTED_METHOD] = { "collected_method",
+				      PARQUET_TYPE_BYTE_ARRAY, true },
+	[COLUMN_SOURCE_IP] = { "source_ip", PARQUET_TYPE_BYTE_ARRAY, true },
+	[COLUMN_CALLED_NUMBER] = { "called_number", PARQUET_TYPE_BYTE_ARRAY,
+				   true },
+	[COLUMN_TRANSPORT_TYPE] = { "transport_type", PARQUET_TYPE_BYTE_ARRAY,
+				    true },
+	[COLUMN_METHOD] = { "method", PARQUET_TYPE_BYTE_ARRAY, true },
+	[COLUMN_USER_AGENT] = { "user_agent", PARQUET_TYPE_BYTE_ARRAY, true },
+	[COLUMN_SIP_MESSAGE] = { "sip_message", PARQUET_TYPE_BYTE_ARRAY, true },
+	[COLUMN_CREATED_BY_NODE_ID] = { "created_by_node_id",
+					PARQUET_TYPE_BYTE_ARRAY, true },
+	[COLUMN_COUNTRY_CODE] = { "country_code", PARQUET_TYPE_BYTE_ARRAY,
+				  true },
+	[COLUMN_CITY] = { "city", PARQUET_TYPE_BYTE_ARRAY, true },
+	[COLUMN_ASN] = { "asn", PARQUET_TYPE_INT64, false },
+	[COLUMN_AS_ORG] = { "as_org", PARQUET_TYPE_BYTE_ARRAY, true },
+};
+
+// "YYYY-MM-DD"
+#define DAY_LEN 10
+
+typedef struct day_file day_file;
+struct day_file {
+	char day[DAY_LEN + 1];
+	char *tmp_path;
+	char *path;
+	parquet_writer *writer;
+	uint64_t last_used;
+};
+
+typedef struct db_export db_export;
+struct db_export {
+	sentrypeer_config const *config;
+	const char *dir;
+	day_file days[DB_EXPORT_DAYS_OPEN];
+	uint64_t rows;
+	db_export_stats *stats;
+	// Of the last row exported from each partition
+	int64_t *cursors;
+	size_t cursor_count;
+	size_t cursor_capacity;
+};
+
+static pthread_mutex_t archive_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t archive_cond = PTHREAD_COND_INITIALIZER;
+static bool archive_stop = false;
+
+static char *path_join(const char *dir, const char *name)
+{
+	size_t path_len = strlen(dir) + 1 + strlen(name) + 1;
+	char *path = malloc(path_len);
+	assert(path);
+	snprintf(path, path_len, "%s/%s", dir, name);
+
+	return path;
+}
+
+static int make_dir(const char *dir)
+{
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		perror("mkdir");
+		fprintf(stderr, "Failed to create export directory: %s\n", dir);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// The day of an event_timestamp, e.g. "2026-10-19 08:30:00.123456789"
+static void event_day(const char *event_timestamp, char day[DAY_LEN + 1])
+{
+	static const char pattern[] = "dddd-dd-dd";
+
+	snprintf(day, DAY_LEN + 1, "%s", DB_EXPORT_DAY_UNKNOWN);
+	if (event_timestamp == 0) {
+		return;
+	}
+	for (int i = 0; i < DAY_LEN; i++) {
+		bool matches = pattern[i] == 'd' ?
+				       isdigit((unsigned char)event_timestamp[i]) :
+				       event_timestamp[i] == pattern[i];
+		if (!matches) {
+			return;
+		}
+	}
+
+	memcpy(day, event_timestamp, DAY_LEN);
+	day[DAY_LEN] = '\0';
+}
+
+// Set the cursor for row_cursor's partition, adding it if it's new
+static void export_cursor_add(db_export *export, int64_t row_cursor)
+{
+	for (size_t i = export->cursor_count; i > 0; i--) {
+		if (DB_CURSOR_PARTITION(export->cursors[i - 1]) ==
+		    DB_CURSOR_PARTITION(row_cursor)) {
+			export->cursors[i - 1] = row_cursor;
+			return;
+		}
+	}
+
+	if (export->cursor_count == export->cursor_capacity) {
+		export->cursor_capacity = export->cursor_capacity == 0 ?
+						  16 :
+						  export->cursor_capacity * 2;
+		export->cursors =
+			realloc(export->cursors,
+				export->cursor_capacity * sizeof(int64_t));
+		assert(export->cursors);
+	}
+	export->cursors[export->cursor_count++] = row_cursor;
+}
+
+// The cursor file has the cursor of the last row exported, then the
+// cursor of the last row exported from each partition, one per line
+static int read_cursor(const char *dir, int64_t *cursor, db_export *export)
+{
+	char *cursor_path = path_join(dir, DB_EXPORT_CURSOR_FILE);
+	FILE *cursor_file = fopen(cursor_path, "r");
+	free(cursor_path);
+
+	*cursor = 0;
+	if (cursor_file == 0) {
+		// First export
+		return errno == ENOENT ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	int status = fscanf(cursor_file, "%" SCNd64, cursor) == 1 ?
+			     EXIT_SUCCESS :
+			     EXIT_FAILURE;
+	int64_t partition_cursor = 0;
+	while (status == EXIT_SUCCESS &&
+	       fscanf(cursor_file, "%" SCNd64, &partition_cursor) == 1) {
+		export_cursor_add(export, partition_cursor);
+	}
+	if (ferror(cursor_file)) {
+		status = EXIT_FAILURE;
+	}
+	fclose(cursor_file);
+	if (status != EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to read %s in %s\n",
+			DB_EXPORT_CURSOR_FILE, dir);
+	}
+
+	return status;
+}
+
+static int write_cursor(const char *dir, int64_t cursor,
+			db_export const *export)
+{
+	char *cursor_path = path_join(dir, DB_EXPORT_CURSOR_FILE);
+	char *tmp_path = path_join(dir, "." DB_EXPORT_CURSOR_FILE ".tmp");
+	int status = EXIT_FAILURE;
+
+	FILE *cursor_file = fopen(tmp_path, "w");
+	if (cursor_file != 0) {
+		status = fprintf(cursor_file, "%" PRId64 "\n", cursor) > 0 ?
+				 EXIT_SUCCESS :
+				 EXIT_FAILURE;
+		for (size_t i = 0;
+		     i < export->cursor_count && status == EXIT_SUCCESS; i++) {
+			if (fprintf(cursor_file, "%" PRId64 "\n",
+				    export->cursors[i]) < 0) {
+				status = EXIT_FAILURE;
+			}
+		}
+		if (status == EXIT_SUCCESS &&
+		    (fflush(cursor_file) != 0 ||
+		     fsync(fileno(cursor_file)) != 0)) {
+			status = EXIT_FAILURE;
+		}
+		if (fclose(cursor_file) != 0) {
+			status = EXIT_FAILURE;
+		}
+	}
+	if (status == EXIT_SUCCESS && rename(tmp_path, cursor_path) != 0) {
+		status = EXIT_FAILURE;
+	}
+	if (status != EXIT_SUCCESS) {
+		perror("write_cursor");
+		fprintf(stderr, "Failed to save export cursor to %s\n",
+			cursor_path);
+		unlink(tmp_path);
+	}
+	free(tmp_path);
+	free(cursor_path);
+
+	return status;
+}
+
+// A cursor file from before there was one per partition. Partitions older
+// than its cursor's were exported in full, so start them from their
+// newest rows.
+static int cursors_from_single(db_export *export, int64_t cursor)
+{
+	int64_t *newest = 0;
+	size_t newest_count = 0;
+	if (db_select_partition_cursors(&newest, &newest_count,
+					export->config) != EXIT_SUCCESS) {
+		free(newest);
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < newest_count; i++) {
+		if (DB_CURSOR_PARTITION(newest[i]) <
+		    DB_CURSOR_PARTITION(cursor)) {
+			export_cursor_add(export, newest[i]);
+		}
+	}
+	export_cursor_add(export, cursor);
+	free(newest);
+
+	return EXIT_SUCCESS;
+}
+
+// Finish a day's file and rename it into place
+static int day_file_finish(db_export *export, day_file *file)
+{
+	if (file->writer == 0) {
+		return EXIT_SUCCESS;
+	}
+
+	int status = parquet_writer_close(&file->writer);
+	if (status == EXIT_SUCCESS && rename(file->tmp_path, file->path) != 0) {
+		perror("rename");
+		status = EXIT_FAILURE;
+	}
+	if (status == EXIT_SUCCESS) {
+		export->stats->files++;
+		if (export->config->debug_mode ||
+		    export->config->verbose_mode) {
+			fprintf(stderr, "Exported %s\n", file->path);
+		}
+	} else {
+		fprintf(stderr, "Failed to export %s\n", file->path);
+		unlink(file->tmp_path);
+	}
+
+	free(file->tmp_path);
+	file->tmp_path = 0;
+	free(file->path);
+	file->path = 0;
+
+	return status;
+}
+
+// Give up on a day's file, leaving nothing behind
+static void day_file_abandon(day_file *file)
+{
+	if (file->writer != 0) {
+		parquet_writer_destroy(&file->writer);
+		unlink(file->tmp_path);
+	}
+	free(file->tmp_path);
+	file->tmp_path = 0;
+	free(file->path);
+	file->path = 0;
+}
+
+// Start a file for day, named after the cursor of its first row. An export
+// done again after a failure writes the same names, rather than doubling
+// up rows.
+static int day_file_start(db_export *export, day_file *file, const char *day,
+			  int64_t cursor)
+{
+	char day_dir_name[sizeof("day=") + DAY_LEN];
+	snprintf(day_dir_name, sizeof(day_dir_name), "day=%s", day);
+	char *day_dir = path_join(export->dir, day_dir_name);
+	if (make_dir(day_dir) != EXIT_SUCCESS) {
+		free(day_dir);
+		return EXIT_FAILURE;
+	}
+
+	char name[64];
+	snprintf(name, sizeof(name), "honey-%" PRId64 ".parquet", cursor);
+	file->path = path_join(day_dir, name);
+	snprintf(name, sizeof(name), ".honey-%" PRId64 ".parquet.tmp", cursor);
+	file->tmp_path = path_join(day_dir, name);
+	free(day_dir);
+
+	file->writer = parquet_writer_new(file->tmp_path, export_columns,
+					  COLUMN_COUNT);
+	if (file->writer == 0) {
+		free(file->tmp_path);
+		file->tmp_path = 0;
+		free(file->path);
+		file->path = 0;
+		return EXIT_FAILURE;
+	}
+	snprintf(file->day, sizeof(file->day), "%s", day);
+
+	return EXIT_SUCCESS;
+}
+
+static day_file *day_file_for(db_export *export, const char *day,
+			      int64_t cursor)
+{
+	day_file *least_recent = &export->days[0];
+	for (size_t i = 0; i < DB_EXPORT_DAYS_OPEN; i++) {
+		day_file *file = &export->days[i];
+		if (file->writer != 0 && strcmp(file->day, day) == 0) {
+			return file;
+		}
+		if (file->writer == 0 ||
+		    (least_recent->writer != 0 &&
+		     file->last_used < least_recent->last_used)) {
+			least_recent = file;
+		}
+	}
+
+	if (day_file_finish(export, least_recent) != EXIT_SUCCESS ||
+	    day_file_start(export, least_recent, day, cursor) !=
+		    EXIT_SUCCESS) {
+		return 0;
+	}
+
+	return least_recent;
+}
+
+static int export_row(void *arg, db_honey_row const *row)
+{
+	db_export *export = arg;
+
+	char day[DAY_LEN + 1];
+	event_day(row->event_timestamp, day);
+	day_file *file = day_file_for(export, day, row->cursor);
+	if (file == 0) {
+		return EXIT_FAILURE;
+	}
+	file->last_used = ++export->rows;
+
+	parquet_writer *writer = file->writer;
+	parquet_writer_put_string(writer, COLUMN_EVENT_TIMESTAMP,
+				  row->event_timestamp);
+	parquet_writer_put_string(writer, COLUMN_EVENT_UUID, row->event_uuid);
+	parquet_writer_put_string(writer, COLUMN_COLLECTED_METHOD,
+				  row->collected_method);
+	parquet_writer_put_string(writer, COLUMN_SOURCE_IP, row->source_ip);
+	parquet_writer_put_string(writer, COLUMN_CALLED_NUMBER,
+				  row->called_number);
+	parquet_writer_put_string(writer, COLUMN_TRANSPORT_TYPE,
+				  row->transport_type);
+	parquet_writer_put_string(writer, COLUMN_METHOD, row->method);
+	parquet_writer_put_string(writer, COLUMN_USER_AGENT, row->user_agent);
+	parquet_writer_put_string(writer, COLUMN_SIP_MESSAGE,
+				  row->sip_message);
+	parquet_writer_put_string(writer, COLUMN_CREATED_BY_NODE_ID,
+				  row->created_by_node_id);
+	parquet_writer_put_string(writer, COLUMN_COUNTRY_CODE,
+				  row->country_code);
+	parquet_writer_put_string(writer, COLUMN_CITY, row->city);
+	if (row->has_asn) {
+		parquet_writer_put_int64(writer, COLUMN_ASN, row->asn);
+	} else {
+		parquet_writer_put_null(writer, COLUMN_ASN);
+	}
+	parquet_writer_put_string(writer, COLUMN_AS_ORG, row->as_org);
+
+	if (parquet_writer_end_row(writer) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	export->stats->rows++;
+	if (row->cursor > export->stats->cursor) {
+		export->stats->cursor = row->cursor;
+	}
+	export_cursor_add(export, row->cursor);
+
+	return EXIT_SUCCESS;
+}
+
+int db_export_parquet(sentrypeer_config const *config, const char *dir,
+		      db_export_stats *stats)
+{
+	assert(dir);
+	memset(stats, 0, sizeof(*stats));
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	db_export export = {
+		.config = config,
+		.dir = dir,
+		.stats = stats,
+	};
+	if (make_dir(dir) != EXIT_SUCCESS ||
+	    read_cursor(dir, &stats->cursor, &export) != EXIT_SUCCESS ||
+	    (stats->cursor != 0 && export.cursor_count == 0 &&
+	     cursors_from_single(&export, stats->cursor) != EXIT_SUCCESS)) {
+		free(export.cursors);
+		return EXIT_FAILURE;
+	}
+
+	// Each partition from where we left it, as db_import can add rows to
+	// ones older than the last row exported
+	int status = db_each_honey_row_since_each(
+		export.cursors, export.cursor_count, export_row, &export,
+		config);
+
+	for (size_t i = 0; i < DB_EXPORT_DAYS_OPEN; i++) {
+		if (status == EXIT_SUCCESS) {
+			status = day_file_finish(&export, &export.days[i]);
+		} else {
+			day_file_abandon(&export.days[i]);
+		}
+	}
+
+	if (status == EXIT_SUCCESS && stats->rows > 0) {
+		status = write_cursor(dir, stats->cursor, &export);
+	}
+	free(export.cursors);
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	stats->seconds = (double)(end.tv_sec - start.tv_sec) +
+			 (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr,
+			"Exported %" PRIu64 " rows to %" PRIu64
+			" Parquet files in %s in %.1f seconds\n",
+			stats->rows, stats->files, dir, stats->seconds);
+	}
+
+	return status;
+}
+
+static void *db_export_thread_start(void *arg)
+{
+	sentrypeer_config const *config = arg;
+
+#ifdef SCHED_IDLE
+	// Only run when nothing else wants the CPU
+	struct sched_param idle_param = { 0 };
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &idle_param);
+#endif
+
+	pthread_mutex_lock(&archive_mutex);
+	while (!archive_stop) {
+		pthread_mutex_unlock(&archive_mutex);
+
+		// Straight away, to catch up on anything logged while we
+		// weren't running
+		db_export_stats stats;
+		if (db_export_parquet(config, config->parquet_archive_dir,
+				      &stats) != EXIT_SUCCESS) {
+			fprintf(stderr,
+				"Parquet archive failed, trying again in %d seconds\n",
+				config->parquet_archive_interval);
+		}
+
+		struct timespec wake_up;
+		clock_gettime(CLOCK_REALTIME, &wake_up);
+		wake_up.tv_sec += config->parquet_archive_interval;
+
+		pthread_mutex_lock(&archive_mutex);
+		int rc = 0;
+		while (!archive_stop && rc != ETIMEDOUT) {
+			rc = pthread_cond_timedwait(&archive_cond,
+						    &archive_mutex, &wake_up);
+		}
+	}
+	pthread_mutex_unlock(&archive_mutex);
+
+	return NULL;
+}
+
+int db_export_run(sentrypeer_config *config)
+{
+	if (config->parquet_archive_dir == 0 ||
+	    config->parquet_archive_interval <= 0) {
+		return EXIT_SUCCESS;
+	}
+
+	pthread_mutex_lock(&archive_mutex);
+	archive_stop = false;
+	pthread_mutex_unlock(&archive_mutex);
+
+	pthread_t parquet_archive_thread = 0;
+	if (pthread_create(&parquet_archive_thread, NULL,
+			   db_export_thread_start,
+			   (void *)config) != EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to create Parquet archive thread.\n");
+		return EXIT_FAILURE;
+	}
+#ifdef __APPLE__
+	// Can only name ourselves on macOS
+#else
+	if (pthread_setname_np(parquet_archive_thread, "parquet_archive") !=
+	    EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to set Parquet archive thread name.\n");
+	}
+#endif
+	config->parquet_archive_thread = parquet_archive_thread;
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr,
+			"Parquet archive to %s every %d seconds...\n",
+			config->parquet_archive_dir,
+			config->parquet_archive_interval);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int db_export_stop(sentrypeer_config const *config)
+{
+	if (config->parquet_archive_thread == 0) {
+		return EXIT_SUCCESS;
+	}
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Stopping Parquet archive...\n");
+	}
+
+	// No pthread_cancel(), let any export finish its files
+	pthread_mutex_lock(&archive_mutex);
+	archive_stop = true;
+	pthread_cond_signal(&archive_cond);
+	pthread_mutex_unlock(&archive_mutex);
+
+	if (pthread_join(config->parquet_archive_thread, NULL) !=
+	    EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to join Parquet archive thread.\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#ifndef SENTRYPEER_DB_EXPORT_H
+#define SENTRYPEER_DB_EXPORT_H 1
+
+#include <stdint.h>
+
+#include "conf.h"
+
+// Seconds between archive passes, config->parquet_archive_interval
+#define DB_EXPORT_INTERVAL 3600
+// Day files open at once, the least recently written is finished first
+#define DB_EXPORT_DAYS_OPEN 4
+// Where the cursor of the last exported row is kept, in the export dir,
+// followed by that of the last row exported from each partition.
+// Readers skip files starting with '_' or '.'.
+#define DB_EXPORT_CURSOR_FILE "_sentrypeer_cursor"
+#define DB_EXPORT_DAY_UNKNOWN "unknown"
+
+typedef struct db_export_stats db_export_stats;
+struct db_export_stats {
+	uint64_t rows;
+	uint64_t files;
+	// Of the last row exported, saved for next time
+	int64_t cursor;
+	double seconds;
+};
+
+/**
+ * Export the honey rows logged since the last export to dir, as zstd
+ * compressed Parquet files with one directory per day of event_timestamp,
+ * e.g. dir/day=2026-10-19/honey-<cursor>.parquet. Rows are streamed from
+ * the database a row group at a time. Files only appear once they're
+ * complete and the cursor only moves on once they all are, so an export
+ * that fails is done again next time. Each partition is read on from its
+ * own cursor, so rows db_import_json_files() adds to older partitions are
+ * still exported.
+ *
+ * @param config Our config.
+ * @param dir The export directory, created if need be.
+ * @param stats Filled in, even on failure.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int db_export_parquet(sentrypeer_config const *config, const char *dir,
+		      db_export_stats *stats);
+
+/**
+ * Start the low priority thread that exports to
+ * config->parquet_archive_dir every config->parquet_archive_interval.
+ *
+ * @param config Our config, no parquet_archive_dir means don't start.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int db_export_run(sentrypeer_config *config);
+
+/**
+ * Stop the archive thread, waiting for any export in progress.
+ *
+ * @param config Our config.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int db_export_stop(sentrypeer_config const *config);
+
+#endif //SENTRYPEER_DB_EXPORT_H
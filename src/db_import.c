@@ -0,0 +1,666 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "db_import.h"
+#include "bad_actor.h"
+#include "database.h"
+#include "db_partition.h"
+#include "json_logger.h"
+#include "utils.h"
+
+// Power of two, picked by the low bits of the hash
+#define IMPORT_UUID_SHARDS 64
+#define IMPORT_UUID_SHARD_INITIAL 1024
+
+typedef struct import_file import_file;
+struct import_file {
+	const char *name;
+	const char *data;
+	size_t size;
+};
+
+// Whole lines of one file
+typedef struct import_chunk import_chunk;
+struct import_chunk {
+	size_t file;
+	size_t start;
+	size_t end;
+};
+
+// A parsed chunk, waiting for the writer
+typedef struct import_result import_result;
+struct import_result {
+	bad_actor **events;
+	size_t count;
+	uint64_t lines;
+	uint64_t duplicates;
+	uint64_t failed;
+	bool ready;
+};
+
+// Open addressing on the 128 bits of each event_uuid, all zeros is empty
+typedef struct import_uuid_shard import_uuid_shard;
+struct import_uuid_shard {
+	pthread_mutex_t mutex;
+	uint64_t (*keys)[2];
+	size_t capacity;
+	size_t count;
+};
+
+typedef struct import_partition import_partition;
+struct import_partition {
+	char path[SENTRYPEER_PATH_MAX + 1];
+	sqlite3 *db;
+	uint64_t used;
+};
+
+typedef struct importer importer;
+struct importer {
+	sentrypeer_config const *config;
+	import_file *files;
+	size_t file_count;
+	import_chunk *chunks;
+	size_t chunk_count;
+
+	pthread_mutex_t mutex;
+	// Workers wait for the writer to fall less than window chunks behind
+	pthread_cond_t claimable;
+	// The writer waits for the next chunk in order
+	pthread_cond_t ready;
+	import_result *results;
+	size_t window;
+	size_t next_chunk;
+	size_t written;
+	bool stopping;
+
+	import_uuid_shard shards[IMPORT_UUID_SHARDS];
+
+	// Only touched by the writer
+	import_partition partitions[DB_IMPORT_PARTITIONS_OPEN];
+	size_t partition_count;
+	uint64_t partition_clock;
+};
+
+// A uuid as its 16 bytes, false if it isn't 32 hex digits and dashes
+static bool import_uuid_key(const char *uuid, uint64_t key[2])
+{
+	size_t digits = 0;
+	key[0] = 0;
+	key[1] = 0;
+	for (const char *c = uuid; *c != '\0'; c++) {
+		if (*c == '-') {
+			continue;
+		}
+		uint64_t nibble;
+		if (*c >= '0' && *c <= '9') {
+			nibble = (uint64_t)(*c - '0');
+		} else if (*c >= 'a' && *c <= 'f') {
+			nibble = (uint64_t)(*c - 'a' + 10);
+		} else if (*c >= 'A' && *c <= 'F') {
+			nibble = (uint64_t)(*c - 'A' + 10);
+		} else {
+			return false;
+		}
+		if (digits == 32) {
+			return false;
+		}
+		key[digits / 16] = (key[digits / 16] << 4) | nibble;
+		digits++;
+	}
+
+	return digits == 32 && (key[0] != 0 || key[1] != 0);
+}
+
+static uint64_t import_uuid_hash(const uint64_t key[2])
+{
+	// UUIDv7 starts with the time, so mix it all in
+	uint64_t hash = key[0] ^ (key[1] * 0x9e3779b97f4a7c15u);
+	hash ^= hash >> 32;
+	hash *= 0xff51afd7ed558ccdu;
+	hash ^= hash >> 29;
+
+	return hash;
+}
+
+static void import_uuid_shard_put(import_uuid_shard *shard,
+				  const uint64_t key[2], size_t slot)
+{
+	size_t mask = shard->capacity - 1;
+	while (shard->keys[slot][0] != 0 || shard->keys[slot][1] != 0) {
+		slot = (slot + 1) & mask;
+	}
+	shard->keys[slot][0] = key[0];
+	shard->keys[slot][1] = key[1];
+	shard->count++;
+}
+
+static void import_uuid_shard_grow(import_uuid_shard *shard)
+{
+	uint64_t (*old_keys)[2] = shard->keys;
+	size_t old_capacity = shard->capacity;
+
+	shard->capacity = old_capacity == 0 ? IMPORT_UUID_SHARD_INITIAL :
+					      old_capacity * 2;
+	shard->keys = calloc(shard->capacity, sizeof(*shard->keys));
+	assert(shard->keys);
+	shard->count = 0;
+	for (size_t i = 0; i < old_capacity; i++) {
+		if (old_keys[i][0] != 0 || old_keys[i][1] != 0) {
+			import_uuid_shard_put(
+				shard, old_keys[i],
+				(import_uuid_hash(old_keys[i]) /
+				 IMPORT_UUID_SHARDS) &
+					(shard->capacity - 1));
+		}
+	}
+	free(old_keys);
+}
+
+// false if we've had it already. Anything that isn't a uuid can't be
+// checked, so always goes in.
+static bool import_uuid_add(importer *self, const char *uuid)
+{
+	uint64_t key[2];
+	if (uuid == 0 || !import_uuid_key(uuid, key)) {
+		return true;
+	}
+	uint64_t hash = import_uuid_hash(key);
+	import_uuid_shard *shard =
+		&self->shards[hash & (IMPORT_UUID_SHARDS - 1)];
+	hash /= IMPORT_UUID_SHARDS;
+
+	pthread_mutex_lock(&shard->mutex);
+	// Kept under 3/4 full
+	if ((shard->count + 1) * 4 > shard->capacity * 3) {
+		import_uuid_shard_grow(shard);
+	}
+	size_t mask = shard->capacity - 1;
+	for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+		if (shard->keys[slot][0] == 0 && shard->keys[slot][1] == 0) {
+			break;
+		}
+		if (shard->keys[slot][0] == key[0] &&
+		    shard->keys[slot][1] == key[1]) {
+			pthread_mutex_unlock(&shard->mutex);
+			return false;
+		}
+	}
+	import_uuid_shard_put(shard, key, hash & mask);
+	pthread_mutex_unlock(&shard->mutex);
+
+	return true;
+}
+
+static void import_uuid_seen(void *arg, const char *event_uuid)
+{
+	import_uuid_add(arg, event_uuid);
+}
+
+static void import_chunk_parse(importer *self, const import_chunk *chunk,
+			       import_result *result)
+{
+	const import_file *file = &self->files[chunk->file];
+	const char *line = file->data + chunk->start;
+	const char *end = file->data + chunk->end;
+	size_t capacity = 0;
+
+	memset(result, 0, sizeof(*result));
+	while (line < end) {
+		const char *line_end = memchr(line, '\n', (size_t)(end - line));
+		const char *next = line_end == 0 ? end : line_end + 1;
+		if (line_end == 0) {
+			line_end = end;
+		}
+		size_t len = (size_t)(line_end - line);
+		if (len > 0 && line[len - 1] == '\r') {
+			len--;
+		}
+		if (len == 0) {
+			line = next;
+			continue;
+		}
+		result->lines++;
+
+		const char *error = 0;
+		bad_actor *bad_actor_event =
+			bad_actor_json_read(line, len, &error);
+		if (bad_actor_event == 0) {
+			result->failed++;
+			if (self->config->debug_mode ||
+			    self->config->verbose_mode) {
+				fprintf(stderr, "%s at byte %zu: %s\n",
+					file->name,
+					(size_t)(line - file->data), error);
+			}
+		} else if (!import_uuid_add(self,
+					    bad_actor_event->event_uuid)) {
+			result->duplicates++;
+			bad_actor_destroy(&bad_actor_event);
+		} else {
+			if (result->count == capacity) {
+				capacity = capacity == 0 ? 256 : capacity * 2;
+				result->events =
+					realloc(result->events,
+						capacity * sizeof(bad_actor *));
+				assert(result->events);
+			}
+			result->events[result->count++] = bad_actor_event;
+		}
+		line = next;
+	}
+}
+
+static void *import_worker_run(void *arg)
+{
+	importer *self = arg;
+
+	for (;;) {
+		pthread_mutex_lock(&self->mutex);
+		while (!self->stopping && self->next_chunk < self->chunk_count &&
+		       self->next_chunk >= self->written + self->window) {
+			pthread_cond_wait(&self->claimable, &self->mutex);
+		}
+		if (self->stopping || self->next_chunk == self->chunk_count) {
+			pthread_mutex_unlock(&self->mutex);
+			break;
+		}
+		size_t chunk = self->next_chunk++;
+		pthread_mutex_unlock(&self->mutex);
+
+		import_result result;
+		import_chunk_parse(self, &self->chunks[chunk], &result);
+
+		pthread_mutex_lock(&self->mutex);
+		result.ready = true;
+		self->results[chunk % self->window] = result;
+		pthread_cond_signal(&self->ready);
+		pthread_mutex_unlock(&self->mutex);
+	}
+
+	return NULL;
+}
+
+static void import_result_clear(import_result *result)
+{
+	for (size_t i = 0; i < result->count; i++) {
+		bad_actor_destroy(&result->events[i]);
+	}
+	free(result->events);
+	memset(result, 0, sizeof(*result));
+}
+
+static sqlite3 *import_partition_db(importer *self, const char *path)
+{
+	import_partition *least_used = 0;
+	for (size_t i = 0; i < self->partition_count; i++) {
+		import_partition *partition = &self->partitions[i];
+		if (strcmp(partition->path, path) == 0) {
+			partition->used = ++self->partition_clock;
+			return partition->db;
+		}
+		if (least_used == 0 || partition->used < least_used->used) {
+			least_used = partition;
+		}
+	}
+
+	import_partition *partition;
+	if (self->partition_count < DB_IMPORT_PARTITIONS_OPEN) {
+		partition = &self->partitions[self->partition_count++];
+	} else {
+		partition = least_used;
+		if (db_bulk_close(&partition->db, self->config) !=
+		    EXIT_SUCCESS) {
+			return 0;
+		}
+	}
+
+	util_copy_string(partition->path, path, sizeof(partition->path));
+	partition->used = ++self->partition_clock;
+	partition->db = db_bulk_open(path, self->config);
+
+	return partition->db;
+}
+
+// With partitioning on, runs of events for the same partition go in
+// together
+static int import_write(importer *self, bad_actor **events, size_t count)
+{
+	sentrypeer_config const *config = self->config;
+	char path[SENTRYPEER_PATH_MAX + 1];
+	char next_path[SENTRYPEER_PATH_MAX + 1];
+	size_t start = 0;
+
+	while (start < count) {
+		size_t end = count;
+		if (config->db_partition == DB_PARTITION_NONE) {
+			util_copy_string(path, config->db_file, sizeof(path));
+		} else {
+			time_t when = util_parse_event_timestamp(
+				events[start]->event_timestamp);
+			if (db_partition_path(config, when == 0 ? time(NULL) :
+								  when,
+					      path,
+					      sizeof(path)) != EXIT_SUCCESS) {
+				return EXIT_FAILURE;
+			}
+			for (end = start + 1; end < count; end++) {
+				when = util_parse_event_timestamp(
+					events[end]->event_timestamp);
+				if (db_partition_path(
+					    config,
+					    when == 0 ? time(NULL) : when,
+					    next_path, sizeof(next_path)) !=
+					    EXIT_SUCCESS ||
+				    strcmp(path, next_path) != 0) {
+					break;
+				}
+			}
+		}
+
+		sqlite3 *db = import_partition_db(self, path);
+		if (db == 0 ||
+		    db_bulk_insert(db, (bad_actor const *const *)events + start,
+				   end - start, config) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+		start = end;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int import_map(import_file *file)
+{
+	int fd = open(file->name, O_RDONLY);
+	if (fd < 0) {
+		perror(file->name);
+		return EXIT_FAILURE;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0) {
+		perror(file->name);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	file->size = (size_t)file_stat.st_size;
+	if (file->size == 0) {
+		close(fd);
+		return EXIT_SUCCESS;
+	}
+	void *data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+	madvise(data, file->size, MADV_SEQUENTIAL);
+	file->data = data;
+
+	return EXIT_SUCCESS;
+}
+
+static void import_split(importer *self, size_t file_index)
+{
+	const import_file *file = &self->files[file_index];
+	size_t start = 0;
+
+	while (start < file->size) {
+		size_t end = start + DB_IMPORT_CHUNK_SIZE;
+		if (end >= file->size) {
+			end = file->size;
+		} else {
+			const char *line_end = memchr(file->data + end, '\n',
+						      file->size - end);
+			end = line_end == 0 ?
+				      file->size :
+				      (size_t)(line_end - file->data) + 1;
+		}
+
+		self->chunks = realloc(self->chunks, (self->chunk_count + 1) *
+							     sizeof(import_chunk));
+		assert(self->chunks);
+		self->chunks[self->chunk_count++] = (import_chunk){
+			.file = file_index, .start = start, .end = end
+		};
+		start = end;
+	}
+}
+
+static double import_seconds_since(const struct timespec *started)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (double)(now.tv_sec - started->tv_sec) +
+	       (double)(now.tv_nsec - started->tv_nsec) / 1e9;
+}
+
+int db_import_json_files(sentrypeer_config const *config,
+			 char *const *file_names, size_t file_count,
+			 size_t workers, db_import_stats *stats)
+{
+	assert(config);
+	assert(file_names);
+	assert(stats);
+
+	struct timespec started;
+	clock_gettime(CLOCK_MONOTONIC, &started);
+	memset(stats, 0, sizeof(*stats));
+
+	if (workers == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		workers = cpus < 1 ? 1 : (size_t)cpus;
+	}
+	if (workers > DB_IMPORT_WORKERS_MAX) {
+		workers = DB_IMPORT_WORKERS_MAX;
+	}
+
+	importer *self = calloc(1, sizeof(importer));
+	assert(self);
+	self->config = config;
+	self->files = calloc(file_count, sizeof(import_file));
+	assert(self->files);
+	int status = EXIT_SUCCESS;
+	for (size_t i = 0; i < file_count && status == EXIT_SUCCESS; i++) {
+		self->files[i].name = file_names[i];
+		self->file_count++;
+		status = import_map(&self->files[i]);
+		if (status == EXIT_SUCCESS) {
+			stats->bytes += self->files[i].size;
+			import_split(self, i);
+		}
+	}
+	stats->files = self->file_count;
+
+	pthread_mutex_init(&self->mutex, NULL);
+	pthread_cond_init(&self->claimable, NULL);
+	pthread_cond_init(&self->ready, NULL);
+	for (size_t i = 0; i < IMPORT_UUID_SHARDS; i++) {
+		pthread_mutex_init(&self->shards[i].mutex, NULL);
+	}
+
+	// What's already there counts as seen
+	if (status == EXIT_SUCCESS) {
+		status = db_each_event_uuid(import_uuid_seen, self, config);
+	}
+
+	if (workers > self->chunk_count) {
+		workers = self->chunk_count > 0 ? self->chunk_count : 1;
+	}
+	self->window = workers * DB_IMPORT_CHUNKS_AHEAD;
+	self->results = calloc(self->window, sizeof(import_result));
+	assert(self->results);
+	pthread_t *threads = calloc(workers, sizeof(pthread_t));
+	assert(threads);
+	size_t started_workers = 0;
+	if (status == EXIT_SUCCESS && self->chunk_count > 0) {
+		for (; started_workers < workers; started_workers++) {
+			if (pthread_create(&threads[started_workers], NULL,
+					   import_worker_run, self) != 0) {
+				fprintf(stderr,
+					"Failed to start import thread.\n");
+				break;
+			}
+		}
+		if (started_workers == 0) {
+			status = EXIT_FAILURE;
+		}
+	}
+	if ((config->debug_mode || config->verbose_mode) &&
+	    status == EXIT_SUCCESS) {
+		fprintf(stderr,
+			"Importing %zu chunks from %zu files with %zu workers...\n",
+			self->chunk_count, self->file_count, started_workers);
+	}
+
+	// Written in the order they're in the files, a transaction at a time
+	bad_actor **pending = 0;
+	size_t pending_count = 0;
+	size_t pending_capacity = 0;
+	uint64_t bytes_done = 0;
+	double reported = 0;
+	for (size_t chunk = 0; status == EXIT_SUCCESS && chunk < self->chunk_count;
+	     chunk++) {
+		pthread_mutex_lock(&self->mutex);
+		import_result *slot = &self->results[chunk % self->window];
+		while (!slot->ready) {
+			pthread_cond_wait(&self->ready, &self->mutex);
+		}
+		import_result result = *slot;
+		memset(slot, 0, sizeof(*slot));
+		self->written = chunk + 1;
+		pthread_cond_broadcast(&self->claimable);
+		pthread_mutex_unlock(&self->mutex);
+
+		stats->lines += result.lines;
+		stats->duplicates += result.duplicates;
+		stats->failed += result.failed;
+		bytes_done += self->chunks[chunk].end - self->chunks[chunk].start;
+
+		if (pending_count + result.count > pending_capacity) {
+			pending_capacity = pending_count + result.count +
+					   DB_IMPORT_TRANSACTION_ROWS;
+			pending = realloc(pending,
+					  pending_capacity * sizeof(bad_actor *));
+			assert(pending);
+		}
+		if (result.count > 0) {
+			memcpy(pending + pending_count, result.events,
+			       result.count * sizeof(bad_actor *));
+		}
+		pending_count += result.count;
+		free(result.events);
+
+		bool last = chunk + 1 == self->chunk_count;
+		if (pending_count >= DB_IMPORT_TRANSACTION_ROWS ||
+		    (last && pending_count > 0)) {
+			status = import_write(self, pending, pending_count);
+			if (status == EXIT_SUCCESS) {
+				stats->imported += pending_count;
+			}
+			for (size_t i = 0; i < pending_count; i++) {
+				bad_actor_destroy(&pending[i]);
+			}
+			pending_count = 0;
+		}
+
+		double seconds = import_seconds_since(&started);
+		if (seconds - reported >= 1.0 || last) {
+			reported = seconds;
+			fprintf(stderr,
+				"Imported %" PRIu64 " events (%.0f%% of %" PRIu64
+				" bytes), %" PRIu64 " duplicates, %" PRIu64
+				" failed, %.0f events/sec\n",
+				stats->imported,
+				stats->bytes > 0 ? 100.0 * (double)bytes_done /
+							   (double)stats->bytes :
+						   100.0,
+				stats->bytes, stats->duplicates, stats->failed,
+				(double)stats->imported / seconds);
+		}
+	}
+
+	pthread_mutex_lock(&self->mutex);
+	self->stopping = true;
+	pthread_cond_broadcast(&self->claimable);
+	pthread_mutex_unlock(&self->mutex);
+	for (size_t i = 0; i < started_workers; i++) {
+		if (pthread_join(threads[i], NULL) != 0) {
+			fprintf(stderr, "Failed to join import thread.\n");
+		}
+	}
+	free(threads);
+
+	// Only left over if writing failed
+	for (size_t i = 0; i < pending_count; i++) {
+		bad_actor_destroy(&pending[i]);
+	}
+	free(pending);
+	for (size_t i = 0; i < self->window; i++) {
+		import_result_clear(&self->results[i]);
+	}
+	free(self->results);
+
+	if (self->partition_count > 0 &&
+	    (config->debug_mode || config->verbose_mode)) {
+		fprintf(stderr, "Building indexes...\n");
+	}
+	for (size_t i = 0; i < self->partition_count; i++) {
+		if (db_bulk_close(&self->partitions[i].db, config) !=
+		    EXIT_SUCCESS) {
+			status = EXIT_FAILURE;
+		}
+	}
+
+	// Old events may have gone straight into partitions that are past
+	// retention
+	if (stats->imported > 0 &&
+	    db_partition_retention(config) != EXIT_SUCCESS) {
+		status = EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < IMPORT_UUID_SHARDS; i++) {
+		pthread_mutex_destroy(&self->shards[i].mutex);
+		free(self->shards[i].keys);
+	}
+	pthread_cond_destroy(&self->ready);
+	pthread_cond_destroy(&self->claimable);
+	pthread_mutex_destroy(&self->mutex);
+	for (size_t i = 0; i < self->file_count; i++) {
+		if (self->files[i].data != 0) {
+			munmap((void *)self->files[i].data, self->files[i].size);
+		}
+	}
+	free(self->files);
+	free(self->chunks);
+	free(self);
+
+	stats->seconds = import_seconds_since(&started);
+
+	return status;
+}
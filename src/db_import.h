@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+#ifndef SENTRYPEER_DB_IMPORT_H
+#define SENTRYPEER_DB_IMPORT_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "conf.h"
+
+#define DB_IMPORT_WORKERS_MAX 32
+// Each file is split into chunks of about this many bytes, on line ends
+#define DB_IMPORT_CHUNK_SIZE (4 * 1024 * 1024)
+// Chunks parsed ahead of the one being written, per worker
+#define DB_IMPORT_CHUNKS_AHEAD 2
+// Rows per transaction
+#define DB_IMPORT_TRANSACTION_ROWS 50000
+// Partition files open at once, the least recently written goes first
+#define DB_IMPORT_PARTITIONS_OPEN 8
+
+typedef struct db_import_stats db_import_stats;
+struct db_import_stats {
+	uint64_t files;
+	uint64_t bytes;
+	uint64_t lines;
+	uint64_t imported;
+	// Already in the database or earlier in the files
+	uint64_t duplicates;
+	// Not a bad actor json_to_bad_actor() would take
+	uint64_t failed;
+	double seconds;
+};
+
+/**
+ * Import NDJSON files of bad actors, e.g. sentrypeer_json.log from this and
+ * other nodes, into the database. Files are mapped with mmap() and split
+ * into chunks that workers parse in parallel, while this thread writes them
+ * out in order in large transactions. Events whose event_uuid is already
+ * in the database, or earlier in the files, are skipped. Progress goes to
+ * stderr about once a second. Partitions past config->db_retention_days
+ * are dropped at the end.
+ *
+ * @param config Our config, with db_file and db_partition set. With
+ *               partitioning on, events go in the partition for their
+ *               event_timestamp.
+ * @param file_names The files.
+ * @param file_count How many.
+ * @param workers 1 to DB_IMPORT_WORKERS_MAX, or 0 for one per CPU.
+ * @param stats Filled in, even on failure.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if a file couldn't be read or the
+ *         database couldn't be written.
+ */
+int db_import_json_files(sentrypeer_config const *config,
+			 char *const *file_names, size_t file_count,
+			 size_t workers, db_import_stats *stats);
+
+#endif //SENTRYPEER_DB_IMPORT_H
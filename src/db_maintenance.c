@@ -0,0 +1,454 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include "db_maintenance.h"
+#include "db_partition.h"
+#include "database.h"
+#include "sip_message_store.h"
+
+static pthread_mutex_t maintenance_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t maintenance_cond = PTHREAD_COND_INITIALIZER;
+static bool maintenance_stop = false;
+static db_maintenance_stats maintenance_stats = { 0 };
+
+static atomic_uint_fast64_t db_writes = 0;
+
+void db_maintenance_note_write(void)
+{
+	atomic_fetch_add_explicit(&db_writes, 1, memory_order_relaxed);
+}
+
+void db_maintenance_stats_get(db_maintenance_stats *stats)
+{
+	pthread_mutex_lock(&maintenance_mutex);
+	*stats = maintenance_stats;
+	pthread_mutex_unlock(&maintenance_mutex);
+}
+
+static double elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (double)(now.tv_sec - start->tv_sec) * 1000.0 +
+	       (double)(now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static int64_t pragma_int(sqlite3 *db, const char *pragma)
+{
+	sqlite3_stmt *pragma_stmt = 0;
+	int64_t value = -1;
+
+	if (sqlite3_prepare_v2(db, pragma, -1, &pragma_stmt, NULL) ==
+		    SQLITE_OK &&
+	    sqlite3_step(pragma_stmt) == SQLITE_ROW) {
+		value = sqlite3_column_int64(pragma_stmt, 0);
+	}
+	sqlite3_finalize(pragma_stmt);
+
+	return value;
+}
+
+static off_t wal_size(const char *db_file)
+{
+	struct stat wal_stat;
+	size_t wal_len = strlen(db_file) + sizeof("-wal");
+	char *wal = malloc(wal_len);
+	assert(wal);
+	snprintf(wal, wal_len, "%s-wal", db_file);
+
+	off_t size = stat(wal, &wal_stat) == 0 ? wal_stat.st_size : 0;
+	free(wal);
+
+	return size;
+}
+
+static int maintain_file(const char *db_file, sentrypeer_config const *config,
+			 db_maintenance_stats *pass_stats)
+{
+	sqlite3 *db;
+	struct timespec start;
+
+	if (sqlite3_open_v2(db_file, &db, SQLITE_OPEN_READWRITE, NULL) !=
+	    SQLITE_OK) {
+		// Nothing logged yet
+		sqlite3_close(db);
+		return EXIT_SUCCESS;
+	}
+	sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+
+	// Give free pages back to the filesystem. Databases created before
+	// auto_vacuum was set need a full VACUUM to switch over, which locks
+	// the whole file for as long as it takes, so that's left to --vacuum.
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int64_t freelist = pragma_int(db, "PRAGMA freelist_count;");
+	if (freelist > DB_MAINTENANCE_FREELIST_PAGES) {
+		if (pragma_int(db, "PRAGMA auto_vacuum;") !=
+		    DB_AUTO_VACUUM_INCREMENTAL) {
+			if (config->debug_mode || config->verbose_mode) {
+				fprintf(stderr,
+					"%s has %" PRId64
+					" free pages, stop SentryPeer and run it with --vacuum to give them back\n",
+					db_file, freelist);
+			}
+		} else {
+			char incremental_vacuum[64];
+			snprintf(incremental_vacuum, sizeof(incremental_vacuum),
+				 "PRAGMA incremental_vacuum(%d);",
+				 DB_MAINTENANCE_VACUUM_PAGES);
+			if (sqlite3_exec(db, incremental_vacuum, NULL, NULL,
+					 NULL) != SQLITE_OK) {
+				fprintf(stderr,
+					"Failed to incremental_vacuum %s: %s\n",
+					db_file, sqlite3_errmsg(db));
+			}
+		}
+	}
+	pass_stats->last_vacuum_ms += elapsed_ms(&start);
+
+	// Off the capture path, as training takes a while
+	sip_message_store_train_dict(db, config);
+
+	// First time round there are no stats at all, so gather them. After
+	// that, PRAGMA optimize only re-analyzes what has drifted.
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	const char *optimize = pragma_int(db, DB_HAS_STATS) == 1 ?
+				       "PRAGMA optimize;" :
+				       "ANALYZE;";
+	if (sqlite3_exec(db, optimize, NULL, NULL, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to run %s on %s: %s\n", optimize,
+			db_file, sqlite3_errmsg(db));
+	}
+	pass_stats->last_optimize_ms += elapsed_ms(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (sqlite3_exec(db, "PRAGMA wal_checkpoint(TRUNCATE);", NULL, NULL,
+			 NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to checkpoint %s: %s\n", db_file,
+			sqlite3_errmsg(db));
+	}
+	pass_stats->last_checkpoint_ms += elapsed_ms(&start);
+
+	if (sqlite3_close(db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to close database\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// The db file and the partition being written to now. Older partitions
+// were maintained while they were current and are only read from now.
+static int maintenance_files(sentrypeer_config const *config,
+			     char files[2][SENTRYPEER_PATH_MAX + 1],
+			     int *count)
+{
+	util_copy_string(files[0], config->db_file, SENTRYPEER_PATH_MAX);
+	*count = 1;
+
+	if (config->db_partition != DB_PARTITION_NONE) {
+		if (db_partition_path(config, time(NULL), files[1],
+				      SENTRYPEER_PATH_MAX) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+		*count = 2;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Switch a file over to incremental auto_vacuum and WAL
+static int vacuum_file(const char *db_file, sentrypeer_config const *config)
+{
+	sqlite3 *db;
+	if (sqlite3_open_v2(db_file, &db, SQLITE_OPEN_READWRITE, NULL) !=
+	    SQLITE_OK) {
+		fprintf(stderr, "Failed to open %s: %s\n", db_file,
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+	sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int status = EXIT_SUCCESS;
+	if (pragma_int(db, "PRAGMA auto_vacuum;") !=
+	    DB_AUTO_VACUUM_INCREMENTAL) {
+		if (sqlite3_exec(db, DB_SET_AUTO_VACUUM, NULL, NULL, NULL) !=
+			    SQLITE_OK ||
+		    sqlite3_exec(db, "VACUUM;", NULL, NULL, NULL) !=
+			    SQLITE_OK) {
+			fprintf(stderr, "Failed to VACUUM %s: %s\n", db_file,
+				sqlite3_errmsg(db));
+			status = EXIT_FAILURE;
+		} else {
+			fprintf(stderr,
+				"Switched %s to incremental auto_vacuum in %.3f seconds\n",
+				db_file, elapsed_ms(&start) / 1000.0);
+		}
+	} else if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "%s already has incremental auto_vacuum\n",
+			db_file);
+	}
+
+	if (status == EXIT_SUCCESS &&
+	    sqlite3_exec(db, DB_SET_JOURNAL_MODE, NULL, NULL, NULL) !=
+		    SQLITE_OK) {
+		fprintf(stderr, "Failed to set journal_mode on %s: %s\n",
+			db_file, sqlite3_errmsg(db));
+		status = EXIT_FAILURE;
+	}
+
+	if (sqlite3_close(db) != SQLITE_OK) {
+		fprintf(stderr, "Failed to close database\n");
+		return EXIT_FAILURE;
+	}
+
+	return status;
+}
+
+int db_maintenance_vacuum(sentrypeer_config const *config)
+{
+	char **files = 0;
+	size_t count = 0;
+	if (db_partition_files(config, &files, &count) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	int status = EXIT_SUCCESS;
+	for (size_t i = 0; i < count; i++) {
+		if (access(files[i], F_OK) == 0 &&
+		    vacuum_file(files[i], config) != EXIT_SUCCESS) {
+			status = EXIT_FAILURE;
+		}
+	}
+	db_partition_files_destroy(&files, count);
+
+	return status;
+}
+
+int db_maintenance_pass(sentrypeer_config const *config)
+{
+	db_maintenance_stats pass_stats = { 0 };
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	char(*files)[SENTRYPEER_PATH_MAX + 1] =
+		calloc(2, sizeof(*files));
+	assert(files);
+	int count = 0;
+	int status = maintenance_files(config, files, &count);
+
+	for (int i = 0; i < count && status == EXIT_SUCCESS; i++) {
+		status = maintain_file(files[i], config, &pass_stats);
+	}
+	free(files);
+
+	if (status == EXIT_SUCCESS) {
+		status = db_partition_retention(config);
+	}
+
+	pass_stats.last_pass_ms = elapsed_ms(&start);
+
+	pthread_mutex_lock(&maintenance_mutex);
+	maintenance_stats.passes++;
+	maintenance_stats.last_pass_ms = pass_stats.last_pass_ms;
+	maintenance_stats.last_vacuum_ms = pass_stats.last_vacuum_ms;
+	maintenance_stats.last_optimize_ms = pass_stats.last_optimize_ms;
+	maintenance_stats.last_checkpoint_ms = pass_stats.last_checkpoint_ms;
+	pthread_mutex_unlock(&maintenance_mutex);
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr,
+			"DB maintenance pass took %.1f ms (vacuum %.1f ms, optimize %.1f ms, checkpoint %.1f ms)\n",
+			pass_stats.last_pass_ms, pass_stats.last_vacuum_ms,
+			pass_stats.last_optimize_ms,
+			pass_stats.last_checkpoint_ms);
+	}
+
+	return status;
+}
+
+static bool thresholds_crossed(sentrypeer_config const *config)
+{
+	char(*files)[SENTRYPEER_PATH_MAX + 1] =
+		calloc(2, sizeof(*files));
+	assert(files);
+	int count = 0;
+	bool crossed = false;
+
+	if (maintenance_files(config, files, &count) == EXIT_SUCCESS) {
+		for (int i = 0; i < count && !crossed; i++) {
+			crossed = wal_size(files[i]) >
+				  DB_MAINTENANCE_WAL_MAX_BYTES;
+		}
+	}
+	free(files);
+
+	return crossed;
+}
+
+static void *db_maintenance_thread_start(void *arg)
+{
+	sentrypeer_config const *config = arg;
+
+#ifdef SCHED_IDLE
+	// Only run when nothing else wants the CPU
+	struct sched_param idle_param = { 0 };
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &idle_param);
+#endif
+
+	time_t last_pass = time(NULL);
+	uint_fast64_t last_writes =
+		atomic_load_explicit(&db_writes, memory_order_relaxed);
+
+	pthread_mutex_lock(&maintenance_mutex);
+	while (!maintenance_stop) {
+		struct timespec wake_up;
+		clock_gettime(CLOCK_REALTIME, &wake_up);
+		wake_up.tv_sec += DB_MAINTENANCE_TICK_SECONDS;
+
+		int rc = 0;
+		while (!maintenance_stop && rc != ETIMEDOUT) {
+			rc = pthread_cond_timedwait(&maintenance_cond,
+						    &maintenance_mutex,
+						    &wake_up);
+		}
+		if (maintenance_stop) {
+			break;
+		}
+		pthread_mutex_unlock(&maintenance_mutex);
+
+		// Only the buckets counted into since last time, so every tick
+		if (config->event_series != 0) {
+			db_save_event_series(config->event_series, config);
+		}
+
+		uint_fast64_t writes =
+			atomic_load_explicit(&db_writes, memory_order_relaxed);
+		bool busy = writes - last_writes >
+			    (uint_fast64_t)DB_MAINTENANCE_BUSY_INSERTS_PER_SECOND *
+				    DB_MAINTENANCE_TICK_SECONDS;
+		last_writes = writes;
+
+		bool due = time(NULL) - last_pass >=
+				   config->db_maintenance_interval ||
+			   thresholds_crossed(config);
+
+		if (due && busy) {
+			if (config->debug_mode || config->verbose_mode) {
+				fprintf(stderr,
+					"DB maintenance postponed, ingest is busy\n");
+			}
+			pthread_mutex_lock(&maintenance_mutex);
+			maintenance_stats.skipped_busy++;
+			pthread_mutex_unlock(&maintenance_mutex);
+		} else if (due) {
+			db_maintenance_pass(config);
+			last_pass = time(NULL);
+		}
+
+		// Cheap, and shouldn't wait for the next rollover or for
+		// ingest to quieten down
+		if (!due || busy) {
+			db_partition_retention(config);
+		}
+
+		pthread_mutex_lock(&maintenance_mutex);
+	}
+	pthread_mutex_unlock(&maintenance_mutex);
+
+	return NULL;
+}
+
+int db_maintenance_run(sentrypeer_config *config)
+{
+	// Partitions that went past retention while we were stopped. After
+	// this it's done on every tick, or only at each rollover if
+	// maintenance is off.
+	if (db_partition_retention(config) != EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to apply DB retention.\n");
+	}
+
+	if (config->db_maintenance_interval <= 0) {
+		return EXIT_SUCCESS;
+	}
+
+	pthread_mutex_lock(&maintenance_mutex);
+	maintenance_stop = false;
+	pthread_mutex_unlock(&maintenance_mutex);
+
+	pthread_t db_maintenance_thread = 0;
+	if (pthread_create(&db_maintenance_thread, NULL,
+			   db_maintenance_thread_start,
+			   (void *)config) != EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to create DB maintenance thread.\n");
+		return EXIT_FAILURE;
+	}
+#ifdef __APPLE__
+	// Can only name ourselves on macOS
+#else
+	if (pthread_setname_np(db_maintenance_thread, "db_maintenance") !=
+	    EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to set DB maintenance thread name.\n");
+	}
+#endif
+	config->db_maintenance_thread = db_maintenance_thread;
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "DB maintenance every %d seconds...\n",
+			config->db_maintenance_interval);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int db_maintenance_stop(sentrypeer_config const *config)
+{
+	if (config->db_maintenance_thread == 0) {
+		return EXIT_SUCCESS;
+	}
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Stopping DB maintenance...\n");
+	}
+
+	// No pthread_cancel(), we don't want to leave SQLite mid-write
+	pthread_mutex_lock(&maintenance_mutex);
+	maintenance_stop = true;
+	pthread_cond_signal(&maintenance_cond);
+	pthread_mutex_unlock(&maintenance_mutex);
+
+	if (pthread_join(config->db_maintenance_thread, NULL) != EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to join DB maintenance thread.\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#ifndef SENTRYPEER_DB_MAINTENANCE_H
+#define SENTRYPEER_DB_MAINTENANCE_H 1
+
+#include <stdint.h>
+
+#include "conf.h"
+
+// Seconds between scheduled passes, config->db_maintenance_interval
+#define DB_MAINTENANCE_INTERVAL 300
+// How often we wake up to check thresholds and how busy ingest is
+#define DB_MAINTENANCE_TICK_SECONDS 10
+// Skip a pass while we're logging more events than this per second
+#define DB_MAINTENANCE_BUSY_INSERTS_PER_SECOND 20
+// Thresholds that bring a pass forward
+#define DB_MAINTENANCE_WAL_MAX_BYTES (64 * 1024 * 1024)
+#define DB_MAINTENANCE_FREELIST_PAGES 1024
+// Pages to give back per incremental_vacuum, so we don't hold the write
+// lock for long
+#define DB_MAINTENANCE_VACUUM_PAGES 4096
+
+typedef struct db_maintenance_stats db_maintenance_stats;
+struct db_maintenance_stats {
+	uint64_t passes;
+	uint64_t skipped_busy;
+	double last_pass_ms;
+	double last_vacuum_ms;
+	double last_optimize_ms;
+	double last_checkpoint_ms;
+};
+
+/**
+ * Start the low priority maintenance thread.
+ *
+ * @param config Our config, db_maintenance_interval of 0 means don't start.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int db_maintenance_run(sentrypeer_config *config);
+
+/**
+ * Stop the maintenance thread, waiting for any pass in progress.
+ *
+ * @param config Our config.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int db_maintenance_stop(sentrypeer_config const *config);
+
+/**
+ * One maintenance pass over the db file, and the current partition if
+ * partitioning is on: incremental_vacuum, ANALYZE or PRAGMA optimize and
+ * wal_checkpoint(TRUNCATE), then partition retention.
+ *
+ * @param config Our config.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int db_maintenance_pass(sentrypeer_config const *config);
+
+/**
+ * Switch the db file and every partition that were created before
+ * incremental auto_vacuum was the default over to it, and to WAL, with a
+ * full VACUUM. That locks each file for as long as it takes, so is only
+ * done offline with --vacuum, never by the maintenance thread.
+ *
+ * @param config Our config.
+ * @return EXIT_SUCCESS or EXIT_FAILURE if any file couldn't be switched.
+ */
+int db_maintenance_vacuum(sentrypeer_config const *config);
+
+/**
+ * Let maintenance know we've written to the database, so it can back off
+ * while ingest is busy. Cheap enough to call on every insert.
+ */
+void db_maintenance_note_write(void);
+
+/**
+ * Copy the current maintenance stats.
+ *
+ * @param stats Filled with a snapshot.
+ */
+void db_maintenance_stats_get(db_maintenance_stats *stats);
+
+#endif //SENTRYPEER_DB_MAINTENANCE_H
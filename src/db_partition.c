@@ -0,0 +1,534 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "db_partition.h"
+#include "utils.h"
+
+#define SECONDS_PER_DAY (24 * 60 * 60)
+
+int db_partition_from_string(const char *partition)
+{
+	if (strcmp(partition, "none") == 0) {
+		return DB_PARTITION_NONE;
+	}
+	if (strcmp(partition, "day") == 0) {
+		return DB_PARTITION_DAY;
+	}
+	if (strcmp(partition, "week") == 0) {
+		return DB_PARTITION_WEEK;
+	}
+
+	return -1;
+}
+
+static time_t partition_period(sentrypeer_config const *config)
+{
+	return config->db_partition == DB_PARTITION_WEEK ? 7 * SECONDS_PER_DAY :
+							   SECONDS_PER_DAY;
+}
+
+// Split db_file into its directory and file name without a .db suffix
+static void partition_dir_and_stem(sentrypeer_config const *config, char *dir,
+				   char *stem)
+{
+	const char *slash = strrchr(config->db_file, '/');
+	if (slash == 0) {
+		util_copy_string(dir, ".", SENTRYPEER_PATH_MAX);
+		util_copy_string(stem, config->db_file, SENTRYPEER_PATH_MAX);
+	} else {
+		// "/sentrypeer.db" lives in "/"
+		size_t dir_len = slash == config->db_file ?
+					 1 :
+					 (size_t)(slash - config->db_file);
+		memcpy(dir, config->db_file, dir_len);
+		dir[dir_len] = '\0';
+		util_copy_string(stem, slash + 1, SENTRYPEER_PATH_MAX);
+	}
+
+	size_t stem_len = strlen(stem);
+	if (stem_len > 3 && strcmp(stem + stem_len - 3, ".db") == 0) {
+		stem[stem_len - 3] = '\0';
+	}
+}
+
+// Partition start time from YYYYMMDD
+static time_t partition_start(const char *date)
+{
+	struct tm tm = { 0 };
+	char part[5] = { 0 };
+
+	memcpy(part, date, 4);
+	tm.tm_year = atoi(part) - 1900;
+	memset(part, 0, sizeof(part));
+	memcpy(part, date + 4, 2);
+	tm.tm_mon = atoi(part) - 1;
+	memcpy(part, date + 6, 2);
+	tm.tm_mday = atoi(part);
+	tm.tm_isdst = -1;
+
+	return mktime(&tm);
+}
+
+// localtime_r() and mktime() take the timezone lock, and every event asks
+// which partition it goes in, so each thread keeps the times the last one
+// covers and its date
+typedef struct partition_cache partition_cache;
+struct partition_cache {
+	int db_partition;
+	time_t start;
+	time_t end;
+	char date[DB_PARTITION_DATE_LEN + 1];
+};
+
+static _Thread_local partition_cache thread_partition;
+
+static int partition_cache_fill(int db_partition, time_t when,
+				partition_cache *cache)
+{
+	struct tm tm;
+	if (localtime_r(&when, &tm) == 0) {
+		return EXIT_FAILURE;
+	}
+
+	int days = 1;
+	if (db_partition == DB_PARTITION_WEEK) {
+		// Back to Monday, letting mktime() normalise the date
+		tm.tm_mday -= (tm.tm_wday + 6) % 7;
+		tm.tm_hour = 12;
+		tm.tm_isdst = -1;
+		time_t monday = mktime(&tm);
+		if (localtime_r(&monday, &tm) == 0) {
+			return EXIT_FAILURE;
+		}
+		days = 7;
+	}
+	strftime(cache->date, sizeof(cache->date), "%Y%m%d", &tm);
+
+	// From midnight at the start of the first day to the one after the
+	// last, whatever DST does in between
+	tm.tm_hour = 0;
+	tm.tm_min = 0;
+	tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+	struct tm end_tm = tm;
+	end_tm.tm_mday += days;
+	cache->start = mktime(&tm);
+	cache->end = mktime(&end_tm);
+	cache->db_partition = db_partition;
+
+	return EXIT_SUCCESS;
+}
+
+int db_partition_path(sentrypeer_config const *config, time_t when,
+		      char *path, size_t path_len)
+{
+	partition_cache *cache = &thread_partition;
+	if (cache->db_partition != config->db_partition ||
+	    when < cache->start || when >= cache->end) {
+		if (partition_cache_fill(config->db_partition, when, cache) !=
+		    EXIT_SUCCESS) {
+			cache->db_partition = DB_PARTITION_NONE;
+			return EXIT_FAILURE;
+		}
+	}
+	const char *date = cache->date;
+
+	char *dir = calloc(SENTRYPEER_PATH_MAX + 1, sizeof(char));
+	char *stem = calloc(SENTRYPEER_PATH_MAX + 1, sizeof(char));
+	assert(dir && stem);
+	partition_dir_and_stem(config, dir, stem);
+
+	int written =
+		snprintf(path, path_len, "%s/%s-%s.db", dir, stem, date);
+	free(dir);
+	free(stem);
+
+	if (written < 0 || (size_t)written >= path_len) {
+		fprintf(stderr, "Partition path is too long for: %s\n",
+			config->db_file);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int compare_newest_first(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)b, *(char *const *)a);
+}
+
+// Partition files only, newest first
+static int partition_list(sentrypeer_config const *config, char ***files,
+			  size_t *count)
+{
+	*files = 0;
+	*count = 0;
+
+	char *dir = calloc(SENTRYPEER_PATH_MAX + 1, sizeof(char));
+	char *stem = calloc(SENTRYPEER_PATH_MAX + 1, sizeof(char));
+	assert(dir && stem);
+	partition_dir_and_stem(config, dir, stem);
+	size_t stem_len = strlen(stem);
+
+	DIR *dir_stream = opendir(dir);
+	if (dir_stream == 0) {
+		fprintf(stderr, "Failed to open db directory: %s\n", dir);
+		free(dir);
+		free(stem);
+		return EXIT_FAILURE;
+	}
+
+	size_t capacity = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir_stream)) != 0) {
+		// stem-YYYYMMDD.db
+		const char *name = entry->d_name;
+		if (strlen(name) != stem_len + 1 + DB_PARTITION_DATE_LEN + 3 ||
+		    strncmp(name, stem, stem_len) != 0 ||
+		    name[stem_len] != '-' ||
+		    strcmp(name + stem_len + 1 + DB_PARTITION_DATE_LEN,
+			   ".db") != 0) {
+			continue;
+		}
+
+		bool is_date = true;
+		for (size_t i = 0; i < DB_PARTITION_DATE_LEN; i++) {
+			if (!isdigit((unsigned char)name[stem_len + 1 + i])) {
+				is_date = false;
+			}
+		}
+		if (!is_date) {
+			continue;
+		}
+
+		if (*count == capacity) {
+			capacity = capacity == 0 ? 16 : capacity * 2;
+			char **grown = realloc(*files, capacity * sizeof(**files));
+			assert(grown);
+			*files = grown;
+		}
+
+		size_t path_len = strlen(dir) + 1 + strlen(name) + 1;
+		(*files)[*count] = malloc(path_len);
+		assert((*files)[*count]);
+		snprintf((*files)[*count], path_len, "%s/%s", dir, name);
+		(*count)++;
+	}
+	closedir(dir_stream);
+	free(dir);
+	free(stem);
+
+	// Same directory and stem, so the dates sort the paths
+	if (*count > 1) {
+		qsort(*files, *count, sizeof(**files), compare_newest_first);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int db_partition_files(sentrypeer_config const *config, char ***files,
+		       size_t *count)
+{
+	if (config->db_partition == DB_PARTITION_NONE) {
+		*files = malloc(sizeof(**files));
+		assert(*files);
+		(*files)[0] = util_duplicate_string(config->db_file);
+		*count = 1;
+		return EXIT_SUCCESS;
+	}
+
+	if (partition_list(config, files, count) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	char **grown = realloc(*files, (*count + 1) * sizeof(**files));
+	assert(grown);
+	*files = grown;
+	(*files)[*count] = util_duplicate_string(config->db_file);
+	(*count)++;
+
+	return EXIT_SUCCESS;
+}
+
+void db_partition_files_destroy(char ***files, size_t count)
+{
+	assert(files);
+	if (*files) {
+		for (size_t i = 0; i < count; i++) {
+			free((*files)[i]);
+		}
+		free(*files);
+		*files = 0;
+	}
+}
+
+int db_partition_prepare(sqlite3 *db, const char *sql_fmt, const char *schema,
+			 sqlite3_stmt **stmt)
+{
+	size_t sql_len = strlen(sql_fmt) + strlen(schema) + 1;
+	char *sql = malloc(sql_len);
+	assert(sql);
+	snprintf(sql, sql_len, sql_fmt, schema);
+
+	int rc = sqlite3_prepare_v2(db, sql, -1, stmt, NULL);
+	free(sql);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare statement on %s: %s\n",
+			schema, sqlite3_errmsg(db));
+		sqlite3_finalize(*stmt);
+		*stmt = 0;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int fan_out_exec(sqlite3 *db, const char *sql_fmt, const char *schema)
+{
+	sqlite3_stmt *stmt = 0;
+	if (db_partition_prepare(db, sql_fmt, schema, &stmt) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	int rc = sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+	if (rc != SQLITE_DONE) {
+		fprintf(stderr, "Failed to run fan out query on %s: %s\n",
+			schema, sqlite3_errmsg(db));
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int db_partition_attach(sqlite3 *db, const char *file)
+{
+	sqlite3_stmt *attach_stmt = 0;
+	if (sqlite3_prepare_v2(db, ATTACH_PARTITION, -1, &attach_stmt, NULL) !=
+		    SQLITE_OK ||
+	    sqlite3_bind_text(attach_stmt, 1, file, -1, SQLITE_STATIC) !=
+		    SQLITE_OK ||
+	    sqlite3_step(attach_stmt) != SQLITE_DONE) {
+		fprintf(stderr, "Failed to attach partition %s: %s\n", file,
+			sqlite3_errmsg(db));
+		sqlite3_finalize(attach_stmt);
+		return EXIT_FAILURE;
+	}
+	sqlite3_finalize(attach_stmt);
+
+	return EXIT_SUCCESS;
+}
+
+int db_partition_detach(sqlite3 *db, const char *file)
+{
+	if (sqlite3_exec(db, DETACH_PARTITION, NULL, NULL, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to detach partition %s: %s\n", file,
+			sqlite3_errmsg(db));
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int db_partition_main_has_honey(sqlite3 *db, bool *has_honey)
+{
+	sqlite3_stmt *honey_exists_stmt = 0;
+	if (sqlite3_prepare_v2(db, HONEY_TABLE_EXISTS, -1, &honey_exists_stmt,
+			       NULL) != SQLITE_OK ||
+	    sqlite3_step(honey_exists_stmt) != SQLITE_ROW) {
+		fprintf(stderr, "Failed to check for honey table: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_finalize(honey_exists_stmt);
+		return EXIT_FAILURE;
+	}
+	*has_honey = sqlite3_column_int(honey_exists_stmt, 0);
+	sqlite3_finalize(honey_exists_stmt);
+
+	return EXIT_SUCCESS;
+}
+
+int64_t db_partition_number(sentrypeer_config const *config,
+			    const char *file)
+{
+	size_t file_len = strlen(file);
+	if (strcmp(file, config->db_file) == 0 ||
+	    file_len < DB_PARTITION_DATE_LEN + 3) {
+		return 0;
+	}
+
+	// ...-YYYYMMDD.db, checked by partition_list()
+	char date[DB_PARTITION_DATE_LEN + 1] = { 0 };
+	memcpy(date, file + file_len - DB_PARTITION_DATE_LEN - 3,
+	       DB_PARTITION_DATE_LEN);
+
+	return strtoll(date, NULL, 10);
+}
+
+int db_partition_fan_out(sqlite3 *db, const char *sql_fmt,
+			 sentrypeer_config const *config)
+{
+	char **files = 0;
+	size_t count = 0;
+	if (partition_list(config, &files, &count) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	int status = EXIT_SUCCESS;
+	for (size_t i = 0; i < count && status == EXIT_SUCCESS; i++) {
+		if (db_partition_attach(db, files[i]) != EXIT_SUCCESS) {
+			status = EXIT_FAILURE;
+			break;
+		}
+
+		status = fan_out_exec(db, sql_fmt, DB_PARTITION_SCHEMA);
+
+		if (db_partition_detach(db, files[i]) != EXIT_SUCCESS) {
+			status = EXIT_FAILURE;
+		}
+	}
+	db_partition_files_destroy(&files, count);
+
+	if (status != EXIT_SUCCESS) {
+		return status;
+	}
+
+	// Rows from before partitioning was turned on
+	bool main_has_honey = false;
+	if (db_partition_main_has_honey(db, &main_has_honey) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	if (main_has_honey) {
+		return fan_out_exec(db, sql_fmt, "main");
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static void partition_drop(const char *file, const char *reason,
+			   sentrypeer_config const *config)
+{
+	const char *suffixes[] = { "", "-wal", "-shm", "-journal" };
+	size_t path_len = strlen(file) + sizeof("-journal");
+	char *path = malloc(path_len);
+	assert(path);
+
+	for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+		snprintf(path, path_len, "%s%s", file, suffixes[i]);
+		if (unlink(path) != 0 && i == 0) {
+			perror("Failed to remove partition");
+		}
+	}
+	free(path);
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Dropped partition %s (%s)\n", file, reason);
+	}
+}
+
+static off_t partition_size(const char *file)
+{
+	struct stat file_stat;
+	off_t size = 0;
+
+	if (stat(file, &file_stat) == 0) {
+		size += file_stat.st_size;
+	}
+
+	size_t wal_len = strlen(file) + sizeof("-wal");
+	char *wal = malloc(wal_len);
+	assert(wal);
+	snprintf(wal, wal_len, "%s-wal", file);
+	if (stat(wal, &file_stat) == 0) {
+		size += file_stat.st_size;
+	}
+	free(wal);
+
+	return size;
+}
+
+int db_partition_retention(sentrypeer_config const *config)
+{
+	if (config->db_partition == DB_PARTITION_NONE ||
+	    (config->db_retention_days == 0 &&
+	     config->db_retention_max_bytes == 0)) {
+		return EXIT_SUCCESS;
+	}
+
+	char **files = 0;
+	size_t count = 0;
+	if (partition_list(config, &files, &count) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	time_t now = time(NULL);
+	char *current = calloc(SENTRYPEER_PATH_MAX + 1, sizeof(char));
+	assert(current);
+	if (db_partition_path(config, now, current, SENTRYPEER_PATH_MAX) !=
+	    EXIT_SUCCESS) {
+		free(current);
+		db_partition_files_destroy(&files, count);
+		return EXIT_FAILURE;
+	}
+
+	char *dir = calloc(SENTRYPEER_PATH_MAX + 1, sizeof(char));
+	char *stem = calloc(SENTRYPEER_PATH_MAX + 1, sizeof(char));
+	assert(dir && stem);
+	partition_dir_and_stem(config, dir, stem);
+	// Where the date starts in each path
+	size_t date_offset = strlen(dir) + 1 + strlen(stem) + 1;
+	free(dir);
+	free(stem);
+
+	time_t cutoff = now - (time_t)config->db_retention_days *
+				      SECONDS_PER_DAY;
+	int64_t total_size = 0;
+
+	// Newest first, so everything after the size limit is hit goes
+	for (size_t i = 0; i < count; i++) {
+		if (strcmp(files[i], current) == 0) {
+			total_size += partition_size(files[i]);
+			continue;
+		}
+
+		time_t end = partition_start(files[i] + date_offset) +
+			     partition_period(config);
+		if (config->db_retention_days > 0 && end <= cutoff) {
+			partition_drop(files[i], "older than retention days",
+				       config);
+			continue;
+		}
+
+		total_size += partition_size(files[i]);
+		if (config->db_retention_max_bytes > 0 &&
+		    total_size > config->db_retention_max_bytes) {
+			partition_drop(files[i], "over retention size", config);
+		}
+	}
+
+	free(current);
+	db_partition_files_destroy(&files, count);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#ifndef SENTRYPEER_DB_PARTITION_H
+#define SENTRYPEER_DB_PARTITION_H 1
+
+#include <sqlite3.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "conf.h"
+
+// config->db_partition
+#define DB_PARTITION_NONE 0
+#define DB_PARTITION_DAY 1
+#define DB_PARTITION_WEEK 2
+
+// sentrypeer.db is partitioned into sentrypeer-YYYYMMDD.db next to it, where
+// the date is the first day of the partition (a Monday for weekly ones)
+#define DB_PARTITION_DATE_LEN 8
+#define DB_PARTITION_SCHEMA "honey_partition"
+#define ATTACH_PARTITION "ATTACH DATABASE ? AS " DB_PARTITION_SCHEMA ";"
+#define DETACH_PARTITION "DETACH DATABASE " DB_PARTITION_SCHEMA ";"
+#define HONEY_TABLE_EXISTS                                                     \
+	"SELECT EXISTS(SELECT 1 FROM main.sqlite_master WHERE type = 'table' AND name = 'honey');"
+
+/**
+ * Parse "day", "week" or "none".
+ *
+ * @param partition The partition period name.
+ * @return DB_PARTITION_* or -1 if not recognised.
+ */
+int db_partition_from_string(const char *partition);
+
+/**
+ * Path of the partition file that holds events logged at a given time.
+ *
+ * @param config Our config, with db_file and db_partition set.
+ * @param when The event time.
+ * @param path The buffer to fill.
+ * @param path_len Size of path.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int db_partition_path(sentrypeer_config const *config, time_t when,
+		      char *path, size_t path_len);
+
+/**
+ * All database files that hold honey rows, newest partition first and
+ * config->db_file last as it has any rows from before partitioning was
+ * turned on. Without partitioning this is just config->db_file.
+ *
+ * @param config Our config.
+ * @param files Set to an array of paths (free with db_partition_files_destroy).
+ * @param count Set to the number of paths.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int db_partition_files(sentrypeer_config const *config, char ***files,
+		       size_t *count);
+void db_partition_files_destroy(char ***files, size_t count);
+
+/**
+ * The partition's first day as the number YYYYMMDD, so newer partitions
+ * have bigger numbers.
+ *
+ * @param config Our config.
+ * @param file A path from db_partition_files().
+ * @return YYYYMMDD, or 0 for config->db_file.
+ */
+int64_t db_partition_number(sentrypeer_config const *config,
+			    const char *file);
+
+// Attach a partition file as DB_PARTITION_SCHEMA, and detach it again
+int db_partition_attach(sqlite3 *db, const char *file);
+int db_partition_detach(sqlite3 *db, const char *file);
+
+// Prepare sql_fmt with its single %s set to schema, e.g. "main" or
+// DB_PARTITION_SCHEMA. On failure *stmt is NULL.
+int db_partition_prepare(sqlite3 *db, const char *sql_fmt, const char *schema,
+			 sqlite3_stmt **stmt);
+
+// Whether config->db_file has a honey table, as with partitioning on from
+// the start it never gets one
+int db_partition_main_has_honey(sqlite3 *db, bool *has_honey);
+
+/**
+ * Run sql_fmt once per partition, plus once for main if it has a honey
+ * table. sql_fmt must contain a single %s for the schema name. Partitions
+ * are attached one at a time, so we never hit SQLITE_MAX_ATTACHED; results
+ * need to go somewhere that outlives the attach, i.e. a TEMP table.
+ *
+ * @param db An open handle on config->db_file.
+ * @param sql_fmt The SQL to run, e.g. "INSERT INTO temp.x SELECT ... FROM %s.honey;"
+ * @param config Our config.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int db_partition_fan_out(sqlite3 *db, const char *sql_fmt,
+			 sentrypeer_config const *config);
+
+/**
+ * Drop whole partitions that are older than config->db_retention_days or,
+ * oldest first, while all partitions together are bigger than
+ * config->db_retention_max_bytes. The current partition is never dropped.
+ *
+ * @param config Our config.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int db_partition_retention(sentrypeer_config const *config);
+
+#endif //SENTRYPEER_DB_PARTITION_H
@@ -0,0 +1,415 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "event_series.h"
+
+#define SERIES_RING_MINUTES 0
+#define SERIES_RING_HOURS 1
+#define SERIES_RINGS 2
+
+// counts[] is bucket by key, so a bucket is one row of EVENT_SERIES_KEYS
+// counters. starts[] says which bucket a slot holds, 0 when unused.
+typedef struct series_ring series_ring;
+struct series_ring {
+	int resolution;
+	size_t size;
+	time_t *starts;
+	bool *dirty;
+	uint32_t *counts;
+};
+
+struct event_series {
+	event_series_key keys[EVENT_SERIES_KEYS];
+	size_t key_count;
+	series_ring rings[SERIES_RINGS];
+	pthread_mutex_t mutex;
+};
+
+static void ring_init(series_ring *ring, int resolution, size_t size)
+{
+	ring->resolution = resolution;
+	ring->size = size;
+	ring->starts = calloc(size, sizeof(time_t));
+	ring->dirty = calloc(size, sizeof(bool));
+	ring->counts = calloc(size * EVENT_SERIES_KEYS, sizeof(uint32_t));
+	assert(ring->starts && ring->dirty && ring->counts);
+}
+
+static void ring_free(series_ring *ring)
+{
+	free(ring->starts);
+	free(ring->dirty);
+	free(ring->counts);
+}
+
+event_series *event_series_new(void)
+{
+	event_series *self = calloc(1, sizeof(event_series));
+	assert(self);
+
+	ring_init(&self->rings[SERIES_RING_MINUTES], EVENT_SERIES_MINUTE,
+		  EVENT_SERIES_MINUTES);
+	ring_init(&self->rings[SERIES_RING_HOURS], EVENT_SERIES_HOUR,
+		  EVENT_SERIES_HOURS);
+
+	if (pthread_mutex_init(&self->mutex, NULL) != EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to init event_series mutex\n");
+		for (int i = 0; i < SERIES_RINGS; i++) {
+			ring_free(&self->rings[i]);
+		}
+		free(self);
+		return NULL;
+	}
+
+	return self;
+}
+
+void event_series_destroy(event_series **self_ptr)
+{
+	assert(self_ptr);
+	if (*self_ptr) {
+		event_series *self = *self_ptr;
+		for (int i = 0; i < SERIES_RINGS; i++) {
+			ring_free(&self->rings[i]);
+		}
+		pthread_mutex_destroy(&self->mutex);
+		free(self);
+		*self_ptr = 0;
+	}
+}
+
+void event_series_range_destroy(event_series_range **range_ptr)
+{
+	assert(range_ptr);
+	if (*range_ptr) {
+		free((*range_ptr)->points);
+		free(*range_ptr);
+		*range_ptr = 0;
+	}
+}
+
+static series_ring *ring_for(event_series *self, int resolution)
+{
+	for (int i = 0; i < SERIES_RINGS; i++) {
+		if (self->rings[i].resolution == resolution) {
+			return &self->rings[i];
+		}
+	}
+
+	return NULL;
+}
+
+static bool key_matches(const event_series_key *key, const char *method,
+			const char *transport_type,
+			const char *collected_method)
+{
+	return strcmp(key->method, method) == 0 &&
+	       strcmp(key->transport_type, transport_type) == 0 &&
+	       strcmp(key->collected_method, collected_method) == 0;
+}
+
+static size_t key_add(event_series *self, const char *method,
+		      const char *transport_type,
+		      const char *collected_method)
+{
+	assert(self->key_count < EVENT_SERIES_KEYS);
+	event_series_key *key = &self->keys[self->key_count];
+	snprintf(key->method, sizeof(key->method), "%s", method);
+	snprintf(key->transport_type, sizeof(key->transport_type), "%s",
+		 transport_type);
+	snprintf(key->collected_method, sizeof(key->collected_method), "%s",
+		 collected_method);
+
+	return self->key_count++;
+}
+
+// There are only ever a handful of keys, so a scan is as quick as a hash
+static size_t key_index(event_series *self, const char *method,
+			const char *transport_type,
+			const char *collected_method)
+{
+	// Truncated the same way as the keys we have
+	event_series_key wanted;
+	snprintf(wanted.method, sizeof(wanted.method), "%s",
+		 method ? method : "");
+	snprintf(wanted.transport_type, sizeof(wanted.transport_type), "%s",
+		 transport_type ? transport_type : "");
+	snprintf(wanted.collected_method, sizeof(wanted.collected_method), "%s",
+		 collected_method ? collected_method : "");
+
+	for (size_t i = 0; i < self->key_count; i++) {
+		if (key_matches(&self->keys[i], wanted.method,
+				wanted.transport_type,
+				wanted.collected_method)) {
+			return i;
+		}
+	}
+
+	if (self->key_count < EVENT_SERIES_KEYS - 1) {
+		return key_add(self, wanted.method, wanted.transport_type,
+			       wanted.collected_method);
+	}
+
+	// Full, so the last slot is only ever "other"
+	for (size_t i = 0; i < self->key_count; i++) {
+		if (key_matches(&self->keys[i], EVENT_SERIES_OTHER,
+				EVENT_SERIES_OTHER, EVENT_SERIES_OTHER)) {
+			return i;
+		}
+	}
+
+	return key_add(self, EVENT_SERIES_OTHER, EVENT_SERIES_OTHER,
+		       EVENT_SERIES_OTHER);
+}
+
+static time_t bucket_start(const series_ring *ring, time_t when)
+{
+	return when - when % ring->resolution;
+}
+
+static size_t ring_slot(const series_ring *ring, time_t start)
+{
+	return (size_t)(start / ring->resolution) % ring->size;
+}
+
+// Whether the bucket starting at start is one the ring holds now, i.e.
+// not older than the ring goes back and not from after the clock skew
+static bool ring_holds(const series_ring *ring, time_t start, time_t now)
+{
+	time_t newest = bucket_start(ring, now + EVENT_SERIES_SKEW);
+	return start <= newest &&
+	       start > newest - (time_t)ring->size * ring->resolution;
+}
+
+// The counters for the bucket starting at start, reusing its slot if that
+// holds an older bucket. NULL if the slot has already moved on past it.
+static uint32_t *bucket_counts(series_ring *ring, time_t start, bool create)
+{
+	size_t slot = ring_slot(ring, start);
+	if (ring->starts[slot] != start) {
+		if (!create || ring->starts[slot] > start) {
+			return NULL;
+		}
+		ring->starts[slot] = start;
+		ring->dirty[slot] = false;
+		memset(&ring->counts[slot * EVENT_SERIES_KEYS], 0,
+		       EVENT_SERIES_KEYS * sizeof(uint32_t));
+	}
+
+	return &ring->counts[slot * EVENT_SERIES_KEYS];
+}
+
+static void counter_add(uint32_t *counter, uint64_t count)
+{
+	*counter = count > UINT32_MAX - *counter ? UINT32_MAX :
+						   *counter + (uint32_t)count;
+}
+
+void event_series_add(event_series *self, time_t when, const char *method,
+		      const char *transport_type,
+		      const char *collected_method, uint64_t count)
+{
+	time_t now = time(NULL);
+	if (when <= 0 || when > now + EVENT_SERIES_SKEW || count == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&self->mutex);
+	size_t key = key_index(self, method, transport_type, collected_method);
+	for (int i = 0; i < SERIES_RINGS; i++) {
+		series_ring *ring = &self->rings[i];
+		time_t start = bucket_start(ring, when);
+		if (!ring_holds(ring, start, now)) {
+			continue;
+		}
+		uint32_t *counts = bucket_counts(ring, start, true);
+		if (counts != 0) {
+			counter_add(&counts[key], count);
+			ring->dirty[ring_slot(ring, start)] = true;
+		}
+	}
+	pthread_mutex_unlock(&self->mutex);
+}
+
+void event_series_set(event_series *self, int resolution, time_t bucket,
+		      const char *method, const char *transport_type,
+		      const char *collected_method, uint64_t count)
+{
+	series_ring *ring = ring_for(self, resolution);
+	if (ring == 0 || bucket <= 0 || bucket % resolution != 0 ||
+	    !ring_holds(ring, bucket, time(NULL))) {
+		return;
+	}
+
+	pthread_mutex_lock(&self->mutex);
+	size_t key = key_index(self, method, transport_type, collected_method);
+	uint32_t *counts = bucket_counts(ring, bucket, true);
+	if (counts != 0) {
+		counts[key] = 0;
+		counter_add(&counts[key], count);
+	}
+	pthread_mutex_unlock(&self->mutex);
+}
+
+void event_series_clear_since(event_series *self, time_t since)
+{
+	pthread_mutex_lock(&self->mutex);
+	for (int i = 0; i < SERIES_RINGS; i++) {
+		series_ring *ring = &self->rings[i];
+		for (size_t slot = 0; slot < ring->size; slot++) {
+			if (ring->starts[slot] >= since) {
+				ring->starts[slot] = 0;
+				ring->dirty[slot] = false;
+				memset(&ring->counts[slot * EVENT_SERIES_KEYS],
+				       0, EVENT_SERIES_KEYS * sizeof(uint32_t));
+			}
+		}
+	}
+	pthread_mutex_unlock(&self->mutex);
+}
+
+time_t event_series_newest(event_series *self, int resolution)
+{
+	series_ring *ring = ring_for(self, resolution);
+	if (ring == 0) {
+		return 0;
+	}
+
+	time_t newest = 0;
+	pthread_mutex_lock(&self->mutex);
+	for (size_t slot = 0; slot < ring->size; slot++) {
+		if (ring->starts[slot] > newest) {
+			newest = ring->starts[slot];
+		}
+	}
+	pthread_mutex_unlock(&self->mutex);
+
+	return newest;
+}
+
+void event_series_take_dirty(event_series *self, event_series_count **counts,
+			     size_t *count)
+{
+	size_t used = 0;
+	size_t allocated = 16;
+	event_series_count *taken = malloc(allocated * sizeof(*taken));
+	assert(taken);
+
+	pthread_mutex_lock(&self->mutex);
+	for (int i = 0; i < SERIES_RINGS; i++) {
+		series_ring *ring = &self->rings[i];
+		for (size_t slot = 0; slot < ring->size; slot++) {
+			if (!ring->dirty[slot]) {
+				continue;
+			}
+			ring->dirty[slot] = false;
+
+			const uint32_t *bucket =
+				&ring->counts[slot * EVENT_SERIES_KEYS];
+			for (size_t key = 0; key < self->key_count; key++) {
+				if (bucket[key] == 0) {
+					continue;
+				}
+				if (used == allocated) {
+					allocated *= 2;
+					taken = realloc(taken,
+							allocated *
+								sizeof(*taken));
+					assert(taken);
+				}
+				taken[used++] = (event_series_count){
+					.resolution = ring->resolution,
+					.bucket = ring->starts[slot],
+					.key = &self->keys[key],
+					.count = bucket[key],
+				};
+			}
+		}
+	}
+	pthread_mutex_unlock(&self->mutex);
+
+	*counts = taken;
+	*count = used;
+}
+
+void event_series_mark_dirty(event_series *self,
+			     const event_series_count *counts, size_t count)
+{
+	pthread_mutex_lock(&self->mutex);
+	for (size_t i = 0; i < count; i++) {
+		series_ring *ring = ring_for(self, counts[i].resolution);
+		size_t slot = ring_slot(ring, counts[i].bucket);
+		if (ring->starts[slot] == counts[i].bucket) {
+			ring->dirty[slot] = true;
+		}
+	}
+	pthread_mutex_unlock(&self->mutex);
+}
+
+event_series_range *event_series_query(event_series *self, time_t from,
+				       time_t to, time_t step)
+{
+	if (from < 0 || to <= from || step <= 0 ||
+	    step % EVENT_SERIES_MINUTE != 0) {
+		return NULL;
+	}
+
+	time_t first = from - from % step;
+	if ((to - first + step - 1) / step > EVENT_SERIES_POINTS_MAX) {
+		return NULL;
+	}
+
+	series_ring *ring =
+		&self->rings[step % EVENT_SERIES_HOUR == 0 ? SERIES_RING_HOURS :
+							     SERIES_RING_MINUTES];
+
+	event_series_range *range = calloc(1, sizeof(event_series_range));
+	assert(range);
+	range->resolution = ring->resolution;
+	range->point_count = (size_t)((to - first + step - 1) / step);
+	range->points = calloc(range->point_count, sizeof(event_series_point));
+	assert(range->points);
+
+	pthread_mutex_lock(&self->mutex);
+	memcpy(range->keys, self->keys, sizeof(range->keys));
+	range->key_count = self->key_count;
+
+	for (size_t i = 0; i < range->point_count; i++) {
+		range->points[i].time = first + (time_t)i * step;
+	}
+	// Walk the slots rather than the time between from and to, so a
+	// query costs at most one pass over the ring however wide it is
+	time_t end = first + (time_t)range->point_count * step;
+	for (size_t slot = 0; slot < ring->size; slot++) {
+		time_t start = ring->starts[slot];
+		if (start == 0 || start < first || start >= end) {
+			continue;
+		}
+		event_series_point *point =
+			&range->points[(start - first) / step];
+		const uint32_t *counts = &ring->counts[slot * EVENT_SERIES_KEYS];
+		for (size_t key = 0; key < range->key_count; key++) {
+			point->counts[key] += counts[key];
+		}
+	}
+	pthread_mutex_unlock(&self->mutex);
+
+	return range;
+}
@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#ifndef SENTRYPEER_EVENT_SERIES_H
+#define SENTRYPEER_EVENT_SERIES_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Bucket sizes in seconds, and how many of each we keep
+#define EVENT_SERIES_MINUTE 60
+#define EVENT_SERIES_HOUR 3600
+#define EVENT_SERIES_MINUTES (2 * 24 * 60) // Two days
+#define EVENT_SERIES_HOURS (366 * 24) // A year
+// Distinct method, transport_type and collected_method combinations. Once
+// they're all taken, anything new is counted under the last one, "other".
+#define EVENT_SERIES_KEYS 64
+#define EVENT_SERIES_KEY_LEN 32
+#define EVENT_SERIES_OTHER "other"
+// How far ahead of now an event can be, for clock skew. Anything further
+// would take the slot of a bucket that's still to come.
+#define EVENT_SERIES_SKEW (5 * 60)
+// Most points a single query returns
+#define EVENT_SERIES_POINTS_MAX EVENT_SERIES_MINUTES
+
+// Events per minute and per hour, broken down by method, transport_type
+// and collected_method. Each resolution is a ring of buckets indexed by
+// bucket start time, so counting is an array increment and old buckets are
+// reused as time moves on.
+typedef struct event_series event_series;
+
+typedef struct event_series_key event_series_key;
+struct event_series_key {
+	char method[EVENT_SERIES_KEY_LEN];
+	char transport_type[EVENT_SERIES_KEY_LEN];
+	char collected_method[EVENT_SERIES_KEY_LEN];
+};
+
+// A bucket's count for one key, for saving. key points into the series,
+// which never moves or forgets a key.
+typedef struct event_series_count event_series_count;
+struct event_series_count {
+	int resolution;
+	time_t bucket;
+	const event_series_key *key;
+	uint64_t count;
+};
+
+typedef struct event_series_point event_series_point;
+struct event_series_point {
+	time_t time;
+	uint64_t counts[EVENT_SERIES_KEYS]; // By key
+};
+
+typedef struct event_series_range event_series_range;
+struct event_series_range {
+	int resolution;
+	event_series_key keys[EVENT_SERIES_KEYS];
+	size_t key_count;
+	event_series_point *points;
+	size_t point_count;
+};
+
+//  Constructor
+event_series *event_series_new(void);
+
+//  Destructors
+void event_series_destroy(event_series **self_ptr);
+void event_series_range_destroy(event_series_range **range_ptr);
+
+/**
+ * Count events into the minute and hour buckets that hold when. Events
+ * older than what a ring holds going back from now are only counted by
+ * the other one, and ones more than EVENT_SERIES_SKEW ahead of now aren't
+ * counted at all.
+ *
+ * @param self The series.
+ * @param when The event time.
+ * @param method The SIP method, e.g. OPTIONS.
+ * @param transport_type UDP, TCP or TLS.
+ * @param collected_method passive or responsive.
+ * @param count How many events.
+ */
+void event_series_add(event_series *self, time_t when, const char *method,
+		      const char *transport_type,
+		      const char *collected_method, uint64_t count);
+
+/**
+ * Set a bucket's count for a key, as saved earlier. Unlike
+ * event_series_add() the bucket isn't marked as needing saving. Buckets
+ * the ring doesn't hold going back from now are ignored.
+ *
+ * @param self The series.
+ * @param resolution EVENT_SERIES_MINUTE or EVENT_SERIES_HOUR.
+ * @param bucket The bucket start time.
+ * @param method, transport_type, collected_method The key.
+ * @param count The count.
+ */
+void event_series_set(event_series *self, int resolution, time_t bucket,
+		      const char *method, const char *transport_type,
+		      const char *collected_method, uint64_t count);
+
+/**
+ * Forget the buckets that start at or after since, so they can be counted
+ * again from the honey table.
+ *
+ * @param self The series.
+ * @param since A bucket start time, on an hour boundary.
+ */
+void event_series_clear_since(event_series *self, time_t since);
+
+/**
+ * @param self The series.
+ * @param resolution EVENT_SERIES_MINUTE or EVENT_SERIES_HOUR.
+ * @return The start of the newest bucket with a count, or 0 if none.
+ */
+time_t event_series_newest(event_series *self, int resolution);
+
+/**
+ * Take the non-zero counts of every bucket changed since the last call.
+ *
+ * @param self The series.
+ * @param counts Set to an array, free with free().
+ * @param count Set to the number in counts.
+ */
+void event_series_take_dirty(event_series *self, event_series_count **counts,
+			     size_t *count);
+
+/**
+ * Mark the buckets in counts as changed again, e.g. when saving them
+ * failed. Buckets since reused for a later time are left alone.
+ *
+ * @param self The series.
+ * @param counts From event_series_take_dirty().
+ * @param count The number in counts.
+ */
+void event_series_mark_dirty(event_series *self,
+			     const event_series_count *counts, size_t count);
+
+/**
+ * Sum buckets into points step seconds apart, covering from to to. Minute
+ * buckets are used unless step is a whole number of hours. Points start on
+ * multiples of step and buckets nobody counted into are zero. Costs one
+ * pass over the ring's buckets, whatever from and to are.
+ *
+ * @param self The series.
+ * @param from Start time.
+ * @param to End time, after from.
+ * @param step Seconds per point, a multiple of EVENT_SERIES_MINUTE.
+ * @return The points, or NULL if the arguments aren't valid or there'd be
+ *         more than EVENT_SERIES_POINTS_MAX of them. Free with
+ *         event_series_range_destroy().
+ */
+event_series_range *event_series_query(event_series *self, time_t from,
+				       time_t to, time_t step);
+
+#endif //SENTRYPEER_EVENT_SERIES_H
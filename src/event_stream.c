@@ -0,0 +1,238 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "event_stream.h"
+#include "utils.h"
+
+// Shared by the ring and whoever is copying it out, so that nobody does
+// more than take or drop a reference while holding the lock
+typedef struct stream_event stream_event;
+struct stream_event {
+	atomic_uint references;
+	char json[];
+};
+
+static stream_event *stream_event_new(const char *json)
+{
+	size_t json_len = strlen(json) + 1;
+	stream_event *self = malloc(sizeof(stream_event) + json_len);
+	assert(self);
+	atomic_init(&self->references, 1);
+	memcpy(self->json, json, json_len);
+
+	return self;
+}
+
+static void stream_event_release(stream_event *self)
+{
+	if (self != 0 && atomic_fetch_sub(&self->references, 1) == 1) {
+		free(self);
+	}
+}
+
+// The event at position p is in events[p % capacity] while
+// head - capacity <= p < head
+struct event_stream {
+	stream_event **events;
+	size_t capacity;
+	uint64_t head;
+	atomic_uint subscribers;
+	bool closed;
+	pthread_mutex_t mutex;
+	pthread_cond_t published;
+};
+
+event_stream *event_stream_new(size_t capacity)
+{
+	assert(capacity > 0);
+
+	event_stream *self = calloc(1, sizeof(event_stream));
+	assert(self);
+
+	self->events = calloc(capacity, sizeof(*self->events));
+	assert(self->events);
+	self->capacity = capacity;
+	atomic_init(&self->subscribers, 0);
+
+	if (pthread_mutex_init(&self->mutex, NULL) != 0 ||
+	    pthread_cond_init(&self->published, NULL) != 0) {
+		fprintf(stderr, "Failed to initialise event stream locks\n");
+		free(self->events);
+		free(self);
+		return 0;
+	}
+
+	return self;
+}
+
+void event_stream_destroy(event_stream **self_ptr)
+{
+	assert(self_ptr);
+	if (*self_ptr) {
+		event_stream *self = *self_ptr;
+		for (size_t i = 0; i < self->capacity; i++) {
+			stream_event_release(self->events[i]);
+		}
+		free(self->events);
+		pthread_cond_destroy(&self->published);
+		pthread_mutex_destroy(&self->mutex);
+		free(self);
+		*self_ptr = 0;
+	}
+}
+
+void event_stream_publish(event_stream *self, const char *json)
+{
+	assert(self);
+	assert(json);
+
+	// Copied and released outside the lock, so capture only ever waits
+	// for a pointer swap
+	stream_event *event = stream_event_new(json);
+
+	pthread_mutex_lock(&self->mutex);
+	stream_event **slot = &self->events[self->head % self->capacity];
+	stream_event *oldest = *slot;
+	*slot = event;
+	self->head++;
+	pthread_cond_broadcast(&self->published);
+	pthread_mutex_unlock(&self->mutex);
+
+	stream_event_release(oldest);
+}
+
+bool event_stream_has_subscribers(event_stream *self)
+{
+	assert(self);
+
+	return atomic_load_explicit(&self->subscribers, memory_order_relaxed) >
+	       0;
+}
+
+int event_stream_subscribe(event_stream *self, uint64_t *next)
+{
+	assert(self);
+
+	pthread_mutex_lock(&self->mutex);
+	if (self->closed ||
+	    atomic_load(&self->subscribers) >= EVENT_STREAM_MAX_SUBSCRIBERS) {
+		pthread_mutex_unlock(&self->mutex);
+		return EXIT_FAILURE;
+	}
+	atomic_fetch_add(&self->subscribers, 1);
+	*next = self->head;
+	pthread_mutex_unlock(&self->mutex);
+
+	return EXIT_SUCCESS;
+}
+
+void event_stream_unsubscribe(event_stream *self)
+{
+	assert(self);
+	assert(atomic_load(&self->subscribers) > 0);
+
+	atomic_fetch_sub(&self->subscribers, 1);
+}
+
+int event_stream_next(event_stream *self, uint64_t *next, char **json,
+		      uint64_t *dropped, int timeout_seconds)
+{
+	assert(self);
+
+	struct timespec wake_up;
+	clock_gettime(CLOCK_REALTIME, &wake_up);
+	wake_up.tv_sec += timeout_seconds;
+
+	pthread_mutex_lock(&self->mutex);
+	int rc = 0;
+	while (timeout_seconds > 0 && !self->closed && *next >= self->head &&
+	       rc != ETIMEDOUT) {
+		rc = pthread_cond_timedwait(&self->published, &self->mutex,
+					    &wake_up);
+	}
+
+	int status = EVENT_STREAM_EVENT;
+	stream_event *event = 0;
+	uint64_t oldest =
+		self->head > self->capacity ? self->head - self->capacity : 0;
+	if (self->closed) {
+		status = EVENT_STREAM_CLOSED;
+	} else if (*next >= self->head) {
+		status = EVENT_STREAM_TIMEOUT;
+	} else if (*next < oldest) {
+		*dropped = oldest - *next;
+		*next = oldest;
+		status = EVENT_STREAM_LAGGED;
+	} else {
+		event = self->events[*next % self->capacity];
+		atomic_fetch_add(&event->references, 1);
+		(*next)++;
+	}
+	pthread_mutex_unlock(&self->mutex);
+
+	if (event != 0) {
+		*json = util_duplicate_string(event->json);
+		stream_event_release(event);
+	}
+
+	return status;
+}
+
+int event_stream_wait(event_stream *self, uint64_t *head,
+		      int timeout_seconds)
+{
+	assert(self);
+
+	struct timespec wake_up;
+	clock_gettime(CLOCK_REALTIME, &wake_up);
+	wake_up.tv_sec += timeout_seconds;
+
+	pthread_mutex_lock(&self->mutex);
+	int rc = 0;
+	while (timeout_seconds > 0 && !self->closed && *head >= self->head &&
+	       rc != ETIMEDOUT) {
+		rc = pthread_cond_timedwait(&self->published, &self->mutex,
+					    &wake_up);
+	}
+
+	int status = EVENT_STREAM_EVENT;
+	if (self->closed) {
+		status = EVENT_STREAM_CLOSED;
+	} else if (*head >= self->head) {
+		status = EVENT_STREAM_TIMEOUT;
+	}
+	*head = self->head;
+	pthread_mutex_unlock(&self->mutex);
+
+	return status;
+}
+
+void event_stream_close(event_stream *self)
+{
+	assert(self);
+
+	pthread_mutex_lock(&self->mutex);
+	self->closed = true;
+	pthread_cond_broadcast(&self->published);
+	pthread_mutex_unlock(&self->mutex);
+}
@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#ifndef SENTRYPEER_EVENT_STREAM_H
+#define SENTRYPEER_EVENT_STREAM_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// How many of the newest events are kept for subscribers to catch up on
+#define EVENT_STREAM_CAPACITY 4096
+#define EVENT_STREAM_MAX_SUBSCRIBERS 4096
+
+// event_stream_next()
+#define EVENT_STREAM_EVENT 0
+#define EVENT_STREAM_TIMEOUT 1
+#define EVENT_STREAM_LAGGED 2
+#define EVENT_STREAM_CLOSED 3
+
+// A ring of the newest events as json that any number of subscribers read
+// from, each at its own position. Publishing never waits for a
+// subscriber: one that falls more than the capacity behind finds the
+// events it missed are gone, and gets told how many.
+typedef struct event_stream event_stream;
+
+//  Constructor
+event_stream *event_stream_new(size_t capacity);
+
+//  Destructor
+void event_stream_destroy(event_stream **self_ptr);
+
+/**
+ * Add an event, overwriting the oldest once full, and wake subscribers.
+ *
+ * @param self The stream.
+ * @param json The event, copied.
+ */
+void event_stream_publish(event_stream *self, const char *json);
+
+// So publishers can skip making the json when nobody is listening
+bool event_stream_has_subscribers(event_stream *self);
+
+/**
+ * Start reading.
+ *
+ * @param self The stream.
+ * @param next Set to the position of the next event to be published.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE at EVENT_STREAM_MAX_SUBSCRIBERS
+ *         or once closed.
+ */
+int event_stream_subscribe(event_stream *self, uint64_t *next);
+void event_stream_unsubscribe(event_stream *self);
+
+/**
+ * Wait for the event at a position.
+ *
+ * @param self The stream.
+ * @param next The position, which is also the event's id. Moved on past
+ *             the event, or to the oldest one still kept if lagged.
+ * @param json Set to a copy of the event, free() it.
+ * @param dropped Set to how many events were missed if lagged.
+ * @param timeout_seconds How long to wait for one, 0 to not wait.
+ * @return EVENT_STREAM_EVENT, EVENT_STREAM_TIMEOUT, EVENT_STREAM_LAGGED
+ *         or EVENT_STREAM_CLOSED.
+ */
+int event_stream_next(event_stream *self, uint64_t *next, char **json,
+		      uint64_t *dropped, int timeout_seconds);
+
+/**
+ * Wait for events to be published, without reading any.
+ *
+ * @param self The stream.
+ * @param head Return as soon as the stream is past this position. Set to
+ *             the position of the next event to be published.
+ * @param timeout_seconds How long to wait.
+ * @return EVENT_STREAM_EVENT, EVENT_STREAM_TIMEOUT or EVENT_STREAM_CLOSED.
+ */
+int event_stream_wait(event_stream *self, uint64_t *head,
+		      int timeout_seconds);
+
+// Wake everyone waiting with EVENT_STREAM_CLOSED, e.g. before stopping
+// the http daemon, which waits for them
+void event_stream_close(event_stream *self);
+
+#endif //SENTRYPEER_EVENT_STREAM_H
@@ -0,0 +1,674 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "geoip.h"
+#include "utils.h"
+
+// The metadata map follows the last copy of this marker, which is in the
+// last 128KiB of the file
+#define MMDB_METADATA_MARKER "\xAB\xCD\xEFMaxMind.com"
+#define MMDB_METADATA_MARKER_LEN 14
+#define MMDB_METADATA_MAX_SIZE (128 * 1024)
+#define MMDB_DATA_SEPARATOR_LEN 16
+#define MMDB_MAX_DEPTH 32
+
+enum mmdb_type {
+	MMDB_EXTENDED = 0,
+	MMDB_POINTER = 1,
+	MMDB_STRING = 2,
+	MMDB_DOUBLE = 3,
+	MMDB_BYTES = 4,
+	MMDB_UINT16 = 5,
+	MMDB_UINT32 = 6,
+	MMDB_MAP = 7,
+	MMDB_INT32 = 8,
+	MMDB_UINT64 = 9,
+	MMDB_UINT128 = 10,
+	MMDB_ARRAY = 11,
+	MMDB_BOOLEAN = 14,
+	MMDB_FLOAT = 15,
+};
+
+// A section of the file we decode values from, either data or metadata
+typedef struct mmdb_section mmdb_section;
+struct mmdb_section {
+	const uint8_t *start;
+	size_t len;
+};
+
+typedef struct mmdb_field mmdb_field;
+struct mmdb_field {
+	int type;
+	uint32_t size;
+	size_t payload; // Offset of the value's bytes or first child
+	size_t next; // Offset of whatever follows this field
+};
+
+typedef struct mmdb mmdb;
+struct mmdb {
+	uint8_t *map;
+	size_t map_len;
+	mmdb_section data;
+	mmdb_section metadata;
+	uint32_t node_count;
+	uint32_t record_size;
+	uint32_t ip_version;
+	uint32_t ipv4_start_node;
+};
+
+#define NO_ENTRY ((uint32_t)-1)
+
+typedef struct geoip_cache_entry geoip_cache_entry;
+struct geoip_cache_entry {
+	char ip_address[INET6_ADDRSTRLEN];
+	uint64_t hash;
+	geoip_result result;
+	bool found;
+	uint32_t prev; // LRU list, head is most recently used
+	uint32_t next;
+	uint32_t chain; // Hash chain
+};
+
+typedef struct geoip_cache_shard geoip_cache_shard;
+struct geoip_cache_shard {
+	pthread_mutex_t mutex;
+	geoip_cache_entry entries[GEOIP_CACHE_SHARD_CAPACITY];
+	uint32_t buckets[GEOIP_CACHE_SHARD_CAPACITY * 2];
+	uint32_t head;
+	uint32_t tail;
+	uint32_t used;
+};
+
+struct geoip {
+	mmdb city;
+	mmdb asn;
+	geoip_cache_shard shards[GEOIP_CACHE_SHARDS];
+};
+
+static int decode_field(const mmdb_section *section, size_t offset,
+			mmdb_field *field, bool follow_pointer)
+{
+	if (offset >= section->len) {
+		return EXIT_FAILURE;
+	}
+	const uint8_t *bytes = section->start;
+	uint8_t control = bytes[offset++];
+	int type = control >> 5;
+
+	if (type == MMDB_POINTER) {
+		int pointer_size = ((control >> 3) & 0x3) + 1;
+		if (!follow_pointer || offset + pointer_size > section->len) {
+			return EXIT_FAILURE;
+		}
+		uint32_t pointer = pointer_size == 4 ? 0 : control & 0x7;
+		for (int i = 0; i < pointer_size; i++) {
+			pointer = (pointer << 8) | bytes[offset + i];
+		}
+		if (pointer_size == 2) {
+			pointer += 2048;
+		} else if (pointer_size == 3) {
+			pointer += 526336;
+		}
+
+		// A pointer never points at another pointer, and skipping it
+		// only skips the pointer itself
+		if (decode_field(section, pointer, field, false) !=
+		    EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+		field->next = offset + pointer_size;
+		return EXIT_SUCCESS;
+	}
+
+	if (type == MMDB_EXTENDED) {
+		if (offset >= section->len) {
+			return EXIT_FAILURE;
+		}
+		type = 7 + bytes[offset++];
+	}
+
+	uint32_t size = control & 0x1f;
+	if (size >= 29) {
+		int size_bytes = size - 28;
+		if (offset + size_bytes > section->len) {
+			return EXIT_FAILURE;
+		}
+		uint32_t extra = 0;
+		for (int i = 0; i < size_bytes; i++) {
+			extra = (extra << 8) | bytes[offset + i];
+		}
+		offset += size_bytes;
+		size = size_bytes == 1 ? 29 + extra :
+		       size_bytes == 2 ? 285 + extra :
+					 65821 + extra;
+	}
+
+	field->type = type;
+	field->size = size;
+	field->payload = offset;
+	field->next = offset;
+
+	switch (type) {
+	case MMDB_MAP:
+	case MMDB_ARRAY:
+		// Only known once the children have been skipped
+		break;
+	case MMDB_BOOLEAN:
+		// The size is the value
+		break;
+	case MMDB_STRING:
+	case MMDB_DOUBLE:
+	case MMDB_BYTES:
+	case MMDB_UINT16:
+	case MMDB_UINT32:
+	case MMDB_INT32:
+	case MMDB_UINT64:
+	case MMDB_UINT128:
+	case MMDB_FLOAT:
+		if (size > section->len - offset) {
+			return EXIT_FAILURE;
+		}
+		field->next = offset + size;
+		break;
+	default:
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Where the field at offset ends, walking into maps and arrays
+static int skip_field(const mmdb_section *section, size_t offset,
+		      size_t *next, int depth)
+{
+	mmdb_field field;
+	if (depth > MMDB_MAX_DEPTH ||
+	    decode_field(section, offset, &field, true) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	if (section->start[offset] >> 5 == MMDB_POINTER ||
+	    (field.type != MMDB_MAP && field.type != MMDB_ARRAY)) {
+		*next = field.next;
+		return EXIT_SUCCESS;
+	}
+
+	uint64_t children = field.type == MMDB_MAP ? (uint64_t)field.size * 2 :
+						     field.size;
+	size_t cursor = field.payload;
+	for (uint64_t i = 0; i < children; i++) {
+		if (skip_field(section, cursor, &cursor, depth + 1) !=
+		    EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	}
+	*next = cursor;
+
+	return EXIT_SUCCESS;
+}
+
+// Offset of the value for key in the map at offset
+static int map_find(const mmdb_section *section, size_t offset,
+		    const char *key, size_t *value_offset)
+{
+	mmdb_field map;
+	if (decode_field(section, offset, &map, true) != EXIT_SUCCESS ||
+	    map.type != MMDB_MAP) {
+		return EXIT_FAILURE;
+	}
+
+	size_t key_len = strlen(key);
+	size_t cursor = map.payload;
+	for (uint32_t i = 0; i < map.size; i++) {
+		mmdb_field map_key;
+		if (decode_field(section, cursor, &map_key, true) !=
+			    EXIT_SUCCESS ||
+		    map_key.type != MMDB_STRING) {
+			return EXIT_FAILURE;
+		}
+		if (map_key.size == key_len &&
+		    memcmp(section->start + map_key.payload, key, key_len) ==
+			    0) {
+			*value_offset = map_key.next;
+			return EXIT_SUCCESS;
+		}
+		if (skip_field(section, map_key.next, &cursor, 0) !=
+		    EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_FAILURE;
+}
+
+// Follow a NULL terminated list of map keys, e.g. "city", "names", "en"
+static int path_find(const mmdb_section *section, size_t offset,
+		     const char *const *path, size_t *value_offset)
+{
+	for (; *path != 0; path++) {
+		if (map_find(section, offset, *path, &offset) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	}
+	*value_offset = offset;
+
+	return EXIT_SUCCESS;
+}
+
+static int read_string(const mmdb_section *section, size_t offset,
+		       const char *const *path, char *out, size_t out_len)
+{
+	mmdb_field field;
+	if (path_find(section, offset, path, &offset) != EXIT_SUCCESS ||
+	    decode_field(section, offset, &field, true) != EXIT_SUCCESS ||
+	    field.type != MMDB_STRING) {
+		return EXIT_FAILURE;
+	}
+
+	size_t len = field.size < out_len - 1 ? field.size : out_len - 1;
+	memcpy(out, section->start + field.payload, len);
+	out[len] = '\0';
+
+	return EXIT_SUCCESS;
+}
+
+static int read_uint(const mmdb_section *section, size_t offset,
+		     const char *const *path, uint64_t *value)
+{
+	mmdb_field field;
+	if (path_find(section, offset, path, &offset) != EXIT_SUCCESS ||
+	    decode_field(section, offset, &field, true) != EXIT_SUCCESS ||
+	    (field.type != MMDB_UINT16 && field.type != MMDB_UINT32 &&
+	     field.type != MMDB_UINT64) ||
+	    field.size > sizeof(uint64_t)) {
+		return EXIT_FAILURE;
+	}
+
+	*value = 0;
+	for (uint32_t i = 0; i < field.size; i++) {
+		*value = (*value << 8) | section->start[field.payload + i];
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static uint32_t read_record(const mmdb *db, uint32_t node, int bit)
+{
+	const uint8_t *p = db->map + (size_t)node * db->record_size / 4;
+
+	switch (db->record_size) {
+	case 24:
+		p += bit ? 3 : 0;
+		return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+	case 28:
+		if (bit) {
+			return ((uint32_t)(p[3] & 0x0f) << 24) |
+			       ((uint32_t)p[4] << 16) | ((uint32_t)p[5] << 8) |
+			       p[6];
+		}
+		return ((uint32_t)(p[3] & 0xf0) << 20) | ((uint32_t)p[0] << 16) |
+		       ((uint32_t)p[1] << 8) | p[2];
+	default:
+		p += bit ? 4 : 0;
+		return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		       ((uint32_t)p[2] << 8) | p[3];
+	}
+}
+
+static void mmdb_close(mmdb *db)
+{
+	if (db->map) {
+		munmap(db->map, db->map_len);
+	}
+	memset(db, 0, sizeof(mmdb));
+}
+
+static int mmdb_open(mmdb *db, const char *db_file)
+{
+	memset(db, 0, sizeof(mmdb));
+
+	int fd = open(db_file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror("open");
+		return EXIT_FAILURE;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= MMDB_METADATA_MARKER_LEN) {
+		fprintf(stderr, "GeoIP database is too small: %s\n", db_file);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd,
+			 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+	db->map = map;
+	db->map_len = (size_t)st.st_size;
+
+	// Search backwards in case the marker appears in the data too
+	size_t search_from = db->map_len > MMDB_METADATA_MAX_SIZE ?
+				     db->map_len - MMDB_METADATA_MAX_SIZE :
+				     0;
+	size_t marker = db->map_len - MMDB_METADATA_MARKER_LEN + 1;
+	do {
+		marker--;
+	} while (marker > search_from &&
+		 memcmp(db->map + marker, MMDB_METADATA_MARKER,
+			MMDB_METADATA_MARKER_LEN) != 0);
+	if (memcmp(db->map + marker, MMDB_METADATA_MARKER,
+		   MMDB_METADATA_MARKER_LEN) != 0) {
+		fprintf(stderr, "Not a MaxMind DB file: %s\n", db_file);
+		mmdb_close(db);
+		return EXIT_FAILURE;
+	}
+	db->metadata.start = db->map + marker + MMDB_METADATA_MARKER_LEN;
+	db->metadata.len = db->map_len - marker - MMDB_METADATA_MARKER_LEN;
+
+	uint64_t node_count = 0;
+	uint64_t record_size = 0;
+	uint64_t ip_version = 0;
+	if (read_uint(&db->metadata, 0, (const char *const[]){ "node_count", 0 },
+		      &node_count) != EXIT_SUCCESS ||
+	    read_uint(&db->metadata, 0,
+		      (const char *const[]){ "record_size", 0 },
+		      &record_size) != EXIT_SUCCESS ||
+	    read_uint(&db->metadata, 0,
+		      (const char *const[]){ "ip_version", 0 },
+		      &ip_version) != EXIT_SUCCESS ||
+	    (record_size != 24 && record_size != 28 && record_size != 32) ||
+	    (ip_version != 4 && ip_version != 6) || node_count == 0 ||
+	    node_count >= UINT32_MAX) {
+		fprintf(stderr, "Unsupported MaxMind DB metadata: %s\n",
+			db_file);
+		mmdb_close(db);
+		return EXIT_FAILURE;
+	}
+
+	size_t tree_size = node_count * record_size / 4;
+	if (tree_size + MMDB_DATA_SEPARATOR_LEN > marker) {
+		fprintf(stderr, "Truncated MaxMind DB file: %s\n", db_file);
+		mmdb_close(db);
+		return EXIT_FAILURE;
+	}
+	db->data.start = db->map + tree_size + MMDB_DATA_SEPARATOR_LEN;
+	db->data.len = marker - tree_size - MMDB_DATA_SEPARATOR_LEN;
+	db->node_count = (uint32_t)node_count;
+	db->record_size = (uint32_t)record_size;
+	db->ip_version = (uint32_t)ip_version;
+
+	// IPv4 addresses live under ::/96 in an IPv6 tree
+	uint32_t node = 0;
+	if (db->ip_version == 6) {
+		for (int i = 0; i < 96 && node < db->node_count; i++) {
+			node = read_record(db, node, 0);
+		}
+	}
+	db->ipv4_start_node = node;
+
+	return EXIT_SUCCESS;
+}
+
+// Offset in the data section of the record for an address
+static int mmdb_find(const mmdb *db, const uint8_t *address, int bits,
+		     size_t *data_offset)
+{
+	if (db->map == 0 || (bits == 128 && db->ip_version == 4)) {
+		return EXIT_FAILURE;
+	}
+
+	uint32_t node = bits == 32 ? db->ipv4_start_node : 0;
+	for (int i = 0; i < bits && node < db->node_count; i++) {
+		node = read_record(db, node, (address[i / 8] >> (7 - i % 8)) & 1);
+	}
+
+	// node_count itself means no data for this address
+	if (node <= db->node_count) {
+		return EXIT_FAILURE;
+	}
+	size_t offset = (size_t)node - db->node_count - MMDB_DATA_SEPARATOR_LEN;
+	if (offset >= db->data.len) {
+		return EXIT_FAILURE;
+	}
+	*data_offset = offset;
+
+	return EXIT_SUCCESS;
+}
+
+static bool lookup_uncached(const geoip *self, const char *ip_address,
+			    geoip_result *result)
+{
+	uint8_t address[16];
+	int bits = 128;
+	if (inet_pton(AF_INET, ip_address, address) == 1) {
+		bits = 32;
+	} else if (inet_pton(AF_INET6, ip_address, address) != 1) {
+		return false;
+	}
+
+	bool found = false;
+	size_t offset = 0;
+	if (mmdb_find(&self->city, address, bits, &offset) == EXIT_SUCCESS) {
+		if (read_string(&self->city.data, offset,
+				(const char *const[]){ "country", "iso_code",
+						       0 },
+				result->country_code,
+				sizeof(result->country_code)) != EXIT_SUCCESS) {
+			read_string(&self->city.data, offset,
+				    (const char *const[]){ "registered_country",
+							   "iso_code", 0 },
+				    result->country_code,
+				    sizeof(result->country_code));
+		}
+		read_string(&self->city.data, offset,
+			    (const char *const[]){ "city", "names", "en", 0 },
+			    result->city, sizeof(result->city));
+		found = true;
+	}
+
+	if (mmdb_find(&self->asn, address, bits, &offset) == EXIT_SUCCESS) {
+		uint64_t asn = 0;
+		if (read_uint(&self->asn.data, offset,
+			      (const char *const[]){ "autonomous_system_number",
+						     0 },
+			      &asn) == EXIT_SUCCESS) {
+			result->asn = (uint32_t)asn;
+		}
+		read_string(&self->asn.data, offset,
+			    (const char *const[]){
+				    "autonomous_system_organization", 0 },
+			    result->as_org, sizeof(result->as_org));
+		found = true;
+	}
+
+	return found;
+}
+
+static void lru_unlink(geoip_cache_shard *shard, uint32_t i)
+{
+	geoip_cache_entry *entry = &shard->entries[i];
+	if (entry->prev != NO_ENTRY) {
+		shard->entries[entry->prev].next = entry->next;
+	} else {
+		shard->head = entry->next;
+	}
+	if (entry->next != NO_ENTRY) {
+		shard->entries[entry->next].prev = entry->prev;
+	} else {
+		shard->tail = entry->prev;
+	}
+}
+
+static void lru_push_front(geoip_cache_shard *shard, uint32_t i)
+{
+	geoip_cache_entry *entry = &shard->entries[i];
+	entry->prev = NO_ENTRY;
+	entry->next = shard->head;
+	if (shard->head != NO_ENTRY) {
+		shard->entries[shard->head].prev = i;
+	}
+	shard->head = i;
+	if (shard->tail == NO_ENTRY) {
+		shard->tail = i;
+	}
+}
+
+static uint32_t *bucket_for(geoip_cache_shard *shard, uint64_t hash)
+{
+	// The low bits picked the shard, so use the high ones here
+	return &shard->buckets[(hash >> 32) %
+			       (sizeof(shard->buckets) / sizeof(uint32_t))];
+}
+
+static uint32_t cache_find(geoip_cache_shard *shard, const char *ip_address,
+			   uint64_t hash)
+{
+	for (uint32_t i = *bucket_for(shard, hash); i != NO_ENTRY;
+	     i = shard->entries[i].chain) {
+		if (shard->entries[i].hash == hash &&
+		    strcmp(shard->entries[i].ip_address, ip_address) == 0) {
+			return i;
+		}
+	}
+
+	return NO_ENTRY;
+}
+
+static void chain_remove(geoip_cache_shard *shard, uint32_t i)
+{
+	uint32_t *link = bucket_for(shard, shard->entries[i].hash);
+	while (*link != i) {
+		link = &shard->entries[*link].chain;
+	}
+	*link = shard->entries[i].chain;
+}
+
+geoip *geoip_new(const char *city_db_file, const char *asn_db_file)
+{
+	geoip *self = calloc(1, sizeof(geoip));
+	assert(self);
+
+	if ((city_db_file != 0 &&
+	     mmdb_open(&self->city, city_db_file) != EXIT_SUCCESS) ||
+	    (asn_db_file != 0 &&
+	     mmdb_open(&self->asn, asn_db_file) != EXIT_SUCCESS)) {
+		mmdb_close(&self->city);
+		free(self);
+		return NULL;
+	}
+
+	for (int s = 0; s < GEOIP_CACHE_SHARDS; s++) {
+		geoip_cache_shard *shard = &self->shards[s];
+		if (pthread_mutex_init(&shard->mutex, NULL) != EXIT_SUCCESS) {
+			fprintf(stderr, "Failed to init geoip cache mutex\n");
+			while (s-- > 0) {
+				pthread_mutex_destroy(&self->shards[s].mutex);
+			}
+			mmdb_close(&self->city);
+			mmdb_close(&self->asn);
+			free(self);
+			return NULL;
+		}
+		memset(shard->buckets, 0xff, sizeof(shard->buckets));
+		shard->head = NO_ENTRY;
+		shard->tail = NO_ENTRY;
+	}
+
+	return self;
+}
+
+void geoip_destroy(geoip **self_ptr)
+{
+	assert(self_ptr);
+	if (*self_ptr) {
+		geoip *self = *self_ptr;
+		for (int s = 0; s < GEOIP_CACHE_SHARDS; s++) {
+			pthread_mutex_destroy(&self->shards[s].mutex);
+		}
+		mmdb_close(&self->city);
+		mmdb_close(&self->asn);
+		free(self);
+		*self_ptr = 0;
+	}
+}
+
+int geoip_lookup(geoip *self, const char *ip_address, geoip_result *result)
+{
+	memset(result, 0, sizeof(geoip_result));
+
+	size_t len = strlen(ip_address);
+	if (len >= INET6_ADDRSTRLEN) {
+		return EXIT_FAILURE;
+	}
+	uint64_t hash = util_hash64(ip_address, len);
+	geoip_cache_shard *shard = &self->shards[hash % GEOIP_CACHE_SHARDS];
+
+	pthread_mutex_lock(&shard->mutex);
+	uint32_t i = cache_find(shard, ip_address, hash);
+	if (i != NO_ENTRY) {
+		lru_unlink(shard, i);
+		lru_push_front(shard, i);
+		*result = shard->entries[i].result;
+		bool found = shard->entries[i].found;
+		pthread_mutex_unlock(&shard->mutex);
+		return found ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	pthread_mutex_unlock(&shard->mutex);
+
+	// Misses are cached too, as a scanner we can't place is still a
+	// scanner that comes back. The mmdb files are read only, so no lock.
+	bool found = lookup_uncached(self, ip_address, result);
+
+	pthread_mutex_lock(&shard->mutex);
+	if (cache_find(shard, ip_address, hash) != NO_ENTRY) {
+		// Another thread got there first
+		pthread_mutex_unlock(&shard->mutex);
+		return found ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (shard->used < GEOIP_CACHE_SHARD_CAPACITY) {
+		i = shard->used++;
+	} else {
+		i = shard->tail;
+		lru_unlink(shard, i);
+		chain_remove(shard, i);
+	}
+	geoip_cache_entry *entry = &shard->entries[i];
+	memcpy(entry->ip_address, ip_address, len + 1);
+	entry->hash = hash;
+	entry->result = *result;
+	entry->found = found;
+	uint32_t *bucket = bucket_for(shard, hash);
+	entry->chain = *bucket;
+	*bucket = i;
+	lru_push_front(shard, i);
+	pthread_mutex_unlock(&shard->mutex);
+
+	return found ? EXIT_SUCCESS : EXIT_FAILURE;
+}
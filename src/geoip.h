@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#ifndef SENTRYPEER_GEOIP_H
+#define SENTRYPEER_GEOIP_H 1
+
+#include <stdint.h>
+
+#define GEOIP_COUNTRY_CODE_LEN 3
+#define GEOIP_NAME_LEN 128
+// Lookups are cached per source IP. Each shard has its own lock and LRU
+// list, so SIP and API threads rarely wait on each other.
+#define GEOIP_CACHE_SHARDS 16
+#define GEOIP_CACHE_SHARD_CAPACITY 1024
+
+// Country, city and ASN for a source IP, from local MaxMind DB (.mmdb)
+// files such as GeoLite2-City.mmdb and GeoLite2-ASN.mmdb, mmap()ed and read
+// in place. See https://maxmind.github.io/MaxMind-DB/
+typedef struct geoip geoip;
+
+typedef struct geoip_result geoip_result;
+struct geoip_result {
+	char country_code[GEOIP_COUNTRY_CODE_LEN]; // ISO 3166-1, e.g. "GB"
+	char city[GEOIP_NAME_LEN]; // English name
+	uint32_t asn;
+	char as_org[GEOIP_NAME_LEN];
+};
+
+/**
+ * Open the databases, either can be NULL.
+ *
+ * @param city_db_file A City or Country database.
+ * @param asn_db_file An ASN database.
+ * @return A new geoip, or NULL if a file given can't be opened.
+ */
+geoip *geoip_new(const char *city_db_file, const char *asn_db_file);
+
+//  Destructor
+void geoip_destroy(geoip **self_ptr);
+
+/**
+ * Look up an address, from the cache if we've seen it recently.
+ *
+ * @param self The geoip databases.
+ * @param ip_address IPv4 or IPv6 address.
+ * @param result Filled with whatever the databases know, empty strings
+ *               and an asn of 0 otherwise.
+ * @return EXIT_SUCCESS if anything was found, otherwise EXIT_FAILURE.
+ */
+int geoip_lookup(geoip *self, const char *ip_address, geoip_result *result);
+
+#endif //SENTRYPEER_GEOIP_H
@@ -0,0 +1,329 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "heavy_hitters.h"
+#include "utils.h"
+
+#define NO_ENTRY ((size_t)-1)
+
+typedef struct hh_entry hh_entry;
+struct hh_entry {
+	heavy_hitter value;
+	uint64_t hash;
+	size_t heap_pos;
+	size_t next; // Hash chain
+};
+
+// entries[] never moves, heap[] is a min-heap of entry indexes on count
+// so the one to evict is always heap[0], and buckets[] chains entries
+// with the same hash & bucket_mask
+struct heavy_hitters {
+	hh_entry *entries;
+	size_t *heap;
+	size_t *buckets;
+	size_t bucket_mask;
+	size_t used;
+	size_t capacity;
+	uint64_t events_total;
+	pthread_mutex_t mutex;
+};
+
+heavy_hitters *heavy_hitters_new(size_t capacity)
+{
+	assert(capacity > 0);
+
+	heavy_hitters *self = calloc(1, sizeof(heavy_hitters));
+	assert(self);
+
+	size_t bucket_count = 1;
+	while (bucket_count < capacity * 2) {
+		bucket_count <<= 1;
+	}
+
+	self->entries = calloc(capacity, sizeof(hh_entry));
+	self->heap = calloc(capacity, sizeof(size_t));
+	self->buckets = malloc(bucket_count * sizeof(size_t));
+	assert(self->entries && self->heap && self->buckets);
+	for (size_t i = 0; i < bucket_count; i++) {
+		self->buckets[i] = NO_ENTRY;
+	}
+	self->bucket_mask = bucket_count - 1;
+	self->capacity = capacity;
+
+	if (pthread_mutex_init(&self->mutex, NULL) != EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to init heavy_hitters mutex\n");
+		free(self->entries);
+		free(self->heap);
+		free(self->buckets);
+		free(self);
+		return NULL;
+	}
+
+	return self;
+}
+
+void heavy_hitters_destroy(heavy_hitters **self_ptr)
+{
+	assert(self_ptr);
+	if (*self_ptr) {
+		heavy_hitters *self = *self_ptr;
+		for (size_t i = 0; i < self->used; i++) {
+			free(self->entries[i].value.key);
+		}
+		free(self->entries);
+		free(self->heap);
+		free(self->buckets);
+		pthread_mutex_destroy(&self->mutex);
+		free(self);
+		*self_ptr = 0;
+	}
+}
+
+void heavy_hitter_list_destroy(heavy_hitter **list_ptr, size_t count)
+{
+	assert(list_ptr);
+	if (*list_ptr) {
+		for (size_t i = 0; i < count; i++) {
+			free((*list_ptr)[i].key);
+		}
+		free(*list_ptr);
+		*list_ptr = 0;
+	}
+}
+
+static size_t key_len(const char *key)
+{
+	size_t len = strlen(key);
+	return len < HEAVY_HITTERS_MAX_KEY_LEN ? len :
+						 HEAVY_HITTERS_MAX_KEY_LEN;
+}
+
+static size_t find_entry(const heavy_hitters *self, const char *key,
+			 size_t len, uint64_t hash)
+{
+	for (size_t i = self->buckets[hash & self->bucket_mask]; i != NO_ENTRY;
+	     i = self->entries[i].next) {
+		const hh_entry *entry = &self->entries[i];
+		if (entry->hash == hash && strlen(entry->value.key) == len &&
+		    memcmp(entry->value.key, key, len) == 0) {
+			return i;
+		}
+	}
+
+	return NO_ENTRY;
+}
+
+static void chain_remove(heavy_hitters *self, size_t entry_index)
+{
+	size_t *link =
+		&self->buckets[self->entries[entry_index].hash & self->bucket_mask];
+	while (*link != entry_index) {
+		link = &self->entries[*link].next;
+	}
+	*link = self->entries[entry_index].next;
+}
+
+static void chain_add(heavy_hitters *self, size_t entry_index)
+{
+	size_t *bucket =
+		&self->buckets[self->entries[entry_index].hash & self->bucket_mask];
+	self->entries[entry_index].next = *bucket;
+	*bucket = entry_index;
+}
+
+static uint64_t heap_count(const heavy_hitters *self, size_t pos)
+{
+	return self->entries[self->heap[pos]].value.count;
+}
+
+static void heap_swap(heavy_hitters *self, size_t a, size_t b)
+{
+	size_t tmp = self->heap[a];
+	self->heap[a] = self->heap[b];
+	self->heap[b] = tmp;
+	self->entries[self->heap[a]].heap_pos = a;
+	self->entries[self->heap[b]].heap_pos = b;
+}
+
+// Counts only ever go up, so only ever sift down
+static void heap_sift_down(heavy_hitters *self, size_t pos)
+{
+	for (;;) {
+		size_t smallest = pos;
+		size_t left = 2 * pos + 1;
+		size_t right = left + 1;
+		if (left < self->used &&
+		    heap_count(self, left) < heap_count(self, smallest)) {
+			smallest = left;
+		}
+		if (right < self->used &&
+		    heap_count(self, right) < heap_count(self, smallest)) {
+			smallest = right;
+		}
+		if (smallest == pos) {
+			return;
+		}
+		heap_swap(self, pos, smallest);
+		pos = smallest;
+	}
+}
+
+static void heap_sift_up(heavy_hitters *self, size_t pos)
+{
+	while (pos > 0 &&
+	       heap_count(self, (pos - 1) / 2) > heap_count(self, pos)) {
+		heap_swap(self, pos, (pos - 1) / 2);
+		pos = (pos - 1) / 2;
+	}
+}
+
+void heavy_hitters_add(heavy_hitters *self, const char *key,
+		       time_t seen_first, time_t seen_last, uint64_t count)
+{
+	if (key == 0 || count == 0) {
+		return;
+	}
+
+	size_t len = key_len(key);
+	uint64_t hash = util_hash64(key, len);
+
+	pthread_mutex_lock(&self->mutex);
+	self->events_total += count;
+
+	size_t i = find_entry(self, key, len, hash);
+	if (i != NO_ENTRY) {
+		heavy_hitter *value = &self->entries[i].value;
+		value->count += count;
+		if (seen_first < value->seen_first) {
+			value->seen_first = seen_first;
+		}
+		if (seen_last > value->seen_last) {
+			value->seen_last = seen_last;
+		}
+		heap_sift_down(self, self->entries[i].heap_pos);
+		pthread_mutex_unlock(&self->mutex);
+		return;
+	}
+
+	uint64_t count_error = 0;
+	size_t heap_pos = 0;
+	if (self->used < self->capacity) {
+		i = self->used;
+		heap_pos = self->used++;
+		self->heap[heap_pos] = i;
+	} else {
+		// Take over the smallest, inheriting its count as our error
+		i = self->heap[0];
+		count_error = self->entries[i].value.count;
+		chain_remove(self, i);
+		free(self->entries[i].value.key);
+	}
+
+	hh_entry *entry = &self->entries[i];
+	entry->value.key = strndup(key, len);
+	assert(entry->value.key);
+	entry->value.count = count_error + count;
+	entry->value.count_error = count_error;
+	entry->value.seen_first = seen_first;
+	entry->value.seen_last = seen_last;
+	entry->hash = hash;
+	entry->heap_pos = heap_pos;
+	chain_add(self, i);
+
+	if (count_error == 0) {
+		heap_sift_up(self, heap_pos);
+	} else {
+		heap_sift_down(self, heap_pos);
+	}
+
+	pthread_mutex_unlock(&self->mutex);
+}
+
+static int compare_count(const void *a, const void *b)
+{
+	const heavy_hitter *hh_a = a;
+	const heavy_hitter *hh_b = b;
+
+	if (hh_a->count != hh_b->count) {
+		return hh_a->count < hh_b->count ? 1 : -1;
+	}
+
+	return strcmp(hh_a->key, hh_b->key);
+}
+
+void heavy_hitters_top(heavy_hitters *self, heavy_hitter **list, size_t limit,
+		       size_t *count)
+{
+	// At most capacity entries to copy and sort, however big honey gets
+	pthread_mutex_lock(&self->mutex);
+	size_t used = self->used;
+	heavy_hitter *all = calloc(used ? used : 1, sizeof(heavy_hitter));
+	assert(all);
+	for (size_t i = 0; i < used; i++) {
+		all[i] = self->entries[i].value;
+		all[i].key = util_duplicate_string(self->entries[i].value.key);
+	}
+	pthread_mutex_unlock(&self->mutex);
+
+	qsort(all, used, sizeof(heavy_hitter), compare_count);
+
+	*count = used < limit ? used : limit;
+	for (size_t i = *count; i < used; i++) {
+		free(all[i].key);
+	}
+	*list = all;
+}
+
+int heavy_hitters_get(heavy_hitters *self, const char *key,
+		      heavy_hitter *found)
+{
+	size_t len = key_len(key);
+	uint64_t hash = util_hash64(key, len);
+
+	pthread_mutex_lock(&self->mutex);
+	size_t i = find_entry(self, key, len, hash);
+	if (i == NO_ENTRY) {
+		pthread_mutex_unlock(&self->mutex);
+		return EXIT_FAILURE;
+	}
+	*found = self->entries[i].value;
+	found->key = util_duplicate_string(self->entries[i].value.key);
+	pthread_mutex_unlock(&self->mutex);
+
+	return EXIT_SUCCESS;
+}
+
+uint64_t heavy_hitters_events_total(heavy_hitters *self)
+{
+	pthread_mutex_lock(&self->mutex);
+	uint64_t events_total = self->events_total;
+	pthread_mutex_unlock(&self->mutex);
+
+	return events_total;
+}
+
+size_t heavy_hitters_size(heavy_hitters *self)
+{
+	pthread_mutex_lock(&self->mutex);
+	size_t used = self->used;
+	pthread_mutex_unlock(&self->mutex);
+
+	return used;
+}
@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#ifndef SENTRYPEER_HEAVY_HITTERS_H
+#define SENTRYPEER_HEAVY_HITTERS_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// How many distinct values we keep a counter for
+#define HEAVY_HITTERS_USER_AGENTS 1024
+#define HEAVY_HITTERS_SIP_METHODS 64
+#define HEAVY_HITTERS_COUNTRIES 256 // Every ISO 3166-1 code, so exact
+#define HEAVY_HITTERS_CITIES 4096
+#define HEAVY_HITTERS_MAX_KEY_LEN 512
+
+// Space-Saving (Metwally, Agrawal and El Abbadi, 2005): a fixed number of
+// counters, and a new value takes over the smallest one when they're all in
+// use. Anything seen more than events_total / capacity times is always
+// there, and its count is over by at most count_error. Values that fit in
+// the capacity are counted exactly.
+typedef struct heavy_hitters heavy_hitters;
+
+typedef struct heavy_hitter heavy_hitter;
+struct heavy_hitter {
+	char *key;
+	uint64_t count;
+	uint64_t count_error;
+	time_t seen_first;
+	time_t seen_last;
+};
+
+//  Constructor
+heavy_hitters *heavy_hitters_new(size_t capacity);
+
+//  Destructors
+void heavy_hitters_destroy(heavy_hitters **self_ptr);
+void heavy_hitter_list_destroy(heavy_hitter **list_ptr, size_t count);
+
+/**
+ * Count a value, e.g. a User-Agent.
+ *
+ * @param self The counters.
+ * @param key The value, truncated to HEAVY_HITTERS_MAX_KEY_LEN.
+ * @param seen_first When it was first seen in this batch.
+ * @param seen_last When it was last seen in this batch.
+ * @param count How many times.
+ */
+void heavy_hitters_add(heavy_hitters *self, const char *key,
+		       time_t seen_first, time_t seen_last, uint64_t count);
+
+/**
+ * The busiest values, biggest count first.
+ *
+ * @param self The counters.
+ * @param list Set to a copy of up to limit entries, free with
+ *             heavy_hitter_list_destroy.
+ * @param limit How many to return.
+ * @param count Set to the number in list.
+ */
+void heavy_hitters_top(heavy_hitters *self, heavy_hitter **list, size_t limit,
+		       size_t *count);
+
+/**
+ * A single value.
+ *
+ * @param self The counters.
+ * @param key The value.
+ * @param found Filled with a copy, free found->key.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if it's not being counted.
+ */
+int heavy_hitters_get(heavy_hitters *self, const char *key,
+		      heavy_hitter *found);
+
+/**
+ * @return Every event counted, including ones for values since evicted.
+ */
+uint64_t heavy_hitters_events_total(heavy_hitters *self);
+
+/**
+ * @return How many distinct values are being counted.
+ */
+size_t heavy_hitters_size(heavy_hitters *self);
+
+#endif //SENTRYPEER_HEAVY_HITTERS_H
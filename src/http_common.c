@@ -15,6 +15,7 @@
 #include "config.h"
 
 #include <stdbool.h>
+#include <errno.h>
 #include <arpa/inet.h>
 #include <string.h>
 #include <strings.h>
@@ -68,6 +69,51 @@ bool json_is_requested(struct MHD_Connection *connection)
 	}
 }
 
+// ?name=123, default_value if it's not there, EXIT_FAILURE if it's not a
+// number between min and max
+int query_arg_long(struct MHD_Connection *connection, const char *name,
+		   long default_value, long min, long max, long *value)
+{
+	const char *arg = MHD_lookup_connection_value(
+		connection, MHD_GET_ARGUMENT_KIND, name);
+	if (arg == NULL) {
+		*value = default_value;
+		return EXIT_SUCCESS;
+	}
+
+	char *end = 0;
+	errno = 0;
+	long parsed = strtol(arg, &end, 10);
+	if (errno != 0 || end == arg || *end != '\0' || parsed < min ||
+	    parsed > max) {
+		return EXIT_FAILURE;
+	}
+	*value = parsed;
+
+	return EXIT_SUCCESS;
+}
+
+int query_arg_int64(struct MHD_Connection *connection, const char *name,
+		    int64_t default_value, int64_t *value)
+{
+	const char *arg = MHD_lookup_connection_value(
+		connection, MHD_GET_ARGUMENT_KIND, name);
+	if (arg == NULL) {
+		*value = default_value;
+		return EXIT_SUCCESS;
+	}
+
+	char *end = 0;
+	errno = 0;
+	long long parsed = strtoll(arg, &end, 10);
+	if (errno != 0 || end == arg || *end != '\0' || parsed < 0) {
+		return EXIT_FAILURE;
+	}
+	*value = parsed;
+
+	return EXIT_SUCCESS;
+}
+
 int finalise_response(struct MHD_Connection *connection, const char *reply_data,
 		      const char *content_type, int status_code,
 		      bool free_reply_data)
@@ -82,7 +128,14 @@ int finalise_response(struct MHD_Connection *connection, const char *reply_data,
 
 	if (NULL == response)
 		return MHD_NO;
-	int ret = MHD_queue_response(connection, status_code, response);
+
+	return queue_response(connection, response, content_type, status_code);
+}
+
+int queue_response(struct MHD_Connection *connection,
+		   struct MHD_Response *response, const char *content_type,
+		   int status_code)
+{
 	if (MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE,
 				    content_type) == MHD_NO) {
 		fprintf(stderr, "Failed to add header\n");
@@ -112,6 +165,7 @@ int finalise_response(struct MHD_Connection *connection, const char *reply_data,
 		return MHD_NO;
 	}
 
+	int ret = MHD_queue_response(connection, status_code, response);
 	MHD_destroy_response(response);
 	return ret;
 }
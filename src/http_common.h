@@ -14,10 +14,15 @@
 #define SENTRYPEER_HTTP_COMMON_H 1
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <microhttpd.h>
 
 #define CONTENT_TYPE_HTML "text/html"
 #define CONTENT_TYPE_JSON "application/json"
+#define CONTENT_TYPE_TEXT "text/plain"
+#define CONTENT_TYPE_EVENT_STREAM "text/event-stream"
+// Prometheus text exposition format
+#define CONTENT_TYPE_METRICS "text/plain; version=0.0.4; charset=utf-8"
 #define STATUS_OK_JSON "{\"status\": \"OK\"}"
 #define NOT_FOUND_ERROR_JSON                                                   \
 	"{\"error\": \"The requested resource could not be found.\"}"
@@ -26,12 +31,30 @@
 #define NOT_FOUND_BAD_ACTORS_JSON "{\"message\": \"No bad actors found\"}"
 #define NOT_FOUND_PHONE_NUMBER_JSON "{\"message\": \"No phone number found\"}"
 #define NOT_FOUND_PHONE_NUMBERS_JSON "{\"message\": \"No phone numbers found\"}"
+#define NOT_FOUND_USER_AGENT_JSON "{\"message\": \"No user agent found\"}"
+#define NOT_FOUND_USER_AGENTS_JSON "{\"message\": \"No user agents found\"}"
+#define NOT_FOUND_SIP_METHOD_JSON "{\"message\": \"No SIP method found\"}"
+#define NOT_FOUND_SIP_METHODS_JSON "{\"message\": \"No SIP methods found\"}"
+#define NOT_FOUND_COUNTRY_JSON "{\"message\": \"No country found\"}"
+#define NOT_FOUND_COUNTRIES_JSON "{\"message\": \"No countries found\"}"
+#define NOT_FOUND_CITY_JSON "{\"message\": \"No city found\"}"
+#define TOO_MANY_SUBSCRIBERS_JSON                                              \
+	"{\"error\": \"Too many event stream subscribers, try again later\"}"
 
 void log_http_client_ip(const char *url, struct MHD_Connection *connection);
 bool json_is_requested(struct MHD_Connection *connection);
+int query_arg_long(struct MHD_Connection *connection, const char *name,
+		   long default_value, long min, long max, long *value);
+// For values that may not fit a long, e.g. Unix times. Never negative.
+int query_arg_int64(struct MHD_Connection *connection, const char *name,
+		    int64_t default_value, int64_t *value);
 
 int finalise_response(struct MHD_Connection *connection, const char *reply_data,
 		      const char *content_type, int status_code,
 		      bool free_reply_data);
+// Adds our usual headers, then queues and releases response
+int queue_response(struct MHD_Connection *connection,
+		   struct MHD_Response *response, const char *content_type,
+		   int status_code);
 
 #endif //SENTRYPEER_HTTP_COMMON_H
@@ -14,6 +14,13 @@
 #include "conf.h"
 #include "http_daemon.h"
 #include "http_routes.h"
+#include "ip_prefix_tree.h"
+#include "ip_address_log.h"
+#include "heavy_hitters.h"
+#include "event_series.h"
+#include "event_stream.h"
+#include "metrics.h"
+#include "database.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -26,12 +33,114 @@ int http_daemon_init(sentrypeer_config *config)
 		fprintf(stderr, "API mode enabled, starting http daemon...\n");
 	}
 
+	// Built once here, then all kept up to date by bad_actor_index()
+	if (config->ip_prefix_tree == 0) {
+		config->ip_prefix_tree = ip_prefix_tree_new();
+		if (config->ip_prefix_tree == 0 ||
+		    ip_prefix_tree_load(config->ip_prefix_tree, config) !=
+			    EXIT_SUCCESS) {
+			fprintf(stderr, "Failed to build IP address index\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (config->ip_address_log == 0) {
+		config->ip_address_log = ip_address_log_new();
+		if (config->ip_address_log == 0 ||
+		    db_load_ip_address_log(config->ip_address_log, config) !=
+			    EXIT_SUCCESS) {
+			fprintf(stderr, "Failed to build IP address log\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (config->user_agents == 0) {
+		config->user_agents =
+			heavy_hitters_new(HEAVY_HITTERS_USER_AGENTS);
+		if (config->user_agents == 0 ||
+		    db_load_heavy_hitters("user_agent", config->user_agents,
+					  config) != EXIT_SUCCESS) {
+			fprintf(stderr, "Failed to count user agents\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (config->sip_methods == 0) {
+		config->sip_methods =
+			heavy_hitters_new(HEAVY_HITTERS_SIP_METHODS);
+		if (config->sip_methods == 0 ||
+		    db_load_heavy_hitters("method", config->sip_methods,
+					  config) != EXIT_SUCCESS) {
+			fprintf(stderr, "Failed to count SIP methods\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (config->countries == 0) {
+		config->countries = heavy_hitters_new(HEAVY_HITTERS_COUNTRIES);
+		if (config->countries == 0 ||
+		    db_load_heavy_hitters("country_code", config->countries,
+					  config) != EXIT_SUCCESS) {
+			fprintf(stderr, "Failed to count countries\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (config->cities == 0) {
+		config->cities = heavy_hitters_new(HEAVY_HITTERS_CITIES);
+		if (config->cities == 0 ||
+		    db_load_heavy_hitters(HEAVY_HITTERS_CITY_KEY,
+					  config->cities,
+					  config) != EXIT_SUCCESS) {
+			fprintf(stderr, "Failed to count cities\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Saved by db_maintenance, and once more when we stop
+	if (config->event_series == 0) {
+		config->event_series = event_series_new();
+		if (config->event_series == 0 ||
+		    db_load_event_series(config->event_series, config) !=
+			    EXIT_SUCCESS) {
+			fprintf(stderr, "Failed to count event series\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (config->event_stream == 0) {
+		config->event_stream = event_stream_new(EVENT_STREAM_CAPACITY);
+		if (config->event_stream == 0) {
+			fprintf(stderr, "Failed to create event stream\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Before the sip daemon starts, which counts into it from then on
+	if (config->metrics == 0) {
+		config->metrics = metrics_new();
+		if (config->metrics == 0) {
+			fprintf(stderr, "Failed to create metrics\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (events_fan_out_start(config) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	// A pool of threads polling for connections, rather than one each,
+	// so /events/stream subscribers are only suspended connections
 	struct MHD_Daemon *daemon;
 
-	daemon = MHD_start_daemon(MHD_USE_THREAD_PER_CONNECTION,
+	daemon = MHD_start_daemon(MHD_USE_AUTO_INTERNAL_THREAD |
+					  MHD_ALLOW_SUSPEND_RESUME,
 				  HTTP_DAEMON_PORT, NULL, NULL, &route_handler,
-				  config, MHD_OPTION_END);
+				  config, MHD_OPTION_THREAD_POOL_SIZE,
+				  (unsigned int)HTTP_DAEMON_THREADS,
+				  MHD_OPTION_END);
 	if (daemon == NULL) {
+		events_fan_out_stop(config);
 		return EXIT_FAILURE;
 	}
 	config->http_daemon = daemon;
@@ -45,6 +154,9 @@ int http_daemon_stop(sentrypeer_config *config)
 		fprintf(stderr, "Stopping http daemon...\n");
 	}
 
+	// Event stream subscribers are suspended waiting for the next event,
+	// so resume them to find the stream closed
+	events_fan_out_stop(config);
 	MHD_stop_daemon(config->http_daemon);
 
 	return EXIT_SUCCESS;
@@ -17,6 +17,8 @@
 #include "conf.h"
 
 #define HTTP_DAEMON_PORT 8082
+// Each serves any number of connections, one request at a time
+#define HTTP_DAEMON_THREADS 8
 
 int http_daemon_init(sentrypeer_config *config);
 int http_daemon_stop(sentrypeer_config *config);
@@ -0,0 +1,323 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <microhttpd.h>
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "http_common.h"
+#include "http_routes.h"
+#include "event_stream.h"
+#include "utils.h"
+
+// A comment line now and then so proxies keep the connection open and we
+// notice when a subscriber has gone
+#define EVENTS_KEEPALIVE_SECONDS 15
+#define EVENTS_BLOCK_SIZE (16 * 1024)
+
+// Each subscriber is only its position in the ring and the one event it's
+// part way through sending. With nothing to send, its connection is
+// suspended and put on the waiting list, and the fan out thread resumes it
+// once there's something new or a keepalive is due. So a subscriber costs
+// no thread while it waits.
+typedef struct events_subscriber events_subscriber;
+struct events_subscriber {
+	event_stream *stream;
+	struct MHD_Connection *connection;
+	uint64_t next;
+	bool close_when_lagged;
+	char *pending;
+	size_t pending_len;
+	size_t pending_sent;
+	time_t keepalive_at;
+	bool waiting;
+	events_subscriber *waiting_prev;
+	events_subscriber *waiting_next;
+};
+
+static pthread_mutex_t waiting_mutex = PTHREAD_MUTEX_INITIALIZER;
+static events_subscriber *waiting = 0;
+static pthread_t fan_out_thread;
+static bool fan_out_running = false;
+
+// With waiting_mutex held
+static void waiting_add(events_subscriber *subscriber)
+{
+	subscriber->waiting = true;
+	subscriber->waiting_prev = 0;
+	subscriber->waiting_next = waiting;
+	if (waiting != 0) {
+		waiting->waiting_prev = subscriber;
+	}
+	waiting = subscriber;
+}
+
+static void waiting_remove(events_subscriber *subscriber)
+{
+	if (subscriber->waiting_prev != 0) {
+		subscriber->waiting_prev->waiting_next =
+			subscriber->waiting_next;
+	} else {
+		waiting = subscriber->waiting_next;
+	}
+	if (subscriber->waiting_next != 0) {
+		subscriber->waiting_next->waiting_prev =
+			subscriber->waiting_prev;
+	}
+	subscriber->waiting = false;
+	subscriber->waiting_prev = 0;
+	subscriber->waiting_next = 0;
+}
+
+static void set_pending(events_subscriber *subscriber, char *pending)
+{
+	free(subscriber->pending);
+	subscriber->pending = pending;
+	subscriber->pending_len = strlen(pending);
+	subscriber->pending_sent = 0;
+	subscriber->keepalive_at = time(NULL) + EVENTS_KEEPALIVE_SECONDS;
+}
+
+static char *event_message(uint64_t id, const char *json)
+{
+	// Bad actor json is always one line, so one data field
+	size_t len = strlen(json) + 64;
+	char *message = malloc(len);
+	assert(message);
+	snprintf(message, len, "id: %" PRIu64 "\nevent: bad_actor\ndata: %s\n\n",
+		 id, json);
+
+	return message;
+}
+
+static char *lagged_message(uint64_t dropped)
+{
+	char message[128];
+	snprintf(message, sizeof(message),
+		 "event: lagged\ndata: {\"dropped\": %" PRIu64 "}\n\n",
+		 dropped);
+
+	return util_duplicate_string(message);
+}
+
+static ssize_t events_reader(void *cls, uint64_t pos, char *buf, size_t max)
+{
+	(void)pos; /* unused */
+	events_subscriber *subscriber = cls;
+
+	while (subscriber->pending_sent == subscriber->pending_len) {
+		char *json = 0;
+		uint64_t dropped = 0;
+		uint64_t id = subscriber->next;
+
+		// Looked at with waiting_mutex held, so anything published
+		// after this is seen by the fan out thread once we're waiting
+		pthread_mutex_lock(&waiting_mutex);
+		int status = event_stream_next(subscriber->stream,
+					       &subscriber->next, &json,
+					       &dropped, 0);
+		if (status == EVENT_STREAM_TIMEOUT &&
+		    time(NULL) < subscriber->keepalive_at) {
+			waiting_add(subscriber);
+			MHD_suspend_connection(subscriber->connection);
+			pthread_mutex_unlock(&waiting_mutex);
+			return 0;
+		}
+		pthread_mutex_unlock(&waiting_mutex);
+
+		switch (status) {
+		case EVENT_STREAM_EVENT:
+			set_pending(subscriber, event_message(id, json));
+			free(json);
+			break;
+		case EVENT_STREAM_LAGGED:
+			if (subscriber->close_when_lagged) {
+				return MHD_CONTENT_READER_END_OF_STREAM;
+			}
+			set_pending(subscriber, lagged_message(dropped));
+			break;
+		case EVENT_STREAM_TIMEOUT:
+			set_pending(subscriber,
+				    util_duplicate_string(": keepalive\n\n"));
+			break;
+		default:
+			return MHD_CONTENT_READER_END_OF_STREAM;
+		}
+	}
+
+	size_t len = subscriber->pending_len - subscriber->pending_sent;
+	if (len > max) {
+		len = max;
+	}
+	memcpy(buf, subscriber->pending + subscriber->pending_sent, len);
+	subscriber->pending_sent += len;
+
+	return (ssize_t)len;
+}
+
+static void events_subscriber_destroy(void *cls)
+{
+	events_subscriber *subscriber = cls;
+
+	// Only if the daemon is stopping with it suspended
+	pthread_mutex_lock(&waiting_mutex);
+	if (subscriber->waiting) {
+		waiting_remove(subscriber);
+	}
+	pthread_mutex_unlock(&waiting_mutex);
+
+	event_stream_unsubscribe(subscriber->stream);
+	free(subscriber->pending);
+	free(subscriber);
+}
+
+// Resume every waiting subscriber with something new to send or a keepalive
+// due, until the stream is closed and then all of them
+static void *events_fan_out(void *arg)
+{
+	event_stream *stream = arg;
+	uint64_t head = 0;
+	int status = EVENT_STREAM_EVENT;
+
+	while (status != EVENT_STREAM_CLOSED) {
+		status = event_stream_wait(stream, &head, 1);
+		time_t now = time(NULL);
+
+		pthread_mutex_lock(&waiting_mutex);
+		events_subscriber *subscriber = waiting;
+		while (subscriber != 0) {
+			events_subscriber *waiting_next =
+				subscriber->waiting_next;
+			if (status == EVENT_STREAM_CLOSED ||
+			    subscriber->next < head ||
+			    now >= subscriber->keepalive_at) {
+				waiting_remove(subscriber);
+				MHD_resume_connection(subscriber->connection);
+			}
+			subscriber = waiting_next;
+		}
+		pthread_mutex_unlock(&waiting_mutex);
+	}
+
+	return 0;
+}
+
+int events_fan_out_start(sentrypeer_config const *config)
+{
+	if (fan_out_running) {
+		return EXIT_SUCCESS;
+	}
+
+	if (pthread_create(&fan_out_thread, NULL, events_fan_out,
+			   config->event_stream) != 0) {
+		fprintf(stderr, "Failed to start event stream fan out\n");
+		return EXIT_FAILURE;
+	}
+	fan_out_running = true;
+
+	return EXIT_SUCCESS;
+}
+
+void events_fan_out_stop(sentrypeer_config const *config)
+{
+	if (!fan_out_running) {
+		return;
+	}
+
+	// Wakes the fan out thread, which resumes everyone waiting to find
+	// the stream closed
+	event_stream_close(config->event_stream);
+	pthread_join(fan_out_thread, NULL);
+	fan_out_running = false;
+}
+
+int events_stream_route(struct MHD_Connection *connection,
+			sentrypeer_config const *config)
+{
+	const char *lag = MHD_lookup_connection_value(
+		connection, MHD_GET_ARGUMENT_KIND, "lag");
+	if (lag != NULL && strcmp(lag, "skip") != 0 &&
+	    strcmp(lag, "close") != 0) {
+		return finalise_response(connection, BAD_DATA_JSON,
+					 CONTENT_TYPE_JSON,
+					 MHD_HTTP_BAD_REQUEST, false);
+	}
+
+	if (config->event_stream == 0) {
+		return finalise_response(connection, NOT_FOUND_ERROR_JSON,
+					 CONTENT_TYPE_JSON, MHD_HTTP_NOT_FOUND,
+					 false);
+	}
+
+	uint64_t next = 0;
+	if (event_stream_subscribe(config->event_stream, &next) !=
+	    EXIT_SUCCESS) {
+		return finalise_response(connection, TOO_MANY_SUBSCRIBERS_JSON,
+					 CONTENT_TYPE_JSON,
+					 MHD_HTTP_SERVICE_UNAVAILABLE, false);
+	}
+
+	events_subscriber *subscriber = calloc(1, sizeof(events_subscriber));
+	assert(subscriber);
+	subscriber->stream = config->event_stream;
+	subscriber->connection = connection;
+	subscriber->next = next;
+	subscriber->keepalive_at = time(NULL) + EVENTS_KEEPALIVE_SECONDS;
+	subscriber->close_when_lagged = lag != NULL &&
+					strcmp(lag, "close") == 0;
+
+	// Carry on after a reconnect, from the oldest event still kept at worst
+	const char *last_event_id = MHD_lookup_connection_value(
+		connection, MHD_HEADER_KIND, "Last-Event-ID");
+	if (last_event_id != NULL) {
+		char *end = 0;
+		errno = 0;
+		unsigned long long last_id = strtoull(last_event_id, &end, 10);
+		if (errno == 0 && end != last_event_id && *end == '\0' &&
+		    last_id < next) {
+			subscriber->next = last_id + 1;
+		}
+	}
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr,
+			"New event stream subscriber from event %" PRIu64 "\n",
+			subscriber->next);
+	}
+
+	struct MHD_Response *response = MHD_create_response_from_callback(
+		MHD_SIZE_UNKNOWN, EVENTS_BLOCK_SIZE, &events_reader, subscriber,
+		&events_subscriber_destroy);
+	if (response == NULL) {
+		events_subscriber_destroy(subscriber);
+		return MHD_NO;
+	}
+
+	if (MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL,
+				    "no-cache") == MHD_NO) {
+		fprintf(stderr, "Failed to add header\n");
+		MHD_destroy_response(response);
+		return MHD_NO;
+	}
+
+	return queue_response(connection, response, CONTENT_TYPE_EVENT_STREAM,
+			      MHD_HTTP_OK);
+}
@@ -0,0 +1,259 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <microhttpd.h>
+#include <jansson.h>
+#include "config.h"
+
+#include "http_common.h"
+#include "http_routes.h"
+#include "heavy_hitters.h"
+#include "geoip.h"
+#include "utils.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#define HEAVY_HITTERS_DEFAULT_LIMIT 10
+
+// /user-agents, /sip-methods and /countries are answered from in-memory
+// counters, so the same code serves them all with a different key name.
+
+static json_t *heavy_hitter_to_json(const char *key_name,
+				    const heavy_hitter *value)
+{
+	char seen_first[TIMESTAMP_LEN];
+	char seen_last[TIMESTAMP_LEN];
+	util_format_seen_time(value->seen_first, seen_first,
+			      sizeof(seen_first));
+	util_format_seen_time(value->seen_last, seen_last, sizeof(seen_last));
+
+	return json_pack("{s:s,s:I,s:I,s:s,s:s}", key_name, value->key,
+			 "seen_count", (json_int_t)value->count,
+			 "seen_count_error", (json_int_t)value->count_error,
+			 "seen_first", seen_first, "seen_last", seen_last);
+}
+
+static int top_route(heavy_hitters *counters, const char *key_name,
+		     const char *list_name, const char *not_found_json,
+		     struct MHD_Connection *connection,
+		     sentrypeer_config const *config)
+{
+	long limit = 0;
+	if (query_arg_long(connection, "limit", HEAVY_HITTERS_DEFAULT_LIMIT, 1,
+			   HEAVY_HITTERS_USER_AGENTS, &limit) != EXIT_SUCCESS) {
+		return finalise_response(connection, BAD_DATA_JSON,
+					 CONTENT_TYPE_JSON,
+					 MHD_HTTP_BAD_REQUEST, false);
+	}
+
+	if (counters == 0) {
+		return finalise_response(connection, not_found_json,
+					 CONTENT_TYPE_JSON, MHD_HTTP_NOT_FOUND,
+					 false);
+	}
+
+	heavy_hitter *top = 0;
+	size_t top_count = 0;
+	heavy_hitters_top(counters, &top, (size_t)limit, &top_count);
+	if (top_count == 0) {
+		heavy_hitter_list_destroy(&top, top_count);
+		return finalise_response(connection, not_found_json,
+					 CONTENT_TYPE_JSON, MHD_HTTP_NOT_FOUND,
+					 false);
+	}
+
+	json_t *json_arr = json_array();
+	for (size_t i = 0; i < top_count; i++) {
+		if (config->verbose_mode || config->debug_mode) {
+			fprintf(stderr, "%s: %s\n", key_name, top[i].key);
+		}
+		json_array_append_new(json_arr,
+				      heavy_hitter_to_json(key_name, &top[i]));
+	}
+	heavy_hitter_list_destroy(&top, top_count);
+
+	char total_name[64];
+	snprintf(total_name, sizeof(total_name), "%s_total", list_name);
+	json_t *json_final_obj = json_pack(
+		"{s:I,s:I,s:o}", total_name,
+		(json_int_t)heavy_hitters_size(counters), "events_total",
+		(json_int_t)heavy_hitters_events_total(counters), list_name,
+		json_arr);
+	const char *reply = json_dumps(json_final_obj, JSON_INDENT(2));
+	json_decref(json_final_obj);
+
+	return finalise_response(connection, reply, CONTENT_TYPE_JSON,
+				 MHD_HTTP_OK, true);
+}
+
+static int single_route(heavy_hitters *counters, const char *key_name,
+			const char *not_found_json, char **key,
+			struct MHD_Connection *connection)
+{
+	heavy_hitter found;
+	int status = counters != 0 ?
+			     heavy_hitters_get(counters, *key, &found) :
+			     EXIT_FAILURE;
+	free(*key);
+	*key = 0;
+
+	if (status != EXIT_SUCCESS) {
+		return finalise_response(connection, not_found_json,
+					 CONTENT_TYPE_JSON, MHD_HTTP_NOT_FOUND,
+					 false);
+	}
+
+	json_t *json_final_obj = heavy_hitter_to_json(key_name, &found);
+	free(found.key);
+	const char *reply = json_dumps(json_final_obj, JSON_INDENT(2));
+	json_decref(json_final_obj);
+
+	return finalise_response(connection, reply, CONTENT_TYPE_JSON,
+				 MHD_HTTP_OK, true);
+}
+
+int user_agents_route(struct MHD_Connection *connection,
+		      sentrypeer_config const *config)
+{
+	return top_route(config->user_agents, "user_agent", "user_agents",
+			 NOT_FOUND_USER_AGENTS_JSON, connection, config);
+}
+
+int user_agent_route(char **user_agent, struct MHD_Connection *connection,
+		     sentrypeer_config const *config)
+{
+	return single_route(config->user_agents, "user_agent",
+			    NOT_FOUND_USER_AGENT_JSON, user_agent, connection);
+}
+
+int sip_methods_route(struct MHD_Connection *connection,
+		      sentrypeer_config const *config)
+{
+	return top_route(config->sip_methods, "sip_method", "sip_methods",
+			 NOT_FOUND_SIP_METHODS_JSON, connection, config);
+}
+
+int sip_method_route(char **sip_method, struct MHD_Connection *connection,
+		     sentrypeer_config const *config)
+{
+	return single_route(config->sip_methods, "sip_method",
+			    NOT_FOUND_SIP_METHOD_JSON, sip_method, connection);
+}
+
+int countries_route(struct MHD_Connection *connection,
+		    sentrypeer_config const *config)
+{
+	return top_route(config->countries, "country_code", "countries",
+			 NOT_FOUND_COUNTRIES_JSON, connection, config);
+}
+
+// Cities are counted as "GB/London", see HEAVY_HITTERS_CITY_KEY
+static json_t *city_to_json(const heavy_hitter *city)
+{
+	heavy_hitter value = *city;
+	value.key = city->key + GEOIP_COUNTRY_CODE_LEN;
+
+	return heavy_hitter_to_json("city", &value);
+}
+
+int country_route(char **country_code, struct MHD_Connection *connection,
+		  sentrypeer_config const *config)
+{
+	char code[GEOIP_COUNTRY_CODE_LEN];
+	code[0] = (char)toupper((unsigned char)(*country_code)[0]);
+	code[1] = (char)toupper((unsigned char)(*country_code)[1]);
+	code[2] = '\0';
+	free(*country_code);
+	*country_code = 0;
+
+	long limit = 0;
+	if (query_arg_long(connection, "limit", HEAVY_HITTERS_DEFAULT_LIMIT, 1,
+			   HEAVY_HITTERS_CITIES, &limit) != EXIT_SUCCESS) {
+		return finalise_response(connection, BAD_DATA_JSON,
+					 CONTENT_TYPE_JSON,
+					 MHD_HTTP_BAD_REQUEST, false);
+	}
+
+	heavy_hitter found;
+	if (config->countries == 0 ||
+	    heavy_hitters_get(config->countries, code, &found) !=
+		    EXIT_SUCCESS) {
+		return finalise_response(connection, NOT_FOUND_COUNTRY_JSON,
+					 CONTENT_TYPE_JSON, MHD_HTTP_NOT_FOUND,
+					 false);
+	}
+	json_t *json_final_obj = heavy_hitter_to_json("country_code", &found);
+	free(found.key);
+
+	// Every city we count, busiest first, then just this country's
+	json_t *json_arr = json_array();
+	if (config->cities != 0) {
+		heavy_hitter *cities = 0;
+		size_t city_count = 0;
+		heavy_hitters_top(config->cities, &cities,
+				  HEAVY_HITTERS_CITIES, &city_count);
+		for (size_t i = 0; i < city_count &&
+				   json_array_size(json_arr) < (size_t)limit;
+		     i++) {
+			if (strncmp(cities[i].key, code,
+				    GEOIP_COUNTRY_CODE_LEN - 1) == 0 &&
+			    cities[i].key[GEOIP_COUNTRY_CODE_LEN - 1] == '/') {
+				json_array_append_new(json_arr,
+						      city_to_json(&cities[i]));
+			}
+		}
+		heavy_hitter_list_destroy(&cities, city_count);
+	}
+
+	json_object_set_new(json_final_obj, "cities_total",
+			    json_integer((json_int_t)json_array_size(json_arr)));
+	json_object_set_new(json_final_obj, "cities", json_arr);
+	const char *reply = json_dumps(json_final_obj, JSON_INDENT(2));
+	json_decref(json_final_obj);
+
+	return finalise_response(connection, reply, CONTENT_TYPE_JSON,
+				 MHD_HTTP_OK, true);
+}
+
+int country_city_route(char **country_city, struct MHD_Connection *connection,
+		       sentrypeer_config const *config)
+{
+	(*country_city)[0] = (char)toupper((unsigned char)(*country_city)[0]);
+	(*country_city)[1] = (char)toupper((unsigned char)(*country_city)[1]);
+
+	heavy_hitter found;
+	int status = config->cities != 0 ?
+			     heavy_hitters_get(config->cities, *country_city,
+					       &found) :
+			     EXIT_FAILURE;
+	free(*country_city);
+	*country_city = 0;
+
+	if (status != EXIT_SUCCESS) {
+		return finalise_response(connection, NOT_FOUND_CITY_JSON,
+					 CONTENT_TYPE_JSON, MHD_HTTP_NOT_FOUND,
+					 false);
+	}
+
+	json_t *json_final_obj = city_to_json(&found);
+	found.key[GEOIP_COUNTRY_CODE_LEN - 1] = '\0';
+	json_object_set_new(json_final_obj, "country_code",
+			    json_string(found.key));
+	free(found.key);
+	const char *reply = json_dumps(json_final_obj, JSON_INDENT(2));
+	json_decref(json_final_obj);
+
+	return finalise_response(connection, reply, CONTENT_TYPE_JSON,
+				 MHD_HTTP_OK, true);
+}
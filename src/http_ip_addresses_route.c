@@ -19,64 +19,109 @@
 #include "bad_actor.h"
 #include "database.h"
 
+// The bad actors as a json array, or NULL if one couldn't be added
+static json_t *bad_actors_json(bad_actor **bad_actors, int64_t row_count,
+			       sentrypeer_config const *config)
+{
+	json_t *json_arr = json_array();
+
+	int64_t row_num = 0;
+	while (row_num < row_count) {
+		if (config->verbose_mode || config->debug_mode) {
+			fprintf(stderr, "source_ip: %s\n",
+				bad_actors[row_num]->source_ip);
+		}
+
+		if (json_array_append_new(
+			    json_arr,
+			    json_pack("{s:s,s:s,s:s}", "ip_address",
+
+				      bad_actors[row_num]->source_ip,
+				      "seen_last",
+				      bad_actors[row_num]->seen_last,
+				      "seen_count",
+				      bad_actors[row_num]->seen_count)) !=
+		    EXIT_SUCCESS) {
+			fprintf(stderr,
+				"Failed to append bad actor to json array\n");
+			json_decref(json_arr);
+			return NULL;
+		}
+		row_num++;
+	}
+
+	return json_arr;
+}
+
 int ip_addresses_route(struct MHD_Connection *connection,
 		       sentrypeer_config const *config)
 {
 	const char *reply = NULL;
 	bad_actor **bad_actors = 0;
 	int64_t row_count = 0;
+	int64_t *since_cursors = 0;
+	size_t since_cursor_count = 0;
+	int64_t *cursors = 0;
+	size_t cursor_count = 0;
+
+	const char *since = MHD_lookup_connection_value(
+		connection, MHD_GET_ARGUMENT_KIND, "since");
+	if (since != NULL && db_parse_cursors(since, &since_cursors,
+					      &since_cursor_count) !=
+				     EXIT_SUCCESS) {
+		return finalise_response(connection, BAD_DATA_JSON,
+					 CONTENT_TYPE_JSON,
+					 MHD_HTTP_BAD_REQUEST, false);
+	}
 
-	if (db_select_bad_actors(&bad_actors, &row_count, config) !=
-	    EXIT_SUCCESS) {
+	// Asked for before the full list, so anything logged while we
+	// select it is in the next ?since= too, rather than missed
+	int selected = EXIT_FAILURE;
+	if (since != NULL) {
+		selected = db_select_bad_actors_since(
+			since_cursors, since_cursor_count, &bad_actors,
+			&row_count, &cursors, &cursor_count, config);
+		free(since_cursors);
+	} else if (db_select_partition_cursors(&cursors, &cursor_count,
+					       config) == EXIT_SUCCESS) {
+		selected =
+			db_select_bad_actors(&bad_actors, &row_count, config);
+	}
+
+	if (selected != EXIT_SUCCESS) {
 		fprintf(stderr, "Failed to select bad actors from database\n");
+		free(cursors);
 		return finalise_response(connection, NOT_FOUND_BAD_ACTORS_JSON,
 					 CONTENT_TYPE_JSON, MHD_HTTP_NOT_FOUND,
 					 false);
 	}
 
-	if ((bad_actors != 0) && (row_count > 0)) {
-		int64_t row_num = 0;
-		json_t *json_arr = json_array();
-
-		while (row_num < row_count) {
-			if (config->verbose_mode || config->debug_mode) {
-				fprintf(stderr, "source_ip: %s\n",
-					bad_actors[row_num]->source_ip);
-			}
-
-			if (json_array_append_new(
-				    json_arr,
-				    json_pack(
-					    "{s:s,s:s,s:s}", "ip_address",
-
-					    bad_actors[row_num]->source_ip,
-					    "seen_last",
-					    bad_actors[row_num]->seen_last,
-					    "seen_count",
-					    bad_actors[row_num]->seen_count)) !=
-			    EXIT_SUCCESS) {
-				fprintf(stderr,
-					"Failed to append bad actor to json array\n");
-
-				// Free the json objects
-				json_decref(json_arr);
-				bad_actors_destroy(bad_actors, &row_count);
-				free(bad_actors);
-
-				return finalise_response(
-					connection, NOT_FOUND_BAD_ACTORS_JSON,
-					CONTENT_TYPE_JSON, MHD_HTTP_NOT_FOUND,
-					false);
-			}
-			row_num++;
+	// Nothing new since the cursor is still a 200
+	if (row_count > 0 || since != NULL) {
+		json_t *json_arr =
+			bad_actors_json(bad_actors, row_count, config);
+		if (json_arr == NULL) {
+			bad_actors_destroy(bad_actors, &row_count);
+			free(bad_actors);
+			free(cursors);
+
+			return finalise_response(connection,
+						 NOT_FOUND_BAD_ACTORS_JSON,
+						 CONTENT_TYPE_JSON,
+						 MHD_HTTP_NOT_FOUND, false);
 		}
-		json_t *json_final_obj =
-			json_pack("{s:i,s:o}", "ip_addresses_total", row_count,
-				  "ip_addresses", json_arr);
+
+		char *cursor = db_format_cursors(cursors, cursor_count);
+		json_t *json_final_obj = json_pack(
+			"{s:I,s:s,s:o}", "ip_addresses_total",
+			(json_int_t)row_count, "cursor", cursor, "ip_addresses",
+			json_arr);
 		reply = json_dumps(json_final_obj, JSON_INDENT(2));
 
 		// Free the json objects
 		json_decref(json_final_obj);
+		free(cursor);
+		free(cursors);
 		bad_actors_destroy(bad_actors, &row_count);
 		free(bad_actors);
 
@@ -85,6 +130,7 @@ int ip_addresses_route(struct MHD_Connection *connection,
 	} else {
 		bad_actors_destroy(bad_actors, &row_count);
 		free(bad_actors);
+		free(cursors);
 		return finalise_response(connection, NOT_FOUND_BAD_ACTORS_JSON,
 					 CONTENT_TYPE_JSON, MHD_HTTP_NOT_FOUND,
 					 false);
@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <microhttpd.h>
+#include <jansson.h>
+#include "config.h"
+
+#include <limits.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "http_common.h"
+#include "http_routes.h"
+#include "ip_prefix_tree.h"
+#include "utils.h"
+
+#define IP_PREFIXES_DEFAULT_LIMIT 10
+#define IP_PREFIX_DEFAULT_LIMIT 100
+#define IP_PREFIXES_DEFAULT_V4_LENGTH 24
+#define IP_PREFIXES_DEFAULT_V6_LENGTH 48
+
+static json_t *prefix_to_json(const char *key, const ip_prefix_stats *stats,
+			      bool with_address_count)
+{
+	char seen_last[TIMESTAMP_LEN];
+	util_format_seen_time(stats->seen_last, seen_last, sizeof(seen_last));
+
+	if (with_address_count) {
+		return json_pack("{s:s,s:I,s:I,s:s}", key, stats->prefix,
+				 "seen_count", (json_int_t)stats->seen_count,
+				 "ip_addresses_total",
+				 (json_int_t)stats->address_count, "seen_last",
+				 seen_last);
+	}
+
+	return json_pack("{s:s,s:I,s:s}", key, stats->prefix, "seen_count",
+			 (json_int_t)stats->seen_count, "seen_last", seen_last);
+}
+
+// ?since= is how many seconds back to look
+static time_t since_from_seconds(long since_seconds)
+{
+	return since_seconds > 0 ? time(NULL) - since_seconds : 0;
+}
+
+int ip_prefixes_route(struct MHD_Connection *connection,
+		      sentrypeer_config const *config)
+{
+	long family = 4;
+	long length = 0;
+	long limit = 0;
+
+	if (query_arg_long(connection, "family", 4, 4, 6, &family) !=
+		    EXIT_SUCCESS ||
+	    family == 5 ||
+	    query_arg_long(connection, "length",
+			   family == 4 ? IP_PREFIXES_DEFAULT_V4_LENGTH :
+					 IP_PREFIXES_DEFAULT_V6_LENGTH,
+			   0, family == 4 ? 32 : IP_PREFIX_MAX_LEN,
+			   &length) != EXIT_SUCCESS ||
+	    query_arg_long(connection, "limit", IP_PREFIXES_DEFAULT_LIMIT, 1,
+			   IP_PREFIX_MAX_RESULTS, &limit) != EXIT_SUCCESS) {
+		return finalise_response(connection, BAD_DATA_JSON,
+					 CONTENT_TYPE_JSON,
+					 MHD_HTTP_BAD_REQUEST, false);
+	}
+
+	ip_prefix_stats *top = 0;
+	size_t top_count = 0;
+	if (config->ip_prefix_tree == 0 ||
+	    ip_prefix_tree_top(config->ip_prefix_tree,
+			       family == 4 ? AF_INET : AF_INET6, (int)length,
+			       &top, (size_t)limit, &top_count) !=
+		    EXIT_SUCCESS ||
+	    top_count == 0) {
+		free(top);
+		return finalise_response(connection, NOT_FOUND_BAD_ACTORS_JSON,
+					 CONTENT_TYPE_JSON, MHD_HTTP_NOT_FOUND,
+					 false);
+	}
+
+	json_t *json_arr = json_array();
+	for (size_t i = 0; i < top_count; i++) {
+		if (config->verbose_mode || config->debug_mode) {
+			fprintf(stderr, "ip_prefix: %s\n", top[i].prefix);
+		}
+		json_array_append_new(json_arr,
+				      prefix_to_json("ip_prefix", &top[i], true));
+	}
+	free(top);
+
+	json_t *json_final_obj = json_pack(
+		"{s:i,s:i,s:I,s:o}", "family", (int)family, "prefix_length",
+		(int)length, "ip_prefixes_total", (json_int_t)top_count,
+		"ip_prefixes", json_arr);
+	const char *reply = json_dumps(json_final_obj, JSON_INDENT(2));
+	json_decref(json_final_obj);
+
+	return finalise_response(connection, reply, CONTENT_TYPE_JSON,
+				 MHD_HTTP_OK, true);
+}
+
+int ip_prefix_route(char **ip_prefix, struct MHD_Connection *connection,
+		    sentrypeer_config const *config)
+{
+	long since_seconds = 0;
+	long limit = 0;
+	ip_prefix_stats summary;
+	ip_prefix_stats *addresses = 0;
+	size_t address_count = 0;
+
+	if (query_arg_long(connection, "since", 0, 0, LONG_MAX,
+			   &since_seconds) != EXIT_SUCCESS ||
+	    query_arg_long(connection, "limit", IP_PREFIX_DEFAULT_LIMIT, 0,
+			   IP_PREFIX_MAX_RESULTS, &limit) != EXIT_SUCCESS ||
+	    config->ip_prefix_tree == 0 ||
+	    ip_prefix_tree_lookup(config->ip_prefix_tree, *ip_prefix,
+				  since_from_seconds(since_seconds), &summary,
+				  &addresses, (size_t)limit,
+				  &address_count) != EXIT_SUCCESS) {
+		free(*ip_prefix);
+		*ip_prefix = 0;
+		free(addresses);
+		return finalise_response(connection, BAD_DATA_JSON,
+					 CONTENT_TYPE_JSON,
+					 MHD_HTTP_BAD_REQUEST, false);
+	}
+	free(*ip_prefix);
+	*ip_prefix = 0;
+
+	if (summary.address_count == 0) {
+		free(addresses);
+		return finalise_response(connection, NOT_FOUND_BAD_ACTORS_JSON,
+					 CONTENT_TYPE_JSON, MHD_HTTP_NOT_FOUND,
+					 false);
+	}
+
+	json_t *json_arr = json_array();
+	for (size_t i = 0; i < address_count; i++) {
+		json_array_append_new(json_arr,
+				      prefix_to_json("ip_address", &addresses[i],
+						     false));
+	}
+	free(addresses);
+
+	json_t *json_final_obj = prefix_to_json("ip_prefix", &summary, true);
+	json_object_set_new(json_final_obj, "ip_addresses", json_arr);
+	const char *reply = json_dumps(json_final_obj, JSON_INDENT(2));
+	json_decref(json_final_obj);
+
+	return finalise_response(connection, reply, CONTENT_TYPE_JSON,
+				 MHD_HTTP_OK, true);
+}
@@ -0,0 +1,266 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <microhttpd.h>
+#include "config.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "http_common.h"
+#include "http_routes.h"
+#include "ip_address_log.h"
+
+#define IPSET_BATCH 256
+#define IPSET_LINE_MAX (IP_PREFIX_STR_LEN + 128)
+#define IPSET_NAME_MAX 31
+#define IPSET_MAXELEM 16777216
+#define NFT_ELEMENTS_PER_LINE 1000
+#define NFT_TABLE "sentrypeer"
+
+// The document is written a batch of addresses at a time as libmicrohttpd
+// asks for more, so millions of addresses never sit in one buffer. The end
+// of the log is fixed when the request comes in, so what's sent is always
+// a consistent copy even while new addresses arrive.
+typedef struct ipset_stream ipset_stream;
+struct ipset_stream {
+	ip_address_log *log;
+	int family;
+	bool nft;
+	char name[IPSET_NAME_MAX + 1];
+	size_t position;
+	size_t end;
+	ip_address_log_address *prefixes; // Only if aggregated
+	size_t prefix_count;
+	size_t prefix_next;
+	size_t elements_in_line;
+	bool started;
+	bool finished;
+	char pending[IPSET_BATCH * IPSET_LINE_MAX];
+	size_t pending_len;
+	size_t pending_sent;
+};
+
+static void append(ipset_stream *stream, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int written = vsnprintf(stream->pending + stream->pending_len,
+				sizeof(stream->pending) - stream->pending_len,
+				format, args);
+	va_end(args);
+	assert(written > 0 &&
+	       (size_t)written < sizeof(stream->pending) - stream->pending_len);
+	stream->pending_len += (size_t)written;
+}
+
+static void render_header(ipset_stream *stream)
+{
+	bool v4 = stream->family == AF_INET;
+	if (stream->nft) {
+		append(stream, "add table inet " NFT_TABLE "\n");
+		append(stream,
+		       "add set inet " NFT_TABLE
+		       " %s { type %s; flags interval; auto-merge; }\n",
+		       stream->name, v4 ? "ipv4_addr" : "ipv6_addr");
+	} else {
+		// -exist so a delta can be restored on top of the set we
+		// sent last time without ipset stopping at the first clash
+		append(stream,
+		       "create %s hash:net family %s maxelem %d -exist\n",
+		       stream->name, v4 ? "inet" : "inet6", IPSET_MAXELEM);
+	}
+}
+
+static void render_address(ipset_stream *stream, const char *address)
+{
+	if (!stream->nft) {
+		append(stream, "add %s %s -exist\n", stream->name, address);
+		return;
+	}
+
+	if (stream->elements_in_line == 0) {
+		append(stream, "add element inet " NFT_TABLE " %s { %s",
+		       stream->name, address);
+	} else {
+		append(stream, ", %s", address);
+	}
+	if (++stream->elements_in_line == NFT_ELEMENTS_PER_LINE) {
+		append(stream, " }\n");
+		stream->elements_in_line = 0;
+	}
+}
+
+static void render_batch(ipset_stream *stream)
+{
+	stream->pending_len = 0;
+	stream->pending_sent = 0;
+
+	if (!stream->started) {
+		render_header(stream);
+		stream->started = true;
+	}
+
+	ip_address_log_address batch[IPSET_BATCH];
+	const ip_address_log_address *addresses = batch;
+	size_t count = 0;
+	if (stream->prefixes != 0) {
+		count = stream->prefix_count - stream->prefix_next;
+		if (count > IPSET_BATCH) {
+			count = IPSET_BATCH;
+		}
+		addresses = stream->prefixes + stream->prefix_next;
+		stream->prefix_next += count;
+	} else {
+		count = ip_address_log_copy(stream->log, stream->family,
+					    &stream->position, stream->end,
+					    batch, IPSET_BATCH);
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		render_address(stream, addresses[i].text);
+	}
+
+	if (count == 0) {
+		if (stream->nft && stream->elements_in_line > 0) {
+			append(stream, " }\n");
+		}
+		stream->finished = true;
+	}
+}
+
+static ssize_t ipset_reader(void *cls, uint64_t pos, char *buf, size_t max)
+{
+	(void)pos; /* unused */
+	ipset_stream *stream = cls;
+
+	while (stream->pending_sent == stream->pending_len) {
+		if (stream->finished) {
+			return MHD_CONTENT_READER_END_OF_STREAM;
+		}
+		render_batch(stream);
+	}
+
+	size_t len = stream->pending_len - stream->pending_sent;
+	if (len > max) {
+		len = max;
+	}
+	memcpy(buf, stream->pending + stream->pending_sent, len);
+	stream->pending_sent += len;
+
+	return (ssize_t)len;
+}
+
+static void ipset_stream_destroy(void *cls)
+{
+	ipset_stream *stream = cls;
+	free(stream->prefixes);
+	free(stream);
+}
+
+// Set names end up in a firewall, so only letters, digits, - and _
+static int valid_set_name(const char *name)
+{
+	size_t len = strlen(name);
+	if (len == 0 || len > IPSET_NAME_MAX ||
+	    strspn(name, "abcdefghijklmnopqrstuvwxyz"
+			 "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-") != len) {
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int ip_addresses_ipset_route(struct MHD_Connection *connection,
+			     sentrypeer_config const *config)
+{
+	long family = 4;
+	long since_seconds = 0;
+	long aggregate = 0;
+	const char *format = MHD_lookup_connection_value(
+		connection, MHD_GET_ARGUMENT_KIND, "format");
+	const char *name = MHD_lookup_connection_value(
+		connection, MHD_GET_ARGUMENT_KIND, "name");
+
+	if (query_arg_long(connection, "family", 4, 4, 6, &family) !=
+		    EXIT_SUCCESS ||
+	    family == 5 ||
+	    query_arg_long(connection, "since", 0, 0, LONG_MAX,
+			   &since_seconds) != EXIT_SUCCESS ||
+	    query_arg_long(connection, "aggregate", 0, 0, 1, &aggregate) !=
+		    EXIT_SUCCESS ||
+	    (format != NULL && strcmp(format, "ipset") != 0 &&
+	     strcmp(format, "nft") != 0) ||
+	    (name != NULL && valid_set_name(name) != EXIT_SUCCESS)) {
+		return finalise_response(connection, BAD_DATA_JSON,
+					 CONTENT_TYPE_JSON,
+					 MHD_HTTP_BAD_REQUEST, false);
+	}
+
+	if (config->ip_address_log == 0) {
+		return finalise_response(connection, NOT_FOUND_BAD_ACTORS_JSON,
+					 CONTENT_TYPE_JSON, MHD_HTTP_NOT_FOUND,
+					 false);
+	}
+
+	ipset_stream *stream = calloc(1, sizeof(ipset_stream));
+	assert(stream);
+	stream->log = config->ip_address_log;
+	stream->family = family == 4 ? AF_INET : AF_INET6;
+	stream->nft = format != NULL && strcmp(format, "nft") == 0;
+	snprintf(stream->name, sizeof(stream->name), "%s",
+		 name != NULL ? name :
+		 family == 4 ? "sentrypeer_v4" :
+			       "sentrypeer_v6");
+
+	// ?since= is how many seconds back to look
+	stream->end = ip_address_log_size(stream->log);
+	stream->position =
+		since_seconds > 0 ?
+			ip_address_log_position(stream->log,
+						time(NULL) - since_seconds) :
+			0;
+
+	if (aggregate &&
+	    ip_address_log_aggregate(stream->log, stream->family,
+				     stream->position, &stream->prefixes,
+				     &stream->prefix_count) != EXIT_SUCCESS) {
+		ipset_stream_destroy(stream);
+		return finalise_response(connection, BAD_DATA_JSON,
+					 CONTENT_TYPE_JSON,
+					 MHD_HTTP_BAD_REQUEST, false);
+	}
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Streaming %zu IP addresses as %s\n",
+			stream->end - stream->position,
+			stream->nft ? "nft" : "ipset");
+	}
+
+	struct MHD_Response *response = MHD_create_response_from_callback(
+		MHD_SIZE_UNKNOWN, sizeof(stream->pending), &ipset_reader,
+		stream, &ipset_stream_destroy);
+	if (response == NULL) {
+		ipset_stream_destroy(stream);
+		return MHD_NO;
+	}
+
+	return queue_response(connection, response, CONTENT_TYPE_TEXT,
+			      MHD_HTTP_OK);
+}
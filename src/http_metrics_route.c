@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+
+#include <microhttpd.h>
+#include "config.h"
+
+#include "http_common.h"
+#include "http_routes.h"
+#include "metrics.h"
+
+int metrics_route(struct MHD_Connection *connection,
+		  sentrypeer_config const *config)
+{
+	if (config->metrics == 0) {
+		return finalise_response(connection, NOT_FOUND_ERROR_JSON,
+					 CONTENT_TYPE_JSON, MHD_HTTP_NOT_FOUND,
+					 false);
+	}
+
+	// All the adding up happens here, so a scrape costs the capture
+	// threads nothing
+	return finalise_response(connection, metrics_render(config->metrics),
+				 CONTENT_TYPE_METRICS, MHD_HTTP_OK, true);
+}
@@ -68,6 +68,11 @@ enum MHD_Result route_handler(void *cls, struct MHD_Connection *connection,
 	log_http_client_ip(url, connection);
 	char *matched_ip_address = 0;
 	char *matched_phone_number = 0;
+	char *matched_ip_prefix = 0;
+	char *matched_user_agent = 0;
+	char *matched_sip_method = 0;
+	char *matched_country = 0;
+	char *matched_country_city = 0;
 
 	// TODO: Switch to a dispatch table or similar later as starting to hurt eyes.
 	if (route_check(url, HEALTH_CHECK_ROUTE, config) == EXIT_SUCCESS) {
@@ -79,6 +84,10 @@ enum MHD_Result route_handler(void *cls, struct MHD_Connection *connection,
 	} else if (route_check(url, IP_ADDRESSES_ROUTE, config) ==
 		   EXIT_SUCCESS) {
 		return ip_addresses_route(connection, config);
+	} else if (route_check(url, IP_ADDRESSES_IPSET_ROUTE, config) ==
+		   EXIT_SUCCESS) {
+		// Before IP_ADDRESS_ROUTE, which would match it too
+		return ip_addresses_ipset_route(connection, config);
 	} else if (regex_match(url, IP_ADDRESS_ROUTE, &matched_ip_address,
 			       config) == EXIT_SUCCESS) {
 		if (config->debug_mode || config->verbose_mode) {
@@ -97,10 +106,17 @@ enum MHD_Result route_handler(void *cls, struct MHD_Connection *connection,
 						 CONTENT_TYPE_JSON,
 						 MHD_HTTP_BAD_REQUEST, false);
 		}
-	} else if (route_check(url, IP_ADDRESSES_IPSET_ROUTE, config) ==
+	} else if (route_check(url, IP_PREFIXES_ROUTE, config) ==
 		   EXIT_SUCCESS) {
-		return finalise_response(connection, IP_ADDRESSES_IPSET_ROUTE,
-					 CONTENT_TYPE_HTML, MHD_HTTP_OK, false);
+		return ip_prefixes_route(connection, config);
+	} else if (regex_match(url, IP_PREFIX_ROUTE, &matched_ip_prefix,
+			       config) == EXIT_SUCCESS) {
+		if (config->debug_mode || config->verbose_mode) {
+			fprintf(stderr, "Matched ip prefix route: %s\n",
+				IP_PREFIX_ROUTE);
+		}
+
+		return ip_prefix_route(&matched_ip_prefix, connection, config);
 	} else if (route_check(url, NUMBERS_ROUTE, config) == EXIT_SUCCESS) {
 		return called_numbers_route(connection, config);
 	} else if (regex_match(url, NUMBER_ROUTE, &matched_phone_number,
@@ -113,29 +129,34 @@ enum MHD_Result route_handler(void *cls, struct MHD_Connection *connection,
 		return called_number_route(&matched_phone_number, connection,
 					   config);
 	} else if (route_check(url, COUNTRIES_ROUTE, config) == EXIT_SUCCESS) {
-		return finalise_response(connection, COUNTRIES_ROUTE,
-					 CONTENT_TYPE_HTML, MHD_HTTP_OK, false);
-	} else if (route_check(url, COUNTRY_ROUTE, config) == EXIT_SUCCESS) {
-		return finalise_response(connection, COUNTRY_ROUTE,
-					 CONTENT_TYPE_HTML, MHD_HTTP_OK, false);
-	} else if (route_check(url, COUNTRY_CITY_ROUTE, config) ==
-		   EXIT_SUCCESS) {
-		return finalise_response(connection, COUNTRY_CITY_ROUTE,
-					 CONTENT_TYPE_HTML, MHD_HTTP_OK, false);
+		return countries_route(connection, config);
+	} else if (regex_match(url, COUNTRY_ROUTE, &matched_country,
+			       config) == EXIT_SUCCESS) {
+		return country_route(&matched_country, connection, config);
+	} else if (regex_match(url, COUNTRY_CITY_ROUTE, &matched_country_city,
+			       config) == EXIT_SUCCESS) {
+		return country_city_route(&matched_country_city, connection,
+					  config);
 	} else if (route_check(url, USER_AGENTS_ROUTE, config) ==
 		   EXIT_SUCCESS) {
-		return finalise_response(connection, USER_AGENTS_ROUTE,
-					 CONTENT_TYPE_HTML, MHD_HTTP_OK, false);
-	} else if (route_check(url, USER_AGENT_ROUTE, config) == EXIT_SUCCESS) {
-		return finalise_response(connection, USER_AGENT_ROUTE,
-					 CONTENT_TYPE_HTML, MHD_HTTP_OK, false);
+		return user_agents_route(connection, config);
+	} else if (regex_match(url, USER_AGENT_ROUTE, &matched_user_agent,
+			       config) == EXIT_SUCCESS) {
+		return user_agent_route(&matched_user_agent, connection,
+					config);
 	} else if (route_check(url, SIP_METHODS_ROUTE, config) ==
 		   EXIT_SUCCESS) {
-		return finalise_response(connection, SIP_METHODS_ROUTE,
-					 CONTENT_TYPE_HTML, MHD_HTTP_OK, false);
-	} else if (route_check(url, SIP_METHOD_ROUTE, config) == EXIT_SUCCESS) {
-		return finalise_response(connection, SIP_METHOD_ROUTE,
-					 CONTENT_TYPE_HTML, MHD_HTTP_OK, false);
+		return sip_methods_route(connection, config);
+	} else if (regex_match(url, SIP_METHOD_ROUTE, &matched_sip_method,
+			       config) == EXIT_SUCCESS) {
+		return sip_method_route(&matched_sip_method, connection, config);
+	} else if (route_check(url, EVENTS_STREAM_ROUTE, config) ==
+		   EXIT_SUCCESS) {
+		return events_stream_route(connection, config);
+	} else if (route_check(url, METRICS_ROUTE, config) == EXIT_SUCCESS) {
+		return metrics_route(connection, config);
+	} else if (route_check(url, TIMESERIES_ROUTE, config) == EXIT_SUCCESS) {
+		return timeseries_route(connection, config);
 	} else {
 		if (config->debug_mode || config->verbose_mode) {
 			fprintf(stderr, "No route matched.\n");
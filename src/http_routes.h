@@ -20,16 +20,29 @@
 // ./tests/tools/pcre2demo "/ip-addresses/(.+)" "/ip-addresses/8.8.8.8"
 #define IP_ADDRESS_ROUTE "/ip-addresses/(.+)"
 #define IP_ADDRESSES_IPSET_ROUTE "/ip-addresses/ipset"
+// ?family=4|6&length=24&since=3600&limit=10
+#define IP_PREFIXES_ROUTE "/ip-prefixes"
+// /ip-prefixes/185.0.0.0/8?since=3600&limit=100
+#define IP_PREFIX_ROUTE "/ip-prefixes/(.+)"
 #define NUMBERS_ROUTE "/numbers"
 #define NUMBER_ROUTE                                                           \
 	"/numbers/(\\+?[0-9]+$)" // +441234567890 or 441234567890 etc
+// ?limit=10, needs SENTRYPEER_GEOIP_DB
 #define COUNTRIES_ROUTE "/countries"
-#define COUNTRY_ROUTE "/countries/:country"
-#define COUNTRY_CITY_ROUTE "/countries/:country/:city"
+// /countries/GB?limit=10 lists its cities, /countries/GB/London is one city
+#define COUNTRY_ROUTE "/countries/([A-Za-z]{2})$"
+#define COUNTRY_CITY_ROUTE "/countries/([A-Za-z]{2}/.+)"
+// ?limit=10
 #define USER_AGENTS_ROUTE "/user-agents"
-#define USER_AGENT_ROUTE "/user-agents/:user_agent"
+#define USER_AGENT_ROUTE "/user-agents/(.+)"
 #define SIP_METHODS_ROUTE "/sip-methods"
-#define SIP_METHOD_ROUTE "/sip-methods/:sip_method"
+#define SIP_METHOD_ROUTE "/sip-methods/(.+)"
+// Server-Sent Events, ?lag=skip|close
+#define EVENTS_STREAM_ROUTE "/events/stream"
+// Prometheus
+#define METRICS_ROUTE "/metrics"
+// ?from=&to=&step= in unix seconds, step a multiple of 60
+#define TIMESERIES_ROUTE "/stats/timeseries"
 
 #include <microhttpd.h>
 #include "conf.h"
@@ -46,6 +59,36 @@ int ip_addresses_route(struct MHD_Connection *connection,
 		       sentrypeer_config const *config);
 int ip_address_route(char **ip_address, struct MHD_Connection *connection,
 		     sentrypeer_config const *config);
+int ip_addresses_ipset_route(struct MHD_Connection *connection,
+			     sentrypeer_config const *config);
+int ip_prefixes_route(struct MHD_Connection *connection,
+		      sentrypeer_config const *config);
+int ip_prefix_route(char **ip_prefix, struct MHD_Connection *connection,
+		    sentrypeer_config const *config);
+int user_agents_route(struct MHD_Connection *connection,
+		      sentrypeer_config const *config);
+int user_agent_route(char **user_agent, struct MHD_Connection *connection,
+		     sentrypeer_config const *config);
+int sip_methods_route(struct MHD_Connection *connection,
+		      sentrypeer_config const *config);
+int sip_method_route(char **sip_method, struct MHD_Connection *connection,
+		     sentrypeer_config const *config);
+int countries_route(struct MHD_Connection *connection,
+		    sentrypeer_config const *config);
+int country_route(char **country_code, struct MHD_Connection *connection,
+		  sentrypeer_config const *config);
+int country_city_route(char **country_city, struct MHD_Connection *connection,
+		       sentrypeer_config const *config);
+int events_stream_route(struct MHD_Connection *connection,
+			sentrypeer_config const *config);
+// The thread that resumes /events/stream subscribers, started before the
+// daemon and stopped, closing config->event_stream, before it is
+int events_fan_out_start(sentrypeer_config const *config);
+void events_fan_out_stop(sentrypeer_config const *config);
+int metrics_route(struct MHD_Connection *connection,
+		  sentrypeer_config const *config);
+int timeseries_route(struct MHD_Connection *connection,
+		     sentrypeer_config const *config);
 int called_numbers_route(struct MHD_Connection *connection,
 			 sentrypeer_config const *config);
 int called_number_route(char **phone_number, struct MHD_Connection *connection,
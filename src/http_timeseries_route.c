@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <microhttpd.h>
+#include <jansson.h>
+#include "config.h"
+
+#include "http_common.h"
+#include "http_routes.h"
+#include "event_series.h"
+
+#include <time.h>
+
+#define TIMESERIES_DEFAULT_RANGE 3600
+
+static void count_into(json_t *obj, const char *name, uint64_t count)
+{
+	json_t *total = json_object_get(obj, name);
+	json_object_set_new(obj, name,
+			    json_integer((total ? json_integer_value(total) : 0) +
+					 (json_int_t)count));
+}
+
+static json_t *point_to_json(const event_series_range *range,
+			     const event_series_point *point,
+			     json_int_t *events_total)
+{
+	json_t *methods = json_object();
+	json_t *transport_types = json_object();
+	json_t *collected_methods = json_object();
+	json_int_t count = 0;
+
+	for (size_t key = 0; key < range->key_count; key++) {
+		if (point->counts[key] == 0) {
+			continue;
+		}
+		count += (json_int_t)point->counts[key];
+		count_into(methods, range->keys[key].method,
+			   point->counts[key]);
+		count_into(transport_types, range->keys[key].transport_type,
+			   point->counts[key]);
+		count_into(collected_methods,
+			   range->keys[key].collected_method,
+			   point->counts[key]);
+	}
+	*events_total += count;
+
+	return json_pack("{s:I,s:I,s:o,s:o,s:o}", "time",
+			 (json_int_t)point->time, "count", count, "method",
+			 methods, "transport_type", transport_types,
+			 "collected_method", collected_methods);
+}
+
+// Answered from the minute and hour buckets in config->event_series, never
+// the honey table
+int timeseries_route(struct MHD_Connection *connection,
+		     sentrypeer_config const *config)
+{
+	time_t now = time(NULL);
+	int64_t to = 0;
+	int64_t from = 0;
+	long step = 0;
+	if (query_arg_int64(connection, "to", now, &to) != EXIT_SUCCESS ||
+	    query_arg_int64(connection, "from",
+			    to > TIMESERIES_DEFAULT_RANGE ?
+				    to - TIMESERIES_DEFAULT_RANGE :
+				    0,
+			    &from) != EXIT_SUCCESS ||
+	    query_arg_long(connection, "step", EVENT_SERIES_MINUTE,
+			   EVENT_SERIES_MINUTE,
+			   (long)EVENT_SERIES_HOURS * EVENT_SERIES_HOUR,
+			   &step) != EXIT_SUCCESS ||
+	    step % EVENT_SERIES_MINUTE != 0) {
+		return finalise_response(connection, BAD_DATA_JSON,
+					 CONTENT_TYPE_JSON,
+					 MHD_HTTP_BAD_REQUEST, false);
+	}
+
+	// Minute buckets only go back so far, ask for a step in hours
+	// before that
+	if (step % EVENT_SERIES_HOUR != 0 &&
+	    from < now - (int64_t)EVENT_SERIES_MINUTES * EVENT_SERIES_MINUTE) {
+		return finalise_response(connection, BAD_DATA_JSON,
+					 CONTENT_TYPE_JSON,
+					 MHD_HTTP_BAD_REQUEST, false);
+	}
+
+	// Nothing is counted after the current step or before the oldest
+	// hour bucket, so don't go looking
+	if (to > now - now % step + step) {
+		to = now - now % step + step;
+	}
+	if (from < now - (int64_t)EVENT_SERIES_HOURS * EVENT_SERIES_HOUR) {
+		from = now - (int64_t)EVENT_SERIES_HOURS * EVENT_SERIES_HOUR;
+	}
+
+	if (config->event_series == 0) {
+		return finalise_response(connection, NOT_FOUND_ERROR_JSON,
+					 CONTENT_TYPE_JSON, MHD_HTTP_NOT_FOUND,
+					 false);
+	}
+
+	// NULL for to before from, or too many points
+	event_series_range *range = event_series_query(
+		config->event_series, (time_t)from, (time_t)to, (time_t)step);
+	if (range == 0) {
+		return finalise_response(connection, BAD_DATA_JSON,
+					 CONTENT_TYPE_JSON,
+					 MHD_HTTP_BAD_REQUEST, false);
+	}
+
+	json_int_t events_total = 0;
+	json_t *json_arr = json_array();
+	for (size_t i = 0; i < range->point_count; i++) {
+		json_array_append_new(json_arr,
+				      point_to_json(range, &range->points[i],
+						    &events_total));
+	}
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Time series of %zu buckets, %lld events\n",
+			range->point_count, (long long)events_total);
+	}
+
+	json_t *json_final_obj = json_pack(
+		"{s:I,s:I,s:I,s:i,s:I,s:o}", "from", (json_int_t)from, "to",
+		(json_int_t)to, "step", (json_int_t)step, "resolution",
+		range->resolution, "events_total", events_total, "buckets",
+		json_arr);
+	event_series_range_destroy(&range);
+	const char *reply = json_dumps(json_final_obj, JSON_INDENT(2));
+	json_decref(json_final_obj);
+
+	return finalise_response(connection, reply, CONTENT_TYPE_JSON,
+				 MHD_HTTP_OK, true);
+}
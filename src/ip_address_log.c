@@ -0,0 +1,575 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "ip_address_log.h"
+#include "utils.h"
+
+#define NO_ENTRY ((uint32_t)-1)
+#define INITIAL_CAPACITY 1024
+
+typedef struct ip_log_entry ip_log_entry;
+struct ip_log_entry {
+	time_t seen_first;
+	uint32_t text_offset; // Into text[], not NUL terminated
+	uint8_t text_len;
+	uint8_t family;
+};
+
+// Sorted addresses of one family from the start of the log up to upto, and
+// the CIDRs they made, so the next aggregate only sorts what's new
+typedef struct aggregate_cache aggregate_cache;
+struct aggregate_cache {
+	uint8_t (*keys)[IP_PREFIX_KEY_LEN];
+	size_t key_count;
+	size_t upto;
+	ip_address_log_address *prefixes;
+	size_t prefix_count;
+	bool prefixes_valid;
+};
+
+struct ip_address_log {
+	pthread_rwlock_t lock;
+	ip_log_entry *entries;
+	size_t count;
+	size_t capacity;
+	char *text;
+	size_t text_len;
+	size_t text_capacity;
+	uint32_t *index; // Open addressing on util_hash64() of the text
+	size_t index_mask;
+	bool sorted;
+
+	pthread_mutex_t aggregate_mutex;
+	aggregate_cache v4;
+	aggregate_cache v6;
+};
+
+// 128 bit unsigned, for walking IPv6 ranges
+typedef struct u128 u128;
+struct u128 {
+	uint64_t hi;
+	uint64_t lo;
+};
+
+ip_address_log *ip_address_log_new(void)
+{
+	ip_address_log *self = calloc(1, sizeof(ip_address_log));
+	assert(self);
+
+	self->capacity = INITIAL_CAPACITY;
+	self->entries = malloc(self->capacity * sizeof(ip_log_entry));
+	self->text_capacity = INITIAL_CAPACITY * 16;
+	self->text = malloc(self->text_capacity);
+	self->index = malloc(self->capacity * 2 * sizeof(uint32_t));
+	assert(self->entries && self->text && self->index);
+	memset(self->index, 0xff, self->capacity * 2 * sizeof(uint32_t));
+	self->index_mask = self->capacity * 2 - 1;
+
+	if (pthread_rwlock_init(&self->lock, NULL) != EXIT_SUCCESS ||
+	    pthread_mutex_init(&self->aggregate_mutex, NULL) != EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to init ip_address_log locks\n");
+		free(self->entries);
+		free(self->text);
+		free(self->index);
+		free(self);
+		return NULL;
+	}
+
+	return self;
+}
+
+static void aggregate_cache_clear(aggregate_cache *cache)
+{
+	free(cache->keys);
+	free(cache->prefixes);
+	memset(cache, 0, sizeof(aggregate_cache));
+}
+
+void ip_address_log_destroy(ip_address_log **self_ptr)
+{
+	assert(self_ptr);
+	if (*self_ptr) {
+		ip_address_log *self = *self_ptr;
+		free(self->entries);
+		free(self->text);
+		free(self->index);
+		aggregate_cache_clear(&self->v4);
+		aggregate_cache_clear(&self->v6);
+		pthread_rwlock_destroy(&self->lock);
+		pthread_mutex_destroy(&self->aggregate_mutex);
+		free(self);
+		*self_ptr = 0;
+	}
+}
+
+static uint64_t entry_hash(const ip_address_log *self, const ip_log_entry *entry)
+{
+	return util_hash64(self->text + entry->text_offset, entry->text_len);
+}
+
+static void index_add(ip_address_log *self, uint32_t entry_index,
+		      uint64_t hash)
+{
+	size_t slot = hash & self->index_mask;
+	while (self->index[slot] != NO_ENTRY) {
+		slot = (slot + 1) & self->index_mask;
+	}
+	self->index[slot] = entry_index;
+}
+
+static void index_rebuild(ip_address_log *self, size_t slot_count)
+{
+	free(self->index);
+	self->index = malloc(slot_count * sizeof(uint32_t));
+	assert(self->index);
+	memset(self->index, 0xff, slot_count * sizeof(uint32_t));
+	self->index_mask = slot_count - 1;
+	for (size_t i = 0; i < self->count; i++) {
+		index_add(self, (uint32_t)i,
+			  entry_hash(self, &self->entries[i]));
+	}
+}
+
+static uint32_t index_find(const ip_address_log *self, const char *text,
+			   size_t len, uint64_t hash)
+{
+	for (size_t slot = hash & self->index_mask;
+	     self->index[slot] != NO_ENTRY;
+	     slot = (slot + 1) & self->index_mask) {
+		const ip_log_entry *entry = &self->entries[self->index[slot]];
+		if (entry->text_len == len &&
+		    memcmp(self->text + entry->text_offset, text, len) == 0) {
+			return self->index[slot];
+		}
+	}
+
+	return NO_ENTRY;
+}
+
+// One spelling per address, so 2001:DB8:0::1 and 2001:db8::1 are only
+// logged once. IPv4-mapped IPv6 addresses from dual stack sockets are
+// written as plain IPv4, as that's the family their traffic arrives on.
+static void canonical_text(const uint8_t *key, char *text)
+{
+	static const uint8_t v4_mapped[IP_PREFIX_V4_MAPPED_LEN / 8] = {
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff
+	};
+
+	if (memcmp(key, v4_mapped, sizeof(v4_mapped)) == 0) {
+		inet_ntop(AF_INET, key + sizeof(v4_mapped), text,
+			  IP_PREFIX_STR_LEN);
+	} else {
+		inet_ntop(AF_INET6, key, text, IP_PREFIX_STR_LEN);
+	}
+}
+
+int ip_address_log_add(ip_address_log *self, const char *ip_address,
+		       time_t seen_first)
+{
+	uint8_t key[IP_PREFIX_KEY_LEN];
+	int prefix_len = 0;
+	if (ip_address == 0 ||
+	    ip_prefix_parse(ip_address, key, &prefix_len) != EXIT_SUCCESS ||
+	    prefix_len != IP_PREFIX_MAX_LEN) {
+		return EXIT_FAILURE;
+	}
+	char canonical[IP_PREFIX_STR_LEN];
+	canonical_text(key, canonical);
+	ip_address = canonical;
+	size_t len = strlen(ip_address);
+	uint64_t hash = util_hash64(ip_address, len);
+
+	pthread_rwlock_wrlock(&self->lock);
+
+	uint32_t found = index_find(self, ip_address, len, hash);
+	if (found != NO_ENTRY) {
+		if (seen_first < self->entries[found].seen_first) {
+			self->entries[found].seen_first = seen_first;
+		}
+		pthread_rwlock_unlock(&self->lock);
+		return EXIT_SUCCESS;
+	}
+
+	// Keep seen_first in order even if the clock steps back, once loading
+	// from the database has finished
+	if (self->sorted && self->count > 0 &&
+	    seen_first < self->entries[self->count - 1].seen_first) {
+		seen_first = self->entries[self->count - 1].seen_first;
+	}
+
+	if (self->count == self->capacity) {
+		self->capacity *= 2;
+		self->entries = realloc(self->entries,
+					self->capacity * sizeof(ip_log_entry));
+		assert(self->entries);
+		index_rebuild(self, self->capacity * 2);
+	}
+	if (self->text_len + len > self->text_capacity) {
+		while (self->text_len + len > self->text_capacity) {
+			self->text_capacity *= 2;
+		}
+		self->text = realloc(self->text, self->text_capacity);
+		assert(self->text);
+	}
+
+	ip_log_entry *entry = &self->entries[self->count];
+	entry->seen_first = seen_first;
+	entry->text_offset = (uint32_t)self->text_len;
+	entry->text_len = (uint8_t)len;
+	entry->family = strchr(ip_address, ':') == 0 ? 4 : 6;
+	memcpy(self->text + self->text_len, ip_address, len);
+	self->text_len += len;
+	index_add(self, (uint32_t)self->count, hash);
+	self->count++;
+
+	pthread_rwlock_unlock(&self->lock);
+
+	return EXIT_SUCCESS;
+}
+
+static int compare_seen_first(const void *a, const void *b)
+{
+	const ip_log_entry *entry_a = a;
+	const ip_log_entry *entry_b = b;
+
+	if (entry_a->seen_first != entry_b->seen_first) {
+		return entry_a->seen_first < entry_b->seen_first ? -1 : 1;
+	}
+
+	// Same second, keep the order they were added in
+	return entry_a->text_offset < entry_b->text_offset ? -1 : 1;
+}
+
+void ip_address_log_sort(ip_address_log *self)
+{
+	pthread_rwlock_wrlock(&self->lock);
+	qsort(self->entries, self->count, sizeof(ip_log_entry),
+	      compare_seen_first);
+	index_rebuild(self, self->capacity * 2);
+	self->sorted = true;
+	pthread_rwlock_unlock(&self->lock);
+
+	// Positions have moved
+	pthread_mutex_lock(&self->aggregate_mutex);
+	aggregate_cache_clear(&self->v4);
+	aggregate_cache_clear(&self->v6);
+	pthread_mutex_unlock(&self->aggregate_mutex);
+}
+
+size_t ip_address_log_size(ip_address_log *self)
+{
+	pthread_rwlock_rdlock(&self->lock);
+	size_t count = self->count;
+	pthread_rwlock_unlock(&self->lock);
+
+	return count;
+}
+
+size_t ip_address_log_position(ip_address_log *self, time_t since)
+{
+	pthread_rwlock_rdlock(&self->lock);
+	size_t low = 0;
+	size_t high = self->count;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (self->entries[middle].seen_first < since) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	pthread_rwlock_unlock(&self->lock);
+
+	return low;
+}
+
+static int family_number(int family)
+{
+	return family == AF_INET ? 4 : family == AF_INET6 ? 6 : 0;
+}
+
+size_t ip_address_log_copy(ip_address_log *self, int family, size_t *position,
+			   size_t end, ip_address_log_address *addresses,
+			   size_t max_addresses)
+{
+	int wanted = family_number(family);
+	size_t copied = 0;
+
+	pthread_rwlock_rdlock(&self->lock);
+	if (end > self->count) {
+		end = self->count;
+	}
+	size_t i = *position;
+	for (; i < end && copied < max_addresses; i++) {
+		const ip_log_entry *entry = &self->entries[i];
+		if (entry->family != wanted) {
+			continue;
+		}
+		memcpy(addresses[copied].text, self->text + entry->text_offset,
+		       entry->text_len);
+		addresses[copied].text[entry->text_len] = '\0';
+		copied++;
+	}
+	pthread_rwlock_unlock(&self->lock);
+	*position = i;
+
+	return copied;
+}
+
+static int compare_keys(const void *a, const void *b)
+{
+	return memcmp(a, b, IP_PREFIX_KEY_LEN);
+}
+
+// Keys of one family from start to the end of the log, sorted
+static size_t collect_keys(ip_address_log *self, int wanted, size_t start,
+			   uint8_t (**keys)[IP_PREFIX_KEY_LEN], size_t *upto)
+{
+	pthread_rwlock_rdlock(&self->lock);
+	size_t end = self->count;
+	*keys = malloc((end > start ? end - start : 1) * IP_PREFIX_KEY_LEN);
+	assert(*keys);
+	size_t key_count = 0;
+	for (size_t i = start; i < end; i++) {
+		const ip_log_entry *entry = &self->entries[i];
+		if (entry->family != wanted) {
+			continue;
+		}
+		char text[IP_PREFIX_STR_LEN];
+		memcpy(text, self->text + entry->text_offset, entry->text_len);
+		text[entry->text_len] = '\0';
+		int prefix_len = 0;
+		ip_prefix_parse(text, (*keys)[key_count++], &prefix_len);
+	}
+	pthread_rwlock_unlock(&self->lock);
+
+	qsort(*keys, key_count, IP_PREFIX_KEY_LEN, compare_keys);
+	*upto = end;
+
+	return key_count;
+}
+
+static u128 u128_from_key(const uint8_t *key)
+{
+	u128 value = { 0, 0 };
+	for (int i = 0; i < 8; i++) {
+		value.hi = (value.hi << 8) | key[i];
+		value.lo = (value.lo << 8) | key[i + 8];
+	}
+
+	return value;
+}
+
+static void u128_to_key(u128 value, uint8_t *key)
+{
+	for (int i = 7; i >= 0; i--) {
+		key[i] = (uint8_t)value.hi;
+		key[i + 8] = (uint8_t)value.lo;
+		value.hi >>= 8;
+		value.lo >>= 8;
+	}
+}
+
+static bool u128_equal(u128 a, u128 b)
+{
+	return a.hi == b.hi && a.lo == b.lo;
+}
+
+static bool u128_less_or_equal(u128 a, u128 b)
+{
+	return a.hi < b.hi || (a.hi == b.hi && a.lo <= b.lo);
+}
+
+static u128 u128_add_one(u128 value)
+{
+	value.lo++;
+	if (value.lo == 0) {
+		value.hi++;
+	}
+
+	return value;
+}
+
+// The low bits set, i.e. the host part of a /(128 - bits)
+static u128 u128_low_mask(int bits)
+{
+	u128 mask = { 0, 0 };
+	if (bits >= 64) {
+		mask.lo = UINT64_MAX;
+		mask.hi = bits == 128 ? UINT64_MAX : (UINT64_C(1) << (bits - 64)) - 1;
+	} else {
+		mask.lo = (UINT64_C(1) << bits) - 1;
+	}
+
+	return mask;
+}
+
+static int u128_trailing_zeros(u128 value)
+{
+	if (value.lo != 0) {
+		return __builtin_ctzll(value.lo);
+	}
+	if (value.hi != 0) {
+		return 64 + __builtin_ctzll(value.hi);
+	}
+
+	return 128;
+}
+
+static void prefix_to_text(u128 start, int prefix_len, bool v4,
+			   ip_address_log_address *prefix)
+{
+	uint8_t key[IP_PREFIX_KEY_LEN];
+	u128_to_key(start, key);
+
+	char address[INET6_ADDRSTRLEN];
+	if (v4) {
+		inet_ntop(AF_INET, key + IP_PREFIX_V4_MAPPED_LEN / 8, address,
+			  sizeof(address));
+		prefix_len -= IP_PREFIX_V4_MAPPED_LEN;
+	} else {
+		inet_ntop(AF_INET6, key, address, sizeof(address));
+	}
+
+	if (prefix_len == (v4 ? 32 : IP_PREFIX_MAX_LEN)) {
+		snprintf(prefix->text, sizeof(prefix->text), "%s", address);
+	} else {
+		snprintf(prefix->text, sizeof(prefix->text), "%s/%d", address,
+			 prefix_len);
+	}
+}
+
+// Runs of consecutive addresses, each split into the fewest aligned CIDRs
+static size_t keys_to_prefixes(uint8_t (*keys)[IP_PREFIX_KEY_LEN],
+			       size_t key_count, bool v4,
+			       ip_address_log_address **prefixes)
+{
+	// Never more CIDRs than addresses, usually far fewer
+	*prefixes = malloc((key_count ? key_count : 1) *
+			   sizeof(ip_address_log_address));
+	assert(*prefixes);
+	size_t prefix_count = 0;
+
+	size_t i = 0;
+	while (i < key_count) {
+		u128 first = u128_from_key(keys[i]);
+		u128 last = first;
+		for (i++; i < key_count; i++) {
+			u128 next = u128_from_key(keys[i]);
+			if (!u128_equal(next, u128_add_one(last))) {
+				break;
+			}
+			last = next;
+		}
+
+		for (;;) {
+			int bits = u128_trailing_zeros(first);
+			u128 block_end;
+			for (;;) {
+				u128 mask = u128_low_mask(bits);
+				block_end.hi = first.hi | mask.hi;
+				block_end.lo = first.lo | mask.lo;
+				if (u128_less_or_equal(block_end, last)) {
+					break;
+				}
+				bits--;
+			}
+			prefix_to_text(first, IP_PREFIX_MAX_LEN - bits, v4,
+				       &(*prefixes)[prefix_count++]);
+			if (u128_equal(block_end, last)) {
+				break;
+			}
+			first = u128_add_one(block_end);
+		}
+	}
+
+	return prefix_count;
+}
+
+int ip_address_log_aggregate(ip_address_log *self, int family, size_t start,
+			     ip_address_log_address **prefixes,
+			     size_t *prefix_count)
+{
+	int wanted = family_number(family);
+	if (wanted == 0) {
+		return EXIT_FAILURE;
+	}
+
+	size_t upto = 0;
+	uint8_t(*keys)[IP_PREFIX_KEY_LEN] = 0;
+	if (start > 0) {
+		// A delta, small compared to the whole log
+		size_t key_count = collect_keys(self, wanted, start, &keys, &upto);
+		*prefix_count = keys_to_prefixes(keys, key_count, wanted == 4,
+						 prefixes);
+		free(keys);
+		return EXIT_SUCCESS;
+	}
+
+	pthread_mutex_lock(&self->aggregate_mutex);
+	aggregate_cache *cache = wanted == 4 ? &self->v4 : &self->v6;
+
+	// Sort what's new, then merge it with what we sorted last time
+	size_t key_count =
+		collect_keys(self, wanted, cache->upto, &keys, &upto);
+	if (key_count > 0 || !cache->prefixes_valid) {
+		uint8_t(*merged)[IP_PREFIX_KEY_LEN] =
+			malloc((cache->key_count + key_count + 1) *
+			       IP_PREFIX_KEY_LEN);
+		assert(merged);
+		size_t a = 0;
+		size_t b = 0;
+		size_t m = 0;
+		while (a < cache->key_count || b < key_count) {
+			if (b == key_count ||
+			    (a < cache->key_count &&
+			     compare_keys(cache->keys[a], keys[b]) < 0)) {
+				memcpy(merged[m++], cache->keys[a++],
+				       IP_PREFIX_KEY_LEN);
+			} else {
+				memcpy(merged[m++], keys[b++],
+				       IP_PREFIX_KEY_LEN);
+			}
+		}
+		free(cache->keys);
+		cache->keys = merged;
+		cache->key_count = m;
+
+		free(cache->prefixes);
+		cache->prefix_count =
+			keys_to_prefixes(cache->keys, cache->key_count,
+					 wanted == 4, &cache->prefixes);
+		cache->prefixes_valid = true;
+	}
+	cache->upto = upto;
+	free(keys);
+
+	*prefix_count = cache->prefix_count;
+	*prefixes = malloc((cache->prefix_count ? cache->prefix_count : 1) *
+			   sizeof(ip_address_log_address));
+	assert(*prefixes);
+	memcpy(*prefixes, cache->prefixes,
+	       cache->prefix_count * sizeof(ip_address_log_address));
+	pthread_mutex_unlock(&self->aggregate_mutex);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#ifndef SENTRYPEER_IP_ADDRESS_LOG_H
+#define SENTRYPEER_IP_ADDRESS_LOG_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "ip_prefix_tree.h"
+
+// Every distinct source IP once, in the order we first saw them. It only
+// ever grows at the end, so a position in it is a cursor: whatever is
+// after it is new, and a copy up to a position never changes.
+typedef struct ip_address_log ip_address_log;
+
+typedef struct ip_address_log_address ip_address_log_address;
+struct ip_address_log_address {
+	char text[IP_PREFIX_STR_LEN]; // An address, or a CIDR once aggregated
+};
+
+//  Constructor
+ip_address_log *ip_address_log_new(void);
+
+//  Destructor
+void ip_address_log_destroy(ip_address_log **self_ptr);
+
+/**
+ * Add an address if we've not seen it before. It's kept as inet_ntop()
+ * writes it, with IPv4-mapped IPv6 addresses as IPv4, so each address is
+ * only in the log once however it was spelt.
+ *
+ * @param self The log.
+ * @param ip_address The source IP.
+ * @param seen_first When it was first seen. Only loading from the
+ *                   database adds older ones, see ip_address_log_sort().
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if ip_address doesn't parse.
+ */
+int ip_address_log_add(ip_address_log *self, const char *ip_address,
+		       time_t seen_first);
+
+// Put the log back in seen_first order after loading
+void ip_address_log_sort(ip_address_log *self);
+
+/**
+ * @return How many addresses are in the log, i.e. the newest position.
+ */
+size_t ip_address_log_size(ip_address_log *self);
+
+/**
+ * The first position with an address seen at or after since.
+ *
+ * @param self The log.
+ * @param since 0 for the start of the log.
+ * @return A position, ip_address_log_size() if there are none.
+ */
+size_t ip_address_log_position(ip_address_log *self, time_t since);
+
+/**
+ * Copy addresses of one family out of the log, a batch at a time.
+ *
+ * @param self The log.
+ * @param family AF_INET or AF_INET6.
+ * @param position Where to start, moved on past what was copied.
+ * @param end Stop here, e.g. ip_address_log_size() when the copying began.
+ * @param addresses Where to copy to.
+ * @param max_addresses Room in addresses.
+ * @return How many were copied, 0 once position reaches end.
+ */
+size_t ip_address_log_copy(ip_address_log *self, int family, size_t *position,
+			   size_t end, ip_address_log_address *addresses,
+			   size_t max_addresses);
+
+/**
+ * Addresses of one family merged into as few CIDRs as cover exactly the
+ * same addresses, e.g. 10.0.0.0 to 10.0.0.255 is 10.0.0.0/24.
+ *
+ * From the start of the log this keeps what it sorted last time and only
+ * sorts what has been added since.
+ *
+ * @param self The log.
+ * @param family AF_INET or AF_INET6.
+ * @param start A position, e.g. from ip_address_log_position().
+ * @param prefixes Set to the CIDRs in address order, free() them.
+ * @param prefix_count Set to the number in prefixes.
+ * @return EXIT_SUCCESS or EXIT_FAILURE on bad arguments.
+ */
+int ip_address_log_aggregate(ip_address_log *self, int family, size_t start,
+			     ip_address_log_address **prefixes,
+			     size_t *prefix_count);
+
+#endif //SENTRYPEER_IP_ADDRESS_LOG_H
@@ -0,0 +1,601 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+
+#include "ip_prefix_tree.h"
+#include "bad_actor.h"
+#include "database.h"
+#include "utils.h"
+
+typedef struct ip_prefix_node ip_prefix_node;
+struct ip_prefix_node {
+	uint8_t key[IP_PREFIX_KEY_LEN];
+	int prefix_len; // IP_PREFIX_MAX_LEN for an address we've seen
+	uint64_t seen_count; // Events under here
+	uint64_t address_count; // Addresses under here
+	time_t seen_last; // Newest event under here
+	ip_prefix_node *child[2]; // Both set on anything but an address
+};
+
+struct ip_prefix_tree {
+	ip_prefix_node *root;
+	pthread_rwlock_t lock;
+};
+
+static const uint8_t v4_mapped_prefix[IP_PREFIX_V4_MAPPED_LEN / 8] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff
+};
+
+ip_prefix_tree *ip_prefix_tree_new(void)
+{
+	ip_prefix_tree *self = calloc(1, sizeof(ip_prefix_tree));
+	assert(self);
+
+	if (pthread_rwlock_init(&self->lock, NULL) != EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to init ip_prefix_tree lock\n");
+		free(self);
+		return NULL;
+	}
+
+	return self;
+}
+
+static void node_destroy(ip_prefix_node *node)
+{
+	if (node == 0) {
+		return;
+	}
+	node_destroy(node->child[0]);
+	node_destroy(node->child[1]);
+	free(node);
+}
+
+void ip_prefix_tree_destroy(ip_prefix_tree **self_ptr)
+{
+	assert(self_ptr);
+	if (*self_ptr) {
+		ip_prefix_tree *self = *self_ptr;
+		node_destroy(self->root);
+		pthread_rwlock_destroy(&self->lock);
+		free(self);
+		*self_ptr = 0;
+	}
+}
+
+static int key_bit(const uint8_t *key, int bit)
+{
+	return (key[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+// How many leading bits a and b share, up to max_bits
+static int common_prefix_len(const uint8_t *a, const uint8_t *b, int max_bits)
+{
+	int bits = 0;
+	for (int i = 0; i < IP_PREFIX_KEY_LEN && bits < max_bits; i++) {
+		uint8_t diff = a[i] ^ b[i];
+		if (diff != 0) {
+			bits += __builtin_clz(diff) - 24;
+			break;
+		}
+		bits += 8;
+	}
+
+	return bits < max_bits ? bits : max_bits;
+}
+
+static void mask_key(const uint8_t *key, int prefix_len, uint8_t *masked)
+{
+	memset(masked, 0, IP_PREFIX_KEY_LEN);
+	memcpy(masked, key, prefix_len / 8);
+	if (prefix_len % 8 != 0) {
+		masked[prefix_len / 8] =
+			key[prefix_len / 8] & (0xff << (8 - prefix_len % 8));
+	}
+}
+
+static bool is_v4_mapped(const uint8_t *key, int prefix_len)
+{
+	return prefix_len >= IP_PREFIX_V4_MAPPED_LEN &&
+	       memcmp(key, v4_mapped_prefix, sizeof(v4_mapped_prefix)) == 0;
+}
+
+// 185.0.0.0/8 or 2001:db8::/32, or without the length for an address
+static void format_prefix(const uint8_t *key, int prefix_len, char *out)
+{
+	uint8_t masked[IP_PREFIX_KEY_LEN];
+	mask_key(key, prefix_len, masked);
+
+	bool v4 = is_v4_mapped(masked, prefix_len);
+	char address[INET6_ADDRSTRLEN];
+	inet_ntop(v4 ? AF_INET : AF_INET6,
+		  v4 ? masked + IP_PREFIX_V4_MAPPED_LEN / 8 : masked, address,
+		  sizeof(address));
+
+	if (prefix_len == IP_PREFIX_MAX_LEN) {
+		snprintf(out, IP_PREFIX_STR_LEN, "%s", address);
+	} else {
+		snprintf(out, IP_PREFIX_STR_LEN, "%s/%d", address,
+			 v4 ? prefix_len - IP_PREFIX_V4_MAPPED_LEN :
+			      prefix_len);
+	}
+}
+
+int ip_prefix_parse(const char *text, uint8_t key[IP_PREFIX_KEY_LEN],
+		    int *prefix_len)
+{
+	char address[INET6_ADDRSTRLEN];
+	const char *slash = strchr(text, '/');
+	size_t address_len = slash ? (size_t)(slash - text) : strlen(text);
+	if (address_len == 0 || address_len >= sizeof(address)) {
+		return EXIT_FAILURE;
+	}
+	memcpy(address, text, address_len);
+	address[address_len] = '\0';
+
+	int max_len = 0;
+	int offset = 0;
+	memset(key, 0, IP_PREFIX_KEY_LEN);
+	if (inet_pton(AF_INET, address,
+		      key + IP_PREFIX_V4_MAPPED_LEN / 8) == 1) {
+		memcpy(key, v4_mapped_prefix, sizeof(v4_mapped_prefix));
+		max_len = 32;
+		offset = IP_PREFIX_V4_MAPPED_LEN;
+	} else if (inet_pton(AF_INET6, address, key) == 1) {
+		max_len = IP_PREFIX_MAX_LEN;
+	} else {
+		return EXIT_FAILURE;
+	}
+
+	int len = max_len;
+	if (slash != 0) {
+		char *end = 0;
+		long parsed = strtol(slash + 1, &end, 10);
+		if (slash[1] == '\0' || *end != '\0' || parsed < 0 ||
+		    parsed > max_len) {
+			return EXIT_FAILURE;
+		}
+		len = (int)parsed;
+	}
+	*prefix_len = len + offset;
+
+	return EXIT_SUCCESS;
+}
+
+static ip_prefix_node *node_new(const uint8_t *key, int prefix_len)
+{
+	ip_prefix_node *node = calloc(1, sizeof(ip_prefix_node));
+	assert(node);
+	mask_key(key, prefix_len, node->key);
+	node->prefix_len = prefix_len;
+
+	return node;
+}
+
+static void node_count(ip_prefix_node *node, time_t seen_last,
+		       uint64_t seen_count, bool new_address)
+{
+	node->seen_count += seen_count;
+	if (new_address) {
+		node->address_count++;
+	}
+	if (seen_last > node->seen_last) {
+		node->seen_last = seen_last;
+	}
+}
+
+int ip_prefix_tree_insert(ip_prefix_tree *self, const char *ip_address,
+			  time_t seen_last, uint64_t seen_count)
+{
+	uint8_t key[IP_PREFIX_KEY_LEN];
+	int prefix_len = 0;
+	if (ip_address == 0 ||
+	    ip_prefix_parse(ip_address, key, &prefix_len) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+	// A single address only, we don't count events against a CIDR
+	if (prefix_len != IP_PREFIX_MAX_LEN) {
+		return EXIT_FAILURE;
+	}
+
+	pthread_rwlock_wrlock(&self->lock);
+
+	// Find out first if this is a new address, as every node on the way
+	// down counts it
+	bool new_address = true;
+	for (const ip_prefix_node *node = self->root; node != 0;) {
+		if (common_prefix_len(node->key, key, node->prefix_len) <
+		    node->prefix_len) {
+			break;
+		}
+		if (node->prefix_len == IP_PREFIX_MAX_LEN) {
+			new_address = false;
+			break;
+		}
+		node = node->child[key_bit(key, node->prefix_len)];
+	}
+
+	ip_prefix_node **slot = &self->root;
+	while (*slot != 0) {
+		ip_prefix_node *node = *slot;
+		int common = common_prefix_len(node->key, key, node->prefix_len);
+
+		if (common < node->prefix_len) {
+			// Splits off here, so a new branch with this node and
+			// the new address under it
+			ip_prefix_node *branch = node_new(key, common);
+			ip_prefix_node *leaf = node_new(key, IP_PREFIX_MAX_LEN);
+			node_count(leaf, seen_last, seen_count, true);
+
+			int bit = key_bit(key, common);
+			branch->child[bit] = leaf;
+			branch->child[!bit] = node;
+			branch->seen_count = node->seen_count + seen_count;
+			branch->address_count = node->address_count + 1;
+			branch->seen_last = node->seen_last > seen_last ?
+						    node->seen_last :
+						    seen_last;
+			*slot = branch;
+
+			pthread_rwlock_unlock(&self->lock);
+			return EXIT_SUCCESS;
+		}
+
+		node_count(node, seen_last, seen_count, new_address);
+		if (node->prefix_len == IP_PREFIX_MAX_LEN) {
+			pthread_rwlock_unlock(&self->lock);
+			return EXIT_SUCCESS;
+		}
+		slot = &node->child[key_bit(key, node->prefix_len)];
+	}
+
+	// Empty tree
+	*slot = node_new(key, IP_PREFIX_MAX_LEN);
+	node_count(*slot, seen_last, seen_count, true);
+
+	pthread_rwlock_unlock(&self->lock);
+	return EXIT_SUCCESS;
+}
+
+int ip_prefix_tree_load(ip_prefix_tree *self, sentrypeer_config const *config)
+{
+	bad_actor **bad_actors = 0;
+	int64_t row_count = 0;
+
+	if (db_select_bad_actors(&bad_actors, &row_count, config) !=
+	    EXIT_SUCCESS) {
+		// Nothing logged yet
+		bad_actors_destroy(bad_actors, &row_count);
+		free(bad_actors);
+		return EXIT_SUCCESS;
+	}
+
+	for (int64_t i = 0; i < row_count; i++) {
+		const bad_actor *row = bad_actors[i];
+		uint64_t seen_count =
+			row->seen_count ? strtoull(row->seen_count, NULL, 10) :
+					  1;
+		if (ip_prefix_tree_insert(self, row->source_ip,
+					  util_parse_event_timestamp(row->seen_last),
+					  seen_count) != EXIT_SUCCESS &&
+		    (config->debug_mode || config->verbose_mode)) {
+			fprintf(stderr, "Skipping unparsable source_ip: %s\n",
+				row->source_ip);
+		}
+	}
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Loaded %" PRId64 " IP addresses into index\n",
+			row_count);
+	}
+
+	bad_actors_destroy(bad_actors, &row_count);
+	free(bad_actors);
+
+	return EXIT_SUCCESS;
+}
+
+static void stats_from_node(const ip_prefix_node *node, int prefix_len,
+			    ip_prefix_stats *stats)
+{
+	format_prefix(node->key, prefix_len, stats->prefix);
+	stats->seen_count = node->seen_count;
+	stats->address_count = node->address_count;
+	stats->seen_last = node->seen_last;
+}
+
+// The node holding everything in key/prefix_len, or NULL
+static const ip_prefix_node *find_covering(const ip_prefix_tree *self,
+					   const uint8_t *key, int prefix_len)
+{
+	const ip_prefix_node *node = self->root;
+	while (node != 0) {
+		int bits = node->prefix_len < prefix_len ? node->prefix_len :
+							   prefix_len;
+		if (common_prefix_len(node->key, key, bits) < bits) {
+			return NULL;
+		}
+		if (node->prefix_len >= prefix_len) {
+			return node;
+		}
+		node = node->child[key_bit(key, node->prefix_len)];
+	}
+
+	return NULL;
+}
+
+static void collect_addresses(const ip_prefix_node *node, time_t since,
+			      ip_prefix_stats *summary,
+			      ip_prefix_stats *addresses, size_t max_addresses,
+			      size_t *address_count)
+{
+	if (node == 0 || node->seen_last < since) {
+		return;
+	}
+
+	if (node->prefix_len == IP_PREFIX_MAX_LEN) {
+		summary->seen_count += node->seen_count;
+		summary->address_count++;
+		if (node->seen_last > summary->seen_last) {
+			summary->seen_last = node->seen_last;
+		}
+		if (*address_count < max_addresses) {
+			stats_from_node(node, IP_PREFIX_MAX_LEN,
+					&addresses[*address_count]);
+			(*address_count)++;
+		}
+		return;
+	}
+
+	// With no time filter the counts are already on the node, so only
+	// go as far as we need for the address list
+	if (since == 0 && *address_count >= max_addresses) {
+		return;
+	}
+
+	collect_addresses(node->child[0], since, summary, addresses,
+			  max_addresses, address_count);
+	collect_addresses(node->child[1], since, summary, addresses,
+			  max_addresses, address_count);
+}
+
+int ip_prefix_tree_lookup(ip_prefix_tree *self, const char *cidr, time_t since,
+			  ip_prefix_stats *summary, ip_prefix_stats **addresses,
+			  size_t max_addresses, size_t *address_count)
+{
+	uint8_t key[IP_PREFIX_KEY_LEN];
+	int prefix_len = 0;
+	if (ip_prefix_parse(cidr, key, &prefix_len) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	memset(summary, 0, sizeof(ip_prefix_stats));
+	format_prefix(key, prefix_len, summary->prefix);
+	*address_count = 0;
+	*addresses = calloc(max_addresses ? max_addresses : 1,
+			    sizeof(ip_prefix_stats));
+	assert(*addresses);
+
+	pthread_rwlock_rdlock(&self->lock);
+	const ip_prefix_node *node = find_covering(self, key, prefix_len);
+	collect_addresses(node, since, summary, *addresses, max_addresses,
+			  address_count);
+	if (node != 0 && since == 0) {
+		summary->seen_count = node->seen_count;
+		summary->address_count = node->address_count;
+		summary->seen_last = node->seen_last;
+	}
+	pthread_rwlock_unlock(&self->lock);
+
+	return EXIT_SUCCESS;
+}
+
+// A prefix_len bucket, with its counts as they're reported
+typedef struct top_entry {
+	const ip_prefix_node *node;
+	uint64_t seen_count;
+	uint64_t address_count;
+	time_t seen_last;
+} top_entry;
+
+// Min-heap on seen_count, so the root is the one to drop when full
+typedef struct top_heap {
+	top_entry *entries;
+	size_t count;
+	size_t limit;
+} top_heap;
+
+static void heap_swap(top_heap *heap, size_t a, size_t b)
+{
+	top_entry tmp = heap->entries[a];
+	heap->entries[a] = heap->entries[b];
+	heap->entries[b] = tmp;
+}
+
+static void heap_sift_down(top_heap *heap, size_t i)
+{
+	for (;;) {
+		size_t smallest = i;
+		size_t left = 2 * i + 1;
+		size_t right = left + 1;
+		if (left < heap->count &&
+		    heap->entries[left].seen_count <
+			    heap->entries[smallest].seen_count) {
+			smallest = left;
+		}
+		if (right < heap->count &&
+		    heap->entries[right].seen_count <
+			    heap->entries[smallest].seen_count) {
+			smallest = right;
+		}
+		if (smallest == i) {
+			return;
+		}
+		heap_swap(heap, i, smallest);
+		i = smallest;
+	}
+}
+
+static void heap_offer(top_heap *heap, const top_entry *entry)
+{
+	if (heap->count < heap->limit) {
+		size_t i = heap->count++;
+		heap->entries[i] = *entry;
+		while (i > 0 && heap->entries[(i - 1) / 2].seen_count >
+					heap->entries[i].seen_count) {
+			heap_swap(heap, i, (i - 1) / 2);
+			i = (i - 1) / 2;
+		}
+	} else if (entry->seen_count > heap->entries[0].seen_count) {
+		heap->entries[0] = *entry;
+		heap_sift_down(heap, 0);
+	}
+}
+
+// An IPv6 prefix short enough to cover ::ffff:0:0/96 has every IPv4
+// address under it too, so only count the subtrees hanging off the way
+// down to v4, the node holding them
+static void entry_without_v4(const ip_prefix_node *node,
+			     const ip_prefix_node *v4, top_entry *entry)
+{
+	entry->node = node;
+	if (v4 == 0 || node == v4 || node->prefix_len >= v4->prefix_len ||
+	    common_prefix_len(node->key, v4->key, node->prefix_len) <
+		    node->prefix_len) {
+		entry->seen_count = node->seen_count;
+		entry->address_count = node->address_count;
+		entry->seen_last = node->seen_last;
+		return;
+	}
+
+	entry->seen_count = 0;
+	entry->address_count = 0;
+	entry->seen_last = 0;
+	for (const ip_prefix_node *on_path = node; on_path != v4;) {
+		int bit = key_bit(v4->key, on_path->prefix_len);
+		const ip_prefix_node *other = on_path->child[!bit];
+		entry->seen_count += other->seen_count;
+		entry->address_count += other->address_count;
+		if (other->seen_last > entry->seen_last) {
+			entry->seen_last = other->seen_last;
+		}
+		on_path = on_path->child[bit];
+	}
+}
+
+// Every prefix_len bucket is exactly one subtree: the first node at or
+// below prefix_len on each path. v4 is only set for AF_INET6.
+static void collect_top(const ip_prefix_node *node, int family,
+			int prefix_len, const ip_prefix_node *v4,
+			top_heap *heap)
+{
+	if (node == 0) {
+		return;
+	}
+	if (family == AF_INET6 && is_v4_mapped(node->key, node->prefix_len)) {
+		return;
+	}
+
+	// Nothing under here can beat what we've got
+	if (heap->count == heap->limit &&
+	    node->seen_count <= heap->entries[0].seen_count) {
+		return;
+	}
+
+	if (node->prefix_len >= prefix_len) {
+		top_entry entry;
+		entry_without_v4(node, v4, &entry);
+		if (entry.address_count > 0) {
+			heap_offer(heap, &entry);
+		}
+		return;
+	}
+
+	// Busiest side first, so the heap fills up with the likely winners
+	// and the check above can skip more
+	int first = node->child[1]->seen_count > node->child[0]->seen_count;
+	collect_top(node->child[first], family, prefix_len, v4, heap);
+	collect_top(node->child[!first], family, prefix_len, v4, heap);
+}
+
+static int compare_seen_count(const void *a, const void *b)
+{
+	const ip_prefix_stats *stats_a = a;
+	const ip_prefix_stats *stats_b = b;
+
+	if (stats_a->seen_count != stats_b->seen_count) {
+		return stats_a->seen_count < stats_b->seen_count ? 1 : -1;
+	}
+
+	return strcmp(stats_a->prefix, stats_b->prefix);
+}
+
+int ip_prefix_tree_top(ip_prefix_tree *self, int family, int prefix_len,
+		       ip_prefix_stats **top, size_t limit, size_t *top_count)
+{
+	int tree_prefix_len = 0;
+	if (family == AF_INET && prefix_len >= 0 && prefix_len <= 32) {
+		tree_prefix_len = prefix_len + IP_PREFIX_V4_MAPPED_LEN;
+	} else if (family == AF_INET6 && prefix_len >= 0 &&
+		   prefix_len <= IP_PREFIX_MAX_LEN) {
+		tree_prefix_len = prefix_len;
+	} else {
+		return EXIT_FAILURE;
+	}
+	if (limit == 0 || limit > IP_PREFIX_MAX_RESULTS) {
+		return EXIT_FAILURE;
+	}
+
+	top_heap heap = { .entries = calloc(limit, sizeof(top_entry)),
+			  .count = 0,
+			  .limit = limit };
+	assert(heap.entries);
+	*top = calloc(limit, sizeof(ip_prefix_stats));
+	assert(*top);
+
+	uint8_t v4_key[IP_PREFIX_KEY_LEN] = { 0 };
+	memcpy(v4_key, v4_mapped_prefix, sizeof(v4_mapped_prefix));
+
+	pthread_rwlock_rdlock(&self->lock);
+	const ip_prefix_node *v4 =
+		find_covering(self, v4_key, IP_PREFIX_V4_MAPPED_LEN);
+	if (family == AF_INET) {
+		collect_top(v4, family, tree_prefix_len, 0, &heap);
+	} else {
+		collect_top(self->root, family, tree_prefix_len, v4, &heap);
+	}
+
+	for (size_t i = 0; i < heap.count; i++) {
+		const top_entry *entry = &heap.entries[i];
+		format_prefix(entry->node->key, tree_prefix_len,
+			      (*top)[i].prefix);
+		(*top)[i].seen_count = entry->seen_count;
+		(*top)[i].address_count = entry->address_count;
+		(*top)[i].seen_last = entry->seen_last;
+	}
+	pthread_rwlock_unlock(&self->lock);
+
+	*top_count = heap.count;
+	qsort(*top, *top_count, sizeof(ip_prefix_stats), compare_seen_count);
+	free(heap.entries);
+
+	return EXIT_SUCCESS;
+}
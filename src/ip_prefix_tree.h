@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#ifndef SENTRYPEER_IP_PREFIX_TREE_H
+#define SENTRYPEER_IP_PREFIX_TREE_H 1
+
+#include <arpa/inet.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "conf.h"
+
+// IPv4 addresses are stored as IPv4-mapped IPv6, ::ffff:a.b.c.d
+#define IP_PREFIX_KEY_LEN 16
+#define IP_PREFIX_MAX_LEN 128
+#define IP_PREFIX_V4_MAPPED_LEN 96
+// "ffff:...:ffff/128"
+#define IP_PREFIX_STR_LEN (INET6_ADDRSTRLEN + 4)
+#define IP_PREFIX_MAX_RESULTS 1000
+
+// A compressed binary radix (Patricia) tree of every source IP we've seen.
+// Each node knows how many events and addresses are under it and when the
+// newest of them was seen, so a CIDR question is a walk down to the node
+// that covers it.
+typedef struct ip_prefix_tree ip_prefix_tree;
+
+typedef struct ip_prefix_stats ip_prefix_stats;
+struct ip_prefix_stats {
+	char prefix[IP_PREFIX_STR_LEN];
+	uint64_t seen_count;
+	uint64_t address_count;
+	time_t seen_last;
+};
+
+//  Constructor
+ip_prefix_tree *ip_prefix_tree_new(void);
+
+//  Destructor
+void ip_prefix_tree_destroy(ip_prefix_tree **self_ptr);
+
+/**
+ * Parse "185.0.0.0/8", "2001:db8::/32" or a bare address (a /32 or /128).
+ *
+ * @param text The address or CIDR.
+ * @param key Set to the (mapped) address.
+ * @param prefix_len Set to the prefix length in IPv6 bits.
+ * @return EXIT_SUCCESS or EXIT_FAILURE if it's not an address.
+ */
+int ip_prefix_parse(const char *text, uint8_t key[IP_PREFIX_KEY_LEN],
+		    int *prefix_len);
+
+/**
+ * Count events from an address.
+ *
+ * @param self The tree.
+ * @param ip_address The source IP.
+ * @param seen_last When the newest of the events was.
+ * @param seen_count How many events.
+ * @return EXIT_SUCCESS or EXIT_FAILURE if ip_address doesn't parse.
+ */
+int ip_prefix_tree_insert(ip_prefix_tree *self, const char *ip_address,
+			  time_t seen_last, uint64_t seen_count);
+
+/**
+ * Fill the tree from every source IP in the database (all partitions).
+ *
+ * @param self The tree.
+ * @param config Our config.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int ip_prefix_tree_load(ip_prefix_tree *self, sentrypeer_config const *config);
+
+/**
+ * Everything we've seen in a CIDR.
+ *
+ * @param self The tree.
+ * @param cidr e.g. "185.0.0.0/8".
+ * @param since Only addresses seen at or after this, 0 for all. Their
+ *              seen_count is still for all time.
+ * @param summary Totals for the included addresses.
+ * @param addresses Set to up to max_addresses addresses, free() them.
+ * @param max_addresses Limit on addresses, they're in address order.
+ * @param address_count Set to the number in addresses.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if cidr doesn't parse.
+ */
+int ip_prefix_tree_lookup(ip_prefix_tree *self, const char *cidr, time_t since,
+			  ip_prefix_stats *summary, ip_prefix_stats **addresses,
+			  size_t max_addresses, size_t *address_count);
+
+/**
+ * Busiest prefixes of a given length, e.g. the top /24s, by event count.
+ * The counts are for all time, as that's what each node keeps. IPv6
+ * prefixes leave out the IPv4 addresses, ::ffff:0:0/96.
+ *
+ * @param self The tree.
+ * @param family AF_INET or AF_INET6.
+ * @param prefix_len Length in the family's own bits, so 24 for a /24.
+ * @param top Set to up to limit prefixes, busiest first, free() them.
+ * @param limit How many to return.
+ * @param top_count Set to the number in top.
+ * @return EXIT_SUCCESS or EXIT_FAILURE on bad arguments.
+ */
+int ip_prefix_tree_top(ip_prefix_tree *self, int family, int prefix_len,
+		       ip_prefix_stats **top, size_t limit, size_t *top_count);
+
+#endif //SENTRYPEER_IP_PREFIX_TREE_H
@@ -11,6 +11,8 @@
                              |___/
 */
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <jansson.h>
 #include <string.h>
@@ -25,8 +27,6 @@
 #include "sentrypeer_rust.h"
 #endif
 
-#define BAD_ACTOR_JSON_FMT                                                     \
-	"{s:s,s:s,s:s,s:s,s:s,s:s,s:s,s:s,s:s,s:s,s:s,s:s,s:s}"
 #define AUTH0_CLIENT_CREDS_JSON_FMT "{s:s,s:s,s:s,s:s}"
 #define AUTH0_MAX_BEARER_TOKEN_LEN 4096
 #define SENTRYPEER_USERAGENT "SentryPeer/1.0"
@@ -234,73 +234,725 @@ static int get_and_set_oauth2_bearer_token(sentrypeer_config *config,
 	return EXIT_SUCCESS;
 }
 
-char *bad_actor_to_json(const sentrypeer_config *config,
-			const bad_actor *bad_actor_to_convert)
+void json_buffer_init(json_buffer *self)
 {
-	json_error_t error;
-	json_t *json_bad_actor =
-		json_pack(BAD_ACTOR_JSON_FMT, "app_name", PACKAGE_NAME,
-			  "app_version", PACKAGE_VERSION, "event_timestamp",
-			  bad_actor_to_convert->event_timestamp ?
-				  bad_actor_to_convert->event_timestamp :
-				  "",
-			  "event_uuid",
-			  bad_actor_to_convert->event_uuid ?
-				  bad_actor_to_convert->event_uuid :
-				  "",
-			  "created_by_node_id",
-			  bad_actor_to_convert->created_by_node_id ?
-				  bad_actor_to_convert->created_by_node_id :
-				  "",
-			  "collected_method",
-			  bad_actor_to_convert->collected_method ?
-				  bad_actor_to_convert->collected_method :
-				  "",
-			  "transport_type",
-			  bad_actor_to_convert->transport_type ?
-				  bad_actor_to_convert->transport_type :
-				  "",
-			  "source_ip",
-			  bad_actor_to_convert->source_ip ?
-				  bad_actor_to_convert->source_ip :
-				  "",
-			  "destination_ip",
-			  bad_actor_to_convert->destination_ip ?
-				  bad_actor_to_convert->destination_ip :
-				  "",
-			  "called_number",
-			  bad_actor_to_convert->called_number ?
-				  bad_actor_to_convert->called_number :
-				  "",
-			  "sip_method",
-			  bad_actor_to_convert->method ?
-				  bad_actor_to_convert->method :
-				  "",
-			  "sip_user_agent",
-			  bad_actor_to_convert->user_agent ?
-				  bad_actor_to_convert->user_agent :
-				  "",
-			  "sip_message",
-			  bad_actor_to_convert->sip_message ?
-				  bad_actor_to_convert->sip_message :
-				  "",
-			  &error);
-	if (!json_bad_actor) {
-		fprintf(stderr, "Error creating json log object: %s\n",
-			error.text);
-		return NULL;
+	self->data = self->storage;
+	self->capacity = sizeof(self->storage);
+	json_buffer_reset(self);
+}
+
+void json_buffer_reset(json_buffer *self)
+{
+	self->len = 0;
+	self->data[0] = '\0';
+}
+
+void json_buffer_release(json_buffer *self)
+{
+	if (self->data != self->storage) {
+		free(self->data);
+	}
+	json_buffer_init(self);
+}
+
+// Always leaves room for the '\0'
+static void json_buffer_reserve(json_buffer *self, size_t extra)
+{
+	if (self->len + extra < self->capacity) {
+		return;
+	}
+
+	size_t capacity = self->capacity * 2;
+	while (capacity <= self->len + extra) {
+		capacity *= 2;
+	}
+
+	char *data = 0;
+	if (self->data == self->storage) {
+		data = malloc(capacity);
+		assert(data);
+		memcpy(data, self->storage, self->len);
+	} else {
+		data = realloc(self->data, capacity);
+		assert(data);
+	}
+	self->data = data;
+	self->capacity = capacity;
+}
+
+static void json_buffer_append(json_buffer *self, const void *data,
+			       size_t len)
+{
+	json_buffer_reserve(self, len);
+	memcpy(self->data + self->len, data, len);
+	self->len += len;
+}
+
+#define BYTES_ONES (~(uint64_t)0 / 255)
+#define BYTES_HIGH_BITS (BYTES_ONES * 0x80)
+
+// Whether any of the 8 bytes in word is a control character, '"', '\\' or
+// not ASCII. Can also be true for the bytes after one that is, but never
+// when none are, which is all the fast path needs.
+static bool json_word_needs_a_look(uint64_t word)
+{
+	uint64_t quotes = word ^ (BYTES_ONES * '"');
+	uint64_t backslashes = word ^ (BYTES_ONES * '\\');
+
+	return ((word - BYTES_ONES * 0x20) | (quotes - BYTES_ONES) |
+		(backslashes - BYTES_ONES) | word) &
+	       BYTES_HIGH_BITS;
+}
+
+// How many bytes the UTF-8 character at pos takes, or 0 if it isn't valid,
+// checked the way jansson does so we turn down the same strings
+static size_t json_utf8_len(const unsigned char *pos,
+			    const unsigned char *end)
+{
+	size_t size = 0;
+	uint32_t value = 0;
+	if (*pos >= 0xC2 && *pos <= 0xDF) {
+		size = 2;
+		value = *pos & 0x1F;
+	} else if (*pos >= 0xE0 && *pos <= 0xEF) {
+		size = 3;
+		value = *pos & 0x0F;
+	} else if (*pos >= 0xF0 && *pos <= 0xF4) {
+		size = 4;
+		value = *pos & 0x07;
+	} else {
+		return 0;
+	}
+
+	if ((size_t)(end - pos) < size) {
+		return 0;
+	}
+	for (size_t i = 1; i < size; i++) {
+		if ((pos[i] & 0xC0) != 0x80) {
+			return 0;
+		}
+		value = (value << 6) | (pos[i] & 0x3F);
+	}
+
+	// Overlong, a surrogate or past the end of Unicode
+	if ((size == 3 && value < 0x800) || (size == 4 && value < 0x10000) ||
+	    (value >= 0xD800 && value <= 0xDFFF) || value > 0x10FFFF) {
+		return 0;
+	}
+
+	return size;
+}
+
+// Escapes as json_dumps() does: '"', '\\' and control characters only,
+// leaving '/' and UTF-8 as they are. Runs with nothing to escape, which
+// is nearly all of a SIP message, are skipped 8 bytes at a time and copied
+// in one go.
+static int json_buffer_append_string(json_buffer *self, const char *string)
+{
+	size_t len = strlen(string);
+	json_buffer_reserve(self, len + 2);
+	self->data[self->len++] = '"';
+
+	const unsigned char *pos = (const unsigned char *)string;
+	const unsigned char *end = pos + len;
+	const unsigned char *run = pos;
+	while (pos < end) {
+		while (end - pos >= 8) {
+			uint64_t word;
+			memcpy(&word, pos, sizeof(word));
+			if (json_word_needs_a_look(word)) {
+				break;
+			}
+			pos += 8;
+		}
+		if (pos == end) {
+			break;
+		}
+
+		if (*pos >= 0x80) {
+			size_t utf8_len = json_utf8_len(pos, end);
+			if (utf8_len == 0) {
+				return EXIT_FAILURE;
+			}
+			pos += utf8_len;
+			continue;
+		}
+		if (*pos >= 0x20 && *pos != '"' && *pos != '\\') {
+			pos++;
+			continue;
+		}
+
+		json_buffer_append(self, run, pos - run);
+		char escaped[8];
+		switch (*pos) {
+		case '"':
+			json_buffer_append(self, "\\\"", 2);
+			break;
+		case '\\':
+			json_buffer_append(self, "\\\\", 2);
+			break;
+		case '\b':
+			json_buffer_append(self, "\\b", 2);
+			break;
+		case '\f':
+			json_buffer_append(self, "\\f", 2);
+			break;
+		case '\n':
+			json_buffer_append(self, "\\n", 2);
+			break;
+		case '\r':
+			json_buffer_append(self, "\\r", 2);
+			break;
+		case '\t':
+			json_buffer_append(self, "\\t", 2);
+			break;
+		default:
+			snprintf(escaped, sizeof(escaped), "\\u%04X", *pos);
+			json_buffer_append(self, escaped, 6);
+			break;
+		}
+		pos++;
+		run = pos;
+	}
+	json_buffer_append(self, run, pos - run);
+	json_buffer_append(self, "\"", 1);
+
+	return EXIT_SUCCESS;
+}
+
+// Each key with what comes before it, in the order json_pack() used to
+// write them
+static const char *const bad_actor_json_keys[] = {
+	"{\"app_name\":",	      ",\"app_version\":",
+	",\"event_timestamp\":",      ",\"event_uuid\":",
+	",\"created_by_node_id\":",   ",\"collected_method\":",
+	",\"transport_type\":",	      ",\"source_ip\":",
+	",\"destination_ip\":",	      ",\"called_number\":",
+	",\"sip_method\":",	      ",\"sip_user_agent\":",
+	",\"sip_message\":"
+};
+
+int bad_actor_json_write(const bad_actor *bad_actor_to_convert,
+			 json_buffer *buffer)
+{
+	const char *values[] = {
+		PACKAGE_NAME,
+		PACKAGE_VERSION,
+		bad_actor_to_convert->event_timestamp,
+		bad_actor_to_convert->event_uuid,
+		bad_actor_to_convert->created_by_node_id,
+		bad_actor_to_convert->collected_method,
+		bad_actor_to_convert->transport_type,
+		bad_actor_to_convert->source_ip,
+		bad_actor_to_convert->destination_ip,
+		bad_actor_to_convert->called_number,
+		bad_actor_to_convert->method,
+		bad_actor_to_convert->user_agent,
+		bad_actor_to_convert->sip_message
+	};
+	json_buffer_reset(buffer);
+	for (size_t i = 0; i < sizeof(values) / sizeof(*values); i++) {
+		json_buffer_append(buffer, bad_actor_json_keys[i],
+				   strlen(bad_actor_json_keys[i]));
+		if (json_buffer_append_string(buffer, values[i] ? values[i] :
+								  "") !=
+		    EXIT_SUCCESS) {
+			json_buffer_reset(buffer);
+			return EXIT_FAILURE;
+		}
+	}
+	json_buffer_append(buffer, "}", 1);
+	buffer->data[buffer->len] = '\0';
+
+	return EXIT_SUCCESS;
+}
+
+const char *bad_actor_json_once(const sentrypeer_config *config,
+				const bad_actor *bad_actor_to_convert,
+				json_buffer *buffer)
+{
+	if (buffer->len > 0) {
+		return buffer->data;
 	}
 
-	char *json_string = json_dumps(json_bad_actor, JSON_COMPACT);
-	json_decref(json_bad_actor);
+	if (bad_actor_json_write(bad_actor_to_convert, buffer) !=
+	    EXIT_SUCCESS) {
+		fprintf(stderr,
+			"Error creating json log object: Invalid UTF-8 string\n");
+		return NULL;
+	}
 
 	if (config->debug_mode || config->verbose_mode) {
-		fprintf(stderr, "Bad actor in JSON format: %s\n", json_string);
+		fprintf(stderr, "Bad actor in JSON format: %s\n", buffer->data);
 	}
 
+	return buffer->data;
+}
+
+char *bad_actor_to_json(const sentrypeer_config *config,
+			const bad_actor *bad_actor_to_convert)
+{
+	json_buffer buffer;
+	json_buffer_init(&buffer);
+
+	const char *json = bad_actor_json_once(config, bad_actor_to_convert,
+					       &buffer);
+	char *json_string = json ? util_duplicate_string(json) : NULL;
+	json_buffer_release(&buffer);
+
 	return json_string; // Caller must free
 }
 
+// jansson's default, so we nest no deeper than it would
+#define JSON_READER_MAX_DEPTH 2048
+
+// Decodes into out, which never needs more room than the json it's
+// reading, as escapes only ever get shorter
+typedef struct json_reader json_reader;
+struct json_reader {
+	const unsigned char *pos;
+	const unsigned char *end;
+	char *out;
+	const char *error;
+};
+
+static void json_reader_skip_whitespace(json_reader *self)
+{
+	while (self->pos < self->end &&
+	       (*self->pos == ' ' || *self->pos == '\t' || *self->pos == '\n' ||
+		*self->pos == '\r')) {
+		self->pos++;
+	}
+}
+
+// Takes the expected character if it's next
+static bool json_reader_take(json_reader *self, unsigned char expected)
+{
+	json_reader_skip_whitespace(self);
+	if (self->pos < self->end && *self->pos == expected) {
+		self->pos++;
+		return true;
+	}
+	return false;
+}
+
+static int json_reader_fail(json_reader *self, const char *error)
+{
+	if (self->error == 0) {
+		self->error = error;
+	}
+	return EXIT_FAILURE;
+}
+
+static int json_reader_hex4(json_reader *self, uint32_t *value)
+{
+	if (self->end - self->pos < 4) {
+		return json_reader_fail(self, "Truncated \\u escape");
+	}
+
+	*value = 0;
+	for (int i = 0; i < 4; i++) {
+		unsigned char c = *self->pos++;
+		*value <<= 4;
+		if (c >= '0' && c <= '9') {
+			*value |= c - '0';
+		} else if (c >= 'a' && c <= 'f') {
+			*value |= c - 'a' + 10;
+		} else if (c >= 'A' && c <= 'F') {
+			*value |= c - 'A' + 10;
+		} else {
+			return json_reader_fail(self, "Invalid \\u escape");
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+static int json_reader_unicode_escape(json_reader *self)
+{
+	uint32_t value = 0;
+	if (json_reader_hex4(self, &value) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	if (value >= 0xD800 && value <= 0xDBFF) {
+		uint32_t low = 0;
+		if (self->end - self->pos < 2 || self->pos[0] != '\\' ||
+		    self->pos[1] != 'u') {
+			return json_reader_fail(self, "Invalid Unicode escape");
+		}
+		self->pos += 2;
+		if (json_reader_hex4(self, &low) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+		if (low < 0xDC00 || low > 0xDFFF) {
+			return json_reader_fail(self, "Invalid Unicode escape");
+		}
+		value = 0x10000 + ((value - 0xD800) << 10) + (low - 0xDC00);
+	} else if (value >= 0xDC00 && value <= 0xDFFF) {
+		return json_reader_fail(self, "Invalid Unicode escape");
+	} else if (value == 0) {
+		return json_reader_fail(self, "\\u0000 is not allowed");
+	}
+
+	char *out = self->out;
+	if (value < 0x80) {
+		*out++ = (char)value;
+	} else if (value < 0x800) {
+		*out++ = (char)(0xC0 | (value >> 6));
+		*out++ = (char)(0x80 | (value & 0x3F));
+	} else if (value < 0x10000) {
+		*out++ = (char)(0xE0 | (value >> 12));
+		*out++ = (char)(0x80 | ((value >> 6) & 0x3F));
+		*out++ = (char)(0x80 | (value & 0x3F));
+	} else {
+		*out++ = (char)(0xF0 | (value >> 18));
+		*out++ = (char)(0x80 | ((value >> 12) & 0x3F));
+		*out++ = (char)(0x80 | ((value >> 6) & 0x3F));
+		*out++ = (char)(0x80 | (value & 0x3F));
+	}
+	self->out = out;
+
+	return EXIT_SUCCESS;
+}
+
+// Decodes the string at pos onto the end of out, with a '\0'. Plain runs
+// are found 8 bytes at a time, as when writing, and copied in one go.
+static int json_reader_string(json_reader *self, char **value)
+{
+	if (!json_reader_take(self, '"')) {
+		return json_reader_fail(self, "Expected a string");
+	}
+
+	*value = self->out;
+	const unsigned char *run = self->pos;
+	while (true) {
+		while (self->end - self->pos >= 8) {
+			uint64_t word;
+			memcpy(&word, self->pos, sizeof(word));
+			if (json_word_needs_a_look(word)) {
+				break;
+			}
+			self->pos += 8;
+		}
+		if (self->pos == self->end) {
+			return json_reader_fail(self, "Unterminated string");
+		}
+
+		unsigned char c = *self->pos;
+		if (c >= 0x80) {
+			size_t utf8_len = json_utf8_len(self->pos, self->end);
+			if (utf8_len == 0) {
+				return json_reader_fail(self,
+							"Invalid UTF-8 string");
+			}
+			self->pos += utf8_len;
+			continue;
+		}
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			self->pos++;
+			continue;
+		}
+
+		memcpy(self->out, run, self->pos - run);
+		self->out += self->pos - run;
+		if (c == '"') {
+			self->pos++;
+			break;
+		}
+		if (c < 0x20) {
+			return json_reader_fail(self,
+						"Control character in string");
+		}
+
+		// A backslash
+		self->pos++;
+		if (self->pos == self->end) {
+			return json_reader_fail(self, "Unterminated string");
+		}
+		switch (*self->pos++) {
+		case '"':
+			*self->out++ = '"';
+			break;
+		case '\\':
+			*self->out++ = '\\';
+			break;
+		case '/':
+			*self->out++ = '/';
+			break;
+		case 'b':
+			*self->out++ = '\b';
+			break;
+		case 'f':
+			*self->out++ = '\f';
+			break;
+		case 'n':
+			*self->out++ = '\n';
+			break;
+		case 'r':
+			*self->out++ = '\r';
+			break;
+		case 't':
+			*self->out++ = '\t';
+			break;
+		case 'u':
+			if (json_reader_unicode_escape(self) != EXIT_SUCCESS) {
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			return json_reader_fail(self, "Invalid escape");
+		}
+		run = self->pos;
+	}
+	*self->out++ = '\0';
+
+	return EXIT_SUCCESS;
+}
+
+static bool json_reader_digits(json_reader *self)
+{
+	const unsigned char *start = self->pos;
+	while (self->pos < self->end && *self->pos >= '0' && *self->pos <= '9') {
+		self->pos++;
+	}
+	return self->pos > start;
+}
+
+static int json_reader_number(json_reader *self)
+{
+	if (*self->pos == '-') {
+		self->pos++;
+	}
+	if (self->pos < self->end && *self->pos == '0') {
+		self->pos++;
+	} else if (!json_reader_digits(self)) {
+		return json_reader_fail(self, "Invalid number");
+	}
+	if (self->pos < self->end && *self->pos == '.') {
+		self->pos++;
+		if (!json_reader_digits(self)) {
+			return json_reader_fail(self, "Invalid number");
+		}
+	}
+	if (self->pos < self->end && (*self->pos == 'e' || *self->pos == 'E')) {
+		self->pos++;
+		if (self->pos < self->end &&
+		    (*self->pos == '+' || *self->pos == '-')) {
+			self->pos++;
+		}
+		if (!json_reader_digits(self)) {
+			return json_reader_fail(self, "Invalid number");
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+static int json_reader_literal(json_reader *self, const char *literal)
+{
+	size_t len = strlen(literal);
+	if ((size_t)(self->end - self->pos) < len ||
+	    memcmp(self->pos, literal, len) != 0) {
+		return json_reader_fail(self, "Invalid literal");
+	}
+	self->pos += len;
+	return EXIT_SUCCESS;
+}
+
+// For keys we don't know, which jansson would have accepted and ignored
+static int json_reader_skip_value(json_reader *self, int depth)
+{
+	if (depth > JSON_READER_MAX_DEPTH) {
+		return json_reader_fail(self, "Maximum nesting depth reached");
+	}
+
+	json_reader_skip_whitespace(self);
+	if (self->pos == self->end) {
+		return json_reader_fail(self, "Expected a value");
+	}
+
+	char *out = self->out;
+	char *skipped = 0;
+	int rc = EXIT_SUCCESS;
+	switch (*self->pos) {
+	case '"':
+		rc = json_reader_string(self, &skipped);
+		self->out = out;
+		return rc;
+	case 't':
+		return json_reader_literal(self, "true");
+	case 'f':
+		return json_reader_literal(self, "false");
+	case 'n':
+		return json_reader_literal(self, "null");
+	case '[':
+		self->pos++;
+		if (json_reader_take(self, ']')) {
+			return EXIT_SUCCESS;
+		}
+		do {
+			if (json_reader_skip_value(self, depth + 1) !=
+			    EXIT_SUCCESS) {
+				return EXIT_FAILURE;
+			}
+		} while (json_reader_take(self, ','));
+		if (!json_reader_take(self, ']')) {
+			return json_reader_fail(self, "Expected ']'");
+		}
+		return EXIT_SUCCESS;
+	case '{':
+		self->pos++;
+		if (json_reader_take(self, '}')) {
+			return EXIT_SUCCESS;
+		}
+		do {
+			rc = json_reader_string(self, &skipped);
+			self->out = out;
+			if (rc != EXIT_SUCCESS) {
+				return EXIT_FAILURE;
+			}
+			if (!json_reader_take(self, ':')) {
+				return json_reader_fail(self, "Expected ':'");
+			}
+			if (json_reader_skip_value(self, depth + 1) !=
+			    EXIT_SUCCESS) {
+				return EXIT_FAILURE;
+			}
+		} while (json_reader_take(self, ','));
+		if (!json_reader_take(self, '}')) {
+			return json_reader_fail(self, "Expected '}'");
+		}
+		return EXIT_SUCCESS;
+	default:
+		if (*self->pos == '-' || (*self->pos >= '0' && *self->pos <= '9')) {
+			return json_reader_number(self);
+		}
+		return json_reader_fail(self, "Unexpected character");
+	}
+}
+
+// Where bad_actor_json_read() puts each key, in bad_actor_json_keys order
+static char **bad_actor_json_fields(bad_actor *self, char **app_name,
+				    char **app_version, size_t key)
+{
+	char **fields[] = {
+		app_name,
+		app_version,
+		&self->event_timestamp,
+		&self->event_uuid,
+		&self->created_by_node_id,
+		&self->collected_method,
+		&self->transport_type,
+		&self->source_ip,
+		&self->destination_ip,
+		&self->called_number,
+		&self->method,
+		&self->user_agent,
+		&self->sip_message
+	};
+	return fields[key];
+}
+
+bad_actor *bad_actor_json_read(const char *json, size_t json_len,
+			       const char **error)
+{
+	const size_t key_count =
+		sizeof(bad_actor_json_keys) / sizeof(*bad_actor_json_keys);
+
+	bad_actor *self = calloc(1, sizeof(bad_actor));
+	assert(self);
+	self->arena = malloc(json_len + 1);
+	assert(self->arena);
+
+	json_reader reader = { .pos = (const unsigned char *)json,
+			       .end = (const unsigned char *)json + json_len,
+			       .out = self->arena,
+			       .error = 0 };
+	char *app_name = 0;
+	char *app_version = 0;
+	bool seen[sizeof(bad_actor_json_keys) / sizeof(*bad_actor_json_keys)] = {
+		false
+	};
+
+	if (!json_reader_take(&reader, '{')) {
+		json_reader_fail(&reader, "Expected an object");
+	} else if (!json_reader_take(&reader, '}')) {
+		do {
+			char *key = 0;
+			char *key_out = reader.out;
+			if (json_reader_string(&reader, &key) != EXIT_SUCCESS) {
+				break;
+			}
+			if (!json_reader_take(&reader, ':')) {
+				json_reader_fail(&reader, "Expected ':'");
+				break;
+			}
+
+			// Keys are written as "{\"key\":" or ",\"key\":"
+			size_t key_len = reader.out - key - 1;
+			size_t found = key_count;
+			for (size_t i = 0; i < key_count; i++) {
+				const char *known = bad_actor_json_keys[i] + 2;
+				if (strlen(known) - 2 == key_len &&
+				    memcmp(key, known, key_len) == 0) {
+					found = i;
+					break;
+				}
+			}
+			reader.out = key_out;
+
+			if (found == key_count) {
+				if (json_reader_skip_value(&reader, 1) !=
+				    EXIT_SUCCESS) {
+					break;
+				}
+				continue;
+			}
+
+			// The last of a repeated key wins, as with jansson
+			json_reader_skip_whitespace(&reader);
+			if (reader.pos == reader.end || *reader.pos != '"') {
+				json_reader_fail(&reader,
+						 "Expected a string value");
+				break;
+			}
+			if (json_reader_string(
+				    &reader,
+				    bad_actor_json_fields(self, &app_name,
+							  &app_version,
+							  found)) !=
+			    EXIT_SUCCESS) {
+				break;
+			}
+			seen[found] = true;
+		} while (json_reader_take(&reader, ','));
+
+		if (reader.error == 0 && !json_reader_take(&reader, '}')) {
+			json_reader_fail(&reader, "Expected '}'");
+		}
+	}
+
+	json_reader_skip_whitespace(&reader);
+	if (reader.error == 0 && reader.pos != reader.end) {
+		json_reader_fail(&reader, "End of file expected");
+	}
+	for (size_t i = 0; reader.error == 0 && i < key_count; i++) {
+		if (!seen[i]) {
+			json_reader_fail(&reader, "Missing a bad actor key");
+		}
+	}
+
+	if (reader.error != 0) {
+		if (error != 0) {
+			*error = reader.error;
+		}
+		free(self->arena);
+		free(self);
+		return NULL;
+	}
+
+	return self; // Caller must free with bad_actor_destroy()
+}
+
 bad_actor *json_to_bad_actor(const sentrypeer_config *config,
 			     const char *json_to_convert)
 {
@@ -310,81 +962,15 @@ bad_actor *json_to_bad_actor(const sentrypeer_config *config,
 	}
 	assert(json_to_convert);
 
-	json_error_t error;
-	// Try to load the JSON string into a JSON object
-	json_t *json_bad_actor =
-		json_loadb(json_to_convert, strlen(json_to_convert), 0, &error);
-	if (!json_bad_actor) {
+	const char *error = 0;
+	bad_actor *bad_actor_event = bad_actor_json_read(
+		json_to_convert, strlen(json_to_convert), &error);
+	if (!bad_actor_event) {
 		fprintf(stderr, "Error converting string to JSON: %s\n",
-			error.text);
-		json_decref(json_bad_actor);
-		return NULL;
-	}
-
-	// Check bad_actor keys are all present
-	const char *bad_actor_keys[] = {
-		"app_name",	  "app_version",	"event_timestamp",
-		"event_uuid",	  "created_by_node_id", "collected_method",
-		"transport_type", "source_ip",		"destination_ip",
-		"called_number",  "sip_method",		"sip_user_agent",
-		"sip_message"
-	};
-	if (json_unpack_ex(
-		    json_bad_actor, &error, JSON_VALIDATE_ONLY,
-		    BAD_ACTOR_JSON_FMT, bad_actor_keys[0], bad_actor_keys[1],
-		    bad_actor_keys[2], bad_actor_keys[3], bad_actor_keys[4],
-		    bad_actor_keys[5], bad_actor_keys[6], bad_actor_keys[7],
-		    bad_actor_keys[8], bad_actor_keys[9], bad_actor_keys[10],
-		    bad_actor_keys[11], bad_actor_keys[12]) != EXIT_SUCCESS) {
-		fprintf(stderr, "Error validating JSON. %s\n", error.text);
-		json_decref(json_bad_actor);
+			error);
 		return NULL;
 	}
 
-	bad_actor *bad_actor_event =
-		bad_actor_new(0, 0, 0, 0, 0, 0, 0, 0, config->node_id);
-	assert(bad_actor_event);
-
-	// Let's free up event_timestamp and event_uuid as we don't need them as we're taking them
-	// from the JSON off the DHT
-	free(bad_actor_event->event_timestamp);
-	bad_actor_event->event_timestamp = 0;
-
-	free(bad_actor_event->event_uuid);
-	bad_actor_event->event_uuid = 0;
-
-	free(bad_actor_event->created_by_node_id);
-	bad_actor_event->created_by_node_id = 0;
-
-	bad_actor_event->event_timestamp =
-		util_duplicate_string(json_string_value(
-			json_object_get(json_bad_actor, bad_actor_keys[2])));
-	bad_actor_event->event_uuid = util_duplicate_string(json_string_value(
-		json_object_get(json_bad_actor, bad_actor_keys[3])));
-	bad_actor_event->created_by_node_id =
-		util_duplicate_string(json_string_value(
-			json_object_get(json_bad_actor, bad_actor_keys[4])));
-	bad_actor_event->collected_method =
-		util_duplicate_string(json_string_value(
-			json_object_get(json_bad_actor, bad_actor_keys[5])));
-	bad_actor_event->transport_type =
-		util_duplicate_string(json_string_value(
-			json_object_get(json_bad_actor, bad_actor_keys[6])));
-	bad_actor_event->source_ip = util_duplicate_string(json_string_value(
-		json_object_get(json_bad_actor, bad_actor_keys[7])));
-	bad_actor_event->destination_ip =
-		util_duplicate_string(json_string_value(
-			json_object_get(json_bad_actor, bad_actor_keys[8])));
-	bad_actor_event->called_number =
-		util_duplicate_string(json_string_value(
-			json_object_get(json_bad_actor, bad_actor_keys[9])));
-	bad_actor_event->method = util_duplicate_string(json_string_value(
-		json_object_get(json_bad_actor, bad_actor_keys[10])));
-	bad_actor_event->user_agent = util_duplicate_string(json_string_value(
-		json_object_get(json_bad_actor, bad_actor_keys[11])));
-	bad_actor_event->sip_message = util_duplicate_string(json_string_value(
-		json_object_get(json_bad_actor, bad_actor_keys[12])));
-
 	if (config->debug_mode || config->verbose_mode) {
 		fprintf(stderr,
 			"bad_actor from JSON on DHT is:\n"
@@ -410,7 +996,6 @@ bad_actor *json_to_bad_actor(const sentrypeer_config *config,
 			bad_actor_event->user_agent,
 			bad_actor_event->sip_message);
 	}
-	json_decref(json_bad_actor);
 
 	return bad_actor_event; // Caller must free
 }
@@ -418,33 +1003,34 @@ bad_actor *json_to_bad_actor(const sentrypeer_config *config,
 int json_log_bad_actor(const sentrypeer_config *config,
 		       const bad_actor *bad_actor_to_log)
 {
-	FILE *logfile = fopen(config->json_log_file, "a");
-	if (logfile == NULL) {
-		fprintf(stderr, "Could not open JSON log file: %s\n",
-			config->json_log_file);
+	json_buffer buffer;
+	json_buffer_init(&buffer);
+
+	const char *json_string =
+		bad_actor_json_once(config, bad_actor_to_log, &buffer);
+	// We don't assert here, because we want to continue even if it fails
+	if (json_string == NULL) {
+		fprintf(stderr, "Failed to convert bad actor to json.\n");
+		json_buffer_release(&buffer);
 		return EXIT_FAILURE;
 	}
 
-	// Caller must free
-	char *json_string =
+	int rc = json_log_bad_actor_json(config, json_string);
+	json_buffer_release(&buffer);
 
-#if HAVE_RUST != 0
-		bad_actor_to_json_rs(config,
-				     bad_actor_to_log);
-#else
-		bad_actor_to_json(config,
-				  bad_actor_to_log);
-#endif
+	return rc;
+}
 
-	// We don't assert here, because we want to continue even if it fails
-	if (json_string == NULL) {
-		fprintf(stderr, "Failed to convert bad actor to json.\n");
-		free(json_string);
-		fclose(logfile);
+int json_log_bad_actor_json(const sentrypeer_config *config,
+			    const char *bad_actor_json)
+{
+	FILE *logfile = fopen(config->json_log_file, "a");
+	if (logfile == NULL) {
+		fprintf(stderr, "Could not open JSON log file: %s\n",
+			config->json_log_file);
 		return EXIT_FAILURE;
 	}
-	fprintf(logfile, "%s\n", json_string);
-	free(json_string);
+	fprintf(logfile, "%s\n", bad_actor_json);
 
 	if (fclose(logfile) != EXIT_SUCCESS) {
 		fprintf(stderr, "Could not close JSON log file: %s\n",
@@ -456,6 +1042,26 @@ int json_log_bad_actor(const sentrypeer_config *config,
 
 int json_http_post_bad_actor(sentrypeer_config *config,
 			     const bad_actor *bad_actor_to_log)
+{
+	json_buffer buffer;
+	json_buffer_init(&buffer);
+
+	const char *json_string =
+		bad_actor_json_once(config, bad_actor_to_log, &buffer);
+	if (json_string == NULL) {
+		fprintf(stderr, "Failed to convert bad actor to json.\n");
+		json_buffer_release(&buffer);
+		return EXIT_FAILURE;
+	}
+
+	int rc = json_http_post_bad_actor_json(config, json_string);
+	json_buffer_release(&buffer);
+
+	return rc;
+}
+
+int json_http_post_bad_actor_json(sentrypeer_config *config,
+				  const char *bad_actor_json)
 {
 	CURL *curl;
 	CURLcode res;
@@ -471,24 +1077,11 @@ int json_http_post_bad_actor(sentrypeer_config *config,
 	struct curl_slist *headers = 0;
 	headers = curl_slist_append(headers, "Content-Type: application/json");
 
-	char *json_string =
-		bad_actor_to_json(config,
-				  bad_actor_to_log); // Caller must free
-	if (json_string == NULL) {
-		fprintf(stderr, "Failed to convert bad actor to json.\n");
-
-		free(json_string);
-		http_cleanup_curl(curl, headers);
-
-		return EXIT_FAILURE;
-	}
-
 	res = curl_easy_setopt(curl, CURLOPT_USERAGENT, SENTRYPEER_USERAGENT);
 	if (res != CURLE_OK) {
 		fprintf(stderr, "curl_easy_setopt() failed: %s\n",
 			curl_easy_strerror(res));
 
-		free(json_string);
 		http_cleanup_curl(curl, headers);
 
 		return EXIT_FAILURE;
@@ -501,7 +1094,6 @@ int json_http_post_bad_actor(sentrypeer_config *config,
 		fprintf(stderr, "curl_easy_setopt() failed: %s\n",
 			curl_easy_strerror(res));
 
-		free(json_string);
 		http_cleanup_curl(curl, headers);
 
 		return EXIT_FAILURE;
@@ -513,7 +1105,6 @@ int json_http_post_bad_actor(sentrypeer_config *config,
 		fprintf(stderr, "curl_easy_setopt() failed: %s\n",
 			curl_easy_strerror(res));
 
-		free(json_string);
 		http_cleanup_curl(curl, headers);
 
 		return EXIT_FAILURE;
@@ -527,7 +1118,6 @@ int json_http_post_bad_actor(sentrypeer_config *config,
 				fprintf(stderr,
 					"Failed to set OAuth2 Bearer token header.\n");
 
-				free(json_string);
 				http_cleanup_curl(curl, headers);
 
 				return EXIT_FAILURE;
@@ -541,7 +1131,6 @@ int json_http_post_bad_actor(sentrypeer_config *config,
 					"curl_easy_setopt() failed: %s\n",
 					curl_easy_strerror(res));
 
-				free(json_string);
 				http_cleanup_curl(curl, headers);
 
 				return EXIT_FAILURE;
@@ -555,7 +1144,6 @@ int json_http_post_bad_actor(sentrypeer_config *config,
 			fprintf(stderr,
 				"Failed to get and set OAuth2 Bearer token.\n");
 
-			free(json_string);
 			http_cleanup_curl(curl, headers);
 
 			return EXIT_FAILURE;
@@ -563,12 +1151,11 @@ int json_http_post_bad_actor(sentrypeer_config *config,
 	}
 
 	// Reset the JSON payload as it might have been changed by get_and_set_oauth2_bearer_token
-	res = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_string);
+	res = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, bad_actor_json);
 	if (res != CURLE_OK) {
 		fprintf(stderr, "curl_easy_setopt() failed: %s\n",
 			curl_easy_strerror(res));
 
-		free(json_string);
 		http_cleanup_curl(curl, headers);
 
 		return EXIT_FAILURE;
@@ -580,7 +1167,6 @@ int json_http_post_bad_actor(sentrypeer_config *config,
 		fprintf(stderr, "curl_easy_setopt() failed: %s\n",
 			curl_easy_strerror(res));
 
-		free(json_string);
 		http_cleanup_curl(curl, headers);
 
 		return EXIT_FAILURE;
@@ -592,7 +1178,6 @@ int json_http_post_bad_actor(sentrypeer_config *config,
 		fprintf(stderr, "curl_easy_setopt() failed: %s\n",
 			curl_easy_strerror(res));
 
-		free(json_string);
 		http_cleanup_curl(curl, headers);
 
 		return EXIT_FAILURE;
@@ -603,7 +1188,6 @@ int json_http_post_bad_actor(sentrypeer_config *config,
 		fprintf(stderr, "curl_easy_setopt() failed: %s\n",
 			curl_easy_strerror(res));
 
-		free(json_string);
 		http_cleanup_curl(curl, headers);
 
 		return EXIT_FAILURE;
@@ -614,7 +1198,6 @@ int json_http_post_bad_actor(sentrypeer_config *config,
 		fprintf(stderr, "WebHook POSTing failed: %d, %s\n", res,
 			curl_easy_strerror(res));
 
-		free(json_string);
 		http_cleanup_curl(curl, headers);
 
 		return EXIT_FAILURE;
@@ -632,8 +1215,8 @@ int json_http_post_bad_actor(sentrypeer_config *config,
 					free(config->oauth2_access_token);
 					config->oauth2_access_token = 0;
 				}
-				if (json_http_post_bad_actor(
-					    config, bad_actor_to_log) !=
+				if (json_http_post_bad_actor_json(
+					    config, bad_actor_json) !=
 				    EXIT_SUCCESS) {
 					fprintf(stderr,
 						"Failed to POST bad actor.\n");
@@ -645,7 +1228,6 @@ int json_http_post_bad_actor(sentrypeer_config *config,
 					"WebHook POSTing failed: HTTP response code %ld\n",
 					http_response_code);
 
-				free(json_string);
 				http_cleanup_curl(curl, headers);
 
 				return EXIT_FAILURE;
@@ -655,14 +1237,12 @@ int json_http_post_bad_actor(sentrypeer_config *config,
 				"WebHook POSTing failed: HTTP response code %ld\n",
 				http_response_code);
 
-			free(json_string);
 			http_cleanup_curl(curl, headers);
 
 			return EXIT_FAILURE;
 		}
 	}
 
-	free(json_string);
 	http_cleanup_curl(curl, headers);
 
 	if (config->debug_mode || config->verbose_mode) {
@@ -16,17 +16,77 @@
 
 #define DEFAULT_JSON_LOG_FILE_NAME "sentrypeer_json.log"
 
+#include <stddef.h>
+
 #include "conf.h"
 #include "bad_actor.h"
 
+// Room for nearly every bad actor we see, SIP message and all, so writing
+// one out doesn't need the heap
+#define JSON_BUFFER_INLINE_SIZE 8192
+
+// Somewhere to write json, reused from one event to the next. It starts out
+// in its own storage, so keep it on the stack, and only moves to the heap
+// for events that don't fit. data points into the struct itself, so never
+// copy one.
+typedef struct json_buffer json_buffer;
+struct json_buffer {
+	char *data;
+	size_t len;
+	size_t capacity;
+	char storage[JSON_BUFFER_INLINE_SIZE];
+};
+
+void json_buffer_init(json_buffer *self);
+// Empty it, keeping whatever room it has grown to
+void json_buffer_reset(json_buffer *self);
+void json_buffer_release(json_buffer *self);
+
+/**
+ * Write a bad actor as a single line of json, exactly as
+ * json_dumps(JSON_COMPACT) would, without building a json object first.
+ *
+ * @param bad_actor_to_convert The bad actor.
+ * @param buffer Emptied, then holds the json on success.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if a field isn't valid UTF-8,
+ *         which jansson refuses too.
+ */
+int bad_actor_json_write(const bad_actor *bad_actor_to_convert,
+			 json_buffer *buffer);
+
+/**
+ * Read json in the format bad_actor_json_write() writes, in one pass. Like
+ * json_to_bad_actor() always has, it needs every key as a string and
+ * ignores any others. All the strings go in one allocation, which
+ * bad_actor_destroy() frees.
+ *
+ * @param json The json, which needn't end in a '\0'.
+ * @param json_len Its length.
+ * @param error Set to why it was turned down, if it was.
+ * @return The bad actor, or NULL.
+ */
+bad_actor *bad_actor_json_read(const char *json, size_t json_len,
+			       const char **error);
+
+// Writes the json the first time it's asked for and hands the same json to
+// everyone after that, so each event is only serialised once whichever
+// sinks are on. NULL on failure. Start with an empty buffer per event.
+const char *bad_actor_json_once(const sentrypeer_config *config,
+				const bad_actor *bad_actor_to_convert,
+				json_buffer *buffer);
+
 char *bad_actor_to_json(const sentrypeer_config *config,
 			const bad_actor *bad_actor_to_convert);
 bad_actor *json_to_bad_actor(const sentrypeer_config *config,
 			     const char *json_to_convert);
 int json_log_bad_actor(const sentrypeer_config *config,
 		       const bad_actor *bad_actor);
+int json_log_bad_actor_json(const sentrypeer_config *config,
+			    const char *bad_actor_json);
 int json_http_post_bad_actor(sentrypeer_config *config,
 			     const bad_actor *bad_actor);
+int json_http_post_bad_actor_json(sentrypeer_config *config,
+				  const char *bad_actor_json);
 void free_oauth2_access_token(sentrypeer_config *config);
 
 #endif //SENTRYPEER_JSON_LOGGER_H
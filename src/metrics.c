@@ -0,0 +1,377 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "config.h"
+#include "metrics.h"
+
+typedef struct metric_description metric_description;
+struct metric_description {
+	const char *name;
+	const char *labels;
+	const char *help;
+};
+
+// Lines with the same name after each other share their HELP and TYPE
+static const metric_description counter_descriptions[METRICS_COUNTERS] = {
+	[METRICS_SIP_UDP_PACKETS] = { "sentrypeer_sip_packets_received_total",
+				      "{transport=\"udp\"}",
+				      "SIP packets received." },
+	[METRICS_SIP_TCP_PACKETS] = { "sentrypeer_sip_packets_received_total",
+				      "{transport=\"tcp\"}",
+				      "SIP packets received." },
+	[METRICS_SIP_BYTES] = { "sentrypeer_sip_received_bytes_total", "",
+				"Bytes of SIP packets received." },
+	[METRICS_SIP_PARSE_FAILURES] = { "sentrypeer_sip_parse_failures_total",
+					 "",
+					 "SIP packets that failed to parse." },
+	[METRICS_DB_INSERTS] = { "sentrypeer_db_inserts_total", "",
+				 "Bad actors saved to the database." },
+	[METRICS_DB_INSERT_FAILURES] = { "sentrypeer_db_insert_failures_total",
+					 "",
+					 "Bad actors that failed to save to the database." },
+	[METRICS_JSON_LOGS] = { "sentrypeer_json_logs_total", "",
+				"Bad actors written to the json log." },
+	[METRICS_JSON_LOG_FAILURES] = { "sentrypeer_json_log_failures_total", "",
+					"Bad actors that failed to write to the json log." },
+	[METRICS_WEBHOOK_POSTS] = { "sentrypeer_webhook_posts_total", "",
+				    "Bad actors POSTed to the WebHook." },
+	[METRICS_WEBHOOK_FAILURES] = { "sentrypeer_webhook_failures_total", "",
+				       "WebHook POSTs that failed." },
+	[METRICS_DHT_PUTS] = { "sentrypeer_dht_puts_total", "",
+			       "Bad actors put on the DHT." },
+	[METRICS_DHT_PUT_FAILURES] = { "sentrypeer_dht_put_failures_total", "",
+				       "DHT puts that failed." },
+	[METRICS_DHT_VALUES_RECEIVED] = { "sentrypeer_dht_values_received_total",
+					  "",
+					  "Bad actors received from DHT peers." },
+	[METRICS_SINK_DROPS] = { "sentrypeer_sink_drops_total", "",
+				 "Bad actors dropped because a sink was behind." },
+	[METRICS_TCP_IDLE_TIMEOUTS] = { "sentrypeer_tcp_connections_closed_total",
+					"{reason=\"idle\"}",
+					"SIP TCP connections we closed." },
+	[METRICS_TCP_LIFETIME_TIMEOUTS] = { "sentrypeer_tcp_connections_closed_total",
+					    "{reason=\"lifetime\"}",
+					    "SIP TCP connections we closed." },
+	[METRICS_TCP_EVICTIONS] = { "sentrypeer_tcp_connections_closed_total",
+				    "{reason=\"evicted\"}",
+				    "SIP TCP connections we closed." },
+	[METRICS_TLS_HANDSHAKES] = { "sentrypeer_tls_handshakes_total",
+				     "{resumed=\"false\"}",
+				     "SIP TLS handshakes completed." },
+	[METRICS_TLS_RESUMED_HANDSHAKES] = { "sentrypeer_tls_handshakes_total",
+					     "{resumed=\"true\"}",
+					     "SIP TLS handshakes completed." },
+	[METRICS_TLS_HANDSHAKE_FAILURES] = { "sentrypeer_tls_handshake_failures_total",
+					     "",
+					     "SIP TLS handshakes that failed." },
+	[METRICS_TLS_KTLS_OFFLOADS] = { "sentrypeer_tls_ktls_offloads_total", "",
+					"SIP TLS connections handed to kernel TLS." },
+};
+
+static const metric_description histogram_descriptions[METRICS_HISTOGRAMS] = {
+	[METRICS_SIP_PARSE_SECONDS] = { "sentrypeer_sip_parse_seconds", "",
+					"Time taken to parse a SIP packet." },
+	[METRICS_DB_INSERT_SECONDS] = { "sentrypeer_db_insert_seconds", "",
+					"Time taken to save a bad actor to the database." },
+	[METRICS_JSON_LOG_SECONDS] = { "sentrypeer_json_log_seconds", "",
+				       "Time taken to write a bad actor to the json log." },
+	[METRICS_WEBHOOK_SECONDS] = { "sentrypeer_webhook_seconds", "",
+				      "Time taken to POST a bad actor to the WebHook." },
+	[METRICS_TLS_HANDSHAKE_SECONDS] = { "sentrypeer_tls_handshake_seconds", "",
+					    "Time taken by a SIP TLS handshake." },
+	[METRICS_TLS_HANDSHAKE_CPU_SECONDS] = { "sentrypeer_tls_handshake_cpu_seconds",
+						"",
+						"CPU time used by a SIP TLS handshake." },
+};
+
+typedef struct metrics_histogram metrics_histogram;
+struct metrics_histogram {
+	atomic_uint_fast64_t buckets[METRICS_BUCKETS + 1]; // Last is +Inf
+	atomic_uint_fast64_t sum_ns;
+};
+
+// Aligned so no two shards share a cache line, and sized to a multiple of
+// one as a result
+typedef struct metrics_shard metrics_shard;
+struct metrics_shard {
+	_Alignas(64) atomic_uint_fast64_t counters[METRICS_COUNTERS];
+	metrics_histogram histograms[METRICS_HISTOGRAMS];
+};
+
+struct metrics {
+	metrics_shard *shards;
+};
+
+static atomic_uint next_shard;
+static _Thread_local unsigned int thread_shard; // 0 until first used
+
+static metrics_shard *shard(metrics *self)
+{
+	if (thread_shard == 0) {
+		thread_shard = atomic_fetch_add_explicit(&next_shard, 1,
+							 memory_order_relaxed) %
+				       METRICS_SHARDS +
+			       1;
+	}
+
+	return &self->shards[thread_shard - 1];
+}
+
+static void relaxed_add(atomic_uint_fast64_t *value, uint64_t n)
+{
+	atomic_fetch_add_explicit(value, n, memory_order_relaxed);
+}
+
+static uint64_t relaxed_load(atomic_uint_fast64_t *value)
+{
+	return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+metrics *metrics_new(void)
+{
+	metrics *self = calloc(1, sizeof(metrics));
+	assert(self);
+
+	self->shards = aligned_alloc(_Alignof(metrics_shard),
+				     METRICS_SHARDS * sizeof(metrics_shard));
+	if (self->shards == 0) {
+		fprintf(stderr, "Failed to allocate metrics\n");
+		free(self);
+		return 0;
+	}
+
+	for (size_t s = 0; s < METRICS_SHARDS; s++) {
+		metrics_shard *shard_ptr = &self->shards[s];
+		for (size_t c = 0; c < METRICS_COUNTERS; c++) {
+			atomic_init(&shard_ptr->counters[c], 0);
+		}
+		for (size_t h = 0; h < METRICS_HISTOGRAMS; h++) {
+			for (size_t b = 0; b <= METRICS_BUCKETS; b++) {
+				atomic_init(&shard_ptr->histograms[h].buckets[b],
+					    0);
+			}
+			atomic_init(&shard_ptr->histograms[h].sum_ns, 0);
+		}
+	}
+
+	return self;
+}
+
+void metrics_destroy(metrics **self_ptr)
+{
+	assert(self_ptr);
+	if (*self_ptr) {
+		metrics *self = *self_ptr;
+		free(self->shards);
+		free(self);
+		*self_ptr = 0;
+	}
+}
+
+void metrics_add(metrics *self, int counter, uint64_t value)
+{
+	if (self == 0) {
+		return;
+	}
+	assert(counter >= 0 && counter < METRICS_COUNTERS);
+
+	relaxed_add(&shard(self)->counters[counter], value);
+}
+
+uint64_t metrics_start(metrics *self)
+{
+	if (self == 0) {
+		return 0;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+void metrics_observe(metrics *self, int histogram, uint64_t started)
+{
+	if (self == 0) {
+		return;
+	}
+
+	uint64_t now = metrics_start(self);
+	metrics_observe_ns(self, histogram, now > started ? now - started : 0);
+}
+
+void metrics_observe_ns(metrics *self, int histogram, uint64_t ns)
+{
+	if (self == 0) {
+		return;
+	}
+	assert(histogram >= 0 && histogram < METRICS_HISTOGRAMS);
+
+	// The smallest bucket it fits in, the rest are added in when rendering
+	uint64_t microseconds = (ns + 999) / 1000;
+	size_t bucket = 0;
+	while (bucket < METRICS_BUCKETS &&
+	       microseconds > ((uint64_t)1 << bucket)) {
+		bucket++;
+	}
+
+	metrics_histogram *h = &shard(self)->histograms[histogram];
+	relaxed_add(&h->buckets[bucket], 1);
+	relaxed_add(&h->sum_ns, ns);
+}
+
+uint64_t metrics_counter_total(metrics *self, int counter)
+{
+	assert(self);
+	assert(counter >= 0 && counter < METRICS_COUNTERS);
+
+	uint64_t total = 0;
+	for (size_t s = 0; s < METRICS_SHARDS; s++) {
+		total += relaxed_load(&self->shards[s].counters[counter]);
+	}
+
+	return total;
+}
+
+uint64_t metrics_histogram_count(metrics *self, int histogram)
+{
+	assert(self);
+	assert(histogram >= 0 && histogram < METRICS_HISTOGRAMS);
+
+	uint64_t total = 0;
+	for (size_t s = 0; s < METRICS_SHARDS; s++) {
+		for (size_t b = 0; b <= METRICS_BUCKETS; b++) {
+			total += relaxed_load(
+				&self->shards[s].histograms[histogram].buckets[b]);
+		}
+	}
+
+	return total;
+}
+
+typedef struct render_buffer render_buffer;
+struct render_buffer {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+static void append(render_buffer *buffer, const char *format, ...)
+{
+	for (;;) {
+		va_list args;
+		va_start(args, format);
+		int written = vsnprintf(buffer->data + buffer->len,
+					buffer->size - buffer->len, format,
+					args);
+		va_end(args);
+		assert(written >= 0);
+
+		if ((size_t)written < buffer->size - buffer->len) {
+			buffer->len += (size_t)written;
+			return;
+		}
+
+		buffer->size = buffer->size * 2 + (size_t)written;
+		buffer->data = realloc(buffer->data, buffer->size);
+		assert(buffer->data);
+	}
+}
+
+static void render_help(render_buffer *buffer,
+			const metric_description *description,
+			const char *type)
+{
+	append(buffer, "# HELP %s %s\n# TYPE %s %s\n", description->name,
+	       description->help, description->name, type);
+}
+
+static void render_histogram(render_buffer *buffer, metrics *self,
+			     int histogram)
+{
+	const metric_description *description =
+		&histogram_descriptions[histogram];
+	uint64_t buckets[METRICS_BUCKETS + 1] = { 0 };
+	uint64_t sum_ns = 0;
+
+	for (size_t s = 0; s < METRICS_SHARDS; s++) {
+		metrics_histogram *h = &self->shards[s].histograms[histogram];
+		for (size_t b = 0; b <= METRICS_BUCKETS; b++) {
+			buckets[b] += relaxed_load(&h->buckets[b]);
+		}
+		sum_ns += relaxed_load(&h->sum_ns);
+	}
+
+	render_help(buffer, description, "histogram");
+
+	// Prometheus buckets count everything up to and including le
+	uint64_t cumulative = 0;
+	for (size_t b = 0; b < METRICS_BUCKETS; b++) {
+		cumulative += buckets[b];
+		append(buffer, "%s_bucket{le=\"%.6f\"} %llu\n",
+		       description->name, (double)((uint64_t)1 << b) / 1e6,
+		       (unsigned long long)cumulative);
+	}
+	cumulative += buckets[METRICS_BUCKETS];
+	append(buffer, "%s_bucket{le=\"+Inf\"} %llu\n", description->name,
+	       (unsigned long long)cumulative);
+	append(buffer, "%s_sum %.9f\n", description->name,
+	       (double)sum_ns / 1e9);
+	append(buffer, "%s_count %llu\n", description->name,
+	       (unsigned long long)cumulative);
+}
+
+char *metrics_render(metrics *self)
+{
+	assert(self);
+
+	render_buffer buffer = { 0 };
+	buffer.size = 16 * 1024;
+	buffer.data = malloc(buffer.size);
+	assert(buffer.data);
+
+	append(&buffer,
+	       "# HELP sentrypeer_build_info Which SentryPeer is running.\n"
+	       "# TYPE sentrypeer_build_info gauge\n"
+	       "sentrypeer_build_info{version=\"%s\"} 1\n",
+	       PACKAGE_VERSION);
+
+	for (int c = 0; c < METRICS_COUNTERS; c++) {
+		const metric_description *description =
+			&counter_descriptions[c];
+		if (c == 0 ||
+		    strcmp(description->name, counter_descriptions[c - 1].name) !=
+			    0) {
+			render_help(&buffer, description, "counter");
+		}
+		append(&buffer, "%s%s %llu\n", description->name,
+		       description->labels,
+		       (unsigned long long)metrics_counter_total(self, c));
+	}
+
+	for (int h = 0; h < METRICS_HISTOGRAMS; h++) {
+		render_histogram(&buffer, self, h);
+	}
+
+	return buffer.data;
+}
@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#ifndef SENTRYPEER_METRICS_H
+#define SENTRYPEER_METRICS_H 1
+
+#include <stdint.h>
+
+// Counters, see metrics.c for their names
+#define METRICS_SIP_UDP_PACKETS 0
+#define METRICS_SIP_TCP_PACKETS 1
+#define METRICS_SIP_BYTES 2
+#define METRICS_SIP_PARSE_FAILURES 3
+#define METRICS_DB_INSERTS 4
+#define METRICS_DB_INSERT_FAILURES 5
+#define METRICS_JSON_LOGS 6
+#define METRICS_JSON_LOG_FAILURES 7
+#define METRICS_WEBHOOK_POSTS 8
+#define METRICS_WEBHOOK_FAILURES 9
+#define METRICS_DHT_PUTS 10
+#define METRICS_DHT_PUT_FAILURES 11
+#define METRICS_DHT_VALUES_RECEIVED 12
+#define METRICS_SINK_DROPS 13
+#define METRICS_TCP_IDLE_TIMEOUTS 14
+#define METRICS_TCP_LIFETIME_TIMEOUTS 15
+#define METRICS_TCP_EVICTIONS 16
+#define METRICS_TLS_HANDSHAKES 17
+#define METRICS_TLS_RESUMED_HANDSHAKES 18
+#define METRICS_TLS_HANDSHAKE_FAILURES 19
+#define METRICS_TLS_KTLS_OFFLOADS 20
+#define METRICS_COUNTERS 21
+
+// Latency histograms
+#define METRICS_SIP_PARSE_SECONDS 0
+#define METRICS_DB_INSERT_SECONDS 1
+#define METRICS_JSON_LOG_SECONDS 2
+#define METRICS_WEBHOOK_SECONDS 3
+#define METRICS_TLS_HANDSHAKE_SECONDS 4
+#define METRICS_TLS_HANDSHAKE_CPU_SECONDS 5 // CPU time, not wall clock
+#define METRICS_HISTOGRAMS 6
+
+// Bucket i holds anything up to 2^i microseconds, so 1us to ~8s, then +Inf
+#define METRICS_BUCKETS 24
+
+// Threads are spread over this many cache line aligned copies of
+// everything, so counting is an uncontended relaxed atomic add and all the
+// adding up is left to whoever scrapes /metrics
+#define METRICS_SHARDS 32
+
+typedef struct metrics metrics;
+
+//  Constructor
+metrics *metrics_new(void);
+
+//  Destructor
+void metrics_destroy(metrics **self_ptr);
+
+// All of these do nothing when self is NULL, i.e. not in API mode, so
+// callers don't need to check
+void metrics_add(metrics *self, int counter, uint64_t value);
+
+// Monotonic nanoseconds to hand to metrics_observe(), 0 when self is NULL
+uint64_t metrics_start(metrics *self);
+
+/**
+ * Record how long something took.
+ *
+ * @param self The metrics.
+ * @param histogram e.g. METRICS_DB_INSERT_SECONDS.
+ * @param started What metrics_start() returned beforehand.
+ */
+void metrics_observe(metrics *self, int histogram, uint64_t started);
+void metrics_observe_ns(metrics *self, int histogram, uint64_t ns);
+
+// Summed over all the shards
+uint64_t metrics_counter_total(metrics *self, int counter);
+uint64_t metrics_histogram_count(metrics *self, int histogram);
+
+/**
+ * Everything in the Prometheus text exposition format.
+ *
+ * @param self The metrics.
+ * @return The document, free() it.
+ */
+char *metrics_render(metrics *self);
+
+#endif //SENTRYPEER_METRICS_H
@@ -0,0 +1,914 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#if HAVE_ZSTD != 0
+#include <zstd.h>
+#endif
+
+#include "parquet_writer.h"
+
+// parquet.thrift enums
+#define PARQUET_REPETITION_OPTIONAL 1
+#define PARQUET_CONVERTED_TYPE_UTF8 0
+#define PARQUET_ENCODING_PLAIN 0
+#define PARQUET_ENCODING_RLE 3
+#define PARQUET_ENCODING_RLE_DICTIONARY 8
+#define PARQUET_CODEC_UNCOMPRESSED 0
+#define PARQUET_CODEC_ZSTD 6
+#define PARQUET_PAGE_DATA 0
+#define PARQUET_PAGE_DICTIONARY 2
+#define PARQUET_FORMAT_VERSION 2
+
+// Thrift compact protocol types
+#define THRIFT_BOOL_TRUE 1
+#define THRIFT_I32 5
+#define THRIFT_I64 6
+#define THRIFT_BINARY 8
+#define THRIFT_LIST 9
+#define THRIFT_STRUCT 12
+#define THRIFT_DEPTH_MAX 8
+
+typedef struct byte_buffer byte_buffer;
+struct byte_buffer {
+	uint8_t *data;
+	size_t len;
+	size_t cap;
+};
+
+static void buffer_reserve(byte_buffer *buffer, size_t more)
+{
+	if (buffer->len + more <= buffer->cap) {
+		return;
+	}
+
+	size_t cap = buffer->cap > 0 ? buffer->cap : 4096;
+	while (cap < buffer->len + more) {
+		cap *= 2;
+	}
+	buffer->data = realloc(buffer->data, cap);
+	assert(buffer->data);
+	buffer->cap = cap;
+}
+
+static void buffer_append(byte_buffer *buffer, const void *data, size_t len)
+{
+	buffer_reserve(buffer, len);
+	if (len > 0) {
+		memcpy(buffer->data + buffer->len, data, len);
+	}
+	buffer->len += len;
+}
+
+static void buffer_byte(byte_buffer *buffer, uint8_t byte)
+{
+	buffer_append(buffer, &byte, 1);
+}
+
+static void buffer_le32(byte_buffer *buffer, uint32_t value)
+{
+	uint8_t le[4] = { (uint8_t)value, (uint8_t)(value >> 8),
+			  (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+	buffer_append(buffer, le, sizeof(le));
+}
+
+static void buffer_le64(byte_buffer *buffer, uint64_t value)
+{
+	buffer_le32(buffer, (uint32_t)value);
+	buffer_le32(buffer, (uint32_t)(value >> 32));
+}
+
+static void buffer_varint(byte_buffer *buffer, uint64_t value)
+{
+	while (value >= 0x80) {
+		buffer_byte(buffer, (uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	buffer_byte(buffer, (uint8_t)value);
+}
+
+static void buffer_free(byte_buffer *buffer)
+{
+	free(buffer->data);
+	buffer->data = 0;
+	buffer->len = 0;
+	buffer->cap = 0;
+}
+
+// Just enough of the Thrift compact protocol for page headers and the
+// footer. Field ids are written as deltas from the last one in the same
+// struct.
+typedef struct thrift_out thrift_out;
+struct thrift_out {
+	byte_buffer *buffer;
+	int16_t last_field_id[THRIFT_DEPTH_MAX];
+	int depth;
+};
+
+static void thrift_field(thrift_out *out, int16_t field_id, uint8_t type)
+{
+	int16_t delta = field_id - out->last_field_id[out->depth];
+	if (delta > 0 && delta <= 15) {
+		buffer_byte(out->buffer, (uint8_t)(delta << 4) | type);
+	} else {
+		buffer_byte(out->buffer, type);
+		buffer_varint(out->buffer, (uint16_t)((uint16_t)field_id << 1) ^
+						   (uint16_t)(field_id >> 15));
+	}
+	out->last_field_id[out->depth] = field_id;
+}
+
+static void thrift_i32_value(thrift_out *out, int32_t value)
+{
+	buffer_varint(out->buffer,
+		      (uint32_t)((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+static void thrift_i32(thrift_out *out, int16_t field_id, int32_t value)
+{
+	thrift_field(out, field_id, THRIFT_I32);
+	thrift_i32_value(out, value);
+}
+
+static void thrift_i64(thrift_out *out, int16_t field_id, int64_t value)
+{
+	thrift_field(out, field_id, THRIFT_I64);
+	buffer_varint(out->buffer,
+		      ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static void thrift_binary_value(thrift_out *out, const char *value)
+{
+	size_t len = strlen(value);
+	buffer_varint(out->buffer, len);
+	buffer_append(out->buffer, value, len);
+}
+
+static void thrift_binary(thrift_out *out, int16_t field_id,
+			  const char *value)
+{
+	thrift_field(out, field_id, THRIFT_BINARY);
+	thrift_binary_value(out, value);
+}
+
+static void thrift_list(thrift_out *out, int16_t field_id, uint8_t type,
+			size_t count)
+{
+	thrift_field(out, field_id, THRIFT_LIST);
+	if (count < 15) {
+		buffer_byte(out->buffer, (uint8_t)(count << 4) | type);
+	} else {
+		buffer_byte(out->buffer, 0xf0 | type);
+		buffer_varint(out->buffer, count);
+	}
+}
+
+// A struct list element has no field header, a struct field does
+static void thrift_struct_begin(thrift_out *out)
+{
+	assert(out->depth + 1 < THRIFT_DEPTH_MAX);
+	out->last_field_id[++out->depth] = 0;
+}
+
+static void thrift_struct_field_begin(thrift_out *out, int16_t field_id)
+{
+	thrift_field(out, field_id, THRIFT_STRUCT);
+	thrift_struct_begin(out);
+}
+
+static void thrift_struct_end(thrift_out *out)
+{
+	assert(out->depth > 0);
+	buffer_byte(out->buffer, 0); // STOP
+	out->depth--;
+}
+
+typedef struct column_chunk column_chunk;
+struct column_chunk {
+	int64_t dictionary_page_offset; // -1 for none
+	int64_t data_page_offset;
+	int64_t num_values;
+	int64_t null_count;
+	int64_t uncompressed_size;
+	int64_t compressed_size;
+};
+
+typedef struct row_group row_group;
+struct row_group {
+	int64_t num_rows;
+	int64_t file_offset;
+	column_chunk *chunks;
+};
+
+typedef struct column_buffer column_buffer;
+struct column_buffer {
+	const parquet_column *spec;
+	// Definition level of each row, 1 for a value and 0 for null
+	uint8_t *defined;
+	size_t rows;
+	size_t rows_cap;
+	// PLAIN values, or with a dictionary an index per value
+	byte_buffer values;
+	uint32_t *indices;
+	size_t value_count;
+	size_t indices_cap;
+	bool dictionary;
+	// PLAIN encoded dictionary, with the offset of each entry and an open
+	// addressing table of entry + 1
+	byte_buffer dictionary_values;
+	size_t *entry_offsets;
+	size_t entry_count;
+	size_t entries_cap;
+	uint32_t *slots;
+	size_t slot_count;
+};
+
+struct parquet_writer {
+	FILE *file;
+	int64_t offset;
+	bool failed;
+	const parquet_column *columns;
+	size_t column_count;
+	column_buffer *buffers;
+	size_t group_rows;
+	uint64_t rows;
+	row_group *row_groups;
+	size_t row_group_count;
+	byte_buffer page;
+	byte_buffer compressed;
+	byte_buffer header;
+#if HAVE_ZSTD != 0
+	ZSTD_CCtx *cctx;
+#endif
+};
+
+static uint64_t hash_bytes(const uint8_t *data, size_t len)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static void column_reset(column_buffer *column)
+{
+	column->rows = 0;
+	column->values.len = 0;
+	column->value_count = 0;
+	column->dictionary = column->spec->dictionary;
+	column->dictionary_values.len = 0;
+	column->entry_count = 0;
+	if (column->slots != 0) {
+		memset(column->slots, 0,
+		       column->slot_count * sizeof(*column->slots));
+	}
+}
+
+static void column_free(column_buffer *column)
+{
+	free(column->defined);
+	buffer_free(&column->values);
+	free(column->indices);
+	buffer_free(&column->dictionary_values);
+	free(column->entry_offsets);
+	free(column->slots);
+}
+
+static void column_define(column_buffer *column, uint8_t defined)
+{
+	if (column->rows == column->rows_cap) {
+		column->rows_cap =
+			column->rows_cap > 0 ? column->rows_cap * 2 : 1024;
+		column->defined = realloc(column->defined, column->rows_cap);
+		assert(column->defined);
+	}
+	column->defined[column->rows++] = defined;
+}
+
+// Give up on the dictionary for the rest of this chunk, turning the
+// indices so far back into PLAIN values
+static void column_drop_dictionary(column_buffer *column)
+{
+	column->values.len = 0;
+	for (size_t i = 0; i < column->value_count; i++) {
+		size_t offset = column->entry_offsets[column->indices[i]];
+		uint8_t *entry = column->dictionary_values.data + offset;
+		uint32_t len = (uint32_t)entry[0] | (uint32_t)entry[1] << 8 |
+			       (uint32_t)entry[2] << 16 |
+			       (uint32_t)entry[3] << 24;
+		buffer_append(&column->values, entry, 4 + (size_t)len);
+	}
+	column->dictionary = false;
+	column->dictionary_values.len = 0;
+	column->entry_count = 0;
+	memset(column->slots, 0, column->slot_count * sizeof(*column->slots));
+}
+
+static void column_grow_slots(column_buffer *column)
+{
+	size_t slot_count = column->slot_count > 0 ? column->slot_count * 2 :
+						     1024;
+	free(column->slots);
+	column->slots = calloc(slot_count, sizeof(*column->slots));
+	assert(column->slots);
+	column->slot_count = slot_count;
+
+	for (size_t entry = 0; entry < column->entry_count; entry++) {
+		const uint8_t *data = column->dictionary_values.data +
+				      column->entry_offsets[entry];
+		size_t len = (size_t)data[0] | (size_t)data[1] << 8 |
+			     (size_t)data[2] << 16 | (size_t)data[3] << 24;
+		size_t slot = hash_bytes(data + 4, len) & (slot_count - 1);
+		while (column->slots[slot] != 0) {
+			slot = (slot + 1) & (slot_count - 1);
+		}
+		column->slots[slot] = (uint32_t)entry + 1;
+	}
+}
+
+// The dictionary index of value, adding it if it's new. Returns false once
+// the dictionary is too big to be worth it.
+static bool column_dictionary_index(column_buffer *column, const char *value,
+				    size_t len, uint32_t *index)
+{
+	if ((column->entry_count + 1) * 2 > column->slot_count) {
+		column_grow_slots(column);
+	}
+
+	size_t slot = hash_bytes((const uint8_t *)value, len) &
+		      (column->slot_count - 1);
+	while (column->slots[slot] != 0) {
+		size_t entry = column->slots[slot] - 1;
+		const uint8_t *data = column->dictionary_values.data +
+				      column->entry_offsets[entry];
+		size_t entry_len = (size_t)data[0] | (size_t)data[1] << 8 |
+				   (size_t)data[2] << 16 |
+				   (size_t)data[3] << 24;
+		if (entry_len == len && memcmp(data + 4, value, len) == 0) {
+			*index = (uint32_t)entry;
+			return true;
+		}
+		slot = (slot + 1) & (column->slot_count - 1);
+	}
+
+	if (column->entry_count >= PARQUET_DICTIONARY_MAX_ENTRIES ||
+	    column->dictionary_values.len + 4 + len >
+		    PARQUET_DICTIONARY_MAX_BYTES) {
+		return false;
+	}
+
+	if (column->entry_count == column->entries_cap) {
+		column->entries_cap = column->entries_cap > 0 ?
+					      column->entries_cap * 2 :
+					      256;
+		column->entry_offsets =
+			realloc(column->entry_offsets,
+				column->entries_cap *
+					sizeof(*column->entry_offsets));
+		assert(column->entry_offsets);
+	}
+	column->entry_offsets[column->entry_count] =
+		column->dictionary_values.len;
+	buffer_le32(&column->dictionary_values, (uint32_t)len);
+	buffer_append(&column->dictionary_values, value, len);
+	column->slots[slot] = (uint32_t)column->entry_count + 1;
+	*index = (uint32_t)column->entry_count++;
+
+	return true;
+}
+
+static void column_put_bytes(column_buffer *column, const char *value,
+			     size_t len)
+{
+	column_define(column, 1);
+
+	uint32_t index = 0;
+	if (column->dictionary &&
+	    !column_dictionary_index(column, value, len, &index)) {
+		column_drop_dictionary(column);
+	}
+
+	if (column->dictionary) {
+		if (column->value_count == column->indices_cap) {
+			column->indices_cap = column->indices_cap > 0 ?
+						      column->indices_cap * 2 :
+						      1024;
+			column->indices = realloc(
+				column->indices,
+				column->indices_cap * sizeof(*column->indices));
+			assert(column->indices);
+		}
+		column->indices[column->value_count] = index;
+	} else {
+		buffer_le32(&column->values, (uint32_t)len);
+		buffer_append(&column->values, value, len);
+	}
+	column->value_count++;
+}
+
+static void rle_value(byte_buffer *out, uint32_t value, int bit_width)
+{
+	for (int byte = 0; byte < (bit_width + 7) / 8; byte++) {
+		buffer_byte(out, (uint8_t)(value >> (8 * byte)));
+	}
+}
+
+static uint32_t level_or_index(const void *values, size_t value_size,
+			       size_t i)
+{
+	return value_size == 1 ? ((const uint8_t *)values)[i] :
+				 ((const uint32_t *)values)[i];
+}
+
+// The RLE/bit-packing hybrid used for definition levels and dictionary
+// indices. Runs of 8 or more go out as RLE runs, everything else is bit
+// packed 8 at a time, with only the very last group padded.
+static void rle_encode(byte_buffer *out, const void *values, size_t value_size,
+		       size_t count, int bit_width)
+{
+	size_t i = 0;
+	while (i < count) {
+		uint32_t value = level_or_index(values, value_size, i);
+		size_t run = 1;
+		while (i + run < count &&
+		       level_or_index(values, value_size, i + run) == value) {
+			run++;
+		}
+		if (run >= 8) {
+			buffer_varint(out, (uint64_t)run << 1);
+			rle_value(out, value, bit_width);
+			i += run;
+			continue;
+		}
+
+		// Bit pack groups of 8 until the next run worth an RLE run
+		size_t groups = 0;
+		size_t end = i;
+		while (end < count) {
+			if (groups > 0) {
+				uint32_t next =
+					level_or_index(values, value_size, end);
+				size_t next_run = 1;
+				while (end + next_run < count &&
+				       next_run < 8 &&
+				       level_or_index(values, value_size,
+						      end + next_run) == next) {
+					next_run++;
+				}
+				if (next_run >= 8) {
+					break;
+				}
+			}
+			end = end + 8 < count ? end + 8 : count;
+			groups++;
+		}
+
+		buffer_varint(out, (uint64_t)groups << 1 | 1);
+		uint64_t bits = 0;
+		int bit_count = 0;
+		for (size_t v = i; v < i + groups * 8; v++) {
+			uint64_t packed =
+				v < count ?
+					level_or_index(values, value_size, v) :
+					0;
+			bits |= packed << bit_count;
+			bit_count += bit_width;
+			while (bit_count >= 8) {
+				buffer_byte(out, (uint8_t)bits);
+				bits >>= 8;
+				bit_count -= 8;
+			}
+		}
+		i = end;
+	}
+}
+
+static void writer_write(parquet_writer *self, const void *data, size_t len)
+{
+	if (self->failed) {
+		return;
+	}
+	if (fwrite(data, 1, len, self->file) != len) {
+		fprintf(stderr, "Failed to write Parquet file\n");
+		self->failed = true;
+		return;
+	}
+	self->offset += (int64_t)len;
+}
+
+// Compress and write self->page with its header, adding to the chunk's
+// sizes
+static void write_page(parquet_writer *self, int page_type, int32_t num_values,
+		       int encoding, column_chunk *chunk)
+{
+	const uint8_t *body = self->page.data;
+	size_t body_len = self->page.len;
+	int32_t uncompressed_len = (int32_t)self->page.len;
+
+#if HAVE_ZSTD != 0
+	self->compressed.len = 0;
+	buffer_reserve(&self->compressed, ZSTD_compressBound(self->page.len));
+	size_t compressed_len = ZSTD_compressCCtx(
+		self->cctx, self->compressed.data, self->compressed.cap,
+		self->page.data, self->page.len, PARQUET_ZSTD_LEVEL);
+	if (ZSTD_isError(compressed_len)) {
+		fprintf(stderr, "Failed to compress Parquet page: %s\n",
+			ZSTD_getErrorName(compressed_len));
+		self->failed = true;
+		return;
+	}
+	body = self->compressed.data;
+	body_len = compressed_len;
+#endif
+
+	self->header.len = 0;
+	thrift_out out = { .buffer = &self->header };
+	thrift_i32(&out, 1, page_type);
+	thrift_i32(&out, 2, uncompressed_len);
+	thrift_i32(&out, 3, (int32_t)body_len);
+	if (page_type == PARQUET_PAGE_DATA) {
+		thrift_struct_field_begin(&out, 5);
+		thrift_i32(&out, 1, num_values);
+		thrift_i32(&out, 2, encoding);
+		thrift_i32(&out, 3, PARQUET_ENCODING_RLE);
+		thrift_i32(&out, 4, PARQUET_ENCODING_RLE);
+		thrift_struct_end(&out);
+	} else {
+		thrift_struct_field_begin(&out, 7);
+		thrift_i32(&out, 1, num_values);
+		thrift_i32(&out, 2, encoding);
+		thrift_struct_end(&out);
+	}
+	buffer_byte(&self->header, 0); // STOP
+
+	writer_write(self, self->header.data, self->header.len);
+	writer_write(self, body, body_len);
+	chunk->uncompressed_size +=
+		(int64_t)(self->header.len + (size_t)uncompressed_len);
+	chunk->compressed_size += (int64_t)(self->header.len + body_len);
+}
+
+static int bit_width_for(size_t entries)
+{
+	int bit_width = 1;
+	while (bit_width < 32 && ((size_t)1 << bit_width) < entries) {
+		bit_width++;
+	}
+
+	return bit_width;
+}
+
+static void write_column_chunk(parquet_writer *self, column_buffer *column,
+			       column_chunk *chunk)
+{
+	chunk->dictionary_page_offset = -1;
+	chunk->num_values = (int64_t)column->rows;
+	chunk->null_count = (int64_t)(column->rows - column->value_count);
+
+	bool dictionary = column->dictionary && column->value_count > 0;
+	if (dictionary) {
+		chunk->dictionary_page_offset = self->offset;
+		self->page.len = 0;
+		buffer_append(&self->page, column->dictionary_values.data,
+			      column->dictionary_values.len);
+		write_page(self, PARQUET_PAGE_DICTIONARY,
+			   (int32_t)column->entry_count, PARQUET_ENCODING_PLAIN,
+			   chunk);
+	}
+
+	// Data page v1: length prefixed definition levels, then the values
+	chunk->data_page_offset = self->offset;
+	self->page.len = 0;
+	buffer_le32(&self->page, 0);
+	rle_encode(&self->page, column->defined, 1, column->rows, 1);
+	uint32_t levels_len = (uint32_t)(self->page.len - 4);
+	memcpy(self->page.data,
+	       (uint8_t[4]){ (uint8_t)levels_len, (uint8_t)(levels_len >> 8),
+			     (uint8_t)(levels_len >> 16),
+			     (uint8_t)(levels_len >> 24) },
+	       4);
+
+	if (dictionary) {
+		int bit_width = bit_width_for(column->entry_count);
+		buffer_byte(&self->page, (uint8_t)bit_width);
+		rle_encode(&self->page, column->indices, sizeof(uint32_t),
+			   column->value_count, bit_width);
+	} else {
+		buffer_append(&self->page, column->values.data,
+			      column->values.len);
+	}
+	write_page(self, PARQUET_PAGE_DATA, (int32_t)column->rows,
+		   dictionary ? PARQUET_ENCODING_RLE_DICTIONARY :
+				PARQUET_ENCODING_PLAIN,
+		   chunk);
+}
+
+static void write_row_group(parquet_writer *self)
+{
+	if (self->group_rows == 0) {
+		return;
+	}
+
+	self->row_groups =
+		realloc(self->row_groups, (self->row_group_count + 1) *
+						  sizeof(*self->row_groups));
+	assert(self->row_groups);
+	row_group *group = &self->row_groups[self->row_group_count++];
+	group->num_rows = (int64_t)self->group_rows;
+	group->file_offset = self->offset;
+	group->chunks = calloc(self->column_count, sizeof(*group->chunks));
+	assert(group->chunks);
+
+	for (size_t i = 0; i < self->column_count; i++) {
+		write_column_chunk(self, &self->buffers[i], &group->chunks[i]);
+		column_reset(&self->buffers[i]);
+	}
+	self->group_rows = 0;
+}
+
+static size_t buffered_bytes(parquet_writer const *self)
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < self->column_count; i++) {
+		const column_buffer *column = &self->buffers[i];
+		bytes += column->rows + column->values.len +
+			 column->dictionary_values.len;
+		if (column->dictionary) {
+			bytes += column->value_count * sizeof(uint32_t);
+		}
+	}
+
+	return bytes;
+}
+
+static void write_schema(thrift_out *out, parquet_writer const *self)
+{
+	thrift_list(out, 2, THRIFT_STRUCT, self->column_count + 1);
+	thrift_struct_begin(out);
+	thrift_binary(out, 4, "schema");
+	thrift_i32(out, 5, (int32_t)self->column_count);
+	thrift_struct_end(out);
+
+	for (size_t i = 0; i < self->column_count; i++) {
+		const parquet_column *column = &self->columns[i];
+		thrift_struct_begin(out);
+		thrift_i32(out, 1, column->type);
+		thrift_i32(out, 3, PARQUET_REPETITION_OPTIONAL);
+		thrift_binary(out, 4, column->name);
+		if (column->type == PARQUET_TYPE_BYTE_ARRAY) {
+			thrift_i32(out, 6, PARQUET_CONVERTED_TYPE_UTF8);
+			// LogicalType STRING, an empty struct
+			thrift_struct_field_begin(out, 10);
+			thrift_struct_field_begin(out, 1);
+			thrift_struct_end(out);
+			thrift_struct_end(out);
+		}
+		thrift_struct_end(out);
+	}
+}
+
+static void write_column_meta(thrift_out *out, const parquet_column *column,
+			      const column_chunk *chunk)
+{
+	thrift_struct_begin(out);
+	thrift_i64(out, 2,
+		   chunk->dictionary_page_offset >= 0 ?
+			   chunk->dictionary_page_offset :
+			   chunk->data_page_offset);
+	thrift_struct_field_begin(out, 3);
+	thrift_i32(out, 1, column->type);
+	if (chunk->dictionary_page_offset >= 0) {
+		thrift_list(out, 2, THRIFT_I32, 3);
+		thrift_i32_value(out, PARQUET_ENCODING_PLAIN);
+		thrift_i32_value(out, PARQUET_ENCODING_RLE);
+		thrift_i32_value(out, PARQUET_ENCODING_RLE_DICTIONARY);
+	} else {
+		thrift_list(out, 2, THRIFT_I32, 2);
+		thrift_i32_value(out, PARQUET_ENCODING_PLAIN);
+		thrift_i32_value(out, PARQUET_ENCODING_RLE);
+	}
+	thrift_list(out, 3, THRIFT_BINARY, 1);
+	thrift_binary_value(out, column->name);
+#if HAVE_ZSTD != 0
+	thrift_i32(out, 4, PARQUET_CODEC_ZSTD);
+#else
+	thrift_i32(out, 4, PARQUET_CODEC_UNCOMPRESSED);
+#endif
+	thrift_i64(out, 5, chunk->num_values);
+	thrift_i64(out, 6, chunk->uncompressed_size);
+	thrift_i64(out, 7, chunk->compressed_size);
+	thrift_i64(out, 9, chunk->data_page_offset);
+	if (chunk->dictionary_page_offset >= 0) {
+		thrift_i64(out, 11, chunk->dictionary_page_offset);
+	}
+	// Statistics, just null_count
+	thrift_struct_field_begin(out, 12);
+	thrift_i64(out, 3, chunk->null_count);
+	thrift_struct_end(out);
+	thrift_struct_end(out);
+	thrift_struct_end(out);
+}
+
+static void write_footer(parquet_writer *self)
+{
+	byte_buffer footer = { 0 };
+	thrift_out out = { .buffer = &footer };
+
+	thrift_i32(&out, 1, PARQUET_FORMAT_VERSION);
+	write_schema(&out, self);
+	thrift_i64(&out, 3, (int64_t)self->rows);
+
+	thrift_list(&out, 4, THRIFT_STRUCT, self->row_group_count);
+	for (size_t g = 0; g < self->row_group_count; g++) {
+		const row_group *group = &self->row_groups[g];
+		int64_t uncompressed = 0;
+		int64_t compressed = 0;
+
+		thrift_struct_begin(&out);
+		thrift_list(&out, 1, THRIFT_STRUCT, self->column_count);
+		for (size_t i = 0; i < self->column_count; i++) {
+			write_column_meta(&out, &self->columns[i],
+					  &group->chunks[i]);
+			uncompressed += group->chunks[i].uncompressed_size;
+			compressed += group->chunks[i].compressed_size;
+		}
+		thrift_i64(&out, 2, uncompressed);
+		thrift_i64(&out, 3, group->num_rows);
+		thrift_i64(&out, 5, group->file_offset);
+		thrift_i64(&out, 6, compressed);
+		thrift_struct_end(&out);
+	}
+	thrift_binary(&out, 6, PACKAGE_NAME " version " PACKAGE_VERSION);
+	buffer_byte(&footer, 0); // STOP
+
+	buffer_le32(&footer, (uint32_t)footer.len);
+	buffer_append(&footer, PARQUET_MAGIC, PARQUET_MAGIC_LEN);
+	writer_write(self, footer.data, footer.len);
+	buffer_free(&footer);
+}
+
+parquet_writer *parquet_writer_new(const char *file_name,
+				   const parquet_column *columns,
+				   size_t column_count)
+{
+	FILE *file = fopen(file_name, "wb");
+	if (file == 0) {
+		perror("fopen");
+		fprintf(stderr, "Failed to create Parquet file: %s\n",
+			file_name);
+		return 0;
+	}
+
+	parquet_writer *self = calloc(1, sizeof(parquet_writer));
+	assert(self);
+	self->file = file;
+	self->columns = columns;
+	self->column_count = column_count;
+	self->buffers = calloc(column_count, sizeof(*self->buffers));
+	assert(self->buffers);
+	for (size_t i = 0; i < column_count; i++) {
+		self->buffers[i].spec = &columns[i];
+		column_reset(&self->buffers[i]);
+	}
+#if HAVE_ZSTD != 0
+	self->cctx = ZSTD_createCCtx();
+	assert(self->cctx);
+#endif
+
+	writer_write(self, PARQUET_MAGIC, PARQUET_MAGIC_LEN);
+
+	return self;
+}
+
+void parquet_writer_destroy(parquet_writer **self_ptr)
+{
+	assert(self_ptr);
+	if (*self_ptr) {
+		parquet_writer *self = *self_ptr;
+
+		if (self->file != 0) {
+			fclose(self->file);
+		}
+		for (size_t i = 0; i < self->column_count; i++) {
+			column_free(&self->buffers[i]);
+		}
+		free(self->buffers);
+		for (size_t g = 0; g < self->row_group_count; g++) {
+			free(self->row_groups[g].chunks);
+		}
+		free(self->row_groups);
+		buffer_free(&self->page);
+		buffer_free(&self->compressed);
+		buffer_free(&self->header);
+#if HAVE_ZSTD != 0
+		ZSTD_freeCCtx(self->cctx);
+#endif
+
+		free(self);
+		*self_ptr = 0;
+	}
+}
+
+void parquet_writer_put_string(parquet_writer *self, size_t column,
+			       const char *value)
+{
+	assert(column < self->column_count);
+	assert(self->columns[column].type == PARQUET_TYPE_BYTE_ARRAY);
+
+	if (value == 0) {
+		parquet_writer_put_null(self, column);
+		return;
+	}
+	column_put_bytes(&self->buffers[column], value, strlen(value));
+}
+
+void parquet_writer_put_int64(parquet_writer *self, size_t column,
+			      int64_t value)
+{
+	assert(column < self->column_count);
+	assert(self->columns[column].type == PARQUET_TYPE_INT64);
+
+	column_buffer *buffer = &self->buffers[column];
+	column_define(buffer, 1);
+	buffer_le64(&buffer->values, (uint64_t)value);
+	buffer->value_count++;
+}
+
+void parquet_writer_put_null(parquet_writer *self, size_t column)
+{
+	assert(column < self->column_count);
+	column_define(&self->buffers[column], 0);
+}
+
+int parquet_writer_end_row(parquet_writer *self)
+{
+	self->group_rows++;
+	self->rows++;
+	for (size_t i = 0; i < self->column_count; i++) {
+		// Every column needs exactly one value per row
+		assert(self->buffers[i].rows == self->group_rows);
+	}
+
+	if (self->group_rows >= PARQUET_ROW_GROUP_ROWS ||
+	    buffered_bytes(self) >= PARQUET_ROW_GROUP_BYTES) {
+		write_row_group(self);
+	}
+
+	return self->failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+uint64_t parquet_writer_rows(parquet_writer const *self)
+{
+	return self->rows;
+}
+
+int parquet_writer_close(parquet_writer **self_ptr)
+{
+	assert(self_ptr);
+	parquet_writer *self = *self_ptr;
+	if (self == 0) {
+		return EXIT_FAILURE;
+	}
+
+	write_row_group(self);
+	write_footer(self);
+
+	// So a file that's been renamed into place is all there
+	if (!self->failed &&
+	    (fflush(self->file) != 0 || fsync(fileno(self->file)) != 0)) {
+		perror("fsync");
+		self->failed = true;
+	}
+	if (fclose(self->file) != 0) {
+		perror("fclose");
+		self->failed = true;
+	}
+	self->file = 0;
+
+	int status = self->failed ? EXIT_FAILURE : EXIT_SUCCESS;
+	parquet_writer_destroy(self_ptr);
+
+	return status;
+}
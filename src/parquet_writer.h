@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#ifndef SENTRYPEER_PARQUET_WRITER_H
+#define SENTRYPEER_PARQUET_WRITER_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// https://parquet.apache.org/docs/file-format/
+#define PARQUET_MAGIC "PAR1"
+#define PARQUET_MAGIC_LEN 4
+// Physical types, from parquet.thrift
+#define PARQUET_TYPE_INT64 2
+#define PARQUET_TYPE_BYTE_ARRAY 6
+
+// A row group is written out when it reaches either of these
+#define PARQUET_ROW_GROUP_ROWS (128 * 1024)
+#define PARQUET_ROW_GROUP_BYTES (64 * 1024 * 1024)
+// A column chunk whose dictionary grows past either of these is written
+// PLAIN instead
+#define PARQUET_DICTIONARY_MAX_ENTRIES (64 * 1024)
+#define PARQUET_DICTIONARY_MAX_BYTES (1024 * 1024)
+#define PARQUET_ZSTD_LEVEL 3
+
+typedef struct parquet_column parquet_column;
+struct parquet_column {
+	const char *name;
+	// PARQUET_TYPE_INT64, or PARQUET_TYPE_BYTE_ARRAY for UTF-8 strings
+	int type;
+	// Worth trying a dictionary, e.g. SIP methods or User-Agents
+	bool dictionary;
+};
+
+typedef struct parquet_writer parquet_writer;
+
+/**
+ * Start a Parquet file of optional (nullable) columns. Rows are buffered a
+ * row group at a time, pages are zstd compressed when we have zstd.
+ *
+ * @param file_name Created or truncated.
+ * @param columns The schema, kept by reference until the writer is gone.
+ * @param column_count How many.
+ * @return The writer, or NULL if the file couldn't be created.
+ */
+parquet_writer *parquet_writer_new(const char *file_name,
+				   const parquet_column *columns,
+				   size_t column_count);
+
+// Destructor, for giving up on a file. Use parquet_writer_close() to
+// finish one.
+void parquet_writer_destroy(parquet_writer **self_ptr);
+
+// Each column gets exactly one value per row, NULL for a null string
+void parquet_writer_put_string(parquet_writer *self, size_t column,
+			       const char *value);
+void parquet_writer_put_int64(parquet_writer *self, size_t column,
+			      int64_t value);
+void parquet_writer_put_null(parquet_writer *self, size_t column);
+
+/**
+ * Finish the current row, writing out the row group if it's full.
+ *
+ * @param self The writer.
+ * @return EXIT_SUCCESS or EXIT_FAILURE on a write error.
+ */
+int parquet_writer_end_row(parquet_writer *self);
+
+// Rows finished so far
+uint64_t parquet_writer_rows(parquet_writer const *self);
+
+/**
+ * Write out the last row group and the footer, then sync, close and
+ * destroy the writer.
+ *
+ * @param self_ptr The writer, set to NULL.
+ * @return EXIT_SUCCESS or EXIT_FAILURE, when the file is unusable.
+ */
+int parquet_writer_close(parquet_writer **self_ptr);
+
+#endif //SENTRYPEER_PARQUET_WRITER_H
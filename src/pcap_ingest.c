@@ -0,0 +1,1301 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pcap_ingest.h"
+#include "bad_actor.h"
+#include "metrics.h"
+#include "sinks.h"
+#include "sip_parser.h"
+#include "utils.h"
+
+// See https://www.tcpdump.org/linktypes.html
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LOOP 108
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+// See https://www.ietf.org/archive/id/draft-ietf-opsawg-pcap-04.html and
+// https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng-02.html
+#define PCAP_MAGIC 0xa1b2c3d4u
+#define PCAP_MAGIC_NANO 0xa1b23c4du
+#define PCAP_HEADER_LEN 24
+#define PCAP_RECORD_HEADER_LEN 16
+#define PCAPNG_SECTION_HEADER 0x0a0d0d0au
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4du
+#define PCAPNG_INTERFACE_DESCRIPTION 1
+#define PCAPNG_PACKET 2
+#define PCAPNG_SIMPLE_PACKET 3
+#define PCAPNG_ENHANCED_PACKET 6
+#define PCAPNG_OPTION_TSRESOL 9
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+
+#define SIP_NONE 0
+#define SIP_REQUEST 1
+#define SIP_RESPONSE 2
+// Longest request line we look through for the SIP version
+#define SIP_START_LINE_MAX 1024
+
+// What the reader hands to a worker. Payloads point into the mapped file.
+typedef struct ingest_packet ingest_packet;
+struct ingest_packet {
+	const uint8_t *payload;
+	uint32_t payload_len;
+	uint32_t tcp_seq;
+	uint64_t hash;
+	struct timespec seen;
+	uint16_t source_port;
+	uint16_t destination_port;
+	uint8_t source[16];
+	uint8_t destination[16];
+	int family;
+	uint8_t protocol;
+	uint8_t tcp_flags;
+};
+
+typedef struct ingest_segment ingest_segment;
+struct ingest_segment {
+	const uint8_t *data;
+	uint32_t len;
+	uint32_t seq;
+	struct timespec seen;
+};
+
+// One direction of a TCP connection
+typedef struct ingest_stream ingest_stream;
+struct ingest_stream {
+	uint8_t source[16];
+	uint8_t destination[16];
+	uint16_t source_port;
+	uint16_t destination_port;
+	int family;
+	size_t bucket;
+	ingest_stream *next_in_bucket;
+	ingest_stream *older;
+	ingest_stream *newer;
+	bool synced;
+	uint32_t next_seq;
+	// Left of a SIP message too big to keep
+	size_t skip;
+	char *buffer;
+	size_t len;
+	size_t capacity;
+	ingest_segment out_of_order[PCAP_INGEST_OUT_OF_ORDER_MAX];
+	size_t out_of_order_count;
+};
+
+typedef struct ingest_worker ingest_worker;
+struct ingest_worker {
+	pcap_ingest_fn fn;
+	void *arg;
+	ingest_packet queue[PCAP_INGEST_QUEUE_CAPACITY];
+	size_t head;
+	size_t queued;
+	bool finished;
+	pthread_mutex_t mutex;
+	pthread_cond_t wake_up;
+	pthread_cond_t has_room;
+	pthread_t thread;
+	// Only touched on the worker's own thread from here on
+	ingest_stream **buckets;
+	ingest_stream *oldest;
+	ingest_stream *newest;
+	size_t stream_count;
+	uint64_t sip_requests;
+	uint64_t sip_responses;
+	uint64_t events;
+	uint64_t failed;
+};
+
+// What the reader thread keeps for itself
+typedef struct ingest_reader ingest_reader;
+struct ingest_reader {
+	ingest_worker **workers;
+	size_t worker_count;
+	// Packets for each worker, handed over PCAP_INGEST_BATCH at a time
+	ingest_packet (*pending)[PCAP_INGEST_BATCH];
+	size_t *pending_count;
+	struct timespec last_seen;
+	uint64_t packets;
+	uint64_t skipped;
+};
+
+#define INGEST_BUCKETS (PCAP_INGEST_STREAMS_MAX * 2)
+
+static uint16_t read_u16(const uint8_t *data, bool swapped)
+{
+	uint16_t value;
+	memcpy(&value, data, sizeof(value));
+
+	return swapped ? (uint16_t)((value >> 8) | (value << 8)) : value;
+}
+
+static uint32_t read_u32(const uint8_t *data, bool swapped)
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	if (swapped) {
+		value = ((value & 0xff000000u) >> 24) |
+			((value & 0x00ff0000u) >> 8) |
+			((value & 0x0000ff00u) << 8) | ((value & 0x000000ffu) << 24);
+	}
+
+	return value;
+}
+
+static uint16_t read_net_u16(const uint8_t *data)
+{
+	return (uint16_t)(data[0] << 8 | data[1]);
+}
+
+static uint32_t read_net_u32(const uint8_t *data)
+{
+	return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 |
+	       (uint32_t)data[2] << 8 | data[3];
+}
+
+static uint64_t ingest_hash_endpoint(const uint8_t *address, uint16_t port)
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325u;
+	for (int i = 0; i < 16; i++) {
+		hash = (hash ^ address[i]) * 0x100000001b3u;
+	}
+	hash = (hash ^ (port & 0xff)) * 0x100000001b3u;
+
+	return (hash ^ (port >> 8)) * 0x100000001b3u;
+}
+
+// The same both ways, so replies go to the same worker
+static uint64_t ingest_hash(const ingest_packet *packet)
+{
+	uint64_t hash =
+		ingest_hash_endpoint(packet->source, packet->source_port) ^
+		ingest_hash_endpoint(packet->destination,
+				     packet->destination_port) ^
+		packet->protocol;
+
+	return hash * 0x9e3779b97f4a7c15u;
+}
+
+static bool ingest_decode_udp_tcp(const uint8_t *data, uint32_t len,
+				  ingest_packet *packet)
+{
+	if (packet->protocol == IPPROTO_UDP) {
+		if (len < 8) {
+			return false;
+		}
+		uint16_t udp_len = read_net_u16(data + 4);
+		if (udp_len >= 8 && udp_len < len) {
+			len = udp_len;
+		}
+		packet->source_port = read_net_u16(data);
+		packet->destination_port = read_net_u16(data + 2);
+		packet->payload = data + 8;
+		packet->payload_len = len - 8;
+		return true;
+	}
+
+	if (packet->protocol == IPPROTO_TCP) {
+		if (len < 20) {
+			return false;
+		}
+		uint32_t header_len = (uint32_t)(data[12] >> 4) * 4;
+		if (header_len < 20 || header_len > len) {
+			return false;
+		}
+		packet->source_port = read_net_u16(data);
+		packet->destination_port = read_net_u16(data + 2);
+		packet->tcp_seq = read_net_u32(data + 4);
+		packet->tcp_flags = data[13];
+		packet->payload = data + header_len;
+		packet->payload_len = len - header_len;
+		return true;
+	}
+
+	return false;
+}
+
+static bool ingest_decode_ipv4(const uint8_t *data, uint32_t len,
+			       ingest_packet *packet)
+{
+	if (len < 20) {
+		return false;
+	}
+	uint32_t header_len = (uint32_t)(data[0] & 0x0f) * 4;
+	uint32_t total_len = read_net_u16(data + 2);
+	if (header_len < 20 || total_len < header_len) {
+		return false;
+	}
+	// Ethernet pads short frames, so trust the IP length over ours
+	if (total_len < len) {
+		len = total_len;
+	}
+	if (header_len > len) {
+		return false;
+	}
+	// More fragments, or not the first
+	if ((read_net_u16(data + 6) & 0x3fff) != 0) {
+		return false;
+	}
+
+	packet->family = AF_INET;
+	packet->protocol = data[9];
+	memset(packet->source, 0, 10);
+	packet->source[10] = 0xff;
+	packet->source[11] = 0xff;
+	memcpy(packet->source + 12, data + 12, 4);
+	memset(packet->destination, 0, 10);
+	packet->destination[10] = 0xff;
+	packet->destination[11] = 0xff;
+	memcpy(packet->destination + 12, data + 16, 4);
+
+	return ingest_decode_udp_tcp(data + header_len, len - header_len,
+				     packet);
+}
+
+static bool ingest_decode_ipv6(const uint8_t *data, uint32_t len,
+			       ingest_packet *packet)
+{
+	if (len < 40) {
+		return false;
+	}
+	uint32_t payload_len = read_net_u16(data + 4);
+	if (40 + payload_len < len) {
+		len = 40 + payload_len;
+	}
+
+	packet->family = AF_INET6;
+	memcpy(packet->source, data + 8, 16);
+	memcpy(packet->destination, data + 24, 16);
+
+	uint8_t next_header = data[6];
+	uint32_t offset = 40;
+	// Hop-by-hop, routing and destination options
+	while (next_header == 0 || next_header == 43 || next_header == 60) {
+		if (offset + 8 > len) {
+			return false;
+		}
+		next_header = data[offset];
+		offset += ((uint32_t)data[offset + 1] + 1) * 8;
+	}
+	// Fragments are left alone, like IPv4 ones
+	if (offset > len || next_header == 44) {
+		return false;
+	}
+	packet->protocol = next_header;
+
+	return ingest_decode_udp_tcp(data + offset, len - offset, packet);
+}
+
+static bool ingest_decode_ip(const uint8_t *data, uint32_t len,
+			     ingest_packet *packet)
+{
+	if (len < 1) {
+		return false;
+	}
+	if ((data[0] >> 4) == 4) {
+		return ingest_decode_ipv4(data, len, packet);
+	}
+	if ((data[0] >> 4) == 6) {
+		return ingest_decode_ipv6(data, len, packet);
+	}
+
+	return false;
+}
+
+static bool ingest_decode_ethertype(uint16_t ethertype, const uint8_t *data,
+				    uint32_t len, ingest_packet *packet)
+{
+	// 802.1Q and QinQ tags
+	while (ethertype == 0x8100 || ethertype == 0x88a8 ||
+	       ethertype == 0x9100) {
+		if (len < 4) {
+			return false;
+		}
+		ethertype = read_net_u16(data + 2);
+		data += 4;
+		len -= 4;
+	}
+	if (ethertype != 0x0800 && ethertype != 0x86dd) {
+		return false;
+	}
+
+	return ingest_decode_ip(data, len, packet);
+}
+
+static bool ingest_decode(uint32_t link_type, const uint8_t *frame,
+			  uint32_t len, ingest_packet *packet)
+{
+	switch (link_type) {
+	case LINKTYPE_ETHERNET:
+		if (len < 14) {
+			return false;
+		}
+		return ingest_decode_ethertype(read_net_u16(frame + 12),
+					       frame + 14, len - 14, packet);
+	case LINKTYPE_LINUX_SLL:
+		if (len < 16) {
+			return false;
+		}
+		return ingest_decode_ethertype(read_net_u16(frame + 14),
+					       frame + 16, len - 16, packet);
+	case LINKTYPE_LINUX_SLL2:
+		if (len < 20) {
+			return false;
+		}
+		return ingest_decode_ethertype(read_net_u16(frame), frame + 20,
+					       len - 20, packet);
+	case LINKTYPE_NULL:
+	case LINKTYPE_LOOP:
+		// The address family is in either byte order, so just look at
+		// the IP version instead
+		if (len < 4) {
+			return false;
+		}
+		return ingest_decode_ip(frame + 4, len - 4, packet);
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+		return ingest_decode_ip(frame, len, packet);
+	default:
+		return false;
+	}
+}
+
+static void ingest_reader_flush(ingest_reader *self, size_t worker_index)
+{
+	ingest_worker *worker = self->workers[worker_index];
+	size_t count = self->pending_count[worker_index];
+	if (count == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&worker->mutex);
+	while (PCAP_INGEST_QUEUE_CAPACITY - worker->queued < count) {
+		pthread_cond_wait(&worker->has_room, &worker->mutex);
+	}
+	for (size_t i = 0; i < count; i++) {
+		worker->queue[(worker->head + worker->queued) %
+			      PCAP_INGEST_QUEUE_CAPACITY] =
+			self->pending[worker_index][i];
+		worker->queued++;
+	}
+	pthread_cond_signal(&worker->wake_up);
+	pthread_mutex_unlock(&worker->mutex);
+
+	self->pending_count[worker_index] = 0;
+}
+
+static void ingest_reader_packet(ingest_reader *self, uint32_t link_type,
+				 const uint8_t *frame, uint32_t len,
+				 const struct timespec *seen)
+{
+	self->packets++;
+
+	ingest_packet packet;
+	memset(&packet, 0, sizeof(packet));
+	if (!ingest_decode(link_type, frame, len, &packet)) {
+		self->skipped++;
+		return;
+	}
+	packet.seen = *seen;
+	packet.hash = ingest_hash(&packet);
+	self->last_seen = *seen;
+
+	// Just the ones that could be part of a SIP message, or tell us
+	// about a TCP stream
+	if (packet.payload_len == 0 &&
+	    !(packet.protocol == IPPROTO_TCP &&
+	      (packet.tcp_flags & (TCP_SYN | TCP_FIN | TCP_RST)))) {
+		return;
+	}
+
+	size_t worker_index = packet.hash % self->worker_count;
+	self->pending[worker_index][self->pending_count[worker_index]++] =
+		packet;
+	if (self->pending_count[worker_index] == PCAP_INGEST_BATCH) {
+		ingest_reader_flush(self, worker_index);
+	}
+}
+
+static struct timespec ingest_timestamp(uint64_t timestamp, uint64_t units)
+{
+	struct timespec seen;
+	seen.tv_sec = (time_t)(timestamp / units);
+	uint64_t fraction = timestamp % units;
+	if (units <= 1000000000u) {
+		seen.tv_nsec = (long)(fraction * (1000000000u / units));
+	} else {
+		seen.tv_nsec = (long)((long double)fraction * 1000000000.0L /
+				      (long double)units);
+	}
+
+	return seen;
+}
+
+static int ingest_read_pcap(ingest_reader *self, const uint8_t *data,
+			    size_t size)
+{
+	if (size < PCAP_HEADER_LEN) {
+		fprintf(stderr, "pcap file is cut short\n");
+		return EXIT_FAILURE;
+	}
+
+	uint32_t magic = read_u32(data, false);
+	bool swapped = magic != PCAP_MAGIC && magic != PCAP_MAGIC_NANO;
+	if (swapped) {
+		magic = read_u32(data, true);
+	}
+	uint64_t units = magic == PCAP_MAGIC_NANO ? 1000000000u : 1000000u;
+	// The top bits can say whether there's a frame check sequence
+	uint32_t link_type = read_u32(data + 20, swapped) & 0xffff;
+
+	size_t offset = PCAP_HEADER_LEN;
+	while (offset + PCAP_RECORD_HEADER_LEN <= size) {
+		const uint8_t *record = data + offset;
+		uint32_t captured_len = read_u32(record + 8, swapped);
+		if (captured_len > size - offset - PCAP_RECORD_HEADER_LEN) {
+			fprintf(stderr, "pcap file is cut short\n");
+			break;
+		}
+		uint32_t fraction = read_u32(record + 4, swapped);
+		struct timespec seen = ingest_timestamp(
+			(uint64_t)read_u32(record, swapped) * units +
+				(fraction < units ? fraction : 0),
+			units);
+		ingest_reader_packet(self, link_type,
+				     record + PCAP_RECORD_HEADER_LEN,
+				     captured_len, &seen);
+		offset += PCAP_RECORD_HEADER_LEN + captured_len;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+typedef struct ingest_interface ingest_interface;
+struct ingest_interface {
+	uint32_t link_type;
+	// Timestamp units per second
+	uint64_t units;
+};
+
+static uint64_t ingest_tsresol_units(uint8_t tsresol)
+{
+	uint64_t units = 1;
+	uint8_t exponent = tsresol & 0x7f;
+	if (tsresol & 0x80) {
+		return exponent < 64 ? (uint64_t)1 << exponent : 0;
+	}
+	for (uint8_t i = 0; i < exponent; i++) {
+		if (units > UINT64_MAX / 10) {
+			return 0;
+		}
+		units *= 10;
+	}
+
+	return units;
+}
+
+static ingest_interface ingest_read_interface(const uint8_t *block,
+					      uint32_t block_len, bool swapped)
+{
+	ingest_interface interface;
+	interface.link_type = read_u16(block + 8, swapped);
+	interface.units = 1000000;
+
+	uint32_t offset = 16;
+	while (offset + 4 <= block_len - 4) {
+		uint16_t code = read_u16(block + offset, swapped);
+		uint16_t len = read_u16(block + offset + 2, swapped);
+		if (code == 0 || offset + 4 + len > block_len - 4) {
+			break;
+		}
+		if (code == PCAPNG_OPTION_TSRESOL && len == 1) {
+			uint64_t units = ingest_tsresol_units(block[offset + 4]);
+			if (units != 0) {
+				interface.units = units;
+			}
+		}
+		offset += 4 + (((uint32_t)len + 3) & ~3u);
+	}
+
+	return interface;
+}
+
+static int ingest_read_pcapng(ingest_reader *self, const uint8_t *data,
+			      size_t size)
+{
+	ingest_interface *interfaces = 0;
+	size_t interface_count = 0;
+	size_t interface_capacity = 0;
+	bool swapped = false;
+
+	size_t offset = 0;
+	while (offset + 12 <= size) {
+		const uint8_t *block = data + offset;
+		uint32_t type = read_u32(block, swapped);
+		if (type == PCAPNG_SECTION_HEADER) {
+			// A new section can have the other byte order, and
+			// interfaces start again
+			swapped = read_u32(block + 8, false) !=
+				  PCAPNG_BYTE_ORDER_MAGIC;
+			interface_count = 0;
+		}
+		uint32_t block_len = read_u32(block + 4, swapped);
+		if (block_len < 12 || block_len % 4 != 0 ||
+		    block_len > size - offset) {
+			fprintf(stderr, "pcapng file is cut short\n");
+			break;
+		}
+
+		if (type == PCAPNG_INTERFACE_DESCRIPTION && block_len >= 20) {
+			if (interface_count == interface_capacity) {
+				interface_capacity = interface_capacity == 0 ?
+							     4 :
+							     interface_capacity *
+								     2;
+				interfaces = realloc(interfaces,
+						     interface_capacity *
+							     sizeof(*interfaces));
+				assert(interfaces);
+			}
+			interfaces[interface_count++] =
+				ingest_read_interface(block, block_len,
+						      swapped);
+		} else if ((type == PCAPNG_ENHANCED_PACKET ||
+			    type == PCAPNG_PACKET) &&
+			   block_len >= 32) {
+			uint32_t interface_id =
+				type == PCAPNG_ENHANCED_PACKET ?
+					read_u32(block + 8, swapped) :
+					read_u16(block + 8, swapped);
+			uint32_t captured_len = read_u32(block + 20, swapped);
+			if (interface_id < interface_count &&
+			    captured_len <= block_len - 32) {
+				uint64_t timestamp =
+					(uint64_t)read_u32(block + 12, swapped)
+						<< 32 |
+					read_u32(block + 16, swapped);
+				struct timespec seen = ingest_timestamp(
+					timestamp,
+					interfaces[interface_id].units);
+				ingest_reader_packet(
+					self,
+					interfaces[interface_id].link_type,
+					block + 28, captured_len, &seen);
+			}
+		} else if (type == PCAPNG_SIMPLE_PACKET && block_len >= 16 &&
+			   interface_count > 0) {
+			uint32_t captured_len = read_u32(block + 8, swapped);
+			if (captured_len > block_len - 16) {
+				captured_len = block_len - 16;
+			}
+			// No timestamp, so say it's with the one before
+			struct timespec seen = self->last_seen;
+			ingest_reader_packet(self, interfaces[0].link_type,
+					     block + 12, captured_len, &seen);
+		}
+
+		offset += block_len;
+	}
+	free(interfaces);
+
+	return EXIT_SUCCESS;
+}
+
+// Whether data starts like a SIP request or response
+static int ingest_sip_kind(const char *data, size_t len)
+{
+	if (len >= 8 && memcmp(data, "SIP/2.0 ", 8) == 0) {
+		return SIP_RESPONSE;
+	}
+
+	size_t method_len = 0;
+	while (method_len < len && method_len < 32 &&
+	       ((data[method_len] >= 'A' && data[method_len] <= 'Z') ||
+		data[method_len] == '-')) {
+		method_len++;
+	}
+	if (method_len == 0 || method_len == len || data[method_len] != ' ') {
+		return SIP_NONE;
+	}
+
+	const char *line_end = memmem(
+		data, len < SIP_START_LINE_MAX ? len : SIP_START_LINE_MAX,
+		"\r\n", 2);
+	if (line_end == 0 || (size_t)(line_end - data) < method_len + 9 ||
+	    memcmp(line_end - 8, " SIP/2.0", 8) != 0) {
+		return SIP_NONE;
+	}
+
+	return SIP_REQUEST;
+}
+
+// 0 if there isn't one, as allowed over UDP
+static size_t ingest_content_length(const char *headers, size_t len)
+{
+	const char *end = headers + len;
+	const char *line = memmem(headers, len, "\r\n", 2);
+
+	while (line != 0 && line + 2 < end) {
+		line += 2;
+		size_t name_len = 0;
+		if ((size_t)(end - line) > 14 &&
+		    strncasecmp(line, "Content-Length", 14) == 0) {
+			name_len = 14;
+		} else if (*line == 'l' || *line == 'L') {
+			// Compact form
+			name_len = 1;
+		}
+
+		if (name_len > 0) {
+			const char *value = line + name_len;
+			while (value < end && (*value == ' ' || *value == '\t')) {
+				value++;
+			}
+			if (value < end && *value == ':') {
+				value++;
+				while (value < end &&
+				       (*value == ' ' || *value == '\t')) {
+					value++;
+				}
+				size_t content_length = 0;
+				while (value < end && *value >= '0' &&
+				       *value <= '9' &&
+				       content_length <= PCAP_INGEST_STREAM_MAX) {
+					content_length = content_length * 10 +
+							 (size_t)(*value - '0');
+					value++;
+				}
+				return content_length;
+			}
+		}
+		line = memmem(line, (size_t)(end - line), "\r\n", 2);
+	}
+
+	return 0;
+}
+
+static void ingest_worker_message(ingest_worker *self, int family,
+				  const uint8_t *source,
+				  const uint8_t *destination,
+				  const char *transport_type,
+				  const char *sip_message, size_t len,
+				  const struct timespec *seen)
+{
+	if (ingest_sip_kind(sip_message, len) != SIP_REQUEST) {
+		self->sip_responses++;
+		return;
+	}
+	self->sip_requests++;
+
+	char source_ip[INET6_ADDRSTRLEN];
+	char destination_ip[INET6_ADDRSTRLEN];
+	if (family == AF_INET) {
+		inet_ntop(AF_INET, source + 12, source_ip, sizeof(source_ip));
+		inet_ntop(AF_INET, destination + 12, destination_ip,
+			  sizeof(destination_ip));
+	} else {
+		inet_ntop(AF_INET6, source, source_ip, sizeof(source_ip));
+		inet_ntop(AF_INET6, destination, destination_ip,
+			  sizeof(destination_ip));
+	}
+
+	pcap_ingest_message message = {
+		.sip_message = sip_message,
+		.sip_message_len = len,
+		.transport_type = transport_type,
+		.source_ip = source_ip,
+		.destination_ip = destination_ip,
+		.seen = *seen,
+	};
+	if (self->fn(self->arg, &message) == EXIT_SUCCESS) {
+		self->events++;
+	} else {
+		self->failed++;
+	}
+}
+
+/*
+ * Hand over every whole SIP message at the start of data, as framed by
+ * RFC 3261, Section 18.3, and return how much of it was used. Anything
+ * before a start line is skipped, so we can pick up part way through a
+ * stream or after a lost segment.
+ */
+static size_t ingest_stream_frame(ingest_worker *self, ingest_stream *stream,
+				  const char *data, size_t len,
+				  const struct timespec *seen)
+{
+	size_t used = 0;
+
+	while (used < len) {
+		const char *start = data + used;
+		size_t remaining = len - used;
+
+		if (stream->skip > 0) {
+			size_t skipped = stream->skip < remaining ? stream->skip :
+								    remaining;
+			stream->skip -= skipped;
+			used += skipped;
+			continue;
+		}
+
+		// Keepalives
+		if (*start == '\r' || *start == '\n') {
+			used++;
+			continue;
+		}
+
+		size_t line_search = remaining < SIP_START_LINE_MAX ?
+					     remaining :
+					     SIP_START_LINE_MAX;
+		const char *line_end = memmem(start, line_search, "\r\n", 2);
+		if (line_end == 0) {
+			if (remaining < SIP_START_LINE_MAX) {
+				break;
+			}
+			used += remaining - SIP_START_LINE_MAX + 1;
+			continue;
+		}
+		if (ingest_sip_kind(start, remaining) == SIP_NONE) {
+			used += (size_t)(line_end - start) + 2;
+			continue;
+		}
+
+		const char *headers_end = memmem(start, remaining, "\r\n\r\n", 4);
+		if (headers_end == 0) {
+			// Never going to end, so start looking again
+			if (remaining >= PCAP_INGEST_STREAM_MAX) {
+				used += (size_t)(line_end - start) + 2;
+				continue;
+			}
+			break;
+		}
+		size_t headers_len = (size_t)(headers_end - start) + 4;
+		size_t content_length = ingest_content_length(start, headers_len);
+		if (headers_len + content_length > PCAP_INGEST_STREAM_MAX) {
+			stream->skip = headers_len + content_length;
+			continue;
+		}
+		if (headers_len + content_length > remaining) {
+			break;
+		}
+
+		ingest_worker_message(self, stream->family, stream->source,
+				      stream->destination, "TCP", start,
+				      headers_len + content_length, seen);
+		used += headers_len + content_length;
+	}
+
+	return used;
+}
+
+static void ingest_stream_data(ingest_worker *self, ingest_stream *stream,
+			       const uint8_t *data, size_t len,
+			       const struct timespec *seen)
+{
+	// Straight from the capture if nothing's waiting, which is usual
+	if (stream->len == 0) {
+		size_t used = ingest_stream_frame(self, stream,
+						  (const char *)data, len, seen);
+		data += used;
+		len -= used;
+		if (len == 0) {
+			return;
+		}
+	}
+
+	if (stream->len + len > stream->capacity) {
+		size_t capacity = stream->capacity == 0 ? 4096 :
+							  stream->capacity;
+		while (capacity < stream->len + len) {
+			capacity *= 2;
+		}
+		stream->buffer = realloc(stream->buffer, capacity);
+		assert(stream->buffer);
+		stream->capacity = capacity;
+	}
+	memcpy(stream->buffer + stream->len, data, len);
+	stream->len += len;
+
+	size_t used = ingest_stream_frame(self, stream, stream->buffer,
+					  stream->len, seen);
+	memmove(stream->buffer, stream->buffer + used, stream->len - used);
+	stream->len -= used;
+}
+
+// Anything held onto that follows on now
+static void ingest_stream_follow_on(ingest_worker *self, ingest_stream *stream)
+{
+	size_t i = 0;
+	while (i < stream->out_of_order_count) {
+		ingest_segment held = stream->out_of_order[i];
+		int32_t ahead = (int32_t)(held.seq - stream->next_seq);
+		if (ahead > 0) {
+			i++;
+			continue;
+		}
+		stream->out_of_order[i] =
+			stream->out_of_order[--stream->out_of_order_count];
+		if ((uint32_t)-ahead < held.len) {
+			uint32_t overlap = (uint32_t)-ahead;
+			ingest_stream_data(self, stream, held.data + overlap,
+					   held.len - overlap, &held.seen);
+			stream->next_seq = held.seq + held.len;
+		}
+		i = 0;
+	}
+}
+
+static void ingest_stream_segment(ingest_worker *self, ingest_stream *stream,
+				  const ingest_segment *segment)
+{
+	int32_t ahead = (int32_t)(segment->seq - stream->next_seq);
+
+	if (ahead > 0 &&
+	    stream->out_of_order_count == PCAP_INGEST_OUT_OF_ORDER_MAX) {
+		// What's missing isn't coming, so carry on from the earliest
+		// we have
+		stream->len = 0;
+		stream->skip = 0;
+		stream->next_seq = segment->seq;
+		for (size_t i = 0; i < stream->out_of_order_count; i++) {
+			if ((int32_t)(stream->out_of_order[i].seq -
+				      stream->next_seq) < 0) {
+				stream->next_seq = stream->out_of_order[i].seq;
+			}
+		}
+		ingest_stream_follow_on(self, stream);
+		ahead = (int32_t)(segment->seq - stream->next_seq);
+	}
+
+	if (ahead > 0) {
+		if (stream->out_of_order_count < PCAP_INGEST_OUT_OF_ORDER_MAX) {
+			stream->out_of_order[stream->out_of_order_count++] =
+				*segment;
+		}
+		return;
+	}
+
+	uint32_t overlap = (uint32_t)-ahead;
+	if (overlap >= segment->len) {
+		// Seen it already
+		return;
+	}
+	ingest_stream_data(self, stream, segment->data + overlap,
+			   segment->len - overlap, &segment->seen);
+	stream->next_seq = segment->seq + segment->len;
+	ingest_stream_follow_on(self, stream);
+}
+
+static size_t ingest_stream_bucket(const ingest_packet *packet)
+{
+	uint64_t hash =
+		ingest_hash_endpoint(packet->source, packet->source_port) * 31 +
+		ingest_hash_endpoint(packet->destination,
+				     packet->destination_port);
+
+	return (size_t)(hash % INGEST_BUCKETS);
+}
+
+static bool ingest_stream_matches(const ingest_stream *stream,
+				  const ingest_packet *packet)
+{
+	return stream->source_port == packet->source_port &&
+	       stream->destination_port == packet->destination_port &&
+	       memcmp(stream->source, packet->source, 16) == 0 &&
+	       memcmp(stream->destination, packet->destination, 16) == 0;
+}
+
+static void ingest_stream_unlink(ingest_worker *self, ingest_stream *stream)
+{
+	if (stream->older != 0) {
+		stream->older->newer = stream->newer;
+	} else {
+		self->oldest = stream->newer;
+	}
+	if (stream->newer != 0) {
+		stream->newer->older = stream->older;
+	} else {
+		self->newest = stream->older;
+	}
+	stream->older = 0;
+	stream->newer = 0;
+}
+
+static void ingest_stream_link_newest(ingest_worker *self,
+				      ingest_stream *stream)
+{
+	stream->older = self->newest;
+	stream->newer = 0;
+	if (self->newest != 0) {
+		self->newest->newer = stream;
+	} else {
+		self->oldest = stream;
+	}
+	self->newest = stream;
+}
+
+static void ingest_stream_destroy(ingest_worker *self, ingest_stream *stream)
+{
+	ingest_stream **link = &self->buckets[stream->bucket];
+	while (*link != stream) {
+		link = &(*link)->next_in_bucket;
+	}
+	*link = stream->next_in_bucket;
+
+	ingest_stream_unlink(self, stream);
+	self->stream_count--;
+	free(stream->buffer);
+	free(stream);
+}
+
+static ingest_stream *ingest_stream_find(ingest_worker *self,
+					 const ingest_packet *packet,
+					 bool create)
+{
+	if (self->buckets == 0) {
+		self->buckets = calloc(INGEST_BUCKETS, sizeof(ingest_stream *));
+		assert(self->buckets);
+	}
+
+	size_t bucket = ingest_stream_bucket(packet);
+	for (ingest_stream *stream = self->buckets[bucket]; stream != 0;
+	     stream = stream->next_in_bucket) {
+		if (ingest_stream_matches(stream, packet)) {
+			ingest_stream_unlink(self, stream);
+			ingest_stream_link_newest(self, stream);
+			return stream;
+		}
+	}
+	if (!create) {
+		return 0;
+	}
+
+	if (self->stream_count == PCAP_INGEST_STREAMS_MAX) {
+		ingest_stream_destroy(self, self->oldest);
+	}
+	ingest_stream *stream = calloc(1, sizeof(ingest_stream));
+	assert(stream);
+	memcpy(stream->source, packet->source, 16);
+	memcpy(stream->destination, packet->destination, 16);
+	stream->source_port = packet->source_port;
+	stream->destination_port = packet->destination_port;
+	stream->family = packet->family;
+	stream->bucket = bucket;
+	stream->next_in_bucket = self->buckets[bucket];
+	self->buckets[bucket] = stream;
+	ingest_stream_link_newest(self, stream);
+	self->stream_count++;
+
+	return stream;
+}
+
+static void ingest_worker_tcp(ingest_worker *self, const ingest_packet *packet)
+{
+	ingest_stream *stream =
+		ingest_stream_find(self, packet, packet->payload_len > 0 ||
+							 (packet->tcp_flags &
+							  TCP_SYN));
+	if (stream == 0) {
+		return;
+	}
+
+	if (packet->tcp_flags & TCP_SYN) {
+		stream->synced = true;
+		stream->next_seq = packet->tcp_seq + 1;
+		stream->len = 0;
+		stream->skip = 0;
+		stream->out_of_order_count = 0;
+	}
+
+	if (packet->payload_len > 0) {
+		// Captured part way through, so start from here
+		if (!stream->synced) {
+			stream->synced = true;
+			stream->next_seq = packet->tcp_seq;
+		}
+		ingest_segment segment = { .data = packet->payload,
+					   .len = packet->payload_len,
+					   .seq = packet->tcp_seq,
+					   .seen = packet->seen };
+		ingest_stream_segment(self, stream, &segment);
+	}
+
+	if (packet->tcp_flags & (TCP_FIN | TCP_RST)) {
+		ingest_stream_destroy(self, stream);
+	}
+}
+
+static void ingest_worker_packet(ingest_worker *self,
+				 const ingest_packet *packet)
+{
+	if (packet->protocol == IPPROTO_TCP) {
+		ingest_worker_tcp(self, packet);
+		return;
+	}
+
+	if (ingest_sip_kind((const char *)packet->payload,
+			    packet->payload_len) != SIP_NONE) {
+		ingest_worker_message(self, packet->family, packet->source,
+				      packet->destination, "UDP",
+				      (const char *)packet->payload,
+				      packet->payload_len, &packet->seen);
+	}
+}
+
+static void *ingest_worker_run(void *arg)
+{
+	ingest_worker *self = arg;
+	ingest_packet *batch = malloc(sizeof(ingest_packet) * PCAP_INGEST_BATCH);
+	assert(batch);
+
+	while (true) {
+		pthread_mutex_lock(&self->mutex);
+		while (self->queued == 0 && !self->finished) {
+			pthread_cond_wait(&self->wake_up, &self->mutex);
+		}
+		if (self->queued == 0) {
+			pthread_mutex_unlock(&self->mutex);
+			break;
+		}
+		size_t count = self->queued < PCAP_INGEST_BATCH ?
+				       self->queued :
+				       PCAP_INGEST_BATCH;
+		for (size_t i = 0; i < count; i++) {
+			batch[i] = self->queue[self->head];
+			self->head = (self->head + 1) % PCAP_INGEST_QUEUE_CAPACITY;
+		}
+		self->queued -= count;
+		pthread_cond_signal(&self->has_room);
+		pthread_mutex_unlock(&self->mutex);
+
+		for (size_t i = 0; i < count; i++) {
+			ingest_worker_packet(self, &batch[i]);
+		}
+	}
+	free(batch);
+
+	while (self->oldest != 0) {
+		ingest_stream_destroy(self, self->oldest);
+	}
+	free(self->buckets);
+	self->buckets = 0;
+
+	return NULL;
+}
+
+static void ingest_worker_destroy(ingest_worker **self_ptr)
+{
+	if (*self_ptr) {
+		ingest_worker *self = *self_ptr;
+		pthread_cond_destroy(&self->has_room);
+		pthread_cond_destroy(&self->wake_up);
+		pthread_mutex_destroy(&self->mutex);
+		free(self);
+		*self_ptr = 0;
+	}
+}
+
+static ingest_worker *ingest_worker_new(pcap_ingest_fn fn, void *arg)
+{
+	ingest_worker *self = calloc(1, sizeof(ingest_worker));
+	assert(self);
+	self->fn = fn;
+	self->arg = arg;
+
+	if (pthread_mutex_init(&self->mutex, NULL) != 0 ||
+	    pthread_cond_init(&self->wake_up, NULL) != 0 ||
+	    pthread_cond_init(&self->has_room, NULL) != 0) {
+		fprintf(stderr, "Failed to initialise pcap ingest locks\n");
+		free(self);
+		return 0;
+	}
+	if (pthread_create(&self->thread, NULL, ingest_worker_run, self) != 0) {
+		fprintf(stderr, "Failed to start pcap ingest thread\n");
+		ingest_worker_destroy(&self);
+		return 0;
+	}
+
+	return self;
+}
+
+int pcap_ingest_file(const char *file_name, size_t workers, pcap_ingest_fn fn,
+		     void *arg, pcap_ingest_stats *stats)
+{
+	assert(file_name);
+	assert(workers > 0 && workers <= PCAP_INGEST_WORKERS_MAX);
+	assert(fn);
+	assert(stats);
+
+	memset(stats, 0, sizeof(pcap_ingest_stats));
+	struct timespec started;
+	clock_gettime(CLOCK_MONOTONIC, &started);
+
+	int fd = open(file_name, O_RDONLY);
+	if (fd == -1) {
+		perror("open");
+		return EXIT_FAILURE;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || file_stat.st_size < 4) {
+		fprintf(stderr, "%s is not a pcap or pcapng file\n", file_name);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	size_t size = (size_t)file_stat.st_size;
+	const uint8_t *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+	madvise((void *)data, size, MADV_SEQUENTIAL);
+
+	uint32_t magic = read_u32(data, false);
+	bool pcapng = magic == PCAPNG_SECTION_HEADER;
+	if (!pcapng && magic != PCAP_MAGIC && magic != PCAP_MAGIC_NANO &&
+	    read_u32(data, true) != PCAP_MAGIC &&
+	    read_u32(data, true) != PCAP_MAGIC_NANO) {
+		fprintf(stderr, "%s is not a pcap or pcapng file\n", file_name);
+		munmap((void *)data, size);
+		return EXIT_FAILURE;
+	}
+
+	ingest_reader reader;
+	memset(&reader, 0, sizeof(reader));
+	reader.workers = calloc(workers, sizeof(ingest_worker *));
+	assert(reader.workers);
+	for (size_t i = 0; i < workers; i++) {
+		reader.workers[i] = ingest_worker_new(fn, arg);
+		if (reader.workers[i] == 0) {
+			break;
+		}
+		reader.worker_count++;
+	}
+	reader.pending = malloc(sizeof(*reader.pending) * workers);
+	assert(reader.pending);
+	reader.pending_count = calloc(workers, sizeof(size_t));
+	assert(reader.pending_count);
+
+	int result = EXIT_FAILURE;
+	if (reader.worker_count > 0) {
+		result = pcapng ? ingest_read_pcapng(&reader, data, size) :
+				ingest_read_pcap(&reader, data, size);
+	}
+
+	for (size_t i = 0; i < reader.worker_count; i++) {
+		ingest_reader_flush(&reader, i);
+		ingest_worker *worker = reader.workers[i];
+		pthread_mutex_lock(&worker->mutex);
+		worker->finished = true;
+		pthread_cond_signal(&worker->wake_up);
+		pthread_mutex_unlock(&worker->mutex);
+	}
+	for (size_t i = 0; i < reader.worker_count; i++) {
+		ingest_worker *worker = reader.workers[i];
+		if (pthread_join(worker->thread, NULL) != 0) {
+			fprintf(stderr, "Failed to join pcap ingest thread.\n");
+		}
+		stats->sip_requests += worker->sip_requests;
+		stats->sip_responses += worker->sip_responses;
+		stats->events += worker->events;
+		stats->failed += worker->failed;
+		ingest_worker_destroy(&reader.workers[i]);
+	}
+	stats->packets = reader.packets;
+	stats->skipped = reader.skipped;
+
+	free(reader.pending_count);
+	free(reader.pending);
+	free(reader.workers);
+	munmap((void *)data, size);
+
+	struct timespec finished;
+	clock_gettime(CLOCK_MONOTONIC, &finished);
+	stats->seconds = (double)(finished.tv_sec - started.tv_sec) +
+			 (double)(finished.tv_nsec - started.tv_nsec) / 1e9;
+
+	return result;
+}
+
+static int pcap_ingest_log(void *arg, const pcap_ingest_message *message)
+{
+	sentrypeer_config *config = arg;
+
+	bad_actor *bad_actor_event = bad_actor_new(
+		0, util_duplicate_string(message->source_ip),
+		util_duplicate_string(message->destination_ip), 0, 0,
+		util_duplicate_string(message->transport_type), 0,
+		util_duplicate_string("passive"), config->node_id);
+	assert(bad_actor_event);
+	// When it was captured, not now
+	event_timestamp_at(&message->seen, bad_actor_event->event_timestamp);
+
+	uint64_t started = metrics_start(config->metrics);
+	int parsed = sip_message_parser(message->sip_message,
+					message->sip_message_len,
+					bad_actor_event, config);
+	metrics_observe(config->metrics, METRICS_SIP_PARSE_SECONDS, started);
+	if (parsed != EXIT_SUCCESS) {
+		metrics_add(config->metrics, METRICS_SIP_PARSE_FAILURES, 1);
+		bad_actor_destroy(&bad_actor_event);
+		return EXIT_FAILURE;
+	}
+
+	sinks_publish(config->sinks, bad_actor_event, SINK_EVENT_WAIT);
+
+	return EXIT_SUCCESS;
+}
+
+int pcap_ingest_run(sentrypeer_config *config, const char *file_name,
+		    pcap_ingest_stats *stats)
+{
+	assert(config);
+	assert(config->sinks);
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t workers = cpus < 1 ? 1 :
+			 cpus > PCAP_INGEST_WORKERS_MAX ?
+				    PCAP_INGEST_WORKERS_MAX :
+				    (size_t)cpus;
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Reading %s with %zu workers...\n", file_name,
+			workers);
+	}
+
+	return pcap_ingest_file(file_name, workers, pcap_ingest_log, config,
+				stats);
+}
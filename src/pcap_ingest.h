@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+#ifndef SENTRYPEER_PCAP_INGEST_H
+#define SENTRYPEER_PCAP_INGEST_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "conf.h"
+
+#define PCAP_INGEST_WORKERS_MAX 32
+// Packets waiting for each worker before the reader waits for it
+#define PCAP_INGEST_QUEUE_CAPACITY 4096
+// Packets handed to a worker in one go
+#define PCAP_INGEST_BATCH 256
+// Most of a TCP stream kept waiting for the rest of a SIP message
+#define PCAP_INGEST_STREAM_MAX 65536
+// TCP streams each worker follows at once, the least recently seen go first
+#define PCAP_INGEST_STREAMS_MAX 16384
+// Segments kept per TCP stream waiting for one that's missing
+#define PCAP_INGEST_OUT_OF_ORDER_MAX 8
+
+// One SIP request found in a capture, only valid during the callback
+typedef struct pcap_ingest_message pcap_ingest_message;
+struct pcap_ingest_message {
+	const char *sip_message;
+	size_t sip_message_len;
+	const char *transport_type;
+	const char *source_ip;
+	const char *destination_ip;
+	// When it was captured
+	struct timespec seen;
+};
+
+typedef struct pcap_ingest_stats pcap_ingest_stats;
+struct pcap_ingest_stats {
+	uint64_t packets;
+	// Not UDP or TCP over IP, IP fragments or cut short by the snaplen
+	uint64_t skipped;
+	uint64_t sip_requests;
+	uint64_t sip_responses;
+	uint64_t events;
+	uint64_t failed;
+	double seconds;
+};
+
+/**
+ * Called for each SIP request. Requests from the same flow always go to the
+ * same worker thread, in the order they were sent.
+ *
+ * @return EXIT_SUCCESS, or EXIT_FAILURE to count it as failed.
+ */
+typedef int (*pcap_ingest_fn)(void *arg, const pcap_ingest_message *message);
+
+/**
+ * Read a pcap or pcapng file with mmap(), reassemble SIP over UDP and TCP
+ * and hand every SIP request to fn on one of workers threads, sharded by
+ * flow.
+ *
+ * @param file_name The capture.
+ * @param workers 1 to PCAP_INGEST_WORKERS_MAX.
+ * @param fn What to do with each SIP request.
+ * @param arg Passed to fn.
+ * @param stats Filled in, even on failure.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the file couldn't be read.
+ */
+int pcap_ingest_file(const char *file_name, size_t workers, pcap_ingest_fn fn,
+		     void *arg, pcap_ingest_stats *stats);
+
+/**
+ * pcap_ingest_file() with a worker per CPU, parsing each SIP request and
+ * publishing it to config->sinks as if it had just arrived, apart from the
+ * event_timestamp being when it was captured. Waits for the sinks rather
+ * than dropping anything.
+ */
+int pcap_ingest_run(sentrypeer_config *config, const char *file_name,
+		    pcap_ingest_stats *stats);
+
+#endif //SENTRYPEER_PCAP_INGEST_H
@@ -20,14 +20,25 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "utils.h"
-#include "jansson.h"
 #include "json_logger.h"
 #include "database.h"
+#include "metrics.h"
+#include "sinks.h"
 
 #define DHT_PORT 4222
 #define DHT_BOOTSTRAP_WAIT_TIME 5
+// event_uuids of recent DHT values, so one that arrives again before the
+// db sink has saved it isn't saved twice
+#define DHT_SEEN_SLOTS 4096
+
+// Held while a value is handled, so once peer_to_peer_dht_stop_listening()
+// has it nothing more is published
+static pthread_mutex_t dht_value_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool dht_listening = false;
+static char dht_seen[DHT_SEEN_SLOTS][UTILS_UUID_STRING_LEN];
 
 struct op_context {
 	dht_runner *runner;
@@ -56,171 +67,113 @@ static bool dht_value_callback(const dht_value *value, bool expired,
 	if (data.size == 0) {
 		return true;
 	}
-
-	// TODO: Move to a validator function
-	if (data.size > 0) {
-		char *received_value_str = malloc(data.size + 1);
-		memcpy(received_value_str, data.data, data.size);
-		received_value_str[data.size] = '\0';
-
-		// Turn back into JSON string
-		json_error_t error;
-		// Maybe switch to json_loadb() instead of json_loads() if needed:
-		// https://github.com/savoirfairelinux/opendht/issues/596#issuecomment-1079957048
-		json_t *json = json_loads(received_value_str, 0, &error);
-
-		if (!json_is_object(json)) {
-			if (config->debug_mode || config->verbose_mode) {
-				fprintf(stderr,
-					"JSON from DHT is not valid.\n");
-				fprintf(stderr, "Failed to parse: %s\n",
-					error.text);
-			}
-			json_decref(json);
-			free(received_value_str);
-			return true;
-		}
-
-		const json_t *node_id =
-			json_object_get(json, "created_by_node_id");
-		if (!node_id) {
-			if (config->debug_mode || config->verbose_mode) {
-				fprintf(stderr,
-					"JSON from DHT is not valid.\n");
-				fprintf(stderr, "No node_id in JSON.\n");
-			}
-			json_decref(json);
-			free(received_value_str);
-			return true;
+	metrics_add(config->metrics, METRICS_DHT_VALUES_RECEIVED, 1);
+
+	// One pass over the value both checks it and gives us the bad actor.
+	// It needn't end in a '\0', so there's no copy to make first.
+	const char *error = 0;
+	bad_actor *bad_actor_event =
+		bad_actor_json_read((const char *)data.data, data.size, &error);
+	if (!bad_actor_event) {
+		if (config->debug_mode || config->verbose_mode) {
+			fprintf(stderr, "JSON from DHT is not valid.\n");
+			fprintf(stderr, "Failed to parse: %s\n", error);
 		}
+		return true;
+	}
 
-		const char *node_id_str = json_string_value(node_id);
-		if (!node_id_str) {
-			if (config->debug_mode || config->verbose_mode) {
-				fprintf(stderr,
-					"JSON from DHT is not valid.\n");
-				fprintf(stderr, "Node ID is not a string.\n");
-			}
-			json_decref(json);
-			free(received_value_str);
-			return true;
+	const char *node_id_str = bad_actor_event->created_by_node_id;
+	uuid_t node_id_uuid_check;
+	if (uuid_parse(node_id_str, node_id_uuid_check) != EXIT_SUCCESS) {
+		if (config->debug_mode || config->verbose_mode) {
+			fprintf(stderr,
+				"Node ID uuid in JSON from DHT is not valid.\n");
 		}
+		bad_actor_destroy(&bad_actor_event);
+		return true;
+	}
 
-		uuid_t node_id_uuid_check;
-		if (uuid_parse(node_id_str, node_id_uuid_check) !=
-		    EXIT_SUCCESS) {
-			if (config->debug_mode || config->verbose_mode) {
-				fprintf(stderr,
-					"Node ID uuid in JSON from DHT is not valid.\n");
-			}
-			json_decref(json);
-			free(received_value_str);
-			return true;
-		}
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Node ID from DHT value is: %s\n", node_id_str);
+	}
 
+	// Check it's not from us
+	if (strncmp(node_id_str, config->node_id, strlen(config->node_id)) ==
+	    0) {
 		if (config->debug_mode || config->verbose_mode) {
-			fprintf(stderr, "Node ID from DHT value is: %s\n",
-				node_id_str);
+			fprintf(stderr,
+				"Node ID from DHT value is the same as ours. Not saving bad_actor.\n");
 		}
+		bad_actor_destroy(&bad_actor_event);
+		return true;
+	}
 
-		// Check it's not from us
-		if (strncmp(node_id_str, config->node_id,
-			    strlen(config->node_id)) == 0) {
-			if (config->debug_mode || config->verbose_mode) {
-				fprintf(stderr,
-					"Node ID from DHT value is the same as ours. Not saving bad_actor.\n");
-			}
-			json_decref(json);
-			free(received_value_str);
-			return true;
+	const char *event_uuid_str = bad_actor_event->event_uuid;
+	if (!is_valid_uuid(event_uuid_str)) {
+		if (config->debug_mode || config->verbose_mode) {
+			fprintf(stderr,
+				"event_uuid in JSON from DHT is invalid.\n");
 		}
+		bad_actor_destroy(&bad_actor_event);
+		return true;
+	}
 
-		// TODO: Validate event_uuid and check our database to see if we already have this bad_actor
-		// by using the event_uuid
-		const json_t *event_uuid = json_object_get(json, "event_uuid");
-		if (!event_uuid) {
-			if (config->debug_mode || config->verbose_mode) {
-				fprintf(stderr,
-					"JSON from DHT is not valid.\n");
-				fprintf(stderr, "No event_uuid in JSON.\n");
-			}
-			json_decref(json);
-			free(received_value_str);
-			return true;
-		}
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "event_uuid from DHT value is: %s\n",
+			event_uuid_str);
 
-		const char *event_uuid_str = json_string_value(event_uuid);
-		if (!event_uuid_str) {
-			if (config->debug_mode || config->verbose_mode) {
-				fprintf(stderr,
-					"JSON from DHT is not valid.\n");
-				fprintf(stderr,
-					"event_uuid is not a string.\n");
-			}
-			json_decref(json);
-			free(received_value_str);
-			return true;
-		}
+		fprintf(stderr,
+			"Checking we haven't seen this event_uuid before in our db: %s\n",
+			event_uuid_str);
+	}
 
-		if (!is_valid_uuid(event_uuid_str)) {
-			if (config->debug_mode || config->verbose_mode) {
-				fprintf(stderr,
-					"event_uuid in JSON from DHT is invalid.\n");
-			}
-			json_decref(json);
-			free(received_value_str);
-			return true;
-		}
+	pthread_mutex_lock(&dht_value_mutex);
+	if (!dht_listening) {
+		pthread_mutex_unlock(&dht_value_mutex);
+		bad_actor_destroy(&bad_actor_event);
+		return false;
+	}
 
+	// Direct mapped, so a collision only means falling back to the db
+	char *seen = dht_seen[util_hash64(event_uuid_str,
+					  strlen(event_uuid_str)) %
+			      DHT_SEEN_SLOTS];
+	if (strcmp(seen, event_uuid_str) == 0 ||
+	    db_bad_actor_exists(event_uuid_str, config)) {
+		pthread_mutex_unlock(&dht_value_mutex);
 		if (config->debug_mode || config->verbose_mode) {
-			fprintf(stderr, "event_uuid from DHT value is: %s\n",
-				event_uuid_str);
-
 			fprintf(stderr,
-				"Checking we haven't seen this event_uuid before in our db: %s\n",
+				"bad_actor event_uuid already exists, not saving: %s\n",
 				event_uuid_str);
 		}
+		bad_actor_destroy(&bad_actor_event);
+		return true;
+	}
+	snprintf(seen, UTILS_UUID_STRING_LEN, "%s", event_uuid_str);
 
-		if (!db_bad_actor_exists(event_uuid_str, config)) {
-			// TODO: Move this to a dht_save_bad_actor function
-			// It's not from us, so it's a new bad_actor we want to save
-			if (config->debug_mode || config->verbose_mode) {
-				fprintf(stderr,
-					"Saving new bad_actor from node_id: %s\n",
-					node_id_str);
-			}
-
-			// Ready to convert JSON to a bad_actor
-			bad_actor *bad_actor_event =
-				json_to_bad_actor(config, received_value_str);
-			if (!bad_actor_event) {
-				fprintf(stderr,
-					"Converting JSON to a bad_actor failed.\n");
-				json_decref(json);
-				free(received_value_str);
-				return true;
-			}
-
-			if (bad_actor_log(config, bad_actor_event) !=
-			    EXIT_SUCCESS) {
-				fprintf(stderr, "Logging bad_actor failed.\n");
-			}
-
-			json_decref(json);
-			free(received_value_str);
-			bad_actor_destroy(&bad_actor_event);
-			return true;
-		} else {
-			if (config->debug_mode || config->verbose_mode) {
-				fprintf(stderr,
-					"bad_actor event_uuid already exists, not saving: %s\n",
-					event_uuid_str);
-			}
-			json_decref(json);
-			free(received_value_str);
-			return true;
-		}
+	// It's not from us, so it's a new bad_actor we want to save
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Saving new bad_actor from node_id: %s\n",
+			node_id_str);
+	}
+
+	if (config->sinks != 0) {
+		sinks_publish(config->sinks, bad_actor_event,
+			      SINK_EVENT_FROM_PEER);
+		pthread_mutex_unlock(&dht_value_mutex);
+		return true;
+	}
+
+	json_buffer bad_actor_json;
+	json_buffer_init(&bad_actor_json);
+	if (bad_actor_log(config, bad_actor_event, &bad_actor_json) !=
+	    EXIT_SUCCESS) {
+		fprintf(stderr, "Logging bad_actor failed.\n");
 	}
+	json_buffer_release(&bad_actor_json);
+	bad_actor_destroy(&bad_actor_event);
+	pthread_mutex_unlock(&dht_value_mutex);
+
 	return true;
 }
 
@@ -236,6 +189,8 @@ static void dht_done_callback(bool ok, void *user_data)
 		fprintf(stderr, "Done callback. %s\n",
 			ok ? "Success!" : "Failure :-(");
 	}
+	metrics_add(config->metrics,
+		    ok ? METRICS_DHT_PUTS : METRICS_DHT_PUT_FAILURES, 1);
 	free(ctx);
 }
 
@@ -297,6 +252,9 @@ int peer_to_peer_dht_run(sentrypeer_config *config)
 		fprintf(stderr,
 			"Listening for changes to the bad_actors DHT key\n");
 	}
+	pthread_mutex_lock(&dht_value_mutex);
+	dht_listening = true;
+	pthread_mutex_unlock(&dht_value_mutex);
 	dht_op_token *token =
 		dht_runner_listen(runner, config->dht_info_hash,
 				  dht_value_callback, op_context_free, ctx);
@@ -307,7 +265,7 @@ int peer_to_peer_dht_run(sentrypeer_config *config)
 }
 
 int peer_to_peer_dht_save(sentrypeer_config *config,
-			  bad_actor const *bad_actor_event)
+			  const char *bad_actor_json)
 {
 	if (config->debug_mode || config->verbose_mode) {
 		fprintf(stderr, "Saving bad actor on the DHT...\n");
@@ -320,11 +278,10 @@ int peer_to_peer_dht_save(sentrypeer_config *config,
 
 	assert(config->dht_node);
 
-	char *bad_actor_json = bad_actor_to_json(config, bad_actor_event);
 	// We don't assert here, because we want to continue even if it fails
 	if (bad_actor_json == NULL) {
 		fprintf(stderr, "Failed to convert bad actor to json.\n");
-		free(bad_actor_json);
+		metrics_add(config->metrics, METRICS_DHT_PUT_FAILURES, 1);
 		free(ctx);
 		return EXIT_FAILURE;
 	}
@@ -336,7 +293,6 @@ int peer_to_peer_dht_save(sentrypeer_config *config,
 		dht_runner_put(config->dht_node, config->dht_info_hash, val,
 			       dht_done_callback, ctx, true);
 		dht_value_unref(val);
-		free(bad_actor_json);
 		if (config->debug_mode || config->verbose_mode) {
 			fprintf(stderr,
 				"bad actor permanently saved on the DHT...\n");
@@ -344,7 +300,7 @@ int peer_to_peer_dht_save(sentrypeer_config *config,
 	} else {
 		fprintf(stderr, "Failed to create DHT value from string: %s\n",
 			bad_actor_json);
-		free(bad_actor_json);
+		metrics_add(config->metrics, METRICS_DHT_PUT_FAILURES, 1);
 		free(ctx);
 
 		return EXIT_FAILURE;
@@ -353,14 +309,29 @@ int peer_to_peer_dht_save(sentrypeer_config *config,
 	return EXIT_SUCCESS;
 }
 
-int peer_to_peer_dht_stop(sentrypeer_config *config)
+int peer_to_peer_dht_stop_listening(sentrypeer_config *config)
 {
 	if (config->debug_mode || config->verbose_mode) {
-		fprintf(stderr, "Stopping peer to peer DHT daemon...\n");
+		fprintf(stderr, "Stopping listening on the DHT...\n");
 	}
 
+	// Waits for a value being handled, and any that turn up before the
+	// listen is cancelled are dropped
+	pthread_mutex_lock(&dht_value_mutex);
+	dht_listening = false;
+	pthread_mutex_unlock(&dht_value_mutex);
 	dht_runner_cancel_listen(config->dht_node, config->dht_info_hash,
 				 config->dht_op_token);
+
+	return EXIT_SUCCESS;
+}
+
+int peer_to_peer_dht_stop(sentrypeer_config *config)
+{
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Stopping peer to peer DHT daemon...\n");
+	}
+
 	dht_runner_shutdown(config->dht_node, NULL, NULL);
 	dht_op_token_delete(config->dht_op_token);
 	dht_runner_delete(config->dht_node);
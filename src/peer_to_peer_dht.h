@@ -22,9 +22,13 @@
 #include "bad_actor.h"
 
 int peer_to_peer_dht_run(sentrypeer_config *config);
+// Stop taking bad actors from the DHT, leaving it up to save ours
+int peer_to_peer_dht_stop_listening(sentrypeer_config *config);
 int peer_to_peer_dht_stop(sentrypeer_config *config);
+// bad_actor_json is the bad actor as bad_actor_json_once() wrote it,
+// NULL if that failed
 int peer_to_peer_dht_save(sentrypeer_config *config,
-			  bad_actor const *bad_actor_event);
+			  const char *bad_actor_json);
 
 #endif //SENTRYPEER_PEER_TO_PEER_DHT_H
 
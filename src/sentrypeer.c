@@ -11,6 +11,7 @@
                              |___/
 */
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <syslog.h>
@@ -25,6 +26,14 @@
 #include "conf.h"
 #include "sip_daemon.h"
 #include "http_daemon.h"
+#include "db_maintenance.h"
+#include "database.h"
+#include "geoip.h"
+#include "sinks.h"
+#include "shm_ring_writer.h"
+#include "pcap_ingest.h"
+#include "db_import.h"
+#include "db_export.h"
 
 #if HAVE_OPENDHT_C != 0
 #include "peer_to_peer_dht.h"
@@ -58,6 +67,87 @@ int main(int argc, char **argv)
 		}
 	}
 
+	// Before anything can log a bad actor
+	if (config->geoip_db_file != 0 || config->geoip_asn_db_file != 0) {
+		config->geoip = geoip_new(config->geoip_db_file,
+					  config->geoip_asn_db_file);
+		if (config->geoip == 0) {
+			fprintf(stderr, "Failed to open GeoIP database.\n");
+			if (config->syslog_mode) {
+				syslog(LOG_ERR,
+				       "Failed to open GeoIP database\n");
+			}
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (config->shm_ring_name != 0) {
+		config->shm_ring = shm_ring_writer_new(config->shm_ring_name,
+						       SHM_RING_DEFAULT_SLOTS);
+		if (config->shm_ring == 0) {
+			fprintf(stderr, "Failed to create shared memory ring %s\n",
+				config->shm_ring_name);
+			if (config->syslog_mode) {
+				syslog(LOG_ERR,
+				       "Failed to create shared memory ring\n");
+			}
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// Straight into the database, without starting anything else
+	if (config->import_json_file_count > 0) {
+		db_import_stats stats;
+		int imported = db_import_json_files(
+			config, config->import_json_files,
+			config->import_json_file_count, 0, &stats);
+
+		fprintf(stderr,
+			"%" PRIu64 " files, %" PRIu64 " bytes, %" PRIu64
+			" lines: %" PRIu64 " events imported, %" PRIu64
+			" duplicates, %" PRIu64 " failed in %.3f seconds (%.0f events/sec)\n",
+			stats.files, stats.bytes, stats.lines, stats.imported,
+			stats.duplicates, stats.failed, stats.seconds,
+			stats.seconds > 0 ?
+				(double)stats.imported / stats.seconds :
+				0);
+		sentrypeer_config_destroy(&config);
+
+		return imported;
+	}
+
+	// Likewise, just what's been logged since the last export
+	if (config->export_parquet_dir != 0) {
+		db_export_stats stats;
+		int exported = db_export_parquet(
+			config, config->export_parquet_dir, &stats);
+
+		fprintf(stderr,
+			"%" PRIu64 " rows exported to %" PRIu64
+			" Parquet files in %s in %.3f seconds, cursor %" PRId64
+			"\n",
+			stats.rows, stats.files, config->export_parquet_dir,
+			stats.seconds, stats.cursor);
+		sentrypeer_config_destroy(&config);
+
+		return exported;
+	}
+
+	// And switching an old database over to incremental auto_vacuum
+	if (config->vacuum_mode) {
+		int vacuumed = db_maintenance_vacuum(config);
+		sentrypeer_config_destroy(&config);
+
+		return vacuumed;
+	}
+
+	// Reading a capture is a one off, with nothing listening
+	if (config->ingest_pcap_file != 0) {
+		config->api_mode = false;
+		config->sip_mode = false;
+		config->p2p_dht_mode = false;
+	}
+
 	// Threaded, so start the HTTP daemon first
 	if (config->api_mode && (http_daemon_init(config) != EXIT_SUCCESS)) {
 		fprintf(stderr, "Failed to start %s server on port %d\n",
@@ -71,6 +161,39 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
+	// After the HTTP daemon has built what the API serves, before anything
+	// can log a bad actor
+	config->sinks = sinks_new(config);
+	if (config->sinks == 0) {
+		fprintf(stderr, "Failed to start sinks.\n");
+		if (config->syslog_mode) {
+			syslog(LOG_ERR, "Failed to start sinks\n");
+		}
+		exit(EXIT_FAILURE);
+	}
+
+	if (config->ingest_pcap_file != 0) {
+		pcap_ingest_stats stats;
+		int ingested = pcap_ingest_run(config, config->ingest_pcap_file,
+					       &stats);
+		// Waits for every sink to catch up
+		sinks_destroy(&config->sinks);
+
+		fprintf(stderr,
+			"%s: %" PRIu64 " packets, %" PRIu64
+			" SIP requests, %" PRIu64 " SIP responses, %" PRIu64
+			" events logged, %" PRIu64 " failed to parse, %" PRIu64
+			" skipped in %.3f seconds (%.0f events/sec)\n",
+			config->ingest_pcap_file, stats.packets,
+			stats.sip_requests, stats.sip_responses, stats.events,
+			stats.failed, stats.skipped, stats.seconds,
+			stats.seconds > 0 ? (double)stats.events / stats.seconds :
+					    0);
+		sentrypeer_config_destroy(&config);
+
+		return ingested;
+	}
+
 	if (config->oauth2_mode &&
 	    (config->debug_mode || config->verbose_mode)) {
 		fprintf(stderr,
@@ -136,6 +259,22 @@ int main(int argc, char **argv)
 	}
 #endif // HAVE_OPENDHT_C
 
+	if (db_maintenance_run(config) != EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to start DB maintenance.\n");
+		if (config->syslog_mode) {
+			syslog(LOG_ERR, "Failed to start DB maintenance\n");
+		}
+		exit(EXIT_FAILURE);
+	}
+
+	if (db_export_run(config) != EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to start Parquet archive.\n");
+		if (config->syslog_mode) {
+			syslog(LOG_ERR, "Failed to start Parquet archive\n");
+		}
+		exit(EXIT_FAILURE);
+	}
+
 	while (cleanup_flag == 0) {
 		sleep(1);
 	}
@@ -155,6 +294,24 @@ int main(int argc, char **argv)
 		fprintf(stderr, "Issue cleanly stopping sip_daemon.\n");
 	}
 
+#if HAVE_OPENDHT_C != 0
+	if (config->p2p_dht_mode &&
+	    peer_to_peer_dht_stop_listening(config) != EXIT_SUCCESS) {
+		fprintf(stderr, "Issue cleanly stopping DHT listening.\n");
+	}
+#endif // HAVE_OPENDHT_C
+
+	if (db_maintenance_stop(config) != EXIT_SUCCESS) {
+		fprintf(stderr, "Issue cleanly stopping db_maintenance.\n");
+	}
+	if (db_export_stop(config) != EXIT_SUCCESS) {
+		fprintf(stderr, "Issue cleanly stopping Parquet archive.\n");
+	}
+
+	// Once nothing more can be published, and while the DHT can still take
+	// what's left
+	sinks_destroy(&config->sinks);
+
 #if HAVE_OPENDHT_C != 0
 	if (config->p2p_dht_mode &&
 	    peer_to_peer_dht_stop(config) != EXIT_SUCCESS) {
@@ -162,6 +319,13 @@ int main(int argc, char **argv)
 	}
 #endif // HAVE_OPENDHT_C
 
+	// Whatever was counted since the last maintenance tick
+	if (config->event_series != 0 &&
+	    db_save_event_series(config->event_series, config) !=
+		    EXIT_SUCCESS) {
+		fprintf(stderr, "Issue saving event series.\n");
+	}
+
 	if (config->debug_mode || config->verbose_mode) {
 		fprintf(stderr, "Stopped %s\n", PACKAGE_NAME);
 		if (config->syslog_mode) {
@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+#ifndef SENTRYPEER_SHM_RING_H
+#define SENTRYPEER_SHM_RING_H 1
+
+// The layout of the shared memory event ring, as written by
+// shm_ring_writer.c and read by shm_ring_reader.c. Nothing else from
+// SentryPeer is needed to read it.
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define SHM_RING_MAGIC 0x53505231u // "SPR1"
+#define SHM_RING_VERSION 1
+// Must be a power of 2
+#define SHM_RING_DEFAULT_SLOTS 4096
+#define SHM_RING_SLOT_SIZE 512
+#define SHM_RING_HEADER_SIZE 128
+
+// record->transport
+#define SHM_RING_TRANSPORT_UNKNOWN 0
+#define SHM_RING_TRANSPORT_UDP 1
+#define SHM_RING_TRANSPORT_TCP 2
+#define SHM_RING_TRANSPORT_TLS 3
+
+// record->collected_method
+#define SHM_RING_COLLECTED_UNKNOWN 0
+#define SHM_RING_COLLECTED_PASSIVE 1
+#define SHM_RING_COLLECTED_RESPONSIVE 2
+
+// record->flags, a bad actor a DHT peer told us about
+#define SHM_RING_FROM_PEER 1
+
+// The writer only ever adds to head. Position p is in slot p % slot_count.
+typedef struct shm_ring_header shm_ring_header;
+struct shm_ring_header {
+	atomic_uint magic;
+	uint32_t version;
+	uint32_t slot_count;
+	uint32_t slot_size;
+	// Set once the writer has gone, nothing more will come
+	atomic_uint closed;
+	_Alignas(64) atomic_uint_fast64_t head;
+};
+
+// A seqlock per slot. sequence is 2p + 1 while position p is being
+// written and 2p + 2 once it's done, so a reader knows it has what it asked
+// for if sequence was 2p + 2 both before and after reading it.
+typedef struct shm_ring_record shm_ring_record;
+struct shm_ring_record {
+	atomic_uint_fast64_t sequence;
+	// CLOCK_REALTIME nanoseconds when we saw it
+	int64_t seen_ns;
+	uint8_t event_uuid[16];
+	uint8_t created_by_node_id[16];
+	// IPv4 addresses are IPv4-mapped, i.e. ::ffff:a.b.c.d
+	uint8_t source_ip[16];
+	uint8_t destination_ip[16];
+	uint8_t transport;
+	uint8_t collected_method;
+	uint8_t flags;
+	uint8_t reserved;
+	// Lengths of the '\0' terminated strings one after the other in text,
+	// cut short on a UTF-8 boundary if they don't all fit
+	uint16_t method_len;
+	uint16_t called_number_len;
+	uint16_t user_agent_len;
+	uint16_t reserved_len;
+	char text[SHM_RING_SLOT_SIZE - 92];
+};
+
+#endif //SENTRYPEER_SHM_RING_H
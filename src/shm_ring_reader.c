@@ -0,0 +1,225 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shm_ring_reader.h"
+
+// Looks at head this many times before sleeping
+#define SHM_RING_READER_SPINS 1024
+
+struct shm_ring_reader {
+	const shm_ring_header *header;
+	const shm_ring_record *records;
+	size_t size;
+	uint64_t next;
+	const shm_ring_record *last;
+	uint64_t last_sequence;
+};
+
+shm_ring_reader *shm_ring_reader_open(const char *name)
+{
+	assert(name);
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1) {
+		perror("shm_open");
+		return 0;
+	}
+
+	struct stat ring_stat;
+	if (fstat(fd, &ring_stat) != 0 ||
+	    (size_t)ring_stat.st_size < SHM_RING_HEADER_SIZE) {
+		fprintf(stderr, "%s is not a SentryPeer event ring\n", name);
+		close(fd);
+		return 0;
+	}
+	size_t size = (size_t)ring_stat.st_size;
+
+	void *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		perror("mmap");
+		return 0;
+	}
+
+	const shm_ring_header *header = base;
+	bool understood =
+		atomic_load_explicit(&header->magic, memory_order_acquire) ==
+			SHM_RING_MAGIC &&
+		header->version == SHM_RING_VERSION &&
+		header->slot_size == sizeof(shm_ring_record) &&
+		header->slot_count > 0 &&
+		(header->slot_count & (header->slot_count - 1)) == 0 &&
+		SHM_RING_HEADER_SIZE +
+				(size_t)header->slot_count *
+					sizeof(shm_ring_record) <=
+			size;
+	if (!understood) {
+		fprintf(stderr, "%s is not a SentryPeer event ring we know\n",
+			name);
+		munmap(base, size);
+		return 0;
+	}
+
+	shm_ring_reader *self = calloc(1, sizeof(shm_ring_reader));
+	assert(self);
+	self->header = header;
+	self->records = (const shm_ring_record *)((const char *)base +
+						  SHM_RING_HEADER_SIZE);
+	self->size = size;
+	self->next =
+		atomic_load_explicit(&header->head, memory_order_acquire);
+
+	return self;
+}
+
+void shm_ring_reader_close(shm_ring_reader **self_ptr)
+{
+	assert(self_ptr);
+	if (*self_ptr) {
+		shm_ring_reader *self = *self_ptr;
+		munmap((void *)self->header, self->size);
+		free(self);
+		*self_ptr = 0;
+	}
+}
+
+const shm_ring_record *shm_ring_reader_next(shm_ring_reader *self,
+					    uint64_t *dropped)
+{
+	assert(self);
+	assert(dropped);
+
+	uint64_t slot_count = self->header->slot_count;
+	uint64_t head =
+		atomic_load_explicit(&self->header->head, memory_order_acquire);
+
+	while (self->next < head) {
+		// Lapped, so skip to the oldest still there
+		if (head - self->next > slot_count) {
+			*dropped += head - slot_count - self->next;
+			self->next = head - slot_count;
+		}
+
+		const shm_ring_record *record =
+			&self->records[self->next & (slot_count - 1)];
+		uint64_t expected = self->next * 2 + 2;
+		self->next++;
+		if (atomic_load_explicit(&record->sequence,
+					 memory_order_acquire) == expected) {
+			self->last = record;
+			self->last_sequence = expected;
+			return record;
+		}
+		// Overwritten since we looked at head
+		(*dropped)++;
+	}
+
+	return 0;
+}
+
+bool shm_ring_reader_valid(shm_ring_reader const *self)
+{
+	assert(self);
+
+	if (self->last == 0) {
+		return false;
+	}
+	// Everything read from the record happens before this
+	atomic_thread_fence(memory_order_acquire);
+
+	return atomic_load_explicit(&self->last->sequence,
+				    memory_order_relaxed) == self->last_sequence;
+}
+
+bool shm_ring_reader_closed(shm_ring_reader const *self)
+{
+	assert(self);
+
+	return atomic_load_explicit(&self->header->closed,
+				    memory_order_acquire) != 0;
+}
+
+static bool shm_ring_reader_ready(shm_ring_reader const *self)
+{
+	return atomic_load_explicit(&self->header->head,
+				    memory_order_acquire) > self->next;
+}
+
+int shm_ring_reader_wait(shm_ring_reader *self, int timeout_ms)
+{
+	assert(self);
+
+	for (int i = 0; i < SHM_RING_READER_SPINS; i++) {
+		if (shm_ring_reader_ready(self)) {
+			return EXIT_SUCCESS;
+		}
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t deadline = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec +
+			   (int64_t)timeout_ms * 1000000;
+	struct timespec poll = { .tv_sec = 0,
+				 .tv_nsec = SHM_RING_READER_POLL_US * 1000 };
+
+	while (!shm_ring_reader_ready(self)) {
+		if (shm_ring_reader_closed(self)) {
+			return EXIT_FAILURE;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if ((int64_t)now.tv_sec * 1000000000 + now.tv_nsec >=
+		    deadline) {
+			return EXIT_FAILURE;
+		}
+		nanosleep(&poll, NULL);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// A torn record can have any lengths at all, so never point outside text.
+// Its last byte is never written, so is always a '\0'.
+static const char *shm_ring_record_text(const shm_ring_record *record,
+					size_t offset)
+{
+	size_t last = sizeof(record->text) - 1;
+
+	return record->text + (offset < last ? offset : last);
+}
+
+const char *shm_ring_record_method(const shm_ring_record *record)
+{
+	return record->text;
+}
+
+const char *shm_ring_record_called_number(const shm_ring_record *record)
+{
+	return shm_ring_record_text(record, (size_t)record->method_len + 1);
+}
+
+const char *shm_ring_record_user_agent(const shm_ring_record *record)
+{
+	return shm_ring_record_text(record,
+				    (size_t)record->method_len + 1 +
+					    record->called_number_len + 1);
+}
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+#ifndef SENTRYPEER_SHM_RING_READER_H
+#define SENTRYPEER_SHM_RING_READER_H 1
+
+// For other processes on the same host that want new bad actors as soon as
+// we have them. Build shm_ring_reader.c into your own program, it only
+// needs libc. See tests/tools/shm_ring_consumer.c.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "shm_ring.h"
+
+// How long shm_ring_reader_wait() sleeps between looks once it has spun
+#define SHM_RING_READER_POLL_US 100
+
+typedef struct shm_ring_reader shm_ring_reader;
+
+//  Constructor. Maps the ring read only and starts at the newest event,
+//  NULL if there's no ring of that name or it isn't one we understand.
+shm_ring_reader *shm_ring_reader_open(const char *name);
+
+//  Destructor
+void shm_ring_reader_close(shm_ring_reader **self_ptr);
+
+/**
+ * The next bad actor, read where it is in the ring, so no copy and no
+ * syscall.
+ *
+ * @param self The reader.
+ * @param dropped Added to when the writer has lapped us and we've missed
+ *                some.
+ * @return The record, or NULL when there's nothing new. Check it with
+ *         shm_ring_reader_valid() once you've read what you need from it.
+ */
+const shm_ring_record *shm_ring_reader_next(shm_ring_reader *self,
+					    uint64_t *dropped);
+
+// false if the record shm_ring_reader_next() last returned has been
+// overwritten since, in which case whatever was read from it is garbage
+bool shm_ring_reader_valid(shm_ring_reader const *self);
+
+// Whether the writer has stopped, i.e. SentryPeer has exited
+bool shm_ring_reader_closed(shm_ring_reader const *self);
+
+/**
+ * Wait for something new. Spins for a moment first, so when events are
+ * arriving it never makes a syscall.
+ *
+ * @param self The reader.
+ * @param timeout_ms How long to wait.
+ * @return EXIT_SUCCESS when there's something new, EXIT_FAILURE on timeout
+ *         or when the writer has closed the ring.
+ */
+int shm_ring_reader_wait(shm_ring_reader *self, int timeout_ms);
+
+// The strings in a record, always '\0' terminated
+const char *shm_ring_record_method(const shm_ring_record *record);
+const char *shm_ring_record_called_number(const shm_ring_record *record);
+const char *shm_ring_record_user_agent(const shm_ring_record *record);
+
+#endif //SENTRYPEER_SHM_RING_READER_H
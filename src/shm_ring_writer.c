@@ -0,0 +1,235 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <uuid/uuid.h>
+
+#include "shm_ring_writer.h"
+#include "utils.h"
+
+static_assert(sizeof(shm_ring_header) <= SHM_RING_HEADER_SIZE,
+	      "shm_ring_header has outgrown SHM_RING_HEADER_SIZE");
+static_assert(sizeof(shm_ring_record) == SHM_RING_SLOT_SIZE,
+	      "shm_ring_record must be SHM_RING_SLOT_SIZE");
+
+struct shm_ring_writer {
+	char *name;
+	shm_ring_header *header;
+	shm_ring_record *records;
+	size_t size;
+	uint32_t slot_count;
+	// Only we change head, so no need to read it back
+	uint64_t head;
+};
+
+shm_ring_writer *shm_ring_writer_new(const char *name, uint32_t slot_count)
+{
+	assert(name);
+	assert(slot_count > 0 && (slot_count & (slot_count - 1)) == 0);
+
+	size_t size = SHM_RING_HEADER_SIZE +
+		      (size_t)slot_count * sizeof(shm_ring_record);
+
+	// Readers of an old one keep it until they let go
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0640);
+	if (fd == -1) {
+		perror("shm_open");
+		return 0;
+	}
+
+	// Comes back zeroed, so every sequence is 0 and no slot looks written
+	if (ftruncate(fd, (off_t)size) != 0) {
+		perror("ftruncate");
+		close(fd);
+		shm_unlink(name);
+		return 0;
+	}
+
+	void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+			  0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		perror("mmap");
+		shm_unlink(name);
+		return 0;
+	}
+
+	shm_ring_writer *self = calloc(1, sizeof(shm_ring_writer));
+	assert(self);
+	self->name = util_duplicate_string(name);
+	self->header = base;
+	self->records = (shm_ring_record *)((char *)base + SHM_RING_HEADER_SIZE);
+	self->size = size;
+	self->slot_count = slot_count;
+
+	self->header->version = SHM_RING_VERSION;
+	self->header->slot_count = slot_count;
+	self->header->slot_size = sizeof(shm_ring_record);
+	// Last, so a reader that sees it sees the rest
+	atomic_store_explicit(&self->header->magic, SHM_RING_MAGIC,
+			      memory_order_release);
+
+	return self;
+}
+
+void shm_ring_writer_destroy(shm_ring_writer **self_ptr)
+{
+	assert(self_ptr);
+	if (*self_ptr) {
+		shm_ring_writer *self = *self_ptr;
+		atomic_store_explicit(&self->header->closed, 1,
+				      memory_order_release);
+		munmap(self->header, self->size);
+		shm_unlink(self->name);
+		free(self->name);
+		free(self);
+		*self_ptr = 0;
+	}
+}
+
+static void shm_ring_copy_ip(uint8_t *address, const char *ip_address)
+{
+	memset(address, 0, 16);
+	if (ip_address == 0) {
+		return;
+	}
+
+	uint8_t ipv4[4];
+	if (inet_pton(AF_INET, ip_address, ipv4) == 1) {
+		address[10] = 0xff;
+		address[11] = 0xff;
+		memcpy(address + 12, ipv4, sizeof(ipv4));
+	} else if (inet_pton(AF_INET6, ip_address, address) != 1) {
+		memset(address, 0, 16);
+	}
+}
+
+static void shm_ring_copy_uuid(uint8_t *out, const char *uuid_string)
+{
+	uuid_t uuid;
+	if (uuid_string != 0 && uuid_parse(uuid_string, uuid) == 0) {
+		memcpy(out, uuid, sizeof(uuid_t));
+	} else {
+		memset(out, 0, sizeof(uuid_t));
+	}
+}
+
+static uint8_t shm_ring_transport(const char *transport_type)
+{
+	if (transport_type == 0) {
+		return SHM_RING_TRANSPORT_UNKNOWN;
+	} else if (strcmp(transport_type, "UDP") == 0) {
+		return SHM_RING_TRANSPORT_UDP;
+	} else if (strcmp(transport_type, "TCP") == 0) {
+		return SHM_RING_TRANSPORT_TCP;
+	} else if (strcmp(transport_type, "TLS") == 0) {
+		return SHM_RING_TRANSPORT_TLS;
+	}
+
+	return SHM_RING_TRANSPORT_UNKNOWN;
+}
+
+static uint8_t shm_ring_collected_method(const char *collected_method)
+{
+	if (collected_method == 0) {
+		return SHM_RING_COLLECTED_UNKNOWN;
+	} else if (strcmp(collected_method, "passive") == 0) {
+		return SHM_RING_COLLECTED_PASSIVE;
+	} else if (strcmp(collected_method, "responsive") == 0) {
+		return SHM_RING_COLLECTED_RESPONSIVE;
+	}
+
+	return SHM_RING_COLLECTED_UNKNOWN;
+}
+
+// Copies as much of text as fits in room bytes, '\0' included, without
+// splitting a UTF-8 character, and returns its length
+static uint16_t shm_ring_copy_text(char *out, size_t room, const char *text)
+{
+	size_t len = text != 0 ? strlen(text) : 0;
+	if (len >= room) {
+		len = room - 1;
+		while (len > 0 && ((unsigned char)text[len] & 0xC0) == 0x80) {
+			len--;
+		}
+	}
+	if (len > 0) {
+		memcpy(out, text, len);
+	}
+	out[len] = '\0';
+
+	return (uint16_t)len;
+}
+
+void shm_ring_writer_write(shm_ring_writer *self,
+			   const bad_actor *bad_actor_event, uint8_t flags)
+{
+	assert(self);
+	assert(bad_actor_event);
+
+	uint64_t position = self->head;
+	shm_ring_record *record =
+		&self->records[position & (self->slot_count - 1)];
+
+	// Readers that catch us part way through know to throw it away
+	atomic_store_explicit(&record->sequence, position * 2 + 1,
+			      memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	record->seen_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	shm_ring_copy_uuid(record->event_uuid, bad_actor_event->event_uuid);
+	shm_ring_copy_uuid(record->created_by_node_id,
+			   bad_actor_event->created_by_node_id);
+	shm_ring_copy_ip(record->source_ip, bad_actor_event->source_ip);
+	shm_ring_copy_ip(record->destination_ip,
+			 bad_actor_event->destination_ip);
+	record->transport = shm_ring_transport(bad_actor_event->transport_type);
+	record->collected_method =
+		shm_ring_collected_method(bad_actor_event->collected_method);
+	record->flags = flags;
+
+	// The last byte of text is left as the '\0' it started as, so a torn
+	// read never runs off the end. Each string leaves room for the '\0's
+	// of those after it.
+	char *text = record->text;
+	size_t room = sizeof(record->text) - 1;
+	record->method_len =
+		shm_ring_copy_text(text, room - 2, bad_actor_event->method);
+	text += record->method_len + 1;
+	room -= record->method_len + 1;
+	record->called_number_len = shm_ring_copy_text(
+		text, room - 1, bad_actor_event->called_number);
+	text += record->called_number_len + 1;
+	room -= record->called_number_len + 1;
+	record->user_agent_len =
+		shm_ring_copy_text(text, room, bad_actor_event->user_agent);
+
+	atomic_store_explicit(&record->sequence, position * 2 + 2,
+			      memory_order_release);
+	self->head = position + 1;
+	atomic_store_explicit(&self->header->head, self->head,
+			      memory_order_release);
+}
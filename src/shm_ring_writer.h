@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+#ifndef SENTRYPEER_SHM_RING_WRITER_H
+#define SENTRYPEER_SHM_RING_WRITER_H 1
+
+#include <stdint.h>
+
+#include "shm_ring.h"
+#include "bad_actor.h"
+
+// Only one thread may write, the shm sink's, see sinks.c
+typedef struct shm_ring_writer shm_ring_writer;
+
+/**
+ * Constructor. Replaces any ring of the same name left by a run that
+ * didn't stop cleanly.
+ *
+ * @param name A POSIX shared memory name, e.g. "/sentrypeer".
+ * @param slot_count How many events are kept, a power of 2.
+ * @return The writer, NULL on failure.
+ */
+shm_ring_writer *shm_ring_writer_new(const char *name, uint32_t slot_count);
+
+//  Destructor. Tells readers it's closed and removes the name, readers
+//  still have what they've mapped.
+void shm_ring_writer_destroy(shm_ring_writer **self_ptr);
+
+// flags is SHM_RING_FROM_PEER or 0
+void shm_ring_writer_write(shm_ring_writer *self,
+			   const bad_actor *bad_actor_event, uint8_t flags);
+
+#endif //SENTRYPEER_SHM_RING_WRITER_H
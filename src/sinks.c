@@ -0,0 +1,577 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "sinks.h"
+#include "database.h"
+#include "event_stream.h"
+#include "json_logger.h"
+#include "metrics.h"
+#include "shm_ring_writer.h"
+
+#if HAVE_RUST != 0
+#include "sentrypeer_rust.h"
+#endif // HAVE_RUST
+
+#if HAVE_OPENDHT_C != 0
+#include "peer_to_peer_dht.h"
+#endif // HAVE_OPENDHT_C
+
+// A ring of events waiting for one sink, and the thread that writes them.
+// Publishers only ever hold the lock long enough to add a pointer.
+typedef struct sink sink;
+struct sink {
+	sentrypeer_config *config;
+	char name[SINKS_NAME_MAX];
+	sink_write_fn write;
+	size_t batch_max;
+	int flags;
+	atomic_bool enabled;
+	atomic_uint_fast64_t dropped;
+	sink_event *queue[SINKS_QUEUE_CAPACITY];
+	size_t head;
+	size_t queued;
+	bool stopping;
+	pthread_mutex_t mutex;
+	pthread_cond_t wake_up;
+	// For publishers waiting with SINK_EVENT_WAIT
+	pthread_cond_t has_room;
+	pthread_t thread;
+};
+
+struct sinks {
+	sentrypeer_config *config;
+	sink *sinks[SINKS_MAX];
+	size_t count;
+};
+
+static void sink_event_release(sink_event *self)
+{
+	if (self != 0 && atomic_fetch_sub(&self->references, 1) == 1) {
+		bad_actor_destroy(&self->bad_actor);
+		free(self);
+	}
+}
+
+static void *sink_run(void *arg)
+{
+	sink *self = arg;
+	sink_event *batch[SINKS_BATCH_MAX];
+
+	while (true) {
+		pthread_mutex_lock(&self->mutex);
+		while (self->queued == 0 && !self->stopping) {
+			pthread_cond_wait(&self->wake_up, &self->mutex);
+		}
+		// Only once everything queued has been written
+		if (self->queued == 0) {
+			pthread_mutex_unlock(&self->mutex);
+			break;
+		}
+		size_t count = self->queued < self->batch_max ? self->queued :
+								self->batch_max;
+		for (size_t i = 0; i < count; i++) {
+			batch[i] = self->queue[self->head];
+			self->head = (self->head + 1) % SINKS_QUEUE_CAPACITY;
+		}
+		self->queued -= count;
+		pthread_cond_broadcast(&self->has_room);
+		pthread_mutex_unlock(&self->mutex);
+
+		// Whatever went wrong stays with this sink, the rest carry on
+		if (self->write(self->config, batch, count) != EXIT_SUCCESS &&
+		    (self->config->debug_mode || self->config->verbose_mode)) {
+			fprintf(stderr, "The %s sink failed to write %zu events.\n",
+				self->name, count);
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			sink_event_release(batch[i]);
+		}
+	}
+
+	return NULL;
+}
+
+static sink *sinks_find(sinks *self, const char *name)
+{
+	for (size_t i = 0; i < self->count; i++) {
+		if (strcmp(self->sinks[i]->name, name) == 0) {
+			return self->sinks[i];
+		}
+	}
+
+	return 0;
+}
+
+// A batch takes as long as it takes, so each event gets its share
+static void sink_observe(sentrypeer_config const *config, int histogram,
+			 uint64_t started, size_t count)
+{
+	if (config->metrics == 0) {
+		return;
+	}
+	uint64_t share = (metrics_start(config->metrics) - started) / count;
+	for (size_t i = 0; i < count; i++) {
+		metrics_observe_ns(config->metrics, histogram, share);
+	}
+}
+
+static int syslog_sink_write(sentrypeer_config *config,
+			     sink_event *const *events, size_t count)
+{
+	(void)config; /* unused */
+
+	for (size_t i = 0; i < count; i++) {
+		const bad_actor *bad_actor_event = events[i]->bad_actor;
+		syslog(LOG_NOTICE, "Source IP: %s, Method: %s, Agent: %s\n",
+		       bad_actor_event->source_ip, bad_actor_event->method,
+		       bad_actor_event->user_agent);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int shm_ring_sink_write(sentrypeer_config *config,
+			       sink_event *const *events, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		shm_ring_writer_write(config->shm_ring, events[i]->bad_actor,
+				      (events[i]->flags & SINK_EVENT_FROM_PEER) ?
+					      SHM_RING_FROM_PEER :
+					      0);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int json_log_sink_write(sentrypeer_config *config,
+			       sink_event *const *events, size_t count)
+{
+	uint64_t started = metrics_start(config->metrics);
+	size_t failed = 0;
+
+#if HAVE_RUST != 0
+	for (size_t i = 0; i < count; i++) {
+		if (json_log_bad_actor_rs(config, events[i]->bad_actor) !=
+		    EXIT_SUCCESS) {
+			failed++;
+		}
+	}
+#else
+	// One open and close for the lot
+	FILE *logfile = fopen(config->json_log_file, "a");
+	if (logfile == NULL) {
+		fprintf(stderr, "Could not open JSON log file: %s\n",
+			config->json_log_file);
+		failed = count;
+	} else {
+		for (size_t i = 0; i < count; i++) {
+			if (events[i]->json == 0 ||
+			    fwrite(events[i]->json, 1, events[i]->json_len,
+				   logfile) != events[i]->json_len ||
+			    fputc('\n', logfile) == EOF) {
+				failed++;
+			}
+		}
+		if (fclose(logfile) != EXIT_SUCCESS) {
+			fprintf(stderr, "Could not close JSON log file: %s\n",
+				config->json_log_file);
+			failed = count;
+		}
+	}
+#endif // HAVE_RUST
+
+	if (failed > 0) {
+		metrics_add(config->metrics, METRICS_JSON_LOG_FAILURES, failed);
+		fprintf(stderr, "Saving %zu bad_actor json to %s failed.\n",
+			failed, config->json_log_file);
+	}
+	if (failed < count) {
+		sink_observe(config, METRICS_JSON_LOG_SECONDS, started, count);
+		metrics_add(config->metrics, METRICS_JSON_LOGS, count - failed);
+	}
+
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// After the db, so the API never counts a bad actor it can't then find
+static void db_sink_saved(sentrypeer_config *config, const sink_event *event,
+			  json_buffer *json)
+{
+	bad_actor_index(config, event->bad_actor);
+
+	if (config->event_stream != 0 &&
+	    event_stream_has_subscribers(config->event_stream)) {
+		const char *event_json = event->json;
+		if (event_json == 0) {
+			json_buffer_reset(json);
+			event_json =
+				bad_actor_json_once(config, event->bad_actor,
+						    json);
+		}
+		if (event_json != 0) {
+			event_stream_publish(config->event_stream, event_json);
+		}
+	}
+}
+
+static int db_sink_write(sentrypeer_config *config, sink_event *const *events,
+			 size_t count)
+{
+	const bad_actor *bad_actor_events[SINKS_BATCH_MAX];
+	for (size_t i = 0; i < count; i++) {
+		bad_actor_events[i] = events[i]->bad_actor;
+	}
+
+	uint64_t started = metrics_start(config->metrics);
+	size_t failed = 0;
+	bool saved[SINKS_BATCH_MAX];
+	bool batch_saved = db_insert_bad_actors(bad_actor_events, count,
+						config) == EXIT_SUCCESS;
+	for (size_t i = 0; i < count; i++) {
+		// Otherwise find which one spoilt it for the others
+		saved[i] = batch_saved ||
+			   db_insert_bad_actor(bad_actor_events[i], config) ==
+				   EXIT_SUCCESS;
+		if (!saved[i]) {
+			failed++;
+		}
+	}
+
+	if (failed > 0) {
+		metrics_add(config->metrics, METRICS_DB_INSERT_FAILURES, failed);
+		fprintf(stderr, "Saving %zu bad actors to db failed\n", failed);
+	}
+	if (failed < count) {
+		sink_observe(config, METRICS_DB_INSERT_SECONDS, started, count);
+		metrics_add(config->metrics, METRICS_DB_INSERTS, count - failed);
+	}
+
+	json_buffer json;
+	json_buffer_init(&json);
+	for (size_t i = 0; i < count; i++) {
+		if (saved[i]) {
+			db_sink_saved(config, events[i], &json);
+		}
+	}
+	json_buffer_release(&json);
+
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int webhook_sink_write(sentrypeer_config *config,
+			      sink_event *const *events, size_t count)
+{
+	size_t failed = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		uint64_t started = metrics_start(config->metrics);
+#if HAVE_RUST != 0
+		int posted = json_http_post_bad_actor_rs(
+			config, events[i]->bad_actor);
+#else
+		int posted = events[i]->json == 0 ?
+				     EXIT_FAILURE :
+				     json_http_post_bad_actor_json(
+					     config, events[i]->json);
+#endif // HAVE_RUST
+		if (posted != EXIT_SUCCESS) {
+			metrics_add(config->metrics, METRICS_WEBHOOK_FAILURES,
+				    1);
+			fprintf(stderr,
+				"POSTing bad_actor json to URL '%s' failed.\n",
+				config->webhook_url);
+			failed++;
+			continue;
+		}
+		metrics_observe(config->metrics, METRICS_WEBHOOK_SECONDS,
+				started);
+		metrics_add(config->metrics, METRICS_WEBHOOK_POSTS, 1);
+	}
+
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#if HAVE_OPENDHT_C != 0
+static int dht_sink_write(sentrypeer_config *config, sink_event *const *events,
+			  size_t count)
+{
+	size_t failed = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		if (peer_to_peer_dht_save(config, events[i]->json) !=
+		    EXIT_SUCCESS) {
+			fprintf(stderr,
+				"Error saving bad_actor to peer_to_peer_dht.\n");
+			failed++;
+		}
+	}
+
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif // HAVE_OPENDHT_C
+
+sinks *sinks_new(sentrypeer_config *config)
+{
+	assert(config);
+
+	sinks *self = calloc(1, sizeof(sinks));
+	assert(self);
+	self->config = config;
+
+	int json_flags = 0;
+	bool json_log_mode = config->json_log_mode;
+	bool webhook_mode = config->webhook_mode;
+#if HAVE_RUST != 0
+	// The Rust side writes its own json, and only in new mode
+	json_log_mode = json_log_mode && config->new_mode;
+	webhook_mode = webhook_mode && config->new_mode;
+#else
+	json_flags = SINK_NEEDS_JSON;
+#endif // HAVE_RUST
+
+	int rc = EXIT_SUCCESS;
+	if (config->syslog_mode) {
+		rc |= sinks_add(self, "syslog", syslog_sink_write,
+				SINKS_BATCH_MAX, 0);
+	}
+	if (config->shm_ring != 0) {
+		rc |= sinks_add(self, "shm", shm_ring_sink_write,
+				SINKS_BATCH_MAX, 0);
+	}
+	if (json_log_mode) {
+		rc |= sinks_add(self, "jsonlog", json_log_sink_write,
+				SINKS_BATCH_MAX, json_flags);
+	}
+	rc |= sinks_add(self, "db", db_sink_write, SINKS_BATCH_MAX, 0);
+	if (webhook_mode) {
+		rc |= sinks_add(self, "webhook", webhook_sink_write,
+				SINKS_BATCH_MAX, json_flags);
+	}
+#if HAVE_OPENDHT_C != 0
+	// Peers have already put theirs on the DHT
+	if (config->p2p_dht_mode) {
+		rc |= sinks_add(self, "dht", dht_sink_write, SINKS_BATCH_MAX,
+				SINK_NEEDS_JSON | SINK_LOCAL_ONLY);
+	}
+#endif // HAVE_OPENDHT_C
+
+	if (rc != EXIT_SUCCESS) {
+		sinks_destroy(&self);
+		return 0;
+	}
+
+	return self;
+}
+
+int sinks_add(sinks *self, const char *name, sink_write_fn write,
+	      size_t batch_max, int flags)
+{
+	assert(self);
+	assert(name);
+	assert(write);
+	assert(batch_max > 0 && batch_max <= SINKS_BATCH_MAX);
+
+	if (self->count == SINKS_MAX || strlen(name) >= SINKS_NAME_MAX ||
+	    sinks_find(self, name) != 0) {
+		fprintf(stderr, "Can't add a sink called %s\n", name);
+		return EXIT_FAILURE;
+	}
+
+	sink *new_sink = calloc(1, sizeof(sink));
+	assert(new_sink);
+	new_sink->config = self->config;
+	strcpy(new_sink->name, name);
+	new_sink->write = write;
+	new_sink->batch_max = batch_max;
+	new_sink->flags = flags;
+	atomic_init(&new_sink->enabled, true);
+	atomic_init(&new_sink->dropped, 0);
+
+	if (pthread_mutex_init(&new_sink->mutex, NULL) != 0 ||
+	    pthread_cond_init(&new_sink->wake_up, NULL) != 0 ||
+	    pthread_cond_init(&new_sink->has_room, NULL) != 0) {
+		fprintf(stderr, "Failed to initialise %s sink locks\n", name);
+		free(new_sink);
+		return EXIT_FAILURE;
+	}
+
+	if (pthread_create(&new_sink->thread, NULL, sink_run, new_sink) != 0) {
+		fprintf(stderr, "Failed to start %s sink thread\n", name);
+		pthread_cond_destroy(&new_sink->has_room);
+		pthread_cond_destroy(&new_sink->wake_up);
+		pthread_mutex_destroy(&new_sink->mutex);
+		free(new_sink);
+		return EXIT_FAILURE;
+	}
+
+	if (self->config->debug_mode || self->config->verbose_mode) {
+		fprintf(stderr, "Started the %s sink.\n", name);
+	}
+	self->sinks[self->count++] = new_sink;
+
+	return EXIT_SUCCESS;
+}
+
+int sinks_enable(sinks *self, const char *name, bool enabled)
+{
+	assert(self);
+
+	sink *found = sinks_find(self, name);
+	if (found == 0) {
+		return EXIT_FAILURE;
+	}
+	atomic_store(&found->enabled, enabled);
+
+	return EXIT_SUCCESS;
+}
+
+static bool sink_wants(sink *self, int flags)
+{
+	return atomic_load_explicit(&self->enabled, memory_order_relaxed) &&
+	       !((self->flags & SINK_LOCAL_ONLY) &&
+		 (flags & SINK_EVENT_FROM_PEER));
+}
+
+static sink_event *sink_event_new(sentrypeer_config const *config,
+				  bad_actor *bad_actor_event, int flags,
+				  bool needs_json)
+{
+	json_buffer json;
+	json_buffer_init(&json);
+	const char *json_string =
+		needs_json ? bad_actor_json_once(config, bad_actor_event, &json) :
+			     0;
+	size_t json_len = json_string != 0 ? json.len + 1 : 0;
+
+	sink_event *self = malloc(sizeof(sink_event) + json_len);
+	assert(self);
+	self->bad_actor = bad_actor_event;
+	self->json = 0;
+	self->json_len = 0;
+	self->flags = flags;
+	atomic_init(&self->references, 1);
+	if (json_string != 0) {
+		memcpy(self->storage, json_string, json_len);
+		self->json = self->storage;
+		self->json_len = json.len;
+	}
+	json_buffer_release(&json);
+
+	return self;
+}
+
+size_t sinks_publish(sinks *self, bad_actor *bad_actor_event, int flags)
+{
+	assert(self);
+	assert(bad_actor_event);
+
+	bool needs_json = false;
+	for (size_t i = 0; i < self->count; i++) {
+		if ((self->sinks[i]->flags & SINK_NEEDS_JSON) &&
+		    sink_wants(self->sinks[i], flags)) {
+			needs_json = true;
+		}
+	}
+
+	// Ours until every sink has its reference
+	sink_event *event = sink_event_new(self->config, bad_actor_event,
+					   flags, needs_json);
+
+	size_t queued = 0;
+	for (size_t i = 0; i < self->count; i++) {
+		sink *target = self->sinks[i];
+		if (!sink_wants(target, flags)) {
+			continue;
+		}
+
+		pthread_mutex_lock(&target->mutex);
+		while ((flags & SINK_EVENT_WAIT) &&
+		       target->queued == SINKS_QUEUE_CAPACITY) {
+			pthread_cond_wait(&target->has_room, &target->mutex);
+		}
+		bool full = target->queued == SINKS_QUEUE_CAPACITY;
+		if (!full) {
+			atomic_fetch_add(&event->references, 1);
+			target->queue[(target->head + target->queued) %
+				      SINKS_QUEUE_CAPACITY] = event;
+			target->queued++;
+			pthread_cond_signal(&target->wake_up);
+		}
+		pthread_mutex_unlock(&target->mutex);
+
+		if (full) {
+			atomic_fetch_add(&target->dropped, 1);
+			metrics_add(self->config->metrics, METRICS_SINK_DROPS,
+				    1);
+			if (self->config->debug_mode ||
+			    self->config->verbose_mode) {
+				fprintf(stderr,
+					"The %s sink is full, dropped an event.\n",
+					target->name);
+			}
+			continue;
+		}
+		queued++;
+	}
+	sink_event_release(event);
+
+	return queued;
+}
+
+uint64_t sinks_dropped(sinks *self, const char *name)
+{
+	assert(self);
+
+	sink *found = sinks_find(self, name);
+
+	return found != 0 ? atomic_load(&found->dropped) : 0;
+}
+
+void sinks_destroy(sinks **self_ptr)
+{
+	assert(self_ptr);
+	if (*self_ptr) {
+		sinks *self = *self_ptr;
+		for (size_t i = 0; i < self->count; i++) {
+			sink *old = self->sinks[i];
+			pthread_mutex_lock(&old->mutex);
+			old->stopping = true;
+			pthread_cond_signal(&old->wake_up);
+			pthread_mutex_unlock(&old->mutex);
+		}
+		// Each one writes out what it has left first
+		for (size_t i = 0; i < self->count; i++) {
+			sink *old = self->sinks[i];
+			if (pthread_join(old->thread, NULL) != 0) {
+				fprintf(stderr,
+					"Failed to join %s sink thread.\n",
+					old->name);
+			}
+			pthread_cond_destroy(&old->has_room);
+			pthread_cond_destroy(&old->wake_up);
+			pthread_mutex_destroy(&old->mutex);
+			free(old);
+		}
+		free(self);
+		*self_ptr = 0;
+	}
+}
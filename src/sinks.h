@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+#ifndef SENTRYPEER_SINKS_H
+#define SENTRYPEER_SINKS_H 1
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "conf.h"
+#include "bad_actor.h"
+
+// Events each sink can have waiting before new ones are dropped for it
+#define SINKS_QUEUE_CAPACITY 4096
+// Most events handed to a sink's write function in one go
+#define SINKS_BATCH_MAX 64
+#define SINKS_MAX 8
+#define SINKS_NAME_MAX 16
+
+// Sink flags
+#define SINK_NEEDS_JSON 1
+// Not for bad actors we were told about by DHT peers
+#define SINK_LOCAL_ONLY 2
+
+// Event flags
+#define SINK_EVENT_FROM_PEER 1
+// Wait for room in a full queue instead of dropping, e.g. reading a pcap
+// file, where nothing is lost by going slower
+#define SINK_EVENT_WAIT 2
+
+// One bad actor, shared by every sink it was queued for and freed by
+// whichever finishes with it last. Nothing here changes once published.
+typedef struct sink_event sink_event;
+struct sink_event {
+	bad_actor *bad_actor;
+	// Only set when a sink wanted json, written once by sinks_publish()
+	const char *json;
+	size_t json_len;
+	int flags;
+	atomic_uint references;
+	char storage[];
+};
+
+/**
+ * What a sink does with events, in the order they were published.
+ *
+ * @param config The config.
+ * @param events Up to the sink's batch_max of them.
+ * @param count How many.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE when any of them failed. Either way
+ *         the sink carries on with the next lot.
+ */
+typedef int (*sink_write_fn)(sentrypeer_config *config,
+			     sink_event *const *events, size_t count);
+
+typedef struct sinks sinks;
+
+//  Constructor, with a sink for each of syslog, the shared memory ring,
+//  json log, db, WebHook and DHT that config has turned on. Every sink has
+//  its own queue and thread.
+sinks *sinks_new(sentrypeer_config *config);
+
+/**
+ * Add another sink and start its thread.
+ *
+ * @param self The sinks.
+ * @param name For logging and sinks_enable().
+ * @param write Called on the sink's thread only.
+ * @param batch_max 1 to SINKS_BATCH_MAX.
+ * @param flags e.g. SINK_NEEDS_JSON.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int sinks_add(sinks *self, const char *name, sink_write_fn write,
+	      size_t batch_max, int flags);
+
+// Stop or start queueing new events for a sink. EXIT_FAILURE if there's no
+// sink of that name.
+int sinks_enable(sinks *self, const char *name, bool enabled);
+
+/**
+ * Hand a bad actor to every enabled sink. Never blocks on a sink, one whose
+ * queue is full just doesn't get it and it's counted as a drop, unless
+ * flags has SINK_EVENT_WAIT.
+ *
+ * @param self The sinks.
+ * @param bad_actor_event Owned by the sinks from now on.
+ * @param flags e.g. SINK_EVENT_FROM_PEER.
+ * @return How many sinks it was queued for.
+ */
+size_t sinks_publish(sinks *self, bad_actor *bad_actor_event, int flags);
+
+// Events dropped for a sink so far, 0 if there's no sink of that name
+uint64_t sinks_dropped(sinks *self, const char *name);
+
+//  Destructor. Waits for every queue to be written out first.
+void sinks_destroy(sinks **self_ptr);
+
+#endif //SENTRYPEER_SINKS_H
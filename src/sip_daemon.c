@@ -33,11 +33,21 @@
 #include <syslog.h>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
 
 #include "conf.h"
 #include "sip_daemon.h"
+#include "sip_daemon_io_uring.h"
+#include "tcp_conn_table.h"
 #include "sip_message_event.h"
 #include "sip_parser.h"
+#include "json_logger.h"
+#include "metrics.h"
+#include "sinks.h"
 
 #if HAVE_OPENDHT_C != 0
 #include "peer_to_peer_dht.h"
@@ -47,44 +57,90 @@
 #include "sentrypeer_rust.h"
 #endif // HAVE_RUST
 
-#define PACKET_BUFFER_SIZE 1024
+struct sip_daemon_worker {
+	sentrypeer_config *config;
+	pthread_t thread;
+	SOCKET socket_listen_udp;
+	SOCKET socket_listen_tcp;
+	int stop_fd; // Wakes an io_uring worker, which can't be cancelled
+};
+
+static int sip_daemon_serve(sentrypeer_config *config,
+			    SOCKET socket_listen_udp, SOCKET socket_listen_tcp);
 
 void *sip_daemon_thread_start(void *arg)
 {
-	sip_daemon_init((sentrypeer_config *)arg);
+	sip_daemon_worker *worker = (sip_daemon_worker *)arg;
+	sentrypeer_config *config = worker->config;
+
+	if (config->sip_backend != SIP_BACKEND_SELECT) {
+		if (sip_daemon_io_uring_serve(config, worker->socket_listen_udp,
+					      worker->socket_listen_tcp,
+					      worker->stop_fd) !=
+		    SIP_IO_URING_UNSUPPORTED) {
+			return NULL;
+		}
+
+		if (config->sip_backend == SIP_BACKEND_IO_URING ||
+		    config->debug_mode || config->verbose_mode) {
+			fprintf(stderr,
+				"io_uring is not available, using select() instead.\n");
+		}
+	}
+
+	sip_daemon_serve(config, worker->socket_listen_udp,
+			 worker->socket_listen_tcp);
 	return NULL;
 }
 
 int sip_daemon_run(sentrypeer_config *config)
 {
-	pthread_t sip_daemon_thread = 0;
-	const char *sip_daemon_thread_name = "sip_daemon";
-
 	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 
-	if (pthread_create(&sip_daemon_thread, NULL, sip_daemon_thread_start,
-			   (void *)config) != EXIT_SUCCESS) {
-		fprintf(stderr, "Failed to create SIP daemon thread.\n");
+	if (sip_daemon_init(config) != EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to create SIP daemon sockets.\n");
 		return EXIT_FAILURE;
 	}
+
+	for (int i = 0; i < config->sip_workers; i++) {
+		sip_daemon_worker *worker = &config->sip_daemon_workers[i];
+		// Thread names are at most 15 characters
+		char sip_daemon_thread_name[16] = "sip_daemon";
+		if (config->sip_workers > 1) {
+			snprintf(sip_daemon_thread_name,
+				 sizeof(sip_daemon_thread_name),
+				 "sip_daemon_%d", i % SIP_DAEMON_WORKERS_MAX);
+		}
+
+		if (pthread_create(&worker->thread, NULL,
+				   sip_daemon_thread_start,
+				   (void *)worker) != EXIT_SUCCESS) {
+			fprintf(stderr, "Failed to create SIP daemon thread.\n");
+			return EXIT_FAILURE;
+		}
 #ifdef __APPLE__
-	if (pthread_setname_np(sip_daemon_thread_name) != EXIT_SUCCESS) {
-		fprintf(stderr, "Failed to set SIP daemon thread name.\n");
-		return EXIT_FAILURE;
-	}
+		if (pthread_setname_np(sip_daemon_thread_name) !=
+		    EXIT_SUCCESS) {
+			fprintf(stderr,
+				"Failed to set SIP daemon thread name.\n");
+			return EXIT_FAILURE;
+		}
 #else
-	if (pthread_setname_np(sip_daemon_thread, sip_daemon_thread_name) !=
-	    EXIT_SUCCESS) {
-		fprintf(stderr, "Failed to set SIP daemon thread name.\n");
-		// Error is?
-		fprintf(stderr, "Error is: %d\n", errno);
-		// Error description?
-		fprintf(stderr, "Error description is: %s\n", strerror(errno));
+		if (pthread_setname_np(worker->thread,
+				       sip_daemon_thread_name) !=
+		    EXIT_SUCCESS) {
+			fprintf(stderr,
+				"Failed to set SIP daemon thread name.\n");
+			// Error is?
+			fprintf(stderr, "Error is: %d\n", errno);
+			// Error description?
+			fprintf(stderr, "Error description is: %s\n",
+				strerror(errno));
 
-		return EXIT_FAILURE;
-	}
+			return EXIT_FAILURE;
+		}
 #endif
-	config->sip_daemon_thread = sip_daemon_thread;
+	}
 
 	return EXIT_SUCCESS;
 }
@@ -100,7 +156,7 @@ int shutdown_sip_server(sentrypeer_config const *config)
 }
 #endif // HAVE_RUST
 
-int sip_daemon_stop(sentrypeer_config const *config)
+int sip_daemon_stop(sentrypeer_config *config)
 {
     // default if no Rust or set via config file/CLI/ENV
 	if (config->new_mode == false) {
@@ -108,17 +164,32 @@ int sip_daemon_stop(sentrypeer_config const *config)
 			fprintf(stderr, "Stopping sip daemon...\n");
 		}
 
-		if (pthread_cancel(config->sip_daemon_thread) != EXIT_SUCCESS) {
-			fprintf(stderr,
-				"Failed to cancel SIP daemon thread.\n");
-			return EXIT_FAILURE;
+		for (int i = 0; config->sip_daemon_workers != 0 &&
+				i < config->sip_workers;
+		     i++) {
+			sip_daemon_io_uring_stop(
+				config->sip_daemon_workers[i].stop_fd);
 		}
 
-		if (pthread_join(config->sip_daemon_thread, NULL) !=
-		    EXIT_SUCCESS) {
-			fprintf(stderr, "Failed to join SIP daemon thread.\n");
-			return EXIT_FAILURE;
+		for (int i = 0; config->sip_daemon_workers != 0 &&
+				i < config->sip_workers;
+		     i++) {
+			sip_daemon_worker *worker =
+				&config->sip_daemon_workers[i];
+			if (pthread_cancel(worker->thread) != EXIT_SUCCESS) {
+				fprintf(stderr,
+					"Failed to cancel SIP daemon thread.\n");
+				return EXIT_FAILURE;
+			}
+
+			if (pthread_join(worker->thread, NULL) !=
+			    EXIT_SUCCESS) {
+				fprintf(stderr,
+					"Failed to join SIP daemon thread.\n");
+				return EXIT_FAILURE;
+			}
 		}
+		sip_daemon_workers_destroy(config);
 	}
 
 	// Shutdown our Rust listeners
@@ -148,9 +219,15 @@ int sip_log_event(sentrypeer_config *config, const sip_message_event *sip_event)
 	assert(bad_actor_event);
 
 	if (sip_event->packet_len > 0) {
-		if ((sip_message_parser(sip_event->packet,
-					sip_event->packet_len, bad_actor_event,
-					config)) != EXIT_SUCCESS) {
+		uint64_t started = metrics_start(config->metrics);
+		int parsed = sip_message_parser(sip_event->packet,
+						sip_event->packet_len,
+						bad_actor_event, config);
+		metrics_observe(config->metrics, METRICS_SIP_PARSE_SECONDS,
+				started);
+		if (parsed != EXIT_SUCCESS) {
+			metrics_add(config->metrics,
+				    METRICS_SIP_PARSE_FAILURES, 1);
 			if (config->debug_mode || config->verbose_mode) {
 				fprintf(stderr,
 					"Parsing this SIP packet failed.\n");
@@ -160,8 +237,23 @@ int sip_log_event(sentrypeer_config *config, const sip_message_event *sip_event)
 		}
 	}
 
-	if (bad_actor_log(config, bad_actor_event) != EXIT_SUCCESS) {
+	// Queued for each sink's own thread, so a slow one never holds up
+	// capture. They free it once they're all done.
+	if (config->sinks != 0) {
+		sinks_publish(config->sinks, bad_actor_event, 0);
+		if (config->debug_mode || config->verbose_mode) {
+			fprintf(stderr, "SIP packet logged.\n");
+		}
+		return EXIT_SUCCESS;
+	}
+
+	// Written at most once, by whichever sink wants json first
+	json_buffer json;
+	json_buffer_init(&json);
+
+	if (bad_actor_log(config, bad_actor_event, &json) != EXIT_SUCCESS) {
 		fprintf(stderr, "Logging bad_actor failed.\n");
+		json_buffer_release(&json);
 		bad_actor_destroy(&bad_actor_event);
 		return EXIT_FAILURE;
 	}
@@ -169,14 +261,18 @@ int sip_log_event(sentrypeer_config *config, const sip_message_event *sip_event)
 // Put on DHT last
 #if HAVE_OPENDHT_C != 0
 	if (config->p2p_dht_mode &&
-	    peer_to_peer_dht_save(config, bad_actor_event) != EXIT_SUCCESS) {
+	    peer_to_peer_dht_save(config, bad_actor_json_once(
+						  config, bad_actor_event,
+						  &json)) != EXIT_SUCCESS) {
 		fprintf(stderr,
 			"Error saving bad_actor to peer_to_peer_dht.\n");
+		json_buffer_release(&json);
 		bad_actor_destroy(&bad_actor_event);
 		return EXIT_FAILURE;
 	}
 #endif // HAVE_OPENDHT_C
 
+	json_buffer_release(&json);
 	bad_actor_destroy(&bad_actor_event);
 	if (config->debug_mode || config->verbose_mode) {
 		fprintf(stderr, "SIP packet logged.\n");
@@ -237,22 +333,23 @@ int sip_send_reply(sentrypeer_config const *config,
  * send();
  *
  */
+static SOCKET listen_failed(const char *what, SOCKET socket_listen,
+			    struct addrinfo *bind_address)
+{
+	perror(what);
+	CLOSESOCKET(socket_listen);
+	freeaddrinfo(bind_address);
+	return -1;
+}
 
-/*
- * sip_daemon_init
- *
- * TODO: Implement proper logging? What do we need to log?
- */
-
-int sip_daemon_init(sentrypeer_config *config)
+// A bound UDP socket, or a listening TCP one, on SIP_DAEMON_PORT
+static SOCKET sip_daemon_listen(sentrypeer_config const *config, int socktype,
+				bool reuseport)
 {
-	if (config->debug_mode || config->verbose_mode) {
-		fprintf(stderr, "Configuring local address...\n");
-	}
 	struct addrinfo gai_hints;
 	memset(&gai_hints, 0, sizeof(gai_hints));
 	gai_hints.ai_family = AF_INET;
-	gai_hints.ai_socktype = SOCK_DGRAM; // UDP
+	gai_hints.ai_socktype = socktype;
 	gai_hints.ai_flags = AI_PASSIVE;
 
 	struct addrinfo *bind_address = 0;
@@ -260,40 +357,17 @@ int sip_daemon_init(sentrypeer_config *config)
 	if (gai != EXIT_SUCCESS) {
 		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(gai));
 		freeaddrinfo(bind_address);
-		return EXIT_FAILURE;
+		return -1;
 	}
 
-	if (config->debug_mode || config->verbose_mode) {
-		fprintf(stderr, "Creating sockets...\n");
-	}
-	SOCKET socket_listen_udp;
-	socket_listen_udp =
+	bool udp = socktype == SOCK_DGRAM;
+	SOCKET socket_listen =
 		socket(bind_address->ai_family, bind_address->ai_socktype,
 		       bind_address->ai_protocol);
-	if (!ISVALIDSOCKET(socket_listen_udp)) {
-		perror("UDP socket() failed.");
+	if (!ISVALIDSOCKET(socket_listen)) {
+		perror(udp ? "UDP socket() failed." : "TCP socket() failed.");
 		freeaddrinfo(bind_address);
-		return EXIT_FAILURE;
-	}
-	freeaddrinfo(bind_address);
-
-	gai_hints.ai_socktype = SOCK_STREAM; // TCP
-	gai = getaddrinfo(0, SIP_DAEMON_PORT, &gai_hints, &bind_address);
-	if (gai != EXIT_SUCCESS) {
-		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(gai));
-		CLOSESOCKET(socket_listen_udp);
-		return EXIT_FAILURE;
-	}
-
-	SOCKET socket_listen_tcp;
-	socket_listen_tcp =
-		socket(bind_address->ai_family, bind_address->ai_socktype,
-		       bind_address->ai_protocol);
-	if (!ISVALIDSOCKET(socket_listen_tcp)) {
-		perror("TCP socket() failed.");
-		CLOSESOCKET(socket_listen_udp);
-		freeaddrinfo(bind_address);
-		return EXIT_FAILURE;
+		return -1;
 	}
 
 	/* The failure of the bind() call can be prevented by setting
@@ -307,63 +381,231 @@ int sip_daemon_init(sentrypeer_config *config)
 	 *
 	 */
 	int enable = 1;
-	if (setsockopt(socket_listen_udp, SOL_SOCKET, SO_REUSEADDR,
+	if (setsockopt(socket_listen, SOL_SOCKET, SO_REUSEADDR,
 		       (void *)&enable, sizeof(enable)) != EXIT_SUCCESS) {
-		perror("UDP setsockopt() failed.");
-		CLOSESOCKET(socket_listen_udp);
-		CLOSESOCKET(socket_listen_tcp);
-		freeaddrinfo(bind_address);
-		return EXIT_FAILURE;
+		return listen_failed(udp ? "UDP setsockopt() failed." :
+					   "TCP setsockopt() failed.",
+				     socket_listen, bind_address);
 	}
 
-	enable = 1;
-	if (setsockopt(socket_listen_tcp, SOL_SOCKET, SO_REUSEADDR,
-		       (void *)&enable, sizeof(enable)) != EXIT_SUCCESS) {
-		perror("TCP setsockopt() failed.");
-		CLOSESOCKET(socket_listen_tcp);
-		CLOSESOCKET(socket_listen_udp);
+	// One socket per worker, all on the same port
+	if (reuseport) {
+#ifdef SO_REUSEPORT
+		enable = 1;
+		if (setsockopt(socket_listen, SOL_SOCKET, SO_REUSEPORT,
+			       (void *)&enable, sizeof(enable)) !=
+		    EXIT_SUCCESS) {
+			return listen_failed(
+				udp ? "UDP setsockopt(SO_REUSEPORT) failed." :
+				      "TCP setsockopt(SO_REUSEPORT) failed.",
+				socket_listen, bind_address);
+		}
+#else
+		fprintf(stderr, "SO_REUSEPORT is not supported here.\n");
+		CLOSESOCKET(socket_listen);
 		freeaddrinfo(bind_address);
-		return EXIT_FAILURE;
+		return -1;
+#endif
 	}
 
-	int optname = 0;
-	int protocol = IPPROTO_IP;
+	if (udp) {
+		int optname = 0;
+		int protocol = IPPROTO_IP;
 #ifdef HAVE_IP_PKTINFO
-	if (bind_address->ai_family == AF_INET) {
-		optname = IP_PKTINFO;
-	} else if (bind_address->ai_family == AF_INET6) {
-		optname = IPV6_RECVPKTINFO;
-		protocol = IPPROTO_IPV6;
-	}
+		if (bind_address->ai_family == AF_INET) {
+			optname = IP_PKTINFO;
+		} else if (bind_address->ai_family == AF_INET6) {
+			optname = IPV6_RECVPKTINFO;
+			protocol = IPPROTO_IPV6;
+		}
 #elif defined(HAVE_IP_RECVDSTADDR)
-	optname = IP_RECVDSTADDR;
+		optname = IP_RECVDSTADDR;
 #endif
 
-	// TODO: move to a function if a new setsockopt() is needed
-	enable = 1;
-	if (setsockopt(socket_listen_udp, protocol, optname, &enable,
-		       sizeof(enable)) != EXIT_SUCCESS) {
-		perror("UDP setsockopt() failed.");
-		CLOSESOCKET(socket_listen_udp);
-		CLOSESOCKET(socket_listen_tcp);
-		freeaddrinfo(bind_address);
-		return EXIT_FAILURE;
+		enable = 1;
+		if (setsockopt(socket_listen, protocol, optname, &enable,
+			       sizeof(enable)) != EXIT_SUCCESS) {
+			return listen_failed("UDP setsockopt() failed.",
+					     socket_listen, bind_address);
+		}
 	}
 
 	if (config->debug_mode || config->verbose_mode) {
-		fprintf(stderr, "Binding sockets to local address...\n");
+		fprintf(stderr, "Binding %s socket to local address...\n",
+			udp ? "UDP" : "TCP");
 	}
-	if (bind(socket_listen_udp, bind_address->ai_addr,
+	if (bind(socket_listen, bind_address->ai_addr,
 		 bind_address->ai_addrlen) != EXIT_SUCCESS) {
-		perror("UDP bind() failed");
-		CLOSESOCKET(socket_listen_udp);
-		CLOSESOCKET(socket_listen_tcp);
-		freeaddrinfo(bind_address);
+		return listen_failed(udp ? "UDP bind() failed" :
+					   "TCP bind() failed",
+				     socket_listen, bind_address);
+	}
+
+	if (!udp && listen(socket_listen, 10) != EXIT_SUCCESS) {
+		return listen_failed("TCP listen() failed", socket_listen,
+				     bind_address);
+	}
+	freeaddrinfo(bind_address);
+
+	return socket_listen;
+}
+
+int sip_steering_from_string(const char *steering)
+{
+	if (strcmp(steering, "source") == 0) {
+		return SIP_STEERING_SOURCE;
+	} else if (strcmp(steering, "kernel") == 0) {
+		return SIP_STEERING_KERNEL;
+	}
+
+	return -1;
+}
+
+int sip_backend_from_string(const char *backend)
+{
+	if (strcmp(backend, "auto") == 0) {
+		return SIP_BACKEND_AUTO;
+	} else if (strcmp(backend, "io_uring") == 0) {
+		return SIP_BACKEND_IO_URING;
+	} else if (strcmp(backend, "select") == 0) {
+		return SIP_BACKEND_SELECT;
+	}
+
+	return -1;
+}
+
+int sip_daemon_worker_for(struct in_addr source, int workers)
+{
+	// What the filter below works out, in the same 32 bit arithmetic
+	uint32_t hash = ntohl(source.s_addr) * SIP_DAEMON_STEER_HASH;
+
+	return (int)((hash >> 16) % (uint32_t)workers);
+}
+
+int sip_daemon_steer_by_source(SOCKET socket_listen, int workers)
+{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+	// Runs on each packet with its UDP or TCP header already pulled, so
+	// the IPv4 source address is at a negative offset from the network
+	// header. The result is the index of the socket in the group, in
+	// the order they were bound.
+	struct sock_filter steer_by_source[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)SKF_NET_OFF + 12),
+		BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, SIP_DAEMON_STEER_HASH),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)workers),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_fprog steer_by_source_prog = {
+		.len = sizeof(steer_by_source) / sizeof(steer_by_source[0]),
+		.filter = steer_by_source,
+	};
+
+	if (setsockopt(socket_listen, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+		       &steer_by_source_prog,
+		       sizeof(steer_by_source_prog)) != EXIT_SUCCESS) {
 		return EXIT_FAILURE;
 	}
 
+	return EXIT_SUCCESS;
+#else
+	(void)socket_listen;
+	(void)workers;
+	errno = ENOPROTOOPT;
+	return EXIT_FAILURE;
+#endif
+}
+
+void sip_daemon_workers_destroy(sentrypeer_config *config)
+{
+	if (config->sip_daemon_workers == 0) {
+		return;
+	}
+
+	for (int i = 0; i < config->sip_workers; i++) {
+		sip_daemon_worker *worker = &config->sip_daemon_workers[i];
+		if (ISVALIDSOCKET(worker->socket_listen_udp)) {
+			CLOSESOCKET(worker->socket_listen_udp);
+		}
+		if (ISVALIDSOCKET(worker->socket_listen_tcp)) {
+			CLOSESOCKET(worker->socket_listen_tcp);
+		}
+		if (worker->stop_fd >= 0) {
+			close(worker->stop_fd);
+		}
+	}
+	free(config->sip_daemon_workers);
+	config->sip_daemon_workers = 0;
+}
+
+/*
+ * sip_daemon_init
+ *
+ * A UDP and a TCP socket per worker. With more than one worker they share
+ * the port with SO_REUSEPORT and, unless SENTRYPEER_SIP_STEERING=kernel,
+ * a filter sends each source IP address to the same worker every time.
+ *
+ * TODO: Implement proper logging? What do we need to log?
+ */
+
+int sip_daemon_init(sentrypeer_config *config)
+{
+	assert(config->sip_workers >= 1);
+	bool reuseport = config->sip_workers > 1;
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Creating sockets for %d SIP worker(s)...\n",
+			config->sip_workers);
+	}
+
+	config->sip_daemon_workers =
+		calloc((size_t)config->sip_workers, sizeof(sip_daemon_worker));
+	assert(config->sip_daemon_workers);
+	for (int i = 0; i < config->sip_workers; i++) {
+		config->sip_daemon_workers[i].config = config;
+		config->sip_daemon_workers[i].socket_listen_udp = -1;
+		config->sip_daemon_workers[i].socket_listen_tcp = -1;
+		config->sip_daemon_workers[i].stop_fd =
+			sip_daemon_io_uring_stop_fd_new();
+	}
+
+	// In order, as the steering filter picks sockets by bind order
+	for (int i = 0; i < config->sip_workers; i++) {
+		sip_daemon_worker *worker = &config->sip_daemon_workers[i];
+		worker->socket_listen_udp =
+			sip_daemon_listen(config, SOCK_DGRAM, reuseport);
+		worker->socket_listen_tcp =
+			sip_daemon_listen(config, SOCK_STREAM, reuseport);
+		if (!ISVALIDSOCKET(worker->socket_listen_udp) ||
+		    !ISVALIDSOCKET(worker->socket_listen_tcp)) {
+			sip_daemon_workers_destroy(config);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// The filter is shared by the whole group, so set it on the first.
+	// Without it the kernel hashes the source port as well, which still
+	// works, just without a scanner always landing on the same worker.
+	if (reuseport && config->sip_steering == SIP_STEERING_SOURCE) {
+		sip_daemon_worker *first = &config->sip_daemon_workers[0];
+		if (sip_daemon_steer_by_source(first->socket_listen_udp,
+					       config->sip_workers) !=
+			    EXIT_SUCCESS ||
+		    sip_daemon_steer_by_source(first->socket_listen_tcp,
+					       config->sip_workers) !=
+			    EXIT_SUCCESS) {
+			fprintf(stderr,
+				"Steering by source IP address is not supported (%s), using the kernel's hash instead.\n",
+				strerror(errno));
+		} else if (config->debug_mode || config->verbose_mode) {
+			fprintf(stderr,
+				"Steering each source IP address to the same SIP worker...\n");
+		}
+	}
+
 	if (config->debug_mode || config->verbose_mode) {
-		fprintf(stderr, "Listening for incoming UDP connections...\n");
+		fprintf(stderr,
+			"Listening for incoming UDP and TCP connections...\n");
 
 		if (config->sip_responsive_mode) {
 			fprintf(stderr,
@@ -371,368 +613,433 @@ int sip_daemon_init(sentrypeer_config *config)
 		}
 	}
 
-	if (bind(socket_listen_tcp, bind_address->ai_addr,
-		 bind_address->ai_addrlen) != EXIT_SUCCESS) {
-		perror("TCP bind() failed");
-		CLOSESOCKET(socket_listen_udp);
-		CLOSESOCKET(socket_listen_tcp);
-		freeaddrinfo(bind_address);
-		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+char *sip_daemon_dest_ip_address(struct cmsghdr *cmsg)
+{
+#ifdef HAVE_IP_PKTINFO
+	if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+		struct in_pktinfo const *pi =
+			(struct in_pktinfo *)CMSG_DATA(cmsg);
+		return util_duplicate_string(inet_ntoa(pi->ipi_spec_dst));
 	}
+#elif defined(HAVE_IP_RECVDSTADDR)
+	if (cmsg->cmsg_level == IPPROTO_IP &&
+	    cmsg->cmsg_type == IP_RECVDSTADDR) {
+		struct in_addr *in = (struct in_addr *)CMSG_DATA(cmsg);
+		return util_duplicate_string(inet_ntoa(*in));
+	}
+#else
+	(void)cmsg;
+#endif
+	return 0;
+}
+
+// The packet isn't NUL terminated and may hold NULs of its own
+static char *copy_packet(const char *packet, int bytes_received)
+{
+	char *copy = malloc((size_t)bytes_received + 1);
+	assert(copy);
+	memcpy(copy, packet, (size_t)bytes_received);
+	copy[bytes_received] = '\0';
 
+	return copy;
+}
+
+int sip_daemon_udp_event(sentrypeer_config *config, SOCKET socket_listen_udp,
+			 const char *packet, int bytes_received,
+			 struct sockaddr_storage *client_address,
+			 socklen_t client_len, char *dest_ip_address)
+{
+	if (bytes_received < 1) {
+		if (config->debug_mode || config->verbose_mode) {
+			fprintf(stderr, "Empty UDP packet received.\n");
+		}
+		free(dest_ip_address);
+		return EXIT_SUCCESS;
+	}
+	metrics_add(config->metrics, METRICS_SIP_UDP_PACKETS, 1);
+	metrics_add(config->metrics, METRICS_SIP_BYTES,
+		    (uint64_t)bytes_received);
+
+	// Format timestamp like ngrep does
+	// https://github.com/jpr5/ngrep/blob/2a9603bc67dface9606a658da45e1f5c65170444/ngrep.c#L1247
 	if (config->debug_mode || config->verbose_mode) {
-		fprintf(stderr, "Listening for incoming TCP connections...\n");
+		if (dest_ip_address) {
+			fprintf(stderr,
+				"Destination IP address of UDP packet is: %s\n",
+				dest_ip_address);
+		}
+		time_t timestamp;
+		time(&timestamp);
+		fprintf(stderr, "epochtime: %ld\nReceived (%d bytes): %.*s\n",
+			timestamp, bytes_received, bytes_received, packet);
 	}
-	if (listen(socket_listen_tcp, 10) != EXIT_SUCCESS) {
-		perror("TCP listen() failed");
-		CLOSESOCKET(socket_listen_tcp);
-		CLOSESOCKET(socket_listen_udp);
-		freeaddrinfo(bind_address);
+
+	char udp_client_ip_address_buffer[100];
+	char udp_client_send_port_buffer[100];
+	if (getnameinfo(((struct sockaddr *)client_address), client_len,
+			udp_client_ip_address_buffer,
+			sizeof(udp_client_ip_address_buffer),
+			udp_client_send_port_buffer,
+			sizeof(udp_client_send_port_buffer),
+			NI_NUMERICHOST | NI_NUMERICSERV) != EXIT_SUCCESS) {
+		perror("getnameinfo() failed.");
+		free(dest_ip_address);
 		return EXIT_FAILURE;
 	}
-	freeaddrinfo(bind_address);
 
-	fd_set master;
-	FD_ZERO(&master);
-	FD_SET(socket_listen_udp, &master);
-	FD_SET(socket_listen_tcp, &master);
-	SOCKET max_socket = max_int(socket_listen_tcp, socket_listen_udp);
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "bytes_received size is: %d: \n\n",
+			bytes_received);
+	}
+	char transport_type[] = "UDP";
+
+	sip_message_event *sip_event = sip_message_event_new(
+		copy_packet(packet, bytes_received), bytes_received,
+		socket_listen_udp, util_duplicate_string(transport_type),
+		(struct sockaddr *)client_address,
+		util_duplicate_string(udp_client_ip_address_buffer),
+		client_len, dest_ip_address);
+	assert(sip_event);
+
+	if (sip_log_event(config, sip_event) != EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to log SIP UDP event.\n");
+		sip_message_event_destroy(&sip_event);
+		return EXIT_FAILURE;
+	}
 
-	// TODO: Switch to libevent/0MQ/epoll etc. later if needed
-	while (1) {
-		fd_set reads;
-		reads = master;
-		char *dest_ip_address_buffer = 0;
-		if (select(max_socket + 1, &reads, 0, 0, 0) < EXIT_SUCCESS) {
-			perror("select() failed.");
+	if (config->sip_responsive_mode) {
+		if (sip_send_reply(config, sip_event) != EXIT_SUCCESS) {
+			fprintf(stderr, "Error sending SIP reply.\n");
+			sip_message_event_destroy(&sip_event);
 			return EXIT_FAILURE;
 		}
+	}
+	sip_message_event_destroy(&sip_event);
 
-		for (SOCKET i = 1; i <= max_socket; ++i) {
-			if (FD_ISSET(i, &reads)) {
-				char tcp_client_ip_address_buffer[100];
-				if (i == socket_listen_tcp) {
-					struct sockaddr_storage
-						tcp_client_address;
-					socklen_t tcp_client_len =
-						sizeof(tcp_client_address);
-
-					SOCKET tcp_socket_client = accept(
-						socket_listen_tcp,
-						(struct sockaddr
-							 *)&tcp_client_address,
-						&tcp_client_len);
-					if (!ISVALIDSOCKET(tcp_socket_client)) {
-						perror("TCP accept() failed.");
-						CLOSESOCKET(tcp_socket_client);
-						continue;
-					}
+	return EXIT_SUCCESS;
+}
 
-					FD_SET(tcp_socket_client, &master);
-					if (tcp_socket_client > max_socket) {
-						max_socket = tcp_socket_client;
-					}
+int sip_daemon_tcp_event(sentrypeer_config *config, SOCKET socket_client,
+			 const char *packet, int bytes_received,
+			 const char *client_ip_address, char *dest_ip_address)
+{
+	metrics_add(config->metrics, METRICS_SIP_TCP_PACKETS, 1);
+	metrics_add(config->metrics, METRICS_SIP_BYTES,
+		    (uint64_t)bytes_received);
 
-					char client_send_port_buffer[100];
-					if (getnameinfo(
-						    ((struct sockaddr
-							      *)&tcp_client_address),
-						    tcp_client_len,
-						    tcp_client_ip_address_buffer,
-						    sizeof(tcp_client_ip_address_buffer),
-						    client_send_port_buffer,
-						    sizeof(client_send_port_buffer),
-						    NI_NUMERICHOST |
-							    NI_NUMERICSERV) !=
-					    EXIT_SUCCESS) {
-						perror("getnameinfo() failed.");
-						return EXIT_FAILURE;
-					}
+	if (config->debug_mode || config->verbose_mode) {
+		time_t timestamp;
+		time(&timestamp);
+		fprintf(stderr, "epochtime: %ld\nReceived (%d bytes): %.*s\n",
+			timestamp, bytes_received, bytes_received, packet);
+
+		fprintf(stderr, "Received TCP packet from %s\n",
+			client_ip_address);
+		fprintf(stderr, "Destination IP address of TCP packet is: %s\n",
+			dest_ip_address);
+	}
 
-					if (config->debug_mode ||
-					    config->verbose_mode) {
-						fprintf(stderr,
-							"Accepted TCP connection from %s\n",
-							tcp_client_ip_address_buffer);
-					}
-				}
+	socklen_t tcp_client_len = sizeof(socket_client);
+
+	char transport_type[] = "TCP";
+	sip_message_event *sip_event = sip_message_event_new(
+		copy_packet(packet, bytes_received), bytes_received,
+		socket_client, util_duplicate_string(transport_type),
+		(struct sockaddr *)&socket_client,
+		util_duplicate_string(client_ip_address), tcp_client_len,
+		dest_ip_address);
+	assert(sip_event);
+	if (sip_log_event(config, sip_event) != EXIT_SUCCESS) {
+		fprintf(stderr, "Failed to log SIP TCP event.\n");
+		sip_message_event_destroy(&sip_event);
+		return EXIT_FAILURE;
+	}
 
-				// Process a connected TCP client
-				if ((i != socket_listen_udp) &&
-				    (i != socket_listen_tcp)) {
-					char read_packet_buf
-						[PACKET_BUFFER_SIZE] = { 0 };
-					int bytes_received =
-						recv(i, read_packet_buf,
-						     PACKET_BUFFER_SIZE, 0);
-					if (bytes_received < 1) {
-						if (config->debug_mode ||
-						    config->verbose_mode) {
-							fprintf(stderr,
-								"Empty TCP packet received.\n");
-						}
-						FD_CLR(i, &master);
-						CLOSESOCKET(i);
-						continue;
-					}
+	if (config->sip_responsive_mode) {
+		if (sip_send_reply(config, sip_event) != EXIT_SUCCESS) {
+			fprintf(stderr, "Error sending SIP reply.\n");
+			sip_message_event_destroy(&sip_event);
+			return EXIT_FAILURE;
+		}
+	}
+	sip_message_event_destroy(&sip_event);
 
-					if (config->debug_mode ||
-					    config->verbose_mode) {
-						time_t timestamp;
-						time(&timestamp);
-						fprintf(stderr,
-							"epochtime: %ld\nReceived (%d bytes): %.*s\n",
-							timestamp,
-							bytes_received,
-							bytes_received,
-							read_packet_buf);
-
-						fprintf(stderr,
-							"Received TCP packet from %s\n",
-							tcp_client_ip_address_buffer);
-					}
+	return EXIT_SUCCESS;
+}
 
-					struct sockaddr_in destination_address;
-					socklen_t destination_address_len =
-						sizeof(destination_address);
-					memset(&destination_address, 0,
-					       destination_address_len);
-					destination_address.sin_family =
-						AF_INET;
-					if (getsockname(
-						    i,
-						    (struct sockaddr
-							     *)&destination_address,
-						    &destination_address_len) ==
-					    EXIT_SUCCESS) {
-						dest_ip_address_buffer =
-							util_duplicate_string(inet_ntoa(
-								destination_address
-									.sin_addr));
-
-						if (config->debug_mode ||
-						    config->verbose_mode) {
-							fprintf(stderr,
-								"Destination IP address of TCP packet is: %s\n",
-								inet_ntoa(
-									destination_address
-										.sin_addr));
-						}
-					}
-					assert(dest_ip_address_buffer);
-					socklen_t tcp_client_len = sizeof(i);
-
-					char transport_type[] = "TCP";
-					sip_message_event *sip_event = sip_message_event_new(
-
-						util_duplicate_string(
-							read_packet_buf),
-						bytes_received, i,
-						util_duplicate_string(
-							transport_type),
-						(struct sockaddr *)&i,
-						util_duplicate_string(
-							tcp_client_ip_address_buffer),
-
-						tcp_client_len,
-
-						dest_ip_address_buffer);
-					assert(sip_event);
-					if (sip_log_event(config, sip_event) !=
-					    EXIT_SUCCESS) {
-						fprintf(stderr,
-							"Failed to log SIP TCP event.\n");
-						continue;
-					}
+tcp_conn_table *sip_daemon_tcp_conn_table_new(sentrypeer_config *config,
+					      tcp_conn_close_fn close_fn,
+					      void *arg)
+{
+	int max_connections = config->tcp_max_connections / config->sip_workers;
+	if (max_connections < 1) {
+		max_connections = 1;
+	}
 
-					if (config->sip_responsive_mode) {
-						if (sip_send_reply(config,
-								   sip_event) !=
-						    EXIT_SUCCESS) {
-							fprintf(stderr,
-								"Error sending SIP reply.\n");
-							continue;
-						}
-					}
-					sip_message_event_destroy(&sip_event);
-				}
+	return tcp_conn_table_new((size_t)max_connections,
+				  (size_t)config->tcp_max_connections_per_ip,
+				  config->tcp_idle_timeout,
+				  config->tcp_max_lifetime, tcp_conn_table_now(),
+				  close_fn, arg);
+}
 
-				if (FD_ISSET(socket_listen_udp, &reads)) {
-					struct sockaddr_storage client_address;
-					socklen_t client_len =
-						sizeof(client_address);
-
-					char read_packet_buf
-						[PACKET_BUFFER_SIZE] = { 0 };
-					char cmbuf[0x100];
-
-					struct msghdr msg_hdr = {
-						.msg_name = &client_address,
-						.msg_namelen =
-							sizeof(client_address),
-						.msg_control = cmbuf,
-						.msg_controllen = sizeof(cmbuf),
-					};
-
-					struct iovec iov = {
-						.iov_base = read_packet_buf,
-						.iov_len =
-							sizeof(read_packet_buf),
-					};
-
-					msg_hdr.msg_iov = &iov;
-					msg_hdr.msg_iovlen = 1;
-
-					int bytes_received = recvmsg(
-						socket_listen_udp, &msg_hdr, 0);
-
-					if (bytes_received < 1) {
-						if (config->debug_mode ||
-						    config->verbose_mode) {
-							fprintf(stderr,
-								"Empty UDP packet received.\n");
-						}
-					}
+void sip_daemon_tcp_closed(sentrypeer_config *config, int reason)
+{
+	const char *why = "shutting down";
+	if (reason == TCP_CONN_IDLE) {
+		metrics_add(config->metrics, METRICS_TCP_IDLE_TIMEOUTS, 1);
+		why = "idle timeout";
+	} else if (reason == TCP_CONN_LIFETIME) {
+		metrics_add(config->metrics, METRICS_TCP_LIFETIME_TIMEOUTS, 1);
+		why = "lifetime timeout";
+	} else if (reason == TCP_CONN_EVICTED) {
+		metrics_add(config->metrics, METRICS_TCP_EVICTIONS, 1);
+		why = "too many connections";
+	}
 
-					// TODO: Clean up
-#ifdef HAVE_IP_PKTINFO
-					for (struct cmsghdr *cmsg =
-						     CMSG_FIRSTHDR(&msg_hdr);
-					     cmsg != NULL;
-					     cmsg = CMSG_NXTHDR(&msg_hdr,
-								cmsg)) {
-						if (cmsg->cmsg_level !=
-							    IPPROTO_IP ||
-						    cmsg->cmsg_type !=
-							    IP_PKTINFO) {
-							continue;
-						}
-						struct in_pktinfo const *pi =
-							(struct in_pktinfo *)
-								CMSG_DATA(cmsg);
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Closed TCP connection: %s\n", why);
+	}
+}
 
-						dest_ip_address_buffer =
-							util_duplicate_string(inet_ntoa(
-								pi->ipi_spec_dst));
-
-						if (config->debug_mode ||
-						    config->verbose_mode) {
-							fprintf(stderr,
-								"Destination IP address of UDP packet is: %s\n",
-								inet_ntoa(
-									pi->ipi_spec_dst));
-						}
-					}
-#elif defined(HAVE_IP_RECVDSTADDR)
-					for (struct cmsghdr *cmsg =
-						     CMSG_FIRSTHDR(&msg_hdr);
-					     cmsg != NULL;
-					     cmsg = CMSG_NXTHDR(&msg_hdr,
-								cmsg)) {
-						if (cmsg->cmsg_level !=
-							    IPPROTO_IP ||
-						    cmsg->cmsg_type !=
-							    IP_RECVDSTADDR) {
-							continue;
-						}
-						struct in_addr *in =
-							(struct in_addr *)
-								CMSG_DATA(cmsg);
-						if (config->debug_mode ||
-						    config->verbose_mode) {
-							fprintf(stderr,
-								"Destination IP address of UDP packet is: %s\n",
-								inet_ntoa(
-									in->ipi_spec_dst));
-						}
-					}
-#endif
-					// Format timestamp like ngrep does
-					// https://github.com/jpr5/ngrep/blob/2a9603bc67dface9606a658da45e1f5c65170444/ngrep.c#L1247
-					if (config->debug_mode ||
-					    config->verbose_mode) {
-						time_t timestamp;
-						time(&timestamp);
-						fprintf(stderr,
-							"epochtime: %ld\nReceived (%d bytes): %.*s\n",
-							timestamp,
-							bytes_received,
-							bytes_received,
-							read_packet_buf);
-					}
+// An accepted TCP connection, found by its socket
+typedef struct sip_daemon_tcp_client sip_daemon_tcp_client;
+struct sip_daemon_tcp_client {
+	tcp_conn *conn;
+	char client_ip_address[INET6_ADDRSTRLEN];
+	char dest_ip_address[INET_ADDRSTRLEN];
+};
+
+typedef struct sip_daemon_select sip_daemon_select;
+struct sip_daemon_select {
+	sentrypeer_config *config;
+	fd_set master;
+	SOCKET max_socket;
+	tcp_conn_table *tcp_conns;
+	sip_daemon_tcp_client *tcp_clients[FD_SETSIZE];
+};
 
-					char udp_client_ip_address_buffer[100];
-					char udp_client_send_port_buffer[100];
-					if (getnameinfo(
-						    ((struct sockaddr
-							      *)&client_address),
-						    client_len,
-						    udp_client_ip_address_buffer,
-						    sizeof(udp_client_ip_address_buffer),
-						    udp_client_send_port_buffer,
-						    sizeof(udp_client_send_port_buffer),
-						    NI_NUMERICHOST |
-							    NI_NUMERICSERV) !=
-					    EXIT_SUCCESS) {
-						perror("getnameinfo() failed.");
-						return EXIT_FAILURE;
-					}
+static void sip_daemon_select_close(SOCKET socket_client, int reason,
+				    void *data, void *arg)
+{
+	sip_daemon_select *self = (sip_daemon_select *)arg;
+
+	self->tcp_clients[socket_client] = 0;
+	free(data);
+	FD_CLR(socket_client, &self->master);
+	CLOSESOCKET(socket_client);
+	sip_daemon_tcp_closed(self->config, reason);
+}
+
+static void sip_daemon_select_cleanup(void *arg)
+{
+	sip_daemon_select *self = (sip_daemon_select *)arg;
+	tcp_conn_table_destroy(&self->tcp_conns);
+}
 
-					if (config->debug_mode ||
-					    config->verbose_mode) {
-#if INTPTR_MAX == INT64_MAX
-						fprintf(stderr,
-							"read_packet_buf size is: %lu: \n",
-							sizeof(read_packet_buf));
-						fprintf(stderr,
-							"read_packet_buf length is: %lu: \n",
-							strnlen(read_packet_buf,
-								PACKET_BUFFER_SIZE));
+static void sip_daemon_select_accept(sip_daemon_select *self,
+				     SOCKET socket_listen_tcp)
+{
+	sentrypeer_config *config = self->config;
+	struct sockaddr_storage tcp_client_address;
+	socklen_t tcp_client_len = sizeof(tcp_client_address);
+
+	// Non-blocking, so a client that sends nothing after select() says
+	// it's readable can't hold up everyone else
+#ifdef SOCK_NONBLOCK
+	SOCKET tcp_socket_client = accept4(
+		socket_listen_tcp, (struct sockaddr *)&tcp_client_address,
+		&tcp_client_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	SOCKET tcp_socket_client =
+		accept(socket_listen_tcp,
+		       (struct sockaddr *)&tcp_client_address, &tcp_client_len);
+	if (ISVALIDSOCKET(tcp_socket_client)) {
+		fcntl(tcp_socket_client, F_SETFL,
+		      fcntl(tcp_socket_client, F_GETFL) | O_NONBLOCK);
+		fcntl(tcp_socket_client, F_SETFD, FD_CLOEXEC);
+	}
 #endif
-						fprintf(stderr,
-							"bytes_received size is: %d: \n\n",
-							bytes_received);
-					}
-					char transport_type[] = "UDP";
-
-					sip_message_event *sip_event = sip_message_event_new(
-						util_duplicate_string(
-							read_packet_buf),
-						bytes_received,
-						socket_listen_udp,
-						util_duplicate_string(
-							transport_type),
-						(struct sockaddr
-							 *)&client_address,
-
-						util_duplicate_string(
-							udp_client_ip_address_buffer),
-						client_len,
-
-						dest_ip_address_buffer);
-					assert(sip_event);
-
-					if (sip_log_event(config, sip_event) !=
-					    EXIT_SUCCESS) {
-						fprintf(stderr,
-							"Failed to log SIP UDP event.\n");
-						continue;
-					}
+	if (!ISVALIDSOCKET(tcp_socket_client)) {
+		perror("TCP accept() failed.");
+		return;
+	}
+
+	if (tcp_socket_client >= FD_SETSIZE) {
+		fprintf(stderr,
+			"TCP connection is past what select() can watch, closing it.\n");
+		CLOSESOCKET(tcp_socket_client);
+		return;
+	}
+
+	// Once per connection rather than once per read
+	sip_daemon_tcp_client *client = calloc(1, sizeof(sip_daemon_tcp_client));
+	assert(client);
+	if (getnameinfo((struct sockaddr *)&tcp_client_address, tcp_client_len,
+			client->client_ip_address,
+			sizeof(client->client_ip_address), 0, 0,
+			NI_NUMERICHOST) != EXIT_SUCCESS) {
+		perror("getnameinfo() failed.");
+		CLOSESOCKET(tcp_socket_client);
+		free(client);
+		return;
+	}
+
+	struct sockaddr_in destination_address;
+	socklen_t destination_address_len = sizeof(destination_address);
+	memset(&destination_address, 0, destination_address_len);
+	if (getsockname(tcp_socket_client,
+			(struct sockaddr *)&destination_address,
+			&destination_address_len) == EXIT_SUCCESS) {
+		inet_ntop(AF_INET, &destination_address.sin_addr,
+			  client->dest_ip_address,
+			  sizeof(client->dest_ip_address));
+	}
+
+	// May close the least recently used connection to make room
+	client->conn = tcp_conn_table_add(
+		self->tcp_conns, tcp_socket_client,
+		(struct sockaddr *)&tcp_client_address, client,
+		tcp_conn_table_now());
+	self->tcp_clients[tcp_socket_client] = client;
+	FD_SET(tcp_socket_client, &self->master);
+	if (tcp_socket_client > self->max_socket) {
+		self->max_socket = tcp_socket_client;
+	}
+
+	if (config->debug_mode || config->verbose_mode) {
+		fprintf(stderr, "Accepted TCP connection from %s\n",
+			client->client_ip_address);
+	}
+}
+
+static void sip_daemon_select_read(sip_daemon_select *self,
+				   SOCKET socket_client)
+{
+	sentrypeer_config *config = self->config;
+	sip_daemon_tcp_client *client = self->tcp_clients[socket_client];
+	if (client == 0) {
+		// Evicted by an accept earlier in this pass
+		return;
+	}
+
+	char read_packet_buf[PACKET_BUFFER_SIZE];
+	int bytes_received =
+		recv(socket_client, read_packet_buf, PACKET_BUFFER_SIZE, 0);
+	if (bytes_received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return;
+	}
+	if (bytes_received < 1) {
+		if (config->debug_mode || config->verbose_mode) {
+			fprintf(stderr, "Empty TCP packet received.\n");
+		}
+		tcp_conn_table_remove(self->tcp_conns, client->conn);
+		self->tcp_clients[socket_client] = 0;
+		free(client);
+		FD_CLR(socket_client, &self->master);
+		CLOSESOCKET(socket_client);
+		return;
+	}
 
-					if (config->sip_responsive_mode) {
-						if (sip_send_reply(config,
-								   sip_event) !=
-						    EXIT_SUCCESS) {
-							fprintf(stderr,
-								"Error sending SIP reply.\n");
-							continue;
-						}
+	tcp_conn_table_touch(self->tcp_conns, client->conn,
+			     tcp_conn_table_now());
+	sip_daemon_tcp_event(config, socket_client, read_packet_buf,
+			     bytes_received, client->client_ip_address,
+			     util_duplicate_string(client->dest_ip_address));
+}
+
+// One per worker, on its own sockets. Used when io_uring isn't.
+static int sip_daemon_serve(sentrypeer_config *config,
+			    SOCKET socket_listen_udp, SOCKET socket_listen_tcp)
+{
+	sip_daemon_select *self = calloc(1, sizeof(sip_daemon_select));
+	assert(self);
+	self->config = config;
+	FD_ZERO(&self->master);
+	FD_SET(socket_listen_udp, &self->master);
+	FD_SET(socket_listen_tcp, &self->master);
+	self->max_socket = max_int(socket_listen_tcp, socket_listen_udp);
+	self->tcp_conns = sip_daemon_tcp_conn_table_new(
+		config, sip_daemon_select_close, self);
+
+	int status = EXIT_SUCCESS;
+	pthread_cleanup_push(free, self);
+	pthread_cleanup_push(sip_daemon_select_cleanup, self);
+
+	while (status == EXIT_SUCCESS) {
+		fd_set reads;
+		reads = self->master;
+		// Wake at least once a second to time out idle connections
+		struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+		if (select(self->max_socket + 1, &reads, 0, 0, &timeout) <
+		    EXIT_SUCCESS) {
+			perror("select() failed.");
+			status = EXIT_FAILURE;
+			break;
+		}
+
+		for (SOCKET i = 1; i <= self->max_socket; ++i) {
+			if (!FD_ISSET(i, &reads)) {
+				continue;
+			}
+
+			if (i == socket_listen_tcp) {
+				sip_daemon_select_accept(self,
+							 socket_listen_tcp);
+			} else if (i == socket_listen_udp) {
+				struct sockaddr_storage client_address;
+				char read_packet_buf[PACKET_BUFFER_SIZE];
+				char cmbuf[0x100];
+
+				struct msghdr msg_hdr = {
+					.msg_name = &client_address,
+					.msg_namelen = sizeof(client_address),
+					.msg_control = cmbuf,
+					.msg_controllen = sizeof(cmbuf),
+				};
+
+				struct iovec iov = {
+					.iov_base = read_packet_buf,
+					.iov_len = sizeof(read_packet_buf),
+				};
+
+				msg_hdr.msg_iov = &iov;
+				msg_hdr.msg_iovlen = 1;
+
+				int bytes_received =
+					recvmsg(socket_listen_udp, &msg_hdr, 0);
+
+				char *dest_ip_address_buffer = 0;
+				for (struct cmsghdr *cmsg =
+					     CMSG_FIRSTHDR(&msg_hdr);
+				     bytes_received > 0 && cmsg != NULL;
+				     cmsg = CMSG_NXTHDR(&msg_hdr, cmsg)) {
+					if (dest_ip_address_buffer == 0) {
+						dest_ip_address_buffer =
+							sip_daemon_dest_ip_address(
+								cmsg);
 					}
-					sip_message_event_destroy(&sip_event);
 				}
+
+				sip_daemon_udp_event(config, socket_listen_udp,
+						     read_packet_buf,
+						     bytes_received,
+						     &client_address,
+						     msg_hdr.msg_namelen,
+						     dest_ip_address_buffer);
+			} else {
+				sip_daemon_select_read(self, i);
 			}
 		}
+
+		tcp_conn_table_expire(self->tcp_conns, tcp_conn_table_now());
 	}
-	CLOSESOCKET(socket_listen_udp);
-	CLOSESOCKET(socket_listen_tcp);
+
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+
+	return status;
 }
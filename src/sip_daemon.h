@@ -17,15 +17,36 @@
 #ifndef SENTRYPEER_SIP_DAEMON_H
 #define SENTRYPEER_SIP_DAEMON_H 1
 
+#include <sys/socket.h>
+#include <netinet/in.h>
+
 #include "conf.h"
 #include "bad_actor.h"
 #include "sip_message_event.h"
+#include "tcp_conn_table.h"
 
 #define ISVALIDSOCKET(s) ((s) >= 0)
 #define CLOSESOCKET(s) close(s)
 
 #define GETSOCKETERRNO() (errno)
 #define SIP_DAEMON_PORT "5060"
+#define PACKET_BUFFER_SIZE 1024
+
+// One thread per worker, each with its own UDP and TCP socket on
+// SIP_DAEMON_PORT
+#define SIP_DAEMON_WORKERS 1
+#define SIP_DAEMON_WORKERS_MAX 64
+// How packets are shared out between workers
+#define SIP_STEERING_SOURCE 0 // By source IP address
+#define SIP_STEERING_KERNEL 1 // The kernel's SO_REUSEPORT hash
+// How each worker waits for packets and connections
+#define SIP_BACKEND_AUTO 0 // io_uring if we can, otherwise select()
+#define SIP_BACKEND_IO_URING 1
+#define SIP_BACKEND_SELECT 2
+// Multiplier of the source IP address hash, 2^32 / golden ratio
+#define SIP_DAEMON_STEER_HASH 0x9E3779B1u
+
+typedef struct sip_daemon_worker sip_daemon_worker;
 
 int sip_log_event(sentrypeer_config *config,
 		  sip_message_event const *sip_event);
@@ -33,6 +54,71 @@ int sip_send_reply(sentrypeer_config const *config,
 		   sip_message_event const *sip_event);
 int sip_daemon_init(sentrypeer_config *config);
 int sip_daemon_run(sentrypeer_config *config);
-int sip_daemon_stop(sentrypeer_config const *config);
+int sip_daemon_stop(sentrypeer_config *config);
+void sip_daemon_workers_destroy(sentrypeer_config *config);
+
+// Shared by the select() and io_uring loops, once a packet has been read.
+// dest_ip_address is freed for you.
+int sip_daemon_udp_event(sentrypeer_config *config, SOCKET socket_listen_udp,
+			 const char *packet, int bytes_received,
+			 struct sockaddr_storage *client_address,
+			 socklen_t client_len, char *dest_ip_address);
+int sip_daemon_tcp_event(sentrypeer_config *config, SOCKET socket_client,
+			 const char *packet, int bytes_received,
+			 const char *client_ip_address, char *dest_ip_address);
+
+/**
+ * Each worker's share of the TCP connection caps and timeouts in config.
+ * With SIP_STEERING_SOURCE every connection from one address goes to the
+ * same worker, so the per IP address cap holds across all of them.
+ *
+ * @param config Our config.
+ * @param close_fn Closes connections the table drops, and should call
+ *        sip_daemon_tcp_closed().
+ * @param arg Handed to close_fn.
+ */
+tcp_conn_table *sip_daemon_tcp_conn_table_new(sentrypeer_config *config,
+					      tcp_conn_close_fn close_fn,
+					      void *arg);
+
+// Count a connection the table dropped, reason is one of TCP_CONN_*
+void sip_daemon_tcp_closed(sentrypeer_config *config, int reason);
+
+/**
+ * @param cmsg Control message from recvmsg() on a UDP listener.
+ * @return The destination IP address it holds, free with free(), or NULL
+ *         if it isn't IP_PKTINFO or IP_RECVDSTADDR.
+ */
+char *sip_daemon_dest_ip_address(struct cmsghdr *cmsg);
+
+/**
+ * @param backend "auto", "io_uring" or "select".
+ * @return One of SIP_BACKEND_*, or -1 if unknown.
+ */
+int sip_backend_from_string(const char *backend);
+
+/**
+ * @param steering "source" or "kernel".
+ * @return SIP_STEERING_SOURCE or SIP_STEERING_KERNEL, or -1 if unknown.
+ */
+int sip_steering_from_string(const char *steering);
+
+/**
+ * Attach a classic BPF filter to a SO_REUSEPORT group that picks the
+ * socket from a hash of the IPv4 source address, so all packets and
+ * connections from one address go to one worker.
+ *
+ * @param socket_listen Any socket in the group.
+ * @param workers How many sockets are in the group.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE with errno set if not supported.
+ */
+int sip_daemon_steer_by_source(SOCKET socket_listen, int workers);
+
+/**
+ * @param source An IPv4 source address.
+ * @param workers How many workers there are.
+ * @return The worker sip_daemon_steer_by_source() sends source to.
+ */
+int sip_daemon_worker_for(struct in_addr source, int workers);
 
 #endif //SENTRYPEER_SIP_DAEMON_H
@@ -0,0 +1,595 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+// Bring in getnameinfo and others as -std=c18 bins them off
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sip_daemon_io_uring.h"
+
+#if HAVE_LIBURING != 0
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <liburing.h>
+
+#include "utils.h"
+#include "tcp_conn_table.h"
+
+#define SIP_IO_URING_BUFFER_GROUP 0
+// Registered file indexes of the listening sockets
+#define SIP_IO_URING_UDP_FILE 0
+#define SIP_IO_URING_TCP_FILE 1
+
+// What a completion is for
+#define SIP_IO_URING_UDP 1
+#define SIP_IO_URING_ACCEPT 2
+#define SIP_IO_URING_RECV 3
+#define SIP_IO_URING_TICK 4 // Once a second, to time out TCP connections
+#define SIP_IO_URING_STOP 5 // sip_daemon_io_uring_stop() was called
+#define SIP_IO_URING_UDP_RETRY 6 // Backed off after a failed recvmsg
+
+// The first retry of the UDP recvmsg is straight away, as running out of
+// buffers under load is normal, then waits twice as long each time up to
+// a second. After this many failures in a row without a packet read in
+// between, we give up on io_uring and the worker uses select() instead.
+#define SIP_IO_URING_UDP_FAILURES_MAX 20
+#define SIP_IO_URING_UDP_RETRY_MAX_MS 1000
+
+// The user_data of each multishot request. One for each listener and one
+// per accepted TCP connection, which also remembers who it's from so that
+// isn't looked up again for every read.
+typedef struct sip_io_uring_conn sip_io_uring_conn;
+struct sip_io_uring_conn {
+	int kind;
+	SOCKET socket;
+	char client_ip_address[INET6_ADDRSTRLEN];
+	char dest_ip_address[INET_ADDRSTRLEN];
+	tcp_conn *entry; // Until the table drops it
+	sip_io_uring_conn *prev;
+	sip_io_uring_conn *next;
+};
+
+typedef struct sip_io_uring sip_io_uring;
+struct sip_io_uring {
+	sentrypeer_config *config;
+	struct io_uring ring;
+	bool ring_ready;
+	struct io_uring_buf_ring *buf_ring;
+	char *buffers;
+	struct msghdr udp_msg; // Tells multishot recvmsg how to lay out buffers
+	sip_io_uring_conn udp;
+	sip_io_uring_conn accept;
+	sip_io_uring_conn *connections; // Accepted, still open
+	tcp_conn_table *tcp_conns;
+	sip_io_uring_conn tick;
+	struct __kernel_timespec tick_interval;
+	sip_io_uring_conn stop;
+	eventfd_t stop_value;
+	sip_io_uring_conn udp_retry;
+	struct __kernel_timespec udp_retry_interval;
+	unsigned int udp_failures; // In a row, reset by a packet
+	bool udp_failure_logged;
+	bool started; // Something has been read, too late to fall back
+	bool stopped;
+};
+
+static void sip_io_uring_cleanup(void *arg)
+{
+	sip_io_uring *self = (sip_io_uring *)arg;
+
+	tcp_conn_table_destroy(&self->tcp_conns);
+	if (self->ring_ready) {
+		// Our requests and registered files keep the sockets open until
+		// the kernel gets round to tearing down the ring, which is after
+		// we've returned. Drop them now so the port is free straight
+		// after sip_daemon_stop().
+		struct io_uring_sync_cancel_reg cancel_all;
+		memset(&cancel_all, 0, sizeof(cancel_all));
+		cancel_all.fd = -1;
+		cancel_all.flags = IORING_ASYNC_CANCEL_ANY;
+		cancel_all.timeout.tv_sec = -1;
+		cancel_all.timeout.tv_nsec = -1;
+		io_uring_register_sync_cancel(&self->ring, &cancel_all);
+		io_uring_unregister_files(&self->ring);
+	}
+
+	while (self->connections) {
+		sip_io_uring_conn *conn = self->connections;
+		self->connections = conn->next;
+		CLOSESOCKET(conn->socket);
+		free(conn);
+	}
+	if (self->buf_ring) {
+		io_uring_free_buf_ring(&self->ring, self->buf_ring,
+				       SIP_IO_URING_BUFFERS,
+				       SIP_IO_URING_BUFFER_GROUP);
+		self->buf_ring = 0;
+	}
+	if (self->ring_ready) {
+		io_uring_queue_exit(&self->ring);
+		self->ring_ready = false;
+	}
+	free(self->buffers);
+	self->buffers = 0;
+}
+
+static struct io_uring_sqe *get_sqe(sip_io_uring *self)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&self->ring);
+	if (sqe == 0) {
+		// Full, so send what's queued and try again
+		io_uring_submit(&self->ring);
+		sqe = io_uring_get_sqe(&self->ring);
+	}
+	assert(sqe);
+
+	return sqe;
+}
+
+static void arm_udp(sip_io_uring *self)
+{
+	struct io_uring_sqe *sqe = get_sqe(self);
+	io_uring_prep_recvmsg_multishot(sqe, SIP_IO_URING_UDP_FILE,
+					&self->udp_msg, 0);
+	sqe->flags |= IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+	sqe->buf_group = SIP_IO_URING_BUFFER_GROUP;
+	io_uring_sqe_set_data(sqe, &self->udp);
+}
+
+static void arm_accept(sip_io_uring *self)
+{
+	struct io_uring_sqe *sqe = get_sqe(self);
+	io_uring_prep_multishot_accept(sqe, SIP_IO_URING_TCP_FILE, 0, 0,
+				       SOCK_NONBLOCK | SOCK_CLOEXEC);
+	sqe->flags |= IOSQE_FIXED_FILE;
+	io_uring_sqe_set_data(sqe, &self->accept);
+}
+
+static void arm_recv(sip_io_uring *self, sip_io_uring_conn *conn)
+{
+	struct io_uring_sqe *sqe = get_sqe(self);
+	io_uring_prep_recv_multishot(sqe, conn->socket, 0, 0, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = SIP_IO_URING_BUFFER_GROUP;
+	io_uring_sqe_set_data(sqe, conn);
+}
+
+static void arm_tick(sip_io_uring *self)
+{
+	struct io_uring_sqe *sqe = get_sqe(self);
+	io_uring_prep_timeout(sqe, &self->tick_interval, 0, 0);
+	io_uring_sqe_set_data(sqe, &self->tick);
+}
+
+static void arm_udp_retry(sip_io_uring *self, long delay_ms)
+{
+	self->udp_retry_interval.tv_sec = delay_ms / 1000;
+	self->udp_retry_interval.tv_nsec = (delay_ms % 1000) * 1000000;
+	struct io_uring_sqe *sqe = get_sqe(self);
+	io_uring_prep_timeout(sqe, &self->udp_retry_interval, 0, 0);
+	io_uring_sqe_set_data(sqe, &self->udp_retry);
+}
+
+static void arm_stop(sip_io_uring *self)
+{
+	struct io_uring_sqe *sqe = get_sqe(self);
+	io_uring_prep_read(sqe, self->stop.socket, &self->stop_value,
+			   sizeof(self->stop_value), 0);
+	io_uring_sqe_set_data(sqe, &self->stop);
+}
+
+// The table dropped conn. Shutting it down ends its multishot recv, and
+// recv_completion() frees it then.
+static void sip_io_uring_close(SOCKET socket_client, int reason, void *data,
+			       void *arg)
+{
+	sip_io_uring *self = (sip_io_uring *)arg;
+	sip_io_uring_conn *conn = (sip_io_uring_conn *)data;
+
+	conn->entry = 0;
+	shutdown(socket_client, SHUT_RDWR);
+	sip_daemon_tcp_closed(self->config, reason);
+}
+
+static char *buffer_of(sip_io_uring *self, struct io_uring_cqe *cqe)
+{
+	unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	return self->buffers + (size_t)bid * SIP_IO_URING_BUFFER_SIZE;
+}
+
+// Give a buffer back to the kernel as soon as we're done with it
+static void recycle(sip_io_uring *self, struct io_uring_cqe *cqe)
+{
+	if ((cqe->flags & IORING_CQE_F_BUFFER) == 0) {
+		return;
+	}
+	io_uring_buf_ring_add(self->buf_ring, buffer_of(self, cqe),
+			      SIP_IO_URING_BUFFER_SIZE,
+			      (unsigned short)(cqe->flags >>
+					       IORING_CQE_BUFFER_SHIFT),
+			      io_uring_buf_ring_mask(SIP_IO_URING_BUFFERS), 0);
+	io_uring_buf_ring_advance(self->buf_ring, 1);
+}
+
+// A kernel that has io_uring but not the multishot flavour of an op
+// answers the first request with one of these
+static bool unsupported(const sip_io_uring *self, int res)
+{
+	return !self->started && (res == -EINVAL || res == -EOPNOTSUPP);
+}
+
+static int udp_completion(sip_io_uring *self, struct io_uring_cqe *cqe)
+{
+	sentrypeer_config *config = self->config;
+
+	if (cqe->res < 0) {
+		if (unsupported(self, cqe->res)) {
+			return SIP_IO_URING_UNSUPPORTED;
+		}
+		self->udp_failures++;
+		if (self->udp_failures >= SIP_IO_URING_UDP_FAILURES_MAX) {
+			fprintf(stderr,
+				"UDP recvmsg() failed %u times in a row: %s, "
+				"giving up on io_uring\n",
+				self->udp_failures, strerror(-cqe->res));
+			return SIP_IO_URING_UNSUPPORTED;
+		}
+		// Out of buffers is expected under load, the request just
+		// needs making again. Anything else is only said once a run.
+		if (cqe->res != -ENOBUFS && !self->udp_failure_logged) {
+			fprintf(stderr, "UDP recvmsg() failed: %s, retrying\n",
+				strerror(-cqe->res));
+			self->udp_failure_logged = true;
+		}
+		if (self->udp_failures > 1) {
+			long delay_ms = 1L << (self->udp_failures - 2);
+			if (delay_ms > SIP_IO_URING_UDP_RETRY_MAX_MS) {
+				delay_ms = SIP_IO_URING_UDP_RETRY_MAX_MS;
+			}
+			// An error always ends the multishot request
+			arm_udp_retry(self, delay_ms);
+			return EXIT_SUCCESS;
+		}
+	} else {
+		self->started = true;
+		self->udp_failures = 0;
+		self->udp_failure_logged = false;
+		struct io_uring_recvmsg_out *out = io_uring_recvmsg_validate(
+			buffer_of(self, cqe), cqe->res, &self->udp_msg);
+		if (out) {
+			struct sockaddr_storage client_address;
+			socklen_t client_len = out->namelen;
+			if (client_len > sizeof(client_address)) {
+				client_len = sizeof(client_address);
+			}
+			memcpy(&client_address, io_uring_recvmsg_name(out),
+			       client_len);
+
+			char *dest_ip_address_buffer = 0;
+			for (struct cmsghdr *cmsg =
+				     io_uring_recvmsg_cmsg_firsthdr(
+					     out, &self->udp_msg);
+			     cmsg != NULL && dest_ip_address_buffer == 0;
+			     cmsg = io_uring_recvmsg_cmsg_nexthdr(
+				     out, &self->udp_msg, cmsg)) {
+				dest_ip_address_buffer =
+					sip_daemon_dest_ip_address(cmsg);
+			}
+
+			sip_daemon_udp_event(
+				config, self->udp.socket,
+				io_uring_recvmsg_payload(out, &self->udp_msg),
+				(int)io_uring_recvmsg_payloadlen(
+					out, cqe->res, &self->udp_msg),
+				&client_address, client_len,
+				dest_ip_address_buffer);
+		}
+		recycle(self, cqe);
+	}
+
+	if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+		arm_udp(self);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int accept_completion(sip_io_uring *self, struct io_uring_cqe *cqe)
+{
+	sentrypeer_config *config = self->config;
+
+	if (cqe->res < 0) {
+		if (unsupported(self, cqe->res)) {
+			return SIP_IO_URING_UNSUPPORTED;
+		}
+		fprintf(stderr, "TCP accept() failed: %s\n",
+			strerror(-cqe->res));
+	} else {
+		self->started = true;
+		sip_io_uring_conn *conn = calloc(1, sizeof(sip_io_uring_conn));
+		assert(conn);
+		conn->kind = SIP_IO_URING_RECV;
+		conn->socket = cqe->res;
+
+		// Once per connection rather than once per read
+		struct sockaddr_storage tcp_client_address;
+		socklen_t tcp_client_len = sizeof(tcp_client_address);
+		if (getpeername(conn->socket,
+				(struct sockaddr *)&tcp_client_address,
+				&tcp_client_len) != EXIT_SUCCESS ||
+		    getnameinfo((struct sockaddr *)&tcp_client_address,
+				tcp_client_len, conn->client_ip_address,
+				sizeof(conn->client_ip_address), 0, 0,
+				NI_NUMERICHOST) != EXIT_SUCCESS) {
+			perror("getnameinfo() failed.");
+			CLOSESOCKET(conn->socket);
+			free(conn);
+			conn = 0;
+		}
+
+		struct sockaddr_in destination_address;
+		socklen_t destination_address_len = sizeof(destination_address);
+		memset(&destination_address, 0, destination_address_len);
+		if (conn &&
+		    getsockname(conn->socket,
+				(struct sockaddr *)&destination_address,
+				&destination_address_len) == EXIT_SUCCESS) {
+			inet_ntop(AF_INET, &destination_address.sin_addr,
+				  conn->dest_ip_address,
+				  sizeof(conn->dest_ip_address));
+		}
+
+		if (conn) {
+			// May shut down the least recently used connection
+			// to make room
+			conn->entry = tcp_conn_table_add(
+				self->tcp_conns, conn->socket,
+				(struct sockaddr *)&tcp_client_address, conn,
+				tcp_conn_table_now());
+			conn->next = self->connections;
+			if (self->connections) {
+				self->connections->prev = conn;
+			}
+			self->connections = conn;
+			arm_recv(self, conn);
+
+			if (config->debug_mode || config->verbose_mode) {
+				fprintf(stderr,
+					"Accepted TCP connection from %s\n",
+					conn->client_ip_address);
+			}
+		}
+	}
+
+	if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+		arm_accept(self);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int recv_completion(sip_io_uring *self, sip_io_uring_conn *conn,
+			   struct io_uring_cqe *cqe)
+{
+	sentrypeer_config *config = self->config;
+
+	if (cqe->res > 0) {
+		if (conn->entry) {
+			tcp_conn_table_touch(self->tcp_conns, conn->entry,
+					     tcp_conn_table_now());
+		}
+		sip_daemon_tcp_event(config, conn->socket, buffer_of(self, cqe),
+				     cqe->res, conn->client_ip_address,
+				     util_duplicate_string(
+					     conn->dest_ip_address));
+		recycle(self, cqe);
+	}
+
+	if (cqe->flags & IORING_CQE_F_MORE) {
+		return EXIT_SUCCESS;
+	}
+
+	if (cqe->res > 0 || cqe->res == -ENOBUFS) {
+		arm_recv(self, conn);
+		return EXIT_SUCCESS;
+	}
+
+	// Closed, or gone wrong, or shut down by sip_io_uring_close(). Nothing
+	// else refers to conn now.
+	if (conn->entry) {
+		if (config->debug_mode || config->verbose_mode) {
+			fprintf(stderr, "Empty TCP packet received.\n");
+		}
+		tcp_conn_table_remove(self->tcp_conns, conn->entry);
+	}
+	if (conn->prev) {
+		conn->prev->next = conn->next;
+	} else {
+		self->connections = conn->next;
+	}
+	if (conn->next) {
+		conn->next->prev = conn->prev;
+	}
+	CLOSESOCKET(conn->socket);
+	free(conn);
+
+	return EXIT_SUCCESS;
+}
+
+static int setup(sip_io_uring *self, SOCKET socket_listen_udp,
+		 SOCKET socket_listen_tcp, int stop_fd)
+{
+	// Without a way to stop us, let the select() loop take it
+	if (stop_fd < 0) {
+		return SIP_IO_URING_UNSUPPORTED;
+	}
+
+	int ret = io_uring_queue_init(SIP_IO_URING_ENTRIES, &self->ring, 0);
+	if (ret < 0) {
+		// ENOSYS, or EPERM if turned off by sysctl or seccomp
+		return SIP_IO_URING_UNSUPPORTED;
+	}
+	self->ring_ready = true;
+
+	int files[] = { socket_listen_udp, socket_listen_tcp };
+	if (io_uring_register_files(&self->ring, files, 2) < 0) {
+		return SIP_IO_URING_UNSUPPORTED;
+	}
+
+	// Needs Linux 5.19
+	self->buf_ring = io_uring_setup_buf_ring(&self->ring,
+						 SIP_IO_URING_BUFFERS,
+						 SIP_IO_URING_BUFFER_GROUP, 0,
+						 &ret);
+	if (self->buf_ring == 0) {
+		return SIP_IO_URING_UNSUPPORTED;
+	}
+
+	self->buffers = malloc((size_t)SIP_IO_URING_BUFFERS *
+			       SIP_IO_URING_BUFFER_SIZE);
+	assert(self->buffers);
+	for (int i = 0; i < SIP_IO_URING_BUFFERS; i++) {
+		io_uring_buf_ring_add(
+			self->buf_ring,
+			self->buffers + (size_t)i * SIP_IO_URING_BUFFER_SIZE,
+			SIP_IO_URING_BUFFER_SIZE, (unsigned short)i,
+			io_uring_buf_ring_mask(SIP_IO_URING_BUFFERS), i);
+	}
+	io_uring_buf_ring_advance(self->buf_ring, SIP_IO_URING_BUFFERS);
+
+	self->udp_msg.msg_namelen = sizeof(struct sockaddr_storage);
+	self->udp_msg.msg_controllen = 64; // IP_PKTINFO with room to spare
+	self->udp.kind = SIP_IO_URING_UDP;
+	self->udp.socket = socket_listen_udp;
+	self->accept.kind = SIP_IO_URING_ACCEPT;
+	self->accept.socket = socket_listen_tcp;
+	self->tick.kind = SIP_IO_URING_TICK;
+	self->tick_interval.tv_sec = 1;
+	self->stop.kind = SIP_IO_URING_STOP;
+	self->stop.socket = stop_fd;
+	self->udp_retry.kind = SIP_IO_URING_UDP_RETRY;
+	self->tcp_conns = sip_daemon_tcp_conn_table_new(
+		self->config, sip_io_uring_close, self);
+	arm_udp(self);
+	arm_accept(self);
+	arm_tick(self);
+	arm_stop(self);
+
+	return EXIT_SUCCESS;
+}
+
+int sip_daemon_io_uring_serve(sentrypeer_config *config,
+			      SOCKET socket_listen_udp,
+			      SOCKET socket_listen_tcp, int stop_fd)
+{
+	sip_io_uring self;
+	memset(&self, 0, sizeof(self));
+	self.config = config;
+
+	// Cancelling part way through a liburing call could leave the ring
+	// half updated, so we're told to stop through stop_fd instead. A
+	// cancel that comes meanwhile waits until we return.
+	int cancel_state = 0;
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+
+	int status = setup(&self, socket_listen_udp, socket_listen_tcp, stop_fd);
+	if (status == EXIT_SUCCESS &&
+	    (config->debug_mode || config->verbose_mode)) {
+		fprintf(stderr, "Waiting for SIP with io_uring...\n");
+	}
+
+	while (status == EXIT_SUCCESS && !self.stopped) {
+		int ret = io_uring_submit_and_wait(&self.ring, 1);
+		if (ret < 0 && ret != -EINTR) {
+			fprintf(stderr, "io_uring_submit_and_wait() failed: %s\n",
+				strerror(-ret));
+			status = EXIT_FAILURE;
+			break;
+		}
+
+		struct io_uring_cqe *cqe = 0;
+		while (status == EXIT_SUCCESS &&
+		       io_uring_peek_cqe(&self.ring, &cqe) == 0) {
+			sip_io_uring_conn *conn =
+				(sip_io_uring_conn *)io_uring_cqe_get_data(cqe);
+			if (conn->kind == SIP_IO_URING_UDP) {
+				status = udp_completion(&self, cqe);
+			} else if (conn->kind == SIP_IO_URING_ACCEPT) {
+				status = accept_completion(&self, cqe);
+			} else if (conn->kind == SIP_IO_URING_TICK) {
+				tcp_conn_table_expire(self.tcp_conns,
+						      tcp_conn_table_now());
+				arm_tick(&self);
+			} else if (conn->kind == SIP_IO_URING_UDP_RETRY) {
+				arm_udp(&self);
+			} else if (conn->kind == SIP_IO_URING_STOP) {
+				self.stopped = true;
+			} else {
+				status = recv_completion(&self, conn, cqe);
+			}
+			io_uring_cqe_seen(&self.ring, cqe);
+		}
+	}
+
+	sip_io_uring_cleanup(&self);
+	pthread_setcancelstate(cancel_state, NULL);
+
+	return status;
+}
+
+int sip_daemon_io_uring_stop_fd_new(void)
+{
+	return eventfd(0, EFD_CLOEXEC);
+}
+
+void sip_daemon_io_uring_stop(int stop_fd)
+{
+	if (stop_fd >= 0) {
+		eventfd_write(stop_fd, 1);
+	}
+}
+
+#else
+
+int sip_daemon_io_uring_serve(sentrypeer_config *config,
+			      SOCKET socket_listen_udp,
+			      SOCKET socket_listen_tcp, int stop_fd)
+{
+	(void)config;
+	(void)socket_listen_udp;
+	(void)socket_listen_tcp;
+	(void)stop_fd;
+
+	return SIP_IO_URING_UNSUPPORTED;
+}
+
+int sip_daemon_io_uring_stop_fd_new(void)
+{
+	return -1;
+}
+
+void sip_daemon_io_uring_stop(int stop_fd)
+{
+	(void)stop_fd;
+}
+
+#endif // HAVE_LIBURING
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#ifndef SENTRYPEER_SIP_DAEMON_IO_URING_H
+#define SENTRYPEER_SIP_DAEMON_IO_URING_H 1
+
+#include "conf.h"
+#include "sip_daemon.h"
+
+// Submission queue size per worker
+#define SIP_IO_URING_ENTRIES 256
+// Buffers in each worker's provided buffer ring, a power of 2. One is
+// taken per UDP packet or TCP read and handed straight back once the
+// event is logged.
+#define SIP_IO_URING_BUFFERS 512
+// Room for a recvmsg header, source address and IP_PKTINFO as well as
+// PACKET_BUFFER_SIZE bytes of SIP
+#define SIP_IO_URING_BUFFER_SIZE (PACKET_BUFFER_SIZE + 512)
+// Returned when io_uring, or one of the features we need, isn't available
+// and the caller should use select() instead
+#define SIP_IO_URING_UNSUPPORTED -1
+
+/**
+ * Wait for packets and connections on one worker's sockets with io_uring:
+ * multishot recvmsg on the UDP socket, multishot accept on the TCP one and
+ * multishot recv on each accepted connection, all reading into a provided
+ * buffer ring registered with the kernel. Runs until
+ * sip_daemon_io_uring_stop() is called on stop_fd. The thread can't be
+ * cancelled meanwhile, as liburing calls aren't cancellation points and
+ * aren't safe to cancel asynchronously.
+ *
+ * Needs Linux 6.0 or later and liburing 2.4 or later at build time.
+ *
+ * @param config Our config.
+ * @param socket_listen_udp A bound UDP socket with IP_PKTINFO set.
+ * @param socket_listen_tcp A listening TCP socket.
+ * @param stop_fd From sip_daemon_io_uring_stop_fd_new().
+ * @return EXIT_SUCCESS once stopped, EXIT_FAILURE on error, or
+ *         SIP_IO_URING_UNSUPPORTED before anything has been read if
+ *         io_uring can't be used here, or once UDP reads have kept
+ *         failing.
+ */
+int sip_daemon_io_uring_serve(sentrypeer_config *config,
+			      SOCKET socket_listen_udp,
+			      SOCKET socket_listen_tcp, int stop_fd);
+
+// An eventfd for stopping sip_daemon_io_uring_serve(), or -1 without
+// io_uring. Close it with close().
+int sip_daemon_io_uring_stop_fd_new(void);
+
+// Stop sip_daemon_io_uring_serve() on stop_fd, whether it has started yet
+// or not. Does nothing for -1.
+void sip_daemon_io_uring_stop(int stop_fd);
+
+#endif //SENTRYPEER_SIP_DAEMON_IO_URING_H
@@ -0,0 +1,550 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "sip_message_store.h"
+#include "utils.h"
+
+#if HAVE_ZSTD != 0
+#include <pthread.h>
+#include <zstd.h>
+#include <zdict.h>
+
+// Building a CDict/DDict is expensive, so the dictionaries last used are
+// kept. They're keyed on the database file as well as dict_id, as dict_id
+// is only unique within one file, e.g. each partition has its own.
+typedef struct dict_cache_entry dict_cache_entry;
+struct dict_cache_entry {
+	char *db_file;
+	sqlite3_int64 dict_id;
+	ZSTD_CDict *cdict;
+	ZSTD_DDict *ddict;
+	unsigned refs; // One for the cache and one for each user
+	uint64_t used;
+};
+
+static pthread_mutex_t dict_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static dict_cache_entry *dict_cache[SIP_MESSAGE_DICT_CACHE_SIZE];
+static uint64_t dict_cache_clock = 0;
+
+// Reused for every body this thread compresses or decompresses
+static _Thread_local ZSTD_CCtx *thread_cctx = 0;
+static _Thread_local ZSTD_DCtx *thread_dctx = 0;
+
+static ZSTD_CCtx *cctx_get(void)
+{
+	if (thread_cctx == 0) {
+		thread_cctx = ZSTD_createCCtx();
+		assert(thread_cctx);
+	}
+
+	return thread_cctx;
+}
+
+static ZSTD_DCtx *dctx_get(void)
+{
+	if (thread_dctx == 0) {
+		thread_dctx = ZSTD_createDCtx();
+		assert(thread_dctx);
+	}
+
+	return thread_dctx;
+}
+
+static void dict_entry_free(dict_cache_entry *entry)
+{
+	ZSTD_freeCDict(entry->cdict);
+	ZSTD_freeDDict(entry->ddict);
+	free(entry->db_file);
+	free(entry);
+}
+
+// Call with dict_cache_mutex held
+static void dict_entry_unref(dict_cache_entry *entry)
+{
+	if (--entry->refs == 0) {
+		dict_entry_free(entry);
+	}
+}
+
+static void dict_release(dict_cache_entry *entry)
+{
+	pthread_mutex_lock(&dict_cache_mutex);
+	dict_entry_unref(entry);
+	pthread_mutex_unlock(&dict_cache_mutex);
+}
+
+// The newest dict_id in db, 0 if there isn't one. A seek on the primary
+// key, so cheap enough to check on every insert.
+static sqlite3_int64 dict_latest_id(sqlite3 *db)
+{
+	sqlite3_stmt *latest_stmt = 0;
+	if (sqlite3_prepare_v2(db, GET_LATEST_SIP_MESSAGE_DICT_ID, -1,
+			       &latest_stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare statement: %s\n",
+			sqlite3_errmsg(db));
+		return -1;
+	}
+
+	sqlite3_int64 dict_id = 0;
+	if (sqlite3_step(latest_stmt) == SQLITE_ROW) {
+		dict_id = sqlite3_column_int64(latest_stmt, 0);
+	}
+	sqlite3_finalize(latest_stmt);
+
+	return dict_id;
+}
+
+// Read dict_id from db and build its CDict and DDict, NULL on failure
+static dict_cache_entry *dict_entry_load(sqlite3 *db, const char *db_file,
+					 sqlite3_int64 dict_id)
+{
+	sqlite3_stmt *get_dict_stmt = 0;
+	if (sqlite3_prepare_v2(db, GET_SIP_MESSAGE_DICT, -1, &get_dict_stmt,
+			       NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare statement: %s\n",
+			sqlite3_errmsg(db));
+		return 0;
+	}
+	sqlite3_bind_int64(get_dict_stmt, 1, dict_id);
+
+	if (sqlite3_step(get_dict_stmt) != SQLITE_ROW) {
+		sqlite3_finalize(get_dict_stmt);
+		return 0;
+	}
+
+	const void *dict = sqlite3_column_blob(get_dict_stmt, 0);
+	size_t dict_len = (size_t)sqlite3_column_bytes(get_dict_stmt, 0);
+
+	dict_cache_entry *entry = calloc(1, sizeof(dict_cache_entry));
+	assert(entry);
+	entry->db_file = util_duplicate_string(db_file);
+	entry->dict_id = dict_id;
+	entry->cdict =
+		ZSTD_createCDict(dict, dict_len, SIP_MESSAGE_ZSTD_LEVEL);
+	entry->ddict = ZSTD_createDDict(dict, dict_len);
+	entry->refs = 1;
+	sqlite3_finalize(get_dict_stmt);
+
+	if (entry->cdict == 0 || entry->ddict == 0) {
+		fprintf(stderr, "Failed to load SIP message dictionary\n");
+		dict_entry_free(entry);
+		return 0;
+	}
+
+	return entry;
+}
+
+// Call with dict_cache_mutex held. Replaces the entry for the same file
+// and dict_id if there is one, otherwise the least recently used.
+static void dict_cache_add(dict_cache_entry *entry)
+{
+	size_t slot = 0;
+	for (size_t i = 0; i < SIP_MESSAGE_DICT_CACHE_SIZE; i++) {
+		if (dict_cache[i] == 0) {
+			slot = i;
+			continue;
+		}
+		if (dict_cache[i]->dict_id == entry->dict_id &&
+		    strcmp(dict_cache[i]->db_file, entry->db_file) == 0) {
+			slot = i;
+			break;
+		}
+		if (dict_cache[slot] != 0 &&
+		    dict_cache[i]->used < dict_cache[slot]->used) {
+			slot = i;
+		}
+	}
+
+	if (dict_cache[slot] != 0) {
+		dict_entry_unref(dict_cache[slot]);
+	}
+	entry->refs++;
+	entry->used = ++dict_cache_clock;
+	dict_cache[slot] = entry;
+}
+
+// dict_id from db, from the cache if it's there. Hand it back with
+// dict_release(). NULL if it can't be loaded.
+static dict_cache_entry *dict_acquire(sqlite3 *db, sqlite3_int64 dict_id)
+{
+	// In memory and temporary databases have no name to key them on
+	const char *db_file = sqlite3_db_filename(db, "main");
+	if (db_file == 0 || db_file[0] == '\0') {
+		return dict_entry_load(db, "", dict_id);
+	}
+
+	pthread_mutex_lock(&dict_cache_mutex);
+	for (size_t i = 0; i < SIP_MESSAGE_DICT_CACHE_SIZE; i++) {
+		dict_cache_entry *entry = dict_cache[i];
+		if (entry != 0 && entry->dict_id == dict_id &&
+		    strcmp(entry->db_file, db_file) == 0) {
+			entry->refs++;
+			entry->used = ++dict_cache_clock;
+			pthread_mutex_unlock(&dict_cache_mutex);
+			return entry;
+		}
+	}
+	pthread_mutex_unlock(&dict_cache_mutex);
+
+	// Loaded without the lock, as it reads the database
+	dict_cache_entry *entry = dict_entry_load(db, db_file, dict_id);
+	if (entry != 0) {
+		pthread_mutex_lock(&dict_cache_mutex);
+		dict_cache_add(entry);
+		pthread_mutex_unlock(&dict_cache_mutex);
+	}
+
+	return entry;
+}
+
+// Load dict_id into the cache even if it's there already, replacing what
+// a file that was here before under the same name had
+static void dict_cache_refresh(sqlite3 *db, sqlite3_int64 dict_id)
+{
+	const char *db_file = sqlite3_db_filename(db, "main");
+	if (db_file == 0 || db_file[0] == '\0') {
+		return;
+	}
+
+	dict_cache_entry *entry = dict_entry_load(db, db_file, dict_id);
+	if (entry != 0) {
+		pthread_mutex_lock(&dict_cache_mutex);
+		dict_cache_add(entry);
+		dict_entry_unref(entry);
+		pthread_mutex_unlock(&dict_cache_mutex);
+	}
+}
+
+// Train a dictionary from the most recent bodies. Scanner traffic differs
+// mostly in Call-ID, tags and branch parameters, so a small shared
+// dictionary gets far better ratios than compressing each body on its own.
+static void train_dict(sqlite3 *db, sentrypeer_config const *config)
+{
+	if (dict_latest_id(db) != 0) {
+		return;
+	}
+
+	sqlite3_stmt *samples_stmt = 0;
+	if (sqlite3_prepare_v2(db, GET_SIP_MESSAGE_DICT_SAMPLES, -1,
+			       &samples_stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare statement: %s\n",
+			sqlite3_errmsg(db));
+		return;
+	}
+	sqlite3_bind_int(samples_stmt, 1, SIP_MESSAGE_DICT_TRAINING_SAMPLES);
+
+	size_t *sample_sizes = calloc(SIP_MESSAGE_DICT_TRAINING_SAMPLES,
+				      sizeof(*sample_sizes));
+	size_t samples_capacity = 64 * 1024;
+	size_t samples_len = 0;
+	char *samples = malloc(samples_capacity);
+	void *dict = malloc(SIP_MESSAGE_DICT_CAPACITY);
+	assert(sample_sizes && samples && dict);
+
+	unsigned sample_count = 0;
+	while (sqlite3_step(samples_stmt) == SQLITE_ROW) {
+		char *body = sip_message_store_get(
+			db, sqlite3_column_int64(samples_stmt, 0));
+		if (body == 0) {
+			continue;
+		}
+
+		size_t body_len = strlen(body);
+		if (samples_len + body_len > samples_capacity) {
+			samples_capacity = (samples_len + body_len) * 2;
+			char *grown = realloc(samples, samples_capacity);
+			assert(grown);
+			samples = grown;
+		}
+		memcpy(samples + samples_len, body, body_len);
+		samples_len += body_len;
+		sample_sizes[sample_count++] = body_len;
+		free(body);
+	}
+	sqlite3_finalize(samples_stmt);
+
+	if (sample_count < SIP_MESSAGE_DICT_TRAINING_SAMPLES) {
+		free(dict);
+		free(samples);
+		free(sample_sizes);
+		return;
+	}
+
+	size_t dict_len = ZDICT_trainFromBuffer(dict, SIP_MESSAGE_DICT_CAPACITY,
+						samples, sample_sizes,
+						sample_count);
+	if (ZDICT_isError(dict_len)) {
+		if (config->debug_mode || config->verbose_mode) {
+			fprintf(stderr,
+				"Not enough variety to train a SIP message dictionary yet: %s\n",
+				ZDICT_getErrorName(dict_len));
+		}
+	} else {
+		sqlite3_stmt *insert_dict_stmt = 0;
+		if (sqlite3_prepare_v2(db, INSERT_SIP_MESSAGE_DICT, -1,
+				       &insert_dict_stmt, NULL) == SQLITE_OK) {
+			sqlite3_bind_blob(insert_dict_stmt, 1, dict,
+					  (int)dict_len, SQLITE_STATIC);
+			if (sqlite3_step(insert_dict_stmt) != SQLITE_DONE) {
+				fprintf(stderr,
+					"Failed to store SIP message dictionary: %s\n",
+					sqlite3_errmsg(db));
+			} else {
+				dict_cache_refresh(db,
+						   sqlite3_last_insert_rowid(db));
+				if (config->debug_mode ||
+				    config->verbose_mode) {
+					fprintf(stderr,
+						"Trained a %zu byte SIP message dictionary from %u samples\n",
+						dict_len, sample_count);
+				}
+			}
+		}
+		sqlite3_finalize(insert_dict_stmt);
+	}
+
+	free(dict);
+	free(samples);
+	free(sample_sizes);
+}
+#endif
+
+void sip_message_store_train_dict(sqlite3 *db, sentrypeer_config const *config)
+{
+#if HAVE_ZSTD != 0
+	train_dict(db, config);
+#else
+	(void)db;
+	(void)config;
+#endif
+}
+
+int sip_message_store_create_schema(sqlite3 *db)
+{
+	if (sqlite3_exec(db, CREATE_SIP_MESSAGES_TABLE, NULL, NULL, NULL) !=
+	    SQLITE_OK) {
+		fprintf(stderr, "Failed to create sip_messages table\n");
+		return EXIT_FAILURE;
+	}
+
+	if (sqlite3_exec(db, CREATE_SIP_MESSAGES_HASH_INDEX, NULL, NULL,
+			 NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to create sip_messages_hash_index\n");
+		return EXIT_FAILURE;
+	}
+
+	if (sqlite3_exec(db, CREATE_SIP_MESSAGE_DICTS_TABLE, NULL, NULL,
+			 NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to create sip_message_dicts table\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+char *sip_message_store_get(sqlite3 *db, sqlite3_int64 sip_message_id)
+{
+	sqlite3_stmt *get_sip_message_stmt = 0;
+	if (sqlite3_prepare_v2(db, GET_SIP_MESSAGE, -1, &get_sip_message_stmt,
+			       NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare statement: %s\n",
+			sqlite3_errmsg(db));
+		return 0;
+	}
+	sqlite3_bind_int64(get_sip_message_stmt, 1, sip_message_id);
+
+	if (sqlite3_step(get_sip_message_stmt) != SQLITE_ROW) {
+		sqlite3_finalize(get_sip_message_stmt);
+		return 0;
+	}
+
+	size_t length = (size_t)sqlite3_column_int64(get_sip_message_stmt, 0);
+	int encoding = sqlite3_column_int(get_sip_message_stmt, 1);
+	const void *body = sqlite3_column_blob(get_sip_message_stmt, 3);
+	size_t body_len = (size_t)sqlite3_column_bytes(get_sip_message_stmt, 3);
+
+	char *sip_message = malloc(length + 1);
+	assert(sip_message);
+	sip_message[length] = '\0';
+
+	int status = EXIT_FAILURE;
+	if (encoding == SIP_MESSAGE_ENCODING_PLAIN) {
+		if (body_len == length) {
+			memcpy(sip_message, body, length);
+			status = EXIT_SUCCESS;
+		}
+	}
+#if HAVE_ZSTD != 0
+	else if (encoding == SIP_MESSAGE_ENCODING_ZSTD) {
+		size_t decoded = ZSTD_decompressDCtx(dctx_get(), sip_message,
+						     length, body, body_len);
+		if (!ZSTD_isError(decoded) && decoded == length) {
+			status = EXIT_SUCCESS;
+		}
+	} else if (encoding == SIP_MESSAGE_ENCODING_ZSTD_DICT) {
+		dict_cache_entry *dict = dict_acquire(
+			db, sqlite3_column_int64(get_sip_message_stmt, 2));
+		if (dict != 0) {
+			size_t decoded = ZSTD_decompress_usingDDict(
+				dctx_get(), sip_message, length, body,
+				body_len, dict->ddict);
+			if (!ZSTD_isError(decoded) && decoded == length) {
+				status = EXIT_SUCCESS;
+			}
+			dict_release(dict);
+		}
+	}
+#endif
+	sqlite3_finalize(get_sip_message_stmt);
+
+	if (status != EXIT_SUCCESS) {
+		fprintf(stderr,
+			"Failed to decode sip_message_id %lld with encoding %d\n",
+			(long long)sip_message_id, encoding);
+		free(sip_message);
+		return 0;
+	}
+
+	return sip_message;
+}
+
+int sip_message_store_put(sqlite3 *db, const char *sip_message,
+			  sqlite3_int64 *sip_message_id,
+			  sentrypeer_config const *config)
+{
+	assert(sip_message);
+	// The original bytes are what's stored and matched, so they can be
+	// read back exactly as they came in
+	size_t length = strlen(sip_message);
+	// SQLite INTEGER is signed, so store the hash bits as-is
+	sqlite3_int64 hash = (sqlite3_int64)util_hash64(sip_message, length);
+
+	sqlite3_stmt *find_stmt = 0;
+	if (sqlite3_prepare_v2(db, GET_SIP_MESSAGES_BY_HASH, -1, &find_stmt,
+			       NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare statement: %s\n",
+			sqlite3_errmsg(db));
+		return EXIT_FAILURE;
+	}
+	sqlite3_bind_int64(find_stmt, 1, hash);
+	sqlite3_bind_int64(find_stmt, 2, (sqlite3_int64)length);
+
+	// Same hash and length is almost certainly the same body, but check
+	while (sqlite3_step(find_stmt) == SQLITE_ROW) {
+		sqlite3_int64 candidate_id = sqlite3_column_int64(find_stmt, 0);
+		char *candidate = sip_message_store_get(db, candidate_id);
+		bool same = candidate != 0 &&
+			    memcmp(candidate, sip_message, length) == 0;
+		free(candidate);
+
+		if (same) {
+			sqlite3_finalize(find_stmt);
+			*sip_message_id = candidate_id;
+			if (config->debug_mode || config->verbose_mode) {
+				fprintf(stderr,
+					"Reusing stored sip_message_id %lld\n",
+					(long long)candidate_id);
+			}
+			return EXIT_SUCCESS;
+		}
+	}
+	sqlite3_finalize(find_stmt);
+
+	int encoding = SIP_MESSAGE_ENCODING_PLAIN;
+	sqlite3_int64 dict_id = 0;
+	const void *body = sip_message;
+	size_t body_len = length;
+
+#if HAVE_ZSTD != 0
+	size_t bound = ZSTD_compressBound(length);
+	void *compressed = malloc(bound);
+	assert(compressed);
+	size_t compressed_len = 0;
+
+	dict_id = dict_latest_id(db);
+	dict_cache_entry *dict = dict_id > 0 ? dict_acquire(db, dict_id) : 0;
+	if (dict != 0) {
+		compressed_len = ZSTD_compress_usingCDict(cctx_get(),
+							  compressed, bound,
+							  sip_message, length,
+							  dict->cdict);
+		dict_release(dict);
+		encoding = SIP_MESSAGE_ENCODING_ZSTD_DICT;
+	} else {
+		dict_id = 0;
+		compressed_len = ZSTD_compressCCtx(cctx_get(), compressed,
+						   bound, sip_message, length,
+						   SIP_MESSAGE_ZSTD_LEVEL);
+		encoding = SIP_MESSAGE_ENCODING_ZSTD;
+	}
+
+	if (ZSTD_isError(compressed_len) || compressed_len >= length) {
+		// Not worth it, keep it plain
+		encoding = SIP_MESSAGE_ENCODING_PLAIN;
+		dict_id = 0;
+	} else {
+		body = compressed;
+		body_len = compressed_len;
+	}
+#endif
+
+	sqlite3_stmt *insert_stmt = 0;
+	int status = EXIT_FAILURE;
+	if (sqlite3_prepare_v2(db, INSERT_SIP_MESSAGE, -1, &insert_stmt,
+			       NULL) != SQLITE_OK) {
+		fprintf(stderr, "Failed to prepare statement: %s\n",
+			sqlite3_errmsg(db));
+	} else {
+		sqlite3_bind_int64(insert_stmt, 1, hash);
+		sqlite3_bind_int64(insert_stmt, 2, (sqlite3_int64)length);
+		sqlite3_bind_int(insert_stmt, 3, encoding);
+		if (dict_id > 0) {
+			sqlite3_bind_int64(insert_stmt, 4, dict_id);
+		} else {
+			sqlite3_bind_null(insert_stmt, 4);
+		}
+		sqlite3_bind_blob(insert_stmt, 5, body, (int)body_len,
+				  SQLITE_STATIC);
+
+		if (sqlite3_step(insert_stmt) != SQLITE_DONE) {
+			fprintf(stderr, "Error inserting sip_message: %s\n",
+				sqlite3_errmsg(db));
+		} else {
+			*sip_message_id = sqlite3_last_insert_rowid(db);
+			status = EXIT_SUCCESS;
+		}
+	}
+	sqlite3_finalize(insert_stmt);
+
+#if HAVE_ZSTD != 0
+	free(compressed);
+#endif
+
+	if (status == EXIT_SUCCESS &&
+	    (config->debug_mode || config->verbose_mode)) {
+		fprintf(stderr,
+			"Stored sip_message_id %lld (%zu bytes as %zu, encoding %d)\n",
+			(long long)*sip_message_id, length, body_len, encoding);
+	}
+
+	return status;
+}
@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#ifndef SENTRYPEER_SIP_MESSAGE_STORE_H
+#define SENTRYPEER_SIP_MESSAGE_STORE_H 1
+
+#include <sqlite3.h>
+#include <stddef.h>
+
+#include "conf.h"
+
+// How a body is stored in the sip_messages table
+#define SIP_MESSAGE_ENCODING_PLAIN 0
+#define SIP_MESSAGE_ENCODING_ZSTD 1
+#define SIP_MESSAGE_ENCODING_ZSTD_DICT 2
+
+#define SIP_MESSAGE_ZSTD_LEVEL 3
+// Train a dictionary once we have this many distinct bodies
+#define SIP_MESSAGE_DICT_TRAINING_SAMPLES 512
+#define SIP_MESSAGE_DICT_CAPACITY (16 * 1024)
+// Dictionaries kept ready to use, e.g. for today's partition and the
+// ones being read back
+#define SIP_MESSAGE_DICT_CACHE_SIZE 4
+
+// Each distinct SIP message body is stored once, as received, and
+// referenced from honey.sip_message_id. hash is util_hash64() of the
+// body and length is its length, as received.
+#define CREATE_SIP_MESSAGES_TABLE                                              \
+	"CREATE TABLE IF NOT EXISTS sip_messages "                             \
+	"("                                                                    \
+	"   sip_message_id INTEGER PRIMARY KEY,"                               \
+	"   hash INTEGER NOT NULL,"                                            \
+	"   length INTEGER NOT NULL,"                                          \
+	"   encoding INTEGER NOT NULL DEFAULT 0,"                              \
+	"   dict_id INTEGER,"                                                  \
+	"   body BLOB NOT NULL,"                                               \
+	"   created_at DATETIME DEFAULT(STRFTIME('%Y-%m-%d %H:%M:%f', 'NOW'))" \
+	");"
+#define CREATE_SIP_MESSAGES_HASH_INDEX                                         \
+	"CREATE INDEX IF NOT EXISTS sip_messages_hash_index ON sip_messages (hash);"
+#define CREATE_SIP_MESSAGE_DICTS_TABLE                                         \
+	"CREATE TABLE IF NOT EXISTS sip_message_dicts "                        \
+	"("                                                                    \
+	"   dict_id INTEGER PRIMARY KEY,"                                      \
+	"   dict BLOB NOT NULL,"                                               \
+	"   created_at DATETIME DEFAULT(STRFTIME('%Y-%m-%d %H:%M:%f', 'NOW'))" \
+	");"
+
+#define GET_SIP_MESSAGES_BY_HASH                                               \
+	"SELECT sip_message_id FROM sip_messages WHERE hash = ? AND length = ?;"
+#define GET_SIP_MESSAGE                                                        \
+	"SELECT length, encoding, dict_id, body FROM sip_messages WHERE sip_message_id = ?;"
+#define INSERT_SIP_MESSAGE                                                     \
+	"INSERT INTO sip_messages (hash, length, encoding, dict_id, body) VALUES (?, ?, ?, ?, ?);"
+#define GET_SIP_MESSAGE_DICT_SAMPLES                                           \
+	"SELECT sip_message_id FROM sip_messages ORDER BY sip_message_id DESC LIMIT ?;"
+#define GET_LATEST_SIP_MESSAGE_DICT_ID                                         \
+	"SELECT MAX(dict_id) FROM sip_message_dicts;"
+#define GET_SIP_MESSAGE_DICT                                                   \
+	"SELECT dict FROM sip_message_dicts WHERE dict_id = ?;"
+#define INSERT_SIP_MESSAGE_DICT "INSERT INTO sip_message_dicts (dict) VALUES (?);"
+
+/**
+ * Create the sip_messages and sip_message_dicts tables if needed.
+ *
+ * @param db An open database handle.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int sip_message_store_create_schema(sqlite3 *db);
+
+/**
+ * Store a SIP message body once, returning the id of an existing identical
+ * body if there is one. Call inside the caller's transaction.
+ *
+ * @param db An open database handle.
+ * @param sip_message The raw SIP message.
+ * @param sip_message_id Set to the id of the stored body.
+ * @param config Our config, for debug/verbose output.
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int sip_message_store_put(sqlite3 *db, const char *sip_message,
+			  sqlite3_int64 *sip_message_id,
+			  sentrypeer_config const *config);
+
+/**
+ * Train a zstd dictionary from the newest SIP_MESSAGE_DICT_TRAINING_SAMPLES
+ * bodies, if there isn't one yet and there are that many. Slow, so called
+ * from DB maintenance rather than when logging. Does nothing without zstd.
+ *
+ * @param db An open database handle.
+ * @param config Our config, for debug/verbose output.
+ */
+void sip_message_store_train_dict(sqlite3 *db, sentrypeer_config const *config);
+
+/**
+ * Fetch and decode a stored SIP message body (must be freed by caller).
+ *
+ * @param db An open database handle.
+ * @param sip_message_id The id from honey.sip_message_id.
+ * @return The SIP message as a NUL terminated string or NULL on failure.
+ */
+char *sip_message_store_get(sqlite3 *db, sqlite3_int64 sip_message_id);
+
+#endif //SENTRYPEER_SIP_MESSAGE_STORE_H
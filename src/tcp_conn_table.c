@@ -0,0 +1,364 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "tcp_conn_table.h"
+#include "utils.h"
+
+#define TCP_CONN_KEY_LEN 16 // IPv4 is mapped into IPv6
+#define TCP_CONN_WHEEL_MASK (TCP_CONN_WHEEL_SLOTS - 1)
+#define TCP_CONN_WHEEL_RANGE (TCP_CONN_WHEEL_SLOTS * TCP_CONN_WHEEL_SLOTS)
+
+// Something to link into more than one list
+typedef struct tcp_conn_link tcp_conn_link;
+struct tcp_conn_link {
+	tcp_conn *prev;
+	tcp_conn *next;
+};
+
+typedef struct tcp_conn_list tcp_conn_list;
+struct tcp_conn_list {
+	tcp_conn *head; // Least recently used, or next due
+	tcp_conn *tail;
+};
+
+// Everything from one source IP address
+typedef struct tcp_conn_ip tcp_conn_ip;
+struct tcp_conn_ip {
+	uint8_t key[TCP_CONN_KEY_LEN];
+	size_t count;
+	tcp_conn_list conns;
+	tcp_conn_ip *next; // Hash chain
+};
+
+struct tcp_conn {
+	SOCKET socket;
+	void *data;
+	uint64_t accepted;
+	uint64_t last_read;
+	tcp_conn_ip *ip;
+	tcp_conn_link lru;
+	tcp_conn_link ip_lru;
+	tcp_conn_link timer;
+	tcp_conn_list *timer_slot;
+};
+
+struct tcp_conn_table {
+	size_t max_connections;
+	size_t max_per_ip;
+	uint64_t idle_timeout;
+	uint64_t max_lifetime;
+	tcp_conn_close_fn close_fn;
+	void *arg;
+
+	size_t count;
+	tcp_conn_list lru;
+	tcp_conn_ip **ips;
+	size_t ips_mask;
+
+	uint64_t wheel_time; // Every slot up to this has been run
+	tcp_conn_list wheel[2][TCP_CONN_WHEEL_SLOTS];
+};
+
+// Each list has its own link in tcp_conn, picked by offset
+#define LINK(conn, offset) ((tcp_conn_link *)((char *)(conn) + (offset)))
+
+static void list_append(tcp_conn_list *list, tcp_conn *conn, size_t offset)
+{
+	tcp_conn_link *link = LINK(conn, offset);
+	link->prev = list->tail;
+	link->next = 0;
+	if (list->tail) {
+		LINK(list->tail, offset)->next = conn;
+	} else {
+		list->head = conn;
+	}
+	list->tail = conn;
+}
+
+static void list_unlink(tcp_conn_list *list, tcp_conn *conn, size_t offset)
+{
+	tcp_conn_link *link = LINK(conn, offset);
+	if (link->prev) {
+		LINK(link->prev, offset)->next = link->next;
+	} else {
+		list->head = link->next;
+	}
+	if (link->next) {
+		LINK(link->next, offset)->prev = link->prev;
+	} else {
+		list->tail = link->prev;
+	}
+	link->prev = 0;
+	link->next = 0;
+}
+
+static void address_key(const struct sockaddr *address,
+			uint8_t key[TCP_CONN_KEY_LEN])
+{
+	memset(key, 0, TCP_CONN_KEY_LEN);
+	if (address->sa_family == AF_INET6) {
+		memcpy(key,
+		       &((const struct sockaddr_in6 *)address)->sin6_addr,
+		       TCP_CONN_KEY_LEN);
+	} else if (address->sa_family == AF_INET) {
+		key[10] = 0xff;
+		key[11] = 0xff;
+		memcpy(key + 12,
+		       &((const struct sockaddr_in *)address)->sin_addr, 4);
+	}
+}
+
+static tcp_conn_ip **ip_find(const tcp_conn_table *self,
+			     const uint8_t key[TCP_CONN_KEY_LEN])
+{
+	tcp_conn_ip **ip =
+		&self->ips[util_hash64(key, TCP_CONN_KEY_LEN) & self->ips_mask];
+	while (*ip && memcmp((*ip)->key, key, TCP_CONN_KEY_LEN) != 0) {
+		ip = &(*ip)->next;
+	}
+
+	return ip;
+}
+
+static uint64_t due(const tcp_conn_table *self, const tcp_conn *conn,
+		    int *reason)
+{
+	uint64_t idle = conn->last_read + self->idle_timeout;
+	uint64_t lifetime = conn->accepted + self->max_lifetime;
+	if (lifetime <= idle) {
+		*reason = TCP_CONN_LIFETIME;
+		return lifetime;
+	}
+	*reason = TCP_CONN_IDLE;
+	return idle;
+}
+
+// Level 0 has a slot per second for the next 64, level 1 a slot per 64
+// seconds after that. Level 1 slots are moved down as their turn comes.
+static void schedule(tcp_conn_table *self, tcp_conn *conn)
+{
+	int reason = 0;
+	uint64_t at = due(self, conn, &reason);
+	// The slot for wheel_time has already been run
+	if (at <= self->wheel_time) {
+		at = self->wheel_time + 1;
+	}
+	if (at - self->wheel_time >= TCP_CONN_WHEEL_RANGE) {
+		at = self->wheel_time + TCP_CONN_WHEEL_RANGE - 1;
+	}
+
+	if (at - self->wheel_time < TCP_CONN_WHEEL_SLOTS) {
+		conn->timer_slot = &self->wheel[0][at & TCP_CONN_WHEEL_MASK];
+	} else {
+		conn->timer_slot =
+			&self->wheel[1][(at >> TCP_CONN_WHEEL_BITS) &
+					TCP_CONN_WHEEL_MASK];
+	}
+	list_append(conn->timer_slot, conn, offsetof(tcp_conn, timer));
+}
+
+// Take conn out of everything and free it, leaving the socket alone
+static void conn_free(tcp_conn_table *self, tcp_conn *conn)
+{
+	list_unlink(&self->lru, conn, offsetof(tcp_conn, lru));
+	list_unlink(&conn->ip->conns, conn, offsetof(tcp_conn, ip_lru));
+	if (conn->timer_slot) {
+		list_unlink(conn->timer_slot, conn, offsetof(tcp_conn, timer));
+	}
+
+	conn->ip->count--;
+	if (conn->ip->count == 0) {
+		tcp_conn_ip **ip = ip_find(self, conn->ip->key);
+		*ip = conn->ip->next;
+		free(conn->ip);
+	}
+	self->count--;
+	free(conn);
+}
+
+static void conn_close(tcp_conn_table *self, tcp_conn *conn, int reason)
+{
+	SOCKET socket = conn->socket;
+	void *data = conn->data;
+	conn_free(self, conn);
+	self->close_fn(socket, reason, data, self->arg);
+}
+
+tcp_conn_table *tcp_conn_table_new(size_t max_connections, size_t max_per_ip,
+				   int idle_timeout, int max_lifetime,
+				   uint64_t now, tcp_conn_close_fn close_fn,
+				   void *arg)
+{
+	assert(max_connections > 0 && max_per_ip > 0);
+	assert(idle_timeout > 0 && max_lifetime > 0);
+
+	tcp_conn_table *self = calloc(1, sizeof(tcp_conn_table));
+	assert(self);
+
+	self->max_connections = max_connections;
+	self->max_per_ip = max_per_ip;
+	self->idle_timeout = (uint64_t)idle_timeout;
+	self->max_lifetime = (uint64_t)max_lifetime;
+	self->close_fn = close_fn;
+	self->arg = arg;
+	self->wheel_time = now;
+
+	size_t buckets = 16;
+	while (buckets < max_connections) {
+		buckets <<= 1;
+	}
+	self->ips = calloc(buckets, sizeof(tcp_conn_ip *));
+	assert(self->ips);
+	self->ips_mask = buckets - 1;
+
+	return self;
+}
+
+void tcp_conn_table_destroy(tcp_conn_table **self_ptr)
+{
+	assert(self_ptr);
+	if (*self_ptr) {
+		tcp_conn_table *self = *self_ptr;
+
+		while (self->lru.head) {
+			conn_close(self, self->lru.head, TCP_CONN_SHUTDOWN);
+		}
+		free(self->ips);
+		free(self);
+		*self_ptr = 0;
+	}
+}
+
+uint64_t tcp_conn_table_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec;
+}
+
+tcp_conn *tcp_conn_table_add(tcp_conn_table *self, SOCKET socket,
+			     const struct sockaddr *address, void *data,
+			     uint64_t now)
+{
+	uint8_t key[TCP_CONN_KEY_LEN];
+	address_key(address, key);
+
+	tcp_conn_ip **found = ip_find(self, key);
+	if (*found && (*found)->count >= self->max_per_ip) {
+		// If it was the only one, found now points at whatever
+		// replaced it in the chain
+		conn_close(self, (*found)->conns.head, TCP_CONN_EVICTED);
+		found = ip_find(self, key);
+	}
+	if (self->count >= self->max_connections) {
+		conn_close(self, self->lru.head, TCP_CONN_EVICTED);
+		found = ip_find(self, key);
+	}
+
+	tcp_conn_ip *ip = *found;
+	if (ip == 0) {
+		ip = calloc(1, sizeof(tcp_conn_ip));
+		assert(ip);
+		memcpy(ip->key, key, TCP_CONN_KEY_LEN);
+		*found = ip;
+	}
+
+	tcp_conn *conn = calloc(1, sizeof(tcp_conn));
+	assert(conn);
+	conn->socket = socket;
+	conn->data = data;
+	conn->accepted = now;
+	conn->last_read = now;
+	conn->ip = ip;
+	ip->count++;
+	self->count++;
+
+	list_append(&self->lru, conn, offsetof(tcp_conn, lru));
+	list_append(&ip->conns, conn, offsetof(tcp_conn, ip_lru));
+	schedule(self, conn);
+
+	return conn;
+}
+
+void tcp_conn_table_touch(tcp_conn_table *self, tcp_conn *conn, uint64_t now)
+{
+	conn->last_read = now;
+	list_unlink(&self->lru, conn, offsetof(tcp_conn, lru));
+	list_append(&self->lru, conn, offsetof(tcp_conn, lru));
+	list_unlink(&conn->ip->conns, conn, offsetof(tcp_conn, ip_lru));
+	list_append(&conn->ip->conns, conn, offsetof(tcp_conn, ip_lru));
+}
+
+void tcp_conn_table_remove(tcp_conn_table *self, tcp_conn *conn)
+{
+	conn_free(self, conn);
+}
+
+// Anything in slot is either due or was read from since it was scheduled
+static void run_slot(tcp_conn_table *self, tcp_conn_list *slot)
+{
+	tcp_conn_list pending = *slot;
+	slot->head = 0;
+	slot->tail = 0;
+
+	while (pending.head) {
+		tcp_conn *conn = pending.head;
+		list_unlink(&pending, conn, offsetof(tcp_conn, timer));
+		conn->timer_slot = 0;
+
+		int reason = 0;
+		if (due(self, conn, &reason) <= self->wheel_time) {
+			conn_close(self, conn, reason);
+		} else {
+			schedule(self, conn);
+		}
+	}
+}
+
+void tcp_conn_table_expire(tcp_conn_table *self, uint64_t now)
+{
+	while (self->wheel_time < now) {
+		self->wheel_time++;
+		if ((self->wheel_time & TCP_CONN_WHEEL_MASK) == 0) {
+			run_slot(self,
+				 &self->wheel[1][(self->wheel_time >>
+						  TCP_CONN_WHEEL_BITS) &
+						 TCP_CONN_WHEEL_MASK]);
+		}
+		run_slot(self,
+			 &self->wheel[0][self->wheel_time & TCP_CONN_WHEEL_MASK]);
+	}
+}
+
+size_t tcp_conn_table_count(const tcp_conn_table *self)
+{
+	return self->count;
+}
+
+size_t tcp_conn_table_count_ip(const tcp_conn_table *self,
+			       const struct sockaddr *address)
+{
+	uint8_t key[TCP_CONN_KEY_LEN];
+	address_key(address, key);
+
+	tcp_conn_ip *const *ip = ip_find(self, key);
+	return *ip ? (*ip)->count : 0;
+}
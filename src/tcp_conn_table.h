@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#ifndef SENTRYPEER_TCP_CONN_TABLE_H
+#define SENTRYPEER_TCP_CONN_TABLE_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "sip_message_event.h"
+
+// Defaults for config->tcp_*, over all SIP workers
+#define TCP_CONN_MAX_CONNECTIONS 1024
+#define TCP_CONN_MAX_PER_IP 8
+#define TCP_CONN_IDLE_TIMEOUT 30 // Seconds without a read
+#define TCP_CONN_MAX_LIFETIME 300 // Seconds since accepted
+
+// Two levels of 64 one second slots, so timeouts up to 4096 seconds are
+// exact and anything longer is looked at again every 4096 seconds
+#define TCP_CONN_WHEEL_BITS 6
+#define TCP_CONN_WHEEL_SLOTS (1 << TCP_CONN_WHEEL_BITS)
+
+// Why a connection was closed for you
+#define TCP_CONN_IDLE 0
+#define TCP_CONN_LIFETIME 1
+#define TCP_CONN_EVICTED 2 // To make room for a new one
+#define TCP_CONN_SHUTDOWN 3 // Still open at tcp_conn_table_destroy()
+
+// Accepted TCP connections of one SIP worker. Each is on a global and a
+// per source IP address least recently used list, so the cap on either
+// can be kept by dropping whichever has been quiet longest, and on a
+// hierarchical timer wheel for idle and lifetime timeouts. Reads only
+// update a timestamp; a connection's timer is moved when it comes due
+// and turns out not to be.
+typedef struct tcp_conn_table tcp_conn_table;
+typedef struct tcp_conn tcp_conn;
+
+/**
+ * Called for each connection the table drops, which is no longer in the
+ * table by then. Close the socket, or arrange for it to be closed.
+ *
+ * @param socket The connection's socket.
+ * @param reason One of TCP_CONN_IDLE, _LIFETIME, _EVICTED or _SHUTDOWN.
+ * @param data What was given to tcp_conn_table_add().
+ * @param arg What was given to tcp_conn_table_new().
+ */
+typedef void (*tcp_conn_close_fn)(SOCKET socket, int reason, void *data,
+				  void *arg);
+
+/**
+ * @param max_connections Most open at once.
+ * @param max_per_ip Most open at once from one source IP address.
+ * @param idle_timeout Seconds a connection can go without a read.
+ * @param max_lifetime Seconds a connection can stay open.
+ * @param now Monotonic seconds, see tcp_conn_table_now().
+ * @param close_fn Called for each connection the table drops.
+ * @param arg Handed to close_fn.
+ */
+tcp_conn_table *tcp_conn_table_new(size_t max_connections, size_t max_per_ip,
+				   int idle_timeout, int max_lifetime,
+				   uint64_t now, tcp_conn_close_fn close_fn,
+				   void *arg);
+
+//  Destructor, connections still open are handed to close_fn
+void tcp_conn_table_destroy(tcp_conn_table **self_ptr);
+
+// Monotonic seconds
+uint64_t tcp_conn_table_now(void);
+
+/**
+ * Add a newly accepted connection, first dropping the least recently used
+ * one from the same IP address, or from anywhere, if that's needed to stay
+ * under the caps.
+ *
+ * @param self The table.
+ * @param socket The accepted socket.
+ * @param address Where it's from.
+ * @param data Anything, handed back to close_fn.
+ * @param now Monotonic seconds.
+ * @return The connection, for tcp_conn_table_touch() and
+ *         tcp_conn_table_remove().
+ */
+tcp_conn *tcp_conn_table_add(tcp_conn_table *self, SOCKET socket,
+			     const struct sockaddr *address, void *data,
+			     uint64_t now);
+
+// Record a read, which puts off its idle timeout and eviction
+void tcp_conn_table_touch(tcp_conn_table *self, tcp_conn *conn, uint64_t now);
+
+// The peer closed it, or you did. close_fn isn't called.
+void tcp_conn_table_remove(tcp_conn_table *self, tcp_conn *conn);
+
+// Drop every connection that has timed out by now
+void tcp_conn_table_expire(tcp_conn_table *self, uint64_t now);
+
+// Open connections, in all or from the IP address of address
+size_t tcp_conn_table_count(const tcp_conn_table *self);
+size_t tcp_conn_table_count_ip(const tcp_conn_table *self,
+			       const struct sockaddr *address);
+
+#endif //SENTRYPEER_TCP_CONN_TABLE_H
@@ -23,26 +23,61 @@
 #include <stdlib.h>
 #include <jansson.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+// Every event in the same second shares the same date and time, so each
+// thread only formats it once a second and just writes the nanoseconds
+// after it the rest of the time
+typedef struct timestamp_cache timestamp_cache;
+struct timestamp_cache {
+	time_t second;
+	bool valid;
+	char prefix[TIMESTAMP_LEN];
+	size_t prefix_len;
+};
+
+static _Thread_local timestamp_cache thread_timestamp_cache;
 
 char *event_timestamp(char *event_timestamp)
 {
+	assert(event_timestamp);
+
 	struct timespec timestamp_ts;
-	char timestamp_buf[TIMESTAMP_LEN];
 	if (clock_gettime(CLOCK_REALTIME, &timestamp_ts) == -1) {
 		perror("clock_gettime() failed.");
 	}
 
-	assert(timestamp_ts.tv_nsec < 1000000000);
+	return event_timestamp_at(&timestamp_ts, event_timestamp);
+}
+
+char *event_timestamp_at(const struct timespec *seen, char *event_timestamp)
+{
+	assert(seen);
+	assert(event_timestamp);
+	assert(seen->tv_nsec >= 0 && seen->tv_nsec < 1000000000);
 
-	struct tm time_info;
-	localtime_r(&timestamp_ts.tv_sec, &time_info);
-	strftime(timestamp_buf, TIMESTAMP_LEN, "%Y-%m-%d %H:%M:%S", &time_info);
+	timestamp_cache *cache = &thread_timestamp_cache;
+	if (!cache->valid || cache->second != seen->tv_sec) {
+		struct tm time_info;
+		localtime_r(&seen->tv_sec, &time_info);
+		cache->prefix_len = strftime(cache->prefix,
+					     sizeof(cache->prefix),
+					     "%Y-%m-%d %H:%M:%S.", &time_info);
+		cache->second = seen->tv_sec;
+		cache->valid = true;
+	}
 
-	if (snprintf(event_timestamp, TIMESTAMP_LEN, "%s.%06ld", timestamp_buf,
-		     timestamp_ts.tv_nsec) < 0) {
-		perror("snprintf() failed.");
+	memcpy(event_timestamp, cache->prefix, cache->prefix_len);
+	char *digits = event_timestamp + cache->prefix_len;
+	long nsec = seen->tv_nsec;
+	for (int i = 8; i >= 0; i--) {
+		digits[i] = (char)('0' + nsec % 10);
+		nsec /= 10;
 	}
-	assert(event_timestamp);
+	digits[9] = '\0';
 
 	return event_timestamp;
 }
@@ -76,18 +111,108 @@ char *util_copy_string(char *dest, const char *src, size_t dest_len)
 	return dest;
 }
 
+// Random bytes for uuids, fetched from the kernel a batch at a time
+// rather than once per uuid. The generation moves on in a child after a
+// fork(), so it never hands out the same bytes as its parent.
+#define UUID_RANDOM_BATCH 256
+
+typedef struct uuid_random uuid_random;
+struct uuid_random {
+	unsigned char bytes[UUID_RANDOM_BATCH];
+	size_t used;
+	unsigned int generation;
+};
+
+static _Thread_local uuid_random thread_uuid_random = { .used =
+								UUID_RANDOM_BATCH };
+static atomic_uint uuid_random_generation;
+static pthread_once_t uuid_random_once = PTHREAD_ONCE_INIT;
+
+static void uuid_random_forked(void)
+{
+	atomic_fetch_add(&uuid_random_generation, 1);
+}
+
+static void uuid_random_init(void)
+{
+	pthread_atfork(NULL, NULL, uuid_random_forked);
+}
+
+static void uuid_random_bytes(unsigned char *bytes, size_t len)
+{
+	pthread_once(&uuid_random_once, uuid_random_init);
+
+	uuid_random *batch = &thread_uuid_random;
+	unsigned int generation = atomic_load(&uuid_random_generation);
+	if (batch->generation != generation) {
+		batch->generation = generation;
+		batch->used = UUID_RANDOM_BATCH;
+	}
+
+	if (batch->used + len > UUID_RANDOM_BATCH) {
+		// getentropy() gives at most 256 bytes a call
+		if (getentropy(batch->bytes, UUID_RANDOM_BATCH) != 0) {
+			perror("getentropy() failed.");
+			abort();
+		}
+		batch->used = 0;
+	}
+	memcpy(bytes, batch->bytes + batch->used, len);
+	// Nothing handed out is kept about
+	memset(batch->bytes + batch->used, 0, len);
+	batch->used += len;
+}
+
+static char *uuid_to_string(const unsigned char *uuid, char *uuid_string)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	char *out = uuid_string;
+	for (int i = 0; i < 16; i++) {
+		if (i == 4 || i == 6 || i == 8 || i == 10) {
+			*out++ = '-';
+		}
+		*out++ = hex[uuid[i] >> 4];
+		*out++ = hex[uuid[i] & 0x0F];
+	}
+	*out = '\0';
+
+	return uuid_string;
+}
+
 char *util_uuid_generate_string(char *uuid_string)
 {
 	assert(uuid_string);
 
-	uuid_t binary_uuid;
-	uuid_generate(binary_uuid);
-	assert(binary_uuid != NULL);
+	unsigned char uuid[16];
+	uuid_random_bytes(uuid, sizeof(uuid));
+	uuid[6] = (uuid[6] & 0x0F) | 0x40; // Version 4
+	uuid[8] = (uuid[8] & 0x3F) | 0x80; // RFC 9562 variant
 
-	uuid_unparse_lower(binary_uuid, uuid_string);
+	return uuid_to_string(uuid, uuid_string);
+}
 
+char *util_uuid7_generate_string(char *uuid_string)
+{
 	assert(uuid_string);
-	return uuid_string;
+
+	struct timespec now;
+	if (clock_gettime(CLOCK_REALTIME, &now) == -1) {
+		perror("clock_gettime() failed.");
+	}
+	uint64_t unix_ms =
+		(uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+
+	// 48 bits of milliseconds, big endian, then random bits
+	unsigned char uuid[16];
+	for (int i = 0; i < 6; i++) {
+		uuid[i] = (unsigned char)(unix_ms >> (40 - 8 * i));
+	}
+	uuid_random_bytes(uuid + 6, sizeof(uuid) - 6);
+	uuid[6] = (uuid[6] & 0x0F) | 0x70; // Version 7
+	uuid[8] = (uuid[8] & 0x3F) | 0x80; // RFC 9562 variant
+
+	return uuid_to_string(uuid, uuid_string);
 }
 
 int valid_ip_address_format(const char *ip_address_to_check)
@@ -159,3 +284,137 @@ int max_int(const int x, const int y)
 		return y;
 	}
 }
+
+// http://www.isthe.com/chongo/tech/comp/fnv/index.html#FNV-1a
+uint64_t util_hash64(const void *data, size_t len)
+{
+	const unsigned char *bytes = data;
+	uint64_t hash = 0xcbf29ce484222325ULL; // FNV offset basis
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL; // FNV prime
+	}
+
+	return hash;
+}
+
+// strptime() and mktime() take glibc's timezone lock on every call, which
+// every thread logging an event would queue on. Timestamps are parsed by
+// hand instead, and each thread keeps the local hour it last converted, so
+// mktime() is only called again when the hour changes.
+typedef struct local_hour_cache local_hour_cache;
+struct local_hour_cache {
+	int64_t local_hour; // Seconds since 1970 on the local clock
+	time_t start;
+	bool linear; // No clock change part way through, e.g. Lord Howe's
+	bool valid;
+};
+
+static _Thread_local local_hour_cache thread_local_hour;
+
+// count digits at text, -1 if there aren't that many
+static int parse_digits(const char *text, int count)
+{
+	int value = 0;
+	for (int i = 0; i < count; i++) {
+		if (text[i] < '0' || text[i] > '9') {
+			return -1;
+		}
+		value = value * 10 + (text[i] - '0');
+	}
+
+	return value;
+}
+
+// Days since 1970-01-01 in the proleptic Gregorian calendar. See
+// https://howardhinnant.github.io/date_algorithms.html#days_from_civil
+static int64_t days_from_civil(int64_t year, int month, int day)
+{
+	year -= month <= 2;
+	int64_t era = (year >= 0 ? year : year - 399) / 400;
+	int64_t year_of_era = year - era * 400;
+	int64_t day_of_year =
+		(153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	int64_t day_of_era = year_of_era * 365 + year_of_era / 4 -
+			     year_of_era / 100 + day_of_year;
+
+	return era * 146097 + day_of_era - 719468;
+}
+
+time_t util_parse_event_timestamp(const char *event_timestamp)
+{
+	// YYYY-MM-DD HH:MM:SS, then anything, e.g. the nanoseconds
+	if (event_timestamp == 0 || strnlen(event_timestamp, 19) < 19 ||
+	    event_timestamp[4] != '-' || event_timestamp[7] != '-' ||
+	    event_timestamp[10] != ' ' || event_timestamp[13] != ':' ||
+	    event_timestamp[16] != ':') {
+		return 0;
+	}
+
+	int year = parse_digits(event_timestamp, 4);
+	int month = parse_digits(event_timestamp + 5, 2);
+	int day = parse_digits(event_timestamp + 8, 2);
+	int hour = parse_digits(event_timestamp + 11, 2);
+	int minute = parse_digits(event_timestamp + 14, 2);
+	int second = parse_digits(event_timestamp + 17, 2);
+	if (year < 0 || month < 1 || month > 12 || day < 1 || day > 31 ||
+	    hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 ||
+	    second > 60) {
+		return 0;
+	}
+
+	int64_t local_hour = days_from_civil(year, month, day) * 86400 +
+			     (int64_t)hour * 3600;
+	local_hour_cache *cache = &thread_local_hour;
+	if (!cache->valid || cache->local_hour != local_hour) {
+		struct tm hour_tm = { .tm_year = year - 1900,
+				      .tm_mon = month - 1,
+				      .tm_mday = day,
+				      .tm_hour = hour,
+				      .tm_isdst = -1 };
+		struct tm next_hour_tm = hour_tm;
+		next_hour_tm.tm_hour++;
+		time_t start = mktime(&hour_tm);
+		if (start == (time_t)-1) {
+			return 0;
+		}
+		cache->start = start;
+		cache->linear = mktime(&next_hour_tm) - start == 3600;
+		cache->local_hour = local_hour;
+		cache->valid = true;
+	}
+
+	if (!cache->linear) {
+		struct tm event_tm = { .tm_year = year - 1900,
+				       .tm_mon = month - 1,
+				       .tm_mday = day,
+				       .tm_hour = hour,
+				       .tm_min = minute,
+				       .tm_sec = second,
+				       .tm_isdst = -1 };
+		return mktime(&event_tm);
+	}
+
+	return cache->start + minute * 60 + second;
+}
+
+time_t util_event_time(const char *event_timestamp, time_t now)
+{
+	time_t when = util_parse_event_timestamp(event_timestamp);
+	if (when < now - UTIL_EVENT_TIME_PAST ||
+	    when > now + UTIL_EVENT_TIME_FUTURE) {
+		return now;
+	}
+
+	return when;
+}
+
+char *util_format_seen_time(time_t seen, char *buf, size_t buf_len)
+{
+	struct tm seen_tm;
+	localtime_r(&seen, &seen_tm);
+	strftime(buf, buf_len, "%Y-%m-%d %H:%M:%S", &seen_tm);
+
+	return buf;
+}
@@ -16,21 +16,37 @@
 
 #define TIMESTAMP_LEN 40
 #define UTILS_UUID_STRING_LEN 37
+// How far an event_timestamp can be from our clock and still be believed
+#define UTIL_EVENT_TIME_PAST (60 * 60) // A held up sink queue
+#define UTIL_EVENT_TIME_FUTURE (5 * 60) // Clock skew
 
 #include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <jansson.h>
 #include <stdbool.h>
 #include <uuid/uuid.h>
 
 /**
- * Get the current time suitable for event logging
+ * Get the current time suitable for event logging. Each thread only
+ * formats the date and time once a second.
  *
- * @param event_timestamp The timestamp to fill.
+ * @param event_timestamp The timestamp to fill, TIMESTAMP_LEN long.
  * @return The current time in format YYYY-MM-DD HH:MM:SS.XXXXXXXXX
  */
 char *event_timestamp(char *event_timestamp);
 
+/**
+ * The same as event_timestamp, for a time other than now, e.g. when a
+ * packet in a pcap file was captured.
+ *
+ * @param seen The time.
+ * @param event_timestamp The timestamp to fill, TIMESTAMP_LEN long.
+ * @return event_timestamp
+ */
+char *event_timestamp_at(const struct timespec *seen, char *event_timestamp);
+
 /**
  * Duplicate a string (must be freed by caller)
  *
@@ -50,13 +66,22 @@ char *util_duplicate_string(const char *string);
 char *util_copy_string(char *dest, const char *src, size_t dest_len);
 
 /**
- * Generate a uuid
+ * Generate a random (version 4) uuid
  *
- * @param uuid_string The string to fill.
+ * @param uuid_string The string to fill, UTILS_UUID_STRING_LEN long.
  * @return A uuid in string format.
  */
 char *util_uuid_generate_string(char *uuid_string);
 
+/**
+ * Generate a time ordered (version 7) uuid, so ones made one after the
+ * other sort, and index, next to each other
+ *
+ * @param uuid_string The string to fill, UTILS_UUID_STRING_LEN long.
+ * @return A uuid in string format.
+ */
+char *util_uuid7_generate_string(char *uuid_string);
+
 /**
  * Validate an IP address
  *
@@ -99,4 +124,45 @@ bool is_valid_uuid(const char *uuid_to_check);
  */
 int max_int(int x, int y);
 
+/**
+ * Hash a buffer with 64-bit FNV-1a. Not cryptographic, so callers that
+ * use it as a content address must compare the content on a match.
+ *
+ * @param data The bytes to hash.
+ * @param len The number of bytes to hash.
+ * @return The 64-bit hash of the buffer.
+ */
+uint64_t util_hash64(const void *data, size_t len);
+
+/**
+ * Parse an event_timestamp (or a seen_last from the database) back to the
+ * second.
+ *
+ * @param event_timestamp The timestamp in local time.
+ * @return The time, or 0 if it's NULL or doesn't parse.
+ */
+time_t util_parse_event_timestamp(const char *event_timestamp);
+
+/**
+ * When an event happened, going by its event_timestamp as long as that's
+ * within UTIL_EVENT_TIME_PAST before now or UTIL_EVENT_TIME_FUTURE after
+ * it. The timestamp can come from a peer or the DHT, so one further out,
+ * or that doesn't parse, is taken to be now.
+ *
+ * @param event_timestamp The timestamp in local time.
+ * @param now The current time.
+ * @return The event time.
+ */
+time_t util_event_time(const char *event_timestamp, time_t now);
+
+/**
+ * Format a time the same way as event_timestamp, without the fraction.
+ *
+ * @param seen The time.
+ * @param buf The buffer to fill.
+ * @param buf_len Size of buf, TIMESTAMP_LEN is plenty.
+ * @return buf
+ */
+char *util_format_seen_time(time_t seen, char *buf, size_t buf_len);
+
 #endif //SENTRYPEER_UTILS_H
@@ -0,0 +1,348 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/* 
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+// Microbenchmarks of the capture hot path, one function at a time, see
+// bench_cases.c for what's timed. Each case is calibrated until a sample
+// takes long enough to time, warmed up, then sampled a number of times.
+// Results can be saved as json and compared against next time with -b to
+// show whether a change made things faster, slower or made no difference
+// beyond the noise.
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <jansson.h>
+
+#include "bench.h"
+
+volatile uintptr_t bench_sink;
+
+// Two sided 97.5% points of Student's t for 1 to 30 degrees of freedom
+static const double t_975[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447,
+				2.365,	2.306, 2.262, 2.228, 2.201, 2.179,
+				2.160,	2.145, 2.131, 2.120, 2.110, 2.101,
+				2.093,	2.086, 2.080, 2.074, 2.069, 2.064,
+				2.060,	2.056, 2.052, 2.048, 2.045, 2.042 };
+
+typedef struct bench_options bench_options;
+struct bench_options {
+	size_t samples;
+	size_t warmup;
+	uint64_t sample_ns;
+	const char *filter;
+	const char *output_file;
+	const char *baseline_file;
+	double fail_over_percent; // 0 for never
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t time_run(const bench_case *bench, void *state,
+			 size_t iterations)
+{
+	uint64_t started = now_ns();
+	bench->run(state, iterations);
+
+	return now_ns() - started;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void summarise(bench_result *result, double *samples, size_t count)
+{
+	qsort(samples, count, sizeof(*samples), compare_doubles);
+
+	double sum = 0;
+	for (size_t i = 0; i < count; i++) {
+		sum += samples[i];
+	}
+	double mean = sum / (double)count;
+
+	double squares = 0;
+	for (size_t i = 0; i < count; i++) {
+		squares += (samples[i] - mean) * (samples[i] - mean);
+	}
+	double stddev = count > 1 ? sqrt(squares / (double)(count - 1)) : 0;
+
+	size_t df = count > 1 ? count - 1 : 1;
+	double t = df <= sizeof(t_975) / sizeof(*t_975) ? t_975[df - 1] : 1.96;
+
+	result->samples = count;
+	result->min_ns = samples[0];
+	result->median_ns = count % 2 ? samples[count / 2] :
+					(samples[count / 2 - 1] +
+					 samples[count / 2]) /
+						2;
+	result->mean_ns = mean;
+	result->stddev_ns = stddev;
+	result->ci95_ns = t * stddev / sqrt((double)count);
+}
+
+static int run_case(const bench_case *bench, const bench_options *options,
+		    bench_result *result)
+{
+	void *state = 0;
+	if (bench->setup != 0 && bench->setup(&state) != EXIT_SUCCESS) {
+		fprintf(stderr, "%s: setup failed\n", bench->name);
+		return EXIT_FAILURE;
+	}
+
+	// Double up until one sample is long enough for the clock
+	size_t iterations = 1;
+	while (time_run(bench, state, iterations) < options->sample_ns &&
+	       iterations < ((size_t)1 << 40)) {
+		iterations *= 2;
+	}
+
+	for (size_t i = 0; i < options->warmup; i++) {
+		time_run(bench, state, iterations);
+	}
+
+	double *samples = calloc(options->samples, sizeof(double));
+	assert(samples);
+	for (size_t i = 0; i < options->samples; i++) {
+		samples[i] = (double)time_run(bench, state, iterations) /
+			     (double)iterations;
+	}
+
+	if (bench->teardown != 0) {
+		bench->teardown(state);
+	}
+
+	result->name = bench->name;
+	result->iterations = iterations;
+	summarise(result, samples, options->samples);
+	free(samples);
+
+	return EXIT_SUCCESS;
+}
+
+static json_t *results_to_json(const bench_result *results, size_t count)
+{
+	json_t *list = json_array();
+	for (size_t i = 0; i < count; i++) {
+		const bench_result *r = &results[i];
+		json_array_append_new(
+			list,
+			json_pack("{s:s, s:I, s:I, s:f, s:f, s:f, s:f, s:f}",
+				  "name", r->name, "iterations",
+				  (json_int_t)r->iterations, "samples",
+				  (json_int_t)r->samples, "min_ns", r->min_ns,
+				  "median_ns", r->median_ns, "mean_ns",
+				  r->mean_ns, "stddev_ns", r->stddev_ns,
+				  "ci95_ns", r->ci95_ns));
+	}
+
+	return json_pack("{s:o}", "benchmarks", list);
+}
+
+static const json_t *find_baseline(const json_t *baseline, const char *name)
+{
+	size_t index;
+	const json_t *entry;
+	json_array_foreach(json_object_get(baseline, "benchmarks"), index,
+			   entry)
+	{
+		const char *entry_name =
+			json_string_value(json_object_get(entry, "name"));
+		if (entry_name != 0 && strcmp(entry_name, name) == 0) {
+			return entry;
+		}
+	}
+
+	return 0;
+}
+
+// Only called a difference when the confidence intervals don't overlap
+static int compare_with_baseline(const bench_result *results, size_t count,
+				 const json_t *baseline,
+				 const bench_options *options)
+{
+	int rc = EXIT_SUCCESS;
+
+	printf("\n%-28s %14s %14s %9s  %s\n", "vs baseline", "before ns",
+	       "after ns", "change", "verdict");
+	for (size_t i = 0; i < count; i++) {
+		const bench_result *r = &results[i];
+		const json_t *before = find_baseline(baseline, r->name);
+		if (before == 0) {
+			printf("%-28s %14s %14.1f %9s  %s\n", r->name, "-",
+			       r->mean_ns, "-", "new");
+			continue;
+		}
+
+		double before_mean =
+			json_number_value(json_object_get(before, "mean_ns"));
+		double before_ci =
+			json_number_value(json_object_get(before, "ci95_ns"));
+		double change = before_mean > 0 ? (r->mean_ns - before_mean) /
+							  before_mean * 100 :
+						  0;
+		bool different =
+			fabs(r->mean_ns - before_mean) > r->ci95_ns + before_ci;
+		const char *verdict = !different   ? "no change" :
+				      r->mean_ns < before_mean ? "faster" :
+								 "slower";
+
+		printf("%-28s %14.1f %14.1f %+8.1f%%  %s\n", r->name,
+		       before_mean, r->mean_ns, change, verdict);
+
+		if (different && options->fail_over_percent > 0 &&
+		    change > options->fail_over_percent) {
+			rc = EXIT_FAILURE;
+		}
+	}
+
+	return rc;
+}
+
+static void print_usage(void)
+{
+	fprintf(stderr,
+		"Usage: bench [OPTIONS]\n\n"
+		"  -n <SAMPLES>   Samples per benchmark (default %d)\n"
+		"  -w <SAMPLES>   Warmup samples, not counted (default %d)\n"
+		"  -m <MS>        Minimum time per sample (default %d)\n"
+		"  -f <NAME>      Only benchmarks with NAME in their name\n"
+		"  -o <FILE>      Save the results as json\n"
+		"  -b <FILE>      Compare against results saved with -o\n"
+		"  -F <PERCENT>   With -b, fail if anything is slower by more\n"
+		"  -l             List the benchmarks\n",
+		BENCH_DEFAULT_SAMPLES, BENCH_DEFAULT_WARMUP,
+		BENCH_DEFAULT_SAMPLE_MS);
+}
+
+int main(int argc, char **argv)
+{
+	bench_options options = {
+		.samples = BENCH_DEFAULT_SAMPLES,
+		.warmup = BENCH_DEFAULT_WARMUP,
+		.sample_ns = (uint64_t)BENCH_DEFAULT_SAMPLE_MS * 1000000,
+	};
+
+	int option;
+	while ((option = getopt(argc, argv, "n:w:m:f:o:b:F:lh")) != -1) {
+		switch (option) {
+		case 'n':
+			options.samples = strtoul(optarg, 0, 10);
+			break;
+		case 'w':
+			options.warmup = strtoul(optarg, 0, 10);
+			break;
+		case 'm':
+			options.sample_ns = strtoull(optarg, 0, 10) * 1000000;
+			break;
+		case 'f':
+			options.filter = optarg;
+			break;
+		case 'o':
+			options.output_file = optarg;
+			break;
+		case 'b':
+			options.baseline_file = optarg;
+			break;
+		case 'F':
+			options.fail_over_percent = strtod(optarg, 0);
+			break;
+		case 'l':
+			for (size_t i = 0; i < bench_case_count; i++) {
+				printf("%s\n", bench_cases[i].name);
+			}
+			return EXIT_SUCCESS;
+		default:
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (options.samples < 2) {
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	json_t *baseline = 0;
+	if (options.baseline_file != 0) {
+		json_error_t error;
+		baseline = json_load_file(options.baseline_file, 0, &error);
+		if (baseline == 0) {
+			fprintf(stderr, "Can't read %s: %s\n",
+				options.baseline_file, error.text);
+			return EXIT_FAILURE;
+		}
+	}
+
+	bench_result *results = calloc(bench_case_count, sizeof(bench_result));
+	assert(results);
+	size_t count = 0;
+	int rc = EXIT_SUCCESS;
+
+	printf("%-28s %12s %12s %12s %12s %10s\n", "benchmark", "iterations",
+	       "median ns", "mean ns", "ci95 ns", "min ns");
+	for (size_t i = 0; i < bench_case_count; i++) {
+		if (options.filter != 0 &&
+		    strstr(bench_cases[i].name, options.filter) == 0) {
+			continue;
+		}
+		bench_result *r = &results[count];
+		if (run_case(&bench_cases[i], &options, r) != EXIT_SUCCESS) {
+			rc = EXIT_FAILURE;
+			continue;
+		}
+		count++;
+		printf("%-28s %12zu %12.1f %12.1f %12.1f %10.1f\n", r->name,
+		       r->iterations, r->median_ns, r->mean_ns, r->ci95_ns,
+		       r->min_ns);
+		fflush(stdout);
+	}
+
+	if (options.output_file != 0) {
+		json_t *json = results_to_json(results, count);
+		if (json_dump_file(json, options.output_file, JSON_INDENT(2)) !=
+		    0) {
+			fprintf(stderr, "Can't write %s\n",
+				options.output_file);
+			rc = EXIT_FAILURE;
+		}
+		json_decref(json);
+	}
+
+	if (baseline != 0) {
+		if (compare_with_baseline(results, count, baseline,
+					  &options) != EXIT_SUCCESS) {
+			rc = EXIT_FAILURE;
+		}
+		json_decref(baseline);
+	}
+
+	free(results);
+
+	return rc;
+}
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/* 
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+#ifndef SENTRYPEER_BENCH_H
+#define SENTRYPEER_BENCH_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BENCH_DEFAULT_SAMPLES 15
+#define BENCH_DEFAULT_WARMUP 3
+#define BENCH_DEFAULT_SAMPLE_MS 20
+
+// One thing to time. setup and teardown are optional and not timed, run
+// is called with however many iterations make a sample long enough to
+// measure.
+typedef struct bench_case bench_case;
+struct bench_case {
+	const char *name;
+	int (*setup)(void **state);
+	void (*run)(void *state, size_t iterations);
+	void (*teardown)(void *state);
+};
+
+typedef struct bench_result bench_result;
+struct bench_result {
+	const char *name;
+	size_t iterations; // Per sample
+	size_t samples;
+	double min_ns; // All per iteration
+	double median_ns;
+	double mean_ns;
+	double stddev_ns;
+	double ci95_ns; // Half width of the 95% confidence interval of the mean
+};
+
+// See bench_cases.c
+extern const bench_case bench_cases[];
+extern const size_t bench_case_count;
+
+// Somewhere for runs to put results so they aren't optimised away
+extern volatile uintptr_t bench_sink;
+
+#endif //SENTRYPEER_BENCH_H
@@ -0,0 +1,336 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/* 
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "../../src/bad_actor.h"
+#include "../../src/conf.h"
+#include "../../src/database.h"
+#include "../../src/http_routes.h"
+#include "../../src/json_logger.h"
+#include "../../src/regex_match.h"
+#include "../../src/sip_parser.h"
+#include "../../src/utils.h"
+
+#define BENCH_DB_ROWS 1000
+
+// What scanners send most, see tests/tools/corpus for more
+static const char *sip_corpus[] = {
+	"OPTIONS sip:100@23.148.145.71 SIP/2.0\r\n"
+	"Via: SIP/2.0/UDP 23.148.145.71:5084;branch=z9hG4bK-3054909403;rport\r\n"
+	"From: \"sipvicious\" <sip:100@1.1.1.1>;tag=6434396633623535313363340133343333313138393833\r\n"
+	"To: \"sipvicious\" <sip:100@1.1.1.1>\r\n"
+	"Call-ID: 711444933874895842969934\r\n"
+	"CSeq: 1 OPTIONS\r\n"
+	"Contact: <sip:100@23.148.145.71:5084>\r\n"
+	"Accept: application/sdp\r\n"
+	"User-agent: friendly-scanner\r\n"
+	"Max-forwards: 70\r\n"
+	"Content-Length: 0\r\n\r\n",
+
+	"REGISTER sip:23.148.145.71 SIP/2.0\r\n"
+	"Via: SIP/2.0/UDP 10.0.0.2:5060;branch=z9hG4bK-524287-1\r\n"
+	"Max-Forwards: 70\r\n"
+	"From: <sip:1001@23.148.145.71>;tag=3f4a1b2c\r\n"
+	"To: <sip:1001@23.148.145.71>\r\n"
+	"Call-ID: 4b2f8a6e1c3d@10.0.0.2\r\n"
+	"CSeq: 1 REGISTER\r\n"
+	"Contact: <sip:1001@10.0.0.2:5060>\r\n"
+	"Expires: 3600\r\n"
+	"User-Agent: Cisco-SIPGateway/IOS-12.x\r\n"
+	"Content-Length: 0\r\n\r\n",
+
+	"INVITE sip:900441904911001@23.148.145.71 SIP/2.0\r\n"
+	"Via: SIP/2.0/UDP 10.0.0.3:5071;branch=z9hG4bK-1a2b3c;rport\r\n"
+	"Max-Forwards: 70\r\n"
+	"From: \"1001\" <sip:1001@23.148.145.71>;tag=as1f2e3d4c\r\n"
+	"To: <sip:900441904911001@23.148.145.71>\r\n"
+	"Call-ID: 0ea1f2c3b4d5@10.0.0.3\r\n"
+	"CSeq: 102 INVITE\r\n"
+	"Contact: <sip:1001@10.0.0.3:5071>\r\n"
+	"Content-Type: application/sdp\r\n"
+	"User-Agent: PolycomSoundPointIP-SPIP_550-UA/3.3.2.0413\r\n"
+	"Content-Length: 176\r\n\r\n"
+	"v=0\r\n"
+	"o=root 1904724712 1904724712 IN IP4 10.0.0.3\r\n"
+	"s=Asterisk PBX 1.6.2.7\r\n"
+	"c=IN IP4 10.0.0.3\r\n"
+	"t=0 0\r\n"
+	"m=audio 14408 RTP/AVP 8 0 101\r\n"
+	"a=rtpmap:8 PCMA/8000\r\n"
+	"a=rtpmap:0 PCMU/8000\r\n",
+};
+#define SIP_CORPUS_COUNT (sizeof(sip_corpus) / sizeof(*sip_corpus))
+
+// Checked in route_handler()'s order, so the later ones cost the most
+static const char *routes[] = {
+	HEALTH_CHECK_ROUTE, HOME_PAGE_ROUTE,	   IP_ADDRESSES_ROUTE,
+	IP_ADDRESSES_IPSET_ROUTE, IP_PREFIXES_ROUTE, NUMBERS_ROUTE,
+	COUNTRIES_ROUTE,	  USER_AGENTS_ROUTE, SIP_METHODS_ROUTE,
+	EVENTS_STREAM_ROUTE,	  METRICS_ROUTE,
+};
+#define ROUTE_COUNT (sizeof(routes) / sizeof(*routes))
+
+typedef struct bench_state bench_state;
+struct bench_state {
+	sentrypeer_config *config;
+	bad_actor *bad_actor_event;
+	char *json;
+	char db_dir[64];
+};
+
+static bad_actor *new_bad_actor(const sentrypeer_config *config,
+				const char *source_ip)
+{
+	return bad_actor_new(0, util_duplicate_string(source_ip),
+			     util_duplicate_string("8.8.8.8"), 0, 0,
+			     util_duplicate_string("UDP"), 0,
+			     util_duplicate_string("passive"),
+			     config->node_id);
+}
+
+static bad_actor *new_parsed_bad_actor(const sentrypeer_config *config,
+				       const char *source_ip, size_t i)
+{
+	bad_actor *bad_actor_event = new_bad_actor(config, source_ip);
+	const char *message = sip_corpus[i % SIP_CORPUS_COUNT];
+	if (sip_message_parser(message, strlen(message), bad_actor_event,
+			       config) != EXIT_SUCCESS) {
+		bad_actor_destroy(&bad_actor_event);
+	}
+
+	return bad_actor_event;
+}
+
+static int setup_config(void **state)
+{
+	bench_state *self = calloc(1, sizeof(bench_state));
+	assert(self);
+	self->config = sentrypeer_config_new();
+	assert(self->config);
+	*state = self;
+
+	return EXIT_SUCCESS;
+}
+
+static int setup_parsed(void **state)
+{
+	setup_config(state);
+	bench_state *self = *state;
+	self->bad_actor_event =
+		new_parsed_bad_actor(self->config, "104.149.141.214", 0);
+	if (self->bad_actor_event == 0) {
+		return EXIT_FAILURE;
+	}
+	self->json = bad_actor_to_json(self->config, self->bad_actor_event);
+
+	return self->json != 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void remove_db(bench_state *self)
+{
+	const char *suffixes[] = { "", "-wal", "-shm", "-journal" };
+	for (size_t i = 0; i < sizeof(suffixes) / sizeof(*suffixes); i++) {
+		char path[SENTRYPEER_PATH_MAX];
+		snprintf(path, sizeof(path), "%s/sentrypeer.db%s",
+			 self->db_dir, suffixes[i]);
+		unlink(path);
+	}
+}
+
+// A scratch database, so a run never touches a real one
+static int setup_db(void **state)
+{
+	if (setup_parsed(state) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+	bench_state *self = *state;
+
+	snprintf(self->db_dir, sizeof(self->db_dir),
+		 "/tmp/sentrypeer_bench_XXXXXX");
+	if (mkdtemp(self->db_dir) == 0) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+	snprintf(self->config->db_file, SENTRYPEER_PATH_MAX,
+		 "%s/sentrypeer.db", self->db_dir);
+
+	return EXIT_SUCCESS;
+}
+
+// BENCH_DB_ROWS events from as many different IP addresses
+static int setup_db_rows(void **state)
+{
+	if (setup_db(state) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+	bench_state *self = *state;
+
+	for (size_t i = 0; i < BENCH_DB_ROWS; i++) {
+		char source_ip[32];
+		snprintf(source_ip, sizeof(source_ip), "10.%zu.%zu.%zu",
+			 i >> 16 & 0xff, i >> 8 & 0xff, i & 0xff);
+		bad_actor *bad_actor_event =
+			new_parsed_bad_actor(self->config, source_ip, i);
+		int rc = db_insert_bad_actor(bad_actor_event, self->config);
+		bad_actor_destroy(&bad_actor_event);
+		if (rc != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static void teardown(void *state)
+{
+	bench_state *self = state;
+	if (self->db_dir[0] != '\0') {
+		remove_db(self);
+		rmdir(self->db_dir);
+	}
+	free(self->json);
+	bad_actor_destroy(&self->bad_actor_event);
+	sentrypeer_config_destroy(&self->config);
+	free(self);
+}
+
+// Includes bad_actor_new() and bad_actor_destroy(), as capture does, see
+// bad_actor_new_destroy for how much of it that is
+static void run_sip_message_parser(void *state, size_t iterations)
+{
+	bench_state *self = state;
+	for (size_t i = 0; i < iterations; i++) {
+		bad_actor *bad_actor_event =
+			new_parsed_bad_actor(self->config, "104.149.141.214", i);
+		bench_sink += (uintptr_t)bad_actor_event;
+		bad_actor_destroy(&bad_actor_event);
+	}
+}
+
+static void run_bad_actor_new_destroy(void *state, size_t iterations)
+{
+	bench_state *self = state;
+	for (size_t i = 0; i < iterations; i++) {
+		bad_actor *bad_actor_event =
+			new_bad_actor(self->config, "104.149.141.214");
+		bench_sink += (uintptr_t)bad_actor_event;
+		bad_actor_destroy(&bad_actor_event);
+	}
+}
+
+static void run_bad_actor_to_json(void *state, size_t iterations)
+{
+	bench_state *self = state;
+	for (size_t i = 0; i < iterations; i++) {
+		char *json =
+			bad_actor_to_json(self->config, self->bad_actor_event);
+		bench_sink += (uintptr_t)json;
+		free(json);
+	}
+}
+
+// The same again into one reused buffer, as bad_actor_log() does
+static void run_bad_actor_json_write(void *state, size_t iterations)
+{
+	bench_state *self = state;
+	json_buffer buffer;
+	json_buffer_init(&buffer);
+	for (size_t i = 0; i < iterations; i++) {
+		bad_actor_json_write(self->bad_actor_event, &buffer);
+		bench_sink += buffer.len;
+	}
+	json_buffer_release(&buffer);
+}
+
+static void run_json_to_bad_actor(void *state, size_t iterations)
+{
+	bench_state *self = state;
+	for (size_t i = 0; i < iterations; i++) {
+		bad_actor *bad_actor_event =
+			json_to_bad_actor(self->config, self->json);
+		bench_sink += (uintptr_t)bad_actor_event;
+		bad_actor_destroy(&bad_actor_event);
+	}
+}
+
+static void run_db_insert_bad_actor(void *state, size_t iterations)
+{
+	bench_state *self = state;
+	for (size_t i = 0; i < iterations; i++) {
+		bench_sink += (uintptr_t)db_insert_bad_actor(
+			self->bad_actor_event, self->config);
+	}
+}
+
+static void run_db_select_bad_actors(void *state, size_t iterations)
+{
+	bench_state *self = state;
+	for (size_t i = 0; i < iterations; i++) {
+		bad_actor **bad_actors = 0;
+		int64_t row_count = 0;
+		if (db_select_bad_actors(&bad_actors, &row_count,
+					 self->config) == EXIT_SUCCESS) {
+			bench_sink += (uintptr_t)row_count;
+			bad_actors_destroy(bad_actors, &row_count);
+			free(bad_actors);
+		}
+	}
+}
+
+static void run_regex_match(void *state, size_t iterations)
+{
+	bench_state *self = state;
+	for (size_t i = 0; i < iterations; i++) {
+		char *matched = 0;
+		bench_sink += (uintptr_t)regex_match("/ip-addresses/8.8.8.8",
+						     IP_ADDRESS_ROUTE, &matched,
+						     self->config);
+		free(matched);
+	}
+}
+
+// A miss against every exact route, the worst case
+static void run_route_check(void *state, size_t iterations)
+{
+	bench_state *self = state;
+	for (size_t i = 0; i < iterations; i++) {
+		for (size_t r = 0; r < ROUTE_COUNT; r++) {
+			bench_sink += (uintptr_t)route_check(
+				"/no-such-route", routes[r], self->config);
+		}
+	}
+}
+
+const bench_case bench_cases[] = {
+	{ "sip_message_parser", setup_config, run_sip_message_parser,
+	  teardown },
+	{ "bad_actor_new_destroy", setup_config, run_bad_actor_new_destroy,
+	  teardown },
+	{ "bad_actor_to_json", setup_parsed, run_bad_actor_to_json, teardown },
+	{ "bad_actor_json_write", setup_parsed, run_bad_actor_json_write,
+	  teardown },
+	{ "json_to_bad_actor", setup_parsed, run_json_to_bad_actor, teardown },
+	{ "db_insert_bad_actor", setup_db, run_db_insert_bad_actor, teardown },
+	{ "db_select_bad_actors", setup_db_rows, run_db_select_bad_actors,
+	  teardown },
+	{ "regex_match", setup_config, run_regex_match, teardown },
+	{ "route_check", setup_config, run_route_check, teardown },
+};
+const size_t bench_case_count = sizeof(bench_cases) / sizeof(*bench_cases);
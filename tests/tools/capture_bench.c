@@ -0,0 +1,668 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+// Replays a corpus of scanner SIP messages at a fixed rate against a
+// running SentryPeer and watches its database for them turning up, to
+// measure events/sec, drops, latency from send to row and CPU per event.
+//
+// Every message that should be logged carries a run tag and sequence
+// number in its User-Agent (%SEQ% in the corpus), which is how rows are
+// matched back to sends. Corpus files starting with "malformed" are sent
+// but not expected in the database.
+//
+// A summary goes to stderr and one line of json to stdout, see
+// capture_bench.sh for running it against the C and Rust listeners.
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <sqlite3.h>
+
+#define CORPUS_MAX 64
+#define MESSAGE_MAX 4096
+#define SEQ_WIDTH 10
+#define RUN_TAG_LEN 8 // hex
+#define NOT_SEEN UINT64_MAX
+
+typedef struct corpus_message corpus_message;
+struct corpus_message {
+	char name[256];
+	char *text; // CRLF line endings, %LEN% already filled in
+	size_t len;
+	bool expected; // In the database afterwards
+};
+
+typedef struct bench bench;
+struct bench {
+	// Options
+	const char *host;
+	const char *port;
+	const char *transport;
+	const char *corpus_dir;
+	const char *db_file;
+	const char *label;
+	long rate;
+	long duration;
+	long drain;
+	long poll_interval_us;
+	pid_t pid;
+	bool persistent;
+
+	corpus_message corpus[CORPUS_MAX];
+	size_t corpus_count;
+	char run_tag[RUN_TAG_LEN + 1];
+
+	size_t total;
+	uint64_t *sent_ns;
+	uint64_t *stored_ns;
+	atomic_size_t expected_sent;
+	atomic_size_t stored;
+	atomic_bool sending;
+	uint64_t send_started_ns;
+	uint64_t send_finished_ns;
+	size_t send_errors;
+
+	struct addrinfo *address;
+	SSL_CTX *ssl_ctx;
+	int fd;
+	SSL *ssl;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline)
+{
+	struct timespec wake_up = {
+		.tv_sec = (time_t)(deadline / 1000000000),
+		.tv_nsec = (long)(deadline % 1000000000),
+	};
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_up, 0) ==
+	       EINTR) {
+	}
+}
+
+static void replace_all(char *text, size_t size, const char *from,
+			const char *to)
+{
+	size_t from_len = strlen(from);
+	size_t to_len = strlen(to);
+	char *found = text;
+	while ((found = strstr(found, from)) != 0) {
+		size_t tail = strlen(found + from_len) + 1;
+		assert((size_t)(found - text) + to_len + tail <= size);
+		memmove(found + to_len, found + from_len, tail);
+		memcpy(found, to, to_len);
+		found += to_len;
+	}
+}
+
+static int load_message(bench *self, const char *dir, const char *name)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	FILE *file = fopen(path, "r");
+	if (file == 0) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	// SIP wants CRLF, the files are easier to edit without
+	char text[MESSAGE_MAX] = { 0 };
+	size_t len = 0;
+	int c;
+	while ((c = fgetc(file)) != EOF && len < sizeof(text) / 2 - 2) {
+		if (c == '\n') {
+			text[len++] = '\r';
+		}
+		text[len++] = (char)c;
+	}
+	fclose(file);
+
+	char transport[8];
+	snprintf(transport, sizeof(transport), "%s", self->transport);
+	for (char *t = transport; *t; t++) {
+		*t = (char)toupper((unsigned char)*t);
+	}
+	replace_all(text, sizeof(text), "%TRANSPORT%", transport);
+	replace_all(text, sizeof(text), "%TARGET%", self->host);
+
+	char *body = strstr(text, "\r\n\r\n");
+	char body_len[24];
+	snprintf(body_len, sizeof(body_len), "%zu",
+		 body != 0 ? strlen(body + 4) : 0);
+	replace_all(text, sizeof(text), "%LEN%", body_len);
+
+	corpus_message *message = &self->corpus[self->corpus_count++];
+	snprintf(message->name, sizeof(message->name), "%s", name);
+	message->text = strdup(text);
+	message->len = strlen(text);
+	message->expected = strncmp(name, "malformed", 9) != 0;
+	assert(message->text);
+
+	return EXIT_SUCCESS;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int load_corpus(bench *self)
+{
+	DIR *dir = opendir(self->corpus_dir);
+	if (dir == 0) {
+		perror(self->corpus_dir);
+		return EXIT_FAILURE;
+	}
+
+	// Sorted, so runs send the same thing in the same order
+	char *names[CORPUS_MAX];
+	size_t count = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != 0 && count < CORPUS_MAX) {
+		size_t len = strlen(entry->d_name);
+		if (len > 4 && strcmp(entry->d_name + len - 4, ".sip") == 0) {
+			names[count++] = strdup(entry->d_name);
+		}
+	}
+	closedir(dir);
+	qsort(names, count, sizeof(*names), compare_names);
+
+	int rc = EXIT_SUCCESS;
+	for (size_t i = 0; i < count; i++) {
+		if (rc == EXIT_SUCCESS) {
+			rc = load_message(self, self->corpus_dir, names[i]);
+		}
+		free(names[i]);
+	}
+	if (rc == EXIT_SUCCESS && self->corpus_count == 0) {
+		fprintf(stderr, "No .sip files in %s\n", self->corpus_dir);
+		rc = EXIT_FAILURE;
+	}
+
+	return rc;
+}
+
+static int connect_socket(bench *self)
+{
+	int fd = socket(self->address->ai_family, self->address->ai_socktype,
+			self->address->ai_protocol);
+	if (fd < 0) {
+		return -1;
+	}
+	if (connect(fd, self->address->ai_addr, self->address->ai_addrlen) !=
+	    0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void disconnect(bench *self)
+{
+	if (self->ssl != 0) {
+		SSL_shutdown(self->ssl);
+		SSL_free(self->ssl);
+		self->ssl = 0;
+	}
+	if (self->fd >= 0) {
+		close(self->fd);
+		self->fd = -1;
+	}
+}
+
+static int ensure_connected(bench *self)
+{
+	if (self->fd >= 0) {
+		return EXIT_SUCCESS;
+	}
+
+	self->fd = connect_socket(self);
+	if (self->fd < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (self->ssl_ctx != 0) {
+		self->ssl = SSL_new(self->ssl_ctx);
+		SSL_set_fd(self->ssl, self->fd);
+		if (SSL_connect(self->ssl) != 1) {
+			disconnect(self);
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// Scanners mostly connect, send one message and go, so that's the default
+// for TCP and TLS. With -k everything goes down one connection instead.
+static int send_message(bench *self, const char *text, size_t len)
+{
+	if (ensure_connected(self) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	ssize_t sent = self->ssl != 0 ? SSL_write(self->ssl, text, (int)len) :
+					send(self->fd, text, len, MSG_NOSIGNAL);
+	int rc = sent == (ssize_t)len ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	if (rc != EXIT_SUCCESS || (!self->persistent &&
+				   strcmp(self->transport, "udp") != 0)) {
+		disconnect(self);
+	}
+
+	return rc;
+}
+
+static void send_all(bench *self)
+{
+	char text[MESSAGE_MAX];
+	char seq[32];
+
+	self->send_started_ns = now_ns();
+	for (size_t i = 0; i < self->total; i++) {
+		// Where we should be by now, sleeping if ahead
+		uint64_t due = self->send_started_ns +
+			       (uint64_t)((double)i * 1e9 / (double)self->rate);
+		if (now_ns() < due) {
+			sleep_until_ns(due);
+		}
+
+		const corpus_message *message =
+			&self->corpus[i % self->corpus_count];
+		snprintf(seq, sizeof(seq), "%s.%0*zu", self->run_tag,
+			 SEQ_WIDTH, i);
+		snprintf(text, sizeof(text), "%s", message->text);
+		replace_all(text, sizeof(text), "%SEQ%", seq);
+
+		self->sent_ns[i] = now_ns();
+		if (send_message(self, text, strlen(text)) != EXIT_SUCCESS) {
+			self->send_errors++;
+			self->sent_ns[i] = NOT_SEEN;
+		} else if (message->expected) {
+			atomic_fetch_add(&self->expected_sent, 1);
+		}
+	}
+	self->send_finished_ns = now_ns();
+	disconnect(self);
+}
+
+static void *poll_database(void *arg)
+{
+	bench *self = arg;
+
+	sqlite3 *db;
+	if (sqlite3_open_v2(self->db_file, &db, SQLITE_OPEN_READONLY, 0) !=
+	    SQLITE_OK) {
+		fprintf(stderr, "Can't open %s: %s\n", self->db_file,
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return 0;
+	}
+	sqlite3_busy_timeout(db, 1000);
+
+	// Only rows that arrive after we start
+	sqlite3_int64 last_id = 0;
+	sqlite3_stmt *stmt;
+	if (sqlite3_prepare_v2(db, "SELECT coalesce(max(honey_id), 0) FROM honey;",
+			       -1, &stmt, 0) == SQLITE_OK &&
+	    sqlite3_step(stmt) == SQLITE_ROW) {
+		last_id = sqlite3_column_int64(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+
+	if (sqlite3_prepare_v2(db,
+			       "SELECT honey_id, user_agent FROM honey "
+			       "WHERE honey_id > ? ORDER BY honey_id;",
+			       -1, &stmt, 0) != SQLITE_OK) {
+		fprintf(stderr, "Can't read honey: %s\n", sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return 0;
+	}
+
+	uint64_t drain_until = 0;
+	for (;;) {
+		sqlite3_bind_int64(stmt, 1, last_id);
+		uint64_t seen_at = now_ns();
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			last_id = sqlite3_column_int64(stmt, 0);
+			const char *user_agent =
+				(const char *)sqlite3_column_text(stmt, 1);
+			const char *tag = user_agent != 0 ?
+						  strstr(user_agent, self->run_tag) :
+						  0;
+			if (tag == 0) {
+				continue;
+			}
+			size_t seq = strtoull(tag + RUN_TAG_LEN + 1, 0, 10);
+			if (seq < self->total &&
+			    self->stored_ns[seq] == NOT_SEEN) {
+				self->stored_ns[seq] = seen_at;
+				atomic_fetch_add(&self->stored, 1);
+			}
+		}
+		sqlite3_reset(stmt);
+
+		if (!atomic_load(&self->sending)) {
+			if (drain_until == 0) {
+				drain_until = now_ns() +
+					      (uint64_t)self->drain * 1000000000;
+			}
+			if (atomic_load(&self->stored) >=
+				    atomic_load(&self->expected_sent) ||
+			    now_ns() > drain_until) {
+				break;
+			}
+		}
+		usleep((useconds_t)self->poll_interval_us);
+	}
+
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+
+	return 0;
+}
+
+// utime + stime of a process in seconds, from /proc
+static double process_cpu_seconds(pid_t pid)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	FILE *file = fopen(path, "r");
+	if (file == 0) {
+		return -1;
+	}
+
+	char stat[1024] = { 0 };
+	size_t len = fread(stat, 1, sizeof(stat) - 1, file);
+	fclose(file);
+	stat[len] = '\0';
+
+	// The command can have spaces in, so count fields from after it
+	const char *fields = strrchr(stat, ')');
+	unsigned long long utime = 0;
+	unsigned long long stime = 0;
+	if (fields == 0 ||
+	    sscanf(fields + 2,
+		   "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+		   &utime, &stime) != 2) {
+		return -1;
+	}
+
+	return (double)(utime + stime) / (double)sysconf(_SC_CLK_TCK);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile_ms(const uint64_t *sorted, size_t count, double q)
+{
+	if (count == 0) {
+		return 0;
+	}
+	size_t rank = (size_t)ceil(q * (double)count);
+
+	return (double)sorted[rank > 0 ? rank - 1 : 0] / 1e6;
+}
+
+static void report(bench *self, double cpu_seconds)
+{
+	uint64_t *latencies = calloc(self->total + 1, sizeof(uint64_t));
+	assert(latencies);
+	size_t count = 0;
+	uint64_t last_stored = self->send_started_ns;
+	for (size_t i = 0; i < self->total; i++) {
+		if (self->stored_ns[i] != NOT_SEEN &&
+		    self->sent_ns[i] != NOT_SEEN) {
+			latencies[count++] = self->stored_ns[i] > self->sent_ns[i] ?
+						     self->stored_ns[i] -
+							     self->sent_ns[i] :
+						     0;
+			if (self->stored_ns[i] > last_stored) {
+				last_stored = self->stored_ns[i];
+			}
+		}
+	}
+	qsort(latencies, count, sizeof(*latencies), compare_u64);
+
+	size_t expected = atomic_load(&self->expected_sent);
+	size_t stored = atomic_load(&self->stored);
+	double send_seconds =
+		(double)(self->send_finished_ns - self->send_started_ns) / 1e9;
+	double store_seconds =
+		(double)(last_stored - self->send_started_ns) / 1e9;
+	double events_per_sec =
+		store_seconds > 0 ? (double)stored / store_seconds : 0;
+	double drop_rate =
+		expected > 0 ? (double)(expected - stored) / (double)expected :
+			       0;
+	double cpu_us_per_event =
+		cpu_seconds >= 0 && stored > 0 ?
+			cpu_seconds * 1e6 / (double)stored :
+			-1;
+	double p50 = percentile_ms(latencies, count, 0.50);
+	double p99 = percentile_ms(latencies, count, 0.99);
+	double p999 = percentile_ms(latencies, count, 0.999);
+
+	fprintf(stderr,
+		"%s %s: sent %zu (%zu expected, %zu errors) at %.0f/s, stored %zu "
+		"at %.0f events/s, dropped %.4f%%\n"
+		"latency to db p50 %.3fms p99 %.3fms p999 %.3fms, cpu %.1fus/event\n",
+		self->label, self->transport, self->total, expected,
+		self->send_errors,
+		send_seconds > 0 ? (double)self->total / send_seconds : 0,
+		stored, events_per_sec, drop_rate * 100, p50, p99, p999,
+		cpu_us_per_event);
+
+	printf("{\"label\": \"%s\", \"transport\": \"%s\", \"persistent\": %s, "
+	       "\"rate\": %ld, \"duration\": %ld, \"sent\": %zu, "
+	       "\"send_errors\": %zu, \"expected\": %zu, \"stored\": %zu, "
+	       "\"events_per_sec\": %.1f, \"drop_rate\": %.6f, "
+	       "\"latency_ms\": {\"p50\": %.3f, \"p99\": %.3f, \"p999\": %.3f}, "
+	       "\"cpu_us_per_event\": %.2f}\n",
+	       self->label, self->transport, self->persistent ? "true" : "false",
+	       self->rate, self->duration, self->total, self->send_errors,
+	       expected, stored, events_per_sec, drop_rate, p50, p99, p999,
+	       cpu_us_per_event);
+
+	free(latencies);
+}
+
+static void print_usage(void)
+{
+	fprintf(stderr,
+		"Usage: capture_bench -f <DB_FILE> [OPTIONS]\n\n"
+		"  -f <DB_FILE>    SentryPeer's database, SENTRYPEER_DB_PARTITION unset\n"
+		"  -H <HOST>       Listener address (default 127.0.0.1)\n"
+		"  -p <PORT>       Listener port (default 5060, 5061 for tls)\n"
+		"  -t <TRANSPORT>  udp, tcp or tls (default udp)\n"
+		"  -r <RATE>       Messages per second (default 1000)\n"
+		"  -d <SECONDS>    How long to send for (default 10)\n"
+		"  -w <SECONDS>    How long to wait for stragglers (default 5)\n"
+		"  -c <DIR>        Corpus of .sip files (default tests/tools/corpus)\n"
+		"  -P <PID>        SentryPeer's pid, for cpu per event\n"
+		"  -l <LABEL>      Label for the results, e.g. c or rust\n"
+		"  -i <USECS>      Database poll interval (default 1000)\n"
+		"  -k              One connection for everything (tcp and tls)\n");
+}
+
+int main(int argc, char **argv)
+{
+	bench self = {
+		.host = "127.0.0.1",
+		.transport = "udp",
+		.corpus_dir = "tests/tools/corpus",
+		.label = "sentrypeer",
+		.rate = 1000,
+		.duration = 10,
+		.drain = 5,
+		.poll_interval_us = 1000,
+		.fd = -1,
+	};
+
+	int option;
+	while ((option = getopt(argc, argv, "f:H:p:t:r:d:w:c:P:l:i:kh")) != -1) {
+		switch (option) {
+		case 'f':
+			self.db_file = optarg;
+			break;
+		case 'H':
+			self.host = optarg;
+			break;
+		case 'p':
+			self.port = optarg;
+			break;
+		case 't':
+			self.transport = optarg;
+			break;
+		case 'r':
+			self.rate = strtol(optarg, 0, 10);
+			break;
+		case 'd':
+			self.duration = strtol(optarg, 0, 10);
+			break;
+		case 'w':
+			self.drain = strtol(optarg, 0, 10);
+			break;
+		case 'c':
+			self.corpus_dir = optarg;
+			break;
+		case 'P':
+			self.pid = (pid_t)strtol(optarg, 0, 10);
+			break;
+		case 'l':
+			self.label = optarg;
+			break;
+		case 'i':
+			self.poll_interval_us = strtol(optarg, 0, 10);
+			break;
+		case 'k':
+			self.persistent = true;
+			break;
+		default:
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	bool udp = strcmp(self.transport, "udp") == 0;
+	bool tls = strcmp(self.transport, "tls") == 0;
+	if (self.db_file == 0 || self.rate < 1 || self.duration < 1 ||
+	    self.poll_interval_us < 1 ||
+	    (!udp && !tls && strcmp(self.transport, "tcp") != 0)) {
+		print_usage();
+		return EXIT_FAILURE;
+	}
+	if (self.port == 0) {
+		self.port = tls ? "5061" : "5060";
+	}
+
+	struct addrinfo hints = {
+		.ai_socktype = udp ? SOCK_DGRAM : SOCK_STREAM,
+	};
+	int rc = getaddrinfo(self.host, self.port, &hints, &self.address);
+	if (rc != 0) {
+		fprintf(stderr, "getaddrinfo() failed: %s\n", gai_strerror(rc));
+		return EXIT_FAILURE;
+	}
+
+	if (tls) {
+		// Self signed certs are normal for a honeypot, don't verify
+		self.ssl_ctx = SSL_CTX_new(TLS_client_method());
+		assert(self.ssl_ctx);
+		SSL_CTX_set_verify(self.ssl_ctx, SSL_VERIFY_NONE, 0);
+	}
+
+	if (load_corpus(&self) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	srandom((unsigned int)(now_ns() ^ (uint64_t)getpid()));
+	snprintf(self.run_tag, sizeof(self.run_tag), "%08lx",
+		 (unsigned long)random() & 0xffffffff);
+
+	self.total = (size_t)self.rate * (size_t)self.duration;
+	self.sent_ns = calloc(self.total, sizeof(uint64_t));
+	self.stored_ns = malloc(self.total * sizeof(uint64_t));
+	assert(self.sent_ns && self.stored_ns);
+	for (size_t i = 0; i < self.total; i++) {
+		self.stored_ns[i] = NOT_SEEN;
+	}
+	atomic_init(&self.expected_sent, 0);
+	atomic_init(&self.stored, 0);
+	atomic_init(&self.sending, true);
+
+	double cpu_before = self.pid > 0 ? process_cpu_seconds(self.pid) : -1;
+
+	pthread_t poller;
+	if (pthread_create(&poller, 0, poll_database, &self) != 0) {
+		perror("pthread_create");
+		return EXIT_FAILURE;
+	}
+	// Let the poller find where the database ends before we add to it
+	usleep(100000);
+
+	send_all(&self);
+	atomic_store(&self.sending, false);
+	pthread_join(poller, 0);
+
+	double cpu_after = self.pid > 0 ? process_cpu_seconds(self.pid) : -1;
+	report(&self, cpu_before >= 0 && cpu_after >= 0 ?
+			      cpu_after - cpu_before :
+			      -1);
+
+	for (size_t i = 0; i < self.corpus_count; i++) {
+		free(self.corpus[i].text);
+	}
+	free(self.sent_ns);
+	free(self.stored_ns);
+	freeaddrinfo(self.address);
+	if (self.ssl_ctx != 0) {
+		SSL_CTX_free(self.ssl_ctx);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,61 @@
+#!/bin/bash
+# Runs capture_bench against the C listener with each of its backends
+# (select() and io_uring) and, when built with Rust, the Rust one, over UDP,
+# TCP and TLS (Rust only). A C backend that isn't available falls back to
+# select(), which the log in $WORK says. One line of json
+# per run on stdout, e.g. to append to a file for regression tracking:
+#
+#   make -C tests/tools capture_bench
+#   tests/tools/capture_bench.sh 2000 10 >> capture_bench.ndjson
+#
+# Run from the top of the tree after building ./sentrypeer. Uses its own
+# database, so nothing else should be listening on 5060/5061.
+set -euo pipefail
+
+RATE=${1:-1000}
+DURATION=${2:-10}
+TOP=$(pwd)
+SENTRYPEER="$TOP/sentrypeer"
+BENCH="$TOP/tests/tools/capture_bench"
+CORPUS="$TOP/tests/tools/corpus"
+
+WORK=$(mktemp -d)
+trap 'kill $PID 2>/dev/null || true; rm -rf "$WORK"' EXIT
+PID=0
+
+run_listener() {
+	local label=$1
+	local backend=$2
+	shift 2
+	rm -f "$WORK"/sentrypeer.db*
+
+	# In $WORK so the Rust listener's generated cert.pem/key.pem land there
+	(cd "$WORK" && exec env -u SENTRYPEER_DB_PARTITION \
+		SENTRYPEER_DB_FILE="$WORK/sentrypeer.db" \
+		SENTRYPEER_DB_MAINTENANCE_INTERVAL=0 \
+		SENTRYPEER_SIP_BACKEND="$backend" \
+		"$SENTRYPEER" "$@" >"$WORK/$label.log" 2>&1) &
+	PID=$!
+	sleep 3
+
+	for transport in "${TRANSPORTS[@]}"; do
+		"$BENCH" -f "$WORK/sentrypeer.db" -t "$transport" -r "$RATE" \
+			-d "$DURATION" -c "$CORPUS" -P "$PID" -l "$label"
+	done
+
+	kill -INT "$PID"
+	wait "$PID" || true
+}
+
+# -N only exists when built with Rust, and picks the C listener
+if "$SENTRYPEER" -h 2>&1 | grep -q -- '-N'; then
+	TRANSPORTS=(udp tcp)
+	run_listener c-select select -N
+	run_listener c-io_uring io_uring -N
+	TRANSPORTS=(udp tcp tls)
+	run_listener rust auto
+else
+	TRANSPORTS=(udp tcp)
+	run_listener c-select select
+	run_listener c-io_uring io_uring
+fi
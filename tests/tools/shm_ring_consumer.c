@@ -0,0 +1,138 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+// Prints every new bad actor from a running SentryPeer's shared memory
+// ring, one per line, along with how long after SentryPeer saw it we did.
+//
+//   SENTRYPEER_SHM_RING=/sentrypeer ./sentrypeer ...
+//   ./shm_ring_consumer /sentrypeer
+//
+// Only needs src/shm_ring_reader.c, see the Makefile.
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shm_ring_reader.h"
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int signal_number)
+{
+	(void)signal_number; /* unused */
+	stopping = 1;
+}
+
+static const char *transport_name(uint8_t transport)
+{
+	switch (transport) {
+	case SHM_RING_TRANSPORT_UDP:
+		return "UDP";
+	case SHM_RING_TRANSPORT_TCP:
+		return "TCP";
+	case SHM_RING_TRANSPORT_TLS:
+		return "TLS";
+	default:
+		return "?";
+	}
+}
+
+static void ip_address_string(const uint8_t *address, char *out,
+			      socklen_t out_len)
+{
+	static const uint8_t ipv4_mapped[12] = { 0, 0, 0, 0, 0, 0,
+						 0, 0, 0, 0, 0xff, 0xff };
+	if (memcmp(address, ipv4_mapped, sizeof(ipv4_mapped)) == 0) {
+		inet_ntop(AF_INET, address + 12, out, out_len);
+	} else {
+		inet_ntop(AF_INET6, address, out, out_len);
+	}
+}
+
+// Straight from the ring, so the caller has to check it wasn't overwritten
+// while we were at it before using line
+static void format_record(const shm_ring_record *record, char *line,
+			  size_t line_len)
+{
+	char source_ip[INET6_ADDRSTRLEN];
+	ip_address_string(record->source_ip, source_ip, sizeof(source_ip));
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	int64_t lag_ns =
+		(int64_t)now.tv_sec * 1000000000 + now.tv_nsec - record->seen_ns;
+
+	char uuid[33];
+	for (int i = 0; i < 16; i++) {
+		snprintf(uuid + i * 2, 3, "%02x", record->event_uuid[i]);
+	}
+
+	snprintf(line, line_len, "%s %s %s %s %s \"%s\"%s lag=%" PRId64 "us",
+		 uuid, transport_name(record->transport), source_ip,
+		 shm_ring_record_method(record),
+		 shm_ring_record_called_number(record),
+		 shm_ring_record_user_agent(record),
+		 (record->flags & SHM_RING_FROM_PEER) ? " peer" : "",
+		 lag_ns / 1000);
+}
+
+int main(int argc, char **argv)
+{
+	const char *name = argc > 1 ? argv[1] : "/sentrypeer";
+
+	shm_ring_reader *reader = shm_ring_reader_open(name);
+	if (reader == 0) {
+		fprintf(stderr, "usage: shm_ring_consumer [shm name]\n");
+		return EXIT_FAILURE;
+	}
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+
+	uint64_t dropped = 0;
+	uint64_t reported = 0;
+	while (!stopping) {
+		if (shm_ring_reader_wait(reader, 1000) != EXIT_SUCCESS) {
+			if (shm_ring_reader_closed(reader)) {
+				fprintf(stderr, "SentryPeer has stopped.\n");
+				break;
+			}
+			continue;
+		}
+
+		const shm_ring_record *record;
+		while ((record = shm_ring_reader_next(reader, &dropped)) != 0) {
+			char line[1024];
+			format_record(record, line, sizeof(line));
+			if (!shm_ring_reader_valid(reader)) {
+				dropped++;
+				continue;
+			}
+			puts(line);
+		}
+		if (dropped != reported) {
+			fprintf(stderr, "Missed %" PRIu64 " events.\n",
+				dropped - reported);
+			reported = dropped;
+		}
+		fflush(stdout);
+	}
+
+	shm_ring_reader_close(&reader);
+
+	return EXIT_SUCCESS;
+}
@@ -29,8 +29,20 @@
 #include "test_http_api.h"
 #include "test_http_route_check.h"
 #include "test_ip_address_regex.h"
+#include "test_ip_prefix_tree.h"
+#include "test_ip_address_log.h"
+#include "test_event_stream.h"
+#include "test_metrics.h"
+#include "test_sinks.h"
+#include "test_shm_ring.h"
+#include "test_pcap_ingest.h"
+#include "test_heavy_hitters.h"
+#include "test_event_series.h"
+#include "test_parquet_writer.h"
+#include "test_geoip.h"
 #include "test_sip_message_event.h"
 #include "test_sip_daemon.h"
+#include "test_tcp_conn_table.h"
 
 #if HAVE_RUST != 0
 #include "test_sentrypeer_rust.h"
@@ -70,17 +82,56 @@ int main(void)
 		cmocka_unit_test_setup_teardown(test_db_select_bad_actors,
 						test_setup_sqlite_db,
 						test_teardown_sqlite_db),
+		cmocka_unit_test_setup_teardown(test_db_sip_message_store,
+						test_setup_sqlite_db,
+						test_teardown_sqlite_db),
+		cmocka_unit_test_setup_teardown(test_db_partition,
+						test_setup_sqlite_db,
+						test_teardown_sqlite_db),
+		cmocka_unit_test_setup_teardown(test_db_maintenance,
+						test_setup_sqlite_db,
+						test_teardown_sqlite_db),
+		cmocka_unit_test_setup_teardown(test_db_import,
+						test_setup_sqlite_db,
+						test_teardown_sqlite_db),
+		cmocka_unit_test_setup_teardown(test_db_export,
+						test_setup_sqlite_db,
+						test_teardown_sqlite_db),
+		cmocka_unit_test(test_parquet_writer),
 		cmocka_unit_test_setup_teardown(test_http_api_get,
 						test_setup_sqlite_db,
 						test_teardown_sqlite_db),
 		cmocka_unit_test(test_http_route_check),
 		cmocka_unit_test(test_ip_address_regex),
+		cmocka_unit_test(test_ip_prefix_tree),
+		cmocka_unit_test(test_ip_address_log),
+		cmocka_unit_test(test_event_stream),
+		cmocka_unit_test(test_metrics),
+		cmocka_unit_test_setup_teardown(test_sinks, test_setup_sqlite_db,
+						test_teardown_sqlite_db),
+		cmocka_unit_test(test_shm_ring),
+		cmocka_unit_test_setup_teardown(test_pcap_ingest,
+						test_setup_sqlite_db,
+						test_teardown_sqlite_db),
+		cmocka_unit_test(test_heavy_hitters),
+		cmocka_unit_test_setup_teardown(test_event_series,
+						test_setup_sqlite_db,
+						test_teardown_sqlite_db),
+		cmocka_unit_test(test_geoip),
 		cmocka_unit_test(test_route_regex_check),
 		cmocka_unit_test(test_sip_message_event),
 		cmocka_unit_test(test_sip_daemon),
+		cmocka_unit_test(test_sip_daemon_steering),
+		cmocka_unit_test(test_sip_daemon_io_uring),
+		cmocka_unit_test_setup_teardown(test_sip_daemon_io_uring_events,
+						test_setup_sqlite_db,
+						test_teardown_sqlite_db),
+		cmocka_unit_test(test_tcp_conn_table),
 		cmocka_unit_test_setup_teardown(test_json_logger,
 						test_setup_sqlite_db,
 						test_teardown_sqlite_db),
+		cmocka_unit_test(test_bad_actor_json_write),
+		cmocka_unit_test(test_bad_actor_json_read),
 #if HAVE_RUST != 0
 		cmocka_unit_test(test_sentrypeer_rust),
 #endif
@@ -209,7 +209,11 @@ void test_bad_actor(void **state)
 	assert_non_null(bad_actor_json);
 	free(bad_actor_json);
 
-	assert_int_equal(bad_actor_log(config, bad_actor_event5), EXIT_SUCCESS);
+	json_buffer json;
+	json_buffer_init(&json);
+	assert_int_equal(bad_actor_log(config, bad_actor_event5, &json),
+			 EXIT_SUCCESS);
+	json_buffer_release(&json);
 
 	bad_actor_destroy(&bad_actor_event5);
 	assert_null(bad_actor_event5);
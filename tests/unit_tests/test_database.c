@@ -19,11 +19,23 @@
 
 #include "test_database.h"
 #include "../../src/database.h"
+#include "../../src/db_partition.h"
+#include "../../src/sip_message_store.h"
+#include "../../src/db_maintenance.h"
+#include "../../src/db_import.h"
+#include "../../src/db_export.h"
+#include "../../src/parquet_writer.h"
+#include "../../src/json_logger.h"
+#include "../../src/utils.h"
 
+#include <dirent.h>
+#include <inttypes.h>
 #include <sqlite3.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #define BAD_ACTOR_EVENT_UUID "2ceba0a8-3ac1-426f-9d45-8ecc3f00c21e"
 #define NODE_ID "1f45cc1c-4fd4-11ec-89f0-d05099894ba6"
@@ -327,4 +339,804 @@ void test_db_select_bad_actors(void **state)
 	free(bad_actors);
 	bad_actors = 0;
 	assert_null(bad_actors);
+
+	// The fixture's honey table is from before GeoIP, so there's no
+	// country_code to count until it has been written to
+	heavy_hitters *counters = heavy_hitters_new(16);
+	assert_non_null(counters);
+	assert_int_equal(db_load_heavy_hitters("country_code", counters,
+					       config),
+			 EXIT_SUCCESS);
+	assert_int_equal(heavy_hitters_size(counters), 0);
+	assert_int_equal(db_load_heavy_hitters("source_ip", counters, config),
+			 EXIT_SUCCESS);
+	assert_int_equal(heavy_hitters_size(counters), 1);
+	heavy_hitters_destroy(&counters);
+
+	// Nothing new since the newest row
+	int64_t *cursors = 0;
+	size_t cursor_count = 0;
+	int64_t *next_cursors = 0;
+	size_t next_cursor_count = 0;
+	assert_int_equal(db_select_partition_cursors(&cursors, &cursor_count,
+						     config),
+			 EXIT_SUCCESS);
+	assert_int_equal(cursor_count, 1);
+	assert_int_not_equal(cursors[0], 0);
+	assert_int_equal(db_select_bad_actors_since(cursors, cursor_count,
+						    &bad_actors, &row_count,
+						    &next_cursors,
+						    &next_cursor_count, config),
+			 EXIT_SUCCESS);
+	assert_int_equal(row_count, 0);
+	assert_null(bad_actors);
+	assert_int_equal(next_cursor_count, 1);
+	assert_int_equal(next_cursors[0], cursors[0]);
+	bad_actors_destroy(bad_actors, &row_count);
+	free(bad_actors);
+	free(next_cursors);
+
+	// The cursors go back and forth as text
+	char *cursor_text = db_format_cursors(cursors, cursor_count);
+	int64_t *parsed_cursors = 0;
+	size_t parsed_cursor_count = 0;
+	assert_int_equal(db_parse_cursors(cursor_text, &parsed_cursors,
+					  &parsed_cursor_count),
+			 EXIT_SUCCESS);
+	assert_int_equal(parsed_cursor_count, 1);
+	assert_int_equal(parsed_cursors[0], cursors[0]);
+	free(parsed_cursors);
+	free(cursor_text);
+	assert_int_equal(db_parse_cursors("1,2", &parsed_cursors,
+					  &parsed_cursor_count),
+			 EXIT_SUCCESS);
+	assert_int_equal(parsed_cursor_count, 2);
+	free(parsed_cursors);
+	assert_int_equal(db_parse_cursors("1,", &parsed_cursors,
+					  &parsed_cursor_count),
+			 EXIT_FAILURE);
+	assert_int_equal(db_parse_cursors("-1", &parsed_cursors,
+					  &parsed_cursor_count),
+			 EXIT_FAILURE);
+	assert_int_equal(db_parse_cursors("1,x", &parsed_cursors,
+					  &parsed_cursor_count),
+			 EXIT_FAILURE);
+	assert_null(parsed_cursors);
+	cursor_text = db_format_cursors(0, 0);
+	assert_string_equal(cursor_text, "0");
+	free(cursor_text);
+
+	// Until it's seen again
+	char test_source_ip[] = BAD_ACTOR_SOURCE_IP;
+	char test_transport_type[] = "UDP";
+	char test_collected_method[] = "passive";
+	bad_actor *bad_actor_event =
+		bad_actor_new(0, util_duplicate_string(test_source_ip), 0, 0, 0,
+			      util_duplicate_string(test_transport_type), 0,
+			      util_duplicate_string(test_collected_method),
+			      config->node_id);
+	assert_non_null(bad_actor_event);
+	assert_int_equal(db_insert_bad_actor(bad_actor_event, config),
+			 EXIT_SUCCESS);
+	bad_actor_destroy(&bad_actor_event);
+
+	assert_int_equal(db_select_bad_actors_since(cursors, cursor_count,
+						    &bad_actors, &row_count,
+						    &next_cursors,
+						    &next_cursor_count, config),
+			 EXIT_SUCCESS);
+	assert_int_equal(row_count, 1);
+	assert_string_equal(bad_actors[0]->source_ip, BAD_ACTOR_SOURCE_IP);
+	assert_string_equal(bad_actors[0]->seen_count, "1");
+	assert_int_equal(next_cursor_count, 1);
+	assert_true(next_cursors[0] > cursors[0]);
+	bad_actors_destroy(bad_actors, &row_count);
+	free(bad_actors);
+	free(next_cursors);
+	free(cursors);
+}
+
+// cppcheck-suppress constParameter
+void test_db_sip_message_store(void **state)
+{
+	sentrypeer_config *config = *state;
+	assert_non_null(config);
+
+	char test_sip_message[] =
+		"OPTIONS sip:100@23.148.145.71 SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP 23.148.145.71:5084;branch=z9hG4bK-3054909403;rport\r\n"
+		"From: \"sipvicious\" <sip:100@1.1.1.1>;tag=6434396633623535313363340133343333313138393833\r\n"
+		"To: \"sipvicious\" <sip:100@1.1.1.1>\r\n"
+		"Call-ID: 711444933874895842969934\r\n"
+		"CSeq: 1 OPTIONS\r\n"
+		"Contact: <sip:100@23.148.145.71:5084>\r\n"
+		"Accept: application/sdp\r\n"
+		"User-agent: friendly-scanner\r\n"
+		"Max-forwards: 70\r\n"
+		"Content-Length: 0";
+	char test_source_ip[] = "127.0.0.1";
+	char test_transport_type[] = "UDP";
+	char test_collected_method[] = "passive";
+
+	// Same body twice, then with trailing whitespace from the wire
+	char *event_uuids[3] = { 0 };
+	char *sip_messages[3] = { 0 };
+	for (int i = 0; i < 3; i++) {
+		char *sip_message = malloc(sizeof(test_sip_message) + 4);
+		assert_non_null(sip_message);
+		snprintf(sip_message, sizeof(test_sip_message) + 4, "%s%s",
+			 test_sip_message, i < 2 ? "" : "\r\n\r\n");
+		sip_messages[i] = util_duplicate_string(sip_message);
+
+		bad_actor *bad_actor_event = bad_actor_new(
+			sip_message, util_duplicate_string(test_source_ip), 0,
+			0, 0, util_duplicate_string(test_transport_type), 0,
+			util_duplicate_string(test_collected_method),
+			config->node_id);
+		assert_non_null(bad_actor_event);
+		event_uuids[i] =
+			util_duplicate_string(bad_actor_event->event_uuid);
+
+		assert_int_equal(db_insert_bad_actor(bad_actor_event, config),
+				 EXIT_SUCCESS);
+		bad_actor_destroy(&bad_actor_event);
+		assert_null(bad_actor_event);
+	}
+
+	// One copy of each distinct body is stored
+	sqlite3 *db;
+	sqlite3_stmt *count_stmt;
+	assert_int_equal(sqlite3_open(config->db_file, &db), SQLITE_OK);
+	assert_int_equal(sqlite3_prepare_v2(db,
+					    "SELECT COUNT(*), COUNT(DISTINCT sip_message_id) FROM honey WHERE sip_message_id IS NOT NULL;",
+					    -1, &count_stmt, NULL),
+			 SQLITE_OK);
+	assert_int_equal(sqlite3_step(count_stmt), SQLITE_ROW);
+	assert_int_equal(sqlite3_column_int(count_stmt, 0), 3);
+	assert_int_equal(sqlite3_column_int(count_stmt, 1), 2);
+	assert_int_equal(sqlite3_finalize(count_stmt), SQLITE_OK);
+
+#if HAVE_ZSTD != 0
+	// A dictionary is only trained once there are enough bodies
+	char sip_message[sizeof(test_sip_message) + 32];
+	sqlite3_int64 sip_message_id = 0;
+	assert_int_equal(sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL),
+			 SQLITE_OK);
+	for (int i = 0; i < SIP_MESSAGE_DICT_TRAINING_SAMPLES; i++) {
+		snprintf(sip_message, sizeof(sip_message), "%s\r\nX-Seq: %d",
+			 test_sip_message, i);
+		assert_int_equal(sip_message_store_put(db, sip_message,
+						       &sip_message_id, config),
+				 EXIT_SUCCESS);
+	}
+	assert_int_equal(sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL),
+			 SQLITE_OK);
+	sip_message_store_train_dict(db, config);
+	snprintf(sip_message, sizeof(sip_message), "%s\r\nX-Seq: dict",
+		 test_sip_message);
+	assert_int_equal(sip_message_store_put(db, sip_message, &sip_message_id,
+					       config),
+			 EXIT_SUCCESS);
+	assert_int_equal(sqlite3_prepare_v2(db,
+					    "SELECT encoding FROM sip_messages WHERE sip_message_id = ?;",
+					    -1, &count_stmt, NULL),
+			 SQLITE_OK);
+	sqlite3_bind_int64(count_stmt, 1, sip_message_id);
+	assert_int_equal(sqlite3_step(count_stmt), SQLITE_ROW);
+	assert_int_equal(sqlite3_column_int(count_stmt, 0),
+			 SIP_MESSAGE_ENCODING_ZSTD_DICT);
+	assert_int_equal(sqlite3_finalize(count_stmt), SQLITE_OK);
+	char *stored = sip_message_store_get(db, sip_message_id);
+	assert_string_equal(stored, sip_message);
+	free(stored);
+#endif
+	sqlite3_close(db);
+
+	// Reads decode it transparently, exactly as it came in
+	for (int i = 0; i < 3; i++) {
+		bad_actor *bad_actor_found = 0;
+		assert_int_equal(db_select_bad_actor_by_event_uuid(
+					 event_uuids[i], &bad_actor_found,
+					 config),
+				 EXIT_SUCCESS);
+		assert_non_null(bad_actor_found);
+		assert_string_equal(bad_actor_found->event_uuid,
+				    event_uuids[i]);
+		assert_string_equal(bad_actor_found->sip_message,
+				    sip_messages[i]);
+		bad_actor_destroy(&bad_actor_found);
+		free(event_uuids[i]);
+		free(sip_messages[i]);
+	}
+
+	// Rows from before the sip_messages table still read back
+	bad_actor *legacy_bad_actor = 0;
+	assert_int_equal(db_select_bad_actor_by_event_uuid(BAD_ACTOR_EVENT_UUID,
+							   &legacy_bad_actor,
+							   config),
+			 EXIT_SUCCESS);
+	assert_non_null(legacy_bad_actor->sip_message);
+	assert_string_equal(legacy_bad_actor->source_ip, BAD_ACTOR_SOURCE_IP);
+	bad_actor_destroy(&legacy_bad_actor);
+	assert_null(legacy_bad_actor);
+}
+
+// cppcheck-suppress constParameter
+void test_db_partition(void **state)
+{
+	sentrypeer_config *config = *state;
+	assert_non_null(config);
+	config->db_partition = DB_PARTITION_DAY;
+
+	char today_partition[SENTRYPEER_PATH_MAX + 1];
+	assert_int_equal(db_partition_path(config, time(NULL), today_partition,
+					   sizeof(today_partition)),
+			 EXIT_SUCCESS);
+	char old_partition[] = "./test_sentrypeer-20000101.db";
+
+	char test_source_ip[] = "127.0.0.1";
+	char test_transport_type[] = "UDP";
+	char test_collected_method[] = "passive";
+	bad_actor *bad_actor_event =
+		bad_actor_new(0, util_duplicate_string(test_source_ip), 0, 0, 0,
+			      util_duplicate_string(test_transport_type), 0,
+			      util_duplicate_string(test_collected_method),
+			      config->node_id);
+	assert_non_null(bad_actor_event);
+	assert_int_equal(db_insert_bad_actor(bad_actor_event, config),
+			 EXIT_SUCCESS);
+	assert_int_equal(access(today_partition, F_OK), 0);
+
+	// Same event again, claiming to be from long ago and far ahead, but
+	// that's not believed, so it's today's too and makes no partitions
+	char future_partition[] = "./test_sentrypeer-29991231.db";
+	char *event_timestamp = bad_actor_event->event_timestamp;
+	bad_actor_event->event_timestamp =
+		util_duplicate_string("2000-01-01 12:00:00.000000");
+	assert_int_equal(db_insert_bad_actor(bad_actor_event, config),
+			 EXIT_SUCCESS);
+	free(bad_actor_event->event_timestamp);
+	bad_actor_event->event_timestamp =
+		util_duplicate_string("2999-12-31 12:00:00.000000");
+	assert_int_equal(db_insert_bad_actor(bad_actor_event, config),
+			 EXIT_SUCCESS);
+	free(bad_actor_event->event_timestamp);
+	bad_actor_event->event_timestamp = event_timestamp;
+	assert_int_not_equal(access(old_partition, F_OK), 0);
+	assert_int_not_equal(access(future_partition, F_OK), 0);
+
+	// Where a ?since= client got to before the earlier partition below
+	int64_t *cursors = 0;
+	size_t cursor_count = 0;
+	int64_t *next_cursors = 0;
+	size_t next_cursor_count = 0;
+	assert_int_equal(db_select_partition_cursors(&cursors, &cursor_count,
+						     config),
+			 EXIT_SUCCESS);
+	assert_int_equal(cursor_count, 2);
+	assert_int_equal(DB_CURSOR_PARTITION(cursors[0]),
+			 db_partition_number(config, today_partition));
+
+	// An earlier day's partition, with the same rows in it
+	sqlite3 *db;
+	assert_int_equal(sqlite3_open(today_partition, &db), SQLITE_OK);
+	assert_int_equal(sqlite3_exec(db,
+				      "VACUUM INTO './test_sentrypeer-20000101.db';",
+				      NULL, NULL, NULL),
+			 SQLITE_OK);
+	assert_int_equal(sqlite3_close(db), SQLITE_OK);
+
+	// Fans out over both partitions plus the rows already in TEST_DB_FILE
+	assert_true(db_bad_actor_exists(bad_actor_event->event_uuid, config));
+	assert_true(db_bad_actor_exists(BAD_ACTOR_EVENT_UUID, config));
+
+	bad_actor **bad_actors = 0;
+	int64_t row_count = 0;
+	assert_int_equal(db_select_bad_actors(&bad_actors, &row_count, config),
+			 EXIT_SUCCESS);
+	assert_int_equal(row_count, 2);
+	for (int64_t i = 0; i < row_count; i++) {
+		if (strcmp(bad_actors[i]->source_ip, test_source_ip) == 0) {
+			assert_string_equal(bad_actors[i]->seen_count, "6");
+		}
+	}
+	bad_actors_destroy(bad_actors, &row_count);
+	free(bad_actors);
+	bad_actor_destroy(&bad_actor_event);
+
+	// The rows that landed in the earlier partition after today's are
+	// still new, as it has no cursor yet
+	assert_int_equal(db_select_bad_actors_since(cursors, cursor_count,
+						    &bad_actors, &row_count,
+						    &next_cursors,
+						    &next_cursor_count, config),
+			 EXIT_SUCCESS);
+	assert_int_equal(row_count, 1);
+	assert_string_equal(bad_actors[0]->source_ip, test_source_ip);
+	assert_string_equal(bad_actors[0]->seen_count, "3");
+	assert_int_equal(next_cursor_count, 3);
+	assert_int_equal(next_cursors[0], cursors[0]);
+	assert_int_equal(DB_CURSOR_PARTITION(next_cursors[1]),
+			 db_partition_number(config, old_partition));
+	bad_actors_destroy(bad_actors, &row_count);
+	free(bad_actors);
+	free(cursors);
+	cursors = next_cursors;
+	cursor_count = next_cursor_count;
+
+	// Then they aren't
+	assert_int_equal(db_select_bad_actors_since(cursors, cursor_count,
+						    &bad_actors, &row_count,
+						    &next_cursors,
+						    &next_cursor_count, config),
+			 EXIT_SUCCESS);
+	assert_int_equal(row_count, 0);
+	assert_int_equal(next_cursor_count, 3);
+	bad_actors_destroy(bad_actors, &row_count);
+	free(bad_actors);
+	free(next_cursors);
+
+	// Everything after the rows from before partitioning
+	int64_t main_cursor = DB_CURSOR(0, INT64_C(1) << 30);
+	assert_int_equal(db_select_bad_actors_since(&main_cursor, 1,
+						    &bad_actors, &row_count,
+						    &next_cursors,
+						    &next_cursor_count, config),
+			 EXIT_SUCCESS);
+	assert_int_equal(row_count, 1);
+	assert_string_equal(bad_actors[0]->seen_count, "6");
+	assert_int_equal(next_cursor_count, 3);
+	assert_int_equal(next_cursors[0], cursors[0]);
+	bad_actors_destroy(bad_actors, &row_count);
+	free(bad_actors);
+	free(next_cursors);
+	free(cursors);
+
+	// Only the old partition is past retention
+	config->db_retention_days = 30;
+	assert_int_equal(db_partition_retention(config), EXIT_SUCCESS);
+	assert_int_not_equal(access(old_partition, F_OK), 0);
+	assert_int_equal(access(today_partition, F_OK), 0);
+
+	assert_int_equal(remove(today_partition), EXIT_SUCCESS);
+}
+
+static int test_db_pragma_int(sqlite3 *db, const char *pragma)
+{
+	sqlite3_stmt *stmt = 0;
+	assert_int_equal(sqlite3_prepare_v2(db, pragma, -1, &stmt, NULL),
+			 SQLITE_OK);
+	assert_int_equal(sqlite3_step(stmt), SQLITE_ROW);
+	int value = sqlite3_column_int(stmt, 0);
+	sqlite3_finalize(stmt);
+
+	return value;
+}
+
+// cppcheck-suppress constParameter
+void test_db_maintenance(void **state)
+{
+	sentrypeer_config *config = *state;
+	assert_non_null(config);
+
+	db_maintenance_stats before;
+	db_maintenance_stats_get(&before);
+
+	// Leave some free pages behind to give back
+	sqlite3 *db;
+	assert_int_equal(sqlite3_open(config->db_file, &db), SQLITE_OK);
+	assert_int_equal(sqlite3_exec(db,
+				      "CREATE TABLE filler (data BLOB);"
+				      "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 2000)"
+				      " INSERT INTO filler SELECT zeroblob(4096) FROM n;"
+				      "DROP TABLE filler;",
+				      NULL, NULL, NULL),
+			 SQLITE_OK);
+	assert_int_equal(sqlite3_close(db), SQLITE_OK);
+
+	assert_int_equal(db_maintenance_pass(config), EXIT_SUCCESS);
+
+	db_maintenance_stats after;
+	db_maintenance_stats_get(&after);
+	assert_int_equal(after.passes, before.passes + 1);
+	assert_true(after.last_pass_ms >= 0);
+
+	// The fixture's file is from before auto_vacuum, which a pass leaves
+	// for --vacuum
+	assert_int_equal(sqlite3_open(config->db_file, &db), SQLITE_OK);
+	assert_int_not_equal(test_db_pragma_int(db, "PRAGMA auto_vacuum;"),
+			     DB_AUTO_VACUUM_INCREMENTAL);
+	assert_true(test_db_pragma_int(db, "PRAGMA freelist_count;") >=
+		    DB_MAINTENANCE_FREELIST_PAGES);
+	assert_int_equal(test_db_pragma_int(db, DB_HAS_STATS), 1);
+	assert_int_equal(sqlite3_close(db), SQLITE_OK);
+
+	assert_int_equal(db_maintenance_vacuum(config), EXIT_SUCCESS);
+	assert_int_equal(sqlite3_open(config->db_file, &db), SQLITE_OK);
+	assert_int_equal(test_db_pragma_int(db, "PRAGMA auto_vacuum;"),
+			 DB_AUTO_VACUUM_INCREMENTAL);
+	assert_true(test_db_pragma_int(db, "PRAGMA freelist_count;") <
+		    DB_MAINTENANCE_FREELIST_PAGES);
+	sqlite3_stmt *stmt = 0;
+	assert_int_equal(sqlite3_prepare_v2(db, "PRAGMA journal_mode;", -1,
+					    &stmt, NULL),
+			 SQLITE_OK);
+	assert_int_equal(sqlite3_step(stmt), SQLITE_ROW);
+	assert_string_equal((const char *)sqlite3_column_text(stmt, 0), "wal");
+	sqlite3_finalize(stmt);
+	assert_int_equal(sqlite3_close(db), SQLITE_OK);
+
+	// Nothing we logged has gone
+	assert_true(db_bad_actor_exists(BAD_ACTOR_EVENT_UUID, config));
+}
+
+#define TEST_IMPORT_FILES 3
+#define TEST_IMPORT_EVENTS 40
+
+static void test_db_import_line(FILE *json_log, const bad_actor *event)
+{
+	json_buffer buffer;
+	json_buffer_init(&buffer);
+	assert_int_equal(bad_actor_json_write(event, &buffer), EXIT_SUCCESS);
+	assert_int_equal(fwrite(buffer.data, buffer.len, 1, json_log), 1);
+	assert_int_equal(fputc('\n', json_log), '\n');
+	json_buffer_release(&buffer);
+}
+
+// cppcheck-suppress constParameter
+void test_db_import(void **state)
+{
+	sentrypeer_config *config = *state;
+	assert_non_null(config);
+
+	char *files[TEST_IMPORT_FILES];
+	char file_names[TEST_IMPORT_FILES][32];
+	char uuids[TEST_IMPORT_FILES * TEST_IMPORT_EVENTS]
+		  [UTILS_UUID_STRING_LEN];
+	size_t uuid_count = 0;
+
+	for (size_t i = 0; i < TEST_IMPORT_FILES; i++) {
+		snprintf(file_names[i], sizeof(file_names[i]),
+			 "test_import_%zu.json", i);
+		files[i] = file_names[i];
+		FILE *json_log = fopen(files[i], "w");
+		assert_non_null(json_log);
+
+		for (size_t j = 0; j < TEST_IMPORT_EVENTS; j++) {
+			char called_number[16];
+			snprintf(called_number, sizeof(called_number), "%zu",
+				 uuid_count);
+			bad_actor *event = bad_actor_new(
+				util_duplicate_string(
+					"OPTIONS sip:100@127.0.0.1 SIP/2.0"),
+				util_duplicate_string(BAD_ACTOR_SOURCE_IP),
+				util_duplicate_string("127.0.0.1"),
+				util_duplicate_string(called_number),
+				util_duplicate_string("OPTIONS"),
+				util_duplicate_string("UDP"),
+				util_duplicate_string("friendly-scanner"),
+				util_duplicate_string("passive"), NODE_ID);
+			assert_non_null(event);
+			assert_int_equal(strlen(event->event_uuid),
+					 UTILS_UUID_STRING_LEN - 1);
+			strcpy(uuids[uuid_count++], event->event_uuid);
+			test_db_import_line(json_log, event);
+			bad_actor_destroy(&event);
+
+			if (i == 0 && j == 10) {
+				// Skipped, apart from the bad json
+				assert_true(fputs("\r\n\n{\"event_uuid\": 1}\n",
+						  json_log) >= 0);
+
+				// Already in the database
+				event = bad_actor_new(
+					util_duplicate_string("OPTIONS"),
+					util_duplicate_string(
+						BAD_ACTOR_SOURCE_IP),
+					util_duplicate_string("127.0.0.1"),
+					util_duplicate_string("100"),
+					util_duplicate_string("OPTIONS"),
+					util_duplicate_string("UDP"),
+					util_duplicate_string("scanner"),
+					util_duplicate_string("passive"),
+					NODE_ID);
+				free(event->event_uuid);
+				event->event_uuid =
+					util_duplicate_string(BAD_ACTOR_EVENT_UUID);
+				test_db_import_line(json_log, event);
+				bad_actor_destroy(&event);
+			}
+		}
+		assert_int_equal(fclose(json_log), 0);
+	}
+
+	db_import_stats stats;
+	assert_int_equal(db_import_json_files(config, files, 1, 1, &stats),
+			 EXIT_SUCCESS);
+	assert_int_equal(stats.imported, TEST_IMPORT_EVENTS);
+	bad_actor *bad_actor_found = 0;
+	assert_int_equal(db_select_bad_actor_by_event_uuid(
+				 uuids[0], &bad_actor_found, config),
+			 EXIT_SUCCESS);
+	assert_non_null(bad_actor_found);
+	assert_string_equal(bad_actor_found->sip_message,
+			    "OPTIONS sip:100@127.0.0.1 SIP/2.0");
+	bad_actor_destroy(&bad_actor_found);
+
+	// The first event again, as if from another node's log
+	char first_line[4096];
+	FILE *json_log = fopen(files[0], "r");
+	assert_non_null(json_log);
+	assert_non_null(fgets(first_line, sizeof(first_line), json_log));
+	assert_int_equal(fclose(json_log), 0);
+	json_log = fopen(files[TEST_IMPORT_FILES - 1], "a");
+	assert_non_null(json_log);
+	assert_true(fputs(first_line, json_log) >= 0);
+	assert_int_equal(fclose(json_log), 0);
+
+	// The first file again, with the rest
+	assert_int_equal(db_import_json_files(config, files, TEST_IMPORT_FILES,
+					      3, &stats),
+			 EXIT_SUCCESS);
+	assert_int_equal(stats.files, TEST_IMPORT_FILES);
+	assert_int_equal(stats.lines, uuid_count + 3);
+	assert_int_equal(stats.imported, uuid_count - TEST_IMPORT_EVENTS);
+	assert_int_equal(stats.duplicates, TEST_IMPORT_EVENTS + 2);
+	assert_int_equal(stats.failed, 1);
+
+	// In the order they were in the files, with the indexes put back
+	sqlite3 *db;
+	sqlite3_stmt *stmt = 0;
+	assert_int_equal(sqlite3_open(config->db_file, &db), SQLITE_OK);
+	assert_int_equal(
+		sqlite3_prepare_v2(
+			db,
+			"SELECT event_uuid FROM honey WHERE event_uuid != ?"
+			" ORDER BY honey_id;",
+			-1, &stmt, NULL),
+		SQLITE_OK);
+	assert_int_equal(sqlite3_bind_text(stmt, 1, BAD_ACTOR_EVENT_UUID, -1,
+					   SQLITE_STATIC),
+			 SQLITE_OK);
+	size_t row = 0;
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		assert_true(row < uuid_count);
+		assert_string_equal((const char *)sqlite3_column_text(stmt, 0),
+				    uuids[row]);
+		row++;
+	}
+	assert_int_equal(row, uuid_count);
+	sqlite3_finalize(stmt);
+
+	assert_int_equal(
+		sqlite3_prepare_v2(
+			db,
+			"SELECT count(*) FROM sqlite_master WHERE type = 'index' AND name IN"
+			" ('source_ip_index', 'called_number_index', 'event_uuid_index');",
+			-1, &stmt, NULL),
+		SQLITE_OK);
+	assert_int_equal(sqlite3_step(stmt), SQLITE_ROW);
+	assert_int_equal(sqlite3_column_int(stmt, 0), 3);
+	sqlite3_finalize(stmt);
+	assert_int_equal(sqlite3_close(db), SQLITE_OK);
+
+	// Missing files import nothing
+	char *missing[] = { "test_import_missing.json" };
+	assert_int_equal(db_import_json_files(config, missing, 1, 0, &stats),
+			 EXIT_FAILURE);
+	assert_int_equal(stats.imported, 0);
+
+	for (size_t i = 0; i < TEST_IMPORT_FILES; i++) {
+		assert_int_equal(remove(files[i]), 0);
+	}
+}
+
+#define TEST_EXPORT_DIR "test_parquet_export"
+#define TEST_EXPORT_EVENTS 40
+
+static void test_db_export_insert(sentrypeer_config const *config,
+				  size_t count, size_t first)
+{
+	bad_actor **events = calloc(count, sizeof(*events));
+	assert_non_null(events);
+
+	for (size_t i = 0; i < count; i++) {
+		char called_number[16];
+		snprintf(called_number, sizeof(called_number), "%zu",
+			 first + i);
+		events[i] = bad_actor_new(
+			util_duplicate_string(
+				"OPTIONS sip:100@127.0.0.1 SIP/2.0"),
+			util_duplicate_string(BAD_ACTOR_SOURCE_IP),
+			util_duplicate_string("127.0.0.1"),
+			util_duplicate_string(called_number),
+			util_duplicate_string("OPTIONS"),
+			util_duplicate_string("UDP"),
+			// Some without a User-Agent
+			(first + i) % 3 == 0 ?
+				0 :
+				util_duplicate_string("friendly-scanner"),
+			util_duplicate_string("passive"), NODE_ID);
+		assert_non_null(events[i]);
+
+		// Every other one the day before
+		free(events[i]->event_timestamp);
+		events[i]->event_timestamp = util_duplicate_string(
+			(first + i) % 2 == 0 ? "2026-10-18 23:59:59.000000000" :
+					       "2026-10-19 00:00:01.000000000");
+	}
+
+	assert_int_equal(db_insert_bad_actors((bad_actor const *const *)events,
+					      count, config),
+			 EXIT_SUCCESS);
+
+	for (size_t i = 0; i < count; i++) {
+		bad_actor_destroy(&events[i]);
+	}
+	free(events);
+}
+
+// How many Parquet files are in a day's directory, checking each one
+// starts and ends with the magic
+static size_t test_db_export_files(const char *day)
+{
+	char day_dir[128];
+	snprintf(day_dir, sizeof(day_dir), "%s/day=%s", TEST_EXPORT_DIR, day);
+	DIR *dir = opendir(day_dir);
+	assert_non_null(dir);
+
+	size_t files = 0;
+	const struct dirent *entry;
+	while ((entry = readdir(dir)) != 0) {
+		// No temporary files left behind
+		assert_int_not_equal(entry->d_name[0], '_');
+		if (entry->d_name[0] == '.') {
+			assert_true(strcmp(entry->d_name, ".") == 0 ||
+				    strcmp(entry->d_name, "..") == 0);
+			continue;
+		}
+		assert_non_null(strstr(entry->d_name, ".parquet"));
+
+		char path[512];
+		snprintf(path, sizeof(path), "%s/%s", day_dir, entry->d_name);
+		FILE *parquet = fopen(path, "rb");
+		assert_non_null(parquet);
+		char magic[PARQUET_MAGIC_LEN];
+		assert_int_equal(fread(magic, 1, sizeof(magic), parquet),
+				 PARQUET_MAGIC_LEN);
+		assert_memory_equal(magic, PARQUET_MAGIC, PARQUET_MAGIC_LEN);
+		assert_int_equal(fseek(parquet, -PARQUET_MAGIC_LEN, SEEK_END),
+				 0);
+		assert_int_equal(fread(magic, 1, sizeof(magic), parquet),
+				 PARQUET_MAGIC_LEN);
+		assert_memory_equal(magic, PARQUET_MAGIC, PARQUET_MAGIC_LEN);
+		assert_int_equal(fclose(parquet), 0);
+		files++;
+	}
+	closedir(dir);
+
+	return files;
+}
+
+static void test_db_export_remove(const char *path)
+{
+	DIR *dir = opendir(path);
+	if (dir != 0) {
+		const struct dirent *entry;
+		while ((entry = readdir(dir)) != 0) {
+			if (strcmp(entry->d_name, ".") == 0 ||
+			    strcmp(entry->d_name, "..") == 0) {
+				continue;
+			}
+			char child[512];
+			snprintf(child, sizeof(child), "%s/%s", path,
+				 entry->d_name);
+			test_db_export_remove(child);
+		}
+		closedir(dir);
+	}
+	assert_int_equal(remove(path), 0);
+}
+
+// cppcheck-suppress constParameter
+void test_db_export(void **state)
+{
+	sentrypeer_config *config = *state;
+	assert_non_null(config);
+
+	test_db_export_insert(config, TEST_EXPORT_EVENTS, 0);
+
+	// The setup row, from before sip_messages, and ours over two days
+	db_export_stats stats;
+	assert_int_equal(db_export_parquet(config, TEST_EXPORT_DIR, &stats),
+			 EXIT_SUCCESS);
+	assert_int_equal(stats.rows, TEST_EXPORT_EVENTS + 1);
+	assert_int_equal(stats.files, 3);
+	assert_int_equal(test_db_export_files("2020-11-18"), 1);
+	assert_int_equal(test_db_export_files("2026-10-18"), 1);
+	assert_int_equal(test_db_export_files("2026-10-19"), 1);
+
+	int64_t *cursors = 0;
+	size_t cursor_count = 0;
+	assert_int_equal(db_select_partition_cursors(&cursors, &cursor_count,
+						     config),
+			 EXIT_SUCCESS);
+	assert_int_equal(cursor_count, 1);
+	int64_t cursor = cursors[0];
+	free(cursors);
+	assert_int_equal(stats.cursor, cursor);
+	FILE *cursor_file = fopen(TEST_EXPORT_DIR "/" DB_EXPORT_CURSOR_FILE,
+				  "r");
+	assert_non_null(cursor_file);
+	int64_t saved_cursor = 0;
+	assert_int_equal(fscanf(cursor_file, "%" SCNd64, &saved_cursor), 1);
+	assert_int_equal(fclose(cursor_file), 0);
+	assert_int_equal(saved_cursor, cursor);
+
+	// Nothing new
+	assert_int_equal(db_export_parquet(config, TEST_EXPORT_DIR, &stats),
+			 EXIT_SUCCESS);
+	assert_int_equal(stats.rows, 0);
+	assert_int_equal(stats.files, 0);
+	assert_int_equal(stats.cursor, cursor);
+
+	// Only the new row, in a file of its own
+	test_db_export_insert(config, 1, 1);
+	assert_int_equal(db_export_parquet(config, TEST_EXPORT_DIR, &stats),
+			 EXIT_SUCCESS);
+	assert_int_equal(stats.rows, 1);
+	assert_int_equal(stats.files, 1);
+	assert_true(stats.cursor > cursor);
+	assert_int_equal(test_db_export_files("2026-10-18"), 1);
+	assert_int_equal(test_db_export_files("2026-10-19"), 2);
+
+	// With partitioning on, a row that lands in an older partition after
+	// a newer one was exported, as db_import does, still goes out once
+	config->db_partition = DB_PARTITION_DAY;
+	time_t now = time(NULL);
+	char partitions[2][SENTRYPEER_PATH_MAX + 1];
+	for (size_t i = 0; i < 2; i++) {
+		assert_int_equal(db_partition_path(config, now - (time_t)i * 86400,
+						   partitions[i],
+						   sizeof(partitions[i])),
+				 EXIT_SUCCESS);
+	}
+	test_db_export_insert(config, 1, 1);
+	assert_int_equal(db_export_parquet(config, TEST_EXPORT_DIR, &stats),
+			 EXIT_SUCCESS);
+	assert_int_equal(stats.rows, 1);
+	cursor = stats.cursor;
+	sqlite3 *db;
+	char vacuum_into[SENTRYPEER_PATH_MAX + 32];
+	snprintf(vacuum_into, sizeof(vacuum_into), "VACUUM INTO '%s';",
+		 partitions[1]);
+	assert_int_equal(sqlite3_open(partitions[0], &db), SQLITE_OK);
+	assert_int_equal(sqlite3_exec(db, vacuum_into, NULL, NULL, NULL),
+			 SQLITE_OK);
+	assert_int_equal(sqlite3_close(db), SQLITE_OK);
+	assert_int_equal(db_export_parquet(config, TEST_EXPORT_DIR, &stats),
+			 EXIT_SUCCESS);
+	assert_int_equal(stats.rows, 1);
+	assert_int_equal(stats.cursor, cursor);
+	assert_int_equal(test_db_export_files("2026-10-19"), 4);
+	assert_int_equal(db_export_parquet(config, TEST_EXPORT_DIR, &stats),
+			 EXIT_SUCCESS);
+	assert_int_equal(stats.rows, 0);
+
+	// A cursor file from before there was one per partition carries on
+	// from its cursor
+	cursor_file = fopen(TEST_EXPORT_DIR "/" DB_EXPORT_CURSOR_FILE, "w");
+	assert_non_null(cursor_file);
+	assert_true(fprintf(cursor_file, "%" PRId64 "\n", cursor) > 0);
+	assert_int_equal(fclose(cursor_file), 0);
+	assert_int_equal(db_export_parquet(config, TEST_EXPORT_DIR, &stats),
+			 EXIT_SUCCESS);
+	assert_int_equal(stats.rows, 0);
+
+	for (size_t i = 0; i < 2; i++) {
+		assert_int_equal(remove(partitions[i]), EXIT_SUCCESS);
+	}
+	config->db_partition = DB_PARTITION_NONE;
+
+	test_db_export_remove(TEST_EXPORT_DIR);
 }
@@ -23,5 +23,10 @@ void test_open_select_close_sqlite_db(void **state);
 void test_db_insert_bad_actor(void **state);
 void test_db_select_bad_actor(void **state);
 void test_db_select_bad_actors(void **state);
+void test_db_sip_message_store(void **state);
+void test_db_partition(void **state);
+void test_db_maintenance(void **state);
+void test_db_import(void **state);
+void test_db_export(void **state);
 
 #endif //SENTRYPEER_TEST_DATABASE_H
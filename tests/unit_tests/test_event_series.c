@@ -0,0 +1,214 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/* 
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+
+#include "test_event_series.h"
+#include "../../src/event_series.h"
+#include "../../src/database.h"
+#include "../../src/utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TEST_SERIES_HONEY_EVENTS 3
+
+static uint64_t test_event_series_total(const event_series_point *point)
+{
+	uint64_t total = 0;
+	for (size_t key = 0; key < EVENT_SERIES_KEYS; key++) {
+		total += point->counts[key];
+	}
+
+	return total;
+}
+
+static void test_event_series_insert(sentrypeer_config const *config)
+{
+	for (int i = 0; i < TEST_SERIES_HONEY_EVENTS; i++) {
+		bad_actor *bad_actor_event = bad_actor_new(
+			util_duplicate_string(
+				"INVITE sip:100@127.0.0.1 SIP/2.0"),
+			util_duplicate_string("104.149.141.214"),
+			util_duplicate_string("127.0.0.1"),
+			util_duplicate_string("100"),
+			util_duplicate_string("INVITE"),
+			util_duplicate_string("TCP"),
+			util_duplicate_string("friendly-scanner"),
+			util_duplicate_string("responsive"), config->node_id);
+		assert_non_null(bad_actor_event);
+		assert_int_equal(db_insert_bad_actor(bad_actor_event, config),
+				 EXIT_SUCCESS);
+		bad_actor_destroy(&bad_actor_event);
+	}
+}
+
+void test_event_series(void **state)
+{
+	sentrypeer_config *config = *state;
+	assert_non_null(config);
+
+	event_series *series = event_series_new();
+	assert_non_null(series);
+
+	// The start of the hour before this one, so all of it has happened
+	time_t now = time(NULL);
+	time_t hour =
+		now - now % EVENT_SERIES_HOUR - EVENT_SERIES_HOUR;
+
+	event_series_add(series, hour + 10, "OPTIONS", "UDP",
+			 "passive", 1);
+	event_series_add(series, hour + 70, "OPTIONS", "UDP",
+			 "passive", 2);
+	event_series_add(series, hour + 70, "INVITE", "TCP",
+			 "responsive", 1);
+	event_series_add(series, hour + 80, 0, 0, 0, 1);
+	assert_int_equal(event_series_newest(series, EVENT_SERIES_MINUTE),
+			 hour + 60);
+	assert_int_equal(event_series_newest(series, EVENT_SERIES_HOUR),
+			 hour);
+
+	event_series_range *range = event_series_query(
+		series, hour, hour + 180, 60);
+	assert_non_null(range);
+	assert_int_equal(range->resolution, EVENT_SERIES_MINUTE);
+	assert_int_equal(range->key_count, 3);
+	assert_int_equal(range->point_count, 3);
+	assert_int_equal(range->points[0].time, hour);
+	assert_int_equal(test_event_series_total(&range->points[0]), 1);
+	assert_int_equal(test_event_series_total(&range->points[1]), 4);
+	assert_int_equal(range->points[1].counts[0], 2);
+	assert_string_equal(range->keys[1].method, "INVITE");
+	assert_string_equal(range->keys[2].method, "");
+	assert_int_equal(test_event_series_total(&range->points[2]), 0);
+	event_series_range_destroy(&range);
+	assert_null(range);
+
+	// Hour steps come from the hour buckets, a point per step
+	range = event_series_query(series, hour + 1800,
+				   hour + 2 * 3600, 3600);
+	assert_non_null(range);
+	assert_int_equal(range->resolution, EVENT_SERIES_HOUR);
+	assert_int_equal(range->point_count, 2);
+	assert_int_equal(test_event_series_total(&range->points[0]), 5);
+	event_series_range_destroy(&range);
+
+	// Wide steps in minutes still come from the minute buckets
+	range = event_series_query(series, hour - 1000 * 3540,
+				   hour + 1000 * 3540, 3540);
+	assert_non_null(range);
+	assert_int_equal(range->resolution, EVENT_SERIES_MINUTE);
+	uint64_t wide_total = 0;
+	for (size_t i = 0; i < range->point_count; i++) {
+		wide_total += test_event_series_total(&range->points[i]);
+	}
+	assert_int_equal(wide_total, 5);
+	event_series_range_destroy(&range);
+
+	// Not a whole minute, backwards and too many points
+	assert_null(event_series_query(series, hour,
+				       hour + 180, 30));
+	assert_null(event_series_query(series, hour + 180,
+				       hour, 60));
+	assert_null(event_series_query(
+		series, hour,
+		hour + (EVENT_SERIES_POINTS_MAX + 1) * 60, 60));
+
+	// Two days back is older than the minute ring goes, so it's only
+	// counted by hour
+	time_t older = hour -
+		       (time_t)EVENT_SERIES_MINUTES * EVENT_SERIES_MINUTE;
+	event_series_add(series, older + 20, "OPTIONS", "UDP", "passive", 7);
+	range = event_series_query(series, older, older + 60, 60);
+	assert_non_null(range);
+	assert_int_equal(test_event_series_total(&range->points[0]), 0);
+	event_series_range_destroy(&range);
+	range = event_series_query(series, older, older + 3600, 3600);
+	assert_non_null(range);
+	assert_int_equal(test_event_series_total(&range->points[0]), 7);
+	event_series_range_destroy(&range);
+
+	// Changed buckets are taken once, and again if saving them failed
+	event_series_count *counts = 0;
+	size_t count = 0;
+	event_series_take_dirty(series, &counts, &count);
+	assert_int_equal(count, 8);
+	event_series_mark_dirty(series, counts, count);
+	free(counts);
+	event_series_take_dirty(series, &counts, &count);
+	assert_int_equal(count, 8);
+	free(counts);
+	event_series_take_dirty(series, &counts, &count);
+	assert_int_equal(count, 0);
+	free(counts);
+
+	// A clock two days ahead would land in the slot this minute needs,
+	// so it's not counted and doesn't stop what's happening now counting
+	time_t ahead = now + (time_t)EVENT_SERIES_MINUTES * EVENT_SERIES_MINUTE;
+	event_series_add(series, ahead, "OPTIONS", "UDP", "passive", 100);
+	event_series_set(series, EVENT_SERIES_HOUR,
+			 ahead - ahead % EVENT_SERIES_HOUR, "OPTIONS", "UDP",
+			 "passive", 100);
+	event_series_add(series, now, "OPTIONS", "UDP", "passive", 3);
+	event_series_add(series, now, "OPTIONS", "UDP", "passive", 2);
+	assert_true(event_series_newest(series, EVENT_SERIES_MINUTE) <= now);
+	assert_true(event_series_newest(series, EVENT_SERIES_HOUR) <= now);
+	range = event_series_query(series, now - now % 60, now + 60, 60);
+	assert_non_null(range);
+	assert_int_equal(test_event_series_total(&range->points[0]), 5);
+	event_series_range_destroy(&range);
+	event_series_destroy(&series);
+	assert_null(series);
+
+	// Saved counts survive a restart, and the newest saved hour is
+	// counted again from honey
+	now = time(NULL);
+	time_t earlier = now - 3 * EVENT_SERIES_HOUR;
+	test_event_series_insert(config);
+	series = event_series_new();
+	assert_non_null(series);
+	assert_int_equal(db_load_event_series(series, config), EXIT_SUCCESS);
+	event_series_add(series, earlier, "OPTIONS", "UDP", "passive", 5);
+	assert_int_equal(db_save_event_series(series, config), EXIT_SUCCESS);
+	event_series_destroy(&series);
+
+	series = event_series_new();
+	assert_non_null(series);
+	assert_int_equal(db_load_event_series(series, config), EXIT_SUCCESS);
+	range = event_series_query(series, earlier - earlier % 3600,
+				   now + EVENT_SERIES_HOUR, EVENT_SERIES_HOUR);
+	assert_non_null(range);
+	assert_int_equal(test_event_series_total(&range->points[0]), 5);
+	uint64_t total = 0;
+	for (size_t i = 0; i < range->point_count; i++) {
+		total += test_event_series_total(&range->points[i]);
+	}
+	assert_int_equal(total, 5 + TEST_SERIES_HONEY_EVENTS);
+	event_series_range_destroy(&range);
+
+	// And by minute, whichever minute they landed in
+	range = event_series_query(series, now - 600, now + 120, 60);
+	assert_non_null(range);
+	total = 0;
+	for (size_t i = 0; i < range->point_count; i++) {
+		total += test_event_series_total(&range->points[i]);
+	}
+	assert_int_equal(total, TEST_SERIES_HONEY_EVENTS);
+	event_series_range_destroy(&range);
+	event_series_destroy(&series);
+}
@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/* 
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+
+#include "test_event_stream.h"
+#include "../../src/event_stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+void test_event_stream(void **state)
+{
+	(void)state; /* unused */
+
+	event_stream *stream = event_stream_new(4);
+	assert_non_null(stream);
+	assert_false(event_stream_has_subscribers(stream));
+
+	// Only what's published after subscribing
+	event_stream_publish(stream, "{\"event\": \"before\"}");
+	uint64_t next = 0;
+	assert_int_equal(event_stream_subscribe(stream, &next), EXIT_SUCCESS);
+	assert_true(event_stream_has_subscribers(stream));
+	assert_int_equal(next, 1);
+
+	char *json = 0;
+	uint64_t dropped = 0;
+	assert_int_equal(event_stream_next(stream, &next, &json, &dropped, 0),
+			 EVENT_STREAM_TIMEOUT);
+
+	event_stream_publish(stream, "{\"event\": 1}");
+	event_stream_publish(stream, "{\"event\": 2}");
+	assert_int_equal(event_stream_next(stream, &next, &json, &dropped, 0),
+			 EVENT_STREAM_EVENT);
+	assert_string_equal(json, "{\"event\": 1}");
+	free(json);
+	assert_int_equal(next, 2);
+
+	// Fall more than the capacity behind and the oldest are gone
+	char event[32];
+	for (int i = 3; i <= 9; i++) {
+		snprintf(event, sizeof(event), "{\"event\": %d}", i);
+		event_stream_publish(stream, event);
+	}
+	assert_int_equal(event_stream_next(stream, &next, &json, &dropped, 0),
+			 EVENT_STREAM_LAGGED);
+	assert_int_equal(dropped, 4);
+	assert_int_equal(next, 6);
+	assert_int_equal(event_stream_next(stream, &next, &json, &dropped, 0),
+			 EVENT_STREAM_EVENT);
+	assert_string_equal(json, "{\"event\": 6}");
+	free(json);
+
+	// Waiting only says there's something new, and where the stream is
+	uint64_t head = 0;
+	assert_int_equal(event_stream_wait(stream, &head, 0),
+			 EVENT_STREAM_EVENT);
+	assert_int_equal(head, 10);
+	assert_int_equal(event_stream_wait(stream, &head, 0),
+			 EVENT_STREAM_TIMEOUT);
+	assert_int_equal(head, 10);
+	assert_int_equal(next, 7);
+
+	event_stream_close(stream);
+	assert_int_equal(event_stream_next(stream, &next, &json, &dropped, 0),
+			 EVENT_STREAM_CLOSED);
+	assert_int_equal(event_stream_wait(stream, &head, 1),
+			 EVENT_STREAM_CLOSED);
+	assert_int_equal(event_stream_subscribe(stream, &next), EXIT_FAILURE);
+
+	event_stream_unsubscribe(stream);
+	assert_false(event_stream_has_subscribers(stream));
+
+	event_stream_destroy(&stream);
+	assert_null(stream);
+}
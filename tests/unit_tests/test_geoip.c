@@ -0,0 +1,297 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/* 
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+
+#include "test_geoip.h"
+#include "../../src/geoip.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#define TEST_GEOIP_DB "./test_sentrypeer_geoip.mmdb"
+#define FIXTURE_MAX_NODES 256
+#define FIXTURE_EMPTY 0xffffffff
+#define FIXTURE_DATA 0x80000000
+
+// Just enough of a MaxMind DB writer to make a fixture, so the tests run
+// offline. See https://maxmind.github.io/MaxMind-DB/
+typedef struct fixture fixture;
+struct fixture {
+	uint32_t records[FIXTURE_MAX_NODES][2];
+	uint32_t node_count;
+	uint8_t data[1024];
+	size_t data_len;
+	uint8_t metadata[256];
+	size_t metadata_len;
+};
+
+static void fixture_insert(fixture *f, const char *address, int prefix_len,
+			   uint32_t data_offset)
+{
+	// IPv4 goes under ::/96 in an IPv6 tree
+	uint8_t key[16] = { 0 };
+	if (inet_pton(AF_INET, address, key + 12) == 1) {
+		prefix_len += 96;
+	} else {
+		assert_int_equal(inet_pton(AF_INET6, address, key), 1);
+	}
+
+	uint32_t node = 0;
+	for (int i = 0; i < prefix_len; i++) {
+		int bit = (key[i / 8] >> (7 - i % 8)) & 1;
+		if (i == prefix_len - 1) {
+			f->records[node][bit] = FIXTURE_DATA | data_offset;
+			return;
+		}
+		if (f->records[node][bit] == FIXTURE_EMPTY) {
+			assert_true(f->node_count < FIXTURE_MAX_NODES);
+			f->records[f->node_count][0] = FIXTURE_EMPTY;
+			f->records[f->node_count][1] = FIXTURE_EMPTY;
+			f->records[node][bit] = f->node_count++;
+		}
+		node = f->records[node][bit];
+	}
+}
+
+static void put_control(uint8_t *buf, size_t *len, int type, size_t size)
+{
+	assert_true(size < 285);
+	size_t size_bits = size < 29 ? size : 29;
+	if (type <= 7) {
+		buf[(*len)++] = (uint8_t)((type << 5) | size_bits);
+	} else {
+		buf[(*len)++] = (uint8_t)size_bits;
+		buf[(*len)++] = (uint8_t)(type - 7);
+	}
+	if (size >= 29) {
+		buf[(*len)++] = (uint8_t)(size - 29);
+	}
+}
+
+static size_t put_string(uint8_t *buf, size_t *len, const char *string)
+{
+	size_t offset = *len;
+	put_control(buf, len, 2, strlen(string));
+	memcpy(buf + *len, string, strlen(string));
+	*len += strlen(string);
+
+	return offset;
+}
+
+static void put_map(uint8_t *buf, size_t *len, size_t pairs)
+{
+	put_control(buf, len, 7, pairs);
+}
+
+static void put_uint(uint8_t *buf, size_t *len, int type, uint32_t value,
+		     size_t bytes)
+{
+	put_control(buf, len, type, bytes);
+	while (bytes-- > 0) {
+		buf[(*len)++] = (uint8_t)(value >> (8 * bytes));
+	}
+}
+
+static void put_pointer(uint8_t *buf, size_t *len, size_t offset)
+{
+	assert_true(offset < 2048);
+	buf[(*len)++] = (uint8_t)((1 << 5) | (offset >> 8));
+	buf[(*len)++] = (uint8_t)(offset & 0xff);
+}
+
+static void put_uint24(FILE *file, uint32_t value)
+{
+	uint8_t bytes[3] = { (uint8_t)(value >> 16), (uint8_t)(value >> 8),
+			     (uint8_t)value };
+	assert_int_equal(fwrite(bytes, 1, sizeof(bytes), file), sizeof(bytes));
+}
+
+static void write_fixture(const char *path)
+{
+	fixture *f = calloc(1, sizeof(fixture));
+	assert_non_null(f);
+	f->records[0][0] = FIXTURE_EMPTY;
+	f->records[0][1] = FIXTURE_EMPTY;
+	f->node_count = 1;
+
+	// 1.2.3.0/24, with a map to skip over before the ones we want
+	size_t london = f->data_len;
+	put_map(f->data, &f->data_len, 5);
+	put_string(f->data, &f->data_len, "continent");
+	put_map(f->data, &f->data_len, 1);
+	put_string(f->data, &f->data_len, "code");
+	put_string(f->data, &f->data_len, "EU");
+	put_string(f->data, &f->data_len, "country");
+	put_map(f->data, &f->data_len, 1);
+	size_t iso_code = put_string(f->data, &f->data_len, "iso_code");
+	put_string(f->data, &f->data_len, "GB");
+	put_string(f->data, &f->data_len, "city");
+	put_map(f->data, &f->data_len, 1);
+	put_string(f->data, &f->data_len, "names");
+	put_map(f->data, &f->data_len, 2);
+	put_string(f->data, &f->data_len, "de");
+	put_string(f->data, &f->data_len, "London");
+	put_string(f->data, &f->data_len, "en");
+	put_string(f->data, &f->data_len, "London");
+	put_string(f->data, &f->data_len, "autonomous_system_number");
+	put_uint(f->data, &f->data_len, 6, 64500, 2);
+	put_string(f->data, &f->data_len, "autonomous_system_organization");
+	put_string(f->data, &f->data_len, "Example Org");
+
+	// 8.8.0.0/16, no city and "iso_code" as a pointer
+	size_t google = f->data_len;
+	put_map(f->data, &f->data_len, 3);
+	put_string(f->data, &f->data_len, "country");
+	put_map(f->data, &f->data_len, 1);
+	put_pointer(f->data, &f->data_len, iso_code);
+	put_string(f->data, &f->data_len, "US");
+	put_string(f->data, &f->data_len, "autonomous_system_number");
+	put_uint(f->data, &f->data_len, 6, 15169, 2);
+	put_string(f->data, &f->data_len, "autonomous_system_organization");
+	put_string(f->data, &f->data_len, "GOOGLE");
+
+	// 2001:db8::/32, only a registered_country
+	size_t berlin = f->data_len;
+	put_map(f->data, &f->data_len, 2);
+	put_string(f->data, &f->data_len, "registered_country");
+	put_map(f->data, &f->data_len, 1);
+	put_string(f->data, &f->data_len, "iso_code");
+	put_string(f->data, &f->data_len, "DE");
+	put_string(f->data, &f->data_len, "city");
+	put_map(f->data, &f->data_len, 1);
+	put_string(f->data, &f->data_len, "names");
+	put_map(f->data, &f->data_len, 1);
+	put_string(f->data, &f->data_len, "en");
+	put_string(f->data, &f->data_len, "Berlin");
+
+	fixture_insert(f, "1.2.3.0", 24, (uint32_t)london);
+	fixture_insert(f, "8.8.0.0", 16, (uint32_t)google);
+	fixture_insert(f, "2001:db8::", 32, (uint32_t)berlin);
+
+	put_map(f->metadata, &f->metadata_len, 5);
+	put_string(f->metadata, &f->metadata_len, "binary_format_major_version");
+	put_uint(f->metadata, &f->metadata_len, 5, 2, 1);
+	put_string(f->metadata, &f->metadata_len, "database_type");
+	put_string(f->metadata, &f->metadata_len, "SentryPeer-Test");
+	put_string(f->metadata, &f->metadata_len, "node_count");
+	put_uint(f->metadata, &f->metadata_len, 6, f->node_count, 4);
+	put_string(f->metadata, &f->metadata_len, "record_size");
+	put_uint(f->metadata, &f->metadata_len, 5, 24, 1);
+	put_string(f->metadata, &f->metadata_len, "ip_version");
+	put_uint(f->metadata, &f->metadata_len, 5, 6, 1);
+
+	FILE *file = fopen(path, "wb");
+	assert_non_null(file);
+	for (uint32_t node = 0; node < f->node_count; node++) {
+		for (int bit = 0; bit < 2; bit++) {
+			uint32_t record = f->records[node][bit];
+			if (record == FIXTURE_EMPTY) {
+				record = f->node_count;
+			} else if (record & FIXTURE_DATA) {
+				record = (record & ~FIXTURE_DATA) +
+					 f->node_count + 16;
+			}
+			put_uint24(file, record);
+		}
+	}
+	uint8_t separator[16] = { 0 };
+	assert_int_equal(fwrite(separator, 1, sizeof(separator), file),
+			 sizeof(separator));
+	assert_int_equal(fwrite(f->data, 1, f->data_len, file), f->data_len);
+	assert_int_equal(fwrite("\xAB\xCD\xEFMaxMind.com", 1, 14, file), 14);
+	assert_int_equal(fwrite(f->metadata, 1, f->metadata_len, file),
+			 f->metadata_len);
+	assert_int_equal(fclose(file), 0);
+	free(f);
+}
+
+void test_geoip(void **state)
+{
+	(void)state; /* unused */
+
+	assert_null(geoip_new("./no_such_geoip.mmdb", 0));
+
+	FILE *not_mmdb = fopen(TEST_GEOIP_DB, "w");
+	assert_non_null(not_mmdb);
+	fputs("Not a MaxMind DB, but long enough to look for one\n", not_mmdb);
+	assert_int_equal(fclose(not_mmdb), 0);
+	assert_null(geoip_new(TEST_GEOIP_DB, 0));
+
+	write_fixture(TEST_GEOIP_DB);
+	geoip *geoip_dbs = geoip_new(TEST_GEOIP_DB, TEST_GEOIP_DB);
+	assert_non_null(geoip_dbs);
+
+	geoip_result result;
+	assert_int_equal(geoip_lookup(geoip_dbs, "1.2.3.4", &result),
+			 EXIT_SUCCESS);
+	assert_string_equal(result.country_code, "GB");
+	assert_string_equal(result.city, "London");
+	assert_int_equal(result.asn, 64500);
+	assert_string_equal(result.as_org, "Example Org");
+
+	assert_int_equal(geoip_lookup(geoip_dbs, "8.8.8.8", &result),
+			 EXIT_SUCCESS);
+	assert_string_equal(result.country_code, "US");
+	assert_string_equal(result.city, "");
+	assert_int_equal(result.asn, 15169);
+	assert_string_equal(result.as_org, "GOOGLE");
+
+	assert_int_equal(geoip_lookup(geoip_dbs, "2001:db8::1", &result),
+			 EXIT_SUCCESS);
+	assert_string_equal(result.country_code, "DE");
+	assert_string_equal(result.city, "Berlin");
+	assert_int_equal(result.asn, 0);
+
+	assert_int_equal(geoip_lookup(geoip_dbs, "9.9.9.9", &result),
+			 EXIT_FAILURE);
+	assert_string_equal(result.country_code, "");
+	assert_int_equal(geoip_lookup(geoip_dbs, "not an ip", &result),
+			 EXIT_FAILURE);
+
+	// Push 1.2.3.4 out of the cache and look it up again
+	char ip_address[INET6_ADDRSTRLEN];
+	for (int i = 0; i < GEOIP_CACHE_SHARDS * GEOIP_CACHE_SHARD_CAPACITY * 2;
+	     i++) {
+		snprintf(ip_address, sizeof(ip_address), "10.%d.%d.%d",
+			 (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+		assert_int_equal(geoip_lookup(geoip_dbs, ip_address, &result),
+				 EXIT_FAILURE);
+	}
+	assert_int_equal(geoip_lookup(geoip_dbs, "1.2.3.4", &result),
+			 EXIT_SUCCESS);
+	assert_string_equal(result.city, "London");
+	assert_int_equal(geoip_lookup(geoip_dbs, "1.2.3.4", &result),
+			 EXIT_SUCCESS);
+	assert_string_equal(result.city, "London");
+	geoip_destroy(&geoip_dbs);
+	assert_null(geoip_dbs);
+
+	// Only an ASN database
+	geoip_dbs = geoip_new(0, TEST_GEOIP_DB);
+	assert_non_null(geoip_dbs);
+	assert_int_equal(geoip_lookup(geoip_dbs, "1.2.3.4", &result),
+			 EXIT_SUCCESS);
+	assert_string_equal(result.country_code, "");
+	assert_int_equal(result.asn, 64500);
+	geoip_destroy(&geoip_dbs);
+
+	assert_int_equal(remove(TEST_GEOIP_DB), EXIT_SUCCESS);
+}
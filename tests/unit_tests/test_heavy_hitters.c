@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/* 
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+
+#include "test_heavy_hitters.h"
+#include "../../src/heavy_hitters.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+void test_heavy_hitters(void **state)
+{
+	(void)state; /* unused */
+
+	heavy_hitters *counters = heavy_hitters_new(4);
+	assert_non_null(counters);
+
+	heavy_hitters_add(counters, "friendly-scanner", 100, 200, 50);
+	heavy_hitters_add(counters, "sipvicious", 150, 150, 10);
+	heavy_hitters_add(counters, "friendly-scanner", 50, 300, 1);
+	heavy_hitters_add(counters, "pplsip", 10, 10, 2);
+	heavy_hitters_add(counters, 0, 10, 10, 1);
+	assert_int_equal(heavy_hitters_size(counters), 3);
+	assert_int_equal(heavy_hitters_events_total(counters), 63);
+
+	heavy_hitter found;
+	assert_int_equal(heavy_hitters_get(counters, "friendly-scanner",
+					   &found),
+			 EXIT_SUCCESS);
+	assert_int_equal(found.count, 51);
+	assert_int_equal(found.count_error, 0);
+	assert_int_equal(found.seen_first, 50);
+	assert_int_equal(found.seen_last, 300);
+	free(found.key);
+
+	// Fill up, then push the smallest (pplsip, 2) out
+	heavy_hitters_add(counters, "sundayddr", 20, 20, 3);
+	heavy_hitters_add(counters, "Cisco-SIPGateway", 30, 30, 1);
+	assert_int_equal(heavy_hitters_size(counters), 4);
+	assert_int_equal(heavy_hitters_get(counters, "pplsip", &found),
+			 EXIT_FAILURE);
+	assert_int_equal(heavy_hitters_get(counters, "Cisco-SIPGateway",
+					   &found),
+			 EXIT_SUCCESS);
+	assert_int_equal(found.count, 3);
+	assert_int_equal(found.count_error, 2);
+	free(found.key);
+
+	heavy_hitter *top = 0;
+	size_t top_count = 0;
+	heavy_hitters_top(counters, &top, 2, &top_count);
+	assert_int_equal(top_count, 2);
+	assert_string_equal(top[0].key, "friendly-scanner");
+	assert_string_equal(top[1].key, "sipvicious");
+	heavy_hitter_list_destroy(&top, top_count);
+	assert_null(top);
+
+	// Anything seen more than events_total / capacity times stays put,
+	// however many one-offs go past it
+	char one_off[32];
+	for (int i = 0; i < 60; i++) {
+		snprintf(one_off, sizeof(one_off), "one-off-%d", i);
+		heavy_hitters_add(counters, one_off, i, i, 1);
+	}
+	assert_int_equal(heavy_hitters_size(counters), 4);
+	assert_int_equal(heavy_hitters_get(counters, "friendly-scanner",
+					   &found),
+			 EXIT_SUCCESS);
+	assert_int_equal(found.count, 51);
+	free(found.key);
+
+	heavy_hitters_destroy(&counters);
+	assert_null(counters);
+}
@@ -22,8 +22,11 @@
 #include "../../src/http_routes.h"
 #include "../../src/http_daemon.h"
 #include "../../src/regex_match.h"
+#include "../../src/event_stream.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <curl/curl.h>
 
 // Returns response code from curl
@@ -54,6 +57,75 @@ static long curl_get_url(const char *url)
 	return http_response_code;
 }
 
+typedef struct test_events_read test_events_read;
+struct test_events_read {
+	event_stream *stream;
+	char data[4096];
+	size_t len;
+	int events;
+};
+
+// Publish another event once the first has arrived, which the subscriber
+// is resumed for, and stop once that has too
+static size_t test_events_write(char *data, size_t size, size_t nmemb,
+				void *arg)
+{
+	test_events_read *read = arg;
+	size_t len = size * nmemb;
+	size_t copy = sizeof(read->data) - read->len - 1;
+	if (len < copy) {
+		copy = len;
+	}
+	memcpy(read->data + read->len, data, copy);
+	read->len += copy;
+	read->data[read->len] = '\0';
+
+	int events = 0;
+	for (const char *event = strstr(read->data, "event: bad_actor");
+	     event != 0; event = strstr(event + 1, "event: bad_actor")) {
+		events++;
+	}
+	if (read->events == 0 && events == 1) {
+		event_stream_publish(read->stream, "{\"event\": 3}");
+	}
+	read->events = events;
+
+	// Anything but len ends the transfer
+	return events >= 2 ? 0 : len;
+}
+
+static void test_events_stream(event_stream *stream)
+{
+	// Two before we subscribe, so Last-Event-ID can ask for the second
+	event_stream_publish(stream, "{\"event\": 1}");
+	event_stream_publish(stream, "{\"event\": 2}");
+	uint64_t head = 0;
+	event_stream_wait(stream, &head, 0);
+	char last_event_id[64];
+	snprintf(last_event_id, sizeof(last_event_id),
+		 "Last-Event-ID: %" PRIu64, head - 2);
+
+	test_events_read read = { .stream = stream };
+	CURL *curl = curl_easy_init();
+	assert_non_null(curl);
+	struct curl_slist *headers = curl_slist_append(0, last_event_id);
+	assert_non_null(headers);
+	curl_easy_setopt(curl, CURLOPT_URL,
+			 "http://127.0.0.1:8082/events/stream");
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, test_events_write);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &read);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
+	assert_int_equal(curl_easy_perform(curl), CURLE_WRITE_ERROR);
+	curl_slist_free_all(headers);
+	curl_easy_cleanup(curl);
+
+	assert_int_equal(read.events, 2);
+	assert_non_null(strstr(read.data, "data: {\"event\": 2}"));
+	assert_non_null(strstr(read.data, "data: {\"event\": 3}"));
+	assert_null(strstr(read.data, "data: {\"event\": 1}"));
+}
+
 // cppcheck-suppress constParameter
 void test_http_api_get(void **state)
 {
@@ -93,12 +165,88 @@ void test_http_api_get(void **state)
 	assert_int_equal(curl_get_url("http://127.0.0.1:8082/ip-addresses"),
 			 200);
 
+	// Live events never end, so the bad request and then reading a
+	// couple of events
+	assert_int_equal(
+		curl_get_url("http://127.0.0.1:8082/events/stream?lag=wait"),
+		400);
+	test_events_stream(config->event_stream);
+
+	// Prometheus
+	assert_int_equal(curl_get_url("http://127.0.0.1:8082/metrics"), 200);
+
+	// Changes since a cursor, none is still a 200
+	assert_int_equal(
+		curl_get_url("http://127.0.0.1:8082/ip-addresses?since=0"),
+		200);
+	assert_int_equal(
+		curl_get_url(
+			"http://127.0.0.1:8082/ip-addresses?since=9000000000000000000"),
+		200);
+	assert_int_equal(
+		curl_get_url("http://127.0.0.1:8082/ip-addresses?since=-1"),
+		400);
+
 	// Bad actor 400 Bad Data
 	assert_int_equal(
 		curl_get_url(
 			"http://127.0.0.1:8082/ip-addresses/104.14da3afcsasd"),
 		400);
 
+	// ipset/nftables export, an empty set is still a 200
+	assert_int_equal(
+		curl_get_url("http://127.0.0.1:8082/ip-addresses/ipset"), 200);
+	assert_int_equal(
+		curl_get_url(
+			"http://127.0.0.1:8082/ip-addresses/ipset?format=nft&aggregate=1"),
+		200);
+	assert_int_equal(
+		curl_get_url(
+			"http://127.0.0.1:8082/ip-addresses/ipset?family=5"),
+		400);
+	assert_int_equal(
+		curl_get_url(
+			"http://127.0.0.1:8082/ip-addresses/ipset?name=bad%20name"),
+		400);
+
+	// Prefix checks (BAD_ACTOR_SOURCE_IP from test_database.c)
+	assert_int_equal(curl_get_url("http://127.0.0.1:8082/ip-prefixes"),
+			 200);
+	assert_int_equal(
+		curl_get_url(
+			"http://127.0.0.1:8082/ip-prefixes/104.149.0.0/16"),
+		200);
+	assert_int_equal(
+		curl_get_url("http://127.0.0.1:8082/ip-prefixes/10.0.0.0/8"),
+		404);
+	assert_int_equal(
+		curl_get_url("http://127.0.0.1:8082/ip-prefixes/10.0.0.0/33"),
+		400);
+	assert_int_equal(
+		curl_get_url(
+			"http://127.0.0.1:8082/ip-prefixes?family=5"),
+		400);
+
+	// Counted from the row test_database.c adds
+	assert_int_equal(curl_get_url("http://127.0.0.1:8082/user-agents"),
+			 200);
+	assert_int_equal(curl_get_url("http://127.0.0.1:8082/sip-methods"),
+			 200);
+	assert_int_equal(
+		curl_get_url("http://127.0.0.1:8082/sip-methods/INVITE"), 200);
+	assert_int_equal(
+		curl_get_url("http://127.0.0.1:8082/sip-methods/NOTAMETHOD"),
+		404);
+	assert_int_equal(
+		curl_get_url("http://127.0.0.1:8082/user-agents?limit=0"), 400);
+
+	// No GeoIP database here, so nothing to count
+	assert_int_equal(curl_get_url("http://127.0.0.1:8082/countries"), 404);
+	assert_int_equal(curl_get_url("http://127.0.0.1:8082/countries/gb"),
+			 404);
+	assert_int_equal(
+		curl_get_url("http://127.0.0.1:8082/countries/GB/London"), 404);
+
 	// Phone numbers check 200 OK
 	assert_int_equal(curl_get_url("http://127.0.0.1:8082/numbers"), 200);
 
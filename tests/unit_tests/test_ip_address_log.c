@@ -0,0 +1,148 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/* 
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+
+#include "test_ip_address_log.h"
+#include "../../src/ip_address_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+void test_ip_address_log(void **state)
+{
+	(void)state; /* unused */
+
+	ip_address_log *log = ip_address_log_new();
+	assert_non_null(log);
+
+	time_t now = time(NULL);
+	assert_int_equal(ip_address_log_add(log, "185.1.2.3", now - 7200),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_address_log_add(log, "2001:db8::1", now - 3600),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_address_log_add(log, "185.1.2.3", now),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_address_log_add(log, "8.8.8.8", now),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_address_log_add(log, "not.an.ip", now),
+			 EXIT_FAILURE);
+	assert_int_equal(ip_address_log_size(log), 3);
+
+	// Other spellings of the same addresses
+	assert_int_equal(ip_address_log_add(log, "2001:DB8:0::0001", now),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_address_log_add(log, "::ffff:185.1.2.3", now),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_address_log_size(log), 3);
+
+	// Seen again doesn't move it
+	assert_int_equal(ip_address_log_position(log, 0), 0);
+	assert_int_equal(ip_address_log_position(log, now - 3600), 1);
+	assert_int_equal(ip_address_log_position(log, now), 2);
+	assert_int_equal(ip_address_log_position(log, now + 1), 3);
+
+	ip_address_log_address addresses[4];
+	size_t position = 0;
+	assert_int_equal(ip_address_log_copy(log, AF_INET, &position,
+					     ip_address_log_size(log),
+					     addresses, 4),
+			 2);
+	assert_string_equal(addresses[0].text, "185.1.2.3");
+	assert_string_equal(addresses[1].text, "8.8.8.8");
+	assert_int_equal(ip_address_log_copy(log, AF_INET, &position,
+					     ip_address_log_size(log),
+					     addresses, 4),
+			 0);
+
+	// A batch at a time
+	position = 0;
+	assert_int_equal(ip_address_log_copy(log, AF_INET6, &position, 3,
+					     addresses, 1),
+			 1);
+	assert_string_equal(addresses[0].text, "2001:db8::1");
+	assert_int_equal(ip_address_log_copy(log, AF_INET6, &position, 3,
+					     addresses, 1),
+			 0);
+
+	// 10.0.0.0 to 10.0.0.255 plus 10.0.1.0 to 10.0.1.4
+	char ip_address[IP_PREFIX_STR_LEN];
+	for (int i = 0; i < 256; i++) {
+		snprintf(ip_address, sizeof(ip_address), "10.0.0.%d", i);
+		assert_int_equal(ip_address_log_add(log, ip_address, now),
+				 EXIT_SUCCESS);
+	}
+	for (int i = 4; i >= 0; i--) {
+		snprintf(ip_address, sizeof(ip_address), "10.0.1.%d", i);
+		assert_int_equal(ip_address_log_add(log, ip_address, now),
+				 EXIT_SUCCESS);
+	}
+
+	ip_address_log_address *prefixes = 0;
+	size_t prefix_count = 0;
+	assert_int_equal(ip_address_log_aggregate(log, AF_INET, 0, &prefixes,
+						  &prefix_count),
+			 EXIT_SUCCESS);
+	assert_int_equal(prefix_count, 5);
+	assert_string_equal(prefixes[0].text, "8.8.8.8");
+	assert_string_equal(prefixes[1].text, "10.0.0.0/24");
+	assert_string_equal(prefixes[2].text, "10.0.1.0/30");
+	assert_string_equal(prefixes[3].text, "10.0.1.4");
+	assert_string_equal(prefixes[4].text, "185.1.2.3");
+	free(prefixes);
+
+	// Only the new ones get sorted in
+	assert_int_equal(ip_address_log_add(log, "10.0.1.5", now),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_address_log_add(log, "10.0.1.6", now),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_address_log_add(log, "10.0.1.7", now),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_address_log_aggregate(log, AF_INET, 0, &prefixes,
+						  &prefix_count),
+			 EXIT_SUCCESS);
+	assert_int_equal(prefix_count, 4);
+	assert_string_equal(prefixes[2].text, "10.0.1.0/29");
+	free(prefixes);
+
+	// From a position only has what came after it
+	assert_int_equal(ip_address_log_aggregate(log, AF_INET,
+						  ip_address_log_size(log) - 3,
+						  &prefixes, &prefix_count),
+			 EXIT_SUCCESS);
+	assert_int_equal(prefix_count, 2);
+	assert_string_equal(prefixes[0].text, "10.0.1.5");
+	assert_string_equal(prefixes[1].text, "10.0.1.6/31");
+	free(prefixes);
+
+	assert_int_equal(ip_address_log_add(log, "2001:db8::", now),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_address_log_aggregate(log, AF_INET6, 0, &prefixes,
+						  &prefix_count),
+			 EXIT_SUCCESS);
+	assert_int_equal(prefix_count, 1);
+	assert_string_equal(prefixes[0].text, "2001:db8::/127");
+	free(prefixes);
+
+	assert_int_equal(ip_address_log_aggregate(log, AF_UNIX, 0, &prefixes,
+						  &prefix_count),
+			 EXIT_FAILURE);
+
+	ip_address_log_destroy(&log);
+	assert_null(log);
+}
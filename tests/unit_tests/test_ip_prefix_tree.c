@@ -0,0 +1,137 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/* 
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+
+#include "test_ip_prefix_tree.h"
+#include "../../src/ip_prefix_tree.h"
+
+#include <stdlib.h>
+#include <sys/socket.h>
+
+void test_ip_prefix_tree(void **state)
+{
+	(void)state; /* unused */
+
+	uint8_t key[IP_PREFIX_KEY_LEN];
+	int prefix_len = 0;
+	assert_int_equal(ip_prefix_parse("185.0.0.0/8", key, &prefix_len),
+			 EXIT_SUCCESS);
+	assert_int_equal(prefix_len, IP_PREFIX_V4_MAPPED_LEN + 8);
+	assert_int_equal(ip_prefix_parse("2001:db8::1", key, &prefix_len),
+			 EXIT_SUCCESS);
+	assert_int_equal(prefix_len, IP_PREFIX_MAX_LEN);
+	assert_int_equal(ip_prefix_parse("185.0.0.0/33", key, &prefix_len),
+			 EXIT_FAILURE);
+	assert_int_equal(ip_prefix_parse("185.0.0.0/", key, &prefix_len),
+			 EXIT_FAILURE);
+	assert_int_equal(ip_prefix_parse("not.an.ip", key, &prefix_len),
+			 EXIT_FAILURE);
+
+	ip_prefix_tree *tree = ip_prefix_tree_new();
+	assert_non_null(tree);
+
+	time_t now = time(NULL);
+	assert_int_equal(ip_prefix_tree_insert(tree, "185.1.2.3", now - 7200, 5),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_prefix_tree_insert(tree, "185.1.2.4", now, 1),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_prefix_tree_insert(tree, "185.1.2.4", now, 1),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_prefix_tree_insert(tree, "185.9.0.1", now, 1),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_prefix_tree_insert(tree, "8.8.8.8", now, 1),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_prefix_tree_insert(tree, "2001:db8::1", now, 3),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_prefix_tree_insert(tree, "10.0.0.0/8", now, 1),
+			 EXIT_FAILURE);
+
+	ip_prefix_stats summary;
+	ip_prefix_stats *addresses = 0;
+	size_t address_count = 0;
+	assert_int_equal(ip_prefix_tree_lookup(tree, "185.0.0.0/8", 0, &summary,
+					       &addresses, 10, &address_count),
+			 EXIT_SUCCESS);
+	assert_string_equal(summary.prefix, "185.0.0.0/8");
+	assert_int_equal(summary.seen_count, 8);
+	assert_int_equal(summary.address_count, 3);
+	assert_int_equal(address_count, 3);
+	assert_string_equal(addresses[0].prefix, "185.1.2.3");
+	assert_int_equal(addresses[1].seen_count, 2);
+	free(addresses);
+
+	// Only what's been seen in the last hour
+	assert_int_equal(ip_prefix_tree_lookup(tree, "185.0.0.0/8", now - 3600,
+					       &summary, &addresses, 10,
+					       &address_count),
+			 EXIT_SUCCESS);
+	assert_int_equal(summary.address_count, 2);
+	assert_int_equal(summary.seen_count, 3);
+	free(addresses);
+
+	assert_int_equal(ip_prefix_tree_lookup(tree, "192.168.0.0/16", 0,
+					       &summary, &addresses, 10,
+					       &address_count),
+			 EXIT_SUCCESS);
+	assert_int_equal(summary.address_count, 0);
+	assert_int_equal(address_count, 0);
+	free(addresses);
+
+	ip_prefix_stats *top = 0;
+	size_t top_count = 0;
+	assert_int_equal(ip_prefix_tree_top(tree, AF_INET, 24, &top, 10,
+					    &top_count),
+			 EXIT_SUCCESS);
+	assert_int_equal(top_count, 3);
+	assert_string_equal(top[0].prefix, "185.1.2.0/24");
+	assert_int_equal(top[0].seen_count, 7);
+	assert_int_equal(top[0].address_count, 2);
+	free(top);
+
+	// IPv4 is kept out of the IPv6 answers, even from ::/32 which
+	// ::ffff:0:0/96 is under
+	assert_int_equal(ip_prefix_tree_top(tree, AF_INET6, 32, &top, 10,
+					    &top_count),
+			 EXIT_SUCCESS);
+	assert_int_equal(top_count, 1);
+	assert_string_equal(top[0].prefix, "2001:db8::/32");
+	free(top);
+	assert_int_equal(ip_prefix_tree_insert(tree, "::1", now - 60, 2),
+			 EXIT_SUCCESS);
+	assert_int_equal(ip_prefix_tree_top(tree, AF_INET6, 32, &top, 10,
+					    &top_count),
+			 EXIT_SUCCESS);
+	assert_int_equal(top_count, 2);
+	assert_string_equal(top[1].prefix, "::/32");
+	assert_int_equal(top[1].seen_count, 2);
+	assert_int_equal(top[1].address_count, 1);
+	assert_int_equal(top[1].seen_last, now - 60);
+	free(top);
+	assert_int_equal(ip_prefix_tree_top(tree, AF_INET6, 112, &top, 10,
+					    &top_count),
+			 EXIT_SUCCESS);
+	assert_int_equal(top_count, 2);
+	free(top);
+
+	assert_int_equal(ip_prefix_tree_top(tree, AF_INET, 33, &top, 10,
+					    &top_count),
+			 EXIT_FAILURE);
+
+	ip_prefix_tree_destroy(&tree);
+	assert_null(tree);
+}
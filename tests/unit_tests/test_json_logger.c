@@ -18,6 +18,9 @@
 #include <setjmp.h>
 #include <stdint.h>
 #include <cmocka.h>
+#include <string.h>
+#include <jansson.h>
+#include <config.h>
 
 #include "../../src/json_logger.h"
 #include "test_bad_actor.h"
@@ -83,3 +86,274 @@ void test_json_logger(void **state)
 
 	assert_int_equal(remove(config->json_log_file), EXIT_SUCCESS);
 }
+
+// What bad_actor_to_json() wrote when it went through json_pack()
+static char *jansson_bad_actor_json(const bad_actor *bad_actor_event)
+{
+	json_t *json_bad_actor = json_pack(
+		"{s:s,s:s,s:s,s:s,s:s,s:s,s:s,s:s,s:s,s:s,s:s,s:s,s:s}",
+		"app_name", PACKAGE_NAME, "app_version", PACKAGE_VERSION,
+		"event_timestamp", bad_actor_event->event_timestamp,
+		"event_uuid", bad_actor_event->event_uuid,
+		"created_by_node_id", bad_actor_event->created_by_node_id,
+		"collected_method", bad_actor_event->collected_method,
+		"transport_type", bad_actor_event->transport_type, "source_ip",
+		bad_actor_event->source_ip, "destination_ip",
+		bad_actor_event->destination_ip, "called_number",
+		bad_actor_event->called_number, "sip_method",
+		bad_actor_event->method, "sip_user_agent",
+		bad_actor_event->user_agent, "sip_message",
+		bad_actor_event->sip_message);
+	if (json_bad_actor == NULL) {
+		return NULL;
+	}
+
+	char *json_string = json_dumps(json_bad_actor, JSON_COMPACT);
+	json_decref(json_bad_actor);
+
+	return json_string;
+}
+
+static bad_actor *bad_actor_with_sip_message(const char *sip_message,
+					     const char *user_agent)
+{
+	return bad_actor_new(util_duplicate_string(sip_message),
+			     util_duplicate_string("104.149.141.214"),
+			     util_duplicate_string("8.8.8.8"),
+			     util_duplicate_string("100441234567890"),
+			     util_duplicate_string("OPTIONS"),
+			     util_duplicate_string("UDP"),
+			     util_duplicate_string(user_agent),
+			     util_duplicate_string("passive"),
+			     "fac9e4b3-2f8c-4a4a-8c3e-30bba3ab8e68");
+}
+
+static void assert_same_as_jansson(json_buffer *buffer,
+				   const bad_actor *bad_actor_event)
+{
+	char *expected = jansson_bad_actor_json(bad_actor_event);
+	assert_non_null(expected);
+
+	assert_int_equal(bad_actor_json_write(bad_actor_event, buffer),
+			 EXIT_SUCCESS);
+	assert_string_equal(buffer->data, expected);
+	assert_int_equal(buffer->len, strlen(expected));
+
+	free(expected);
+}
+
+void test_bad_actor_json_write(void **state)
+{
+	(void)state; /* unused */
+
+	sentrypeer_config *config = sentrypeer_config_new();
+	assert_non_null(config);
+
+	json_buffer buffer;
+	json_buffer_init(&buffer);
+
+	// Everything json_dumps() escapes, and the things it doesn't, with
+	// runs long enough to take the 8 bytes at a time path either side
+	const char *sip_messages[] = {
+		"OPTIONS sip:100@127.0.0.1:5060 SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP 1.2.3.4:5060;branch=z9hG4bK-1\r\n"
+		"From: \"sipvicious\"<sip:100@1.1.1.1>;tag=6\r\n"
+		"Content-Length: 0\r\n\r\n",
+		"\\\"\b\f\n\r\t\x01\x1f\x7f /// \\\\ \"\"",
+		"caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 after twelve bytes",
+		"01234567\x1f" "01234567\xc3\xa9" "012345\"",
+		"",
+	};
+	for (size_t i = 0; i < sizeof(sip_messages) / sizeof(*sip_messages);
+	     i++) {
+		bad_actor *bad_actor_event = bad_actor_with_sip_message(
+			sip_messages[i], "friendly-scanner \"x\"");
+		assert_non_null(bad_actor_event);
+		assert_same_as_jansson(&buffer, bad_actor_event);
+		bad_actor_destroy(&bad_actor_event);
+	}
+
+	// Bigger than the buffer's own storage, so it moves to the heap, then
+	// gets reused as is for a small one
+	size_t big_len = JSON_BUFFER_INLINE_SIZE * 3;
+	char *big = malloc(big_len + 1);
+	assert_non_null(big);
+	for (size_t i = 0; i < big_len; i++) {
+		big[i] = i % 61 == 0 ? '\n' : (char)('a' + i % 26);
+	}
+	big[big_len] = '\0';
+	bad_actor *big_event = bad_actor_with_sip_message(big, "big");
+	assert_non_null(big_event);
+	assert_same_as_jansson(&buffer, big_event);
+	assert_true(buffer.data != buffer.storage);
+	bad_actor_destroy(&big_event);
+	free(big);
+
+	bad_actor *small_event = bad_actor_with_sip_message("small", "small");
+	assert_non_null(small_event);
+	assert_same_as_jansson(&buffer, small_event);
+
+	// Written once, then the same json for every sink after that
+	json_buffer_reset(&buffer);
+	const char *json = bad_actor_json_once(config, small_event, &buffer);
+	assert_non_null(json);
+	assert_true(bad_actor_json_once(config, small_event, &buffer) == json);
+	bad_actor_destroy(&small_event);
+
+	// jansson turns these down, so we do too
+	const char *invalid_utf8[] = {
+		"\xc0\xaf",	      // Overlong '/'
+		"\x80",	      // Continuation byte on its own
+		"\xed\xa0\x80",   // Surrogate
+		"\xe2\x82",	      // Cut short
+		"\xf4\x90\x80\x80", // Past U+10FFFF
+		"\xff",
+	};
+	for (size_t i = 0; i < sizeof(invalid_utf8) / sizeof(*invalid_utf8);
+	     i++) {
+		bad_actor *bad_actor_event = bad_actor_with_sip_message(
+			invalid_utf8[i], "invalid");
+		assert_non_null(bad_actor_event);
+		assert_null(jansson_bad_actor_json(bad_actor_event));
+		assert_int_equal(bad_actor_json_write(bad_actor_event, &buffer),
+				 EXIT_FAILURE);
+		assert_int_equal(buffer.len, 0);
+		assert_null(bad_actor_json_once(config, bad_actor_event,
+						&buffer));
+		bad_actor_destroy(&bad_actor_event);
+	}
+
+	json_buffer_release(&buffer);
+	assert_true(buffer.data == buffer.storage);
+	sentrypeer_config_destroy(&config);
+	assert_null(config);
+}
+
+#define TEST_BAD_ACTOR_JSON_KEYS                                               \
+	"\"app_name\":\"sentrypeer\",\"app_version\":\"4.0.0\","               \
+	"\"event_timestamp\":\"2026-10-19 10:00:00.000000000\","              \
+	"\"event_uuid\":\"460f30e4-ce1d-4d53-9004-dd40a1c4abc9\","            \
+	"\"created_by_node_id\":\"350f30e4-ce1d-4d53-9004-dd40a1c4abc8\","    \
+	"\"collected_method\":\"passive\",\"transport_type\":\"UDP\","         \
+	"\"source_ip\":\"104.149.141.214\",\"destination_ip\":\"8.8.8.8\","    \
+	"\"called_number\":\"100\",\"sip_method\":\"OPTIONS\","                \
+	"\"sip_user_agent\":\"friendly-scanner\""
+
+static bad_actor *read_json(const char *json)
+{
+	const char *error = 0;
+	bad_actor *bad_actor_event =
+		bad_actor_json_read(json, strlen(json), &error);
+	if (bad_actor_event == NULL) {
+		assert_non_null(error);
+	}
+
+	return bad_actor_event;
+}
+
+void test_bad_actor_json_read(void **state)
+{
+	(void)state; /* unused */
+
+	// Whatever we write, we read back the same
+	bad_actor *written = bad_actor_with_sip_message(
+		"OPTIONS sip:100@1.1.1.1 SIP/2.0\r\nFrom: \"a\\b\"\t\x01/caf\xc3\xa9\r\n",
+		"friendly-scanner \"x\"");
+	assert_non_null(written);
+	json_buffer buffer;
+	json_buffer_init(&buffer);
+	assert_int_equal(bad_actor_json_write(written, &buffer), EXIT_SUCCESS);
+
+	bad_actor *read = bad_actor_json_read(buffer.data, buffer.len, NULL);
+	assert_non_null(read);
+	assert_non_null(read->arena);
+	assert_string_equal(read->event_timestamp, written->event_timestamp);
+	assert_string_equal(read->event_uuid, written->event_uuid);
+	assert_string_equal(read->created_by_node_id,
+			    written->created_by_node_id);
+	assert_string_equal(read->collected_method, written->collected_method);
+	assert_string_equal(read->transport_type, written->transport_type);
+	assert_string_equal(read->source_ip, written->source_ip);
+	assert_string_equal(read->destination_ip, written->destination_ip);
+	assert_string_equal(read->called_number, written->called_number);
+	assert_string_equal(read->method, written->method);
+	assert_string_equal(read->user_agent, written->user_agent);
+	assert_string_equal(read->sip_message, written->sip_message);
+	assert_null(read->seen_last);
+	assert_null(read->seen_count);
+	bad_actor_destroy(&read);
+	assert_null(read);
+	bad_actor_destroy(&written);
+
+	// Only the json's own length is read, it needn't end in a '\0'
+	char *truncated = malloc(buffer.len);
+	assert_non_null(truncated);
+	memcpy(truncated, buffer.data, buffer.len);
+	read = bad_actor_json_read(truncated, buffer.len, NULL);
+	assert_non_null(read);
+	bad_actor_destroy(&read);
+	assert_null(bad_actor_json_read(truncated, buffer.len - 1, NULL));
+	free(truncated);
+	json_buffer_release(&buffer);
+
+	// Any json jansson would have taken: other escapes, whitespace, keys
+	// in any order, keys we don't know, and the last of a repeated key
+	read = read_json(
+		" {\n\t\"sip_message\" : \"first\",\r\n"
+		"\"extra\": {\"a\": [1, -2.5e+3, true, false, null, \"s\", {}]},"
+		"\"more\": [], " TEST_BAD_ACTOR_JSON_KEYS ","
+		"\"sip_message\": \"\\u00e9\\u20AC\\ud83d\\ude00\\/\\\"\\\\\\b\\f\\n\\r\\t\"}\n");
+	assert_non_null(read);
+	assert_string_equal(read->sip_message,
+			    "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80/\"\\\b\f\n\r\t");
+	assert_string_equal(read->user_agent, "friendly-scanner");
+	assert_string_equal(read->source_ip, "104.149.141.214");
+	bad_actor_destroy(&read);
+
+	// What jansson, or our schema, turns down
+	const char *invalid[] = {
+		"",
+		"[]",
+		"{}",
+		"{" TEST_BAD_ACTOR_JSON_KEYS "}",
+		"{" TEST_BAD_ACTOR_JSON_KEYS ",\"sip_message\":1}",
+		"{" TEST_BAD_ACTOR_JSON_KEYS ",\"sip_message\":null}",
+		"{" TEST_BAD_ACTOR_JSON_KEYS ",\"sip_message\":\"\"} x",
+		"{" TEST_BAD_ACTOR_JSON_KEYS ",\"sip_message\":\"\",}",
+		"{" TEST_BAD_ACTOR_JSON_KEYS ",\"sip_message\":\"\"",
+		"{" TEST_BAD_ACTOR_JSON_KEYS ",\"sip_message\":\"\\x\"}",
+		"{" TEST_BAD_ACTOR_JSON_KEYS ",\"sip_message\":\"\\ud83d\"}",
+		"{" TEST_BAD_ACTOR_JSON_KEYS ",\"sip_message\":\"\\ude00\"}",
+		"{" TEST_BAD_ACTOR_JSON_KEYS ",\"sip_message\":\"\\u0000\"}",
+		"{" TEST_BAD_ACTOR_JSON_KEYS ",\"sip_message\":\"\\u12\"}",
+		"{" TEST_BAD_ACTOR_JSON_KEYS ",\"sip_message\":\"\n\"}",
+		"{" TEST_BAD_ACTOR_JSON_KEYS ",\"sip_message\":\"\xc0\xaf\"}",
+		"{" TEST_BAD_ACTOR_JSON_KEYS ",\"sip_message\":\"\",\"x\":01}",
+		"{" TEST_BAD_ACTOR_JSON_KEYS ",\"sip_message\":\"\",\"x\":tru}",
+		"{" TEST_BAD_ACTOR_JSON_KEYS ",\"sip_message\":\"\",\"x\":[1,]}",
+		"{" TEST_BAD_ACTOR_JSON_KEYS ",\"sip_message\":\"\",\"x\":{1:2}}",
+	};
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(*invalid); i++) {
+		read = read_json(invalid[i]);
+		if (read != NULL) {
+			fprintf(stderr, "Should have been turned down: %s\n",
+				invalid[i]);
+		}
+		assert_null(read);
+	}
+
+	// Too deep, as jansson would say too
+	size_t depth = 3000;
+	size_t deep_len = strlen(TEST_BAD_ACTOR_JSON_KEYS) + 64 + depth * 2;
+	char *deep = malloc(deep_len);
+	assert_non_null(deep);
+	int len = snprintf(deep, deep_len,
+			   "{" TEST_BAD_ACTOR_JSON_KEYS
+			   ",\"sip_message\":\"\",\"x\":");
+	memset(deep + len, '[', depth);
+	memset(deep + len + depth, ']', depth);
+	deep[len + depth * 2] = '}';
+	deep[len + depth * 2 + 1] = '\0';
+	assert_null(read_json(deep));
+	free(deep);
+}
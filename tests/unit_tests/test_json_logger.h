@@ -15,5 +15,7 @@
 #define SENTRYPEER_TEST_JSON_LOGGER 1
 
 void test_json_logger(void **state);
+void test_bad_actor_json_write(void **state);
+void test_bad_actor_json_read(void **state);
 
 #endif //SENTRYPEER_TEST_JSON_LOGGER_H
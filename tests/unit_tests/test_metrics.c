@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/* 
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+
+#include "test_metrics.h"
+#include "../../src/metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void test_metrics(void **state)
+{
+	(void)state; /* unused */
+
+	// Not in API mode, nothing to count into
+	metrics_add(0, METRICS_SIP_UDP_PACKETS, 1);
+	assert_int_equal(metrics_start(0), 0);
+	metrics_observe(0, METRICS_DB_INSERT_SECONDS, 0);
+
+	metrics *counters = metrics_new();
+	assert_non_null(counters);
+
+	metrics_add(counters, METRICS_SIP_UDP_PACKETS, 1);
+	metrics_add(counters, METRICS_SIP_UDP_PACKETS, 1);
+	metrics_add(counters, METRICS_SIP_TCP_PACKETS, 1);
+	metrics_add(counters, METRICS_SIP_BYTES, 1500);
+	assert_int_equal(metrics_counter_total(counters,
+					       METRICS_SIP_UDP_PACKETS),
+			 2);
+	assert_int_equal(metrics_counter_total(counters, METRICS_SIP_BYTES),
+			 1500);
+	assert_int_equal(metrics_counter_total(counters,
+					       METRICS_DB_INSERT_FAILURES),
+			 0);
+
+	// 1us, 3us (the 4us bucket), 1.5s and an hour (+Inf)
+	metrics_observe_ns(counters, METRICS_DB_INSERT_SECONDS, 1000);
+	metrics_observe_ns(counters, METRICS_DB_INSERT_SECONDS, 3000);
+	metrics_observe_ns(counters, METRICS_DB_INSERT_SECONDS, 1500000000);
+	metrics_observe_ns(counters, METRICS_DB_INSERT_SECONDS,
+			   3600000000000);
+	uint64_t started = metrics_start(counters);
+	assert_true(started > 0);
+	metrics_observe(counters, METRICS_SIP_PARSE_SECONDS, started);
+	assert_int_equal(metrics_histogram_count(counters,
+						 METRICS_DB_INSERT_SECONDS),
+			 4);
+	assert_int_equal(metrics_histogram_count(counters,
+						 METRICS_SIP_PARSE_SECONDS),
+			 1);
+
+	char *text = metrics_render(counters);
+	assert_non_null(text);
+
+	assert_non_null(strstr(text, "sentrypeer_build_info{version=\""));
+	assert_non_null(strstr(
+		text, "# TYPE sentrypeer_sip_packets_received_total counter\n"
+		      "sentrypeer_sip_packets_received_total{transport=\"udp\"} 2\n"
+		      "sentrypeer_sip_packets_received_total{transport=\"tcp\"} 1\n"));
+	assert_non_null(
+		strstr(text, "\nsentrypeer_sip_received_bytes_total 1500\n"));
+	assert_non_null(
+		strstr(text, "# TYPE sentrypeer_db_insert_seconds histogram\n"));
+
+	// Cumulative, as Prometheus expects
+	assert_non_null(strstr(
+		text, "sentrypeer_db_insert_seconds_bucket{le=\"0.000001\"} 1\n"
+		      "sentrypeer_db_insert_seconds_bucket{le=\"0.000002\"} 1\n"
+		      "sentrypeer_db_insert_seconds_bucket{le=\"0.000004\"} 2\n"));
+	assert_non_null(strstr(
+		text, "sentrypeer_db_insert_seconds_bucket{le=\"1.048576\"} 2\n"
+		      "sentrypeer_db_insert_seconds_bucket{le=\"2.097152\"} 3\n"));
+	assert_non_null(strstr(
+		text, "sentrypeer_db_insert_seconds_bucket{le=\"8.388608\"} 3\n"
+		      "sentrypeer_db_insert_seconds_bucket{le=\"+Inf\"} 4\n"
+		      "sentrypeer_db_insert_seconds_sum 3601.500004000\n"
+		      "sentrypeer_db_insert_seconds_count 4\n"));
+	assert_non_null(strstr(text, "\nsentrypeer_webhook_seconds_count 0\n"));
+
+	free(text);
+	metrics_destroy(&counters);
+	assert_null(counters);
+}
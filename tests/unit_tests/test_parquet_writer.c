@@ -0,0 +1,819 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/* 
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+
+#include <config.h>
+
+#include "test_parquet_writer.h"
+#include "../../src/parquet_writer.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if HAVE_ZSTD != 0
+#include <zstd.h>
+#endif
+
+#define TEST_PARQUET_FILE "test_parquet_writer.parquet"
+// Enough for the user_agent dictionary to overflow in the first row group,
+// and a second row group where it doesn't
+#define TEST_PARQUET_ROWS (PARQUET_ROW_GROUP_ROWS + 1000)
+#define TEST_PARQUET_COLUMNS 3
+#define TEST_PARQUET_ROW_GROUPS_MAX 4
+#define TEST_PARQUET_NAME_MAX 32
+
+// From parquet.thrift, what a reader sees
+#define TEST_PARQUET_REPETITION_OPTIONAL 1
+#define TEST_PARQUET_CONVERTED_TYPE_UTF8 0
+#define TEST_PARQUET_ENCODING_PLAIN 0
+#define TEST_PARQUET_ENCODING_RLE_DICTIONARY 8
+#define TEST_PARQUET_CODEC_UNCOMPRESSED 0
+#define TEST_PARQUET_CODEC_ZSTD 6
+#define TEST_PARQUET_PAGE_DATA 0
+#define TEST_PARQUET_PAGE_DICTIONARY 2
+
+// Thrift compact protocol types
+#define TEST_THRIFT_BOOL_TRUE 1
+#define TEST_THRIFT_BOOL_FALSE 2
+#define TEST_THRIFT_BYTE 3
+#define TEST_THRIFT_I16 4
+#define TEST_THRIFT_I32 5
+#define TEST_THRIFT_I64 6
+#define TEST_THRIFT_DOUBLE 7
+#define TEST_THRIFT_BINARY 8
+#define TEST_THRIFT_LIST 9
+#define TEST_THRIFT_SET 10
+#define TEST_THRIFT_STRUCT 12
+
+static const parquet_column test_parquet_columns[TEST_PARQUET_COLUMNS] = {
+	{ "honey_id", PARQUET_TYPE_INT64, false },
+	{ "method", PARQUET_TYPE_BYTE_ARRAY, true },
+	{ "user_agent", PARQUET_TYPE_BYTE_ARRAY, true },
+};
+
+static const char *test_parquet_methods[] = { "INVITE", "OPTIONS",
+					      "REGISTER" };
+
+// What each row holds, with some nulls in every column
+static bool test_parquet_id(size_t row, int64_t *id)
+{
+	*id = (int64_t)row;
+	return row % 7 != 3;
+}
+
+static const char *test_parquet_method(size_t row)
+{
+	return row % 5 == 4 ? 0 : test_parquet_methods[row % 3];
+}
+
+static const char *test_parquet_user_agent(size_t row, char *user_agent,
+					   size_t len)
+{
+	if (row % 11 == 0) {
+		return 0;
+	}
+	snprintf(user_agent, len, "friendly-scanner/%zu", row);
+
+	return user_agent;
+}
+
+// Just enough of a Thrift compact protocol reader for the footer and page
+// headers
+typedef struct test_thrift test_thrift;
+struct test_thrift {
+	const uint8_t *data;
+	size_t len;
+	size_t pos;
+};
+
+static uint8_t test_thrift_byte(test_thrift *in)
+{
+	assert_true(in->pos < in->len);
+
+	return in->data[in->pos++];
+}
+
+static uint64_t test_thrift_varint(test_thrift *in)
+{
+	uint64_t value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		uint8_t byte = test_thrift_byte(in);
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0) {
+			return value;
+		}
+	}
+	fail_msg("Thrift varint too long");
+
+	return 0;
+}
+
+static int64_t test_thrift_zigzag(test_thrift *in)
+{
+	uint64_t value = test_thrift_varint(in);
+
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// The next field of a struct, false at its end
+static bool test_thrift_field(test_thrift *in, int16_t *field_id,
+			      uint8_t *type)
+{
+	uint8_t byte = test_thrift_byte(in);
+	if (byte == 0) {
+		return false;
+	}
+
+	*type = byte & 0x0f;
+	if ((byte >> 4) != 0) {
+		*field_id = (int16_t)(*field_id + (byte >> 4));
+	} else {
+		*field_id = (int16_t)test_thrift_zigzag(in);
+	}
+
+	return true;
+}
+
+static size_t test_thrift_list(test_thrift *in, uint8_t *type)
+{
+	uint8_t byte = test_thrift_byte(in);
+	*type = byte & 0x0f;
+	size_t count = byte >> 4;
+	if (count == 15) {
+		count = test_thrift_varint(in);
+	}
+
+	return count;
+}
+
+static void test_thrift_string(test_thrift *in, char *value, size_t len)
+{
+	size_t value_len = test_thrift_varint(in);
+	assert_true(value_len < len);
+	assert_true(value_len <= in->len - in->pos);
+	memcpy(value, in->data + in->pos, value_len);
+	value[value_len] = '\0';
+	in->pos += value_len;
+}
+
+static void test_thrift_skip(test_thrift *in, uint8_t type)
+{
+	switch (type) {
+	case TEST_THRIFT_BOOL_TRUE:
+	case TEST_THRIFT_BOOL_FALSE:
+		// In the field header
+		break;
+	case TEST_THRIFT_BYTE:
+		test_thrift_byte(in);
+		break;
+	case TEST_THRIFT_I16:
+	case TEST_THRIFT_I32:
+	case TEST_THRIFT_I64:
+		test_thrift_varint(in);
+		break;
+	case TEST_THRIFT_DOUBLE:
+		assert_true(in->len - in->pos >= 8);
+		in->pos += 8;
+		break;
+	case TEST_THRIFT_BINARY: {
+		size_t len = test_thrift_varint(in);
+		assert_true(len <= in->len - in->pos);
+		in->pos += len;
+		break;
+	}
+	case TEST_THRIFT_LIST:
+	case TEST_THRIFT_SET: {
+		uint8_t element_type = 0;
+		size_t count = test_thrift_list(in, &element_type);
+		for (size_t i = 0; i < count; i++) {
+			test_thrift_skip(in, element_type);
+		}
+		break;
+	}
+	case TEST_THRIFT_STRUCT: {
+		int16_t field_id = 0;
+		uint8_t field_type = 0;
+		while (test_thrift_field(in, &field_id, &field_type)) {
+			test_thrift_skip(in, field_type);
+		}
+		break;
+	}
+	default:
+		fail_msg("Unexpected Thrift type %d", type);
+	}
+}
+
+typedef struct test_parquet_chunk test_parquet_chunk;
+struct test_parquet_chunk {
+	int32_t type;
+	int32_t codec;
+	bool rle_dictionary;
+	int64_t num_values;
+	int64_t data_page_offset;
+	int64_t dictionary_page_offset;
+	int64_t null_count;
+};
+
+typedef struct test_parquet_meta test_parquet_meta;
+struct test_parquet_meta {
+	int64_t num_rows;
+	size_t schema_count;
+	int32_t num_children;
+	char names[TEST_PARQUET_COLUMNS][TEST_PARQUET_NAME_MAX];
+	int32_t types[TEST_PARQUET_COLUMNS];
+	int32_t repetitions[TEST_PARQUET_COLUMNS];
+	int32_t converted_types[TEST_PARQUET_COLUMNS];
+	size_t row_group_count;
+	int64_t row_group_rows[TEST_PARQUET_ROW_GROUPS_MAX];
+	test_parquet_chunk chunks[TEST_PARQUET_ROW_GROUPS_MAX]
+				 [TEST_PARQUET_COLUMNS];
+};
+
+// The root, then a SchemaElement per column
+static void test_parquet_schema_element(test_thrift *in,
+					test_parquet_meta *meta, size_t index)
+{
+	size_t column = index - 1;
+	if (index > 0) {
+		assert_true(column < TEST_PARQUET_COLUMNS);
+		meta->converted_types[column] = -1;
+	}
+
+	int16_t field_id = 0;
+	uint8_t type = 0;
+	while (test_thrift_field(in, &field_id, &type)) {
+		if (index == 0 && field_id == 5) {
+			meta->num_children = (int32_t)test_thrift_zigzag(in);
+		} else if (index > 0 && field_id == 1) {
+			meta->types[column] = (int32_t)test_thrift_zigzag(in);
+		} else if (index > 0 && field_id == 3) {
+			meta->repetitions[column] =
+				(int32_t)test_thrift_zigzag(in);
+		} else if (index > 0 && field_id == 4) {
+			test_thrift_string(in, meta->names[column],
+					   TEST_PARQUET_NAME_MAX);
+		} else if (index > 0 && field_id == 6) {
+			meta->converted_types[column] =
+				(int32_t)test_thrift_zigzag(in);
+		} else {
+			test_thrift_skip(in, type);
+		}
+	}
+}
+
+static void test_parquet_column_meta(test_thrift *in,
+				     test_parquet_chunk *chunk)
+{
+	chunk->dictionary_page_offset = -1;
+
+	int16_t field_id = 0;
+	uint8_t type = 0;
+	while (test_thrift_field(in, &field_id, &type)) {
+		if (field_id == 1) {
+			chunk->type = (int32_t)test_thrift_zigzag(in);
+		} else if (field_id == 2) {
+			uint8_t element_type = 0;
+			size_t count = test_thrift_list(in, &element_type);
+			assert_int_equal(element_type, TEST_THRIFT_I32);
+			for (size_t i = 0; i < count; i++) {
+				if (test_thrift_zigzag(in) ==
+				    TEST_PARQUET_ENCODING_RLE_DICTIONARY) {
+					chunk->rle_dictionary = true;
+				}
+			}
+		} else if (field_id == 4) {
+			chunk->codec = (int32_t)test_thrift_zigzag(in);
+		} else if (field_id == 5) {
+			chunk->num_values = test_thrift_zigzag(in);
+		} else if (field_id == 9) {
+			chunk->data_page_offset = test_thrift_zigzag(in);
+		} else if (field_id == 11) {
+			chunk->dictionary_page_offset = test_thrift_zigzag(in);
+		} else if (field_id == 12) {
+			// Statistics
+			int16_t stats_field_id = 0;
+			uint8_t stats_type = 0;
+			while (test_thrift_field(in, &stats_field_id,
+						 &stats_type)) {
+				if (stats_field_id == 3) {
+					chunk->null_count =
+						test_thrift_zigzag(in);
+				} else {
+					test_thrift_skip(in, stats_type);
+				}
+			}
+		} else {
+			test_thrift_skip(in, type);
+		}
+	}
+}
+
+static void test_parquet_row_group(test_thrift *in, test_parquet_meta *meta,
+				   size_t group)
+{
+	assert_true(group < TEST_PARQUET_ROW_GROUPS_MAX);
+
+	int16_t field_id = 0;
+	uint8_t type = 0;
+	while (test_thrift_field(in, &field_id, &type)) {
+		if (field_id == 1) {
+			uint8_t element_type = 0;
+			size_t count = test_thrift_list(in, &element_type);
+			assert_int_equal(count, TEST_PARQUET_COLUMNS);
+			for (size_t column = 0; column < count; column++) {
+				// ColumnChunk, with its meta_data in field 3
+				int16_t chunk_field_id = 0;
+				uint8_t chunk_type = 0;
+				while (test_thrift_field(in, &chunk_field_id,
+							 &chunk_type)) {
+					if (chunk_field_id == 3) {
+						test_parquet_column_meta(
+							in,
+							&meta->chunks[group]
+								     [column]);
+					} else {
+						test_thrift_skip(in,
+								 chunk_type);
+					}
+				}
+			}
+		} else if (field_id == 3) {
+			meta->row_group_rows[group] = test_thrift_zigzag(in);
+		} else {
+			test_thrift_skip(in, type);
+		}
+	}
+}
+
+static uint32_t test_parquet_le32(const uint8_t *data)
+{
+	return (uint32_t)data[0] | (uint32_t)data[1] << 8 |
+	       (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+// Check the magic at both ends and read the footer
+static void test_parquet_footer(const uint8_t *file, size_t file_len,
+				test_parquet_meta *meta)
+{
+	assert_true(file_len > 2 * PARQUET_MAGIC_LEN + 4);
+	assert_memory_equal(file, PARQUET_MAGIC, PARQUET_MAGIC_LEN);
+	assert_memory_equal(file + file_len - PARQUET_MAGIC_LEN, PARQUET_MAGIC,
+			    PARQUET_MAGIC_LEN);
+	size_t footer_len =
+		test_parquet_le32(file + file_len - PARQUET_MAGIC_LEN - 4);
+	assert_true(footer_len < file_len - 2 * PARQUET_MAGIC_LEN - 4);
+
+	test_thrift in = {
+		.data = file + file_len - PARQUET_MAGIC_LEN - 4 - footer_len,
+		.len = footer_len,
+	};
+	int16_t field_id = 0;
+	uint8_t type = 0;
+	while (test_thrift_field(&in, &field_id, &type)) {
+		uint8_t element_type = 0;
+		if (field_id == 2) {
+			meta->schema_count = test_thrift_list(&in, &element_type);
+			assert_int_equal(meta->schema_count,
+					 TEST_PARQUET_COLUMNS + 1);
+			for (size_t i = 0; i < meta->schema_count; i++) {
+				test_parquet_schema_element(&in, meta, i);
+			}
+		} else if (field_id == 3) {
+			meta->num_rows = test_thrift_zigzag(&in);
+		} else if (field_id == 4) {
+			meta->row_group_count =
+				test_thrift_list(&in, &element_type);
+			for (size_t i = 0; i < meta->row_group_count; i++) {
+				test_parquet_row_group(&in, meta, i);
+			}
+		} else {
+			test_thrift_skip(&in, type);
+		}
+	}
+	assert_int_equal(in.pos, in.len);
+}
+
+typedef struct test_parquet_page test_parquet_page;
+struct test_parquet_page {
+	int32_t type;
+	int32_t num_values;
+	int32_t encoding;
+	uint8_t *body;
+	size_t body_len;
+};
+
+// Read the page header at *offset and its body, uncompressed, moving
+// *offset past it
+static void test_parquet_page_read(const uint8_t *file, size_t file_len,
+				   int64_t *offset, int32_t codec,
+				   test_parquet_page *page)
+{
+	assert_true(*offset > 0 && (size_t)*offset < file_len);
+	test_thrift in = { .data = file, .len = file_len, .pos = *offset };
+	int32_t uncompressed_len = -1;
+	int32_t compressed_len = -1;
+
+	int16_t field_id = 0;
+	uint8_t type = 0;
+	while (test_thrift_field(&in, &field_id, &type)) {
+		if (field_id == 1) {
+			page->type = (int32_t)test_thrift_zigzag(&in);
+		} else if (field_id == 2) {
+			uncompressed_len = (int32_t)test_thrift_zigzag(&in);
+		} else if (field_id == 3) {
+			compressed_len = (int32_t)test_thrift_zigzag(&in);
+		} else if (field_id == 5 || field_id == 7) {
+			// DataPageHeader or DictionaryPageHeader, which start
+			// the same
+			int16_t header_field_id = 0;
+			uint8_t header_type = 0;
+			while (test_thrift_field(&in, &header_field_id,
+						 &header_type)) {
+				if (header_field_id == 1) {
+					page->num_values =
+						(int32_t)test_thrift_zigzag(&in);
+				} else if (header_field_id == 2) {
+					page->encoding =
+						(int32_t)test_thrift_zigzag(&in);
+				} else {
+					test_thrift_skip(&in, header_type);
+				}
+			}
+		} else {
+			test_thrift_skip(&in, type);
+		}
+	}
+	assert_true(uncompressed_len >= 0 && compressed_len >= 0);
+	assert_true((size_t)compressed_len <= file_len - in.pos);
+
+	page->body_len = (size_t)uncompressed_len;
+	page->body = malloc(page->body_len > 0 ? page->body_len : 1);
+	assert_non_null(page->body);
+	if (codec == TEST_PARQUET_CODEC_UNCOMPRESSED) {
+		assert_int_equal(compressed_len, uncompressed_len);
+		memcpy(page->body, file + in.pos, page->body_len);
+	} else {
+#if HAVE_ZSTD != 0
+		assert_int_equal(codec, TEST_PARQUET_CODEC_ZSTD);
+		assert_int_equal(ZSTD_decompress(page->body, page->body_len,
+						 file + in.pos,
+						 (size_t)compressed_len),
+				 page->body_len);
+#else
+		fail_msg("Unexpected Parquet codec %d", codec);
+#endif
+	}
+	*offset = (int64_t)in.pos + compressed_len;
+}
+
+// The RLE/bit-packing hybrid, for definition levels and dictionary indices
+static void test_parquet_rle(const uint8_t *data, size_t len, int bit_width,
+			     uint32_t *values, size_t count)
+{
+	test_thrift in = { .data = data, .len = len };
+	size_t i = 0;
+	while (i < count) {
+		uint64_t header = test_thrift_varint(&in);
+		if ((header & 1) != 0) {
+			uint64_t bits = 0;
+			int bit_count = 0;
+			for (size_t v = 0; v < (header >> 1) * 8; v++) {
+				while (bit_count < bit_width) {
+					bits |= (uint64_t)test_thrift_byte(&in)
+						<< bit_count;
+					bit_count += 8;
+				}
+				uint32_t value = (uint32_t)(
+					bits & ((1ULL << bit_width) - 1));
+				bits >>= bit_width;
+				bit_count -= bit_width;
+				if (i < count) {
+					values[i++] = value;
+				}
+			}
+		} else {
+			uint32_t value = 0;
+			for (int byte = 0; byte < (bit_width + 7) / 8; byte++) {
+				value |= (uint32_t)test_thrift_byte(&in)
+					 << (8 * byte);
+			}
+			for (uint64_t run = 0; run < header >> 1; run++) {
+				assert_true(i < count);
+				values[i++] = value;
+			}
+		}
+	}
+}
+
+// PLAIN BYTE_ARRAYs, each as a length and its bytes
+static char *test_parquet_plain_string(const uint8_t *data, size_t len,
+				       size_t *pos)
+{
+	assert_true(len - *pos >= 4);
+	size_t value_len = test_parquet_le32(data + *pos);
+	*pos += 4;
+	assert_true(value_len <= len - *pos);
+
+	char *value = malloc(value_len + 1);
+	assert_non_null(value);
+	memcpy(value, data + *pos, value_len);
+	value[value_len] = '\0';
+	*pos += value_len;
+
+	return value;
+}
+
+typedef struct test_parquet_values test_parquet_values;
+struct test_parquet_values {
+	size_t rows;
+	uint32_t *defined;
+	// Per row, where defined
+	int64_t *ints;
+	char **strings;
+};
+
+static void test_parquet_values_free(test_parquet_values *values)
+{
+	if (values->strings != 0) {
+		for (size_t row = 0; row < values->rows; row++) {
+			free(values->strings[row]);
+		}
+	}
+	free(values->strings);
+	free(values->ints);
+	free(values->defined);
+	memset(values, 0, sizeof(*values));
+}
+
+// Read back a column chunk, its dictionary page if it has one and then
+// its data page
+static void test_parquet_chunk_read(const uint8_t *file, size_t file_len,
+				    const test_parquet_chunk *chunk,
+				    test_parquet_values *values)
+{
+	char **dictionary = 0;
+	size_t dictionary_count = 0;
+	int64_t offset = chunk->data_page_offset;
+	test_parquet_page page = { 0 };
+
+	if (chunk->dictionary_page_offset >= 0) {
+		offset = chunk->dictionary_page_offset;
+		test_parquet_page_read(file, file_len, &offset, chunk->codec,
+				       &page);
+		assert_int_equal(page.type, TEST_PARQUET_PAGE_DICTIONARY);
+		assert_int_equal(page.encoding, TEST_PARQUET_ENCODING_PLAIN);
+		dictionary_count = (size_t)page.num_values;
+		dictionary = calloc(dictionary_count, sizeof(*dictionary));
+		assert_non_null(dictionary);
+		size_t pos = 0;
+		for (size_t i = 0; i < dictionary_count; i++) {
+			dictionary[i] = test_parquet_plain_string(
+				page.body, page.body_len, &pos);
+		}
+		assert_int_equal(pos, page.body_len);
+		free(page.body);
+	}
+	assert_int_equal(offset, chunk->data_page_offset);
+
+	test_parquet_page_read(file, file_len, &offset, chunk->codec, &page);
+	assert_int_equal(page.type, TEST_PARQUET_PAGE_DATA);
+	assert_int_equal(page.num_values, chunk->num_values);
+	values->rows = (size_t)page.num_values;
+	values->defined = calloc(values->rows, sizeof(*values->defined));
+	assert_non_null(values->defined);
+
+	// Length prefixed definition levels, then the values
+	assert_true(page.body_len >= 4);
+	size_t levels_len = test_parquet_le32(page.body);
+	assert_true(levels_len <= page.body_len - 4);
+	test_parquet_rle(page.body + 4, levels_len, 1, values->defined,
+			 values->rows);
+	size_t defined_count = 0;
+	for (size_t row = 0; row < values->rows; row++) {
+		defined_count += values->defined[row];
+	}
+	assert_int_equal(values->rows - defined_count, chunk->null_count);
+
+	const uint8_t *data = page.body + 4 + levels_len;
+	size_t data_len = page.body_len - 4 - levels_len;
+	size_t pos = 0;
+	if (chunk->type == PARQUET_TYPE_INT64) {
+		assert_int_equal(page.encoding, TEST_PARQUET_ENCODING_PLAIN);
+		values->ints = calloc(values->rows, sizeof(*values->ints));
+		assert_non_null(values->ints);
+		assert_int_equal(data_len, defined_count * 8);
+		for (size_t row = 0; row < values->rows; row++) {
+			if (values->defined[row]) {
+				values->ints[row] =
+					(int64_t)((uint64_t)test_parquet_le32(
+							  data + pos) |
+						  (uint64_t)test_parquet_le32(
+							  data + pos + 4)
+							  << 32);
+				pos += 8;
+			}
+		}
+	} else if (page.encoding == TEST_PARQUET_ENCODING_RLE_DICTIONARY) {
+		assert_non_null(dictionary);
+		values->strings = calloc(values->rows, sizeof(*values->strings));
+		assert_non_null(values->strings);
+		uint32_t *indices =
+			calloc(defined_count + 1, sizeof(*indices));
+		assert_non_null(indices);
+		assert_true(data_len >= 1);
+		test_parquet_rle(data + 1, data_len - 1, data[0], indices,
+				 defined_count);
+		size_t index = 0;
+		for (size_t row = 0; row < values->rows; row++) {
+			if (values->defined[row]) {
+				assert_true(indices[index] < dictionary_count);
+				values->strings[row] =
+					strdup(dictionary[indices[index++]]);
+				assert_non_null(values->strings[row]);
+			}
+		}
+		free(indices);
+	} else {
+		assert_int_equal(page.encoding, TEST_PARQUET_ENCODING_PLAIN);
+		assert_null(dictionary);
+		values->strings = calloc(values->rows, sizeof(*values->strings));
+		assert_non_null(values->strings);
+		for (size_t row = 0; row < values->rows; row++) {
+			if (values->defined[row]) {
+				values->strings[row] =
+					test_parquet_plain_string(
+						data, data_len, &pos);
+			}
+		}
+		assert_int_equal(pos, data_len);
+	}
+	free(page.body);
+
+	for (size_t i = 0; i < dictionary_count; i++) {
+		free(dictionary[i]);
+	}
+	free(dictionary);
+}
+
+static uint8_t *test_parquet_file_read(const char *file_name, size_t *len)
+{
+	FILE *file = fopen(file_name, "rb");
+	assert_non_null(file);
+	assert_int_equal(fseek(file, 0, SEEK_END), 0);
+	long file_len = ftell(file);
+	assert_true(file_len > 0);
+	assert_int_equal(fseek(file, 0, SEEK_SET), 0);
+
+	uint8_t *data = malloc((size_t)file_len);
+	assert_non_null(data);
+	assert_int_equal(fread(data, 1, (size_t)file_len, file), file_len);
+	assert_int_equal(fclose(file), 0);
+	*len = (size_t)file_len;
+
+	return data;
+}
+
+void test_parquet_writer(void **state)
+{
+	(void)state; /* unused */
+
+	parquet_writer *writer = parquet_writer_new(
+		TEST_PARQUET_FILE, test_parquet_columns, TEST_PARQUET_COLUMNS);
+	assert_non_null(writer);
+
+	char user_agent[64];
+	for (size_t row = 0; row < TEST_PARQUET_ROWS; row++) {
+		int64_t id = 0;
+		if (test_parquet_id(row, &id)) {
+			parquet_writer_put_int64(writer, 0, id);
+		} else {
+			parquet_writer_put_null(writer, 0);
+		}
+		parquet_writer_put_string(writer, 1, test_parquet_method(row));
+		parquet_writer_put_string(
+			writer, 2,
+			test_parquet_user_agent(row, user_agent,
+						sizeof(user_agent)));
+		assert_int_equal(parquet_writer_end_row(writer), EXIT_SUCCESS);
+	}
+	assert_int_equal(parquet_writer_rows(writer), TEST_PARQUET_ROWS);
+	assert_int_equal(parquet_writer_close(&writer), EXIT_SUCCESS);
+	assert_null(writer);
+
+	size_t file_len = 0;
+	uint8_t *file = test_parquet_file_read(TEST_PARQUET_FILE, &file_len);
+	test_parquet_meta meta = { 0 };
+	test_parquet_footer(file, file_len, &meta);
+
+	// The schema as written
+	assert_int_equal(meta.num_rows, TEST_PARQUET_ROWS);
+	assert_int_equal(meta.num_children, TEST_PARQUET_COLUMNS);
+	for (size_t column = 0; column < TEST_PARQUET_COLUMNS; column++) {
+		assert_string_equal(meta.names[column],
+				    test_parquet_columns[column].name);
+		assert_int_equal(meta.types[column],
+				 test_parquet_columns[column].type);
+		assert_int_equal(meta.repetitions[column],
+				 TEST_PARQUET_REPETITION_OPTIONAL);
+		assert_int_equal(meta.converted_types[column],
+				 test_parquet_columns[column].type ==
+						 PARQUET_TYPE_BYTE_ARRAY ?
+					 TEST_PARQUET_CONVERTED_TYPE_UTF8 :
+					 -1);
+	}
+
+	// A full row group and what's left
+	assert_int_equal(meta.row_group_count, 2);
+	assert_int_equal(meta.row_group_rows[0], PARQUET_ROW_GROUP_ROWS);
+	assert_int_equal(meta.row_group_rows[1],
+			 TEST_PARQUET_ROWS - PARQUET_ROW_GROUP_ROWS);
+
+	// honey_id is never a dictionary and method always is. user_agent
+	// is too many different values for one in the first row group, so
+	// goes back to PLAIN, but fits in the second.
+	assert_false(meta.chunks[0][0].rle_dictionary);
+	assert_int_equal(meta.chunks[0][0].dictionary_page_offset, -1);
+	assert_true(meta.chunks[0][1].rle_dictionary);
+	assert_true(meta.chunks[1][1].rle_dictionary);
+	assert_false(meta.chunks[0][2].rle_dictionary);
+	assert_int_equal(meta.chunks[0][2].dictionary_page_offset, -1);
+	assert_true(meta.chunks[1][2].rle_dictionary);
+	assert_true(meta.chunks[1][2].dictionary_page_offset > 0);
+
+	// Every value and null, back as they went in
+	size_t first_row = 0;
+	for (size_t group = 0; group < meta.row_group_count; group++) {
+		size_t group_rows = (size_t)meta.row_group_rows[group];
+		for (size_t column = 0; column < TEST_PARQUET_COLUMNS;
+		     column++) {
+			const test_parquet_chunk *chunk =
+				&meta.chunks[group][column];
+			assert_int_equal(chunk->type,
+					 test_parquet_columns[column].type);
+#if HAVE_ZSTD != 0
+			assert_int_equal(chunk->codec,
+					 TEST_PARQUET_CODEC_ZSTD);
+#else
+			assert_int_equal(chunk->codec,
+					 TEST_PARQUET_CODEC_UNCOMPRESSED);
+#endif
+			assert_int_equal(chunk->num_values, group_rows);
+
+			test_parquet_values values = { 0 };
+			test_parquet_chunk_read(file, file_len, chunk, &values);
+			assert_int_equal(values.rows, group_rows);
+			for (size_t i = 0; i < group_rows; i++) {
+				size_t row = first_row + i;
+				if (column == 0) {
+					int64_t id = 0;
+					bool defined = test_parquet_id(row, &id);
+					assert_int_equal(values.defined[i],
+							 defined);
+					if (defined) {
+						assert_int_equal(
+							values.ints[i], id);
+					}
+					continue;
+				}
+
+				const char *expected =
+					column == 1 ?
+						test_parquet_method(row) :
+						test_parquet_user_agent(
+							row, user_agent,
+							sizeof(user_agent));
+				if (expected == 0) {
+					assert_int_equal(values.defined[i], 0);
+					assert_null(values.strings[i]);
+				} else {
+					assert_int_equal(values.defined[i], 1);
+					assert_string_equal(values.strings[i],
+							    expected);
+				}
+			}
+			test_parquet_values_free(&values);
+		}
+		first_row += group_rows;
+	}
+	assert_int_equal(first_row, TEST_PARQUET_ROWS);
+
+	free(file);
+	assert_int_equal(remove(TEST_PARQUET_FILE), 0);
+}
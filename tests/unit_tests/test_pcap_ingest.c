@@ -0,0 +1,448 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+
+#include "test_pcap_ingest.h"
+#include "test_database.h"
+#include "../../src/pcap_ingest.h"
+#include "../../src/sinks.h"
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_PCAP_FILE "test_sentrypeer.pcap"
+#define TEST_PCAPNG_FILE "test_sentrypeer.pcapng"
+#define TEST_PCAP_SECOND 1700000000
+
+typedef struct test_pcap_found test_pcap_found;
+struct test_pcap_found {
+	char method[16];
+	char transport_type[4];
+	char source_ip[INET6_ADDRSTRLEN];
+	char destination_ip[INET6_ADDRSTRLEN];
+	size_t len;
+	struct timespec seen;
+};
+
+static pthread_mutex_t found_lock = PTHREAD_MUTEX_INITIALIZER;
+static test_pcap_found found[16];
+static size_t found_count;
+
+static const char options[] = "OPTIONS sip:100@198.51.100.1 SIP/2.0\r\n"
+			      "Via: SIP/2.0/UDP 192.0.2.10:5060\r\n"
+			      "To: <sip:100@198.51.100.1>\r\n"
+			      "From: <sip:scanner@192.0.2.10>;tag=1\r\n"
+			      "Call-ID: 1@192.0.2.10\r\n"
+			      "CSeq: 1 OPTIONS\r\n"
+			      "User-Agent: friendly-scanner\r\n"
+			      "Content-Length: 0\r\n\r\n";
+
+static const char ok[] = "SIP/2.0 200 OK\r\n"
+			 "Via: SIP/2.0/UDP 192.0.2.10:5060\r\n"
+			 "Content-Length: 0\r\n\r\n";
+
+// A keepalive, then two requests, the first with a body
+static const char tcp_stream[] = "\r\n\r\n"
+				 "INVITE sip:900@198.51.100.1 SIP/2.0\r\n"
+				 "Via: SIP/2.0/TCP 192.0.2.20:40000\r\n"
+				 "To: <sip:900@198.51.100.1>\r\n"
+				 "l: 10\r\n\r\n"
+				 "v=0\r\no=x\r\n"
+				 "REGISTER sip:198.51.100.1 SIP/2.0\r\n"
+				 "To: <sip:901@198.51.100.1>\r\n"
+				 "Content-Length: 0\r\n\r\n";
+
+static const char register_ipv6[] = "REGISTER sip:[2001:db8::1] SIP/2.0\r\n"
+				    "To: <sip:902@[2001:db8::1]>\r\n"
+				    "Content-Length: 0\r\n\r\n";
+
+static int test_pcap_ingest_found(void *arg, const pcap_ingest_message *message)
+{
+	(void)arg; /* unused */
+
+	pthread_mutex_lock(&found_lock);
+	assert_true(found_count < 16);
+	test_pcap_found *entry = &found[found_count++];
+	size_t method_len = strcspn(message->sip_message, " ");
+	assert_true(method_len < sizeof(entry->method));
+	memcpy(entry->method, message->sip_message, method_len);
+	entry->method[method_len] = '\0';
+	strcpy(entry->transport_type, message->transport_type);
+	strcpy(entry->source_ip, message->source_ip);
+	strcpy(entry->destination_ip, message->destination_ip);
+	entry->len = message->sip_message_len;
+	entry->seen = message->seen;
+	pthread_mutex_unlock(&found_lock);
+
+	return EXIT_SUCCESS;
+}
+
+static const test_pcap_found *test_pcap_ingest_find(const char *method,
+						    const char *transport_type)
+{
+	for (size_t i = 0; i < found_count; i++) {
+		if (strcmp(found[i].method, method) == 0 &&
+		    strcmp(found[i].transport_type, transport_type) == 0) {
+			return &found[i];
+		}
+	}
+
+	return 0;
+}
+
+static size_t test_pcap_ipv4(uint8_t *packet, uint8_t protocol,
+			     const char *source_ip,
+			     const char *destination_ip, uint16_t flags,
+			     size_t len)
+{
+	memset(packet, 0, 20);
+	packet[0] = 0x45;
+	packet[2] = (uint8_t)((20 + len) >> 8);
+	packet[3] = (uint8_t)(20 + len);
+	packet[6] = (uint8_t)(flags >> 8);
+	packet[7] = (uint8_t)flags;
+	packet[8] = 64;
+	packet[9] = protocol;
+	inet_pton(AF_INET, source_ip, packet + 12);
+	inet_pton(AF_INET, destination_ip, packet + 16);
+
+	return 20;
+}
+
+static size_t test_pcap_udp(uint8_t *packet, uint16_t source_port,
+			    uint16_t destination_port, const char *payload,
+			    size_t len)
+{
+	packet[0] = (uint8_t)(source_port >> 8);
+	packet[1] = (uint8_t)source_port;
+	packet[2] = (uint8_t)(destination_port >> 8);
+	packet[3] = (uint8_t)destination_port;
+	packet[4] = (uint8_t)((8 + len) >> 8);
+	packet[5] = (uint8_t)(8 + len);
+	packet[6] = 0;
+	packet[7] = 0;
+	memcpy(packet + 8, payload, len);
+
+	return 8 + len;
+}
+
+static size_t test_pcap_ethernet(uint8_t *frame, uint16_t ethertype)
+{
+	memset(frame, 0, 12);
+	frame[12] = (uint8_t)(ethertype >> 8);
+	frame[13] = (uint8_t)ethertype;
+
+	return 14;
+}
+
+static size_t test_pcap_udp_frame(uint8_t *frame, const char *source_ip,
+				  const char *destination_ip,
+				  const char *payload, size_t len)
+{
+	size_t offset = test_pcap_ethernet(frame, 0x0800);
+	offset += test_pcap_ipv4(frame + offset, IPPROTO_UDP, source_ip,
+				 destination_ip, 0, 8 + len);
+
+	return offset + test_pcap_udp(frame + offset, 5060, 5060, payload, len);
+}
+
+static size_t test_pcap_tcp_frame(uint8_t *frame, uint32_t seq, uint8_t flags,
+				  const char *payload, size_t len)
+{
+	size_t offset = test_pcap_ethernet(frame, 0x0800);
+	offset += test_pcap_ipv4(frame + offset, IPPROTO_TCP, "192.0.2.20",
+				 "198.51.100.1", 0, 20 + len);
+	uint8_t *tcp = frame + offset;
+	memset(tcp, 0, 20);
+	tcp[0] = 40000 >> 8;
+	tcp[1] = 40000 & 0xff;
+	tcp[2] = 5060 >> 8;
+	tcp[3] = 5060 & 0xff;
+	tcp[4] = (uint8_t)(seq >> 24);
+	tcp[5] = (uint8_t)(seq >> 16);
+	tcp[6] = (uint8_t)(seq >> 8);
+	tcp[7] = (uint8_t)seq;
+	tcp[12] = 5 << 4;
+	tcp[13] = flags;
+	memcpy(tcp + 20, payload, len);
+
+	return offset + 20 + len;
+}
+
+static void test_pcap_record(FILE *pcap, uint32_t usec, const uint8_t *frame,
+			     size_t len)
+{
+	uint32_t record[4] = { TEST_PCAP_SECOND, usec, (uint32_t)len,
+			       (uint32_t)len };
+	assert_int_equal(fwrite(record, sizeof(record), 1, pcap), 1);
+	assert_int_equal(fwrite(frame, len, 1, pcap), 1);
+}
+
+static void test_pcap_write(void)
+{
+	FILE *pcap = fopen(TEST_PCAP_FILE, "wb");
+	assert_non_null(pcap);
+	uint32_t header[6] = { 0xa1b2c3d4, 0x00040002, 0, 0, 65535, 1 };
+	assert_int_equal(fwrite(header, sizeof(header), 1, pcap), 1);
+
+	uint8_t frame[2048];
+	size_t len = test_pcap_udp_frame(frame, "192.0.2.10", "198.51.100.1",
+					 options, strlen(options));
+	test_pcap_record(pcap, 1, frame, len);
+	len = test_pcap_udp_frame(frame, "198.51.100.1", "192.0.2.10", ok,
+				  strlen(ok));
+	test_pcap_record(pcap, 2, frame, len);
+	len = test_pcap_udp_frame(frame, "192.0.2.11", "198.51.100.1",
+				  "hello", 5);
+	test_pcap_record(pcap, 3, frame, len);
+
+	// A fragment and ARP are skipped
+	len = test_pcap_ethernet(frame, 0x0800);
+	len += test_pcap_ipv4(frame + len, IPPROTO_UDP, "192.0.2.12",
+			      "198.51.100.1", 0x2000, 8 + strlen(options));
+	len += test_pcap_udp(frame + len, 5060, 5060, options, strlen(options));
+	test_pcap_record(pcap, 4, frame, len);
+	len = test_pcap_ethernet(frame, 0x0806);
+	memset(frame + len, 0, 28);
+	test_pcap_record(pcap, 5, frame, len + 28);
+
+	// Out of order, with a retransmission
+	size_t stream_len = strlen(tcp_stream);
+	size_t cut_one = 30;
+	size_t cut_two = 120;
+	len = test_pcap_tcp_frame(frame, 999, 0x02, "", 0);
+	test_pcap_record(pcap, 10, frame, len);
+	len = test_pcap_tcp_frame(frame, 1000, 0x18, tcp_stream, cut_one);
+	test_pcap_record(pcap, 11, frame, len);
+	len = test_pcap_tcp_frame(frame, 1000 + (uint32_t)cut_two, 0x18,
+				  tcp_stream + cut_two, stream_len - cut_two);
+	test_pcap_record(pcap, 12, frame, len);
+	len = test_pcap_tcp_frame(frame, 1000 + (uint32_t)cut_one, 0x18,
+				  tcp_stream + cut_one, cut_two - cut_one);
+	test_pcap_record(pcap, 13, frame, len);
+	len = test_pcap_tcp_frame(frame, 1000, 0x18, tcp_stream, cut_one);
+	test_pcap_record(pcap, 14, frame, len);
+	len = test_pcap_tcp_frame(frame, 1000 + (uint32_t)stream_len, 0x11, "",
+				  0);
+	test_pcap_record(pcap, 15, frame, len);
+
+	// IPv6 in a VLAN
+	len = test_pcap_ethernet(frame, 0x8100);
+	frame[len + 2] = 0x86;
+	frame[len + 3] = 0xdd;
+	len += 4;
+	uint8_t *ipv6 = frame + len;
+	memset(ipv6, 0, 40);
+	ipv6[0] = 0x60;
+	size_t udp_len = 8 + strlen(register_ipv6);
+	ipv6[4] = (uint8_t)(udp_len >> 8);
+	ipv6[5] = (uint8_t)udp_len;
+	ipv6[6] = IPPROTO_UDP;
+	inet_pton(AF_INET6, "2001:db8::5", ipv6 + 8);
+	inet_pton(AF_INET6, "2001:db8::1", ipv6 + 24);
+	len += 40;
+	len += test_pcap_udp(frame + len, 5060, 5060, register_ipv6,
+			     strlen(register_ipv6));
+	test_pcap_record(pcap, 16, frame, len);
+
+	assert_int_equal(fclose(pcap), 0);
+}
+
+static void test_pcapng_u32(FILE *pcapng, uint32_t value)
+{
+	// Big endian, to check the other byte order too
+	uint8_t bytes[4] = { (uint8_t)(value >> 24), (uint8_t)(value >> 16),
+			     (uint8_t)(value >> 8), (uint8_t)value };
+	assert_int_equal(fwrite(bytes, sizeof(bytes), 1, pcapng), 1);
+}
+
+static void test_pcapng_write(void)
+{
+	FILE *pcapng = fopen(TEST_PCAPNG_FILE, "wb");
+	assert_non_null(pcapng);
+
+	// Section header
+	test_pcapng_u32(pcapng, 0x0a0d0d0a);
+	test_pcapng_u32(pcapng, 28);
+	test_pcapng_u32(pcapng, 0x1a2b3c4d);
+	test_pcapng_u32(pcapng, 0x00010000);
+	test_pcapng_u32(pcapng, 0xffffffff);
+	test_pcapng_u32(pcapng, 0xffffffff);
+	test_pcapng_u32(pcapng, 28);
+
+	// Raw IP interface in nanoseconds
+	test_pcapng_u32(pcapng, 1);
+	test_pcapng_u32(pcapng, 32);
+	test_pcapng_u32(pcapng, 101 << 16);
+	test_pcapng_u32(pcapng, 65535);
+	test_pcapng_u32(pcapng, 0x00090001);
+	test_pcapng_u32(pcapng, 0x09000000);
+	test_pcapng_u32(pcapng, 0);
+	test_pcapng_u32(pcapng, 32);
+
+	uint8_t packet[1024];
+	size_t len = test_pcap_ipv4(packet, IPPROTO_UDP, "192.0.2.30",
+				    "198.51.100.1", 0, 8 + strlen(options));
+	len += test_pcap_udp(packet + len, 5060, 5060, options,
+			     strlen(options));
+	size_t padded = (len + 3) & ~(size_t)3;
+	memset(packet + len, 0, padded - len);
+
+	uint64_t timestamp = (uint64_t)TEST_PCAP_SECOND * 1000000000 + 5;
+	test_pcapng_u32(pcapng, 6);
+	test_pcapng_u32(pcapng, (uint32_t)(32 + padded));
+	test_pcapng_u32(pcapng, 0);
+	test_pcapng_u32(pcapng, (uint32_t)(timestamp >> 32));
+	test_pcapng_u32(pcapng, (uint32_t)timestamp);
+	test_pcapng_u32(pcapng, (uint32_t)len);
+	test_pcapng_u32(pcapng, (uint32_t)len);
+	assert_int_equal(fwrite(packet, padded, 1, pcapng), 1);
+	test_pcapng_u32(pcapng, (uint32_t)(32 + padded));
+
+	// Simple packet block, with no timestamp
+	test_pcapng_u32(pcapng, 3);
+	test_pcapng_u32(pcapng, (uint32_t)(16 + padded));
+	test_pcapng_u32(pcapng, (uint32_t)len);
+	assert_int_equal(fwrite(packet, padded, 1, pcapng), 1);
+	test_pcapng_u32(pcapng, (uint32_t)(16 + padded));
+
+	assert_int_equal(fclose(pcapng), 0);
+}
+
+static void test_pcap_ingest_check(size_t workers)
+{
+	pcap_ingest_stats stats;
+	found_count = 0;
+	assert_int_equal(pcap_ingest_file(TEST_PCAP_FILE, workers,
+					  test_pcap_ingest_found, 0, &stats),
+			 EXIT_SUCCESS);
+	assert_int_equal(stats.packets, 12);
+	assert_int_equal(stats.skipped, 2);
+	assert_int_equal(stats.sip_requests, 4);
+	assert_int_equal(stats.sip_responses, 1);
+	assert_int_equal(stats.events, 4);
+	assert_int_equal(stats.failed, 0);
+	assert_int_equal(found_count, 4);
+
+	const test_pcap_found *entry = test_pcap_ingest_find("OPTIONS", "UDP");
+	assert_non_null(entry);
+	assert_string_equal(entry->source_ip, "192.0.2.10");
+	assert_string_equal(entry->destination_ip, "198.51.100.1");
+	assert_int_equal(entry->len, strlen(options));
+	assert_int_equal(entry->seen.tv_sec, TEST_PCAP_SECOND);
+	assert_int_equal(entry->seen.tv_nsec, 1000);
+
+	entry = test_pcap_ingest_find("INVITE", "TCP");
+	assert_non_null(entry);
+	assert_string_equal(entry->source_ip, "192.0.2.20");
+	const char *invite = strstr(tcp_stream, "INVITE");
+	assert_int_equal(entry->len, strstr(tcp_stream, "REGISTER") - invite);
+	// When the segment that finished it arrived
+	assert_int_equal(entry->seen.tv_nsec, 12000);
+
+	entry = test_pcap_ingest_find("REGISTER", "TCP");
+	assert_non_null(entry);
+	assert_int_equal(entry->len, strlen(strstr(tcp_stream, "REGISTER")));
+
+	entry = test_pcap_ingest_find("REGISTER", "UDP");
+	assert_non_null(entry);
+	assert_string_equal(entry->source_ip, "2001:db8::5");
+	assert_string_equal(entry->destination_ip, "2001:db8::1");
+}
+
+static atomic_size_t logged;
+static atomic_size_t logged_when_captured;
+
+static int test_pcap_ingest_sink_write(sentrypeer_config *config,
+				       sink_event *const *events, size_t count)
+{
+	(void)config; /* unused */
+
+	struct timespec captured = { .tv_sec = TEST_PCAP_SECOND,
+				     .tv_nsec = 1000 };
+	char expected[TIMESTAMP_LEN];
+	event_timestamp_at(&captured, expected);
+
+	for (size_t i = 0; i < count; i++) {
+		const bad_actor *bad_actor_event = events[i]->bad_actor;
+		if (strcmp(bad_actor_event->method, "OPTIONS") == 0 &&
+		    strcmp(bad_actor_event->event_timestamp, expected) == 0 &&
+		    strcmp(bad_actor_event->destination_ip, "198.51.100.1") ==
+			    0) {
+			atomic_fetch_add(&logged_when_captured, 1);
+		}
+	}
+	atomic_fetch_add(&logged, count);
+
+	return EXIT_SUCCESS;
+}
+
+void test_pcap_ingest(void **state)
+{
+	(void)state; /* unused */
+
+	test_pcap_write();
+	test_pcap_ingest_check(1);
+	test_pcap_ingest_check(4);
+
+	test_pcapng_write();
+	pcap_ingest_stats stats;
+	found_count = 0;
+	assert_int_equal(pcap_ingest_file(TEST_PCAPNG_FILE, 2,
+					  test_pcap_ingest_found, 0, &stats),
+			 EXIT_SUCCESS);
+	assert_int_equal(stats.packets, 2);
+	assert_int_equal(stats.events, 2);
+	assert_int_equal(found[0].seen.tv_sec, TEST_PCAP_SECOND);
+	assert_int_equal(found[0].seen.tv_nsec, 5);
+	assert_int_equal(found[1].seen.tv_nsec, 5);
+	assert_string_equal(found[0].source_ip, "192.0.2.30");
+
+	// Not a capture
+	assert_int_equal(pcap_ingest_file(TEST_DB_FILE, 1,
+					  test_pcap_ingest_found, 0, &stats),
+			 EXIT_FAILURE);
+	assert_int_equal(pcap_ingest_file("does_not_exist.pcap", 1,
+					  test_pcap_ingest_found, 0, &stats),
+			 EXIT_FAILURE);
+
+	// All the way through to the sinks
+	sentrypeer_config *config = sentrypeer_config_new();
+	assert_non_null(config);
+	strncpy(config->db_file, TEST_DB_FILE, SENTRYPEER_PATH_MAX);
+	config->sinks = sinks_new(config);
+	assert_non_null(config->sinks);
+	assert_int_equal(sinks_add(config->sinks, "pcap",
+				   test_pcap_ingest_sink_write, SINKS_BATCH_MAX,
+				   0),
+			 EXIT_SUCCESS);
+	assert_int_equal(pcap_ingest_run(config, TEST_PCAP_FILE, &stats),
+			 EXIT_SUCCESS);
+	sinks_destroy(&config->sinks);
+	assert_int_equal(stats.events, 4);
+	assert_int_equal(atomic_load(&logged), 4);
+	assert_int_equal(atomic_load(&logged_when_captured), 1);
+	sentrypeer_config_destroy(&config);
+
+	assert_int_equal(unlink(TEST_PCAP_FILE), 0);
+	assert_int_equal(unlink(TEST_PCAPNG_FILE), 0);
+}
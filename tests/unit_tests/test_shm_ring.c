@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+
+#include "test_shm_ring.h"
+#include "../../src/shm_ring_writer.h"
+#include "../../src/shm_ring_reader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <uuid/uuid.h>
+
+static bad_actor *test_shm_ring_bad_actor(const char *source_ip,
+					  const char *user_agent)
+{
+	bad_actor *bad_actor_event = bad_actor_new(
+		0, util_duplicate_string(source_ip),
+		util_duplicate_string("2001:db8::1"), util_duplicate_string("100"),
+		util_duplicate_string("OPTIONS"), util_duplicate_string("UDP"),
+		util_duplicate_string(user_agent),
+		util_duplicate_string("passive"),
+		"7b3d3a1e-5c9c-4f3a-9a53-0d3d0d3d0d3d");
+	assert_non_null(bad_actor_event);
+
+	return bad_actor_event;
+}
+
+void test_shm_ring(void **state)
+{
+	(void)state; /* unused */
+
+	char name[64];
+	snprintf(name, sizeof(name), "/sentrypeer-test-%d", (int)getpid());
+
+	assert_null(shm_ring_reader_open(name));
+	shm_ring_writer *writer = shm_ring_writer_new(name, 8);
+	assert_non_null(writer);
+
+	shm_ring_reader *reader = shm_ring_reader_open(name);
+	assert_non_null(reader);
+	assert_false(shm_ring_reader_closed(reader));
+	assert_false(shm_ring_reader_valid(reader));
+
+	uint64_t dropped = 0;
+	assert_null(shm_ring_reader_next(reader, &dropped));
+	assert_int_equal(shm_ring_reader_wait(reader, 0), EXIT_FAILURE);
+
+	bad_actor *bad_actor_event =
+		test_shm_ring_bad_actor("192.0.2.1", "friendly-scanner");
+	shm_ring_writer_write(writer, bad_actor_event, 0);
+	assert_int_equal(shm_ring_reader_wait(reader, 0), EXIT_SUCCESS);
+
+	const shm_ring_record *record =
+		shm_ring_reader_next(reader, &dropped);
+	assert_non_null(record);
+	assert_string_equal(shm_ring_record_method(record), "OPTIONS");
+	assert_string_equal(shm_ring_record_called_number(record), "100");
+	assert_string_equal(shm_ring_record_user_agent(record),
+			    "friendly-scanner");
+	assert_int_equal(record->transport, SHM_RING_TRANSPORT_UDP);
+	assert_int_equal(record->collected_method, SHM_RING_COLLECTED_PASSIVE);
+	assert_int_equal(record->flags, 0);
+	const uint8_t mapped[16] = { 0, 0, 0,    0,    0,   0, 0, 0,
+				     0, 0, 0xff, 0xff, 192, 0, 2, 1 };
+	assert_memory_equal(record->source_ip, mapped, sizeof(mapped));
+	assert_int_equal(record->destination_ip[0], 0x20);
+	assert_int_equal(record->created_by_node_id[0], 0x7b);
+	assert_true(record->seen_ns > 0);
+	uuid_t event_uuid;
+	assert_int_equal(uuid_parse(bad_actor_event->event_uuid, event_uuid),
+			 0);
+	assert_memory_equal(record->event_uuid, event_uuid, sizeof(uuid_t));
+	assert_true(shm_ring_reader_valid(reader));
+	assert_null(shm_ring_reader_next(reader, &dropped));
+	assert_int_equal(dropped, 0);
+	bad_actor_destroy(&bad_actor_event);
+
+	// Too long for the slot, so cut short between characters
+	char user_agent[1024];
+	memset(user_agent, 'a', sizeof(user_agent));
+	for (size_t i = 1; i + 2 < sizeof(user_agent); i += 2) {
+		user_agent[i] = (char)0xc3;
+		user_agent[i + 1] = (char)0xa9;
+	}
+	user_agent[sizeof(user_agent) - 1] = '\0';
+	bad_actor_event = test_shm_ring_bad_actor("2001:db8::2", user_agent);
+	shm_ring_writer_write(writer, bad_actor_event, SHM_RING_FROM_PEER);
+	bad_actor_destroy(&bad_actor_event);
+
+	record = shm_ring_reader_next(reader, &dropped);
+	assert_non_null(record);
+	assert_int_equal(record->flags, SHM_RING_FROM_PEER);
+	const char *truncated = shm_ring_record_user_agent(record);
+	assert_int_equal(strlen(truncated), record->user_agent_len);
+	assert_true(record->user_agent_len < sizeof(record->text));
+	assert_int_equal(record->user_agent_len % 2, 1);
+	assert_memory_equal(truncated, user_agent, record->user_agent_len);
+	assert_true(shm_ring_reader_valid(reader));
+
+	// Lapped, so we're told what we missed and carry on from the oldest
+	for (int i = 0; i < 20; i++) {
+		bad_actor_event =
+			test_shm_ring_bad_actor("192.0.2.3", "sipvicious");
+		shm_ring_writer_write(writer, bad_actor_event, 0);
+		bad_actor_destroy(&bad_actor_event);
+	}
+	record = shm_ring_reader_next(reader, &dropped);
+	assert_non_null(record);
+	assert_true(shm_ring_reader_valid(reader));
+	// Overwritten under us
+	for (int i = 0; i < 8; i++) {
+		bad_actor_event =
+			test_shm_ring_bad_actor("192.0.2.4", "sipvicious");
+		shm_ring_writer_write(writer, bad_actor_event, 0);
+		bad_actor_destroy(&bad_actor_event);
+	}
+	assert_false(shm_ring_reader_valid(reader));
+	assert_int_equal(dropped, 12);
+
+	int received = 0;
+	while (shm_ring_reader_next(reader, &dropped) != 0) {
+		received++;
+	}
+	assert_int_equal(received, 8);
+	assert_int_equal(dropped, 12 + 7);
+
+	shm_ring_writer_destroy(&writer);
+	assert_null(writer);
+	assert_true(shm_ring_reader_closed(reader));
+	assert_int_equal(shm_ring_reader_wait(reader, 1000), EXIT_FAILURE);
+	assert_null(shm_ring_reader_open(name));
+
+	shm_ring_reader_close(&reader);
+	assert_null(reader);
+}
@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/*
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+
+#include "test_sinks.h"
+#include "test_bad_actor.h"
+#include "test_database.h"
+#include "../../src/sinks.h"
+#include "../../src/database.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static atomic_size_t json_written;
+static atomic_size_t json_missing;
+static atomic_size_t local_written;
+static atomic_size_t stuck_written;
+static pthread_mutex_t stuck_gate = PTHREAD_MUTEX_INITIALIZER;
+
+static int json_sink_write(sentrypeer_config *config,
+			   sink_event *const *events, size_t count)
+{
+	(void)config; /* unused */
+
+	assert_true(count <= 8);
+	for (size_t i = 0; i < count; i++) {
+		if (events[i]->json == 0 ||
+		    strlen(events[i]->json) != events[i]->json_len ||
+		    strstr(events[i]->json, events[i]->bad_actor->event_uuid) ==
+			    0) {
+			atomic_fetch_add(&json_missing, 1);
+		}
+	}
+	atomic_fetch_add(&json_written, count);
+
+	return EXIT_SUCCESS;
+}
+
+static int local_sink_write(sentrypeer_config *config,
+			    sink_event *const *events, size_t count)
+{
+	(void)config; /* unused */
+
+	for (size_t i = 0; i < count; i++) {
+		assert_false(events[i]->flags & SINK_EVENT_FROM_PEER);
+	}
+	atomic_fetch_add(&local_written, count);
+
+	// Only this sink knows it failed
+	return EXIT_FAILURE;
+}
+
+static int stuck_sink_write(sentrypeer_config *config,
+			    sink_event *const *events, size_t count)
+{
+	(void)config; /* unused */
+	(void)events; /* unused */
+
+	pthread_mutex_lock(&stuck_gate);
+	atomic_fetch_add(&stuck_written, count);
+	pthread_mutex_unlock(&stuck_gate);
+
+	return EXIT_SUCCESS;
+}
+
+void test_sinks(void **state)
+{
+	(void)state; /* unused */
+
+	sentrypeer_config *config = sentrypeer_config_new();
+	assert_non_null(config);
+	config->debug_mode = true;
+	strncpy(config->db_file, TEST_DB_FILE, SENTRYPEER_PATH_MAX);
+
+	// Just the db, nothing else is turned on
+	sinks *pipeline = sinks_new(config);
+	assert_non_null(pipeline);
+	assert_int_equal(sinks_add(pipeline, "json", json_sink_write, 8,
+				   SINK_NEEDS_JSON),
+			 EXIT_SUCCESS);
+	assert_int_equal(sinks_add(pipeline, "local", local_sink_write,
+				   SINKS_BATCH_MAX, SINK_LOCAL_ONLY),
+			 EXIT_SUCCESS);
+	assert_int_equal(sinks_add(pipeline, "json", json_sink_write, 1, 0),
+			 EXIT_FAILURE);
+	assert_int_equal(sinks_enable(pipeline, "nope", false), EXIT_FAILURE);
+
+	char first_uuid[UTILS_UUID_STRING_LEN];
+	char last_uuid[UTILS_UUID_STRING_LEN];
+	for (int i = 0; i < 100; i++) {
+		bad_actor *bad_actor_event = test_bad_actor_event_new();
+		if (i == 0) {
+			strcpy(first_uuid, bad_actor_event->event_uuid);
+		}
+		strcpy(last_uuid, bad_actor_event->event_uuid);
+		assert_int_equal(sinks_publish(pipeline, bad_actor_event, 0), 3);
+	}
+	for (int i = 0; i < 10; i++) {
+		assert_int_equal(sinks_publish(pipeline,
+					       test_bad_actor_event_new(),
+					       SINK_EVENT_FROM_PEER),
+				 2);
+	}
+	assert_int_equal(sinks_enable(pipeline, "json", false), EXIT_SUCCESS);
+	assert_int_equal(
+		sinks_publish(pipeline, test_bad_actor_event_new(), 0), 2);
+
+	// Waits for everything queued to be written
+	sinks_destroy(&pipeline);
+	assert_null(pipeline);
+	assert_int_equal(atomic_load(&json_written), 110);
+	assert_int_equal(atomic_load(&json_missing), 0);
+	assert_int_equal(atomic_load(&local_written), 101);
+	assert_true(db_bad_actor_exists(first_uuid, config));
+	assert_true(db_bad_actor_exists(last_uuid, config));
+
+	// A sink that can't keep up loses events, nobody else waits for it
+	config->debug_mode = false;
+	pipeline = sinks_new(config);
+	assert_non_null(pipeline);
+	assert_int_equal(sinks_enable(pipeline, "db", false), EXIT_SUCCESS);
+	assert_int_equal(sinks_add(pipeline, "stuck", stuck_sink_write,
+				   SINKS_BATCH_MAX, 0),
+			 EXIT_SUCCESS);
+
+	size_t published = SINKS_QUEUE_CAPACITY + SINKS_BATCH_MAX + 1;
+	pthread_mutex_lock(&stuck_gate);
+	for (size_t i = 0; i < published; i++) {
+		sinks_publish(pipeline, test_bad_actor_event_new(), 0);
+	}
+	uint64_t dropped = sinks_dropped(pipeline, "stuck");
+	assert_true(dropped > 0);
+	pthread_mutex_unlock(&stuck_gate);
+
+	sinks_destroy(&pipeline);
+	assert_int_equal(atomic_load(&stuck_written) + dropped, published);
+
+	sentrypeer_config_destroy(&config);
+	assert_null(config);
+}
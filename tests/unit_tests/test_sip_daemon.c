@@ -11,6 +11,7 @@
                              |___/
 */
 
+#define _GNU_SOURCE // for SO_REUSEPORT
 #include <stdarg.h>
 #include <stddef.h>
 #include <setjmp.h>
@@ -18,7 +19,30 @@
 #include <cmocka.h>
 
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include "../../src/sip_daemon.h"
+#include "../../src/sip_daemon_io_uring.h"
+#include "../../src/database.h"
+
+#define TEST_SIP_WORKERS 4
+#define TEST_SIP_SOURCES 32
+#define TEST_SIP_OPTIONS                                                       \
+	"OPTIONS sip:100@127.0.0.1 SIP/2.0\r\n"                               \
+	"Via: SIP/2.0/UDP 127.0.0.1:5084;branch=z9hG4bK-3054909403;rport\r\n" \
+	"From: \"sipvicious\" <sip:100@1.1.1.1>;tag=643439663362\r\n"         \
+	"To: \"sipvicious\" <sip:100@1.1.1.1>\r\n"                            \
+	"Call-ID: 711444933874895842969934\r\n"                               \
+	"CSeq: 1 OPTIONS\r\n"                                                 \
+	"User-agent: friendly-scanner\r\n"                                    \
+	"Content-Length: 0\r\n\r\n"
 
 #if HAVE_RUST != 0
 #include "../../src/sentrypeer_rust.h"
@@ -43,3 +67,250 @@ void test_sip_daemon(void **state)
 	sentrypeer_config_destroy(&config);
 	assert_null(config);
 }
+
+static SOCKET bind_udp(const char *ip, in_port_t port, bool reuseport)
+{
+	SOCKET udp = socket(AF_INET, SOCK_DGRAM, 0);
+	assert_true(ISVALIDSOCKET(udp));
+
+	int enable = 1;
+	if (reuseport) {
+		assert_int_equal(setsockopt(udp, SOL_SOCKET, SO_REUSEPORT,
+					    &enable, sizeof(enable)),
+				 EXIT_SUCCESS);
+	}
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = port;
+	assert_int_equal(inet_pton(AF_INET, ip, &address.sin_addr), 1);
+	assert_int_equal(bind(udp, (struct sockaddr *)&address,
+			      sizeof(address)),
+			 EXIT_SUCCESS);
+
+	return udp;
+}
+
+void test_sip_daemon_steering(void **state)
+{
+	(void)state; /* unused */
+
+	assert_int_equal(sip_steering_from_string("source"),
+			 SIP_STEERING_SOURCE);
+	assert_int_equal(sip_steering_from_string("kernel"),
+			 SIP_STEERING_KERNEL);
+	assert_int_equal(sip_steering_from_string("round-robin"), -1);
+
+	// Same worker every time, and always one of them
+	struct in_addr source;
+	assert_int_equal(inet_pton(AF_INET, "192.0.2.1", &source), 1);
+	int worker = sip_daemon_worker_for(source, TEST_SIP_WORKERS);
+	assert_in_range(worker, 0, TEST_SIP_WORKERS - 1);
+	assert_int_equal(sip_daemon_worker_for(source, TEST_SIP_WORKERS),
+			 worker);
+	assert_int_equal(sip_daemon_worker_for(source, 1), 0);
+
+	// A group of workers on an ephemeral port, in bind order
+	SOCKET workers[TEST_SIP_WORKERS];
+	workers[0] = bind_udp("127.0.0.1", 0, true);
+	struct sockaddr_in bound;
+	socklen_t bound_len = sizeof(bound);
+	assert_int_equal(getsockname(workers[0], (struct sockaddr *)&bound,
+				     &bound_len),
+			 EXIT_SUCCESS);
+	for (int i = 1; i < TEST_SIP_WORKERS; i++) {
+		workers[i] = bind_udp("127.0.0.1", bound.sin_port, true);
+	}
+
+	if (sip_daemon_steer_by_source(workers[0], TEST_SIP_WORKERS) !=
+	    EXIT_SUCCESS) {
+		for (int i = 0; i < TEST_SIP_WORKERS; i++) {
+			CLOSESOCKET(workers[i]);
+		}
+		skip();
+	}
+
+	// Each source lands on the worker sip_daemon_worker_for() says
+	for (int i = 0; i < TEST_SIP_SOURCES; i++) {
+		char ip[INET_ADDRSTRLEN];
+		snprintf(ip, sizeof(ip), "127.0.0.%d", i + 2);
+		SOCKET sender = bind_udp(ip, 0, false);
+		assert_int_equal(sendto(sender, "OPTIONS", 7, 0,
+					(struct sockaddr *)&bound,
+					sizeof(bound)),
+				 7);
+		CLOSESOCKET(sender);
+
+		inet_pton(AF_INET, ip, &source);
+		int expected = sip_daemon_worker_for(source, TEST_SIP_WORKERS);
+		char buffer[16];
+		for (int w = 0; w < TEST_SIP_WORKERS; w++) {
+			ssize_t received = recv(workers[w], buffer,
+						sizeof(buffer), MSG_DONTWAIT);
+			if (w == expected) {
+				assert_int_equal(received, 7);
+			} else {
+				assert_int_equal(received, -1);
+			}
+		}
+	}
+
+	for (int i = 0; i < TEST_SIP_WORKERS; i++) {
+		CLOSESOCKET(workers[i]);
+	}
+}
+
+void test_sip_daemon_io_uring(void **state)
+{
+	(void)state; /* unused */
+
+	assert_int_equal(sip_backend_from_string("auto"), SIP_BACKEND_AUTO);
+	assert_int_equal(sip_backend_from_string("io_uring"),
+			 SIP_BACKEND_IO_URING);
+	assert_int_equal(sip_backend_from_string("select"),
+			 SIP_BACKEND_SELECT);
+	assert_int_equal(sip_backend_from_string("epoll"), -1);
+
+	// Falls back to select() where io_uring isn't built in or allowed,
+	// either way it has to start and stop cleanly
+	sentrypeer_config *config = sentrypeer_config_new();
+	assert_non_null(config);
+	config->sip_backend = SIP_BACKEND_IO_URING;
+	config->sip_workers = 2;
+
+	if (config->new_mode == false) {
+		assert_int_equal(sip_daemon_run(config), EXIT_SUCCESS);
+		assert_int_equal(sip_daemon_stop(config), EXIT_SUCCESS);
+	}
+
+	sentrypeer_config_destroy(&config);
+	assert_null(config);
+}
+
+typedef struct test_io_uring_worker {
+	sentrypeer_config *config;
+	SOCKET udp;
+	SOCKET tcp;
+	int stop_fd;
+	atomic_int status;
+	atomic_bool done;
+} test_io_uring_worker;
+
+static void *test_io_uring_serve(void *arg)
+{
+	test_io_uring_worker *worker = arg;
+	atomic_store(&worker->status,
+		     sip_daemon_io_uring_serve(worker->config, worker->udp,
+					       worker->tcp, worker->stop_fd));
+	atomic_store(&worker->done, true);
+
+	return NULL;
+}
+
+typedef struct test_io_uring_logged {
+	int udp;
+	int tcp;
+} test_io_uring_logged;
+
+static int test_io_uring_count(void *arg, db_honey_row const *row)
+{
+	test_io_uring_logged *logged = arg;
+	if (strcmp(row->transport_type, "UDP") == 0) {
+		logged->udp++;
+	} else if (strcmp(row->transport_type, "TCP") == 0) {
+		logged->tcp++;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+void test_sip_daemon_io_uring_events(void **state)
+{
+	sentrypeer_config *config = *state;
+	assert_non_null(config);
+
+	test_io_uring_worker worker;
+	memset(&worker, 0, sizeof(worker));
+	worker.config = config;
+	worker.stop_fd = sip_daemon_io_uring_stop_fd_new();
+	if (worker.stop_fd < 0) {
+		skip(); // Built without liburing
+	}
+
+	struct sockaddr_in bound;
+	socklen_t bound_len = sizeof(bound);
+	worker.udp = bind_udp("127.0.0.1", 0, false);
+	int enable = 1; // Like sip_daemon_listen(), for the destination
+	assert_int_equal(setsockopt(worker.udp, IPPROTO_IP, IP_PKTINFO,
+				    &enable, sizeof(enable)),
+			 EXIT_SUCCESS);
+	assert_int_equal(getsockname(worker.udp, (struct sockaddr *)&bound,
+				     &bound_len),
+			 EXIT_SUCCESS);
+
+	worker.tcp = socket(AF_INET, SOCK_STREAM, 0);
+	assert_true(ISVALIDSOCKET(worker.tcp));
+	assert_int_equal(bind(worker.tcp, (struct sockaddr *)&bound,
+			      sizeof(bound)),
+			 EXIT_SUCCESS);
+	assert_int_equal(listen(worker.tcp, 10), EXIT_SUCCESS);
+
+	// The rows test_setup_sqlite_db() put there
+	test_io_uring_logged before = { 0, 0 };
+	assert_int_equal(db_each_honey_row_since(0, test_io_uring_count,
+						 &before, config),
+			 EXIT_SUCCESS);
+
+	pthread_t thread;
+	assert_int_equal(pthread_create(&thread, NULL, test_io_uring_serve,
+					&worker),
+			 EXIT_SUCCESS);
+
+	// Both wait in the socket buffers until the worker is ready for them
+	SOCKET sender = socket(AF_INET, SOCK_DGRAM, 0);
+	assert_true(ISVALIDSOCKET(sender));
+	assert_int_equal(sendto(sender, TEST_SIP_OPTIONS,
+				strlen(TEST_SIP_OPTIONS), 0,
+				(struct sockaddr *)&bound, sizeof(bound)),
+			 strlen(TEST_SIP_OPTIONS));
+	CLOSESOCKET(sender);
+
+	SOCKET client = socket(AF_INET, SOCK_STREAM, 0);
+	assert_true(ISVALIDSOCKET(client));
+	assert_int_equal(connect(client, (struct sockaddr *)&bound,
+				 sizeof(bound)),
+			 EXIT_SUCCESS);
+	assert_int_equal(send(client, TEST_SIP_OPTIONS,
+			      strlen(TEST_SIP_OPTIONS), 0),
+			 strlen(TEST_SIP_OPTIONS));
+
+	// Up to 5 seconds for both to be logged
+	test_io_uring_logged logged = before;
+	struct timespec pause = { 0, 100 * 1000 * 1000 };
+	for (int i = 0; i < 50 && !atomic_load(&worker.done) &&
+			(logged.udp == before.udp || logged.tcp == before.tcp);
+	     i++) {
+		nanosleep(&pause, NULL);
+		logged.udp = 0;
+		logged.tcp = 0;
+		assert_int_equal(db_each_honey_row_since(0, test_io_uring_count,
+							 &logged, config),
+				 EXIT_SUCCESS);
+	}
+
+	sip_daemon_io_uring_stop(worker.stop_fd);
+	assert_int_equal(pthread_join(thread, NULL), EXIT_SUCCESS);
+	CLOSESOCKET(client);
+	CLOSESOCKET(worker.udp);
+	CLOSESOCKET(worker.tcp);
+	close(worker.stop_fd);
+
+	// No io_uring here, e.g. seccomp or kernel.io_uring_disabled
+	if (atomic_load(&worker.status) == SIP_IO_URING_UNSUPPORTED) {
+		skip();
+	}
+	assert_int_equal(atomic_load(&worker.status), EXIT_SUCCESS);
+	assert_int_equal(logged.udp, before.udp + 1);
+	assert_int_equal(logged.tcp, before.tcp + 1);
+}
@@ -15,5 +15,8 @@
 #define SENTRYPEER_TEST_SIP_DAEMON_H 1
 
 void test_sip_daemon(void **state);
+void test_sip_daemon_steering(void **state);
+void test_sip_daemon_io_uring(void **state);
+void test_sip_daemon_io_uring_events(void **state);
 
 #endif //SENTRYPEER_TEST_SIP_DAEMON_H
@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only  */
+/* Copyright (c) 2021 - 2026 Gavin Henry <ghenry@sentrypeer.org> */
+/* 
+   _____            _              _____
+  / ____|          | |            |  __ \
+ | (___   ___ _ __ | |_ _ __ _   _| |__) |__  ___ _ __
+  \___ \ / _ \ '_ \| __| '__| | | |  ___/ _ \/ _ \ '__|
+  ____) |  __/ | | | |_| |  | |_| | |  |  __/  __/ |
+ |_____/ \___|_| |_|\__|_|   \__, |_|   \___|\___|_|
+                              __/ |
+                             |___/
+*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <cmocka.h>
+
+#include "test_tcp_conn_table.h"
+#include "../../src/tcp_conn_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+typedef struct closed closed;
+struct closed {
+	int count;
+	SOCKET socket;
+	int reason;
+};
+
+static void on_close(SOCKET socket_client, int reason, void *data, void *arg)
+{
+	(void)data;
+	closed *last = (closed *)arg;
+	last->count++;
+	last->socket = socket_client;
+	last->reason = reason;
+}
+
+static struct sockaddr_in address_of(const char *ip)
+{
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	inet_pton(AF_INET, ip, &address.sin_addr);
+
+	return address;
+}
+
+void test_tcp_conn_table(void **state)
+{
+	(void)state; /* unused */
+
+	closed last = { 0 };
+	struct sockaddr_in scanner = address_of("198.51.100.1");
+	struct sockaddr_in other = address_of("203.0.113.7");
+
+	// Idle timeout 10, lifetime 100, from time 1000
+	tcp_conn_table *table =
+		tcp_conn_table_new(4, 2, 10, 100, 1000, on_close, &last);
+	assert_non_null(table);
+
+	tcp_conn *quiet = tcp_conn_table_add(
+		table, 10, (struct sockaddr *)&scanner, 0, 1000);
+	tcp_conn *chatty = tcp_conn_table_add(
+		table, 11, (struct sockaddr *)&other, 0, 1000);
+	assert_non_null(quiet);
+	assert_non_null(chatty);
+	assert_int_equal(tcp_conn_table_count(table), 2);
+	assert_int_equal(
+		tcp_conn_table_count_ip(table, (struct sockaddr *)&scanner), 1);
+
+	// Reads put off the idle timeout, but not the lifetime one
+	for (uint64_t now = 1001; now < 1100; now++) {
+		tcp_conn_table_touch(table, chatty, now);
+		tcp_conn_table_expire(table, now);
+		if (now == 1009) {
+			assert_int_equal(last.count, 0);
+		}
+		if (now == 1010) {
+			assert_int_equal(last.count, 1);
+			assert_int_equal(last.socket, 10);
+			assert_int_equal(last.reason, TCP_CONN_IDLE);
+		}
+	}
+	assert_int_equal(last.count, 1);
+	tcp_conn_table_expire(table, 1100);
+	assert_int_equal(last.count, 2);
+	assert_int_equal(last.socket, 11);
+	assert_int_equal(last.reason, TCP_CONN_LIFETIME);
+	assert_int_equal(tcp_conn_table_count(table), 0);
+
+	// The third from one address pushes out the one quiet longest
+	tcp_conn *first =
+		tcp_conn_table_add(table, 20, (struct sockaddr *)&scanner, 0, 1200);
+	tcp_conn_table_add(table, 21, (struct sockaddr *)&scanner, 0, 1201);
+	tcp_conn_table_touch(table, first, 1202);
+	tcp_conn_table_add(table, 22, (struct sockaddr *)&scanner, 0, 1203);
+	assert_int_equal(last.count, 3);
+	assert_int_equal(last.socket, 21);
+	assert_int_equal(last.reason, TCP_CONN_EVICTED);
+	assert_int_equal(
+		tcp_conn_table_count_ip(table, (struct sockaddr *)&scanner), 2);
+
+	// And the fifth from anywhere pushes out the one quiet longest of all
+	struct sockaddr_in third = address_of("192.0.2.9");
+	tcp_conn *removed =
+		tcp_conn_table_add(table, 23, (struct sockaddr *)&other, 0, 1204);
+	tcp_conn_table_add(table, 24, (struct sockaddr *)&third, 0, 1205);
+	assert_int_equal(tcp_conn_table_count(table), 4);
+	tcp_conn_table_add(table, 25, (struct sockaddr *)&third, 0, 1206);
+	assert_int_equal(last.count, 4);
+	assert_int_equal(last.socket, 20);
+	assert_int_equal(last.reason, TCP_CONN_EVICTED);
+	assert_int_equal(
+		tcp_conn_table_count_ip(table, (struct sockaddr *)&scanner), 1);
+
+	// Removed by us, so no close_fn
+	tcp_conn_table_remove(table, removed);
+	assert_int_equal(last.count, 4);
+	assert_int_equal(tcp_conn_table_count(table), 3);
+	assert_int_equal(
+		tcp_conn_table_count_ip(table, (struct sockaddr *)&other), 0);
+
+	// Anything left is handed over on the way out
+	tcp_conn_table_destroy(&table);
+	assert_null(table);
+	assert_int_equal(last.count, 7);
+	assert_int_equal(last.reason, TCP_CONN_SHUTDOWN);
+}
@@ -71,6 +71,56 @@ void test_utils(void **state)
 	assert_string_not_equal(uuid_string, "");
 	assert_string_not_equal(uuid_string,
 				"00000000-0000-0000-0000-000000000000");
+	assert_int_equal(strlen(uuid_string), UTILS_UUID_STRING_LEN - 1);
+	assert_true(is_valid_uuid(uuid_string));
+	assert_int_equal(uuid_string[14], '4');
+	assert_non_null(strchr("89ab", uuid_string[19]));
+
+	// Enough to need more than one batch of random bytes
+	char previous_uuid[UTILS_UUID_STRING_LEN];
+	util_uuid7_generate_string(previous_uuid);
+	for (int i = 0; i < 100; i++) {
+		char uuid7_string[UTILS_UUID_STRING_LEN];
+		util_uuid7_generate_string(uuid7_string);
+		assert_true(is_valid_uuid(uuid7_string));
+		assert_int_equal(uuid7_string[14], '7');
+		assert_non_null(strchr("89ab", uuid7_string[19]));
+		assert_string_not_equal(uuid7_string, previous_uuid);
+		// Time ordered, to the millisecond
+		assert_true(strncmp(previous_uuid, uuid7_string, 13) <= 0);
+		memcpy(previous_uuid, uuid7_string, sizeof(previous_uuid));
+	}
+
+	// event_timestamp, always with all nine digits of nanoseconds
+	char timestamp[TIMESTAMP_LEN];
+	for (int i = 0; i < 3; i++) {
+		assert_non_null(event_timestamp(timestamp));
+		assert_int_equal(strlen(timestamp), 29);
+		assert_int_equal(timestamp[19], '.');
+		assert_int_equal(strspn(timestamp + 20, "0123456789"), 9);
+		assert_true(util_parse_event_timestamp(timestamp) > 0);
+	}
+
+	// Parsed by hand, so check they come back the same in and across
+	// local hours
+	const char *timestamps[] = { "2026-10-19 11:10:35.101453120",
+				     "2026-10-19 11:59:59", "2026-10-19 12:00:00",
+				     "2024-02-29 23:59:59", "2000-01-01 00:00:00" };
+	for (size_t i = 0; i < sizeof(timestamps) / sizeof(timestamps[0]);
+	     i++) {
+		char formatted[TIMESTAMP_LEN];
+		util_format_seen_time(util_parse_event_timestamp(timestamps[i]),
+				      formatted, sizeof(formatted));
+		assert_int_equal(strncmp(formatted, timestamps[i], 19), 0);
+	}
+	assert_int_equal(util_parse_event_timestamp("2026-10-19 12:00:00") -
+				 util_parse_event_timestamp("2026-10-19 11:59:59"),
+			 1);
+	assert_int_equal(util_parse_event_timestamp(0), 0);
+	assert_int_equal(util_parse_event_timestamp("2026-10-19"), 0);
+	assert_int_equal(util_parse_event_timestamp("2026-13-19 11:10:35"), 0);
+	assert_int_equal(util_parse_event_timestamp("2026-10-19T11:10:35"), 0);
+	assert_int_equal(util_parse_event_timestamp("2026-10-19 1:10:35"), 0);
 
 	// valid_ip_address_format
 	assert_int_equal(valid_ip_address_format("127.0.0.1"), EXIT_SUCCESS);